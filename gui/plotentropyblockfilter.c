@@ -39,7 +39,6 @@ static char copyright[] =
 #include <config.h>
 #endif
 
-#include <math.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -51,14 +50,11 @@ static char copyright[] =
 #include "writer.h"
 #include "filter.h"
 #include "msgprinter.h"
-
-#define NUM_BYTE_VAL   256
-
-#define RDD_LN2        0.69314718055994530942
+#include "histogram.h"
 
 typedef struct _RDD_PLOTENTROPY_BLOCKFILTER {
 	rdd_count_t     blocknum;
-	unsigned        histogram[NUM_BYTE_VAL];
+	RDD_HISTOGRAM   hist;
 	void          (*handler)(unsigned blocknum, double entropy, void *env);
 	void           *env;
 } RDD_PLOTENTROPY_BLOCKFILTER;
@@ -94,10 +90,13 @@ rddgui_new_plotentropy_blockfilter(RDD_FILTER **self, unsigned blocksize,
 	}
 	state = (RDD_PLOTENTROPY_BLOCKFILTER *) f->state;
 
+	if ((rc = rdd_hist_init(&state->hist, blocksize)) != RDD_OK) {
+		goto error;
+	}
+
 	state->handler = entropy_handler;
 	state->env = env;
 	state->blocknum = 0;
-	memset(state->histogram, 0, sizeof(state->histogram));
 
 	*self = f;
 	return RDD_OK;
@@ -109,31 +108,6 @@ error:
 	return rc;
 }
 
-/** Computes block statistics based on the byte-value histogram.
- *  The modus is the byte value that occurs most in the block.
- *  Entropy measures randomness in a block.  It is computed as
- *  sum(-Pi * (log2(Pi))), where Pi is the occurrence frequency of
- *  byte value i and where i ranges over all byte values with positive Pi.
- */
-static void
-compute_histogram_stats(RDD_PLOTENTROPY_BLOCKFILTER *state, unsigned block_size,
-	double *entropy)
-{
-	unsigned byte, count;
-	double p, ent;
-
-	ent = 0.0;
-	for (byte = 0; byte < NUM_BYTE_VAL; byte++) {
-		count = state->histogram[byte];
-		if (count > 0) {
-			p = ((double) count) / ((double) block_size);
-			ent += -p * (log(p) / RDD_LN2);
-		}
-	}
-
-	*entropy = ent;
-}
-
 /** Uses the byte values in buf to update the histogramming
  *  statistics for the current block.
  */
@@ -141,32 +115,28 @@ static int
 plotentropy_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 {
 	RDD_PLOTENTROPY_BLOCKFILTER *state = (RDD_PLOTENTROPY_BLOCKFILTER *) f->state;
-	unsigned byte;
-	unsigned i;
 
-	for (i = 0; i < nbyte; i++) {
-		byte = buf[i];
-		state->histogram[byte]++;
-	}
+	rdd_hist_add(&state->hist, buf, nbyte);
 
 	return RDD_OK;
 }
 
-/** Computes and outputs the per-block histogramming statistics:
- *  entropy, mininum byte value, maximum byte value, and modus.
+/** Computes the entropy of the current block and passes it to
+ *  the handler.
  */
 static int
 plotentropy_block(RDD_FILTER *f, unsigned nbyte)
 {
 	RDD_PLOTENTROPY_BLOCKFILTER *state = (RDD_PLOTENTROPY_BLOCKFILTER *) f->state;
-	double entropy;
+	unsigned counts[RDD_HIST_NVAL];
+	RDD_HIST_STATS stats;
 
-	compute_histogram_stats(state, nbyte, &entropy);
+	rdd_hist_take(&state->hist, counts);
+	rdd_hist_stats(&state->hist, counts, nbyte, &stats);
 
-	(*state->handler)(state->blocknum, entropy, state->env);
+	(*state->handler)(state->blocknum, stats.entropy, state->env);
 
 	state->blocknum++;
-	memset(state->histogram, 0, sizeof(state->histogram));
 
 	return RDD_OK;
 }
@@ -180,5 +150,9 @@ plotentropy_close(RDD_FILTER *f)
 static int
 plotentropy_free(RDD_FILTER *f)
 {
+	RDD_PLOTENTROPY_BLOCKFILTER *state = (RDD_PLOTENTROPY_BLOCKFILTER *) f->state;
+
+	rdd_hist_free(&state->hist);
+
 	return RDD_OK;
 }
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Implements a reader that decodes an adaptive codec stream (see
+ * codec.h) that it reads from its parent reader.
+ *
+ * Stored chunks are copied from the parent straight into the
+ * caller's buffer and zero runs are produced without any input.
+ * A compressed chunk is read and decompressed as a whole; its
+ * decoded size is known from the chunk header.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#endif
+#if defined(HAVE_LIBLZ4)
+#include <lz4frame.h>
+#endif
+
+#include "rdd.h"
+#include "reader.h"
+#include "codec.h"
+
+typedef struct _RDD_ADAPT_READER {
+	RDD_READER    *parent;
+	unsigned       codec;
+	int            header_done;	/* stream header read? */
+	unsigned       kind;		/* type of the current chunk */
+	rdd_count_t    avail;		/* #bytes of it not yet returned */
+	unsigned char *zbuf;		/* compressed data */
+	unsigned       zbufsize;
+	unsigned char *rbuf;		/* decompressed data */
+	unsigned       rbufsize;
+	unsigned       rpos;		/* next byte to return from rbuf */
+#if defined(HAVE_LIBZSTD)
+	ZSTD_DCtx     *zstd;
+#endif
+#if defined(HAVE_LIBLZ4)
+	LZ4F_dctx     *lz4;
+#endif
+	rdd_count_t    pos;
+} RDD_ADAPT_READER;
+
+
+/* Forward declarations
+ */
+static int rdd_adapt_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_adapt_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_adapt_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_adapt_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS adapt_read_ops = {
+	rdd_adapt_read,
+	rdd_adapt_tell,
+	rdd_adapt_seek,
+	rdd_adapt_close
+};
+
+static void
+free_contexts(RDD_ADAPT_READER *state)
+{
+#if defined(HAVE_LIBZSTD)
+	if (state->zstd != 0) {
+		ZSTD_freeDCtx(state->zstd);
+		state->zstd = 0;
+	}
+#endif
+#if defined(HAVE_LIBLZ4)
+	if (state->lz4 != 0) {
+		LZ4F_freeDecompressionContext(state->lz4);
+		state->lz4 = 0;
+	}
+#endif
+}
+
+int
+rdd_open_adaptive_codec_reader(RDD_READER **self, RDD_READER *parent,
+		unsigned codec)
+{
+	RDD_READER *r = 0;
+	RDD_ADAPT_READER *state = 0;
+	int rc = RDD_OK;
+
+	if (! rdd_codec_supported(codec)) {
+		return RDD_ECOMPRESS;
+	}
+
+	rc = rdd_new_reader(&r, &adapt_read_ops, sizeof(RDD_ADAPT_READER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_ADAPT_READER *) r->state;
+	memset(state, 0, sizeof(RDD_ADAPT_READER));
+	state->parent = parent;
+	state->codec = codec;
+
+#if defined(HAVE_LIBZSTD)
+	if (codec == RDD_CODEC_ZSTD && (state->zstd = ZSTD_createDCtx()) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+#endif
+#if defined(HAVE_LIBLZ4)
+	if (codec == RDD_CODEC_LZ4
+	&&  LZ4F_isError(LZ4F_createDecompressionContext(&state->lz4,
+				LZ4F_VERSION))) {
+		state->lz4 = 0;
+		rc = RDD_NOMEM;
+		goto error;
+	}
+#endif
+
+	*self = r;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (state != 0) {
+		free_contexts(state);
+		free(state);
+	}
+	if (r != 0) free(r);
+	return rc;
+}
+
+/* Reads up to nbyte bytes from the parent; reads fewer bytes only at
+ * the end of the input.
+ */
+static int
+read_full(RDD_ADAPT_READER *state, unsigned char *buf, unsigned nbyte,
+		unsigned *nread)
+{
+	unsigned n;
+	int rc;
+
+	*nread = 0;
+	while (*nread < nbyte) {
+		rc = rdd_reader_read(state->parent, buf + *nread,
+				nbyte - *nread, &n);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if (n == 0) {
+			break;
+		}
+		*nread += n;
+	}
+	return RDD_OK;
+}
+
+/* Makes sure that *bufp holds at least size bytes.
+ */
+static int
+grow_buffer(unsigned char **bufp, unsigned *bufsize, unsigned size)
+{
+	unsigned char *buf;
+
+	if (*bufsize >= size) {
+		return RDD_OK;
+	}
+	if ((buf = malloc(size)) == 0) {
+		return RDD_NOMEM;
+	}
+	free(*bufp);
+	*bufp = buf;
+	*bufsize = size;
+	return RDD_OK;
+}
+
+/* Decompresses zlen bytes in zbuf to exactly rawlen bytes in rbuf.
+ */
+static int
+decode_chunk(RDD_ADAPT_READER *state, unsigned zlen, unsigned rawlen)
+{
+	uLongf outlen;
+#if defined(HAVE_LIBLZ4)
+	size_t in, out, n, m, hint;
+#endif
+#if defined(HAVE_LIBZSTD)
+	size_t zn;
+#endif
+
+	switch (state->codec) {
+	case RDD_CODEC_ZLIB:
+		outlen = rawlen;
+		if (uncompress(state->rbuf, &outlen, state->zbuf, zlen) != Z_OK
+		||  outlen != rawlen) {
+			return RDD_ECOMPRESS;
+		}
+		return RDD_OK;
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		zn = ZSTD_decompressDCtx(state->zstd, state->rbuf, rawlen,
+				state->zbuf, zlen);
+		if (ZSTD_isError(zn) || zn != rawlen) {
+			return RDD_ECOMPRESS;
+		}
+		return RDD_OK;
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		in = out = 0;
+		do {
+			n = rawlen - out;
+			m = zlen - in;
+			hint = LZ4F_decompress(state->lz4, state->rbuf + out,
+					&n, state->zbuf + in, &m, 0);
+			if (LZ4F_isError(hint) || (n == 0 && m == 0)) {
+				return RDD_ECOMPRESS;
+			}
+			out += n;
+			in += m;
+		} while (hint != 0 && in < zlen);
+		if (hint != 0 || in != zlen || out != rawlen) {
+			return RDD_ECOMPRESS;
+		}
+		return RDD_OK;
+#endif
+	default:
+		(void) outlen;
+		return RDD_ECOMPRESS;
+	}
+}
+
+static unsigned long
+get_be(const unsigned char *p, unsigned nbyte)
+{
+	unsigned long v = 0;
+
+	while (nbyte-- > 0) {
+		v = (v << 8) | *p++;
+	}
+	return v;
+}
+
+static int
+read_stream_header(RDD_ADAPT_READER *state)
+{
+	unsigned char hdr[RDD_ADAPT_HDR_SIZE];
+	unsigned n;
+	int rc;
+
+	if ((rc = read_full(state, hdr, sizeof hdr, &n)) != RDD_OK) {
+		return rc;
+	}
+	if (n != sizeof hdr
+	||  memcmp(hdr, RDD_ADAPT_MAGIC, 4) != 0
+	||  hdr[4] != RDD_ADAPT_VERSION
+	||  hdr[5] != state->codec) {
+		return RDD_ECOMPRESS;
+	}
+	state->header_done = 1;
+	return RDD_OK;
+}
+
+/* Reads the next chunk header and, for a compressed chunk, the
+ * chunk's data.  Sets *eof at the end of the stream.
+ */
+static int
+next_chunk(RDD_ADAPT_READER *state, int *eof)
+{
+	unsigned char hdr[RDD_ADAPT_CHUNK_HDR_SIZE];
+	unsigned datalen;
+	rdd_count_t rawlen;
+	unsigned n;
+	int rc;
+
+	*eof = 0;
+	if (!state->header_done
+	&&  (rc = read_stream_header(state)) != RDD_OK) {
+		return rc;
+	}
+
+	if ((rc = read_full(state, hdr, sizeof hdr, &n)) != RDD_OK) {
+		return rc;
+	}
+	if (n == 0) {
+		*eof = 1;
+		return RDD_OK;
+	}
+	if (n != sizeof hdr || hdr[1] != 0 || hdr[2] != 0 || hdr[3] != 0) {
+		return RDD_ECOMPRESS;
+	}
+	datalen = (unsigned) get_be(hdr + 4, 4);
+	rawlen = ((rdd_count_t) get_be(hdr + 8, 4) << 32)
+		| (rdd_count_t) get_be(hdr + 12, 4);
+
+	switch (hdr[0]) {
+	case RDD_ADAPT_ZERO:
+		if (datalen != 0) {
+			return RDD_ECOMPRESS;
+		}
+		break;
+	case RDD_ADAPT_STORED:
+		if (rawlen != datalen || datalen > RDD_ADAPT_MAX_CHUNK) {
+			return RDD_ECOMPRESS;
+		}
+		break;
+	case RDD_ADAPT_COMPRESSED:
+		if (rawlen > RDD_ADAPT_MAX_CHUNK || rawlen == 0
+		||  datalen > 2 * RDD_ADAPT_MAX_CHUNK) {
+			return RDD_ECOMPRESS;
+		}
+		rc = grow_buffer(&state->zbuf, &state->zbufsize, datalen);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		rc = grow_buffer(&state->rbuf, &state->rbufsize,
+				(unsigned) rawlen);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if ((rc = read_full(state, state->zbuf, datalen, &n)) != RDD_OK) {
+			return rc;
+		}
+		if (n != datalen) {
+			return RDD_ECOMPRESS;
+		}
+		rc = decode_chunk(state, datalen, (unsigned) rawlen);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		state->rpos = 0;
+		break;
+	default:
+		return RDD_ECOMPRESS;
+	}
+
+	state->kind = hdr[0];
+	state->avail = rawlen;
+	return RDD_OK;
+}
+
+static int
+rdd_adapt_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+			unsigned *nread)
+{
+	RDD_ADAPT_READER *state = self->state;
+	unsigned done = 0;
+	unsigned n, got;
+	int eof;
+	int rc;
+
+	*nread = 0;
+
+	while (done < nbyte) {
+		if (state->avail == 0) {
+			if ((rc = next_chunk(state, &eof)) != RDD_OK) {
+				return rc;
+			}
+			if (eof) {
+				break;
+			}
+			continue;
+		}
+
+		n = nbyte - done;
+		if (n > state->avail) {
+			n = (unsigned) state->avail;
+		}
+		switch (state->kind) {
+		case RDD_ADAPT_ZERO:
+			memset(buf + done, 0, n);
+			break;
+		case RDD_ADAPT_STORED:
+			rc = read_full(state, buf + done, n, &got);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			if (got != n) {
+				return RDD_ECOMPRESS;	/* truncated */
+			}
+			break;
+		default:
+			memcpy(buf + done, state->rbuf + state->rpos, n);
+			state->rpos += n;
+			break;
+		}
+		state->avail -= n;
+		done += n;
+	}
+
+	*nread = done;
+	state->pos += done;
+	return RDD_OK;
+}
+
+static int
+rdd_adapt_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_ADAPT_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_adapt_seek(RDD_READER *self, rdd_count_t pos)
+{
+	return RDD_ESEEK;	/* not implemented */
+}
+
+static int
+rdd_adapt_close(RDD_READER *self, int recurse)
+{
+	RDD_ADAPT_READER *state = self->state;
+	int rc;
+
+	free_contexts(state);
+
+	if (recurse) {
+		if ((rc = rdd_reader_close(state->parent, 1)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	free(state->zbuf);
+	free(state->rbuf);
+	state->zbuf = 0;
+	state->rbuf = 0;
+
+	return RDD_OK;
+}
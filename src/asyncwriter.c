@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * An async writer decouples its client from a slow output channel.
+ * It copies the data written to it into the slots of a bounded buffer
+ * queue (see bufqueue.h); a writer thread takes the slots from the
+ * queue, in order, and writes them to the parent writer.  The client
+ * only waits when all slots are full.
+ *
+ * A write error in the writer thread aborts the queue.  The error is
+ * returned by the client's next write, by a checkpoint save, or by
+ * close.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "writer.h"
+#include "bufqueue.h"
+#include "checkpoint.h"
+
+/* Forward declarations
+ */
+static int async_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int async_close(RDD_WRITER *w);
+static int async_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int async_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp,
+			const char *name);
+static int async_holes(RDD_WRITER *w, rdd_count_t *nbyte);
+
+static RDD_WRITE_OPS async_write_ops = {
+	async_write,
+	async_close,
+	async_save,
+	async_restore,
+	async_holes
+};
+
+typedef struct _RDD_ASYNC_WRITER {
+	RDD_WRITER     *parent;
+	RDD_BUFQUEUE   *queue;
+	unsigned        nbuf;
+	RDD_BUFQ_SLOT  *slot;		/* slot being filled, or 0 */
+	pthread_t       thread;
+
+	pthread_mutex_t lock;		/* protects the fields below */
+	pthread_cond_t  written;	/* signalled after each slot */
+	unsigned long   nput;		/* #slots handed to the thread */
+	unsigned long   nwritten;	/* #slots written by the thread */
+	int             write_rc;	/* first error of the thread */
+} RDD_ASYNC_WRITER;
+
+/* Body of the writer thread.
+ */
+static void *
+write_stage(void *arg)
+{
+	RDD_ASYNC_WRITER *s = (RDD_ASYNC_WRITER *) arg;
+	RDD_BUFQ_SLOT *slot;
+	int rc;
+
+	while ((rc = rdd_bufq_get_full(s->queue, &slot)) == RDD_OK) {
+		rc = rdd_writer_write(s->parent, slot->buf, slot->len);
+		if (rc != RDD_OK) {
+			break;
+		}
+		if ((rc = rdd_bufq_put_free(s->queue, slot)) != RDD_OK) {
+			break;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		s->nwritten++;
+		pthread_cond_signal(&s->written);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	if (rc != RDD_NOTFOUND) {
+		/* Stop the client; it sees rc on its next write.
+		 */
+		rdd_bufq_abort(s->queue, rc);
+
+		pthread_mutex_lock(&s->lock);
+		if (s->write_rc == RDD_OK) {
+			s->write_rc = rc;
+		}
+		pthread_cond_signal(&s->written);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return 0;
+}
+
+int
+rdd_open_async_writer(RDD_WRITER **self, RDD_WRITER *parent,
+			unsigned nbuf, unsigned bufsize)
+{
+	RDD_WRITER *w = 0;
+	RDD_ASYNC_WRITER *state = 0;
+	int rc = RDD_OK;
+
+	if (nbuf < 2 || bufsize == 0) return RDD_BADARG;
+
+	rc = rdd_new_writer(&w, &async_write_ops, sizeof(RDD_ASYNC_WRITER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_ASYNC_WRITER *) w->state;
+	state->parent = parent;
+	state->nbuf = nbuf;
+	state->slot = 0;
+	state->nput = 0;
+	state->nwritten = 0;
+	state->write_rc = RDD_OK;
+
+	rc = rdd_new_bufqueue(&state->queue, nbuf, bufsize, RDD_SECTOR_SIZE);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+
+	pthread_mutex_init(&state->lock, 0);
+	pthread_cond_init(&state->written, 0);
+	if (pthread_create(&state->thread, 0, write_stage, state) != 0) {
+		pthread_cond_destroy(&state->written);
+		pthread_mutex_destroy(&state->lock);
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (state->queue != 0) rdd_free_bufqueue(state->queue);
+	free(state);
+	free(w);
+	return rc;
+}
+
+/* Hands the slot being filled, if any, to the writer thread.
+ */
+static int
+put_slot(RDD_ASYNC_WRITER *s)
+{
+	int rc;
+
+	if (s->slot == 0 || s->slot->len == 0) {
+		return RDD_OK;
+	}
+	if ((rc = rdd_bufq_put_full(s->queue, s->slot)) != RDD_OK) {
+		return rc;
+	}
+	s->slot = 0;
+
+	pthread_mutex_lock(&s->lock);
+	s->nput++;
+	pthread_mutex_unlock(&s->lock);
+
+	return RDD_OK;
+}
+
+/* Waits until the writer thread has written all slots handed to it.
+ * Returns the thread's error status.
+ */
+static int
+drain(RDD_ASYNC_WRITER *s)
+{
+	int rc;
+
+	if ((rc = put_slot(s)) != RDD_OK) {
+		return rc;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	while (s->write_rc == RDD_OK && s->nwritten < s->nput) {
+		pthread_cond_wait(&s->written, &s->lock);
+	}
+	rc = s->write_rc;
+	pthread_mutex_unlock(&s->lock);
+
+	return rc;
+}
+
+static int
+async_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_ASYNC_WRITER *s = w->state;
+	RDD_BUFQ_SLOT *slot;
+	unsigned n;
+	int rc;
+
+	while (nbyte > 0) {
+		if (s->slot == 0) {
+			/* Blocks while all slots are full; fails with the
+			 * writer thread's error after a write error.
+			 */
+			if ((rc = rdd_bufq_get_free(s->queue, &slot)) != RDD_OK) {
+				return rc;
+			}
+			s->slot = slot;
+		}
+		slot = s->slot;
+
+		n = slot->size - slot->len;
+		if (n > nbyte) {
+			n = nbyte;
+		}
+		memcpy(slot->buf + slot->len, buf, n);
+		slot->len += n;
+		buf += n;
+		nbyte -= n;
+
+		if (slot->len == slot->size && (rc = put_slot(s)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+static int
+async_close(RDD_WRITER *w)
+{
+	RDD_ASYNC_WRITER *s = w->state;
+	int rc;
+
+	rc = put_slot(s);
+	rdd_bufq_close(s->queue);
+	pthread_join(s->thread, 0);
+
+	if (rc == RDD_OK) {
+		rc = s->write_rc;
+	}
+
+	pthread_cond_destroy(&s->written);
+	pthread_mutex_destroy(&s->lock);
+	rdd_free_bufqueue(s->queue);
+	s->queue = 0;
+
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_close(s->parent);
+}
+
+/* All data written so far must be in the parent before the parent
+ * can save its position.
+ */
+static int
+async_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_ASYNC_WRITER *s = w->state;
+	int rc;
+
+	if ((rc = drain(s)) != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_save(s->parent, cp, name);
+}
+
+static int
+async_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_ASYNC_WRITER *s = w->state;
+	int rc;
+
+	if ((rc = drain(s)) != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_restore(s->parent, cp, name);
+}
+
+static int
+async_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	RDD_ASYNC_WRITER *s = w->state;
+	int rc;
+
+	if ((rc = drain(s)) != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_holes(s->parent, nbyte);
+}
+
+int
+rdd_async_writer_stats(RDD_WRITER *w, RDD_ASYNC_STATS *stats)
+{
+	RDD_ASYNC_WRITER *s;
+	RDD_BUFQ_STATS qstats;
+	int rc;
+
+	if (w->ops != &async_write_ops) {
+		return RDD_BADARG;
+	}
+	s = w->state;
+
+	if ((rc = rdd_bufq_get_stats(s->queue, &qstats)) != RDD_OK) {
+		return rc;
+	}
+	stats->nbuf = s->nbuf;
+	stats->depth = rdd_bufq_depth(s->queue);
+	stats->maxdepth = qstats.maxdepth;
+	stats->stall = qstats.put_wait;
+	stats->idle = qstats.get_wait;
+
+	return RDD_OK;
+}
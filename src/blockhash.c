@@ -0,0 +1,667 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Binary block-hash files (see blockhash.h).
+ *
+ * Writers produce the digests themselves (see md5blockfilter.c) and
+ * call rdd_blockhash_finish() at the end.  Readers map the whole file
+ * into memory; digests and index entries are accessed in place.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "blockhash.h"
+
+#define INDEX_ENTRY_SIZE(ds)	((ds) + 8)
+
+/* An index entry as it is sorted in memory.  Only MD5 digests are
+ * supported for now.
+ */
+typedef struct _RDD_BLOCKHASH_ENTRY {
+	unsigned char digest[RDD_BLOCKHASH_MD5_SIZE];
+	RDD_UINT64    blocknum;
+} RDD_BLOCKHASH_ENTRY;
+
+static void
+put_le(unsigned char *p, rdd_count_t val, unsigned nbyte)
+{
+	unsigned i;
+
+	for (i = 0; i < nbyte; i++) {
+		p[i] = (unsigned char) (val & 0xff);
+		val >>= 8;
+	}
+}
+
+static rdd_count_t
+get_le(const unsigned char *p, unsigned nbyte)
+{
+	rdd_count_t val = 0;
+	unsigned i;
+
+	for (i = nbyte; i > 0; i--) {
+		val = (val << 8) | p[i - 1];
+	}
+	return val;
+}
+
+static int
+compare_entries(const void *p1, const void *p2)
+{
+	const RDD_BLOCKHASH_ENTRY *e1 = (const RDD_BLOCKHASH_ENTRY *) p1;
+	const RDD_BLOCKHASH_ENTRY *e2 = (const RDD_BLOCKHASH_ENTRY *) p2;
+	int cmp;
+
+	cmp = memcmp(e1->digest, e2->digest, sizeof e1->digest);
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (e1->blocknum < e2->blocknum) {
+		return -1;
+	}
+	return e1->blocknum > e2->blocknum;
+}
+
+int
+rdd_blockhash_init_header(RDD_BLOCKHASH_HEADER *hdr,
+		unsigned algorithm, unsigned blocksize, rdd_count_t offset)
+{
+	if (algorithm != RDD_BLOCKHASH_MD5 || blocksize == 0) {
+		return RDD_BADARG;
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, RDD_BLOCKHASH_MAGIC, sizeof hdr->magic);
+	hdr->version = RDD_BLOCKHASH_VERSION;
+	hdr->algorithm = algorithm;
+	hdr->digestsize = RDD_BLOCKHASH_MD5_SIZE;
+	hdr->blocksize = blocksize;
+	hdr->offset = offset;
+
+	return RDD_OK;
+}
+
+void
+rdd_blockhash_encode_header(const RDD_BLOCKHASH_HEADER *hdr,
+		unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE])
+{
+	memcpy(buf, hdr->magic, sizeof hdr->magic);
+	put_le(buf +  8, hdr->version, 4);
+	put_le(buf + 12, hdr->algorithm, 4);
+	put_le(buf + 16, hdr->digestsize, 4);
+	put_le(buf + 20, hdr->blocksize, 4);
+	put_le(buf + 24, hdr->offset, 8);
+	put_le(buf + 32, hdr->imagesize, 8);
+	put_le(buf + 40, hdr->nblock, 8);
+	put_le(buf + 48, hdr->indexpos, 8);
+	put_le(buf + 56, hdr->flags, 4);
+	put_le(buf + 60, hdr->reserved, 4);
+}
+
+int
+rdd_blockhash_decode_header(const unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE],
+		RDD_BLOCKHASH_HEADER *hdr)
+{
+	memcpy(hdr->magic, buf, sizeof hdr->magic);
+	hdr->version = (RDD_UINT32) get_le(buf + 8, 4);
+	hdr->algorithm = (RDD_UINT32) get_le(buf + 12, 4);
+	hdr->digestsize = (RDD_UINT32) get_le(buf + 16, 4);
+	hdr->blocksize = (RDD_UINT32) get_le(buf + 20, 4);
+	hdr->offset = get_le(buf + 24, 8);
+	hdr->imagesize = get_le(buf + 32, 8);
+	hdr->nblock = get_le(buf + 40, 8);
+	hdr->indexpos = get_le(buf + 48, 8);
+	hdr->flags = (RDD_UINT32) get_le(buf + 56, 4);
+	hdr->reserved = (RDD_UINT32) get_le(buf + 60, 4);
+
+	if (memcmp(hdr->magic, RDD_BLOCKHASH_MAGIC, sizeof hdr->magic) != 0
+	||  hdr->version != RDD_BLOCKHASH_VERSION
+	||  hdr->algorithm != RDD_BLOCKHASH_MD5
+	||  hdr->digestsize != RDD_BLOCKHASH_MD5_SIZE
+	||  hdr->blocksize == 0) {
+		return RDD_ESYNTAX;
+	}
+
+	return RDD_OK;
+}
+
+/* The index is sorted in runs of at most INDEX_RUN entries.  A file
+ * with more blocks is sorted run by run into a scratch area behind
+ * the index, and the runs are then merged into the index.  Merging
+ * buffers about INDEX_RUN entries in total, so building the index
+ * takes a bounded amount of memory for any reasonable file size.
+ */
+#define INDEX_RUN	(1 << 16)	/* entries sorted in memory at once */
+#define MIN_MERGE_BUF	16		/* entries buffered per run */
+
+/* A sorted run on disk and its merge buffer.
+ */
+typedef struct _RDD_INDEX_RUN {
+	off_t                pos;	/* file offset of next unread entry */
+	rdd_count_t          left;	/* #entries not read yet */
+	RDD_BLOCKHASH_ENTRY *buf;
+	unsigned             n;		/* #entries in buf */
+	unsigned             next;	/* next entry in buf */
+} RDD_INDEX_RUN;
+
+/* Reads n digests from in, which is positioned at the digest of
+ * block first.
+ */
+static int
+read_digests(FILE *in, RDD_BLOCKHASH_ENTRY *entries, rdd_count_t first,
+		unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if (fread(entries[i].digest, sizeof entries[i].digest, 1, in)
+		!= 1) {
+			return RDD_EREAD;
+		}
+		entries[i].blocknum = first + i;
+	}
+	return RDD_OK;
+}
+
+/* Writes n entries to fp in index format.
+ */
+static int
+write_entries(FILE *fp, const RDD_BLOCKHASH_ENTRY *entries, unsigned n)
+{
+	unsigned char blocknum[8];
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		put_le(blocknum, entries[i].blocknum, sizeof blocknum);
+		if (fwrite(entries[i].digest, sizeof entries[i].digest, 1, fp) != 1
+		||  fwrite(blocknum, sizeof blocknum, 1, fp) != 1) {
+			return RDD_EWRITE;
+		}
+	}
+	return RDD_OK;
+}
+
+/* Refills the merge buffer of run r from in.
+ */
+static int
+fill_run(FILE *in, RDD_INDEX_RUN *r, unsigned bufsize)
+{
+	unsigned char rec[INDEX_ENTRY_SIZE(RDD_BLOCKHASH_MD5_SIZE)];
+	unsigned i;
+
+	r->n = r->left < bufsize ? (unsigned) r->left : bufsize;
+	r->next = 0;
+	if (fseeko(in, r->pos, SEEK_SET) < 0) {
+		return RDD_ESEEK;
+	}
+	for (i = 0; i < r->n; i++) {
+		if (fread(rec, sizeof rec, 1, in) != 1) {
+			return RDD_EREAD;
+		}
+		memcpy(r->buf[i].digest, rec, sizeof r->buf[i].digest);
+		r->buf[i].blocknum = get_le(rec + sizeof r->buf[i].digest, 8);
+	}
+	r->pos += (off_t) (r->n * sizeof rec);
+	r->left -= r->n;
+	return RDD_OK;
+}
+
+static int
+compare_runs(const RDD_INDEX_RUN *r1, const RDD_INDEX_RUN *r2)
+{
+	return compare_entries(&r1->buf[r1->next], &r2->buf[r2->next]);
+}
+
+/* Restores the heap property of a min-heap of runs whose entry i
+ * may be too large.
+ */
+static void
+sift_down(RDD_INDEX_RUN **heap, unsigned nheap, unsigned i)
+{
+	RDD_INDEX_RUN *tmp;
+	unsigned child;
+
+	for (; (child = 2 * i + 1) < nheap; i = child) {
+		if (child + 1 < nheap
+		&&  compare_runs(heap[child + 1], heap[child]) < 0) {
+			child++;
+		}
+		if (compare_runs(heap[i], heap[child]) <= 0) {
+			break;
+		}
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+	}
+}
+
+/* Merges the nrun sorted runs that start at file offset scratch
+ * into the index; fp must be positioned at the index.
+ */
+static int
+merge_runs(FILE *fp, FILE *in, RDD_BLOCKHASH_HEADER *hdr, off_t scratch,
+		unsigned nrun)
+{
+	RDD_INDEX_RUN *runs = 0;
+	RDD_INDEX_RUN **heap = 0;
+	RDD_BLOCKHASH_ENTRY *bufs = 0;
+	RDD_INDEX_RUN *r;
+	rdd_count_t first;
+	unsigned bufsize;
+	unsigned nheap;
+	unsigned i;
+	int rc = RDD_OK;
+
+	bufsize = INDEX_RUN / nrun;
+	if (bufsize < MIN_MERGE_BUF) {
+		bufsize = MIN_MERGE_BUF;
+	}
+
+	runs = calloc(nrun, sizeof(*runs));
+	heap = calloc(nrun, sizeof(*heap));
+	bufs = malloc((size_t) nrun * bufsize * sizeof(*bufs));
+	if (runs == 0 || heap == 0 || bufs == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	/* Every run but the last has INDEX_RUN entries.
+	 */
+	for (i = 0, first = 0; i < nrun; i++, first += INDEX_RUN) {
+		r = &runs[i];
+		r->pos = scratch + (off_t) (first * INDEX_ENTRY_SIZE(hdr->digestsize));
+		r->left = hdr->nblock - first < INDEX_RUN ?
+				hdr->nblock - first : INDEX_RUN;
+		r->buf = bufs + (size_t) i * bufsize;
+		if ((rc = fill_run(in, r, bufsize)) != RDD_OK) {
+			goto error;
+		}
+		heap[i] = r;
+	}
+
+	/* Build the heap bottom-up, then repeatedly move the smallest
+	 * entry to the index.
+	 */
+	for (i = nrun / 2; i > 0; i--) {
+		sift_down(heap, nrun, i - 1);
+	}
+	nheap = nrun;
+	while (nheap > 0) {
+		r = heap[0];
+		if ((rc = write_entries(fp, &r->buf[r->next], 1)) != RDD_OK) {
+			goto error;
+		}
+		if (++r->next == r->n) {
+			if (r->left == 0) {
+				heap[0] = heap[--nheap];
+			} else if ((rc = fill_run(in, r, bufsize)) != RDD_OK) {
+				goto error;
+			}
+		}
+		sift_down(heap, nheap, 0);
+	}
+
+error:
+	free(bufs);
+	free(heap);
+	free(runs);
+	return rc;
+}
+
+/* Reads the digests back from the output file, sorts them, and
+ * writes the index to fp.
+ */
+static int
+write_index(FILE *fp, const char *path, RDD_BLOCKHASH_HEADER *hdr)
+{
+	RDD_BLOCKHASH_ENTRY *entries = 0;
+	FILE *in = NULL;
+	rdd_count_t first;
+	off_t scratch;
+	unsigned nrun;
+	unsigned n;
+	int rc = RDD_OK;
+
+	if (hdr->digestsize != sizeof entries->digest) {
+		return RDD_BADARG;
+	}
+	if (hdr->nblock == 0) {
+		return RDD_OK;
+	}
+	if ((hdr->nblock + INDEX_RUN - 1) / INDEX_RUN > (unsigned) -1) {
+		return RDD_BADARG;
+	}
+	nrun = (unsigned) ((hdr->nblock + INDEX_RUN - 1) / INDEX_RUN);
+
+	n = hdr->nblock < INDEX_RUN ? (unsigned) hdr->nblock : INDEX_RUN;
+	if ((entries = malloc(n * sizeof(*entries))) == 0) {
+		return RDD_NOMEM;
+	}
+
+	if ((in = fopen(path, "rb")) == NULL) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	if (fseeko(in, (off_t) RDD_BLOCKHASH_HEADER_SIZE, SEEK_SET) < 0) {
+		rc = RDD_ESEEK;
+		goto error;
+	}
+
+	/* A single run is written to the index directly.
+	 */
+	hdr->indexpos = RDD_BLOCKHASH_HEADER_SIZE
+			+ hdr->nblock * hdr->digestsize;
+	scratch = (off_t) (hdr->indexpos
+			+ hdr->nblock * INDEX_ENTRY_SIZE(hdr->digestsize));
+	if (fseeko(fp, nrun == 1 ? (off_t) hdr->indexpos : scratch,
+			SEEK_SET) < 0) {
+		rc = RDD_ESEEK;
+		goto error;
+	}
+	for (first = 0; first < hdr->nblock; first += n) {
+		if (hdr->nblock - first < n) {
+			n = (unsigned) (hdr->nblock - first);
+		}
+		if ((rc = read_digests(in, entries, first, n)) != RDD_OK) {
+			goto error;
+		}
+		qsort(entries, n, sizeof(*entries), compare_entries);
+		if ((rc = write_entries(fp, entries, n)) != RDD_OK) {
+			goto error;
+		}
+	}
+
+	if (nrun > 1) {
+		free(entries);
+		entries = 0;
+		if (fflush(fp) == EOF) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
+		if (fseeko(fp, (off_t) hdr->indexpos, SEEK_SET) < 0) {
+			rc = RDD_ESEEK;
+			goto error;
+		}
+		if ((rc = merge_runs(fp, in, hdr, scratch, nrun)) != RDD_OK) {
+			goto error;
+		}
+		if (fflush(fp) == EOF || ftruncate(fileno(fp), scratch) < 0) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
+	}
+	hdr->flags |= RDD_BLOCKHASH_INDEXED;
+
+error:
+	if (in != NULL) fclose(in);
+	free(entries);
+	return rc;
+}
+
+int
+rdd_blockhash_finish(FILE *fp, const char *path,
+		RDD_BLOCKHASH_HEADER *hdr, int indexed)
+{
+	unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE];
+	int rc;
+
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+
+	hdr->indexpos = 0;
+	hdr->flags &= ~RDD_BLOCKHASH_INDEXED;
+	if (indexed && (rc = write_index(fp, path, hdr)) != RDD_OK) {
+		return rc;
+	}
+
+	hdr->flags |= RDD_BLOCKHASH_FINISHED;
+	if (fseeko(fp, (off_t) 0, SEEK_SET) < 0) {
+		return RDD_ESEEK;
+	}
+	rdd_blockhash_encode_header(hdr, buf);
+	if (fwrite(buf, sizeof buf, 1, fp) != 1) {
+		return RDD_EWRITE;
+	}
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+
+	return RDD_OK;
+}
+
+/* Checks the header of a mapped file and derives the number of
+ * digests of an unfinished file.
+ */
+static int
+check_header(RDD_BLOCKHASH_FILE *bf)
+{
+	RDD_BLOCKHASH_HEADER *hdr = &bf->header;
+	rdd_count_t datasize;
+
+	if (bf->size < RDD_BLOCKHASH_HEADER_SIZE) {
+		return RDD_ESYNTAX;
+	}
+	if (rdd_blockhash_decode_header(bf->base, hdr) != RDD_OK) {
+		return RDD_ESYNTAX;
+	}
+
+	datasize = bf->size - RDD_BLOCKHASH_HEADER_SIZE;
+	if ((hdr->flags & RDD_BLOCKHASH_FINISHED) == 0) {
+		hdr->nblock = datasize / hdr->digestsize;
+		hdr->imagesize = hdr->nblock * hdr->blocksize;
+		hdr->indexpos = 0;
+	} else if (hdr->nblock > datasize / hdr->digestsize) {
+		return RDD_ESYNTAX;
+	}
+
+	bf->digests = bf->base + RDD_BLOCKHASH_HEADER_SIZE;
+	bf->index = 0;
+	if ((hdr->flags & RDD_BLOCKHASH_INDEXED) != 0) {
+		if (hdr->indexpos < RDD_BLOCKHASH_HEADER_SIZE
+		||  hdr->indexpos > bf->size
+		||  hdr->nblock > (bf->size - hdr->indexpos)
+				/ INDEX_ENTRY_SIZE(hdr->digestsize)) {
+			return RDD_ESYNTAX;
+		}
+		bf->index = bf->base + hdr->indexpos;
+	}
+
+	return RDD_OK;
+}
+
+int
+rdd_blockhash_open(RDD_BLOCKHASH_FILE **self, const char *path)
+{
+	RDD_BLOCKHASH_FILE *bf = 0;
+	struct stat info;
+	void *base;
+	int fd = -1;
+	int rc = RDD_OK;
+
+	if ((bf = calloc(1, sizeof(*bf))) == 0) {
+		return RDD_NOMEM;
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	if (fstat(fd, &info) < 0) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	if (!S_ISREG(info.st_mode)
+	||  (size_t) info.st_size < RDD_BLOCKHASH_HEADER_SIZE) {
+		rc = RDD_ESYNTAX;
+		goto error;
+	}
+
+	bf->size = (size_t) info.st_size;
+	base = mmap(0, bf->size, PROT_READ, MAP_SHARED, fd, (off_t) 0);
+	if (base == MAP_FAILED) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	bf->base = (const unsigned char *) base;
+	close(fd);
+	fd = -1;
+
+	if ((rc = check_header(bf)) != RDD_OK) {
+		goto error;
+	}
+
+	*self = bf;
+	return RDD_OK;
+
+error:
+	if (fd >= 0) close(fd);
+	if (bf->base != 0) munmap((void *) bf->base, bf->size);
+	free(bf);
+	*self = 0;
+	return rc;
+}
+
+const unsigned char *
+rdd_blockhash_digest(RDD_BLOCKHASH_FILE *bf, rdd_count_t blocknum)
+{
+	if (blocknum >= bf->header.nblock) {
+		return 0;
+	}
+
+	return bf->digests + blocknum * bf->header.digestsize;
+}
+
+/* Returns the position in the index of the first entry whose digest
+ * is not smaller than digest.
+ */
+static rdd_count_t
+index_lower_bound(RDD_BLOCKHASH_FILE *bf, const unsigned char *digest)
+{
+	unsigned ds = bf->header.digestsize;
+	rdd_count_t lo = 0, hi = bf->header.nblock, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (memcmp(bf->index + mid * INDEX_ENTRY_SIZE(ds), digest, ds) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+int
+rdd_blockhash_lookup(RDD_BLOCKHASH_FILE *bf, const unsigned char *digest,
+		rdd_count_t *blocks, unsigned maxblock, rdd_count_t *nfound)
+{
+	unsigned ds = bf->header.digestsize;
+	const unsigned char *entry;
+	rdd_count_t i, n = 0;
+
+	if (bf->index != 0) {
+		i = index_lower_bound(bf, digest);
+		for (; i < bf->header.nblock; i++) {
+			entry = bf->index + i * INDEX_ENTRY_SIZE(ds);
+			if (memcmp(entry, digest, ds) != 0) {
+				break;
+			}
+			if (n < maxblock) {
+				blocks[n] = get_le(entry + ds, 8);
+			}
+			n++;
+		}
+	} else {
+		for (i = 0; i < bf->header.nblock; i++) {
+			if (memcmp(bf->digests + i * ds, digest, ds) != 0) {
+				continue;
+			}
+			if (n < maxblock) {
+				blocks[n] = i;
+			}
+			n++;
+		}
+	}
+
+	*nfound = n;
+	return RDD_OK;
+}
+
+int
+rdd_blockhash_print(RDD_BLOCKHASH_FILE *bf, FILE *fp)
+{
+	char hex[2*RDD_BLOCKHASH_MD5_SIZE + 1];
+	rdd_count_t i;
+	int rc;
+
+	for (i = 0; i < bf->header.nblock; i++) {
+		rc = rdd_buf2hex(rdd_blockhash_digest(bf, i),
+				bf->header.digestsize, hex, sizeof hex);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if (fprintf(fp, "%llu\t%s\n", (unsigned long long) i, hex) < 0) {
+			return RDD_EWRITE;
+		}
+	}
+
+	return RDD_OK;
+}
+
+void
+rdd_blockhash_close(RDD_BLOCKHASH_FILE *bf)
+{
+	munmap((void *) bf->base, bf->size);
+	free(bf);
+}
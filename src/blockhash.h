@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __blockhash_h__
+#define __blockhash_h__
+
+/** @file
+ *  \brief Binary block-hash files.
+ *
+ *  A block-hash file holds the hash value of every block of an image.
+ *  It consists of a fixed-size header, followed by one raw digest
+ *  per block, in block order, optionally followed by an index.  The
+ *  digest of block \c n is at file offset
+ *  <tt>RDD_BLOCKHASH_HEADER_SIZE + n * digestsize</tt>, so a reader
+ *  can map the file into memory and access any block directly.
+ *
+ *  The index, if present, lists the pairs (digest, block number)
+ *  sorted by digest and then by block number; every entry takes
+ *  <tt>digestsize + 8</tt> bytes.  It allows a reader to find the
+ *  blocks with a given hash value by binary search.
+ *
+ *  All integers are stored in little-endian byte order, so a file
+ *  can be read on any machine.  The header is written twice: once, with zero
+ *  counts, when the file is created, and once more, complete, when
+ *  the file is finished.  A reader that finds an unfinished file
+ *  derives the number of digests from the file size.
+ */
+
+#define RDD_BLOCKHASH_MAGIC	"RDDBHASH"
+#define RDD_BLOCKHASH_VERSION	0x0100
+
+#define RDD_BLOCKHASH_MD5	0x1	/**< algorithm: MD5 */
+
+#define RDD_BLOCKHASH_MD5_SIZE	16	/**< size of an MD5 digest */
+
+#define RDD_BLOCKHASH_HEADER_SIZE	64	/**< size of an encoded header */
+
+#define RDD_BLOCKHASH_FINISHED	0x1	/**< flag: header is complete */
+#define RDD_BLOCKHASH_INDEXED	0x2	/**< flag: file has an index */
+
+/** \brief The header of a block-hash file, in host byte order.
+ *
+ *  In the file, the fields are stored in this order, without padding.
+ */
+typedef struct _RDD_BLOCKHASH_HEADER {
+	char       magic[8];	/**< \c RDD_BLOCKHASH_MAGIC, not terminated */
+	RDD_UINT32 version;	/**< \c RDD_BLOCKHASH_VERSION */
+	RDD_UINT32 algorithm;	/**< hash algorithm */
+	RDD_UINT32 digestsize;	/**< size in bytes of a digest */
+	RDD_UINT32 blocksize;	/**< block size in bytes */
+	RDD_UINT64 offset;	/**< image offset of the first block */
+	RDD_UINT64 imagesize;	/**< number of bytes hashed */
+	RDD_UINT64 nblock;	/**< number of digests */
+	RDD_UINT64 indexpos;	/**< file offset of the index, or 0 */
+	RDD_UINT32 flags;	/**< \c RDD_BLOCKHASH_FINISHED etc. */
+	RDD_UINT32 reserved;	/**< zero */
+} RDD_BLOCKHASH_HEADER;
+
+/** \brief A block-hash file that has been opened for reading.
+ */
+typedef struct _RDD_BLOCKHASH_FILE {
+	RDD_BLOCKHASH_HEADER  header;	/**< header; \c nblock is valid */
+	const unsigned char  *base;	/**< the mapped file */
+	size_t                size;	/**< size of the mapped file */
+	const unsigned char  *digests;	/**< the first digest */
+	const unsigned char  *index;	/**< the first index entry, or 0 */
+} RDD_BLOCKHASH_FILE;
+
+/** \brief Initializes the header of a new block-hash file.
+ *  \param hdr the header
+ *  \param algorithm the hash algorithm
+ *  \param blocksize the block size in bytes
+ *  \param offset the image offset of the first block
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c algorithm is unknown.
+ */
+int rdd_blockhash_init_header(RDD_BLOCKHASH_HEADER *hdr,
+		unsigned algorithm, unsigned blocksize, rdd_count_t offset);
+
+/** \brief Encodes a header in its file format.
+ *  \param hdr the header
+ *  \param buf output value: the encoded header
+ */
+void rdd_blockhash_encode_header(const RDD_BLOCKHASH_HEADER *hdr,
+		unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE]);
+
+/** \brief Decodes a header.
+ *  \param buf the encoded header
+ *  \param hdr output value: the header
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_ESYNTAX if
+ *  \c buf does not hold a valid MD5 block-hash header.
+ */
+int rdd_blockhash_decode_header(const unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE],
+		RDD_BLOCKHASH_HEADER *hdr);
+
+/** \brief Finishes a block-hash file.
+ *  \param fp the output stream, positioned after the last digest
+ *  \param path the name of the output file
+ *  \param hdr the header; \c nblock and \c imagesize must be set
+ *  \param indexed true iff an index must be appended
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  This routine appends the index, if requested, and rewrites the
+ *  header.  Building the index reads the digests back from \c path
+ *  and sorts them in runs of bounded size; the runs of a large file
+ *  are merged on disk, using a scratch area behind the index that is
+ *  truncated afterwards.  The stream is flushed but not closed.
+ */
+int rdd_blockhash_finish(FILE *fp, const char *path,
+		RDD_BLOCKHASH_HEADER *hdr, int indexed);
+
+/** \brief Opens a block-hash file for reading.
+ *  \param bf output value: the opened file
+ *  \param path the name of the file
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_EOPEN if the
+ *  file cannot be opened or mapped, and \c RDD_ESYNTAX if it is not a
+ *  valid block-hash file.
+ */
+int rdd_blockhash_open(RDD_BLOCKHASH_FILE **bf, const char *path);
+
+/** \brief Returns the digest of a block.
+ *  \param bf the block-hash file
+ *  \param blocknum the block number
+ *  \return Returns a pointer to the digest of block \c blocknum, or
+ *  0 if there is no such block.
+ */
+const unsigned char *rdd_blockhash_digest(RDD_BLOCKHASH_FILE *bf,
+		rdd_count_t blocknum);
+
+/** \brief Finds the blocks that have a given digest.
+ *  \param bf the block-hash file
+ *  \param digest the digest to look for
+ *  \param blocks output value: the first \c maxblock matching block
+ *         numbers, in ascending order
+ *  \param maxblock the size of array \c blocks
+ *  \param nfound output value: the total number of matching blocks
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Files with an index are searched by binary search; other files
+ *  are searched sequentially.
+ */
+int rdd_blockhash_lookup(RDD_BLOCKHASH_FILE *bf, const unsigned char *digest,
+		rdd_count_t *blocks, unsigned maxblock, rdd_count_t *nfound);
+
+/** \brief Writes a block-hash file in rdd's text format.
+ *  \param bf the block-hash file
+ *  \param fp the output stream
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_EWRITE if
+ *  the output cannot be written.
+ *
+ *  Every block is written as its block number, a tab, and its
+ *  digest in hexadecimal, which is the format of the text output of
+ *  the block MD5 filter.
+ */
+int rdd_blockhash_print(RDD_BLOCKHASH_FILE *bf, FILE *fp);
+
+/** \brief Closes a block-hash file.
+ *  \param bf the block-hash file
+ */
+void rdd_blockhash_close(RDD_BLOCKHASH_FILE *bf);
+
+#endif /* __blockhash_h__ */
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "alignedbuf.h"
+#include "bufqueue.h"
+
+/* Slot states.  A slot moves from FREE to FILLING (owned by the
+ * producer) to FULL (queued) to DRAINING (owned by the consumer)
+ * and back to FREE.
+ */
+#define SLOT_FREE      0
+#define SLOT_FILLING   1
+#define SLOT_FULL      2
+#define SLOT_DRAINING  3
+
+struct _RDD_BUFQUEUE {
+	pthread_mutex_t lock;
+	pthread_cond_t  slot_freed;	/* a slot became FREE */
+	pthread_cond_t  slot_filled;	/* a slot became FULL or queue closed */
+	RDD_BUFQ_SLOT  *slots;
+	unsigned        nslot;
+	unsigned        in;		/* next slot for the producer */
+	unsigned        out;		/* next slot for the consumer */
+	unsigned        depth;		/* number of FULL slots */
+	int             closed;		/* producer is done */
+	int             status;		/* abort status or RDD_OK */
+	RDD_BUFQ_STATS  stats;
+};
+
+int
+rdd_new_bufqueue(RDD_BUFQUEUE **self, unsigned nbuf, unsigned bufsize,
+		unsigned align)
+{
+	RDD_BUFQUEUE *q = 0;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (nbuf < 2 || bufsize <= 0) return RDD_BADARG;
+
+	if ((q = calloc(1, sizeof(RDD_BUFQUEUE))) == 0) {
+		return RDD_NOMEM;
+	}
+	if ((q->slots = calloc(nbuf, sizeof(RDD_BUFQ_SLOT))) == 0) {
+		free(q);
+		return RDD_NOMEM;
+	}
+	q->nslot = nbuf;
+
+	for (i = 0; i < nbuf; i++) {
+		rc = rdd_new_alignedbuf(&q->slots[i].abuf, bufsize, align);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		q->slots[i].buf = q->slots[i].abuf.aligned;
+		q->slots[i].size = bufsize;
+		q->slots[i].state = SLOT_FREE;
+	}
+
+	pthread_mutex_init(&q->lock, 0);
+	pthread_cond_init(&q->slot_freed, 0);
+	pthread_cond_init(&q->slot_filled, 0);
+	q->status = RDD_OK;
+
+	*self = q;
+	return RDD_OK;
+
+error:
+	for (i = 0; i < nbuf; i++) {
+		if (q->slots[i].abuf.unaligned != 0) {
+			rdd_free_alignedbuf(&q->slots[i].abuf);
+		}
+	}
+	free(q->slots);
+	free(q);
+	*self = 0;
+	return rc;
+}
+
+int
+rdd_free_bufqueue(RDD_BUFQUEUE *q)
+{
+	unsigned i;
+
+	for (i = 0; i < q->nslot; i++) {
+		rdd_free_alignedbuf(&q->slots[i].abuf);
+	}
+	free(q->slots);
+
+	pthread_cond_destroy(&q->slot_filled);
+	pthread_cond_destroy(&q->slot_freed);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+
+	return RDD_OK;
+}
+
+int
+rdd_bufq_get_free(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT **slot)
+{
+	RDD_BUFQ_SLOT *s;
+	double start = 0.0;
+	int rc;
+
+	pthread_mutex_lock(&q->lock);
+	s = &q->slots[q->in];
+	if (q->status == RDD_OK && s->state != SLOT_FREE) {
+		start = rdd_gettime();
+		while (q->status == RDD_OK && s->state != SLOT_FREE) {
+			pthread_cond_wait(&q->slot_freed, &q->lock);
+		}
+		q->stats.put_wait += rdd_gettime() - start;
+	}
+	if ((rc = q->status) == RDD_OK) {
+		s->state = SLOT_FILLING;
+		s->len = 0;
+		s->offset = 0;
+		s->flags = 0;
+		*slot = s;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return rc;
+}
+
+int
+rdd_bufq_put_full(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT *slot)
+{
+	pthread_mutex_lock(&q->lock);
+	if (slot != &q->slots[q->in] || slot->state != SLOT_FILLING) {
+		pthread_mutex_unlock(&q->lock);
+		return RDD_BADARG;
+	}
+	slot->state = SLOT_FULL;
+	q->in = (q->in + 1) % q->nslot;
+	if (++q->depth > q->stats.maxdepth) {
+		q->stats.maxdepth = q->depth;
+	}
+	pthread_cond_signal(&q->slot_filled);
+	pthread_mutex_unlock(&q->lock);
+
+	return RDD_OK;
+}
+
+int
+rdd_bufq_get_full(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT **slot)
+{
+	RDD_BUFQ_SLOT *s;
+	double start = 0.0;
+	int rc;
+
+	pthread_mutex_lock(&q->lock);
+	s = &q->slots[q->out];
+	if (q->status == RDD_OK && s->state != SLOT_FULL && !q->closed) {
+		start = rdd_gettime();
+		while (q->status == RDD_OK && s->state != SLOT_FULL
+		&&     !q->closed) {
+			pthread_cond_wait(&q->slot_filled, &q->lock);
+		}
+		q->stats.get_wait += rdd_gettime() - start;
+	}
+	if ((rc = q->status) == RDD_OK) {
+		if (s->state == SLOT_FULL) {
+			s->state = SLOT_DRAINING;
+			q->depth--;
+			*slot = s;
+		} else {
+			rc = RDD_NOTFOUND;	/* closed and drained */
+		}
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return rc;
+}
+
+int
+rdd_bufq_put_free(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT *slot)
+{
+	pthread_mutex_lock(&q->lock);
+	if (slot != &q->slots[q->out] || slot->state != SLOT_DRAINING) {
+		pthread_mutex_unlock(&q->lock);
+		return RDD_BADARG;
+	}
+	slot->state = SLOT_FREE;
+	q->out = (q->out + 1) % q->nslot;
+	pthread_cond_signal(&q->slot_freed);
+	pthread_mutex_unlock(&q->lock);
+
+	return RDD_OK;
+}
+
+int
+rdd_bufq_close(RDD_BUFQUEUE *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->slot_filled);
+	pthread_mutex_unlock(&q->lock);
+
+	return RDD_OK;
+}
+
+int
+rdd_bufq_abort(RDD_BUFQUEUE *q, int status)
+{
+	if (status == RDD_OK) return RDD_BADARG;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->status == RDD_OK) {
+		q->status = status;
+	}
+	pthread_cond_broadcast(&q->slot_filled);
+	pthread_cond_broadcast(&q->slot_freed);
+	pthread_mutex_unlock(&q->lock);
+
+	return RDD_OK;
+}
+
+unsigned
+rdd_bufq_depth(RDD_BUFQUEUE *q)
+{
+	unsigned depth;
+
+	pthread_mutex_lock(&q->lock);
+	depth = q->depth;
+	pthread_mutex_unlock(&q->lock);
+
+	return depth;
+}
+
+int
+rdd_bufq_get_stats(RDD_BUFQUEUE *q, RDD_BUFQ_STATS *stats)
+{
+	pthread_mutex_lock(&q->lock);
+	*stats = q->stats;
+	pthread_mutex_unlock(&q->lock);
+
+	return RDD_OK;
+}
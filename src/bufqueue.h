@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __bufqueue_h__
+#define __bufqueue_h__
+
+/** @file
+ *  \brief Bounded queue of aligned data buffers.
+ *
+ *  A buffer queue connects a producer thread to a consumer thread.
+ *  The queue owns a fixed ring of aligned buffers (slots).  The producer
+ *  obtains a free slot, fills it, and hands it to the consumer; the
+ *  consumer drains the slot and returns it to the producer.  Slots
+ *  travel through the ring in order, so the consumer sees the data in
+ *  exactly the order in which it was produced.
+ *
+ *  Either party can abort the queue.  All blocked and all future queue
+ *  operations then fail with the status that was passed to
+ *  \c rdd_bufq_abort().
+ */
+
+#include "alignedbuf.h"
+
+/** \brief Queue slot.
+ */
+typedef struct _RDD_BUFQ_SLOT {
+	unsigned char  *buf;	/**< aligned data buffer */
+	unsigned        size;	/**< capacity of \c buf in bytes */
+	unsigned        len;	/**< number of valid bytes in \c buf */
+	rdd_count_t     offset;	/**< client-defined stream offset */
+	unsigned        flags;	/**< client-defined flags */
+	int             state;	/**< private: slot state */
+	RDD_ALIGNEDBUF  abuf;	/**< private: backing buffer */
+} RDD_BUFQ_SLOT;
+
+/** \brief Queue statistics.
+ */
+typedef struct _RDD_BUFQ_STATS {
+	unsigned     maxdepth;	/**< largest number of filled slots seen */
+	double       put_wait;	/**< seconds the producer waited for a slot */
+	double       get_wait;	/**< seconds the consumer waited for data */
+} RDD_BUFQ_STATS;
+
+struct _RDD_BUFQUEUE;
+typedef struct _RDD_BUFQUEUE RDD_BUFQUEUE;
+
+struct _RDD_FILTER;
+
+/** \brief Creates a buffer queue.
+ *  \param q output value: the new queue.
+ *  \param nbuf number of slots in the queue; must be at least 2.
+ *  \param bufsize size in bytes of each slot.
+ *  \param align alignment in bytes of each slot's buffer.
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG for
+ *  bad arguments and \c RDD_NOMEM if the buffers cannot be allocated.
+ */
+int rdd_new_bufqueue(RDD_BUFQUEUE **q, unsigned nbuf, unsigned bufsize,
+			unsigned align);
+
+/** \brief Releases a buffer queue and all of its slots.
+ *  \param q the queue
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  No thread may use the queue when it is released.
+ */
+int rdd_free_bufqueue(RDD_BUFQUEUE *q);
+
+/** \brief Producer: obtains the next free slot.
+ *  \param q the queue
+ *  \param slot output value: the free slot.
+ *  \return Returns \c RDD_OK on success. Blocks until a slot is
+ *  available. If the queue has been aborted, the abort status is returned.
+ */
+int rdd_bufq_get_free(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT **slot);
+
+/** \brief Producer: hands a filled slot to the consumer.
+ *  \param q the queue
+ *  \param slot a slot obtained with \c rdd_bufq_get_free().
+ *  \return Returns \c RDD_OK on success.
+ */
+int rdd_bufq_put_full(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT *slot);
+
+/** \brief Consumer: obtains the next filled slot.
+ *  \param q the queue
+ *  \param slot output value: the filled slot.
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND when
+ *  the producer has closed the queue and all slots have been drained.
+ *  If the queue has been aborted, the abort status is returned.
+ */
+int rdd_bufq_get_full(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT **slot);
+
+/** \brief Consumer: returns a drained slot to the producer.
+ *  \param q the queue
+ *  \param slot a slot obtained with \c rdd_bufq_get_full().
+ *  \return Returns \c RDD_OK on success.
+ */
+int rdd_bufq_put_free(RDD_BUFQUEUE *q, RDD_BUFQ_SLOT *slot);
+
+/** \brief Producer: marks the end of the data stream.
+ *  \param q the queue
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Closing a queue more than once is harmless.
+ */
+int rdd_bufq_close(RDD_BUFQUEUE *q);
+
+/** \brief Aborts all current and future queue operations.
+ *  \param q the queue
+ *  \param status the (nonzero) error code that queue operations
+ *  will return from now on.
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Only the first abort status is retained.
+ */
+int rdd_bufq_abort(RDD_BUFQUEUE *q, int status);
+
+/** \brief Returns the number of filled slots that wait for the consumer.
+ */
+unsigned rdd_bufq_depth(RDD_BUFQUEUE *q);
+
+/** \brief Copies the queue's statistics to \c stats.
+ */
+int rdd_bufq_get_stats(RDD_BUFQUEUE *q, RDD_BUFQ_STATS *stats);
+
+/** \brief Creates a stream filter that feeds a buffer queue.
+ *  \param f output value: the new filter.
+ *  \param q the queue; the filter acts as its producer.
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The filter copies all data pushed into it into free slots of \c q
+ *  and closes \c q when the filter is closed.  Pushes block while
+ *  the queue is full.  The filter does not own the queue.
+ */
+int rdd_new_queue_streamfilter(struct _RDD_FILTER **f, RDD_BUFQUEUE *q);
+
+#endif /* __bufqueue_h__ */
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "checkpoint.h"
+
+#define MAX_RECORD   4096		/* max. record size in bytes */
+#define MAX_LINE     (2*MAX_RECORD + 256)
+
+int
+rdd_new_checkpoint(RDD_CHECKPOINT **self)
+{
+	RDD_CHECKPOINT *cp;
+
+	if ((cp = calloc(1, sizeof(RDD_CHECKPOINT))) == 0) {
+		return RDD_NOMEM;
+	}
+
+	*self = cp;
+	return RDD_OK;
+}
+
+int
+rdd_free_checkpoint(RDD_CHECKPOINT *cp)
+{
+	unsigned i;
+
+	for (i = 0; i < cp->nrec; i++) {
+		free(cp->rec[i].name);
+		free(cp->rec[i].data);
+	}
+	free(cp->rec);
+	free(cp);
+
+	return RDD_OK;
+}
+
+static RDD_CKPT_RECORD *
+find_record(RDD_CHECKPOINT *cp, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < cp->nrec; i++) {
+		if (strcmp(cp->rec[i].name, name) == 0) {
+			return &cp->rec[i];
+		}
+	}
+	return 0;
+}
+
+/* Stores a record under its full name.  Takes ownership of name.
+ */
+static int
+put_record(RDD_CHECKPOINT *cp, char *name, const void *buf, unsigned len)
+{
+	RDD_CKPT_RECORD *rec;
+	unsigned char *data;
+	unsigned n;
+
+	if (len > MAX_RECORD) {
+		free(name);
+		return RDD_ESPACE;
+	}
+	if ((data = malloc(len > 0 ? len : 1)) == 0) {
+		free(name);
+		return RDD_NOMEM;
+	}
+	memcpy(data, buf, len);
+
+	if ((rec = find_record(cp, name)) != 0) {
+		free(name);
+		free(rec->data);
+		rec->data = data;
+		rec->len = len;
+		return RDD_OK;
+	}
+
+	if (cp->nrec >= cp->maxrec) {
+		n = cp->maxrec > 0 ? 2 * cp->maxrec : 16;
+		rec = realloc(cp->rec, n * sizeof(RDD_CKPT_RECORD));
+		if (rec == 0) {
+			free(name);
+			free(data);
+			return RDD_NOMEM;
+		}
+		cp->rec = rec;
+		cp->maxrec = n;
+	}
+	rec = &cp->rec[cp->nrec++];
+	rec->name = name;
+	rec->data = data;
+	rec->len = len;
+
+	return RDD_OK;
+}
+
+static char *
+record_name(const char *obj, const char *key)
+{
+	char *name;
+
+	if ((name = malloc(strlen(obj) + strlen(key) + 2)) == 0) {
+		return 0;
+	}
+	sprintf(name, "%s.%s", obj, key);
+	return name;
+}
+
+int
+rdd_ckpt_put(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		const void *buf, unsigned len)
+{
+	char *name;
+
+	if (strchr(obj, '\n') != 0 || strchr(key, '\n') != 0) {
+		return RDD_BADARG;
+	}
+	if ((name = record_name(obj, key)) == 0) {
+		return RDD_NOMEM;
+	}
+	return put_record(cp, name, buf, len);
+}
+
+int
+rdd_ckpt_get(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		void *buf, unsigned len)
+{
+	RDD_CKPT_RECORD *rec;
+	char *name;
+
+	if ((name = record_name(obj, key)) == 0) {
+		return RDD_NOMEM;
+	}
+	rec = find_record(cp, name);
+	free(name);
+
+	if (rec == 0) {
+		return RDD_NOTFOUND;
+	}
+	if (rec->len != len) {
+		return RDD_ESYNTAX;
+	}
+	memcpy(buf, rec->data, len);
+
+	return RDD_OK;
+}
+
+int
+rdd_ckpt_put_count(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		rdd_count_t val)
+{
+	return rdd_ckpt_put(cp, obj, key, &val, sizeof val);
+}
+
+int
+rdd_ckpt_get_count(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		rdd_count_t *val)
+{
+	return rdd_ckpt_get(cp, obj, key, val, sizeof *val);
+}
+
+int
+rdd_ckpt_save(RDD_CHECKPOINT *cp, const char *path)
+{
+	char hex[2*MAX_RECORD + 1];
+	char *tmppath = 0;
+	FILE *fp = NULL;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if ((tmppath = malloc(strlen(path) + 5)) == 0) {
+		return RDD_NOMEM;
+	}
+	sprintf(tmppath, "%s.tmp", path);
+
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		rc = RDD_EOPEN;
+		goto out;
+	}
+	fprintf(fp, "# rdd checkpoint\n");
+	for (i = 0; i < cp->nrec; i++) {
+		rc = rdd_buf2hex(cp->rec[i].data, cp->rec[i].len,
+				hex, sizeof hex);
+		if (rc != RDD_OK) {
+			fclose(fp);
+			goto out;
+		}
+		fprintf(fp, "%s %s\n", cp->rec[i].len > 0 ? hex : "-",
+			cp->rec[i].name);
+	}
+	if (fflush(fp) == EOF || ferror(fp) || fsync(fileno(fp)) < 0) {
+		fclose(fp);
+		rc = RDD_EWRITE;
+		goto out;
+	}
+	if (fclose(fp) == EOF) {
+		rc = RDD_ECLOSE;
+		goto out;
+	}
+	if (rename(tmppath, path) < 0) {
+		rc = RDD_EWRITE;
+	}
+
+out:
+	free(tmppath);
+	return rc;
+}
+
+static int
+hexval(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/* Parses one "<hex> <name>" line into a record.
+ */
+static int
+parse_line(RDD_CHECKPOINT *cp, char *line, unsigned char *buf)
+{
+	char *name;
+	char *sep;
+	unsigned len = 0;
+	unsigned i;
+	int hi, lo;
+
+	if ((sep = strchr(line, ' ')) == 0 || sep[1] == '\000') {
+		return RDD_ESYNTAX;
+	}
+	*sep = '\000';
+
+	if (strcmp(line, "-") != 0) {
+		if (strlen(line) % 2 != 0) {
+			return RDD_ESYNTAX;
+		}
+		for (i = 0; line[i] != '\000'; i += 2) {
+			hi = hexval(line[i]);
+			lo = hexval(line[i+1]);
+			if (hi < 0 || lo < 0) {
+				return RDD_ESYNTAX;
+			}
+			buf[len++] = (unsigned char) ((hi << 4) | lo);
+		}
+	}
+
+	if ((name = malloc(strlen(sep + 1) + 1)) == 0) {
+		return RDD_NOMEM;
+	}
+	strcpy(name, sep + 1);
+	return put_record(cp, name, buf, len);
+}
+
+int
+rdd_ckpt_load(RDD_CHECKPOINT **self, const char *path)
+{
+	RDD_CHECKPOINT *cp = 0;
+	unsigned char *buf = 0;
+	char *line = 0;
+	FILE *fp = NULL;
+	unsigned n;
+	int rc;
+
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		return rc;
+	}
+	if ((line = malloc(MAX_LINE)) == 0 || (buf = malloc(MAX_RECORD)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if ((fp = fopen(path, "r")) == NULL) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+
+	while (fgets(line, MAX_LINE, fp) != NULL) {
+		n = strlen(line);
+		if (n == 0 || line[n-1] != '\n') {
+			rc = RDD_ESYNTAX;
+			goto error;
+		}
+		line[n-1] = '\000';
+		if (line[0] == '#' || line[0] == '\000') {
+			continue;
+		}
+		if ((rc = parse_line(cp, line, buf)) != RDD_OK) {
+			goto error;
+		}
+	}
+	if (! feof(fp)) {
+		rc = RDD_EREAD;
+		goto error;
+	}
+
+	fclose(fp);
+	free(buf);
+	free(line);
+	*self = cp;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (fp != NULL) fclose(fp);
+	free(buf);
+	free(line);
+	rdd_free_checkpoint(cp);
+	return rc;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __checkpoint_h__
+#define __checkpoint_h__
+
+/** @file
+ *  \brief Checkpoints for interrupted acquisitions.
+ *
+ *  A checkpoint is a set of named records.  Every record is an
+ *  opaque byte string that some object (a copier, a filter, a
+ *  writer) saved and that the same kind of object can restore.
+ *  Names consist of the name of the object and a key, separated
+ *  by a dot; for example \c "copier.nbyte" or \c "MD5 stream.ctx".
+ *
+ *  A checkpoint is saved to a text file, one record per line: the
+ *  record bytes in hexadecimal, a space, and the record name.
+ *  \verbatim
+ *  # rdd checkpoint
+ *  0000100000000000 copier.nbyte
+ *  ...
+ *  \endverbatim
+ *  The records hold raw in-memory state (for example an MD5_CTX),
+ *  so a checkpoint can only be resumed by the same rdd binary on
+ *  the same platform.  The file is replaced atomically (write,
+ *  fsync, rename).
+ */
+
+/** \brief Checkpoint record.
+ */
+typedef struct _RDD_CKPT_RECORD {
+	char          *name;	/**< "object.key" */
+	unsigned char *data;	/**< record bytes */
+	unsigned       len;	/**< number of bytes in \c data */
+} RDD_CKPT_RECORD;
+
+/** \brief Checkpoint.
+ */
+typedef struct _RDD_CHECKPOINT {
+	RDD_CKPT_RECORD *rec;	/**< records, in insertion order */
+	unsigned         nrec;	/**< number of records */
+	unsigned         maxrec; /**< capacity of \c rec */
+} RDD_CHECKPOINT;
+
+/** \brief Creates an empty checkpoint.
+ */
+int rdd_new_checkpoint(RDD_CHECKPOINT **cp);
+
+/** \brief Releases a checkpoint and all its records.
+ */
+int rdd_free_checkpoint(RDD_CHECKPOINT *cp);
+
+/** \brief Stores a record.
+ *  \param cp the checkpoint
+ *  \param obj the object name
+ *  \param key the record key
+ *  \param buf the record bytes
+ *  \param len the number of bytes in \c buf
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  An existing record with the same name is replaced.
+ */
+int rdd_ckpt_put(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		const void *buf, unsigned len);
+
+/** \brief Retrieves a record.
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_NOTFOUND if
+ *  there is no record with this name and \c RDD_ESYNTAX if the record
+ *  does not have exactly \c len bytes.
+ */
+int rdd_ckpt_get(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		void *buf, unsigned len);
+
+/** \brief Stores a counter (convenience routine).
+ */
+int rdd_ckpt_put_count(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		rdd_count_t val);
+
+/** \brief Retrieves a counter (convenience routine).
+ */
+int rdd_ckpt_get_count(RDD_CHECKPOINT *cp, const char *obj, const char *key,
+		rdd_count_t *val);
+
+/** \brief Writes a checkpoint to file \c path.
+ */
+int rdd_ckpt_save(RDD_CHECKPOINT *cp, const char *path);
+
+/** \brief Reads a checkpoint from file \c path.
+ *  \return Returns \c RDD_OK on success, \c RDD_EOPEN if \c path
+ *  cannot be opened and \c RDD_ESYNTAX if the file is malformed.
+ */
+int rdd_ckpt_load(RDD_CHECKPOINT **cp, const char *path);
+
+#endif /* __checkpoint_h__ */
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Block-checksum kernels with run-time dispatch.
+ *
+ * Adler32 (AVX2).  The data is processed in 32-byte vectors.  Within
+ * a run of at most ADLER_NMAX bytes, s1 is accumulated with a
+ * sum-of-absolute-differences against zero and s2 with a multiply-add
+ * of the bytes by the weights 32..1.  Every vector also contributes
+ * 32 times the sum of all preceding vectors to s2; those sums are
+ * accumulated separately and scaled once per run.  The sums are
+ * reduced modulo 65521 after each run, as in zlib.
+ *
+ * CRC32 and CRC32C (PCLMULQDQ).  The data is folded 64 bytes at a
+ * time into four 128-bit accumulators with carry-less multiplications
+ * by x^(512+32) and x^(512-32) modulo the CRC polynomial.  The
+ * accumulators are then folded into one, reduced to 64 and 32 bits,
+ * and a Barrett reduction yields the CRC.  This is the algorithm of
+ * Intel's white paper "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction"; the constants are the bit-reflected
+ * values that the paper derives for each polynomial.
+ *
+ * Data that does not fill a vector is handed to zlib (Adler32 and
+ * CRC32) or to the SSE4.2 CRC32 instruction (CRC32C).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "rdd.h"
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+&&  defined(HAVE_CPUID_H) && defined(HAVE_IMMINTRIN_H)
+#define RDD_X86_SIMD 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY	0x82f63b78	/* bit-reflected Castagnoli polynomial */
+
+typedef rdd_checksum_t (*checksum_fun)(rdd_checksum_t sum,
+				const unsigned char *buf, unsigned nbyte);
+
+typedef struct _CHECKSUM_IMPL {
+	checksum_fun  fun;
+	const char   *name;
+} CHECKSUM_IMPL;
+
+static CHECKSUM_IMPL adler32_impl;
+static CHECKSUM_IMPL crc32_impl;
+static CHECKSUM_IMPL crc32c_impl;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static rdd_checksum_t crc32c_table[256];
+
+/* Portable implementations.
+ */
+static rdd_checksum_t
+adler32_zlib(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	return adler32(sum, buf, nbyte);
+}
+
+static rdd_checksum_t
+crc32_zlib(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	return crc32(sum, buf, nbyte);
+}
+
+static void
+init_crc32c_table(void)
+{
+	rdd_checksum_t c;
+	unsigned i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		}
+		crc32c_table[i] = c;
+	}
+}
+
+static rdd_checksum_t
+crc32c_portable(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	rdd_checksum_t c = ~sum;
+
+	while (nbyte-- > 0) {
+		c = crc32c_table[(c ^ *buf++) & 0xff] ^ (c >> 8);
+	}
+	return ~c;
+}
+
+#if defined(RDD_X86_SIMD)
+
+#define ADLER_BASE	65521	/* largest prime smaller than 65536 */
+#define ADLER_NMAX	5536	/* zlib's NMAX, rounded down to 32 */
+
+/* Fold constants for one CRC polynomial (see the comment at the top).
+ */
+typedef struct _CRC_FOLD {
+	unsigned long long k1, k2;	/* fold by 512 bits */
+	unsigned long long k3, k4;	/* fold by 128 bits */
+	unsigned long long k5;		/* fold 64 bits to 32 bits */
+	unsigned long long poly, mu;	/* Barrett reduction */
+} CRC_FOLD;
+
+static const CRC_FOLD crc32_fold = {
+	0x154442bd4ULL, 0x1c6e41596ULL,
+	0x1751997d0ULL, 0x0ccaa009eULL,
+	0x163cd6124ULL,
+	0x1db710641ULL, 0x1f7011641ULL
+};
+
+static const CRC_FOLD crc32c_fold = {
+	0x0740eef02ULL, 0x09e4addf8ULL,
+	0x0f20c0dfeULL, 0x14cd00bd6ULL,
+	0x0dd45aab8ULL,
+	0x105ec76f1ULL, 0x0dea713f1ULL
+};
+
+#define FOLD128(x, k, data) \
+	_mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((x), (k), 0x00), \
+				    _mm_clmulepi64_si128((x), (k), 0x11)), \
+		      (data))
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i *) (p))
+
+static rdd_count_t
+sum_lanes(const RDD_UINT32 *lanes)
+{
+	rdd_count_t sum = 0;
+	unsigned i;
+
+	for (i = 0; i < 8; i++) {
+		sum += lanes[i];
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static rdd_checksum_t
+adler32_avx2(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i weights = _mm256_setr_epi8(
+		32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1);
+	__m256i v, vs1, vs2, vprev;
+	RDD_UINT32 lanes[8];
+	rdd_count_t s1 = sum & 0xffff;
+	rdd_count_t s2 = (sum >> 16) & 0xffff;
+	unsigned n, k;
+
+	while (nbyte >= 32) {
+		n = nbyte < ADLER_NMAX ? nbyte & ~31U : ADLER_NMAX;
+
+		vs1 = zero;
+		vs2 = zero;
+		vprev = zero;	/* sum of vs1 before each vector */
+		for (k = 0; k < n; k += 32) {
+			v = _mm256_loadu_si256((const __m256i *) (buf + k));
+			vprev = _mm256_add_epi32(vprev, vs1);
+			vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(v, zero));
+			vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(
+					_mm256_maddubs_epi16(v, weights), ones));
+		}
+		vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(vprev, 5));
+
+		_mm256_storeu_si256((__m256i *) lanes, vs2);
+		s2 = (s2 + s1 * n + sum_lanes(lanes)) % ADLER_BASE;
+		_mm256_storeu_si256((__m256i *) lanes, vs1);
+		s1 = (s1 + sum_lanes(lanes)) % ADLER_BASE;
+
+		buf += n;
+		nbyte -= n;
+	}
+
+	sum = (rdd_checksum_t) ((s2 << 16) | s1);
+	return nbyte > 0 ? adler32(sum, buf, nbyte) : sum;
+}
+
+/* Computes the (unconditioned) CRC of nbyte bytes; nbyte must be
+ * a multiple of 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static rdd_checksum_t
+crc_fold(const CRC_FOLD *c, rdd_checksum_t crc,
+	const unsigned char *buf, unsigned nbyte)
+{
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, 0, 0);
+	__m128i x1, x2, x3, x4, y, k;
+
+	x1 = _mm_xor_si128(LOAD128(buf), _mm_cvtsi32_si128((int) crc));
+	x2 = LOAD128(buf + 16);
+	x3 = LOAD128(buf + 32);
+	x4 = LOAD128(buf + 48);
+	buf += 64;
+	nbyte -= 64;
+
+	k = _mm_set_epi64x((long long) c->k2, (long long) c->k1);
+	while (nbyte >= 64) {
+		x1 = FOLD128(x1, k, LOAD128(buf));
+		x2 = FOLD128(x2, k, LOAD128(buf + 16));
+		x3 = FOLD128(x3, k, LOAD128(buf + 32));
+		x4 = FOLD128(x4, k, LOAD128(buf + 48));
+		buf += 64;
+		nbyte -= 64;
+	}
+
+	k = _mm_set_epi64x((long long) c->k4, (long long) c->k3);
+	x1 = FOLD128(x1, k, x2);
+	x1 = FOLD128(x1, k, x3);
+	x1 = FOLD128(x1, k, x4);
+	while (nbyte >= 16) {
+		x1 = FOLD128(x1, k, LOAD128(buf));
+		buf += 16;
+		nbyte -= 16;
+	}
+
+	/* 128 bits to 64 bits.
+	 */
+	y = _mm_clmulepi64_si128(k, x1, 0x01);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), y);
+
+	/* 64 bits to 32 bits.
+	 */
+	k = _mm_set_epi64x(0, (long long) c->k5);
+	y = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), y);
+
+	/* Barrett reduction.
+	 */
+	k = _mm_set_epi64x((long long) c->mu, (long long) c->poly);
+	y = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+	y = _mm_clmulepi64_si128(_mm_and_si128(y, mask32), k, 0x00);
+	x1 = _mm_xor_si128(x1, y);
+
+	return (rdd_checksum_t) _mm_extract_epi32(x1, 1);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static rdd_checksum_t
+crc32_pclmul(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	unsigned n = nbyte & ~15U;
+
+	if (n >= 64) {
+		sum = ~crc_fold(&crc32_fold, ~sum, buf, n);
+		buf += n;
+		nbyte -= n;
+	}
+	return nbyte > 0 ? crc32(sum, buf, nbyte) : sum;
+}
+
+__attribute__((target("sse4.2")))
+static rdd_checksum_t
+crc32c_sse42(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	rdd_checksum_t c = ~sum;
+	RDD_UINT32 w;
+#if defined(__x86_64__)
+	unsigned long long c64 = c;
+	unsigned long long w64;
+
+	while (nbyte >= 8) {
+		memcpy(&w64, buf, 8);
+		c64 = _mm_crc32_u64(c64, w64);
+		buf += 8;
+		nbyte -= 8;
+	}
+	c = (rdd_checksum_t) c64;
+#endif
+	while (nbyte >= 4) {
+		memcpy(&w, buf, 4);
+		c = _mm_crc32_u32(c, w);
+		buf += 4;
+		nbyte -= 4;
+	}
+	while (nbyte > 0) {
+		c = _mm_crc32_u8(c, *buf++);
+		nbyte--;
+	}
+	return ~c;
+}
+
+__attribute__((target("pclmul,sse4.1,sse4.2")))
+static rdd_checksum_t
+crc32c_pclmul(rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	unsigned n = nbyte & ~15U;
+
+	if (n >= 64) {
+		sum = ~crc_fold(&crc32c_fold, ~sum, buf, n);
+		buf += n;
+		nbyte -= n;
+	}
+	return nbyte > 0 ? crc32c_sse42(sum, buf, nbyte) : sum;
+}
+
+static void
+select_x86_impl(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	unsigned xcr0, xcr0_high;
+	int sse42, pclmul;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return;
+	}
+	sse42 = (ecx & bit_SSE4_2) != 0;
+	pclmul = (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSE4_1) != 0;
+
+	if (pclmul) {
+		crc32_impl.fun = crc32_pclmul;
+		crc32_impl.name = "pclmul";
+	}
+	if (pclmul && sse42) {
+		crc32c_impl.fun = crc32c_pclmul;
+		crc32c_impl.name = "pclmul";
+	} else if (sse42) {
+		crc32c_impl.fun = crc32c_sse42;
+		crc32c_impl.name = "sse4.2";
+	}
+
+	/* AVX2 also needs operating-system support for the YMM registers.
+	 */
+	if ((ecx & bit_OSXSAVE) == 0 || (ecx & bit_AVX) == 0) {
+		return;
+	}
+	__asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+	if ((xcr0 & 0x6) != 0x6 || __get_cpuid_max(0, 0) < 7) {
+		return;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if ((ebx & bit_AVX2) != 0) {
+		adler32_impl.fun = adler32_avx2;
+		adler32_impl.name = "avx2";
+	}
+}
+
+#endif /* RDD_X86_SIMD */
+
+static void
+select_impl(void)
+{
+	init_crc32c_table();
+
+	adler32_impl.fun = adler32_zlib;
+	adler32_impl.name = "zlib";
+	crc32_impl.fun = crc32_zlib;
+	crc32_impl.name = "zlib";
+	crc32c_impl.fun = crc32c_portable;
+	crc32c_impl.name = "portable";
+
+#if defined(RDD_X86_SIMD)
+	select_x86_impl();
+#endif
+}
+
+static CHECKSUM_IMPL *
+lookup_impl(rdd_checksum_algorithm_t alg)
+{
+	pthread_once(&impl_once, select_impl);
+
+	switch (alg) {
+	case RDD_ADLER32:
+		return &adler32_impl;
+	case RDD_CRC32:
+		return &crc32_impl;
+	case RDD_CRC32C:
+		return &crc32c_impl;
+	}
+	return 0;
+}
+
+rdd_checksum_t
+rdd_checksum_init(rdd_checksum_algorithm_t alg)
+{
+	return alg == RDD_ADLER32 ? 1 : 0;
+}
+
+rdd_checksum_t
+rdd_checksum_update(rdd_checksum_algorithm_t alg,
+		rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte)
+{
+	CHECKSUM_IMPL *impl = lookup_impl(alg);
+
+	if (impl == 0 || nbyte == 0) {
+		return sum;
+	}
+	return (*impl->fun)(sum, buf, nbyte);
+}
+
+const char *
+rdd_checksum_impl(rdd_checksum_algorithm_t alg)
+{
+	CHECKSUM_IMPL *impl = lookup_impl(alg);
+
+	return impl != 0 ? impl->name : "none";
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __checksum_h__
+#define __checksum_h__
+
+/** @file
+ *  Block-checksum kernels.
+ *
+ *  These routines compute the checksums that are stored in checksum
+ *  files: Adler32 and CRC32 (as computed by zlib) and CRC32C
+ *  (Castagnoli).  On x86 processors the implementation is selected
+ *  at run time: Adler32 uses AVX2, CRC32 and CRC32C use carry-less
+ *  multiplication (PCLMULQDQ), and CRC32C also uses the SSE4.2 CRC32
+ *  instruction.  Otherwise portable code is used.  All implementations
+ *  produce the same values.
+ */
+
+/** \brief Returns the checksum of an empty buffer.
+ *  \param alg the checksum algorithm
+ *  \return The initial checksum value for algorithm \c alg.
+ */
+rdd_checksum_t rdd_checksum_init(rdd_checksum_algorithm_t alg);
+
+/** \brief Updates a running checksum.
+ *  \param alg the checksum algorithm
+ *  \param sum the checksum of the preceding data
+ *  \param buf the data buffer
+ *  \param nbyte the size in bytes of the data buffer
+ *  \return The checksum of the preceding data followed by \c buf.
+ */
+rdd_checksum_t rdd_checksum_update(rdd_checksum_algorithm_t alg,
+		rdd_checksum_t sum, const unsigned char *buf, unsigned nbyte);
+
+/** \brief Returns the name of the implementation that is used for
+ *  a checksum algorithm (for example "avx2" or "portable").
+ *  \param alg the checksum algorithm
+ */
+const char *rdd_checksum_impl(rdd_checksum_algorithm_t alg);
+
+#endif /* __checksum_h__ */
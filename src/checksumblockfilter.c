@@ -48,7 +48,6 @@ static char copyright[] =
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <zlib.h>
 
 #include "rdd.h"
 #include "rdd_internals.h"
@@ -57,15 +56,26 @@ static char copyright[] =
 #include "filter.h"
 #include "filterset.h"
 #include "outfile.h"
+#include "checkpoint.h"
+#include "checksumfile.h"
 
+#define RECORD_BUF_SIZE	65536	/* bytes of records written at once */
 
 /* State maintained by a checksum filter.
  */
 typedef struct _RDD_CHECKSUM_BLOCKFILTER {
 	char                    *path;          /* output file */
 	FILE                    *fp;		/* output stream */
-	rdd_checksum_t           checksum;	/* running checksum */
-	rdd_checksum_algorithm_t algorithm;	/* checksum algorithm */
+	struct _RDD_CKSUM2_CTX  *ctx;		/* running checksum or hash */
+	unsigned                 type;		/* record type */
+	unsigned                 recordsize;	/* record size in bytes */
+	int                      version;	/* file format version: 1 or 2 */
+	int                      indexed;	/* version 2: append an index? */
+	RDD_CHECKSUM2_HEADER     header;	/* version 2: file header */
+	rdd_count_t              nrecord;	/* #records emitted */
+	rdd_count_t              nbyte;		/* #bytes checksummed */
+	unsigned char           *recbuf;	/* records not yet written */
+	unsigned                 reclen;	/* #bytes in recbuf */
 } RDD_CHECKSUM_BLOCKFILTER;
 
 /* Forward declarations.
@@ -75,28 +85,26 @@ static int checksum_input(RDD_FILTER *f,
 static int checksum_block(RDD_FILTER *f, unsigned nbyte);
 static int checksum_close(RDD_FILTER *f);
 static int checksum_free(RDD_FILTER *f);
+static int checksum_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int checksum_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp,
+			const char *name);
+static int checksum_digest(RDD_FILTER *f,
+			const unsigned char *buf, unsigned nbyte, void *result);
+static int checksum_emit(RDD_FILTER *f, const void *result, unsigned nbyte);
 
 static RDD_FILTER_OPS checksum_ops = {
 	checksum_input,
 	checksum_block,
 	checksum_close,
 	0,
-	checksum_free
+	checksum_free,
+	checksum_save,
+	checksum_restore,
+	checksum_digest,
+	checksum_emit,
+	RDD_CKSUM2_MAX_RECORD
 };
 
-static void
-reset_checksum(RDD_CHECKSUM_BLOCKFILTER *state)
-{
-	switch (state->algorithm) {
-	case RDD_ADLER32:
-		state->checksum = adler32(0, NULL, 0);
-		break;
-	case RDD_CRC32:
-		state->checksum = crc32(0, NULL, 0);
-		break;
-	}
-}
-
 static void
 init_header(RDD_CHECKSUM_FILE_HEADER* rec,
 	    int type, size_t blocksize,
@@ -112,19 +120,27 @@ init_header(RDD_CHECKSUM_FILE_HEADER* rec,
 	rec->imagesize = imgsize;
 }
 
+/* Writes the buffered records to the output file.
+ */
+static int
+flush_records(RDD_CHECKSUM_BLOCKFILTER *state)
+{
+	if (state->reclen == 0) {
+		return RDD_OK;
+	}
+	if (fwrite(state->recbuf, state->reclen, 1, state->fp) != 1) {
+		return RDD_EWRITE;
+	}
+	state->reclen = 0;
+	return RDD_OK;
+}
+
 static int
 checksum_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 {
 	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
 
-	switch (state->algorithm) {
-	case RDD_ADLER32:
-		state->checksum = adler32(state->checksum, buf, nbyte);
-		break;
-	case RDD_CRC32:
-		state->checksum = crc32(state->checksum, buf, nbyte);
-		break;
-	}
+	rdd_cksum2_ctx_update(state->ctx, buf, nbyte);
 
 	return RDD_OK;
 }
@@ -133,12 +149,48 @@ static int
 checksum_block(RDD_FILTER *f, unsigned pos)
 {
 	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
-	rdd_checksum_t checksum = state->checksum;
+	unsigned char record[RDD_CKSUM2_MAX_RECORD];
 
-	if (fwrite(&checksum, sizeof checksum, 1, state->fp) < 1) {
-		return RDD_EWRITE;
+	rdd_cksum2_ctx_final(state->ctx, record);
+
+	return checksum_emit(f, record, pos);
+}
+
+static int
+checksum_digest(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte,
+		void *result)
+{
+	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
+
+	return rdd_cksum2_compute(state->type, buf, nbyte,
+				(unsigned char *) result);
+}
+
+/* Appends the record of the next block to the record buffer.  The
+ * record is in version-2 format; version-1 files store checksums in
+ * the byte order of the machine that wrote them.
+ */
+static int
+checksum_emit(RDD_FILTER *f, const void *result, unsigned nbyte)
+{
+	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
+	rdd_checksum_t sum;
+	int rc;
+
+	if (state->reclen + state->recordsize > RECORD_BUF_SIZE
+	&&  (rc = flush_records(state)) != RDD_OK) {
+		return rc;
 	}
-	reset_checksum(state);
+
+	if (state->version == 1) {
+		sum = rdd_cksum2_get_checksum((const unsigned char *) result);
+		memcpy(state->recbuf + state->reclen, &sum, sizeof sum);
+	} else {
+		memcpy(state->recbuf + state->reclen, result, state->recordsize);
+	}
+	state->reclen += state->recordsize;
+	state->nrecord++;
+	state->nbyte += nbyte;
 
 	return RDD_OK;
 }
@@ -147,11 +199,20 @@ static int
 checksum_close(RDD_FILTER *f)
 {
 	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
+	int rc;
+
+	rc = flush_records(state);
+	if (rc == RDD_OK && state->version == 2) {
+		state->header.nrecord = state->nrecord;
+		state->header.imagesize = state->nbyte;
+		rc = rdd_cksum2_finish(state->fp, state->path,
+					&state->header, state->indexed);
+	}
 
 	outfile_fclose(state->fp, state->path);
 	state->fp = NULL;
 
-	return RDD_OK;
+	return rc;
 }
 
 static int
@@ -161,23 +222,94 @@ checksum_free(RDD_FILTER *f)
 
 	free(state->path);
 	state->path = 0;
+	free(state->recbuf);
+	state->recbuf = 0;
+	rdd_cksum2_ctx_free(state->ctx);
+	state->ctx = 0;
 
 	return RDD_OK;
 }
 
 static int
-new_checksum_blockfilter(RDD_FILTER **self, rdd_checksum_algorithm_t alg,
-		unsigned blocksize, const char *outpath, int overwrite)
+checksum_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
+	rdd_count_t len;
+	unsigned size;
+	void *ctx;
+	int rc;
+
+	if ((rc = flush_records(state)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = outfile_fsave(state->fp, &len)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_put_count(cp, name, "filelen", len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put_count(cp, name, "nrecord", state->nrecord);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	ctx = rdd_cksum2_ctx_state(state->ctx, &size);
+	return rdd_ckpt_put(cp, name, "checksum", ctx, size);
+}
+
+/* Restoring truncates the output file to its saved length; this
+ * also removes the file header that the constructor appended.
+ */
+static int
+checksum_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_CHECKSUM_BLOCKFILTER *state = (RDD_CHECKSUM_BLOCKFILTER *) f->state;
+	rdd_count_t len;
+	unsigned size;
+	void *ctx;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "filelen", &len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_get_count(cp, name, "nrecord", &state->nrecord);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state->nbyte = state->nrecord * f->blocksize;
+
+	ctx = rdd_cksum2_ctx_state(state->ctx, &size);
+	if ((rc = rdd_ckpt_get(cp, name, "checksum", ctx, size)) != RDD_OK) {
+		return rc;
+	}
+
+	state->reclen = 0;
+	return outfile_frestore(state->fp, len);
+}
+
+static int
+new_checksum_blockfilter(RDD_FILTER **self, unsigned type, int version,
+		unsigned blocksize, rdd_count_t offset,
+		const char *outpath, int overwrite, int indexed)
 {
 	RDD_FILTER *f = 0;
 	RDD_CHECKSUM_BLOCKFILTER *state = 0;
 	RDD_CHECKSUM_FILE_HEADER header;
+	unsigned char header2[RDD_CHECKSUM2_HEADER_SIZE];
 	char *path = 0;
 	FILE *fp = NULL;
+	unsigned char *recbuf = 0;
+	struct _RDD_CKSUM2_CTX *ctx = 0;
 	int rc = RDD_OK;
 
 	if (blocksize <= 0) return RDD_BADARG;
-	if (alg != RDD_ADLER32 && alg != RDD_CRC32) return RDD_BADARG;
+	if (version == 1
+	&&  type != RDD_ADLER32 && type != RDD_CRC32 && type != RDD_CRC32C) {
+		return RDD_BADARG;
+	}
+	if ((rc = rdd_cksum2_ctx_new(&ctx, type)) != RDD_OK) {
+		return rc;
+	}
 
 	rc = rdd_new_filter(&f, &checksum_ops, sizeof(RDD_CHECKSUM_BLOCKFILTER),
 			blocksize);
@@ -192,19 +324,43 @@ new_checksum_blockfilter(RDD_FILTER **self, rdd_checksum_algorithm_t alg,
 	}
 	strcpy(path, outpath);
 
+	if ((recbuf = malloc(RECORD_BUF_SIZE)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
 	if ((rc = outfile_fopen(&fp, outpath, overwrite)) != RDD_OK) {
 		goto error;
 	}
 
 	state->path = path;
 	state->fp = fp;
-	state->algorithm = alg;
-	reset_checksum(state);
-
-	init_header(&header, alg, blocksize, 0, 0);
-	if (fwrite((const void *) &header, sizeof(header), 1, state->fp) < 1) {
-		rc = RDD_EWRITE;
-		goto error;
+	state->ctx = ctx;
+	state->type = type;
+	state->recordsize = rdd_cksum2_record_size(type);
+	state->version = version;
+	state->indexed = indexed;
+	state->recbuf = recbuf;
+
+	/* A version-2 header is provisional until the filter is closed.
+	 */
+	if (version == 1) {
+		init_header(&header, type, blocksize, 0, 0);
+		if (fwrite((const void *) &header, sizeof(header), 1, fp) < 1) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
+	} else {
+		rc = rdd_cksum2_init_header(&state->header, type,
+					blocksize, offset);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		rdd_cksum2_encode_header(&state->header, header2);
+		if (fwrite(header2, sizeof header2, 1, fp) < 1) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
 	}
 
 	*self = f;
@@ -213,7 +369,9 @@ new_checksum_blockfilter(RDD_FILTER **self, rdd_checksum_algorithm_t alg,
 error:
 	*self = 0;
 	if (fp != NULL) fclose(fp);
+	if (recbuf != 0) free(recbuf);
 	if (path != 0) free(path);
+	if (ctx != 0) rdd_cksum2_ctx_free(ctx);
 	if (state != 0) free(state);
 	if (f != 0) free(f);
 	return rc;
@@ -223,14 +381,31 @@ int
 rdd_new_adler32_blockfilter(RDD_FILTER **f,
 		unsigned blocksize, const char *outpath, int overwrite)
 {
-	return new_checksum_blockfilter(f, RDD_ADLER32,
-					blocksize, outpath, overwrite);
+	return new_checksum_blockfilter(f, RDD_ADLER32, 1,
+					blocksize, 0, outpath, overwrite, 0);
 }
 
 int
 rdd_new_crc32_blockfilter(RDD_FILTER **f,
 		unsigned blocksize, const char *outpath, int overwrite)
 {
-	return new_checksum_blockfilter(f, RDD_CRC32,
-					blocksize, outpath, overwrite);
+	return new_checksum_blockfilter(f, RDD_CRC32, 1,
+					blocksize, 0, outpath, overwrite, 0);
+}
+
+int
+rdd_new_crc32c_blockfilter(RDD_FILTER **f,
+		unsigned blocksize, const char *outpath, int overwrite)
+{
+	return new_checksum_blockfilter(f, RDD_CRC32C, 1,
+					blocksize, 0, outpath, overwrite, 0);
+}
+
+int
+rdd_new_checksum2_blockfilter(RDD_FILTER **f, unsigned type,
+		unsigned blocksize, rdd_count_t offset,
+		const char *outpath, int overwrite, int indexed)
+{
+	return new_checksum_blockfilter(f, type, 2, blocksize, offset,
+					outpath, overwrite, indexed);
 }
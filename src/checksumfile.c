@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+/*
+ * Version-2 checksum files (see checksumfile.h and doc/checksum.txt).
+ *
+ * The checksum filters (checksumblockfilter.c) write these files
+ * and the verification filters (verifyblockfilter.c) read them.
+ * This file holds what they share: the header and record encoding,
+ * the record computation for all record types, and the index.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(HAVE_LIBCRYPTO) && defined(HAVE_OPENSSL_MD5_H) && defined(HAVE_OPENSSL_SHA_H)
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+#define HAVE_SHA256 1
+#else
+/* Use local versions to allow stand-alone compilation.
+ */
+#include "md5.h"
+#include "sha1.h"
+#endif /* HAVE_LIBCRYPTO */
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "checksum.h"
+#include "checksumfile.h"
+
+#define INDEX_ENTRY_SIZE(rs)	((rs) + 8)
+
+typedef struct _RDD_CKSUM2_CTX {
+	unsigned type;
+	union {
+		rdd_checksum_t checksum;
+		MD5_CTX        md5;
+		SHA_CTX        sha1;
+#ifdef HAVE_SHA256
+		SHA256_CTX     sha256;
+#endif
+	} u;
+} RDD_CKSUM2_CTX;
+
+/* An index entry as it is sorted in memory.  Records that are
+ * shorter than RDD_CKSUM2_MAX_RECORD are padded with zeroes, which
+ * does not change their order.
+ */
+typedef struct _RDD_CKSUM2_ENTRY {
+	unsigned char record[RDD_CKSUM2_MAX_RECORD];
+	rdd_count_t   blocknum;
+} RDD_CKSUM2_ENTRY;
+
+/* Little-endian encoding.
+ */
+static void
+put_le(unsigned char *p, rdd_count_t val, unsigned nbyte)
+{
+	unsigned i;
+
+	for (i = 0; i < nbyte; i++) {
+		p[i] = (unsigned char) (val & 0xff);
+		val >>= 8;
+	}
+}
+
+static rdd_count_t
+get_le(const unsigned char *p, unsigned nbyte)
+{
+	rdd_count_t val = 0;
+	unsigned i;
+
+	for (i = nbyte; i > 0; i--) {
+		val = (val << 8) | p[i - 1];
+	}
+	return val;
+}
+
+unsigned
+rdd_cksum2_record_size(unsigned type)
+{
+	switch (type) {
+	case RDD_ADLER32:
+	case RDD_CRC32:
+	case RDD_CRC32C:
+		return sizeof(rdd_checksum_t);
+	case RDD_CKSUM2_MD5:
+		return MD5_DIGEST_LENGTH;
+	case RDD_CKSUM2_SHA1:
+		return SHA_DIGEST_LENGTH;
+#ifdef HAVE_SHA256
+	case RDD_CKSUM2_SHA256:
+		return SHA256_DIGEST_LENGTH;
+#endif
+	default:
+		return 0;
+	}
+}
+
+const char *
+rdd_cksum2_name(unsigned type)
+{
+	switch (type) {
+	case RDD_ADLER32:       return "Adler32";
+	case RDD_CRC32:         return "CRC-32";
+	case RDD_CRC32C:        return "CRC-32C";
+	case RDD_CKSUM2_MD5:    return "MD5";
+	case RDD_CKSUM2_SHA1:   return "SHA-1";
+	case RDD_CKSUM2_SHA256: return "SHA-256";
+	default:                return "unknown";
+	}
+}
+
+int
+rdd_cksum2_init_header(RDD_CHECKSUM2_HEADER *hdr, unsigned type,
+		unsigned blocksize, rdd_count_t offset)
+{
+	unsigned recordsize = rdd_cksum2_record_size(type);
+
+	if (recordsize == 0 || blocksize == 0) {
+		return RDD_BADARG;
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->type = type;
+	hdr->recordsize = recordsize;
+	hdr->blocksize = blocksize;
+	hdr->offset = offset;
+
+	return RDD_OK;
+}
+
+void
+rdd_cksum2_encode_header(const RDD_CHECKSUM2_HEADER *hdr,
+		unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE])
+{
+	memset(buf, 0, RDD_CHECKSUM2_HEADER_SIZE);
+	put_le(buf +  0, RDD_CHECKSUM_MAGIC, 2);
+	put_le(buf +  2, RDD_CHECKSUM_VERSION2, 2);
+	put_le(buf +  4, hdr->type, 2);
+	put_le(buf +  6, hdr->flags, 2);
+	put_le(buf +  8, hdr->recordsize, 4);
+	put_le(buf + 12, hdr->blocksize, 4);
+	put_le(buf + 16, hdr->offset, 8);
+	put_le(buf + 24, hdr->imagesize, 8);
+	put_le(buf + 32, hdr->nrecord, 8);
+	put_le(buf + 40, hdr->indexpos, 8);
+	/* bytes 48-63 are reserved */
+}
+
+int
+rdd_cksum2_decode_header(const unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE],
+		RDD_CHECKSUM2_HEADER *hdr)
+{
+	if (get_le(buf, 2) != RDD_CHECKSUM_MAGIC
+	||  get_le(buf + 2, 2) != RDD_CHECKSUM_VERSION2) {
+		return RDD_ESYNTAX;
+	}
+
+	hdr->type = (unsigned) get_le(buf + 4, 2);
+	hdr->flags = (unsigned) get_le(buf + 6, 2);
+	hdr->recordsize = (unsigned) get_le(buf + 8, 4);
+	hdr->blocksize = (unsigned) get_le(buf + 12, 4);
+	hdr->offset = get_le(buf + 16, 8);
+	hdr->imagesize = get_le(buf + 24, 8);
+	hdr->nrecord = get_le(buf + 32, 8);
+	hdr->indexpos = get_le(buf + 40, 8);
+
+	if (hdr->recordsize == 0
+	||  hdr->recordsize != rdd_cksum2_record_size(hdr->type)
+	||  hdr->blocksize == 0) {
+		return RDD_ESYNTAX;
+	}
+
+	return RDD_OK;
+}
+
+void
+rdd_cksum2_put_checksum(unsigned char *record, rdd_checksum_t sum)
+{
+	put_le(record, sum, sizeof sum);
+}
+
+rdd_checksum_t
+rdd_cksum2_get_checksum(const unsigned char *record)
+{
+	return (rdd_checksum_t) get_le(record, sizeof(rdd_checksum_t));
+}
+
+static int
+compare_entries(const void *p1, const void *p2)
+{
+	const RDD_CKSUM2_ENTRY *e1 = (const RDD_CKSUM2_ENTRY *) p1;
+	const RDD_CKSUM2_ENTRY *e2 = (const RDD_CKSUM2_ENTRY *) p2;
+	int cmp;
+
+	cmp = memcmp(e1->record, e2->record, sizeof e1->record);
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (e1->blocknum < e2->blocknum) {
+		return -1;
+	}
+	return e1->blocknum > e2->blocknum;
+}
+
+/* Reads the records back from the output file, sorts them, and
+ * writes the index to fp.
+ */
+static int
+write_index(FILE *fp, const char *path, RDD_CHECKSUM2_HEADER *hdr)
+{
+	RDD_CKSUM2_ENTRY *entries = 0;
+	unsigned char buf[INDEX_ENTRY_SIZE(RDD_CKSUM2_MAX_RECORD)];
+	unsigned rs = hdr->recordsize;
+	FILE *in = NULL;
+	rdd_count_t i;
+	int rc = RDD_OK;
+
+	if (hdr->nrecord == 0) {
+		return RDD_OK;
+	}
+	if (hdr->nrecord > ((size_t) -1) / sizeof(*entries)) {
+		return RDD_NOMEM;
+	}
+
+	entries = calloc((size_t) hdr->nrecord, sizeof(*entries));
+	if (entries == 0) {
+		return RDD_NOMEM;
+	}
+
+	if ((in = fopen(path, "rb")) == NULL) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	if (fseeko(in, (off_t) RDD_CHECKSUM2_HEADER_SIZE, SEEK_SET) < 0) {
+		rc = RDD_ESEEK;
+		goto error;
+	}
+	for (i = 0; i < hdr->nrecord; i++) {
+		if (fread(entries[i].record, rs, 1, in) != 1) {
+			rc = RDD_EREAD;
+			goto error;
+		}
+		entries[i].blocknum = i;
+	}
+	fclose(in);
+	in = NULL;
+
+	qsort(entries, (size_t) hdr->nrecord, sizeof(*entries),
+		compare_entries);
+
+	hdr->indexpos = RDD_CHECKSUM2_HEADER_SIZE + hdr->nrecord * rs;
+	if (fseeko(fp, (off_t) hdr->indexpos, SEEK_SET) < 0) {
+		rc = RDD_ESEEK;
+		goto error;
+	}
+	for (i = 0; i < hdr->nrecord; i++) {
+		memcpy(buf, entries[i].record, rs);
+		put_le(buf + rs, entries[i].blocknum, 8);
+		if (fwrite(buf, INDEX_ENTRY_SIZE(rs), 1, fp) != 1) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
+	}
+	hdr->flags |= RDD_CHECKSUM2_INDEXED;
+
+error:
+	if (in != NULL) fclose(in);
+	free(entries);
+	return rc;
+}
+
+int
+rdd_cksum2_finish(FILE *fp, const char *path,
+		RDD_CHECKSUM2_HEADER *hdr, int indexed)
+{
+	unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE];
+	int rc;
+
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+
+	hdr->indexpos = 0;
+	hdr->flags &= ~RDD_CHECKSUM2_INDEXED;
+	if (indexed && (rc = write_index(fp, path, hdr)) != RDD_OK) {
+		return rc;
+	}
+
+	hdr->flags |= RDD_CHECKSUM2_FINISHED;
+	rdd_cksum2_encode_header(hdr, buf);
+	if (fseeko(fp, (off_t) 0, SEEK_SET) < 0) {
+		return RDD_ESEEK;
+	}
+	if (fwrite(buf, sizeof buf, 1, fp) != 1) {
+		return RDD_EWRITE;
+	}
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+
+	return RDD_OK;
+}
+
+static int
+read_entry(FILE *fp, const RDD_CHECKSUM2_HEADER *hdr, rdd_count_t i,
+		unsigned char *buf)
+{
+	off_t pos = (off_t) (hdr->indexpos + i * INDEX_ENTRY_SIZE(hdr->recordsize));
+
+	if (fseeko(fp, pos, SEEK_SET) < 0) {
+		return RDD_ESEEK;
+	}
+	if (fread(buf, INDEX_ENTRY_SIZE(hdr->recordsize), 1, fp) != 1) {
+		return RDD_EREAD;
+	}
+	return RDD_OK;
+}
+
+int
+rdd_cksum2_lookup(FILE *fp, const RDD_CHECKSUM2_HEADER *hdr,
+		const unsigned char *record, rdd_count_t *blocknum)
+{
+	unsigned char buf[INDEX_ENTRY_SIZE(RDD_CKSUM2_MAX_RECORD)];
+	unsigned rs = hdr->recordsize;
+	rdd_count_t lo = 0, hi = hdr->nrecord, mid;
+	int rc;
+
+	if ((hdr->flags & RDD_CHECKSUM2_INDEXED) == 0) {
+		return RDD_BADARG;
+	}
+
+	/* Find the first entry whose record is not smaller than record.
+	 */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((rc = read_entry(fp, hdr, mid, buf)) != RDD_OK) {
+			return rc;
+		}
+		if (memcmp(buf, record, rs) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo >= hdr->nrecord) {
+		return RDD_NOTFOUND;
+	}
+	if ((rc = read_entry(fp, hdr, lo, buf)) != RDD_OK) {
+		return rc;
+	}
+	if (memcmp(buf, record, rs) != 0) {
+		return RDD_NOTFOUND;
+	}
+
+	*blocknum = get_le(buf + rs, 8);
+	return RDD_OK;
+}
+
+int
+rdd_cksum2_ctx_new(RDD_CKSUM2_CTX **self, unsigned type)
+{
+	RDD_CKSUM2_CTX *ctx;
+
+	if (rdd_cksum2_record_size(type) == 0) {
+		return RDD_BADARG;
+	}
+	if ((ctx = malloc(sizeof(*ctx))) == 0) {
+		return RDD_NOMEM;
+	}
+	ctx->type = type;
+	rdd_cksum2_ctx_init(ctx);
+
+	*self = ctx;
+	return RDD_OK;
+}
+
+void
+rdd_cksum2_ctx_free(RDD_CKSUM2_CTX *ctx)
+{
+	free(ctx);
+}
+
+void
+rdd_cksum2_ctx_init(RDD_CKSUM2_CTX *ctx)
+{
+	switch (ctx->type) {
+	case RDD_CKSUM2_MD5:
+		MD5_Init(&ctx->u.md5);
+		break;
+	case RDD_CKSUM2_SHA1:
+		SHA1_Init(&ctx->u.sha1);
+		break;
+#ifdef HAVE_SHA256
+	case RDD_CKSUM2_SHA256:
+		SHA256_Init(&ctx->u.sha256);
+		break;
+#endif
+	default:
+		ctx->u.checksum =
+		  rdd_checksum_init((rdd_checksum_algorithm_t) ctx->type);
+		break;
+	}
+}
+
+void
+rdd_cksum2_ctx_update(RDD_CKSUM2_CTX *ctx, const unsigned char *buf,
+		unsigned nbyte)
+{
+	switch (ctx->type) {
+	case RDD_CKSUM2_MD5:
+		MD5_Update(&ctx->u.md5, buf, nbyte);
+		break;
+	case RDD_CKSUM2_SHA1:
+		SHA1_Update(&ctx->u.sha1, buf, nbyte);
+		break;
+#ifdef HAVE_SHA256
+	case RDD_CKSUM2_SHA256:
+		SHA256_Update(&ctx->u.sha256, buf, nbyte);
+		break;
+#endif
+	default:
+		ctx->u.checksum =
+		  rdd_checksum_update((rdd_checksum_algorithm_t) ctx->type,
+				ctx->u.checksum, buf, nbyte);
+		break;
+	}
+}
+
+void
+rdd_cksum2_ctx_final(RDD_CKSUM2_CTX *ctx, unsigned char *record)
+{
+	switch (ctx->type) {
+	case RDD_CKSUM2_MD5:
+		MD5_Final(record, &ctx->u.md5);
+		break;
+	case RDD_CKSUM2_SHA1:
+		SHA1_Final(record, &ctx->u.sha1);
+		break;
+#ifdef HAVE_SHA256
+	case RDD_CKSUM2_SHA256:
+		SHA256_Final(record, &ctx->u.sha256);
+		break;
+#endif
+	default:
+		rdd_cksum2_put_checksum(record, ctx->u.checksum);
+		break;
+	}
+
+	rdd_cksum2_ctx_init(ctx);
+}
+
+void *
+rdd_cksum2_ctx_state(RDD_CKSUM2_CTX *ctx, unsigned *size)
+{
+	switch (ctx->type) {
+	case RDD_CKSUM2_MD5:
+		*size = sizeof ctx->u.md5;
+		break;
+	case RDD_CKSUM2_SHA1:
+		*size = sizeof ctx->u.sha1;
+		break;
+#ifdef HAVE_SHA256
+	case RDD_CKSUM2_SHA256:
+		*size = sizeof ctx->u.sha256;
+		break;
+#endif
+	default:
+		*size = sizeof ctx->u.checksum;
+		break;
+	}
+
+	return &ctx->u;
+}
+
+int
+rdd_cksum2_compute(unsigned type, const unsigned char *buf, unsigned nbyte,
+		unsigned char *record)
+{
+	RDD_CKSUM2_CTX ctx;
+
+	if (rdd_cksum2_record_size(type) == 0) {
+		return RDD_BADARG;
+	}
+
+	ctx.type = type;
+	rdd_cksum2_ctx_init(&ctx);
+	rdd_cksum2_ctx_update(&ctx, buf, nbyte);
+	rdd_cksum2_ctx_final(&ctx, record);
+
+	return RDD_OK;
+}
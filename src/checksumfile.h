@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __checksumfile_h__
+#define __checksumfile_h__
+
+/** @file
+ *  \brief Checksum files, version 2.
+ *
+ *  A version-2 checksum file holds one record per block of an
+ *  image: a checksum (Adler32, CRC32, CRC32C) or a hash value (MD5,
+ *  SHA-1, SHA-256).  The file consists of a header of
+ *  \c RDD_CHECKSUM2_HEADER_SIZE bytes, followed by the records, in
+ *  block order, optionally followed by an index.  Unlike version 1
+ *  (\c RDD_CHECKSUM_FILE_HEADER), the layout does not depend on
+ *  the machine that wrote the file: all integers, including the
+ *  checksum records, are stored in little-endian byte order.
+ *  See doc/checksum.txt for the exact layout.
+ *
+ *  The magic and version fields are at the same place as in
+ *  version 1, so a reader can tell the versions apart from the
+ *  first four bytes of a file.
+ */
+
+#define RDD_CHECKSUM_VERSION2	0x0200
+
+/* Record types of version 2.  The checksum types are the values of
+ * rdd_checksum_algorithm_t (see rdd.h).
+ */
+#define RDD_CKSUM2_MD5		0x8
+#define RDD_CKSUM2_SHA1		0x10
+#define RDD_CKSUM2_SHA256	0x20
+
+#define RDD_CKSUM2_MAX_RECORD	32	/**< largest record size in bytes */
+
+#define RDD_CHECKSUM2_HEADER_SIZE	64	/**< size of an encoded header */
+
+#define RDD_CHECKSUM2_FINISHED	0x1	/**< flag: header is complete */
+#define RDD_CHECKSUM2_INDEXED	0x2	/**< flag: file has an index */
+
+/** \brief The header of a version-2 checksum file, in host byte order.
+ */
+typedef struct _RDD_CHECKSUM2_HEADER {
+	unsigned    type;	/**< record type, e.g. \c RDD_CRC32C */
+	unsigned    flags;	/**< \c RDD_CHECKSUM2_FINISHED etc. */
+	unsigned    recordsize;	/**< size in bytes of a record */
+	unsigned    blocksize;	/**< block size in bytes */
+	rdd_count_t offset;	/**< image offset of the first block */
+	rdd_count_t imagesize;	/**< number of bytes checksummed */
+	rdd_count_t nrecord;	/**< number of records */
+	rdd_count_t indexpos;	/**< file offset of the index, or 0 */
+} RDD_CHECKSUM2_HEADER;
+
+struct _RDD_CKSUM2_CTX;
+
+/** \brief Returns the record size of a record type.
+ *  \param type the record type
+ *  \return Returns the size in bytes of a record of type \c type, or
+ *  0 if \c type is unknown or not supported by this build.
+ */
+unsigned rdd_cksum2_record_size(unsigned type);
+
+/** \brief Returns the name of a record type, e.g. "SHA-256".
+ */
+const char *rdd_cksum2_name(unsigned type);
+
+/** \brief Initializes the header of a new version-2 checksum file.
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c type is unknown or \c blocksize is 0.
+ */
+int rdd_cksum2_init_header(RDD_CHECKSUM2_HEADER *hdr, unsigned type,
+		unsigned blocksize, rdd_count_t offset);
+
+/** \brief Encodes a header in its file format.
+ *  \param hdr the header
+ *  \param buf output value: the encoded header
+ */
+void rdd_cksum2_encode_header(const RDD_CHECKSUM2_HEADER *hdr,
+		unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE]);
+
+/** \brief Decodes a header.
+ *  \param buf the encoded header
+ *  \param hdr output value: the header
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_ESYNTAX if
+ *  \c buf does not hold a valid version-2 header.
+ */
+int rdd_cksum2_decode_header(const unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE],
+		RDD_CHECKSUM2_HEADER *hdr);
+
+/** \brief Encodes a checksum as a version-2 record.
+ */
+void rdd_cksum2_put_checksum(unsigned char *record, rdd_checksum_t sum);
+
+/** \brief Decodes a version-2 checksum record.
+ */
+rdd_checksum_t rdd_cksum2_get_checksum(const unsigned char *record);
+
+/** \brief Finishes a version-2 checksum file.
+ *  \param fp the output stream, positioned after the last record
+ *  \param path the name of the output file
+ *  \param hdr the header; \c nrecord and \c imagesize must be set
+ *  \param indexed true iff an index must be appended
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  This routine appends the index, if requested, and rewrites the
+ *  header.  Building the index reads the records back from \c path
+ *  and sorts them in memory, which takes
+ *  <tt>nrecord * (RDD_CKSUM2_MAX_RECORD + 8)</tt> bytes.
+ *  The stream is flushed but not closed.
+ */
+int rdd_cksum2_finish(FILE *fp, const char *path,
+		RDD_CHECKSUM2_HEADER *hdr, int indexed);
+
+/** \brief Finds a block with a given record in an indexed file.
+ *  \param fp an open version-2 checksum file
+ *  \param hdr the header of \c fp
+ *  \param record the record to look for
+ *  \param blocknum output value: the lowest number of a block whose
+ *         record equals \c record
+ *  \return Returns \c RDD_OK if a block was found and \c RDD_NOTFOUND
+ *  if there is no such block. Returns \c RDD_BADARG if the file has
+ *  no index.
+ *
+ *  The index is searched by binary search; the file position of
+ *  \c fp is undefined afterwards.
+ */
+int rdd_cksum2_lookup(FILE *fp, const RDD_CHECKSUM2_HEADER *hdr,
+		const unsigned char *record, rdd_count_t *blocknum);
+
+/** \brief Allocates a context that computes the records of one type.
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c type is unknown or not supported by this build.
+ */
+int rdd_cksum2_ctx_new(struct _RDD_CKSUM2_CTX **ctx, unsigned type);
+
+void rdd_cksum2_ctx_free(struct _RDD_CKSUM2_CTX *ctx);
+
+/** \brief Starts the record of a new block.
+ */
+void rdd_cksum2_ctx_init(struct _RDD_CKSUM2_CTX *ctx);
+
+/** \brief Adds data to the current block.
+ */
+void rdd_cksum2_ctx_update(struct _RDD_CKSUM2_CTX *ctx,
+		const unsigned char *buf, unsigned nbyte);
+
+/** \brief Stores the record of the current block in \c record and
+ *  starts a new block.
+ */
+void rdd_cksum2_ctx_final(struct _RDD_CKSUM2_CTX *ctx,
+		unsigned char *record);
+
+/** \brief Returns the internal state of a context, for checkpoints.
+ *  \param ctx the context
+ *  \param size output value: the size in bytes of the state
+ *  \return Returns a pointer to the state.
+ */
+void *rdd_cksum2_ctx_state(struct _RDD_CKSUM2_CTX *ctx, unsigned *size);
+
+/** \brief Computes the record of a whole block.
+ *  \param type the record type
+ *  \param buf the block
+ *  \param nbyte the size of the block in bytes
+ *  \param record output value: the record
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c type is unknown.
+ */
+int rdd_cksum2_compute(unsigned type, const unsigned char *buf,
+		unsigned nbyte, unsigned char *record);
+
+#endif /* __checksumfile_h__ */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Selects the compressing writers and decompressing readers by
+ * codec identifier.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <zlib.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "codec.h"
+
+static const char *codec_names[RDD_CODEC_COUNT] = {
+	"zlib",
+	"zstd",
+	"lz4"
+};
+
+const char *
+rdd_codec_name(unsigned codec)
+{
+	if (codec >= RDD_CODEC_COUNT) {
+		return 0;
+	}
+	return codec_names[codec];
+}
+
+int
+rdd_codec_lookup(const char *name, unsigned *codec)
+{
+	unsigned i;
+
+	for (i = 0; i < RDD_CODEC_COUNT; i++) {
+		if (strcmp(name, codec_names[i]) == 0) {
+			*codec = i;
+			return RDD_OK;
+		}
+	}
+	return RDD_NOTFOUND;
+}
+
+int
+rdd_codec_supported(unsigned codec)
+{
+	switch (codec) {
+	case RDD_CODEC_ZLIB:
+		return 1;
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		return 1;
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+int
+rdd_open_codec_writer(RDD_WRITER **w, RDD_WRITER *parent,
+		unsigned codec, int level)
+{
+	switch (codec) {
+	case RDD_CODEC_ZLIB:
+		if (level < 0 || level > Z_BEST_COMPRESSION) {
+			return RDD_BADARG;
+		}
+		return rdd_open_zlib_level_writer(w, parent,
+			level == 0 ? Z_DEFAULT_COMPRESSION : level);
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		return rdd_open_zstd_writer(w, parent, level);
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		return rdd_open_lz4_writer(w, parent, level);
+#endif
+	default:
+		return RDD_ECOMPRESS;
+	}
+}
+
+int
+rdd_open_codec_reader(RDD_READER **r, RDD_READER *parent, unsigned codec)
+{
+	switch (codec) {
+	case RDD_CODEC_ZLIB:
+		return rdd_open_zlib_reader(r, parent);
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		return rdd_open_zstd_reader(r, parent);
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		return rdd_open_lz4_reader(r, parent);
+#endif
+	default:
+		return RDD_ECOMPRESS;
+	}
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __codec_h__
+#define __codec_h__
+
+/** @file
+ *  Compression codecs.
+ *
+ *  rdd compresses network traffic and output images with zlib and,
+ *  if it was built with the libraries, with Zstandard or LZ4.  A
+ *  codec is identified by a small number that is also sent to the
+ *  server in the request header (see netio.h).
+ */
+
+#include "reader.h"
+#include "writer.h"
+
+typedef enum _rdd_codec_t {
+	RDD_CODEC_ZLIB = 0,
+	RDD_CODEC_ZSTD = 1,
+	RDD_CODEC_LZ4  = 2
+} rdd_codec_t;
+
+#define RDD_CODEC_COUNT		3
+
+/** \brief Returns the name of codec \c codec ("zlib", "zstd" or
+ *  "lz4"), or 0 if there is no such codec.
+ */
+const char *rdd_codec_name(unsigned codec);
+
+/** \brief Looks up a codec by name.
+ *  \param name the codec name
+ *  \param codec output value: the codec identifier
+ *  \return Returns \c RDD_OK on success and \c RDD_NOTFOUND if
+ *  there is no codec named \c name.
+ */
+int rdd_codec_lookup(const char *name, unsigned *codec);
+
+/** \brief Tells whether this build of rdd supports codec \c codec.
+ */
+int rdd_codec_supported(unsigned codec);
+
+/** \brief Stacks a compressing writer on top of \c parent.
+ *  \param w output value: the new writer object
+ *  \param parent all compressed output is written to \c parent
+ *  \param codec the codec
+ *  \param level the compression level; 0 selects the codec's
+ *         default level
+ *  \return Returns \c RDD_OK on success and \c RDD_ECOMPRESS if the
+ *  codec is not supported.
+ */
+int rdd_open_codec_writer(RDD_WRITER **w, RDD_WRITER *parent,
+		unsigned codec, int level);
+
+/** \brief Stacks a decompressing reader on top of \c parent.
+ *  \param r output value: the new reader object
+ *  \param parent the reader of the compressed data
+ *  \param codec the codec
+ *  \return Returns \c RDD_OK on success and \c RDD_ECOMPRESS if the
+ *  codec is not supported.
+ */
+int rdd_open_codec_reader(RDD_READER **r, RDD_READER *parent,
+		unsigned codec);
+
+/** \brief Default chunk size of a parallel codec writer.
+ */
+#define RDD_PARALLEL_CHUNK	(1024*1024)
+
+/** \brief Stacks a compressing writer on top of \c parent that
+ *  compresses on \c nthread worker threads.
+ *  \param w output value: the new writer object
+ *  \param parent all compressed output is written to \c parent
+ *  \param codec the codec
+ *  \param level the compression level; 0 selects the codec's
+ *         default level
+ *  \param nthread the number of worker threads
+ *  \param chunksize the input is compressed in independent chunks
+ *         of \c chunksize bytes (at least 32 Kbyte)
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The output is a single stream in the codec's ordinary format, so
+ *  the reader of rdd_open_codec_reader() decodes it.  A zlib stream
+ *  is built from deflate segments that each start with the previous
+ *  32 Kbyte as dictionary; zstd and LZ4 streams hold one frame per
+ *  chunk.  Parent writes are done by the caller's thread.
+ */
+int rdd_open_parallel_codec_writer(RDD_WRITER **w, RDD_WRITER *parent,
+		unsigned codec, int level, unsigned nthread, unsigned chunksize);
+
+/* Adaptive codec streams.
+ *
+ * An adaptive stream starts with a stream header: the magic bytes
+ * RDD_ADAPT_MAGIC, a format version and the codec.  It continues
+ * with chunks, each with a chunk header that holds
+ * - the chunk type (1 byte) and three zero bytes;
+ * - the size in bytes of the chunk's data (32 bits, big-endian);
+ * - the number of bytes that the chunk decodes to (64 bits,
+ *   big-endian).
+ *
+ * A stored chunk holds its input as is, a compressed chunk holds one
+ * independent zlib stream, zstd frame or LZ4 frame, and a zero chunk
+ * holds no data and decodes to a run of zero bytes.
+ */
+#define RDD_ADAPT_MAGIC		"RDDA"
+#define RDD_ADAPT_VERSION	1
+#define RDD_ADAPT_HDR_SIZE	8	/**< size of the stream header */
+#define RDD_ADAPT_CHUNK_HDR_SIZE 16	/**< size of a chunk header */
+#define RDD_ADAPT_MAX_CHUNK	(64*1024*1024)	/**< largest non-zero chunk */
+
+#define RDD_ADAPT_STORED	0	/**< data stored as is */
+#define RDD_ADAPT_COMPRESSED	1	/**< data compressed by the codec */
+#define RDD_ADAPT_ZERO		2	/**< run of zero bytes */
+
+/** \brief Statistics of an adaptive codec writer.
+ */
+typedef struct _RDD_CODEC_STATS {
+	rdd_count_t nbyte_in;		/**< #bytes written to the writer */
+	rdd_count_t nbyte_out;		/**< #bytes written to its parent */
+	rdd_count_t nbyte_compressed;	/**< #bytes in compressed chunks */
+	rdd_count_t nbyte_bypassed;	/**< #bytes stored because of their
+					     entropy, without compression */
+	rdd_count_t nbyte_incompressible; /**< #bytes stored because
+					     compression did not shrink them */
+	rdd_count_t nbyte_zero;		/**< #bytes in zero runs */
+	double      compress_time;	/**< seconds spent compressing, summed
+					     over the worker threads */
+	double      saved_time;		/**< estimated compression time saved
+					     by the bypass */
+} RDD_CODEC_STATS;
+
+/** \brief Stacks a compressing writer on top of \c parent that
+ *  writes an adaptive codec stream.
+ *  \param w output value: the new writer object
+ *  \param parent all output is written to \c parent
+ *  \param codec the codec
+ *  \param level the compression level; 0 selects the codec's
+ *         default level
+ *  \param nthread the number of worker threads
+ *  \param chunksize the input is cut in chunks of \c chunksize bytes
+ *         (at least 32 Kbyte and at most RDD_ADAPT_MAX_CHUNK)
+ *  \param maxentropy chunks with an estimated entropy of at least
+ *         \c maxentropy bits per byte are stored without trying to
+ *         compress them
+ *  \param stats output value, or 0: the writer's statistics; they
+ *         are complete once the writer has been closed
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The entropy of a chunk is estimated from the byte histogram of a
+ *  sample of the chunk.  Chunks that are all zero are merged into
+ *  zero runs.  Chunks whose compressed form is not smaller than the
+ *  chunk itself are stored as well.
+ */
+int rdd_open_adaptive_codec_writer(RDD_WRITER **w, RDD_WRITER *parent,
+		unsigned codec, int level, unsigned nthread, unsigned chunksize,
+		double maxentropy, RDD_CODEC_STATS *stats);
+
+/** \brief Stacks a reader on top of \c parent that decodes an
+ *  adaptive codec stream.
+ *  \param r output value: the new reader object
+ *  \param parent the reader of the adaptive stream
+ *  \param codec the codec of the stream
+ *  \return Returns \c RDD_OK on success and \c RDD_ECOMPRESS if the
+ *  codec is not supported.
+ *
+ *  Reads return \c RDD_ECOMPRESS if the stream header does not match
+ *  \c codec, or if the stream is damaged or truncated.
+ */
+int rdd_open_adaptive_codec_reader(RDD_READER **r, RDD_READER *parent,
+		unsigned codec);
+
+#endif /* __codec_h__ */
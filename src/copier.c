@@ -84,6 +84,26 @@ rdd_copy_exec(RDD_COPIER *c, RDD_READER *r, RDD_FILTERSET *fset,
 	return (*ops->exec)(c, r, fset, ret);
 }
 
+int
+rdd_copy_save(RDD_COPIER *c, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_COPY_OPS *ops = c->ops;
+
+	if (ops->save == 0) return RDD_NOTFOUND;
+
+	return (*ops->save)(c, cp, name);
+}
+
+int
+rdd_copy_restore(RDD_COPIER *c, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_COPY_OPS *ops = c->ops;
+
+	if (ops->restore == 0) return RDD_NOTFOUND;
+
+	return (*ops->restore)(c, cp, name);
+}
+
 int
 rdd_copy_free(RDD_COPIER *c)
 {
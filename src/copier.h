@@ -42,6 +42,7 @@
 
 struct _RDD_COPIER;
 struct _RDD_COPY_OPS;
+struct _RDD_CHECKPOINT;
 
 typedef struct _RDD_COPIER {
 	struct _RDD_COPY_OPS *ops;
@@ -62,12 +63,20 @@ typedef int (*rdd_copy_exec_fun)(RDD_COPIER *c,
 
 typedef int (*rdd_copy_free_fun)(RDD_COPIER *c);
 
+typedef int (*rdd_copy_save_fun)(RDD_COPIER *c,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
+typedef int (*rdd_copy_restore_fun)(RDD_COPIER *c,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
 /** Each copier must supply an \c RDD_COPY_OPS structure that
  *  contains its specific copy routines.
  */
 typedef struct _RDD_COPY_OPS {
 	rdd_copy_exec_fun exec;	/**< copy data */
 	rdd_copy_free_fun free;	/**< release the copier and its resources */
+	rdd_copy_save_fun save;	/**< save progress to a checkpoint (optional) */
+	rdd_copy_restore_fun restore; /**< resume from a checkpoint (optional) */
 } RDD_COPY_OPS;
 
 /** \brief Read error callback type.
@@ -81,6 +90,16 @@ typedef void (*rdd_substhandler_t)(rdd_count_t offset, unsigned nbyte,
 /** \brief Progress callback type.
  */
 typedef int (*rdd_proghandler_t)(rdd_count_t ncopied, void *env);
+/** \brief Block-size callback type.
+ *  Called when an adaptive copier switches from block length \c oldlen
+ *  to \c newlen at byte \c offset; \c bytes_per_sec is the measured
+ *  throughput at \c oldlen.
+ */
+typedef void (*rdd_blocklenhandler_t)(rdd_count_t offset, unsigned oldlen,
+				unsigned newlen, double bytes_per_sec, void *env);
+/** \brief Reader factory callback type.
+ */
+typedef int (*rdd_reader_opener_t)(RDD_READER **r, void *env);
 
 /** \brief Simple copier configuration parameters.
  */
@@ -102,6 +121,9 @@ typedef struct _RDD_ROBUST_PARAMS {
 	void                *substenv;    /**< substitution callback environment */
 	rdd_proghandler_t    progressfun; /**< progress callback */
 	void                *progressenv; /**< progress callback environment */
+	int                  adaptive;    /**< choose block length by throughput */
+	rdd_blocklenhandler_t blocklenfun; /**< block-size callback (adaptive) */
+	void                *blocklenenv; /**< block-size callback environment */
 } RDD_ROBUST_PARAMS;
 
 /* Constructors
@@ -160,11 +182,113 @@ int rdd_new_simple_copier(RDD_COPIER **c, RDD_SIMPLE_PARAMS *params);
  *  read errors occur. A robust copier will enter a retry phase when
  *  a read fails. In that phase it reduces the amount of data it reads
  *  at a time and it will retry reads that fail.
+ *
+ *  Normally the copier reads \c maxblocklen bytes at a time while no
+ *  errors occur.  If \c params->adaptive is set, it instead times its
+ *  reads and moves between the block lengths \c minblocklen,
+ *  2 * \c minblocklen, ..., \c maxblocklen towards the length that
+ *  gives the highest throughput.  A read that takes much longer than
+ *  usual makes it step down one length.
  */
 int rdd_new_robust_copier(RDD_COPIER **c,
 		rdd_count_t offset, rdd_count_t count,
 		RDD_ROBUST_PARAMS *params);
 
+/** \brief Creates a new pipelined copier.
+ *  \param c output value: will be set to a pointer to the new copier object.
+ *  \param offset byte offset; where to start copying
+ *  \param count the maximum number of bytes to copy
+ *  \param nbuf the number of read buffers in the pipeline (at least 2)
+ *  \param params the copier's error-handling parameters
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_NOMEM if there
+ *  is insufficient memory to create the object.
+ *
+ *  A pipelined copier reads exactly the same data as a robust copier
+ *  with the same arguments and handles read errors in the same way.
+ *  The difference is that reading is done by a separate thread, which
+ *  can run up to \c nbuf blocks ahead of the filters.  Reading the
+ *  next block therefore overlaps with writing and hashing the current
+ *  block.
+ *
+ *  The read-error, substitution, and progress callbacks in \c params
+ *  are called from the reader thread.
+ */
+int rdd_new_pipelined_copier(RDD_COPIER **c,
+		rdd_count_t offset, rdd_count_t count, unsigned nbuf,
+		RDD_ROBUST_PARAMS *params);
+
+/** \brief Creates a new striped copier.
+ *  \param c output value: will be set to a pointer to the new copier object.
+ *  \param offset byte offset; where to start copying
+ *  \param count the number of bytes to copy; must be known
+ *  \param nstripe the number of concurrent stripes
+ *  \param chunklen the number of bytes a stripe reads before the
+ *  next stripe takes over
+ *  \param nbuf the number of read buffers per stripe (at least 2)
+ *  \param openfun opens an additional input reader; called once for
+ *  each stripe except the first
+ *  \param openenv environment for \c openfun
+ *  \param params the copier's error-handling parameters
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c count is \c RDD_WHOLE_FILE.  Returns \c RDD_NOMEM if there
+ *  is insufficient memory to create the object.
+ *
+ *  A striped copier divides the input range in chunks of \c chunklen
+ *  bytes and deals them round-robin to \c nstripe stripes.  Each stripe
+ *  is copied by a robust copier that runs on its own thread and reads
+ *  from its own reader, so a slow or failing area holds up only one
+ *  stripe.  The first stripe reads from the reader passed to
+ *  \c rdd_copy_exec().
+ *
+ *  The data is pushed into the filter set in input order, so the
+ *  filters see the same stream as with a robust copier.  Read errors
+ *  and substitutions are reported with input offsets; \c maxsubst
+ *  limits the number of substitutions of all stripes together.
+ *  Callbacks in \c params are called one at a time, but not always
+ *  from the same thread.
+ */
+int rdd_new_striped_copier(RDD_COPIER **c,
+		rdd_count_t offset, rdd_count_t count,
+		unsigned nstripe, unsigned chunklen, unsigned nbuf,
+		rdd_reader_opener_t openfun, void *openenv,
+		RDD_ROBUST_PARAMS *params);
+
+/** \brief Creates a new rescue copier.
+ *  \param c output value: will be set to a pointer to the new copier object.
+ *  \param offset byte offset; where to start copying
+ *  \param count the number of bytes to copy; must be known
+ *  \param imagepath the image file; data is written at its input
+ *  position, relative to \c offset
+ *  \param mappath the rescue map file (see rescuemap.h)
+ *  \param params the copier's error-handling parameters
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c count is \c RDD_WHOLE_FILE.  Returns \c RDD_NOMEM if there
+ *  is insufficient memory to create the object.
+ *
+ *  A rescue copier first copies all data that can be read quickly:
+ *  it skips ahead, by a growing distance, after each read error.  It
+ *  then returns to the skipped areas, reading them in blocks of
+ *  \c minblocklen bytes, first forward, then backward, and finally
+ *  with \c nretry retries per block.  Blocks that cannot be read are
+ *  zeroed in the image.
+ *
+ *  The state of every input block is kept in the map file, which is
+ *  updated while the copier runs.  If the map file exists when
+ *  \c rdd_copy_exec() is called, the copier resumes the rescue that
+ *  it describes and keeps the existing image data.
+ *
+ *  The filter set receives the complete image, in order, after all
+ *  passes are done.  The progress callback receives the number of
+ *  bytes rescued so far.  If the copier gives up (see \c maxsubst)
+ *  or the progress callback aborts, the filter set is not closed
+ *  and \c RDD_ABORTED is returned; the map file records where to
+ *  resume.
+ */
+int rdd_new_rescue_copier(RDD_COPIER **c,
+		rdd_count_t offset, rdd_count_t count,
+		const char *imagepath, const char *mappath,
+		RDD_ROBUST_PARAMS *params);
+
 /* Generic routines
  */
 
@@ -185,6 +309,34 @@ int rdd_new_robust_copier(RDD_COPIER **c,
 int rdd_copy_exec(RDD_COPIER *c, RDD_READER *r, RDD_FILTERSET *fset,
 					    RDD_COPIER_RETURN *ret);
 
+/** \brief Saves a copier's progress in a checkpoint.
+ *  \param c a pointer to the copier object.
+ *  \param cp the checkpoint
+ *  \param name the copier's name in the checkpoint
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND if
+ *  the copier cannot be checkpointed.
+ *
+ *  This routine is meant to be called from the copier's progress
+ *  callback, when all data that the copier has counted so far has
+ *  been pushed into the filter set.  At present only the robust
+ *  copier supports checkpoints.
+ */
+int rdd_copy_save(RDD_COPIER *c, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
+/** \brief Restores a copier's progress from a checkpoint.
+ *  \param c a pointer to the copier object.
+ *  \param cp the checkpoint
+ *  \param name the copier's name in the checkpoint
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The copier must have been created with the same parameters as
+ *  the copier that was saved.  When \c rdd_copy_exec() is called,
+ *  the copier continues where the saved copier was.
+ */
+int rdd_copy_restore(RDD_COPIER *c, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
 /** \brief Deallocates the copier object and releases its resources.
  *  \param c a pointer to the copier object.
  *  \return Returns \c RDD_OK on success. 
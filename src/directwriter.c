@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * A direct writer bypasses the page cache.  It opens its output file
+ * with O_DIRECT, collects data in an aligned staging buffer, and
+ * writes the buffer when it is full.  O_DIRECT requires the buffer
+ * address, the file offset and the write size to be multiples of the
+ * target's logical block size.  The pieces that do not meet these
+ * requirements are written with O_DIRECT switched off.  These are the
+ * start of the output when writing begins at an unaligned offset, and
+ * the tail at close or at a checkpoint.  If the file system does not
+ * support O_DIRECT, the writer falls back to ordinary writes.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1		/* O_DIRECT */
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_LINUX_FS_H)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "writer.h"
+#include "alignedbuf.h"
+#include "checkpoint.h"
+
+#if !defined(O_DIRECT)
+#define O_DIRECT 0		/* not supported: use the page cache */
+#endif
+
+#define DIRECT_BUFSIZE (1024 * 1024)	/* staging buffer size */
+
+/* Forward declarations
+ */
+static int direct_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int direct_close(RDD_WRITER *w);
+static int direct_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int direct_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp,
+			const char *name);
+
+static RDD_WRITE_OPS direct_write_ops = {
+	direct_write,
+	direct_close,
+	direct_save,
+	direct_restore,
+	0
+};
+
+typedef struct _RDD_DIRECT_WRITER {
+	int            fd;
+	int            direct;	/* is O_DIRECT set? */
+	unsigned       blksize;	/* logical block size of the target */
+	RDD_ALIGNEDBUF buf;	/* staging buffer */
+	unsigned       bufsize;	/* staging buffer size; a multiple of blksize */
+	unsigned       nbuf;	/* #bytes in the staging buffer */
+	unsigned       head;	/* #bytes to write before offset is aligned */
+} RDD_DIRECT_WRITER;
+
+/* Returns the logical block size of the file or device open on fd.
+ * For regular files the file system's block size is used; it is a
+ * multiple of the device's logical block size.
+ */
+static unsigned
+logical_block_size(int fd)
+{
+	struct stat info;
+	unsigned size = RDD_SECTOR_SIZE;
+
+	if (fstat(fd, &info) < 0) {
+		return size;
+	}
+#if defined(HAVE_LINUX_FS_H) && defined(BLKSSZGET)
+	if (S_ISBLK(info.st_mode)) {
+		int ssz = 0;
+
+		if (ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0) {
+			size = (unsigned) ssz;
+		}
+	} else
+#endif
+	if (info.st_blksize > 0) {
+		size = (unsigned) info.st_blksize;
+	}
+
+	if (size < RDD_SECTOR_SIZE || (size & (size - 1)) != 0) {
+		size = 4096;	/* not a power of two; play safe */
+	}
+	return size;
+}
+
+/* Switches O_DIRECT on or off for state->fd.
+ */
+static int
+set_direct(RDD_DIRECT_WRITER *state, int on)
+{
+	int flags;
+
+	if ((flags = fcntl(state->fd, F_GETFL)) < 0) {
+		return -1;
+	}
+	flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	return fcntl(state->fd, F_SETFL, flags);
+}
+
+/* Determines how many bytes must be written before the file offset
+ * is aligned to the block size.
+ */
+static int
+compute_head(RDD_DIRECT_WRITER *state)
+{
+	off_t off;
+
+	if ((off = lseek(state->fd, (off_t) 0, SEEK_CUR)) == (off_t) -1) {
+		return RDD_ETELL;
+	}
+	state->head = (unsigned)
+		((state->blksize - off % state->blksize) % state->blksize);
+	return RDD_OK;
+}
+
+int
+rdd_open_direct_fd_writer(RDD_WRITER **self, int fd)
+{
+	RDD_WRITER *w = 0;
+	RDD_DIRECT_WRITER *state = 0;
+	int rc = RDD_OK;
+
+	rc = rdd_new_writer(&w, &direct_write_ops, sizeof(RDD_DIRECT_WRITER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_DIRECT_WRITER *) w->state;
+	state->fd = fd;
+	state->blksize = logical_block_size(fd);
+	state->nbuf = 0;
+	state->bufsize = ((DIRECT_BUFSIZE + state->blksize - 1) / state->blksize)
+			* state->blksize;
+
+	rc = rdd_new_alignedbuf(&state->buf, state->bufsize, state->blksize);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	if ((rc = compute_head(state)) != RDD_OK) {
+		goto error;
+	}
+
+	/* File systems that do not support O_DIRECT refuse the flag.
+	 */
+	state->direct = O_DIRECT != 0 && set_direct(state, 1) == 0;
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (state->buf.unaligned != 0) rdd_free_alignedbuf(&state->buf);
+	free(state);
+	free(w);
+	return rc;
+}
+
+int
+rdd_open_direct_writer(RDD_WRITER **w, const char *path)
+{
+	int fd = -1;
+	int rc;
+
+	fd = open(path, O_CREAT|O_TRUNC|O_WRONLY|O_DIRECT, S_IRUSR|S_IWUSR);
+	if (fd < 0 && errno == EINVAL) {
+		fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR);
+	}
+	if (fd < 0) {
+		return RDD_EOPEN;
+	}
+
+	if ((rc = rdd_open_direct_fd_writer(w, fd)) != RDD_OK) {
+		close(fd);
+	}
+	return rc;
+}
+
+/* Writes nbyte bytes from buf to the output file.  If the kernel
+ * rejects a direct write, O_DIRECT is switched off for good and the
+ * write is retried.
+ */
+static int
+write_out(RDD_DIRECT_WRITER *state, const unsigned char *buf, unsigned nbyte)
+{
+	int n;
+
+	while (nbyte > 0) {
+		if ((n = write(state->fd, buf, nbyte)) < 0) {
+#if defined(RDD_SIGNALS)
+			if (errno == EINTR) continue;
+#endif
+			if (errno == EINVAL && state->direct) {
+				if (set_direct(state, 0) < 0) {
+					return RDD_EWRITE;
+				}
+				state->direct = 0;
+				continue;
+			}
+			if (errno == ENOSPC) {
+				return RDD_ESPACE;
+			} else {
+				return RDD_EWRITE;
+			}
+		}
+		buf += n;
+		nbyte -= n;
+	}
+
+	return RDD_OK;
+}
+
+/* Writes an unaligned piece of data with O_DIRECT switched off.
+ */
+static int
+write_unaligned(RDD_DIRECT_WRITER *state, const unsigned char *buf,
+		unsigned nbyte)
+{
+	int rc;
+
+	if (!state->direct) {
+		return write_out(state, buf, nbyte);
+	}
+
+	if (set_direct(state, 0) < 0) {
+		return RDD_EWRITE;
+	}
+	rc = write_out(state, buf, nbyte);
+	if (set_direct(state, 1) < 0 && rc == RDD_OK) {
+		rc = RDD_EWRITE;
+	}
+	return rc;
+}
+
+/* Writes all whole blocks in the staging buffer with O_DIRECT.  If
+ * all is nonzero, the partial block at the end is written as well;
+ * the next write then starts at an unaligned offset.  Otherwise the
+ * partial block moves to the start of the staging buffer.
+ */
+static int
+flush(RDD_DIRECT_WRITER *state, int all)
+{
+	unsigned char *data = state->buf.aligned;
+	unsigned nblock, ntail;
+	int rc;
+
+	ntail = state->nbuf % state->blksize;
+	nblock = state->nbuf - ntail;
+
+	if (nblock > 0 && (rc = write_out(state, data, nblock)) != RDD_OK) {
+		return rc;
+	}
+
+	if (ntail > 0 && all) {
+		rc = write_unaligned(state, data + nblock, ntail);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		state->head = state->blksize - ntail;
+		ntail = 0;
+	} else if (ntail > 0) {
+		memmove(data, data + nblock, ntail);
+	}
+	state->nbuf = ntail;
+
+	return RDD_OK;
+}
+
+static int
+direct_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_DIRECT_WRITER *state = w->state;
+	unsigned n;
+	int rc;
+
+	while (nbyte > 0) {
+		if (state->head > 0) {
+			/* Bring the file offset to a block boundary.
+			 */
+			n = nbyte < state->head ? nbyte : state->head;
+			if ((rc = write_unaligned(state, buf, n)) != RDD_OK) {
+				return rc;
+			}
+			state->head -= n;
+		} else {
+			n = state->bufsize - state->nbuf;
+			if (n > nbyte) {
+				n = nbyte;
+			}
+			memcpy(state->buf.aligned + state->nbuf, buf, n);
+			state->nbuf += n;
+			if (state->nbuf == state->bufsize
+			&&  (rc = flush(state, 0)) != RDD_OK) {
+				return rc;
+			}
+		}
+		buf += n;
+		nbyte -= n;
+	}
+
+	return RDD_OK;
+}
+
+static int
+direct_close(RDD_WRITER *self)
+{
+	RDD_DIRECT_WRITER *state = self->state;
+	int rc;
+
+	if ((rc = flush(state, 1)) != RDD_OK) {
+		return rc;
+	}
+	if (close(state->fd) < 0) {
+		return RDD_ECLOSE;
+	}
+	rdd_free_alignedbuf(&state->buf);
+
+	return RDD_OK;
+}
+
+/* Writes out the staging buffer and records the file offset.  Uses
+ * the same record as the fd writer.
+ */
+static int
+direct_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_DIRECT_WRITER *state = w->state;
+	off_t off;
+	int rc;
+
+	if ((rc = flush(state, 1)) != RDD_OK) {
+		return rc;
+	}
+	if ((off = lseek(state->fd, (off_t) 0, SEEK_CUR)) == (off_t) -1) {
+		return RDD_ETELL;
+	}
+	if (fsync(state->fd) < 0 && errno != EINVAL) {
+		return RDD_EWRITE;
+	}
+
+	return rdd_ckpt_put_count(cp, name, "pos", (rdd_count_t) off);
+}
+
+/* Moves back to the saved file offset; see fd_restore().
+ */
+static int
+direct_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_DIRECT_WRITER *state = w->state;
+	struct stat info;
+	rdd_count_t pos;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "pos", &pos)) != RDD_OK) {
+		return rc;
+	}
+	if (fstat(state->fd, &info) < 0) {
+		return RDD_ESEEK;
+	}
+	if (S_ISREG(info.st_mode)) {
+		if ((rdd_count_t) info.st_size < pos) {
+			return RDD_ERANGE;	/* output file is too short */
+		}
+		if (ftruncate(state->fd, (off_t) pos) < 0) {
+			return RDD_EWRITE;
+		}
+	}
+	if (lseek(state->fd, (off_t) pos, SEEK_SET) == (off_t) -1) {
+		return RDD_ESEEK;
+	}
+	state->nbuf = 0;
+
+	return compute_head(state);
+}
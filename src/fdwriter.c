@@ -35,27 +35,44 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "rdd.h"
 #include "writer.h"
+#include "checkpoint.h"
 
 /* Forward declarations
  */
 static int fd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
 static int fd_close(RDD_WRITER *w);
+static int fd_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int fd_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int fd_holes(RDD_WRITER *w, rdd_count_t *nbyte);
 
 static RDD_WRITE_OPS fd_write_ops = {
 	fd_write,
-	fd_close
+	fd_close,
+	fd_save,
+	fd_restore,
+	fd_holes
 };
 
+/* A sparse writer looks for zero data in blocks of this size.
+ */
+#define SPARSE_BLOCK 4096
+
 typedef struct _RDD_FD_WRITER {
 	int fd;
+	int sparse;		/* leave holes for zero blocks? */
+	int hole_at_end;	/* file must be extended before it is closed */
+	rdd_count_t nhole;	/* #bytes left as holes */
 } RDD_FD_WRITER;
 
-int
-rdd_open_fd_writer(RDD_WRITER **self, int fd)
+static int
+open_fd(RDD_WRITER **self, int fd, int sparse)
 {
 	RDD_WRITER *w = 0;
 	RDD_FD_WRITER *state = 0;
@@ -67,21 +84,60 @@ rdd_open_fd_writer(RDD_WRITER **self, int fd)
 	}
 	state = (RDD_FD_WRITER *) w->state;
 	state->fd = fd;
+	state->sparse = sparse;
+	state->hole_at_end = 0;
+	state->nhole = 0;
 
 	*self = w;
 	return RDD_OK;
 }
 
-/* Writes the entire input buffer to the output file descriptor.
+int
+rdd_open_fd_writer(RDD_WRITER **self, int fd)
+{
+	return open_fd(self, fd, 0);
+}
+
+int
+rdd_open_sparse_fd_writer(RDD_WRITER **self, int fd)
+{
+	struct stat info;
+	off_t off;
+	int sparse;
+
+	/* Skipping over old data would leave that data in place, so
+	 * only regular files that end at the current offset get holes.
+	 * Block devices are written in full.
+	 */
+	off = lseek(fd, (off_t) 0, SEEK_CUR);
+	sparse = off != (off_t) -1
+		&& fstat(fd, &info) == 0
+		&& S_ISREG(info.st_mode)
+		&& info.st_size <= off;
+
+	return open_fd(self, fd, sparse);
+}
+
+/* Returns nonzero if all nbyte bytes in buf are zero.  Comparing the
+ * block to itself shifted by one byte lets memcmp(), which C libraries
+ * vectorize, do the scanning.
  */
 static int
-fd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+all_zero(const unsigned char *buf, unsigned nbyte)
+{
+	return nbyte == 0
+		|| (buf[0] == 0 && memcmp(buf, buf + 1, nbyte - 1) == 0);
+}
+
+/* Writes the entire input buffer to file descriptor fd.
+ */
+static int
+write_all(int fd, const unsigned char *buf, unsigned nbyte)
 {
-	RDD_FD_WRITER *state = w->state;
 	int n;
 
 	while (nbyte > 0) {
-		if ((n = write(state->fd, buf, nbyte)) < 0) {
+		if ((n = write(fd, buf, nbyte)) < 0) {
 #if defined(RDD_SIGNALS)
 			if (errno == EINTR) continue;
 #endif
@@ -98,15 +154,161 @@ fd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
 	return RDD_OK;
 }
 
+/* Writes the entire input buffer to the output file descriptor.  A
+ * sparse writer splits the buffer into runs of zero and nonzero blocks;
+ * it writes the nonzero runs and skips the zero runs.
+ */
+static int
+fd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_FD_WRITER *state = w->state;
+	unsigned len, n;
+	int zero;
+	int rc;
+
+	if (!state->sparse) {
+		return write_all(state->fd, buf, nbyte);
+	}
+
+	while (nbyte > 0) {
+		len = nbyte < SPARSE_BLOCK ? nbyte : SPARSE_BLOCK;
+		zero = all_zero(buf, len);
+		while (len < nbyte) {
+			n = nbyte - len < SPARSE_BLOCK ? nbyte - len : SPARSE_BLOCK;
+			if (all_zero(buf + len, n) != zero) break;
+			len += n;
+		}
+
+		if (zero) {
+			if (lseek(state->fd, (off_t) len, SEEK_CUR) == (off_t) -1) {
+				return RDD_ESEEK;
+			}
+			state->nhole += len;
+			state->hole_at_end = 1;
+		} else {
+			if ((rc = write_all(state->fd, buf, len)) != RDD_OK) {
+				return rc;
+			}
+			state->hole_at_end = 0;
+		}
+		buf += len;
+		nbyte -= len;
+	}
+
+	return RDD_OK;
+}
+
+/* A file that ends in a hole is shorter than its current offset;
+ * extends the file to that offset.
+ */
+static int
+extend_file(RDD_FD_WRITER *state)
+{
+	off_t off;
+
+	if (!state->hole_at_end) {
+		return RDD_OK;
+	}
+	if ((off = lseek(state->fd, (off_t) 0, SEEK_CUR)) == (off_t) -1) {
+		return RDD_ETELL;
+	}
+	if (ftruncate(state->fd, off) < 0) {
+		return errno == ENOSPC ? RDD_ESPACE : RDD_EWRITE;
+	}
+	state->hole_at_end = 0;
+
+	return RDD_OK;
+}
+
 static int
 fd_close(RDD_WRITER *self)
 {
 	RDD_FD_WRITER *state = self->state;
 	int rc;
 
+	if ((rc = extend_file(state)) != RDD_OK) {
+		return rc;
+	}
 	if ((rc = close(state->fd)) < 0) {
 		return RDD_ECLOSE;
 	}
 
 	return RDD_OK;
 }
+
+/* Records the current file offset after forcing all data written
+ * so far to disk.  Fails for pipes and sockets.
+ */
+static int
+fd_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_FD_WRITER *state = w->state;
+	rdd_count_t pos;
+	off_t off;
+	int rc;
+
+	if ((rc = extend_file(state)) != RDD_OK) {
+		return rc;
+	}
+	if ((off = lseek(state->fd, (off_t) 0, SEEK_CUR)) == (off_t) -1) {
+		return RDD_ETELL;
+	}
+	if (fsync(state->fd) < 0 && errno != EINVAL) {
+		return RDD_EWRITE;
+	}
+	pos = (rdd_count_t) off;
+
+	rc = rdd_ckpt_put_count(cp, name, "holes", state->nhole);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	return rdd_ckpt_put_count(cp, name, "pos", pos);
+}
+
+/* Moves back to the saved file offset.  A regular file is truncated
+ * there, so that data written after the checkpoint disappears.
+ */
+static int
+fd_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_FD_WRITER *state = w->state;
+	struct stat info;
+	rdd_count_t pos;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "pos", &pos)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_get_count(cp, name, "holes", &state->nhole);
+	if (rc == RDD_NOTFOUND) {
+		state->nhole = 0;	/* saved by a writer without holes */
+	} else if (rc != RDD_OK) {
+		return rc;
+	}
+	if (fstat(state->fd, &info) < 0) {
+		return RDD_ESEEK;
+	}
+	if (S_ISREG(info.st_mode)) {
+		if ((rdd_count_t) info.st_size < pos) {
+			return RDD_ERANGE;	/* output file is too short */
+		}
+		if (ftruncate(state->fd, (off_t) pos) < 0) {
+			return RDD_EWRITE;
+		}
+	}
+	if (lseek(state->fd, (off_t) pos, SEEK_SET) == (off_t) -1) {
+		return RDD_ESEEK;
+	}
+	state->hole_at_end = 0;
+
+	return RDD_OK;
+}
+
+static int
+fd_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	RDD_FD_WRITER *state = w->state;
+
+	*nbyte = state->nhole;
+	return RDD_OK;
+}
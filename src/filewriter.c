@@ -62,3 +62,15 @@ rdd_open_file_writer(RDD_WRITER **w, const char *path)
 
 	return rdd_open_fd_writer(w, fd);
 }
+
+int
+rdd_open_sparse_file_writer(RDD_WRITER **w, const char *path)
+{
+	int fd = -1;
+
+	if ((fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR)) < 0) {
+		return RDD_EOPEN;
+	}
+
+	return rdd_open_sparse_fd_writer(w, fd);
+}
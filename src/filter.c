@@ -39,6 +39,7 @@ static char copyright[] =
 #include "config.h"
 #endif
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,10 +47,55 @@ static char copyright[] =
 #include "rdd.h"
 #include "writer.h"
 #include "filter.h"
+#include "checkpoint.h"
 
 #define is_stream_filter(fltr)  ((fltr)->ops->block == 0)
 #define is_block_filter(fltr)   ((fltr)->ops->block != 0)
 
+/* Parallel block filters.
+ *
+ * Pushed data is copied into a ring of nslot batches; every batch
+ * holds up to nblock whole blocks.  Batch number seq lives in slot
+ * seq % nslot.  Batches head..tail-1 have been submitted; the
+ * workers take them in order (next is the first batch that no
+ * worker has taken yet) and store one digest() result per block in
+ * the batch.  The pushing thread emits the results of the oldest
+ * batch once it is done and only then reuses its slot, so the
+ * results leave the ring in block order.
+ *
+ * A block that was begun in the filter's own state, which happens
+ * when a checkpoint is saved or restored in the middle of a block,
+ * is finished with the filter's input() and block() routines.  No
+ * batch is outstanding at that time.
+ */
+#define PAR_BATCH	(256 * 1024)	/* bytes per batch */
+
+typedef struct _RDD_FILTER_BATCH {
+	unsigned char *data;
+	unsigned char *results;
+	unsigned       len;	/* number of valid bytes in data */
+	int            done;	/* all results are present */
+	int            status;	/* first digest() error or RDD_OK */
+} RDD_FILTER_BATCH;
+
+struct _RDD_FILTER_PAR {
+	pthread_mutex_t   lock;
+	pthread_cond_t    submitted;	/* new batch or stop request */
+	pthread_cond_t    finished;	/* a batch is done */
+	RDD_FILTER_BATCH *batches;
+	unsigned          nslot;
+	unsigned          nblock;	/* blocks per batch */
+	unsigned long     head;		/* sequence number of next batch */
+	unsigned long     next;		/* next batch for the workers */
+	unsigned long     tail;		/* oldest batch not yet emitted */
+	RDD_FILTER_BATCH *cur;		/* batch being filled, or 0 */
+	pthread_t        *workers;
+	unsigned          nworker;
+	unsigned          nstarted;
+	int               stop;
+	int               serial;	/* current block is in f->state */
+};
+
 /** This is a convenience routine that can (and should) be used
  *  by filter implementations to initialize the 'base' filter.
  */
@@ -134,6 +180,352 @@ block_filter_push(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 	return RDD_OK;
 }
 
+static void *
+par_worker(void *arg)
+{
+	RDD_FILTER *f = (RDD_FILTER *) arg;
+	struct _RDD_FILTER_PAR *par = f->par;
+	RDD_FILTER_OPS *ops = f->ops;
+	RDD_FILTER_BATCH *b;
+	unsigned pos, len;
+	unsigned char *result;
+	int rc;
+
+	pthread_mutex_lock(&par->lock);
+	for (;;) {
+		while (par->next == par->head && !par->stop) {
+			pthread_cond_wait(&par->submitted, &par->lock);
+		}
+		if (par->next == par->head) {
+			break;		/* stopped and drained */
+		}
+		b = &par->batches[par->next % par->nslot];
+		par->next++;
+		pthread_mutex_unlock(&par->lock);
+
+		rc = RDD_OK;
+		result = b->results;
+		for (pos = 0; pos < b->len && rc == RDD_OK; pos += len) {
+			len = b->len - pos;
+			if (len > f->blocksize) {
+				len = f->blocksize;
+			}
+			rc = (*ops->digest)(f, b->data + pos, len, result);
+			result += ops->resultsize;
+		}
+
+		pthread_mutex_lock(&par->lock);
+		b->status = rc;
+		b->done = 1;
+		pthread_cond_broadcast(&par->finished);
+	}
+	pthread_mutex_unlock(&par->lock);
+
+	return 0;
+}
+
+/* Emits the results of a finished batch.
+ */
+static int
+par_emit(RDD_FILTER *f, RDD_FILTER_BATCH *b)
+{
+	RDD_FILTER_OPS *ops = f->ops;
+	unsigned pos, len;
+	unsigned char *result;
+	int rc;
+
+	if (b->status != RDD_OK) {
+		return b->status;
+	}
+
+	result = b->results;
+	for (pos = 0; pos < b->len; pos += len) {
+		len = b->len - pos;
+		if (len > f->blocksize) {
+			len = f->blocksize;
+		}
+		if ((rc = (*ops->emit)(f, result, len)) != RDD_OK) {
+			return rc;
+		}
+		result += ops->resultsize;
+	}
+
+	return RDD_OK;
+}
+
+/* Emits the results of all batches before batch number seq, waiting
+ * for the workers where necessary.  If wait is zero, stops at the
+ * first batch that is not done yet instead.
+ */
+static int
+par_retire(RDD_FILTER *f, unsigned long seq, int wait)
+{
+	struct _RDD_FILTER_PAR *par = f->par;
+	RDD_FILTER_BATCH *b;
+	int rc = RDD_OK;
+
+	pthread_mutex_lock(&par->lock);
+	while (par->tail < seq) {
+		b = &par->batches[par->tail % par->nslot];
+		if (!b->done) {
+			if (!wait) {
+				break;
+			}
+			pthread_cond_wait(&par->finished, &par->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&par->lock);
+
+		/* Only this thread touches a batch after it is done.
+		 */
+		rc = par_emit(f, b);
+		b->done = 0;
+		b->len = 0;
+
+		pthread_mutex_lock(&par->lock);
+		par->tail++;
+		if (rc != RDD_OK) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&par->lock);
+
+	return rc;
+}
+
+/* Hands the current batch to the workers.
+ */
+static void
+par_submit(struct _RDD_FILTER_PAR *par)
+{
+	pthread_mutex_lock(&par->lock);
+	par->head++;
+	par->cur = 0;
+	pthread_cond_signal(&par->submitted);
+	pthread_mutex_unlock(&par->lock);
+}
+
+/* Stops the workers and releases all resources.  Batches that
+ * have not been emitted yet are discarded.
+ */
+static void
+par_stop(RDD_FILTER *f)
+{
+	struct _RDD_FILTER_PAR *par = f->par;
+	unsigned i;
+
+	pthread_mutex_lock(&par->lock);
+	par->stop = 1;
+	pthread_cond_broadcast(&par->submitted);
+	pthread_mutex_unlock(&par->lock);
+
+	for (i = 0; i < par->nstarted; i++) {
+		pthread_join(par->workers[i], 0);
+	}
+
+	for (i = 0; par->batches != 0 && i < par->nslot; i++) {
+		free(par->batches[i].data);
+		free(par->batches[i].results);
+	}
+	free(par->batches);
+	free(par->workers);
+	pthread_cond_destroy(&par->finished);
+	pthread_cond_destroy(&par->submitted);
+	pthread_mutex_destroy(&par->lock);
+	free(par);
+	f->par = 0;
+}
+
+/* Submits the whole blocks of the current batch and emits all
+ * results.  The rest of the batch, the beginning of the current
+ * block, is passed to the filter's input() routine; from then on
+ * the filter's own state holds the current block.
+ */
+static int
+par_flush(RDD_FILTER *f)
+{
+	struct _RDD_FILTER_PAR *par = f->par;
+	RDD_FILTER_BATCH *b = par->cur;
+	unsigned whole = 0, partial = 0;
+	int rc;
+
+	if (b != 0) {
+		partial = b->len % f->blocksize;
+		whole = b->len - partial;
+		b->len = whole;
+		if (whole > 0) {
+			par_submit(par);
+		} else {
+			par->cur = 0;
+		}
+	}
+
+	if ((rc = par_retire(f, par->head, 1)) != RDD_OK) {
+		return rc;
+	}
+
+	/* The slot of b has been emitted but not reused, so its data
+	 * is still there.
+	 */
+	if (partial > 0) {
+		rc = (*f->ops->input)(f, b->data + whole, partial);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		par->serial = 1;
+	}
+
+	return RDD_OK;
+}
+
+static int
+par_push(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
+{
+	struct _RDD_FILTER_PAR *par = f->par;
+	RDD_FILTER_OPS *ops = f->ops;
+	RDD_FILTER_BATCH *b;
+	unsigned batchsize = par->nblock * f->blocksize;
+	unsigned todo;
+	int rc;
+
+	while (nbyte > 0) {
+		if (par->serial) {
+			todo = f->blocksize - f->pos;
+			if (todo > nbyte) {
+				todo = nbyte;
+			}
+			if ((rc = (*ops->input)(f, buf, todo)) != RDD_OK) {
+				return rc;
+			}
+			buf += todo;
+			nbyte -= todo;
+			f->pos += todo;
+			if (f->pos >= f->blocksize) {
+				if ((rc = (*ops->block)(f, f->pos)) != RDD_OK) {
+					return rc;
+				}
+				f->pos = 0;
+				par->serial = 0;
+			}
+			continue;
+		}
+
+		if (par->cur == 0) {
+			/* Wait for the slot of the next batch to be
+			 * emitted, and emit whatever else is done.
+			 */
+			if (par->head >= par->nslot) {
+				rc = par_retire(f, par->head - par->nslot + 1, 1);
+				if (rc != RDD_OK) {
+					return rc;
+				}
+			}
+			if ((rc = par_retire(f, par->head, 0)) != RDD_OK) {
+				return rc;
+			}
+			par->cur = &par->batches[par->head % par->nslot];
+		}
+
+		b = par->cur;
+		todo = batchsize - b->len;
+		if (todo > nbyte) {
+			todo = nbyte;
+		}
+		memcpy(b->data + b->len, buf, todo);
+		b->len += todo;
+		buf += todo;
+		nbyte -= todo;
+		f->pos = b->len % f->blocksize;
+
+		if (b->len == batchsize) {
+			par_submit(par);
+		}
+	}
+
+	return RDD_OK;
+}
+
+/* Emits all results, including that of a final partial block, and
+ * stops the workers.
+ */
+static int
+par_finish(RDD_FILTER *f)
+{
+	struct _RDD_FILTER_PAR *par = f->par;
+	int rc;
+
+	if (par->cur != 0) {
+		par_submit(par);
+		f->pos = 0;
+	}
+	rc = par_retire(f, par->head, 1);
+	par_stop(f);
+
+	return rc;
+}
+
+int
+rdd_filter_set_parallel(RDD_FILTER *f, unsigned nworker)
+{
+	struct _RDD_FILTER_PAR *par = 0;
+	RDD_FILTER_OPS *ops = f->ops;
+	RDD_FILTER_BATCH *b;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (!is_block_filter(f) || ops->digest == 0 || ops->emit == 0) {
+		return RDD_BADARG;
+	}
+	if (nworker == 0 || f->par != 0) return RDD_BADARG;
+
+	if ((par = calloc(1, sizeof(*par))) == 0) {
+		return RDD_NOMEM;
+	}
+	pthread_mutex_init(&par->lock, 0);
+	pthread_cond_init(&par->submitted, 0);
+	pthread_cond_init(&par->finished, 0);
+	par->nslot = 2 * nworker;
+	par->nblock = PAR_BATCH / f->blocksize;
+	if (par->nblock == 0) {
+		par->nblock = 1;
+	}
+	par->nworker = nworker;
+	par->serial = (f->pos > 0);
+	f->par = par;
+
+	if ((par->batches = calloc(par->nslot, sizeof(RDD_FILTER_BATCH))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	for (i = 0; i < par->nslot; i++) {
+		b = &par->batches[i];
+		b->data = malloc(par->nblock * f->blocksize);
+		b->results = malloc(par->nblock * ops->resultsize);
+		if (b->data == 0 || b->results == 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+	}
+
+	if ((par->workers = calloc(nworker, sizeof(pthread_t))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	for (i = 0; i < nworker; i++) {
+		if (pthread_create(&par->workers[i], 0, par_worker, f) != 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		par->nstarted++;
+	}
+
+	return RDD_OK;
+
+error:
+	par_stop(f);
+	return rc;
+}
+
 /** Passes a buffer of nbyte bytes to a filter.  If the filter is a
  *  stream filter it will simply pass the buffer to the client's
  *  handler.  If the filter is a block filter, it processes the
@@ -146,6 +538,8 @@ rdd_filter_push(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 
 	if (is_stream_filter(f)) {
 		return stream_filter_push(f, buf, nbyte);
+	} else if (f->par != 0) {
+		return par_push(f, buf, nbyte);
 	} else {
 		return block_filter_push(f, buf, nbyte);
 	}
@@ -157,6 +551,10 @@ rdd_filter_close(RDD_FILTER *f)
 	RDD_FILTER_OPS *ops = f->ops;
 	int rc;
 
+	if (f->par != 0 && (rc = par_finish(f)) != RDD_OK) {
+		return rc;
+	}
+
 	if (is_block_filter(f) && f->pos > 0) {
 		rc = (*ops->block)(f, f->pos);	/* final block() call */
 		if (rc != RDD_OK) {
@@ -184,12 +582,55 @@ rdd_filter_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
 	return (*ops->get_result)(f, buf, nbyte);
 }
 
+int
+rdd_filter_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_FILTER_OPS *ops = f->ops;
+	int rc;
+
+	if (ops->save == 0) return RDD_NOTFOUND;
+
+	if (f->par != 0 && (rc = par_flush(f)) != RDD_OK) {
+		return rc;
+	}
+
+	rc = rdd_ckpt_put(cp, name, "blockpos", &f->pos, sizeof f->pos);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	return (*ops->save)(f, cp, name);
+}
+
+int
+rdd_filter_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_FILTER_OPS *ops = f->ops;
+	int rc;
+
+	if (ops->restore == 0) return RDD_NOTFOUND;
+
+	rc = rdd_ckpt_get(cp, name, "blockpos", &f->pos, sizeof f->pos);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	if (f->par != 0) {
+		f->par->serial = (f->pos > 0);
+	}
+
+	return (*ops->restore)(f, cp, name);
+}
+
 int
 rdd_filter_free(RDD_FILTER *f)
 {
 	RDD_FILTER_OPS *ops = f->ops;
 	int rc;
 
+	if (f->par != 0) {
+		par_stop(f);
+	}
+
 	if (ops->free != 0) {
 		rc = (*ops->free)(f);
 		if (rc != RDD_OK) {
@@ -49,9 +49,20 @@
  *  after every B bytes of input data.  These B bytes, however, may be
  *  passed to the filter through multiple calls to the filter's input()
  *  routine.
+ *
+ *  A block filter whose blocks are independent of each other can also
+ *  supply a digest() and an emit() routine.  The digest routine computes
+ *  the result of one whole block (a hash value, a checksum) without
+ *  touching the filter's state; the emit routine outputs such a result.
+ *  Such filters can compute their blocks on several threads (see
+ *  \c rdd_filter_set_parallel()).
  */
 struct _RDD_FILTER;
 struct _RDD_FILTER_OPS;
+struct _RDD_FILTER_PAR;
+struct _RDD_CHECKPOINT;
+struct _RDD_BLOCKHASH_FILE;
+struct _RDD_CHECKSUM2_HEADER;
 
 typedef int (*rdd_fltr_input_fun)(struct _RDD_FILTER *f,
 				const unsigned char *buf, unsigned nbyte);
@@ -65,12 +76,30 @@ typedef int (*rdd_fltr_rslt_fun)(struct _RDD_FILTER *f,
 
 typedef int (*rdd_fltr_free_fun)(struct _RDD_FILTER *f);
 
+typedef int (*rdd_fltr_save_fun)(struct _RDD_FILTER *f,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
+typedef int (*rdd_fltr_restore_fun)(struct _RDD_FILTER *f,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
+typedef int (*rdd_fltr_digest_fun)(struct _RDD_FILTER *f,
+				const unsigned char *buf, unsigned nbyte,
+				void *result);
+
+typedef int (*rdd_fltr_emit_fun)(struct _RDD_FILTER *f,
+				const void *result, unsigned nbyte);
+
 typedef struct _RDD_FILTER_OPS {
 	rdd_fltr_input_fun  input;	/* used to pass data to the filter */
 	rdd_fltr_block_fun  block;	/* used to mark block boundaries */
 	rdd_fltr_close_fun  close;	/* used to mark end of input */
 	rdd_fltr_rslt_fun   get_result; /* used to obtain final result */
 	rdd_fltr_free_fun   free;       /* deallocate filter state */
+	rdd_fltr_save_fun   save;	/* save state to a checkpoint */
+	rdd_fltr_restore_fun restore;	/* restore state from a checkpoint */
+	rdd_fltr_digest_fun digest;	/* compute the result of one block */
+	rdd_fltr_emit_fun   emit;	/* output the result of one block */
+	unsigned            resultsize;	/* size of a digest() result */
 } RDD_FILTER_OPS;
 
 typedef struct _RDD_FILTER {
@@ -78,12 +107,18 @@ typedef struct _RDD_FILTER {
 	RDD_FILTER_OPS *ops;
 	unsigned        blocksize;	/* zero for stream filters */
 	unsigned        pos;		/* position in current block */
+	struct _RDD_FILTER_PAR *par;	/* parallel block execution or 0 */
 } RDD_FILTER;
 
 typedef void (*rdd_fltr_error_fun)(rdd_count_t pos,
 				rdd_checksum_t expected, 
 				rdd_checksum_t computed, void *env);
 
+typedef void (*rdd_fltr_digest_error_fun)(rdd_count_t pos,
+				const unsigned char *expected,
+				const unsigned char *computed,
+				unsigned size, void *env);
+
 /* Constructors
  */
 int rdd_new_filter(RDD_FILTER **f, RDD_FILTER_OPS *ops,
@@ -98,6 +133,23 @@ int rdd_new_write_streamfilter(RDD_FILTER **f, RDD_WRITER *writer);
 int rdd_new_md5_blockfilter(RDD_FILTER **f,
 		unsigned blocksize, const char *outpath, int overwrite);
 
+/** \brief Creates a block filter that writes a binary block-hash file.
+ *  \param f output value: the new filter
+ *  \param blocksize the block size in bytes
+ *  \param offset the image offset of the first block (for the header)
+ *  \param outpath the name of the block-hash file
+ *  \param overwrite the overwrite mode of the block-hash file
+ *  \param indexed true iff the file must get a sorted digest index
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The filter computes the same MD5 hash values as the filter created
+ *  by \c rdd_new_md5_blockfilter(), but writes them in the format
+ *  described in blockhash.h.
+ */
+int rdd_new_binary_md5_blockfilter(RDD_FILTER **f,
+		unsigned blocksize, rdd_count_t offset,
+		const char *outpath, int overwrite, int indexed);
+
 int rdd_new_stats_blockfilter(RDD_FILTER **f,
 		unsigned blocksize, const char *outpath, int overwrite);
 
@@ -107,12 +159,71 @@ int rdd_new_adler32_blockfilter(RDD_FILTER **f,
 int rdd_new_crc32_blockfilter(RDD_FILTER **f,
 		unsigned blocksize, const char *outpath, int overwrite);
 
+int rdd_new_crc32c_blockfilter(RDD_FILTER **f,
+		unsigned blocksize, const char *outpath, int overwrite);
+
+/** \brief Creates a block filter that writes a version-2 checksum file.
+ *  \param f output value: the new filter
+ *  \param type the record type: \c RDD_ADLER32, \c RDD_CRC32,
+ *         \c RDD_CRC32C, or one of the hash types in checksumfile.h
+ *  \param blocksize the block size in bytes
+ *  \param offset the image offset of the first block (for the header)
+ *  \param outpath the name of the checksum file
+ *  \param overwrite the overwrite mode of the checksum file
+ *  \param indexed true iff the file must get a sorted record index
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c type is not supported.
+ */
+int rdd_new_checksum2_blockfilter(RDD_FILTER **f, unsigned type,
+		unsigned blocksize, rdd_count_t offset,
+		const char *outpath, int overwrite, int indexed);
+
 int rdd_new_verify_adler32_blockfilter(RDD_FILTER **f, FILE *fp,
 	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env);
 
 int rdd_new_verify_crc32_blockfilter(RDD_FILTER **f, FILE *fp,
 	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env);
 
+int rdd_new_verify_crc32c_blockfilter(RDD_FILTER **f, FILE *fp,
+	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env);
+
+/** \brief Creates a block filter that verifies blocks against the
+ *  records in a version-2 checksum file.
+ *  \param f output value: the new filter
+ *  \param fp the checksum file, positioned after the header
+ *  \param hdr the decoded header of \c fp
+ *  \param err called for every block whose record differs, and
+ *         once, with a null \c computed record, for the first block
+ *         that is missing from the input; records are passed as they
+ *         are stored in the file
+ *  \param env passed to \c err
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The filter's result is the number of bad or missing blocks, as
+ *  an \c unsigned.
+ */
+int rdd_new_verify_checksum2_blockfilter(RDD_FILTER **f, FILE *fp,
+	const struct _RDD_CHECKSUM2_HEADER *hdr,
+	rdd_fltr_digest_error_fun err, void *env);
+
+/** \brief Creates a block filter that verifies blocks against the
+ *  MD5 hash values in a block-hash file.
+ *  \param f output value: the new filter
+ *  \param bf the block-hash file; it must stay open while the
+ *         filter is in use
+ *  \param err called for every block whose hash value differs, and
+ *         once, with a null \c computed digest, for the first block
+ *         that is missing from the input
+ *  \param env passed to \c err
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The filter's result is the number of bad or missing blocks, as
+ *  an \c unsigned.
+ */
+int rdd_new_verify_md5_blockfilter(RDD_FILTER **f,
+	struct _RDD_BLOCKHASH_FILE *bf, rdd_fltr_digest_error_fun err,
+	void *env);
+
 /* Generic routines
  */
 /** \brief Pushes a data buffer into a filter.
@@ -127,6 +238,25 @@ int rdd_new_verify_crc32_blockfilter(RDD_FILTER **f, FILE *fp,
  */
 int rdd_filter_push(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte);
 
+/** \brief Computes the blocks of a block filter on several threads.
+ *  \param f the filter
+ *  \param nworker the number of threads
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  \c f is not a block filter with \c digest() and \c emit() routines,
+ *  if \c nworker is zero, or if \c f already runs in parallel.
+ *
+ *  Data pushed into a parallel filter is copied into batches of
+ *  whole blocks.  Each batch is handed to a worker thread, which calls
+ *  the filter's \c digest() routine for every block in it.  The
+ *  results pass through a reorder buffer: the filter's \c emit()
+ *  routine is called on the pushing thread, in block order, so the
+ *  filter's output is the same as that of a sequential run.
+ *  Results are emitted some time after their blocks were pushed;
+ *  \c rdd_filter_save() and \c rdd_filter_close() emit all
+ *  outstanding results.
+ */
+int rdd_filter_set_parallel(RDD_FILTER *f, unsigned nworker);
+
 /** \brief Closes a filter for input.
  *  \param f the filter
  *  \return Returns \c RDD_OK on success.
@@ -148,6 +278,32 @@ int rdd_filter_close(RDD_FILTER *f);
  */
 int rdd_filter_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte);
 
+/** \brief Saves a filter's state in a checkpoint.
+ *  \param f the filter
+ *  \param cp the checkpoint
+ *  \param name the filter's name in the checkpoint
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND if
+ *  the filter cannot be checkpointed.
+ *  The saved state includes everything the filter has written to
+ *  its output file so far: the output file is flushed and its length
+ *  is recorded.
+ */
+int rdd_filter_save(RDD_FILTER *f, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
+/** \brief Restores a filter's state from a checkpoint.
+ *  \param f the filter
+ *  \param cp the checkpoint
+ *  \param name the filter's name in the checkpoint
+ *  \return Returns \c RDD_OK on success.
+ *  Filter \c f must have been created with the same parameters
+ *  as the filter that was saved; its output file must have been
+ *  opened in \c RDD_APPEND mode.  Output written after the checkpoint
+ *  was saved is discarded.
+ */
+int rdd_filter_restore(RDD_FILTER *f, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
 /** \brief Deallocates a filter and its resources.
  *  \param f the filter
  *  \return Returns \c RDD_OK on success.
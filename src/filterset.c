@@ -41,7 +41,9 @@ static char copyright[] =
 
 #include <assert.h>
 #include <memory.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "rdd.h"
@@ -49,15 +51,280 @@ static char copyright[] =
 #include "writer.h"
 #include "filter.h"
 #include "filterset.h"
+#include "checkpoint.h"
+#include "alignedbuf.h"
 
 #define is_stream_filter(fltr)  ((fltr)->block_size <= 0)
 #define is_block_filter(fltr)  ((fltr)->block_size > 0)
 
+/* Chunked pushes.
+ *
+ * With several filters and large buffers, pushing the whole buffer
+ * through one filter after another evicts the buffer from the cache
+ * before the next filter reads it.  Therefore a buffer that is larger
+ * than the filter set's chunk size is passed to all filters one chunk
+ * at a time.  Block filters keep track of their position within the
+ * current block across pushes, so their block boundaries do not
+ * depend on the chunk size.
+ */
+
+/* Parallel filter sets.
+ *
+ * Every worker runs a fixed group of filters.  The workers share a
+ * ring of buffers.  Buffer number seq lives in slot seq % nbuf; its
+ * reference count is set to the number of workers and each worker
+ * drops it after pushing the buffer into its filters.  The producer
+ * reuses a slot only when its reference count is zero.
+ *
+ * A producer that obtains the next slot with rdd_fset_get_buffer()
+ * reads its data directly into the shared buffer, and rdd_fset_push()
+ * then only hands the slot to the workers.  Data from anywhere else is
+ * copied into the slot first.
+ */
+typedef struct _RDD_FSET_BUF {
+	RDD_ALIGNEDBUF mem;
+	unsigned       size;	/* usable size of mem.aligned */
+	unsigned       len;	/* number of valid bytes */
+	unsigned       refcnt;	/* #workers that still need this buffer */
+} RDD_FSET_BUF;
+
+typedef struct _RDD_FSET_WORKER {
+	struct _RDD_FSET_PAR *par;
+	pthread_t     thread;
+	RDD_FILTER  **filters;
+	unsigned      nfilter;
+	unsigned long next;	/* sequence number of next buffer */
+} RDD_FSET_WORKER;
+
+struct _RDD_FSET_PAR {
+	pthread_mutex_t  lock;
+	pthread_cond_t   filled;	/* new buffer or stop request */
+	pthread_cond_t   released;	/* a buffer's refcnt dropped to zero */
+	RDD_FSET_BUF    *bufs;
+	unsigned         nbuf;
+	unsigned long    head;		/* sequence number of next buffer */
+	RDD_FSET_WORKER *workers;
+	unsigned         nworker;
+	unsigned         nstarted;
+	unsigned         chunk;		/* push granularity (0 = none) */
+	int              stop;
+	int              status;	/* first filter error or RDD_OK */
+};
+
+/* Pushes buf into an array of filters, chunk by chunk.  Used both
+ * by rdd_fset_push() and by the workers of a parallel filter set.
+ */
+static int
+push_filters(RDD_FILTER **filters, unsigned nfilter, unsigned chunk,
+		const unsigned char *buf, unsigned nbyte)
+{
+	unsigned len;
+	unsigned i;
+	int rc;
+
+	if (chunk == 0 || nfilter < 2) {
+		chunk = nbyte;	/* nothing to gain */
+	}
+
+	do {
+		len = nbyte < chunk ? nbyte : chunk;
+		for (i = 0; i < nfilter; i++) {
+			rc = rdd_filter_push(filters[i], buf, len);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+		}
+		buf += len;
+		nbyte -= len;
+	} while (nbyte > 0);
+
+	return RDD_OK;
+}
+
+static void *
+fset_worker(void *arg)
+{
+	RDD_FSET_WORKER *w = (RDD_FSET_WORKER *) arg;
+	struct _RDD_FSET_PAR *par = w->par;
+	RDD_FSET_BUF *b;
+	int status;
+	int rc;
+
+	pthread_mutex_lock(&par->lock);
+	for (;;) {
+		while (w->next == par->head && !par->stop) {
+			pthread_cond_wait(&par->filled, &par->lock);
+		}
+		if (w->next == par->head) {
+			break;		/* stopped and drained */
+		}
+		b = &par->bufs[w->next % par->nbuf];
+		status = par->status;
+		pthread_mutex_unlock(&par->lock);
+
+		/* After an error, buffers are released without being
+		 * processed so that the producer never blocks.
+		 */
+		rc = RDD_OK;
+		if (status == RDD_OK) {
+			rc = push_filters(w->filters, w->nfilter, par->chunk,
+					b->mem.aligned, b->len);
+		}
+
+		pthread_mutex_lock(&par->lock);
+		if (rc != RDD_OK && par->status == RDD_OK) {
+			par->status = rc;
+		}
+		w->next++;
+		if (--b->refcnt == 0) {
+			pthread_cond_signal(&par->released);
+		}
+	}
+	pthread_mutex_unlock(&par->lock);
+
+	return 0;
+}
+
+/* Stops the workers after they have processed all pending buffers
+ * and releases all resources.  Returns the first filter error.
+ */
+static int
+fset_stop_parallel(RDD_FILTERSET *fset)
+{
+	struct _RDD_FSET_PAR *par = fset->par;
+	unsigned i;
+	int rc;
+
+	pthread_mutex_lock(&par->lock);
+	par->stop = 1;
+	pthread_cond_broadcast(&par->filled);
+	pthread_mutex_unlock(&par->lock);
+
+	for (i = 0; i < par->nstarted; i++) {
+		pthread_join(par->workers[i].thread, 0);
+	}
+	rc = par->status;
+
+	for (i = 0; par->workers != 0 && i < par->nworker; i++) {
+		free(par->workers[i].filters);
+	}
+	for (i = 0; par->bufs != 0 && i < par->nbuf; i++) {
+		if (par->bufs[i].mem.unaligned != 0) {
+			(void) rdd_free_alignedbuf(&par->bufs[i].mem);
+		}
+	}
+	free(par->workers);
+	free(par->bufs);
+	pthread_cond_destroy(&par->released);
+	pthread_cond_destroy(&par->filled);
+	pthread_mutex_destroy(&par->lock);
+	free(par);
+	fset->par = 0;
+
+	return rc;
+}
+
+/* Waits until every worker has processed all buffers pushed so far.
+ * Workers process the buffers in order, so it suffices to wait for
+ * the most recent buffer.  Returns the first filter error.
+ */
+static int
+fset_drain_parallel(RDD_FILTERSET *fset)
+{
+	struct _RDD_FSET_PAR *par = fset->par;
+	RDD_FSET_BUF *b;
+	int rc;
+
+	pthread_mutex_lock(&par->lock);
+	if (par->head > 0) {
+		b = &par->bufs[(par->head - 1) % par->nbuf];
+		while (b->refcnt > 0) {
+			pthread_cond_wait(&par->released, &par->lock);
+		}
+	}
+	rc = par->status;
+	pthread_mutex_unlock(&par->lock);
+
+	return rc;
+}
+
+/* Waits until the next slot in the ring is free and makes sure that
+ * it can hold size bytes.  No worker refers to the slot after this,
+ * so the producer can fill it without holding the lock.
+ */
+static int
+fset_next_buf(struct _RDD_FSET_PAR *par, unsigned size, RDD_FSET_BUF **buf)
+{
+	RDD_FSET_BUF *b;
+	int rc;
+
+	pthread_mutex_lock(&par->lock);
+	b = &par->bufs[par->head % par->nbuf];
+	while (b->refcnt > 0) {
+		pthread_cond_wait(&par->released, &par->lock);
+	}
+	rc = par->status;
+	pthread_mutex_unlock(&par->lock);
+
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	if (b->mem.unaligned == 0 || size > b->size) {
+		if (b->mem.unaligned != 0) {
+			(void) rdd_free_alignedbuf(&b->mem);
+			b->size = 0;
+		}
+		rc = rdd_new_alignedbuf(&b->mem, size, RDD_SECTOR_SIZE);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		b->size = size;
+	}
+
+	*buf = b;
+	return RDD_OK;
+}
+
+static int
+fset_push_parallel(RDD_FILTERSET *fset, const unsigned char *buf,
+		unsigned nbyte)
+{
+	struct _RDD_FSET_PAR *par = fset->par;
+	RDD_FSET_BUF *b;
+	int rc;
+
+	if ((rc = fset_next_buf(par, nbyte, &b)) != RDD_OK) {
+		return rc;
+	}
+
+	/* The producer alone advances head, so a buffer that was lent
+	 * out by rdd_fset_get_buffer() is still the next slot and
+	 * already holds the data.
+	 */
+	if (buf != b->mem.aligned && nbyte > 0) {
+		memcpy(b->mem.aligned, buf, nbyte);
+	}
+	b->len = nbyte;
+
+	pthread_mutex_lock(&par->lock);
+	b->refcnt = par->nworker;
+	par->head++;
+	pthread_cond_broadcast(&par->filled);
+	pthread_mutex_unlock(&par->lock);
+
+	return RDD_OK;
+}
+
 int
 rdd_fset_init(RDD_FILTERSET *fset)
 {
 	fset->head = 0;
 	fset->tail = &fset->head;
+	fset->filters = 0;
+	fset->nfilter = 0;
+	fset->par = 0;
+	fset->chunk = 0;
 
 	return RDD_OK;
 }
@@ -66,10 +333,12 @@ int
 rdd_fset_add(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f)
 {
 	RDD_FSET_NODE *node = 0;
+	RDD_FILTER **filters;
 	char *filtername = 0;
 	int rc = RDD_OK;
 
 	if (name == 0 || strlen(name) < 1 || f == 0) return RDD_BADARG;
+	if (fset->par != 0) return RDD_BADARG;	/* workers already running */
 
 	rc = rdd_fset_get(fset, name, 0);
 	if (rc == RDD_OK) {
@@ -90,6 +359,15 @@ rdd_fset_add(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f)
 	}
 	strcpy(filtername, name);
 
+	filters = realloc(fset->filters,
+			(fset->nfilter + 1) * sizeof(RDD_FILTER *));
+	if (filters == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	fset->filters = filters;
+	fset->filters[fset->nfilter++] = f;
+
 	node->name = filtername;
 	node->filter = f;
 	node->next = 0;
@@ -107,6 +385,84 @@ error:
 	return rc;
 }
 
+int
+rdd_fset_set_parallel(RDD_FILTERSET *fset, unsigned nworker, unsigned nbuf)
+{
+	struct _RDD_FSET_PAR *par = 0;
+	RDD_FSET_WORKER *w;
+	unsigned nfilter = fset->nfilter;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (fset->par != 0 || nbuf < 2) return RDD_BADARG;
+	if (nfilter == 0) return RDD_BADARG;
+	if (nworker == 0 || nworker > nfilter) {
+		nworker = nfilter;
+	}
+
+	if ((par = calloc(1, sizeof(*par))) == 0) {
+		return RDD_NOMEM;
+	}
+	pthread_mutex_init(&par->lock, 0);
+	pthread_cond_init(&par->filled, 0);
+	pthread_cond_init(&par->released, 0);
+	par->status = RDD_OK;
+	par->nbuf = nbuf;
+	par->nworker = nworker;
+	par->chunk = fset->chunk;
+	fset->par = par;
+
+	if ((par->bufs = calloc(nbuf, sizeof(RDD_FSET_BUF))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if ((par->workers = calloc(nworker, sizeof(RDD_FSET_WORKER))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	/* Assign the filters round-robin to the workers.
+	 */
+	for (i = 0; i < nworker; i++) {
+		w = &par->workers[i];
+		w->par = par;
+		w->filters = calloc((nfilter + nworker - 1) / nworker,
+					sizeof(RDD_FILTER *));
+		if (w->filters == 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+	}
+	for (i = 0; i < nfilter; i++) {
+		w = &par->workers[i % nworker];
+		w->filters[w->nfilter++] = fset->filters[i];
+	}
+
+	for (i = 0; i < nworker; i++) {
+		w = &par->workers[i];
+		if (pthread_create(&w->thread, 0, fset_worker, w) != 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		par->nstarted++;
+	}
+
+	return RDD_OK;
+
+error:
+	(void) fset_stop_parallel(fset);
+	return rc;
+}
+
+int
+rdd_fset_set_chunk(RDD_FILTERSET *fset, unsigned chunk)
+{
+	if (fset->par != 0) return RDD_BADARG;
+
+	fset->chunk = chunk;
+	return RDD_OK;
+}
+
 int
 rdd_fset_get(RDD_FILTERSET *fset, const char *name, RDD_FILTER **f)
 {
@@ -152,14 +508,52 @@ rdd_fset_cursor_close(RDD_FSET_CURSOR *c)
 	return RDD_OK;
 }
 
+int
+rdd_fset_get_buffer(RDD_FILTERSET *fset, unsigned size, unsigned char **buf)
+{
+	RDD_FSET_BUF *b;
+	int rc;
+
+	if (fset->par == 0) {
+		return RDD_NOTFOUND;	/* no shared buffers */
+	}
+
+	if ((rc = fset_next_buf(fset->par, size, &b)) != RDD_OK) {
+		return rc;
+	}
+
+	*buf = b->mem.aligned;
+	return RDD_OK;
+}
+
 int
 rdd_fset_push(RDD_FILTERSET *fset, const unsigned char *buf, unsigned nbyte)
+{
+	if (fset->par != 0) {
+		return fset_push_parallel(fset, buf, nbyte);
+	}
+
+	return push_filters(fset->filters, fset->nfilter, fset->chunk,
+				buf, nbyte);
+}
+
+int
+rdd_fset_close(RDD_FILTERSET *fset)
 {
 	RDD_FSET_NODE *node;
 	int rc;
 
+	/* Close the filters on this thread, in list order, once
+	 * the workers are gone.
+	 */
+	if (fset->par != 0) {
+		if ((rc = fset_stop_parallel(fset)) != RDD_OK) {
+			return rc;
+		}
+	}
+
 	for (node = fset->head; node != 0; node = node->next) {
-		rc = rdd_filter_push(node->filter, buf, nbyte);
+		rc = rdd_filter_close(node->filter);
 		if (rc != RDD_OK) {
 			return rc;
 		}
@@ -169,13 +563,35 @@ rdd_fset_push(RDD_FILTERSET *fset, const unsigned char *buf, unsigned nbyte)
 }
 
 int
-rdd_fset_close(RDD_FILTERSET *fset)
+rdd_fset_save(RDD_FILTERSET *fset, RDD_CHECKPOINT *cp)
 {
 	RDD_FSET_NODE *node;
 	int rc;
 
+	if (fset->par != 0) {
+		if ((rc = fset_drain_parallel(fset)) != RDD_OK) {
+			return rc;
+		}
+	}
+
 	for (node = fset->head; node != 0; node = node->next) {
-		rc = rdd_filter_close(node->filter);
+		rc = rdd_filter_save(node->filter, cp, node->name);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+int
+rdd_fset_restore(RDD_FILTERSET *fset, RDD_CHECKPOINT *cp)
+{
+	RDD_FSET_NODE *node;
+	int rc;
+
+	for (node = fset->head; node != 0; node = node->next) {
+		rc = rdd_filter_restore(node->filter, cp, node->name);
 		if (rc != RDD_OK) {
 			return rc;
 		}
@@ -191,6 +607,10 @@ rdd_fset_clear(RDD_FILTERSET *fset)
 	RDD_FSET_NODE *next;
 	int rc;
 
+	if (fset->par != 0) {
+		(void) fset_stop_parallel(fset);
+	}
+
 	for (node = fset->head; node != 0; node = next) {
 		next = node->next;
 		free(node->name);
@@ -200,6 +620,7 @@ rdd_fset_clear(RDD_FILTERSET *fset)
 		}
 		free(node);
 	}
+	free(fset->filters);
 
 	memset(fset, 0, sizeof(*fset));
 
@@ -52,6 +52,9 @@ typedef struct _RDD_FSET_NODE {
 	struct _RDD_FSET_NODE *next;	/**< list link */
 } RDD_FSET_NODE;
 
+struct _RDD_FSET_PAR;
+struct _RDD_CHECKPOINT;
+
 /** \brief Representation of a filter collection.
  *
  * A filter set is implemented as a linked list of \c RDD_FSET_NODE nodes.
@@ -61,6 +64,10 @@ typedef struct _RDD_FSET_NODE {
 typedef struct _RDD_FILTERSET {
 	RDD_FSET_NODE  *head;	/**< head of the filter list */
 	RDD_FSET_NODE **tail;	/**< tail of the filter list */
+	RDD_FILTER    **filters; /**< the filters in list order */
+	unsigned        nfilter; /**< number of filters */
+	struct _RDD_FSET_PAR *par; /**< worker threads (0 if sequential) */
+	unsigned        chunk;	/**< push granularity in bytes (0 = none) */
 } RDD_FILTERSET;
 
 /** \brief Representation of a filter cursor.
@@ -100,6 +107,54 @@ int rdd_fset_add(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f);
  */
 int rdd_fset_get(RDD_FILTERSET *fset, const char *name, RDD_FILTER **f);
 
+/** \brief Lets a filter set run its filters on worker threads.
+ *  \param fset the filter set
+ *  \param nworker the number of worker threads; 0 means one thread
+ *         per filter
+ *  \param nbuf the number of data buffers shared by the workers
+ *         (at least 2)
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  the filter set is empty, if it already is parallel, or if \c nbuf
+ *  is too small.
+ *
+ *  This function must be called after all filters have been added
+ *  and before the first call to \c rdd_fset_push().  Filters are
+ *  assigned to the workers round-robin in the order in which they
+ *  were added, so a worker may run a group of (cheap) filters.
+ *  Each filter still sees all data in order, from a single thread.
+ *
+ *  In parallel mode the workers share \c nbuf reference-counted
+ *  buffers.  \c rdd_fset_push() hands the data to the workers in one of
+ *  these buffers and returns without waiting for the filters; data that
+ *  was not read into a buffer obtained from \c rdd_fset_get_buffer()
+ *  is copied first.  A buffer is reused only after every worker has
+ *  released it.  A filter error is therefore reported by a later call to
+ *  \c rdd_fset_push() or by \c rdd_fset_close().  \c rdd_fset_close()
+ *  waits for all workers to finish and then closes the filters
+ *  one by one on the calling thread, so that closing and the filter
+ *  results are exactly the same as in sequential mode.
+ */
+int rdd_fset_set_parallel(RDD_FILTERSET *fset, unsigned nworker, unsigned nbuf);
+
+/** \brief Sets the size of the chunks in which a filter set feeds
+ *  data to its filters.
+ *  \param fset the filter set
+ *  \param chunk the chunk size in bytes; 0 disables chunking
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_BADARG if
+ *  the filter set already is parallel.
+ *
+ *  A buffer that is larger than \c chunk bytes is passed to the filters
+ *  chunk by chunk: every filter processes the first chunk, then every
+ *  filter processes the second chunk, and so on.  Each chunk is then
+ *  still in the processor cache when the next filter reads it.
+ *  Block filters see exactly the same block boundaries as without
+ *  chunking.  Chunking is off by default, because the extra calls
+ *  cost more than they save for small block sizes and because it
+ *  also splits the writes of write filters.
+ *  This function must be called before \c rdd_fset_set_parallel().
+ */
+int rdd_fset_set_chunk(RDD_FILTERSET *fset, unsigned chunk);
+
 /** \brief Opens a cursor that can be used to iterate over a filter set.
  *  \param fset the filter set
  *  \param c the cursor
@@ -127,6 +182,23 @@ int rdd_fset_cursor_next(RDD_FSET_CURSOR *c, RDD_FILTER **f);
  */
 int rdd_fset_cursor_close(RDD_FSET_CURSOR *c);
 
+/** \brief Lends the next shared buffer of a parallel filter set.
+ *  \param fset the filter set
+ *  \param size the minimum size in bytes of the buffer
+ *  \param buf output value: a sector-aligned buffer of at least
+ *  \c size bytes
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND if
+ *  the filter set is not parallel, in which case the caller uses its
+ *  own buffer.  Returns an earlier filter error if there was one.
+ *
+ *  This function waits until every worker has released the next buffer.
+ *  A caller that reads its data into \c buf and then passes \c buf to
+ *  \c rdd_fset_push() saves a copy of the data.  After the push, the
+ *  buffer belongs to the workers again and must not be touched.
+ */
+int rdd_fset_get_buffer(RDD_FILTERSET *fset, unsigned size,
+			unsigned char **buf);
+
 /** \brief Pushes a data buffer into all filters in a filter set.
  *  \param fset the filter set
  *  \param buf the data buffer
@@ -135,7 +207,8 @@ int rdd_fset_cursor_close(RDD_FSET_CURSOR *c);
  *
  *  This function passes data buffer \c buf to each filter in the filter
  *  set by calling \c rdd_filter_push(f, buf, nbyte) for each filter \c f
- *  in the filter set.
+ *  in the filter set.  Large buffers are passed in chunks (see
+ *  \c rdd_fset_set_chunk()).
  */
 int rdd_fset_push(RDD_FILTERSET *fset, const unsigned char *buf, unsigned nbyte);
 
@@ -145,9 +218,32 @@ int rdd_fset_push(RDD_FILTERSET *fset, const unsigned char *buf, unsigned nbyte)
  *
  *  This function closes all filters in the filters by calling
  *  \c rdd_filter_close(f) for each filter \c f in the filter set.
+ *  A parallel filter set first waits for its workers to process
+ *  all pending data and stops them; the filter set is sequential
+ *  afterwards.
  */
 int rdd_fset_close(RDD_FILTERSET *fset);
 
+/** \brief Saves the state of all filters in a filter set.
+ *  \param fset the filter set
+ *  \param cp the checkpoint
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND if
+ *  some filter cannot be checkpointed.
+ *  Each filter is saved under its name in the filter set (see
+ *  \c rdd_filter_save()).  A parallel filter set first waits until
+ *  its workers have processed all data pushed so far.
+ */
+int rdd_fset_save(RDD_FILTERSET *fset, struct _RDD_CHECKPOINT *cp);
+
+/** \brief Restores the state of all filters in a filter set.
+ *  \param fset the filter set
+ *  \param cp the checkpoint
+ *  \return Returns \c RDD_OK on success.
+ *  This function must be called before the first call to
+ *  \c rdd_fset_push().
+ */
+int rdd_fset_restore(RDD_FILTERSET *fset, struct _RDD_CHECKPOINT *cp);
+
 /** \brief Destroys all resources associated with a filter set.
  *  \param fset the filter set
  *  \return Returns \c RDD_OK on success.
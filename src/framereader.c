@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic reader interface (see reader.h)
+ *
+ * A frame reader receives the data frames of a network protocol
+ * version 2 client (see framewriter.c).  Every frame is checked
+ * before its data is passed on: the header and data checksums must
+ * match, the frame must start where the previous one ended, and the
+ * first frame must carry the checksum of the request header.
+ *
+ * The reader grants the client a credit for every frame that has
+ * been consumed.  When the reader is closed after the client's end
+ * frame, it sends DONE with the number of bytes received; callers
+ * close their output first, so DONE tells the client that the image
+ * is complete.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "msgprinter.h"
+#include "checksum.h"
+#include "netio.h"
+
+typedef struct _RDD_FRAME_READER {
+	RDD_READER    *parent;
+	int            sock;		/* reverse channel */
+	rdd_checksum_t hdrcrc;		/* checksum of the request header */
+	unsigned char *buf;		/* data of the current frame */
+	unsigned       bufsize;
+	unsigned       len;		/* data bytes in the current frame */
+	unsigned       next;		/* next unread byte in buf */
+	rdd_count_t    pos;		/* stream offset after the current frame */
+	int            started;		/* header frame has been received */
+	int            eof;		/* end frame has been received */
+	int            failed;
+} RDD_FRAME_READER;
+
+static int rdd_frame_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_frame_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_frame_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_frame_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS frame_read_ops = {
+	rdd_frame_read,
+	rdd_frame_tell,
+	rdd_frame_seek,
+	rdd_frame_close
+};
+
+int
+rdd_open_frame_reader(RDD_READER **self, RDD_READER *parent, int sock,
+			rdd_checksum_t hdrcrc)
+{
+	RDD_READER *r = 0;
+	RDD_FRAME_READER *state = 0;
+	int rc = RDD_OK;
+
+	rc = rdd_new_reader(&r, &frame_read_ops, sizeof(RDD_FRAME_READER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state = (RDD_FRAME_READER *) r->state;
+	state->parent = parent;
+	state->sock = sock;
+	state->hdrcrc = hdrcrc;
+
+	*self = r;
+	return RDD_OK;
+}
+
+/* Reads exactly nbyte bytes from the parent.
+ */
+static int
+receive(RDD_FRAME_READER *state, unsigned char *buf, unsigned nbyte)
+{
+	unsigned nread = 0;
+	int rc;
+
+	rc = rdd_reader_read(state->parent, buf, nbyte, &nread);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	return nread == nbyte ? RDD_OK : RDD_ESYNTAX;
+}
+
+/* Receives and checks the next frame.
+ */
+static int
+recv_frame(RDD_FRAME_READER *state)
+{
+	unsigned char hdr[RDD_NET_FRAME2_HDR_SIZE];
+	rdd_checksum_t crc, datacrc;
+	rdd_count_t offset;
+	unsigned char *p;
+	unsigned type;
+	unsigned len;
+	int rc;
+
+	if ((rc = receive(state, hdr, sizeof hdr)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_net_unpack_frame2(hdr, &type, &offset, &len, &crc);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	if (offset != state->pos) {
+		return RDD_ESYNTAX;
+	}
+	if ((type == RDD_NET_FRAME_HEADER) == state->started) {
+		return RDD_ESYNTAX;
+	}
+
+	if (len > state->bufsize) {
+		if ((p = realloc(state->buf, len)) == 0) {
+			return RDD_NOMEM;
+		}
+		state->buf = p;
+		state->bufsize = len;
+	}
+	if (len > 0 && (rc = receive(state, state->buf, len)) != RDD_OK) {
+		return rc;
+	}
+	datacrc = rdd_checksum_update(RDD_CRC32C,
+			rdd_checksum_init(RDD_CRC32C), state->buf, len);
+	if (datacrc != crc) {
+		return RDD_ECHECKSUM;
+	}
+
+	switch (type) {
+	case RDD_NET_FRAME_HEADER:
+		if (len != 4) {
+			return RDD_ESYNTAX;
+		}
+		crc = ((rdd_checksum_t) state->buf[0] << 24)
+		    | ((rdd_checksum_t) state->buf[1] << 16)
+		    | ((rdd_checksum_t) state->buf[2] << 8)
+		    | (rdd_checksum_t) state->buf[3];
+		if (crc != state->hdrcrc) {
+			return RDD_ECHECKSUM;
+		}
+		state->started = 1;
+		len = 0;
+		break;
+	case RDD_NET_FRAME_DATA:
+		if (len == 0) {
+			return RDD_ESYNTAX;
+		}
+		break;
+	case RDD_NET_FRAME_END:
+		if (len != 0) {
+			return RDD_ESYNTAX;
+		}
+		state->eof = 1;
+		break;
+	default:
+		return RDD_ESYNTAX;
+	}
+
+	state->len = len;
+	state->next = 0;
+	state->pos += len;
+	return RDD_OK;
+}
+
+/* Returns the credit for the current frame once it has been consumed.
+ */
+static int
+consume(RDD_FRAME_READER *state, unsigned nbyte)
+{
+	state->next += nbyte;
+	if (state->next < state->len) {
+		return RDD_OK;
+	}
+	return rdd_net_send_msg(state->sock, RDD_NET_MSG_CREDIT,
+				(rdd_count_t) state->len);
+}
+
+static int
+rdd_frame_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+		unsigned *nread)
+{
+	RDD_FRAME_READER *state = self->state;
+	unsigned n;
+	int rc;
+
+	*nread = 0;
+	while (nbyte > 0 && ! state->eof) {
+		if (state->next == state->len) {
+			if ((rc = recv_frame(state)) != RDD_OK) {
+				state->failed = 1;
+				return rc;
+			}
+			continue;
+		}
+
+		n = state->len - state->next;
+		if (n > nbyte) {
+			n = nbyte;
+		}
+		memcpy(buf, state->buf + state->next, n);
+		if ((rc = consume(state, n)) != RDD_OK) {
+			state->failed = 1;
+			return rc;
+		}
+		buf += n;
+		nbyte -= n;
+		*nread += n;
+	}
+
+	return RDD_OK;
+}
+
+static int
+rdd_frame_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_FRAME_READER *state = self->state;
+
+	*pos = state->pos - (state->len - state->next);
+	return RDD_OK;
+}
+
+static int
+rdd_frame_seek(RDD_READER *self, rdd_count_t pos)
+{
+	RDD_FRAME_READER *state = self->state;
+
+	if (pos != state->pos - (state->len - state->next)) {
+		return RDD_ESEEK;
+	}
+	return RDD_OK;
+}
+
+static int
+rdd_frame_close(RDD_READER *self, int recurse)
+{
+	RDD_FRAME_READER *state = self->state;
+	int rc = RDD_OK;
+
+	/* A reader on top of us (a zlib or stripe reader) may stop
+	 * reading at its own end marker, just before our end frame.
+	 */
+	if (! state->eof && ! state->failed && state->started
+	    && state->next == state->len) {
+		if (recv_frame(state) != RDD_OK || ! state->eof) {
+			state->failed = 1;
+		}
+	}
+	if (state->eof && ! state->failed) {
+		rc = rdd_net_send_msg(state->sock, RDD_NET_MSG_DONE, state->pos);
+	}
+
+	free(state->buf);
+
+	if (recurse) {
+		int rc2 = rdd_reader_close(state->parent, 1);
+		if (rc == RDD_OK) {
+			rc = rc2;
+		}
+	}
+	return rc;
+}
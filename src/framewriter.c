@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * A frame writer sends its data to an rdd server that speaks network
+ * protocol version 2 (see netio.h).  Each write is sent as one or
+ * more data frames; every frame carries its stream offset, its
+ * length and the CRC32C of its data, so the server detects damaged,
+ * lost or misplaced data before it reaches the image.  The first
+ * frame holds the checksum of the request header.
+ *
+ * The server answers on the same socket.  It grants credits for the
+ * bytes it has consumed; the writer never has more than the credit
+ * window in flight, so a slow server disk slows the client down
+ * instead of filling the socket buffers.  An error message from the
+ * server makes the next write fail, and closing the writer waits
+ * until the server reports that the output has been closed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "reader.h"
+#include "msgprinter.h"
+#include "checksum.h"
+#include "netio.h"
+
+typedef struct _RDD_FRAME_WRITER {
+	RDD_WRITER    *parent;
+	int            sock;		/* reverse channel */
+	unsigned       framesize;	/* maximum data bytes per frame */
+	unsigned char  hdr[RDD_NET_FRAME2_HDR_SIZE];
+	rdd_count_t    pos;		/* stream offset of the next frame */
+	rdd_count_t    limit;		/* offset up to which we may send */
+	rdd_count_t    acked;		/* bytes consumed by the server */
+	rdd_count_t    window;		/* credit window in bytes */
+	int            done;		/* server has sent DONE */
+} RDD_FRAME_WRITER;
+
+static int frame_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int frame_close(RDD_WRITER *w);
+
+static RDD_WRITE_OPS frame_write_ops = {
+	frame_write,
+	frame_close,
+	0,
+	0,
+	0
+};
+
+static int
+send_frame(RDD_FRAME_WRITER *state, unsigned type, const unsigned char *buf,
+		unsigned nbyte)
+{
+	rdd_checksum_t crc;
+	int rc;
+
+	crc = rdd_checksum_update(RDD_CRC32C, rdd_checksum_init(RDD_CRC32C),
+			buf, nbyte);
+	rdd_net_pack_frame2(state->hdr, type, state->pos, nbyte, crc);
+	rc = rdd_writer_write(state->parent, state->hdr, sizeof state->hdr);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	if (nbyte > 0) {
+		return rdd_writer_write(state->parent, buf, nbyte);
+	}
+	return RDD_OK;
+}
+
+/* Handles one message from the server.  Waits at most timeout
+ * milliseconds; returns RDD_EAGAIN if no message arrived.  An error
+ * message yields the server's error code.
+ */
+static int
+recv_feedback(RDD_FRAME_WRITER *state, int timeout)
+{
+	rdd_count_t value;
+	unsigned type;
+	int rc;
+
+	rc = rdd_net_recv_msg(state->sock, timeout, &type, &value);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	switch (type) {
+	case RDD_NET_MSG_CREDIT:
+		if (value > state->pos - state->acked) {
+			return RDD_ESYNTAX;
+		}
+		state->acked += value;
+		state->limit = state->acked + state->window;
+		return RDD_OK;
+	case RDD_NET_MSG_ERROR:
+		if (value == RDD_OK || value > 0xffff) {
+			return RDD_ABORTED;
+		}
+		return (int) value;
+	case RDD_NET_MSG_DONE:
+		if (value != state->pos) {
+			return RDD_ESYNTAX;
+		}
+		state->done = 1;
+		return RDD_OK;
+	default:
+		return RDD_ESYNTAX;
+	}
+}
+
+/* Handles all messages that have already arrived.
+ */
+static int
+poll_feedback(RDD_FRAME_WRITER *state)
+{
+	int rc;
+
+	while ((rc = recv_feedback(state, 0)) == RDD_OK)
+		;
+	return rc == RDD_EAGAIN ? RDD_OK : rc;
+}
+
+/* Returns the reason why a write to the server failed with error
+ * code rc: the error the server reported, if any, or rc itself.
+ */
+static int
+write_failure(RDD_FRAME_WRITER *state, int rc)
+{
+	int err = poll_feedback(state);
+
+	return err != RDD_OK && err != RDD_ECONNECT ? err : rc;
+}
+
+int
+rdd_open_frame_writer(RDD_WRITER **self, RDD_WRITER *parent, int sock,
+			unsigned framesize, rdd_count_t window,
+			rdd_checksum_t hdrcrc)
+{
+	RDD_WRITER *w = 0;
+	RDD_FRAME_WRITER *state = 0;
+	unsigned char crcbuf[4];
+	int rc = RDD_OK;
+
+	if (framesize < 1 || framesize > RDD_NET_MAX_FRAME || window < 1) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_writer(&w, &frame_write_ops, sizeof(RDD_FRAME_WRITER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_FRAME_WRITER *) w->state;
+	state->parent = parent;
+	state->sock = sock;
+	state->framesize = framesize;
+	state->window = window;
+	state->limit = window;
+
+	crcbuf[0] = (hdrcrc >> 24) & 0xff;
+	crcbuf[1] = (hdrcrc >> 16) & 0xff;
+	crcbuf[2] = (hdrcrc >> 8) & 0xff;
+	crcbuf[3] = hdrcrc & 0xff;
+	rc = send_frame(state, RDD_NET_FRAME_HEADER, crcbuf, sizeof crcbuf);
+	if (rc != RDD_OK) {
+		free(state);
+		free(w);
+		return rc;
+	}
+
+	*self = w;
+	return RDD_OK;
+}
+
+static int
+frame_write(RDD_WRITER *self, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_FRAME_WRITER *state = self->state;
+	unsigned len;
+	int rc;
+
+	if ((rc = poll_feedback(state)) != RDD_OK) {
+		return rc;
+	}
+
+	while (nbyte > 0) {
+		len = nbyte < state->framesize ? nbyte : state->framesize;
+
+		/* Wait for credit.  A frame that is larger than the
+		 * window is sent when nothing else is in flight.
+		 */
+		while (state->pos + len > state->limit
+		       && state->pos > state->acked) {
+			if ((rc = recv_feedback(state, -1)) != RDD_OK) {
+				return rc;
+			}
+		}
+
+		rc = send_frame(state, RDD_NET_FRAME_DATA, buf, len);
+		if (rc != RDD_OK) {
+			return write_failure(state, rc);
+		}
+		state->pos += len;
+		buf += len;
+		nbyte -= len;
+	}
+
+	return RDD_OK;
+}
+
+static int
+frame_close(RDD_WRITER *self)
+{
+	RDD_FRAME_WRITER *state = self->state;
+	int rc;
+
+	rc = send_frame(state, RDD_NET_FRAME_END, 0, 0);
+	if (rc != RDD_OK) {
+		return write_failure(state, rc);
+	}
+
+	/* The server sends DONE after it has closed its output.
+	 */
+	while (! state->done) {
+		if ((rc = recv_feedback(state, -1)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return rdd_writer_close(state->parent);
+}
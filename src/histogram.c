@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Byte-value histograms.
+ *
+ * Counting bytes into a single table serializes on the counter of
+ * the most frequent byte value: every increment must wait for the
+ * previous one to reach memory.  Long runs of equal bytes, which
+ * are common in disk images, turn this into one increment per
+ * store-to-load round trip.  We therefore count into RDD_HIST_NSUB
+ * sub-histograms, each of which sees every RDD_HIST_NSUB-th byte,
+ * and sum them when the block is finished.  Bytes are loaded a
+ * word at a time.
+ *
+ * The smallest and largest byte values of a block are the first and
+ * last nonzero bins of the summed histogram; they need not be
+ * tracked per byte.
+ *
+ * The entropy of a block of n bytes is the sum of -(c/n) * log2(c/n)
+ * over the byte counts c.  For a given block size there are only
+ * n + 1 possible terms, so for small blocks we tabulate them once and
+ * replace 256 logarithms per block by 256 table lookups.  The terms
+ * are computed exactly as the direct computation would, and summed
+ * in the same order, so the result does not depend on whether the
+ * table is used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "histogram.h"
+
+#define RDD_LN2        0.69314718055994530942
+
+/* Largest block size for which an entropy table is built.
+ */
+#define HIST_TABLE_MAX (64 * 1024)
+
+static double
+entropy_term(unsigned count, unsigned nbyte)
+{
+	double p;
+
+	p = ((double) count) / ((double) nbyte);
+	return -p * (log(p) / RDD_LN2);
+}
+
+int
+rdd_hist_init(RDD_HISTOGRAM *h, unsigned blocksize)
+{
+	double *table = 0;
+	unsigned c;
+
+	if (blocksize > 0 && blocksize <= HIST_TABLE_MAX) {
+		table = malloc((blocksize + 1) * sizeof(double));
+		if (table == 0) {
+			return RDD_NOMEM;
+		}
+		table[0] = 0.0;
+		for (c = 1; c <= blocksize; c++) {
+			table[c] = entropy_term(c, blocksize);
+		}
+	}
+
+	memset(h->count, 0, sizeof h->count);
+	h->blocksize = blocksize;
+	h->entropy = table;
+
+	return RDD_OK;
+}
+
+void
+rdd_hist_free(RDD_HISTOGRAM *h)
+{
+	free(h->entropy);
+	h->entropy = 0;
+}
+
+void
+rdd_hist_add(RDD_HISTOGRAM *h, const unsigned char *buf, unsigned nbyte)
+{
+	unsigned *c0 = h->count[0];
+	unsigned *c1 = h->count[1];
+	unsigned *c2 = h->count[2];
+	unsigned *c3 = h->count[3];
+	RDD_UINT32 w0, w1, w2, w3;
+
+	while (nbyte >= 16) {
+		memcpy(&w0, buf, 4);
+		memcpy(&w1, buf + 4, 4);
+		memcpy(&w2, buf + 8, 4);
+		memcpy(&w3, buf + 12, 4);
+
+		c0[w0 & 0xff]++;
+		c1[(w0 >> 8) & 0xff]++;
+		c2[(w0 >> 16) & 0xff]++;
+		c3[w0 >> 24]++;
+		c0[w1 & 0xff]++;
+		c1[(w1 >> 8) & 0xff]++;
+		c2[(w1 >> 16) & 0xff]++;
+		c3[w1 >> 24]++;
+		c0[w2 & 0xff]++;
+		c1[(w2 >> 8) & 0xff]++;
+		c2[(w2 >> 16) & 0xff]++;
+		c3[w2 >> 24]++;
+		c0[w3 & 0xff]++;
+		c1[(w3 >> 8) & 0xff]++;
+		c2[(w3 >> 16) & 0xff]++;
+		c3[w3 >> 24]++;
+
+		buf += 16;
+		nbyte -= 16;
+	}
+	while (nbyte > 0) {
+		c0[*buf++]++;
+		nbyte--;
+	}
+}
+
+void
+rdd_hist_get(RDD_HISTOGRAM *h, unsigned counts[RDD_HIST_NVAL])
+{
+	unsigned i;
+
+	for (i = 0; i < RDD_HIST_NVAL; i++) {
+		counts[i] = h->count[0][i] + h->count[1][i]
+			+ h->count[2][i] + h->count[3][i];
+	}
+}
+
+void
+rdd_hist_take(RDD_HISTOGRAM *h, unsigned counts[RDD_HIST_NVAL])
+{
+	rdd_hist_get(h, counts);
+	memset(h->count, 0, sizeof h->count);
+}
+
+void
+rdd_hist_put(RDD_HISTOGRAM *h, const unsigned counts[RDD_HIST_NVAL])
+{
+	memset(h->count, 0, sizeof h->count);
+	memcpy(h->count[0], counts, sizeof h->count[0]);
+}
+
+void
+rdd_hist_stats(RDD_HISTOGRAM *h, const unsigned counts[RDD_HIST_NVAL],
+		unsigned nbyte, RDD_HIST_STATS *stats)
+{
+	const double *table = 0;
+	unsigned byte, count;
+	unsigned minbyte, maxbyte;
+	unsigned mval, mcount;
+	double ent;
+
+	if (h->entropy != 0 && nbyte == h->blocksize) {
+		table = h->entropy;
+	}
+
+	ent = 0.0;
+	minbyte = RDD_HIST_NVAL - 1;
+	maxbyte = 0;
+	mval = 0;
+	mcount = counts[0];
+
+	for (byte = 0; byte < RDD_HIST_NVAL; byte++) {
+		count = counts[byte];
+		if (count == 0) {
+			continue;
+		}
+
+		if (table != 0) {
+			ent += table[count];
+		} else {
+			ent += entropy_term(count, nbyte);
+		}
+		if (byte < minbyte) minbyte = byte;
+		maxbyte = byte;
+		if (count > mcount) {
+			mval = byte;
+			mcount = count;
+		}
+	}
+
+	stats->minbyte = minbyte;
+	stats->maxbyte = maxbyte;
+	stats->modus = mval;
+	stats->modus_count = mcount;
+	stats->entropy = ent;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __histogram_h__
+#define __histogram_h__
+
+/** @file
+ *  Byte-value histograms and the statistics derived from them.
+ *
+ *  This is the engine behind the statistics block filter and the
+ *  GUI's entropy plot.  Bytes are counted in several interleaved
+ *  sub-histograms, so that runs of equal bytes do not stall on
+ *  a single counter; the sub-histograms are summed at the end of
+ *  each block.  The entropy of a block is computed from a table
+ *  that holds the entropy contribution of every possible count.
+ */
+
+#define RDD_HIST_NVAL	256	/**< number of byte values */
+#define RDD_HIST_NSUB	4	/**< number of interleaved sub-histograms */
+
+/** \brief Byte-value histogram of a block of data.
+ */
+typedef struct _RDD_HISTOGRAM {
+	unsigned  count[RDD_HIST_NSUB][RDD_HIST_NVAL]; /**< sub-histograms */
+	unsigned  blocksize;	/**< block size of the entropy table */
+	double   *entropy;	/**< entropy term per count, or 0 */
+} RDD_HISTOGRAM;
+
+/** \brief Statistics of a block of data.
+ */
+typedef struct _RDD_HIST_STATS {
+	unsigned minbyte;	/**< smallest byte value */
+	unsigned maxbyte;	/**< largest byte value */
+	unsigned modus;		/**< most frequent byte value */
+	unsigned modus_count;	/**< number of occurrences of \c modus */
+	double   entropy;	/**< entropy in bits per byte */
+} RDD_HIST_STATS;
+
+/** \brief Initializes an empty histogram.
+ *  \param h the histogram
+ *  \param blocksize the block size; blocks of this size use a
+ *         precomputed entropy table
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOMEM if
+ *  the entropy table cannot be allocated.
+ *
+ *  No table is built for very large blocks, for which the cost of
+ *  computing the entropy directly is negligible.
+ */
+int rdd_hist_init(RDD_HISTOGRAM *h, unsigned blocksize);
+
+/** \brief Releases the resources of a histogram.
+ *  \param h the histogram
+ */
+void rdd_hist_free(RDD_HISTOGRAM *h);
+
+/** \brief Counts the bytes in a buffer.
+ *  \param h the histogram
+ *  \param buf the data buffer
+ *  \param nbyte the size in bytes of the data buffer
+ */
+void rdd_hist_add(RDD_HISTOGRAM *h, const unsigned char *buf, unsigned nbyte);
+
+/** \brief Returns the byte counts of a histogram.
+ *  \param h the histogram
+ *  \param counts output value: the number of occurrences of each
+ *         byte value
+ */
+void rdd_hist_get(RDD_HISTOGRAM *h, unsigned counts[RDD_HIST_NVAL]);
+
+/** \brief Returns the byte counts of a histogram and clears it.
+ *  \param h the histogram
+ *  \param counts output value: the number of occurrences of each
+ *         byte value
+ */
+void rdd_hist_take(RDD_HISTOGRAM *h, unsigned counts[RDD_HIST_NVAL]);
+
+/** \brief Replaces the byte counts of a histogram.
+ *  \param h the histogram
+ *  \param counts the number of occurrences of each byte value
+ */
+void rdd_hist_put(RDD_HISTOGRAM *h, const unsigned counts[RDD_HIST_NVAL]);
+
+/** \brief Computes the statistics of a block.
+ *  \param h the histogram (for its entropy table)
+ *  \param counts the byte counts of the block (see \c rdd_hist_take())
+ *  \param nbyte the size of the block in bytes; must be positive
+ *  \param stats output value: the block statistics
+ *
+ *  The modus is the smallest byte value that occurs most often.
+ *  The entropy is the sum of -Pi * log2(Pi), where Pi is the
+ *  frequency of byte value i, over all byte values that occur.
+ */
+void rdd_hist_stats(RDD_HISTOGRAM *h, const unsigned counts[RDD_HIST_NVAL],
+		unsigned nbyte, RDD_HIST_STATS *stats);
+
+#endif /* __histogram_h__ */
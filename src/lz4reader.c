@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Implements a reader that decompresses LZ4 frame data that it
+ * reads from its parent reader.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_LIBLZ4)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lz4frame.h>
+
+#include "rdd.h"
+#include "reader.h"
+
+#define ZBUF_SIZE 65536
+
+typedef struct _RDD_LZ4_READER {
+	RDD_READER    *parent;
+	LZ4F_dctx     *dctx;
+	unsigned char *zbuf;
+	unsigned       zpos;	/* first unconsumed byte in zbuf */
+	unsigned       zlen;	/* number of valid bytes in zbuf */
+	size_t         hint;	/* 0 between frames */
+	rdd_count_t    pos;
+} RDD_LZ4_READER;
+
+
+/* Forward declarations
+ */
+static int rdd_lz4_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_lz4_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_lz4_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_lz4_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS lz4_read_ops = {
+	rdd_lz4_read,
+	rdd_lz4_tell,
+	rdd_lz4_seek,
+	rdd_lz4_close
+};
+
+int
+rdd_open_lz4_reader(RDD_READER **self, RDD_READER *parent)
+{
+	RDD_READER *r = 0;
+	RDD_LZ4_READER *state = 0;
+	LZ4F_dctx *dctx = 0;
+	unsigned char *zbuf = 0;
+	int rc = RDD_OK;
+
+	rc = rdd_new_reader(&r, &lz4_read_ops, sizeof(RDD_LZ4_READER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_LZ4_READER *) r->state;
+
+	if ((zbuf = malloc(ZBUF_SIZE)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx,
+				LZ4F_VERSION))) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	state->parent = parent;
+	state->dctx = dctx;
+	state->zbuf = zbuf;
+	state->zpos = 0;
+	state->zlen = 0;
+	state->hint = 0;
+	state->pos = 0;
+
+	*self = r;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (dctx != 0) LZ4F_freeDecompressionContext(dctx);
+	if (zbuf != 0) free(zbuf);
+	if (state != 0) free(state);
+	if (r != 0) free(r);
+	return rc;
+}
+
+static int
+rdd_lz4_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+			unsigned *nread)
+{
+	RDD_LZ4_READER *state = self->state;
+	size_t outlen, inlen;
+	unsigned done = 0;
+	unsigned n;
+	int rc;
+
+	*nread = 0;
+
+	while (done < nbyte) {
+		if (state->zpos >= state->zlen) {
+			/* Input buffer (zbuf) is empty: refill it with
+			 * compressed data that is obtained from the parent
+			 * reader.
+			 */
+			rc = rdd_reader_read(state->parent,
+					state->zbuf, ZBUF_SIZE, &n);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			if (n == 0) {
+				/* End of input; it must not end inside
+				 * a frame.
+				 */
+				if (state->hint != 0) {
+					return RDD_ECOMPRESS;
+				}
+				break;
+			}
+			state->zpos = 0;
+			state->zlen = n;
+		}
+
+		outlen = nbyte - done;
+		inlen = state->zlen - state->zpos;
+		state->hint = LZ4F_decompress(state->dctx, buf + done, &outlen,
+				state->zbuf + state->zpos, &inlen, 0);
+		if (LZ4F_isError(state->hint)) {
+			return RDD_ECOMPRESS;
+		}
+		state->zpos += (unsigned) inlen;
+		done += (unsigned) outlen;
+	}
+
+	*nread = done;
+	state->pos += done;
+	return RDD_OK;
+}
+
+static int
+rdd_lz4_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_LZ4_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_lz4_seek(RDD_READER *self, rdd_count_t pos)
+{
+	return RDD_ESEEK;	/* not implemented */
+}
+
+static int
+rdd_lz4_close(RDD_READER *self, int recurse)
+{
+	RDD_LZ4_READER *state = self->state;
+	int rc;
+
+	LZ4F_freeDecompressionContext(state->dctx);
+	state->dctx = 0;
+
+	if (recurse) {
+		if ((rc = rdd_reader_close(state->parent, 1)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	free(state->zbuf);
+	state->zbuf = 0;
+
+	return RDD_OK;
+}
+
+#endif /* HAVE_LIBLZ4 */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Implements a writer that compresses its input in LZ4 frame format
+ * and writes the compressed data to its parent writer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(HAVE_LIBLZ4)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lz4frame.h>
+
+#include "rdd.h"
+#include "writer.h"
+
+/* The compressor is fed at most LZ4_CHUNK bytes at a time, so that
+ * its output always fits in a buffer of fixed size.
+ */
+#define LZ4_CHUNK 65536
+
+/* Forward declarations
+ */
+static int lz4_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
+static int lz4_close(RDD_WRITER *w);
+
+static RDD_WRITE_OPS lz4_write_ops = {
+	lz4_write,
+	lz4_close
+};
+
+typedef struct _RDD_LZ4_WRITER {
+	RDD_WRITER        *parent;
+	LZ4F_cctx         *cctx;
+	LZ4F_preferences_t prefs;
+	unsigned char     *zbuf;
+	size_t             zbufsize;
+	int                started;	/* frame header written? */
+} RDD_LZ4_WRITER;
+
+int
+rdd_open_lz4_writer(RDD_WRITER **self, RDD_WRITER *parent, int level)
+{
+	RDD_WRITER *w = 0;
+	RDD_LZ4_WRITER *state = 0;
+	LZ4F_cctx *cctx = 0;
+	unsigned char *zbuf = 0;
+	int rc = RDD_OK;
+
+	if (level < 0 || level > LZ4F_compressionLevel_max()) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_writer(&w, &lz4_write_ops, sizeof(RDD_LZ4_WRITER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_LZ4_WRITER *) w->state;
+
+	memset(&state->prefs, 0, sizeof state->prefs);
+	state->prefs.compressionLevel = level;
+	state->prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+
+	/* Room for the frame header, one chunk, and the frame trailer.
+	 */
+	state->zbufsize = LZ4F_compressBound(LZ4_CHUNK, &state->prefs)
+			+ LZ4F_HEADER_SIZE_MAX;
+	if ((zbuf = malloc(state->zbufsize)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	state->parent = parent;
+	state->cctx = cctx;
+	state->zbuf = zbuf;
+	state->started = 0;
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (cctx != 0) LZ4F_freeCompressionContext(cctx);
+	if (zbuf != 0) free(zbuf);
+	if (state != 0) free(state);
+	if (w != 0) free(w);
+	return rc;
+}
+
+static int
+write_frame_header(RDD_LZ4_WRITER *state)
+{
+	size_t n;
+
+	n = LZ4F_compressBegin(state->cctx, state->zbuf, state->zbufsize,
+			&state->prefs);
+	if (LZ4F_isError(n)) {
+		return RDD_ECOMPRESS;
+	}
+	state->started = 1;
+	return rdd_writer_write(state->parent, state->zbuf, (unsigned) n);
+}
+
+static int
+lz4_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_LZ4_WRITER *state = w->state;
+	unsigned chunk;
+	size_t n;
+	int rc;
+
+	if (!state->started) {
+		if ((rc = write_frame_header(state)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	while (nbyte > 0) {
+		chunk = nbyte < LZ4_CHUNK ? nbyte : LZ4_CHUNK;
+		n = LZ4F_compressUpdate(state->cctx, state->zbuf,
+				state->zbufsize, buf, chunk, 0);
+		if (LZ4F_isError(n)) {
+			return RDD_ECOMPRESS;
+		}
+		if (n > 0) {
+			rc = rdd_writer_write(state->parent, state->zbuf,
+					(unsigned) n);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+		}
+		buf += chunk;
+		nbyte -= chunk;
+	}
+
+	return RDD_OK;
+}
+
+static int
+lz4_close(RDD_WRITER *self)
+{
+	RDD_LZ4_WRITER *state = self->state;
+	size_t n;
+	int rc;
+
+	/* An empty input still yields a valid (empty) frame.
+	 */
+	if (!state->started) {
+		if ((rc = write_frame_header(state)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	n = LZ4F_compressEnd(state->cctx, state->zbuf, state->zbufsize, 0);
+	if (LZ4F_isError(n)) {
+		return RDD_ECOMPRESS;
+	}
+	if ((rc = rdd_writer_write(state->parent, state->zbuf, (unsigned) n))
+			!= RDD_OK) {
+		return rc;
+	}
+
+	/* Close parent.
+	 */
+	if ((rc = rdd_writer_close(state->parent)) != RDD_OK) {
+		return rc;
+	}
+
+	/* Clean up.
+	 */
+	LZ4F_freeCompressionContext(state->cctx);
+	state->cctx = 0;
+	free(state->zbuf);
+	state->zbuf = 0;
+
+	return RDD_OK;
+}
+
+#endif /* HAVE_LIBLZ4 */
@@ -59,37 +59,91 @@ static char copyright[] =
 #include "error.h"
 #include "writer.h"
 #include "filter.h"
-#include "msgprinter.h"
+#include "outfile.h"
+#include "checkpoint.h"
+#include "blockhash.h"
+
+#define BLOCKHASH_IOBUF	(1024 * 1024)	/* stdio buffer of a binary file */
 
 typedef struct _RDD_BLOCKHASH_FILTER {
 	rdd_count_t     blocknum;
+	rdd_count_t     nbyte;		/* number of bytes hashed */
 	MD5_CTX         md5_state;
 	char           *path;
-	RDD_MSGPRINTER *printer;
+	FILE           *fp;
+	int             binary;		/* write a block-hash file */
+	int             indexed;	/* ... with an index */
+	RDD_BLOCKHASH_HEADER header;	/* header of a block-hash file */
+	char           *iobuf;		/* stdio buffer of a block-hash file */
 } RDD_BLOCKHASH_FILTER;
 
+typedef struct _RDD_VERIFY_MD5_BLOCKFILTER {
+	RDD_BLOCKHASH_FILE *bf;		/* the expected hash values */
+	MD5_CTX             md5_state;
+	rdd_count_t         blocknum;
+	unsigned            num_error;	/* error count */
+	rdd_fltr_digest_error_fun error_fun;	/* callback function */
+	void               *error_env;	/* callback environment */
+} RDD_VERIFY_MD5_BLOCKFILTER;
+
 static int blockhash_input(RDD_FILTER *f,
 			const unsigned char *buf, unsigned nbyte);
 static int blockhash_block(RDD_FILTER *f, unsigned nbyte);
 static int blockhash_close(RDD_FILTER *f);
 static int blockhash_free(RDD_FILTER *f);
+static int blockhash_save(RDD_FILTER *f, RDD_CHECKPOINT *cp,
+			const char *name);
+static int blockhash_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp,
+			const char *name);
+static int blockhash_digest(RDD_FILTER *f,
+			const unsigned char *buf, unsigned nbyte, void *result);
+static int blockhash_emit(RDD_FILTER *f, const void *result, unsigned nbyte);
 
 static RDD_FILTER_OPS blockhash_ops = {
 	blockhash_input,
 	blockhash_block,
 	blockhash_close,
 	0,
-	blockhash_free
+	blockhash_free,
+	blockhash_save,
+	blockhash_restore,
+	blockhash_digest,
+	blockhash_emit,
+	MD5_DIGEST_LENGTH
 };
 
-int
-rdd_new_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
-			const char *outpath, int force_overwrite)
+static int verify_md5_input(RDD_FILTER *f,
+			const unsigned char *buf, unsigned nbyte);
+static int verify_md5_block(RDD_FILTER *f, unsigned nbyte);
+static int verify_md5_close(RDD_FILTER *f);
+static int verify_md5_get_result(RDD_FILTER *f,
+			unsigned char *buf, unsigned nbyte);
+static int verify_md5_emit(RDD_FILTER *f, const void *result, unsigned nbyte);
+
+static RDD_FILTER_OPS verify_md5_ops = {
+	verify_md5_input,
+	verify_md5_block,
+	verify_md5_close,
+	verify_md5_get_result,
+	0,	/* free */
+	0,	/* save */
+	0,	/* restore */
+	blockhash_digest,
+	verify_md5_emit,
+	MD5_DIGEST_LENGTH
+};
+
+static int
+new_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
+			const char *outpath, int force_overwrite,
+			int binary, rdd_count_t offset, int indexed)
 {
 	RDD_FILTER *f = 0;
 	RDD_BLOCKHASH_FILTER *state = 0;
-	RDD_MSGPRINTER *prn = 0;
+	FILE *fp = NULL;
+	unsigned char hdrbuf[RDD_BLOCKHASH_HEADER_SIZE];
 	char *path = 0;
+	char *iobuf = 0;
 	int rc;
 
 	rc = rdd_new_filter(&f, &blockhash_ops, sizeof(RDD_BLOCKHASH_FILTER),
@@ -105,12 +159,41 @@ rdd_new_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
 	}
 	strcpy(path, outpath);
 
-	if ((rc = rdd_mp_open_file_printer(&prn, outpath)) != RDD_OK) {
+	if ((rc = outfile_fopen(&fp, outpath, force_overwrite)) != RDD_OK) {
 		goto error;
 	}
 
+	/* A block-hash file starts with a provisional header, which
+	 * is completed when the filter is closed.  When resuming from
+	 * a checkpoint, restoring truncates the file to its saved
+	 * length, which also removes this header.
+	 */
+	if (binary) {
+		rc = rdd_blockhash_init_header(&state->header,
+				RDD_BLOCKHASH_MD5, blocksize, offset);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		if ((iobuf = malloc(BLOCKHASH_IOBUF)) == 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		if (setvbuf(fp, iobuf, _IOFBF, BLOCKHASH_IOBUF) != 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		rdd_blockhash_encode_header(&state->header, hdrbuf);
+		if (fwrite(hdrbuf, sizeof hdrbuf, 1, fp) != 1) {
+			rc = RDD_EWRITE;
+			goto error;
+		}
+	}
+
 	state->path = path;
-	state->printer = prn;
+	state->fp = fp;
+	state->binary = binary;
+	state->indexed = indexed;
+	state->iobuf = iobuf;
 	MD5_Init(&state->md5_state);
 
 	*self = f;
@@ -118,12 +201,31 @@ rdd_new_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
 
 error:
 	*self = 0;
+	if (fp != NULL) fclose(fp);
+	if (iobuf != 0) free(iobuf);
 	if (path != 0) free(path);
 	if (state != 0) free(state);
 	if (f != 0) free(f);
 	return rc;
 }
 
+int
+rdd_new_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
+			const char *outpath, int force_overwrite)
+{
+	return new_md5_blockfilter(self, blocksize, outpath, force_overwrite,
+				0, 0, 0);
+}
+
+int
+rdd_new_binary_md5_blockfilter(RDD_FILTER **self, unsigned blocksize,
+			rdd_count_t offset, const char *outpath,
+			int force_overwrite, int indexed)
+{
+	return new_md5_blockfilter(self, blocksize, outpath, force_overwrite,
+				1, offset, indexed);
+}
+
 /** Updates the running MD5 hash value for the current block.
  */
 static int
@@ -144,20 +246,58 @@ blockhash_block(RDD_FILTER *self, unsigned block_size)
 {
 	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
 	unsigned char md5bytes[MD5_DIGEST_LENGTH];
+
+	MD5_Final(md5bytes, &state->md5_state);
+	MD5_Init(&state->md5_state);
+
+	return blockhash_emit(self, md5bytes, block_size);
+}
+
+/** Computes the MD5 hash value of a whole block.
+ */
+static int
+blockhash_digest(RDD_FILTER *self, const unsigned char *buf, unsigned nbyte,
+		void *result)
+{
+	MD5_CTX ctx;
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, buf, nbyte);
+	MD5_Final((unsigned char *) result, &ctx);
+
+	return RDD_OK;
+}
+
+/** Outputs the MD5 hash value of the next block.
+ */
+static int
+blockhash_emit(RDD_FILTER *self, const void *result, unsigned nbyte)
+{
+	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
 	char digest[2*MD5_DIGEST_LENGTH + 1];
 	int rc;
 
-	MD5_Final(md5bytes, &state->md5_state);
+	state->nbyte += nbyte;
+
+	if (state->binary) {
+		if (fwrite(result, MD5_DIGEST_LENGTH, 1, state->fp) != 1) {
+			return RDD_EWRITE;
+		}
+		state->blocknum++;
+		return RDD_OK;
+	}
 
-	rc = rdd_buf2hex(md5bytes, sizeof md5bytes, digest, sizeof digest);
+	rc = rdd_buf2hex((const unsigned char *) result, MD5_DIGEST_LENGTH,
+			digest, sizeof digest);
 	if (rc != RDD_OK) {
 		return rc;
 	}
-	rdd_mp_message(state->printer, RDD_MSG_INFO, "%llu\t%s",
-			state->blocknum, digest);
+	if (fprintf(state->fp, "%llu\t%s\n",
+			(unsigned long long) state->blocknum, digest) < 0) {
+		return RDD_EWRITE;
+	}
 
 	state->blocknum++;
-	MD5_Init(&state->md5_state);
 
 	return RDD_OK;
 }
@@ -167,16 +307,21 @@ blockhash_close(RDD_FILTER *self)
 {
 	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
 	unsigned char md5bytes[MD5_DIGEST_LENGTH];
-	int rc;
+	int rc = RDD_OK;
 
 	MD5_Final(md5bytes, &state->md5_state);
 
-	rc = rdd_mp_close(state->printer, RDD_MP_RECURSE|RDD_MP_READONLY);
-	if (rc != RDD_OK) {
-		return rc;
+	if (state->binary) {
+		state->header.nblock = state->blocknum;
+		state->header.imagesize = state->nbyte;
+		rc = rdd_blockhash_finish(state->fp, state->path,
+					&state->header, state->indexed);
 	}
 
-	return RDD_OK;
+	outfile_fclose(state->fp, state->path);
+	state->fp = NULL;
+
+	return rc;
 }
 
 static int
@@ -185,6 +330,177 @@ blockhash_free(RDD_FILTER *self)
 	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
 
 	free(state->path);
+	free(state->iobuf);
+
+	return RDD_OK;
+}
+
+static int
+blockhash_save(RDD_FILTER *self, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
+	rdd_count_t len;
+	int rc;
+
+	if ((rc = outfile_fsave(state->fp, &len)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_put_count(cp, name, "filelen", len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put_count(cp, name, "blocknum", state->blocknum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	return rdd_ckpt_put(cp, name, "ctx",
+			&state->md5_state, sizeof(MD5_CTX));
+}
+
+static int
+blockhash_restore(RDD_FILTER *self, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_BLOCKHASH_FILTER *state = (RDD_BLOCKHASH_FILTER *) self->state;
+	rdd_count_t len;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "filelen", &len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_get_count(cp, name, "blocknum", &state->blocknum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state->nbyte = state->blocknum * self->blocksize;
+	rc = rdd_ckpt_get(cp, name, "ctx",
+			&state->md5_state, sizeof(MD5_CTX));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	return outfile_frestore(state->fp, len);
+}
+
+int
+rdd_new_verify_md5_blockfilter(RDD_FILTER **self, RDD_BLOCKHASH_FILE *bf,
+		rdd_fltr_digest_error_fun error_fun, void *error_env)
+{
+	RDD_FILTER *f = 0;
+	RDD_VERIFY_MD5_BLOCKFILTER *state = 0;
+	int rc;
+
+	if (bf->header.algorithm != RDD_BLOCKHASH_MD5) return RDD_BADARG;
+
+	rc = rdd_new_filter(&f, &verify_md5_ops,
+			sizeof(RDD_VERIFY_MD5_BLOCKFILTER),
+			bf->header.blocksize);
+	if (rc != RDD_OK) {
+		*self = 0;
+		return rc;
+	}
+	state = (RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+
+	state->bf = bf;
+	state->blocknum = 0;
+	state->num_error = 0;
+	state->error_fun = error_fun;
+	state->error_env = error_env;
+	MD5_Init(&state->md5_state);
+
+	*self = f;
+	return RDD_OK;
+}
+
+static int
+verify_md5_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_VERIFY_MD5_BLOCKFILTER *state =
+		(RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+
+	MD5_Update(&state->md5_state, buf, nbyte);
+
+	return RDD_OK;
+}
+
+static int
+verify_md5_block(RDD_FILTER *f, unsigned nbyte)
+{
+	RDD_VERIFY_MD5_BLOCKFILTER *state =
+		(RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+	unsigned char md5bytes[MD5_DIGEST_LENGTH];
+
+	MD5_Final(md5bytes, &state->md5_state);
+	MD5_Init(&state->md5_state);
+
+	return verify_md5_emit(f, md5bytes, nbyte);
+}
+
+/** Compares the MD5 hash value of the next block with the value
+ *  in the block-hash file.  An image that is longer than the
+ *  block-hash file is a read error, as it is for checksum files.
+ */
+static int
+verify_md5_emit(RDD_FILTER *f, const void *result, unsigned nbyte)
+{
+	RDD_VERIFY_MD5_BLOCKFILTER *state =
+		(RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+	const unsigned char *expected;
+
+	expected = rdd_blockhash_digest(state->bf, state->blocknum);
+	if (expected == 0) {
+		return RDD_EREAD;
+	}
+
+	if (memcmp(expected, result, MD5_DIGEST_LENGTH) != 0) {
+		state->num_error++;
+		if (state->error_fun != 0) {
+			(*state->error_fun)(state->blocknum * f->blocksize,
+				expected, (const unsigned char *) result,
+				MD5_DIGEST_LENGTH, state->error_env);
+		}
+	}
+
+	state->blocknum++;
+
+	return RDD_OK;
+}
+
+/** Counts the blocks that are in the block-hash file but not in
+ *  the image as errors.  The first missing block is reported with
+ *  a null computed digest.
+ */
+static int
+verify_md5_close(RDD_FILTER *f)
+{
+	RDD_VERIFY_MD5_BLOCKFILTER *state =
+		(RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+	rdd_count_t nblock = state->bf->header.nblock;
+
+	if (state->blocknum >= nblock) {
+		return RDD_OK;
+	}
+
+	state->num_error += nblock - state->blocknum;
+	if (state->error_fun != 0) {
+		(*state->error_fun)(state->blocknum * f->blocksize,
+			rdd_blockhash_digest(state->bf, state->blocknum), 0,
+			MD5_DIGEST_LENGTH, state->error_env);
+	}
+
+	return RDD_OK;
+}
+
+static int
+verify_md5_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
+{
+	RDD_VERIFY_MD5_BLOCKFILTER *state =
+		(RDD_VERIFY_MD5_BLOCKFILTER *) f->state;
+
+	if (nbyte < sizeof(state->num_error)) {
+		return RDD_NOMEM;
+	}
+
+	memcpy(buf, &state->num_error, sizeof(state->num_error));
 
 	return RDD_OK;
 }
@@ -55,6 +55,7 @@ static char copyright[] =
 
 #include "writer.h"
 #include "filter.h"
+#include "checkpoint.h"
 
 typedef struct _RDD_MD5_STREAM_FILTER {
 	MD5_CTX   md5_state;
@@ -64,13 +65,17 @@ typedef struct _RDD_MD5_STREAM_FILTER {
 static int md5_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte);
 static int md5_close(RDD_FILTER *f);
 static int md5_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte);
+static int md5_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int md5_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
 
 static RDD_FILTER_OPS md5_ops = {
 	md5_input,
 	0,
 	md5_close,
 	md5_get_result,
-	0
+	0,
+	md5_save,
+	md5_restore
 };
 
 int
@@ -123,3 +128,21 @@ md5_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
 
 	return RDD_OK;
 }
+
+static int
+md5_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_MD5_STREAM_FILTER *state = (RDD_MD5_STREAM_FILTER *) f->state;
+
+	return rdd_ckpt_put(cp, name, "ctx",
+			&state->md5_state, sizeof(MD5_CTX));
+}
+
+static int
+md5_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_MD5_STREAM_FILTER *state = (RDD_MD5_STREAM_FILTER *) f->state;
+
+	return rdd_ckpt_get(cp, name, "ctx",
+			&state->md5_state, sizeof(MD5_CTX));
+}
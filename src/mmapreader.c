@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * A reader that maps a regular file into memory, one window at a time.
+ *
+ * The window is a (large) page-aligned range of the file that covers
+ * the current file position.  When a request does not fit in the
+ * current window, the window is unmapped and a new window is mapped
+ * that starts at the page that contains the current file position.
+ * Pages behind the cursor are therefore released as the reader moves
+ * forward, and the process never maps more than one window.
+ *
+ * Besides the regular read() routine, which copies data out of the
+ * window, the reader offers rdd_mmap_reader_map(), which returns a
+ * pointer into the window itself.  Consumers that only look at the
+ * data (hash and checksum filters) can use it to avoid a copy.
+ *
+ * The file size is sampled when the reader is opened.  A file that
+ * shrinks while it is mapped causes SIGBUS on access, so this reader
+ * must only be used for image files that are not being modified.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+
+#define MMAP_WINDOW	(64 * 1024 * 1024)	/* bytes */
+
+typedef struct _RDD_MMAP_READER {
+	int            fd;
+	rdd_count_t    size;	/* file size at open time */
+	rdd_count_t    pos;	/* current file position */
+	unsigned char *base;	/* start of current window or 0 */
+	rdd_count_t    winoff;	/* file offset of current window */
+	size_t         winlen;	/* length of current window */
+	size_t         pagesize;
+} RDD_MMAP_READER;
+
+/* Forward declarations
+ */
+static int rdd_mmap_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_mmap_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_mmap_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_mmap_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS mmap_read_ops = {
+	rdd_mmap_read,
+	rdd_mmap_tell,
+	rdd_mmap_seek,
+	rdd_mmap_close
+};
+
+int
+rdd_open_mmap_reader(RDD_READER **self, int fd)
+{
+	RDD_READER *r = 0;
+	RDD_MMAP_READER *state = 0;
+	struct stat statinfo;
+	long pagesize;
+	int rc = RDD_OK;
+
+	if (fstat(fd, &statinfo) < 0) {
+		return RDD_EOPEN;
+	}
+	if (! S_ISREG(statinfo.st_mode)) {
+		return RDD_BADARG;
+	}
+	if ((pagesize = sysconf(_SC_PAGESIZE)) <= 0) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_reader(&r, &mmap_read_ops, sizeof(RDD_MMAP_READER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state = (RDD_MMAP_READER *) r->state;
+	state->fd = fd;
+	state->size = (rdd_count_t) statinfo.st_size;
+	state->pos = 0;
+	state->base = 0;
+	state->winoff = 0;
+	state->winlen = 0;
+	state->pagesize = (size_t) pagesize;
+
+	*self = r;
+	return RDD_OK;
+}
+
+static void
+unmap_window(RDD_MMAP_READER *state)
+{
+	if (state->base != 0) {
+		(void) munmap(state->base, state->winlen);
+		state->base = 0;
+		state->winlen = 0;
+	}
+}
+
+/* Maps a window that covers the range [state->pos, state->pos + nbyte).
+ * The caller guarantees that this range lies within the file.
+ */
+static int
+map_window(RDD_MMAP_READER *state, unsigned nbyte)
+{
+	rdd_count_t off;
+	rdd_count_t len;
+	void *p;
+
+	unmap_window(state);
+
+	off = state->pos - (state->pos % state->pagesize);
+	len = (state->pos - off) + nbyte;
+	if (len < MMAP_WINDOW) {
+		len = MMAP_WINDOW;
+	}
+	if (len > state->size - off) {
+		len = state->size - off;
+	}
+
+	p = mmap(0, (size_t) len, PROT_READ, MAP_SHARED, state->fd, (off_t) off);
+	if (p == MAP_FAILED) {
+		return RDD_EREAD;
+	}
+#if defined(MADV_SEQUENTIAL)
+	(void) madvise(p, (size_t) len, MADV_SEQUENTIAL);
+#endif
+
+	state->base = (unsigned char *) p;
+	state->winoff = off;
+	state->winlen = (size_t) len;
+	return RDD_OK;
+}
+
+int
+rdd_mmap_reader_map(RDD_READER *self, const unsigned char **buf,
+			unsigned nbyte, unsigned *nread)
+{
+	RDD_MMAP_READER *state;
+	int rc;
+
+	if (self->ops != &mmap_read_ops) {
+		return RDD_BADARG;
+	}
+	state = self->state;
+
+	if (state->pos >= state->size) {
+		*buf = 0;
+		*nread = 0;
+		return RDD_OK;	/* EOF */
+	}
+	if ((rdd_count_t) nbyte > state->size - state->pos) {
+		nbyte = (unsigned) (state->size - state->pos);
+	}
+
+	if (state->base == 0
+	||  state->pos < state->winoff
+	||  state->pos + nbyte > state->winoff + state->winlen) {
+		if ((rc = map_window(state, nbyte)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	*buf = state->base + (size_t) (state->pos - state->winoff);
+	*nread = nbyte;
+	state->pos += nbyte;
+	return RDD_OK;
+}
+
+static int
+rdd_mmap_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+			unsigned *nread)
+{
+	const unsigned char *data;
+	int rc;
+
+	if ((rc = rdd_mmap_reader_map(self, &data, nbyte, nread)) != RDD_OK) {
+		return rc;
+	}
+	if (*nread > 0) {
+		memcpy(buf, data, *nread);
+	}
+	return RDD_OK;
+}
+
+static int
+rdd_mmap_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_MMAP_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_mmap_seek(RDD_READER *self, rdd_count_t pos)
+{
+	RDD_MMAP_READER *state = self->state;
+
+	state->pos = pos;
+	return RDD_OK;
+}
+
+static int
+rdd_mmap_close(RDD_READER *self, int recurse /* ignored */)
+{
+	RDD_MMAP_READER *state = self->state;
+
+	unmap_window(state);
+
+	if (close(state->fd) < 0) {
+		return RDD_ECLOSE;
+	}
+
+	return RDD_OK;
+}
@@ -37,8 +37,6 @@ static char copyright[] =
 
 /*
  * TCP support
- *
- * TODO: add checksumming.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -52,6 +50,7 @@ static char copyright[] =
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -63,6 +62,7 @@ static char copyright[] =
 #include "msgprinter.h"
 #include "reader.h"
 #include "writer.h"
+#include "checksum.h"
 #include "netio.h"
 
 #if !defined(HAVE_SOCKLEN_T)
@@ -101,49 +101,132 @@ unpack_netnum(struct netnum *packed, rdd_count_t *num)
  * - length of output file name including terminating null byte (64 bits)
  * - file size (64 bits)
  * - block size (64 bits)
+ * - split size (64 bits)
+ * - flags (64 bits)
  * - output file name, including terminating null byte
  *
+ * If flag RDD_NET_STRIPED is set, the name is followed by:
+ * - the number of connections (streams) of the session (64 bits)
+ * - a session identifier chosen by the client (64 bits)
+ *
  * These items are transmitted by rdd_send_info and received by
- * rdd_recv_info.
+ * rdd_recv_info.  Every other connection of a striped session starts
+ * with a join header (see rdd_send_join).
+ *
+ * If flag RDD_NET_COMPRESS is set, the RDD_NET_CODEC bits of the flags
+ * select the codec; 0 means zlib.  Flag RDD_NET_ADAPTIVE says that the
+ * compressed data is an adaptive codec stream.
+ *
+ * If flag RDD_NET_V2 is set, the client offers protocol version 2
+ * and waits for the server's HELLO message (see netio.h).  The
+ * request header itself is the same in both versions.
  */
+struct request {
+	struct netnum hdr[5];
+	struct netnum stripe[2];
+	unsigned flen;
+};
+
+static int
+pack_info(struct request *req, char *file_name,
+		rdd_count_t file_size,
+		rdd_count_t block_size,
+		rdd_count_t split_size,
+		unsigned flags,
+		unsigned nstream,
+		rdd_count_t session)
+{
+	req->flen = strlen(file_name) + 1;
+	if (req->flen > RDD_MAX_FILENAMESIZE) {
+		return RDD_ERANGE;
+	}
+
+	pack_netnum(&req->hdr[0], (rdd_count_t) req->flen);
+	pack_netnum(&req->hdr[1], file_size);
+	pack_netnum(&req->hdr[2], block_size);
+	pack_netnum(&req->hdr[3], split_size);
+	pack_netnum(&req->hdr[4], (rdd_count_t) flags);
+	pack_netnum(&req->stripe[0], (rdd_count_t) nstream);
+	pack_netnum(&req->stripe[1], session);
+	return RDD_OK;
+}
+
 int
 rdd_send_info(RDD_WRITER *writer, char *file_name,
 		rdd_count_t file_size,
 		rdd_count_t block_size,
 		rdd_count_t split_size,
-		unsigned flags)
+		unsigned flags,
+		unsigned nstream,
+		rdd_count_t session)
 {
-	struct netnum hdr[5];
-	unsigned flen;
+	struct request req;
 	int rc;
 
-	flen = strlen(file_name) + 1;
-	if (flen > RDD_MAX_FILENAMESIZE) {
-		return RDD_ERANGE;
+	rc = pack_info(&req, file_name, file_size, block_size, split_size,
+			flags, nstream, session);
+	if (rc != RDD_OK) {
+		return rc;
 	}
 
-	pack_netnum(&hdr[0], (rdd_count_t) flen);
-	pack_netnum(&hdr[1], file_size);
-	pack_netnum(&hdr[2], block_size);
-	pack_netnum(&hdr[3], split_size);
-	pack_netnum(&hdr[4], (rdd_count_t) flags);
-
 	rc = rdd_writer_write(writer,
-			(const unsigned char *) hdr, sizeof hdr);
+			(const unsigned char *) req.hdr, sizeof req.hdr);
 	if (rc != RDD_OK) {
 		return rc;
 	}
 
-	rc = rdd_writer_write(writer, (unsigned char *) file_name, flen);
+	rc = rdd_writer_write(writer, (unsigned char *) file_name, req.flen);
 	if (rc != RDD_OK) {
 		return rc;
 	}
 
-	/* TODO: add header checksum */
+	if ((flags & RDD_NET_STRIPED) != 0) {
+		rc = rdd_writer_write(writer, (const unsigned char *) req.stripe,
+				sizeof req.stripe);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+	}
 
 	return RDD_OK;
 }
 
+/* Returns the CRC32C of the request header that rdd_send_info sends
+ * for the same arguments.  A version-1 request header carries no
+ * checksum, because a version-1 server would take the checksum for
+ * image data.  In protocol version 2 the client sends this value in
+ * its first frame and the server compares it with the value it
+ * computes from the header it received.
+ */
+rdd_checksum_t
+rdd_net_info_crc(char *file_name,
+		rdd_count_t file_size,
+		rdd_count_t block_size,
+		rdd_count_t split_size,
+		unsigned flags,
+		unsigned nstream,
+		rdd_count_t session)
+{
+	struct request req;
+	rdd_checksum_t crc;
+
+	crc = rdd_checksum_init(RDD_CRC32C);
+	if (pack_info(&req, file_name, file_size, block_size, split_size,
+			flags, nstream, session) != RDD_OK) {
+		return crc;
+	}
+
+	crc = rdd_checksum_update(RDD_CRC32C, crc,
+			(const unsigned char *) req.hdr, sizeof req.hdr);
+	crc = rdd_checksum_update(RDD_CRC32C, crc,
+			(const unsigned char *) file_name, req.flen);
+	if ((flags & RDD_NET_STRIPED) != 0) {
+		crc = rdd_checksum_update(RDD_CRC32C, crc,
+			(const unsigned char *) req.stripe, sizeof req.stripe);
+	}
+	return crc;
+}
+
 /* Reads exactly buflen bytes into buffer buf using reader.
  */
 static int
@@ -163,35 +246,50 @@ receive(RDD_READER *reader, unsigned char *buf, unsigned buflen)
 	return RDD_OK;
 }
 
-/* Receives a copy request header from an rdd client and extracts
- * all information from that header.
+/* Receives the header that starts every connection from an rdd
+ * client: either a request header or, for the other connections of
+ * a striped session, a join header (see rdd_send_join).  The two
+ * are told apart by the file-name length, which is zero in a join
+ * header.
  */
 int
-rdd_recv_info(RDD_READER *reader, char **filename,
-		rdd_count_t *file_size,
-		rdd_count_t *block_size,
-		rdd_count_t *split_size,
-		unsigned *flagp)
+rdd_recv_header(RDD_READER *reader, RDD_NET_HEADER *h)
 {
 	struct netnum hdr[5];
-	rdd_count_t flen;
-	rdd_count_t flags;
+	struct netnum stripe[2];
+	rdd_count_t flen, flags, n;
 	int rc;
 
+	memset(h, 0, sizeof *h);
 	rc = receive(reader, (unsigned char *) &hdr, sizeof hdr);
 	if (rc != RDD_OK) {
 		return rc;
 	}
 
-	/* TODO: verify header checksum */
-
+	/* The header checksum is verified by the frame reader
+	 * (see rdd_net_header_crc).
+	 */
 	unpack_netnum(&hdr[0], &flen);
-	unpack_netnum(&hdr[1], file_size);
-	unpack_netnum(&hdr[2], block_size);
-	unpack_netnum(&hdr[3], split_size);
 	unpack_netnum(&hdr[4], &flags);
+	h->flags = (unsigned) flags;
+
+	if (flen == 0) {
+		if ((flags & RDD_NET_JOIN) == 0) {
+			return RDD_ESYNTAX;
+		}
+		h->join = 1;
+		unpack_netnum(&hdr[1], &h->session);
+		unpack_netnum(&hdr[2], &n);
+		if (n >= RDD_NET_MAX_STREAMS) {
+			return RDD_ERANGE;
+		}
+		h->index = (unsigned) n;
+		return RDD_OK;
+	}
 
-	*flagp = (unsigned) flags;
+	unpack_netnum(&hdr[1], &h->file_size);
+	unpack_netnum(&hdr[2], &h->block_size);
+	unpack_netnum(&hdr[3], &h->split_size);
 
 	if (flen > RDD_MAX_FILENAMESIZE) {
 		return RDD_ERANGE;
@@ -199,17 +297,312 @@ rdd_recv_info(RDD_READER *reader, char **filename,
 	if (flen <= 1) {
 		return RDD_ESYNTAX;
 	}
-	if ((*filename = malloc(flen)) == 0) {
+	if ((h->filename = malloc(flen)) == 0) {
 		return RDD_NOMEM;
 	}
-	rc = receive(reader, (unsigned char *) *filename, flen);
+	rc = receive(reader, (unsigned char *) h->filename, flen);
 	if (rc != RDD_OK) {
+		goto error;
+	}
+	if (h->filename[flen-1] != '\0') {
+		rc = RDD_ESYNTAX;
+		goto error;
+	}
+
+	h->nstream = 1;
+	if ((flags & RDD_NET_STRIPED) != 0) {
+		rc = receive(reader, (unsigned char *) &stripe, sizeof stripe);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		unpack_netnum(&stripe[0], &n);
+		unpack_netnum(&stripe[1], &h->session);
+		if (n < 1 || n > RDD_NET_MAX_STREAMS) {
+			rc = RDD_ERANGE;
+			goto error;
+		}
+		h->nstream = (unsigned) n;
+	}
+
+	return RDD_OK;
+
+error:
+	free(h->filename);
+	h->filename = 0;
+	return rc;
+}
+
+/* Returns the CRC32C of a request or join header (see
+ * rdd_net_info_crc).
+ */
+rdd_checksum_t
+rdd_net_header_crc(const RDD_NET_HEADER *h)
+{
+	if (h->join) {
+		return rdd_net_join_crc(h->session, h->index, h->flags);
+	}
+	return rdd_net_info_crc(h->filename, h->file_size, h->block_size,
+			h->split_size, h->flags, h->nstream, h->session);
+}
+
+/* Receives a copy request header from an rdd client and extracts
+ * all information from that header.
+ */
+int
+rdd_recv_info(RDD_READER *reader, char **filename,
+		rdd_count_t *file_size,
+		rdd_count_t *block_size,
+		rdd_count_t *split_size,
+		unsigned *flagp,
+		unsigned *nstream,
+		rdd_count_t *session)
+{
+	RDD_NET_HEADER h;
+	int rc;
+
+	if ((rc = rdd_recv_header(reader, &h)) != RDD_OK) {
+		return rc;
+	}
+	if (h.join) {
+		return RDD_ESYNTAX;
+	}
+
+	*filename = h.filename;
+	*file_size = h.file_size;
+	*block_size = h.block_size;
+	*split_size = h.split_size;
+	*flagp = h.flags;
+	*nstream = h.nstream;
+	*session = h.session;
+	return RDD_OK;
+}
+
+/* A join header has the size of a request header.  Its file-name
+ * length is zero, which is invalid in a request header, and it
+ * carries the session identifier and the index of the connection
+ * within the session.
+ */
+static void
+pack_join(struct netnum *hdr, rdd_count_t session, unsigned index,
+		unsigned flags)
+{
+	pack_netnum(&hdr[0], 0);
+	pack_netnum(&hdr[1], session);
+	pack_netnum(&hdr[2], (rdd_count_t) index);
+	pack_netnum(&hdr[3], 0);
+	pack_netnum(&hdr[4], (rdd_count_t) (flags | RDD_NET_JOIN));
+}
+
+int
+rdd_send_join(RDD_WRITER *writer, rdd_count_t session, unsigned index,
+		unsigned flags)
+{
+	struct netnum hdr[5];
+
+	pack_join(hdr, session, index, flags);
+	return rdd_writer_write(writer, (const unsigned char *) hdr, sizeof hdr);
+}
+
+/* Receives a join header and checks that it belongs to session.
+ */
+int
+rdd_recv_join(RDD_READER *reader, rdd_count_t session, unsigned nstream,
+		unsigned *index, unsigned *flagp)
+{
+	RDD_NET_HEADER h;
+	int rc;
+
+	if ((rc = rdd_recv_header(reader, &h)) != RDD_OK) {
 		return rc;
 	}
-	if ((*filename)[flen-1] != '\0') {
+	if (! h.join) {
+		free(h.filename);
+		return RDD_ESYNTAX;
+	}
+	if (h.session != session) {
+		return RDD_BADARG;
+	}
+	if (h.index < 1 || h.index >= nstream) {
+		return RDD_ERANGE;
+	}
+
+	*index = h.index;
+	*flagp = h.flags;
+	return RDD_OK;
+}
+
+/* Returns the CRC32C of a join header (see rdd_net_info_crc).
+ */
+rdd_checksum_t
+rdd_net_join_crc(rdd_count_t session, unsigned index, unsigned flags)
+{
+	struct netnum hdr[5];
+
+	pack_join(hdr, session, index, flags);
+	return rdd_checksum_update(RDD_CRC32C, rdd_checksum_init(RDD_CRC32C),
+			(const unsigned char *) hdr, sizeof hdr);
+}
+
+/* A frame header consists of two 64-bit numbers in network format:
+ * the stream offset of the frame's data and the data length.
+ */
+void
+rdd_net_pack_frame(unsigned char *hdr, rdd_count_t offset, rdd_count_t length)
+{
+	struct netnum num[2];
+
+	pack_netnum(&num[0], offset);
+	pack_netnum(&num[1], length);
+	memcpy(hdr, num, RDD_NET_FRAME_HDR_SIZE);
+}
+
+void
+rdd_net_unpack_frame(const unsigned char *hdr, rdd_count_t *offset,
+		rdd_count_t *length)
+{
+	struct netnum num[2];
+
+	memcpy(num, hdr, RDD_NET_FRAME_HDR_SIZE);
+	unpack_netnum(&num[0], offset);
+	unpack_netnum(&num[1], length);
+}
+
+/* A version-2 frame header consists of four 64-bit numbers in
+ * network format:
+ * - RDD_NET_MAGIC (high 32 bits) and the frame type (low 32 bits)
+ * - the stream offset of the frame's data
+ * - the data length
+ * - the CRC32C of the first 28 header bytes (high 32 bits) and
+ *   the CRC32C of the data (low 32 bits)
+ * The header checksum covers the data checksum, so a damaged header
+ * is told apart from damaged data.
+ */
+void
+rdd_net_pack_frame2(unsigned char *hdr, unsigned type, rdd_count_t offset,
+		unsigned length, rdd_checksum_t crc)
+{
+	struct netnum num[4];
+	rdd_checksum_t hcrc;
+
+	pack_netnum(&num[0], (((rdd_count_t) RDD_NET_MAGIC) << 32) | type);
+	pack_netnum(&num[1], offset);
+	pack_netnum(&num[2], (rdd_count_t) length);
+	num[3].lo = htonl(crc);
+	hcrc = rdd_checksum_update(RDD_CRC32C, rdd_checksum_init(RDD_CRC32C),
+			(const unsigned char *) num,
+			RDD_NET_FRAME2_HDR_SIZE - 4);
+	num[3].hi = htonl(hcrc);
+	memcpy(hdr, num, RDD_NET_FRAME2_HDR_SIZE);
+}
+
+/* Unpacks a version-2 frame header.  Returns RDD_ESYNTAX if the
+ * header does not start with the magic number and RDD_ECHECKSUM if
+ * its checksum is wrong.
+ */
+int
+rdd_net_unpack_frame2(const unsigned char *hdr, unsigned *type,
+		rdd_count_t *offset, unsigned *length, rdd_checksum_t *crc)
+{
+	struct netnum num[4];
+	rdd_count_t magic, len;
+	rdd_checksum_t hcrc;
+
+	memcpy(num, hdr, RDD_NET_FRAME2_HDR_SIZE);
+	unpack_netnum(&num[0], &magic);
+	if ((magic >> 32) != RDD_NET_MAGIC) {
 		return RDD_ESYNTAX;
 	}
+	hcrc = rdd_checksum_update(RDD_CRC32C, rdd_checksum_init(RDD_CRC32C),
+			(const unsigned char *) num,
+			RDD_NET_FRAME2_HDR_SIZE - 4);
+	if (hcrc != ntohl(num[3].hi)) {
+		return RDD_ECHECKSUM;
+	}
+	unpack_netnum(&num[1], offset);
+	unpack_netnum(&num[2], &len);
+	if (len > RDD_NET_MAX_FRAME) {
+		return RDD_ERANGE;
+	}
+
+	*type = (unsigned) (magic & 0xffffffff);
+	*length = (unsigned) len;
+	*crc = ntohl(num[3].lo);
+	return RDD_OK;
+}
+
+/* Messages on the reverse channel of a version-2 connection consist
+ * of two 64-bit numbers in network format: RDD_NET_MAGIC (high 32
+ * bits) and the message type (low 32 bits), and a value.
+ */
+int
+rdd_net_send_msg(int sock, unsigned type, rdd_count_t value)
+{
+	struct netnum msg[2];
+	unsigned char *p = (unsigned char *) msg;
+	unsigned nbyte = sizeof msg;
+	ssize_t n;
+
+	pack_netnum(&msg[0], (((rdd_count_t) RDD_NET_MAGIC) << 32) | type);
+	pack_netnum(&msg[1], value);
+
+	while (nbyte > 0) {
+		if ((n = write(sock, p, nbyte)) < 0) {
+			if (errno == EINTR) continue;
+			return RDD_EWRITE;
+		}
+		p += n;
+		nbyte -= n;
+	}
+	return RDD_OK;
+}
+
+/* Receives a message from the reverse channel.  Waits at most
+ * timeout milliseconds for the message to arrive, or forever if
+ * timeout is negative.  Returns RDD_EAGAIN if no message arrived
+ * in time and RDD_ECONNECT if the peer closed the connection.
+ */
+int
+rdd_net_recv_msg(int sock, int timeout, unsigned *type, rdd_count_t *value)
+{
+	struct netnum msg[2];
+	struct pollfd pfd;
+	unsigned char *p = (unsigned char *) msg;
+	unsigned nbyte = sizeof msg;
+	rdd_count_t hdr;
+	ssize_t n;
+	int rc;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	while ((rc = poll(&pfd, 1, timeout)) < 0) {
+		if (errno != EINTR) {
+			return RDD_EREAD;
+		}
+	}
+	if (rc == 0) {
+		return RDD_EAGAIN;
+	}
+
+	/* The rest of the message is on its way.
+	 */
+	while (nbyte > 0) {
+		if ((n = read(sock, p, nbyte)) < 0) {
+			if (errno == EINTR) continue;
+			return RDD_EREAD;
+		} else if (n == 0) {
+			return RDD_ECONNECT;
+		}
+		p += n;
+		nbyte -= n;
+	}
 
+	unpack_netnum(&msg[0], &hdr);
+	if ((hdr >> 32) != RDD_NET_MAGIC) {
+		return RDD_ESYNTAX;
+	}
+	*type = (unsigned) (hdr & 0xffffffff);
+	unpack_netnum(&msg[1], value);
 	return RDD_OK;
 }
 
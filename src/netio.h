@@ -36,9 +36,81 @@
 #include "msgprinter.h"
 
 typedef enum _rdd_net_flags_t {
-	RDD_NET_COMPRESS = 0x1
+	RDD_NET_COMPRESS = 0x1,
+	RDD_NET_STRIPED  = 0x2,	/* data is striped over several connections */
+	RDD_NET_JOIN     = 0x4,	/* connection joins a striped session */
+	RDD_NET_V2       = 0x8,	/* client speaks protocol version 2 */
+	RDD_NET_CODEC    = 0xf0,	/* codec of compressed data (see codec.h) */
+	RDD_NET_ADAPTIVE = 0x100	/* compressed data is an adaptive codec
+					   stream (see codec.h) */
 } rdd_net_flags_t;
 
+/* The codec of a compressed transfer (flag RDD_NET_COMPRESS) is
+ * stored in the RDD_NET_CODEC bits of the request flags.  Codec 0 is
+ * zlib, which is what older clients send.  A current server refuses
+ * a codec that it does not know, but a version-1 server ignores the
+ * codec bits and RDD_NET_ADAPTIVE and inflates the data as zlib.
+ * A client must therefore send plain zlib to a version-1 server.
+ */
+#define RDD_NET_CODEC_SHIFT	4
+#define rdd_net_codec(flags) \
+	(((flags) & RDD_NET_CODEC) >> RDD_NET_CODEC_SHIFT)
+#define rdd_net_codec_flags(codec) \
+	(((unsigned) (codec) << RDD_NET_CODEC_SHIFT) & RDD_NET_CODEC)
+
+/* Striped transfers send the data in frames of at most
+ * RDD_NET_FRAME_SIZE bytes (see stripewriter.c).  A frame header
+ * holds the offset of the frame's data in the stream and its length.
+ */
+#define RDD_NET_FRAME_SIZE	262144
+#define RDD_NET_MAX_FRAME	(16*1024*1024)
+#define RDD_NET_FRAME_HDR_SIZE	16
+#define RDD_NET_MAX_STREAMS	64
+
+/* Protocol version 2.  A client that sets RDD_NET_V2 in its request
+ * header waits for a HELLO message from the server.  A version-1
+ * server ignores the flag and never answers; after
+ * RDD_NET_HELLO_TIMEOUT milliseconds the client falls back to
+ * version 1.  Once both sides speak version 2, the client sends its
+ * data in checksummed frames (see framewriter.c) and the server
+ * answers on the same connection with messages of type
+ * rdd_net_msg_t: flow-control credits, errors, and a final DONE
+ * after the output has been closed.
+ */
+#define RDD_NET_VERSION		2
+#define RDD_NET_MAGIC		0x52444432	/* "RDD2" */
+#define RDD_NET_FRAME2_HDR_SIZE	32
+#define RDD_NET_MSG_SIZE	16
+#define RDD_NET_WINDOW		(8*1024*1024)
+#define RDD_NET_HELLO_TIMEOUT	5000
+
+typedef enum _rdd_net_frame_t {
+	RDD_NET_FRAME_HEADER = 1,	/* checksum of the request header */
+	RDD_NET_FRAME_DATA   = 2,
+	RDD_NET_FRAME_END    = 3
+} rdd_net_frame_t;
+
+typedef enum _rdd_net_msg_t {
+	RDD_NET_MSG_HELLO  = 1,	/* value: initial credit window in bytes */
+	RDD_NET_MSG_CREDIT = 2,	/* value: bytes consumed by the server */
+	RDD_NET_MSG_ERROR  = 3,	/* value: rdd error code */
+	RDD_NET_MSG_DONE   = 4	/* value: total number of bytes received */
+} rdd_net_msg_t;
+
+/* The contents of a request header or a join header.
+ */
+typedef struct _RDD_NET_HEADER {
+	int          join;		/* join header? */
+	char        *filename;		/* request: output file name */
+	rdd_count_t  file_size;
+	rdd_count_t  block_size;
+	rdd_count_t  split_size;
+	unsigned     flags;
+	unsigned     nstream;		/* request: connections in session */
+	unsigned     index;		/* join: index of the connection */
+	rdd_count_t  session;
+} RDD_NET_HEADER;
+
 int rdd_init_server(RDD_MSGPRINTER *printer, unsigned port,
 			int *server_sock);
 
@@ -47,12 +119,54 @@ int rdd_await_connection(RDD_MSGPRINTER *printer, int server_sock,
 
 int rdd_recv_info(RDD_READER *reader, char **filename,
 	rdd_count_t *file_size, rdd_count_t *block_size, rdd_count_t *split_size,
-	unsigned *flags);
+	unsigned *flags, unsigned *nstream, rdd_count_t *session);
+
+int rdd_recv_header(RDD_READER *reader, RDD_NET_HEADER *hdr);
+
+rdd_checksum_t rdd_net_header_crc(const RDD_NET_HEADER *hdr);
 
 int rdd_send_info(RDD_WRITER *writer, char *file_name,
 		rdd_count_t file_size,
 		rdd_count_t block_size,
 		rdd_count_t split_size,
+		unsigned flags,
+		unsigned nstream,
+		rdd_count_t session);
+
+rdd_checksum_t rdd_net_info_crc(char *file_name,
+		rdd_count_t file_size,
+		rdd_count_t block_size,
+		rdd_count_t split_size,
+		unsigned flags,
+		unsigned nstream,
+		rdd_count_t session);
+
+int rdd_send_join(RDD_WRITER *writer, rdd_count_t session, unsigned index,
 		unsigned flags);
 
+int rdd_recv_join(RDD_READER *reader, rdd_count_t session, unsigned nstream,
+		unsigned *index, unsigned *flags);
+
+rdd_checksum_t rdd_net_join_crc(rdd_count_t session, unsigned index,
+		unsigned flags);
+
+int rdd_tcp_connect(const char *host, unsigned port, int *sock);
+
+int rdd_net_send_msg(int sock, unsigned type, rdd_count_t value);
+
+int rdd_net_recv_msg(int sock, int timeout, unsigned *type,
+		rdd_count_t *value);
+
+void rdd_net_pack_frame(unsigned char *hdr, rdd_count_t offset,
+		rdd_count_t length);
+
+void rdd_net_unpack_frame(const unsigned char *hdr, rdd_count_t *offset,
+		rdd_count_t *length);
+
+void rdd_net_pack_frame2(unsigned char *hdr, unsigned type,
+		rdd_count_t offset, unsigned length, rdd_checksum_t crc);
+
+int rdd_net_unpack_frame2(const unsigned char *hdr, unsigned *type,
+		rdd_count_t *offset, unsigned *length, rdd_checksum_t *crc);
+
 #endif /* __netio_h__ */
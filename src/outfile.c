@@ -51,6 +51,7 @@ static char copyright[] =
 #include "rdd.h"
 #include "rdd_internals.h"
 #include "error.h"
+#include "writer.h"
 #include "outfile.h"
 
 /* Check whether path is a valid path name in the file system.
@@ -63,13 +64,16 @@ path_exists(const char *path, struct stat *info)
 
 
 /* Opens a new output file, but refuses to overwrite
- * an existing file, unless the user specified -f.
+ * an existing file, unless the user specified -f.  If
+ * force_overwrite equals RDD_APPEND, an existing file is kept
+ * and the file offset is set to its end (resume from a checkpoint).
  */
 int
 outfile_open(int *fdp, const char *path, int force_overwrite)
 {
 	struct stat statinfo;
 	int open_flags;
+	int append = 0;
 	int fd = -1;
 
 	open_flags = O_CREAT|O_WRONLY;
@@ -77,10 +81,12 @@ outfile_open(int *fdp, const char *path, int force_overwrite)
 		if (S_ISDIR(statinfo.st_mode)) {
 			unix_error("%s is a directory", path);
 		}
-		if (! force_overwrite) {
+		if (force_overwrite == RDD_APPEND) {
+			append = 1;
+		} else if (! force_overwrite) {
 			error("refusing to overwrite %s; use -f", path);
 		}
-		if (S_ISREG(statinfo.st_mode)) {
+		if (S_ISREG(statinfo.st_mode) && !append) {
 			open_flags |= O_TRUNC;
 		}
 	}
@@ -88,6 +94,9 @@ outfile_open(int *fdp, const char *path, int force_overwrite)
 	if ((fd = open(path, open_flags, S_IRUSR|S_IWUSR)) < 0) {
 		unix_error("cannot open output file %s", path);
 	}
+	if (append && lseek(fd, (off_t) 0, SEEK_END) == (off_t) -1) {
+		unix_error("cannot seek in output file %s", path);
+	}
 
 	*fdp = fd;
 	return RDD_OK;
@@ -153,3 +162,52 @@ outfile_fclose(FILE *fp, char *path)
 	}
 	outfile_close(fd2, path);
 }
+
+/* Flushes an output stream to disk and returns its length.  Used to
+ * save a filter's output position in a checkpoint.
+ */
+int
+outfile_fsave(FILE *fp, rdd_count_t *len)
+{
+	long pos;
+
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+	if (fsync(fileno(fp)) < 0) {
+		return RDD_EWRITE;
+	}
+	if ((pos = ftell(fp)) < 0) {
+		return RDD_ETELL;
+	}
+
+	*len = (rdd_count_t) pos;
+	return RDD_OK;
+}
+
+/* Truncates an output stream to length len and continues writing
+ * there.  Used to restore a filter's output position from a checkpoint.
+ */
+int
+outfile_frestore(FILE *fp, rdd_count_t len)
+{
+	struct stat statinfo;
+
+	if (fflush(fp) == EOF) {
+		return RDD_EWRITE;
+	}
+	if (fstat(fileno(fp), &statinfo) < 0) {
+		return RDD_ESEEK;
+	}
+	if ((rdd_count_t) statinfo.st_size < len) {
+		return RDD_ERANGE;
+	}
+	if (ftruncate(fileno(fp), (off_t) len) < 0) {
+		return RDD_EWRITE;
+	}
+	if (fseek(fp, (long) len, SEEK_SET) < 0) {
+		return RDD_ESEEK;
+	}
+
+	return RDD_OK;
+}
@@ -41,4 +41,8 @@ int  outfile_fopen(FILE **fp, const char *path, int force_overwrite);
 
 void outfile_fclose(FILE *fp, char *path);
 
+int  outfile_fsave(FILE *fp, rdd_count_t *len);
+
+int  outfile_frestore(FILE *fp, rdd_count_t len);
+
 #endif /* __outfile_h__ */
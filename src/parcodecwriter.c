@@ -0,0 +1,951 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * A parallel codec writer compresses its input on a pool of worker
+ * threads.  It cuts the input into chunks of a fixed size, hands
+ * each chunk to the workers, and writes the compressed chunks to its
+ * parent in their original order.  The client's thread does all
+ * writes to the parent; it only waits when all chunk slots are in
+ * use.
+ *
+ * The chunks form one stream in the codec's ordinary format:
+ * - zlib: a zlib header, one raw deflate segment per chunk, and the
+ *   Adler-32 trailer of the whole input.  Each chunk starts with the
+ *   last 32 Kbyte of the previous chunk as its dictionary and ends
+ *   with a sync flush, so the segments join into a single deflate
+ *   stream (as in pigz) that any zlib reader decodes.
+ * - zstd and LZ4: one independent frame per chunk.  Their readers
+ *   decode concatenated frames.
+ *
+ * An adaptive writer writes an adaptive codec stream (see codec.h)
+ * instead.  Its workers first look at each chunk.  A chunk that is
+ * all zero becomes part of a zero run.  For other chunks they
+ * estimate the entropy from the byte histogram of a sample; chunks
+ * that look random (encrypted or already compressed data) are stored
+ * as is, which saves the time that compressing them would take.
+ * The remaining chunks are compressed independently.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#endif
+#if defined(HAVE_LIBLZ4)
+#include <lz4frame.h>
+#endif
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "writer.h"
+#include "histogram.h"
+#include "codec.h"
+
+#define DICT_SIZE	32768	/* deflate window */
+#define JOBS_PER_THREAD	2
+
+/* The entropy of a chunk is estimated from ADAPT_SAMPLE bytes, taken
+ * in evenly spaced slices of ADAPT_SLICE bytes.
+ */
+#define ADAPT_SAMPLE	65536
+#define ADAPT_SLICE	4096
+
+/* States of a chunk slot.
+ */
+#define JOB_FREE	0	/* being filled by the client */
+#define JOB_QUEUED	1	/* waiting for a worker */
+#define JOB_DONE	2	/* compressed; waiting to be written */
+
+typedef struct _RDD_PARZ_JOB {
+	unsigned char *in;
+	unsigned       inlen;
+	unsigned char *dict;		/* zlib: end of previous chunk */
+	unsigned       dictlen;
+	unsigned char *out;
+	unsigned       outlen;
+	unsigned long  check;		/* zlib: Adler-32 of in */
+	int            last;		/* zlib: last chunk of the stream */
+	int            kind;		/* adaptive: chunk type */
+	int            bypassed;	/* adaptive: stored for its entropy? */
+	double         seconds;		/* adaptive: compression time */
+	int            state;
+	int            rc;
+} RDD_PARZ_JOB;
+
+struct _RDD_PARZ_WRITER;
+
+typedef struct _RDD_PARZ_WORKER {
+	struct _RDD_PARZ_WRITER *s;
+	pthread_t      thread;
+	int            started;
+	z_stream       z;
+	int            zinit;
+	RDD_HISTOGRAM  hist;		/* adaptive: sample histogram */
+#if defined(HAVE_LIBZSTD)
+	ZSTD_CCtx     *cctx;
+#endif
+} RDD_PARZ_WORKER;
+
+typedef struct _RDD_PARZ_WRITER {
+	RDD_WRITER     *parent;
+	unsigned        codec;
+	int             level;
+	unsigned        chunksize;
+	unsigned        outsize;
+	unsigned        nthread;
+	unsigned        njob;
+	RDD_PARZ_JOB   *jobs;
+	RDD_PARZ_WORKER *workers;
+	unsigned long   nemit;		/* next chunk to write */
+	unsigned long   check;		/* zlib: Adler-32 of all input */
+	int             header_done;	/* zlib, adaptive: header written? */
+	int             holdback;	/* zlib: keep the last chunk back? */
+	int             owned;		/* client fills slot nsubmit? */
+	int             adaptive;	/* adaptive codec stream? */
+	double          maxentropy;	/* adaptive: bypass threshold */
+	RDD_HISTOGRAM   hist;		/* adaptive: entropy table */
+	rdd_count_t     zerorun;	/* adaptive: pending zero bytes */
+	RDD_CODEC_STATS *stats;		/* adaptive: statistics */
+	RDD_CODEC_STATS own_stats;	/* adaptive: if the caller keeps none */
+	int             rc;		/* first error */
+
+	pthread_mutex_t lock;		/* protects the fields below */
+	pthread_cond_t  queued;		/* a job was queued, or quit */
+	pthread_cond_t  done;		/* a job was compressed */
+	unsigned long   nsubmit;	/* #chunks handed to the workers */
+	unsigned long   ntake;		/* #chunks taken by the workers */
+	int             quit;
+} RDD_PARZ_WRITER;
+
+/* Forward declarations
+ */
+static int parz_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int parz_close(RDD_WRITER *w);
+
+static RDD_WRITE_OPS parz_write_ops = {
+	parz_write,
+	parz_close,
+	0,
+	0,
+	0
+};
+
+static int
+deflate_chunk(RDD_PARZ_WORKER *wk, RDD_PARZ_JOB *job)
+{
+	RDD_PARZ_WRITER *s = wk->s;
+	z_stream *z = &wk->z;
+	int rc;
+
+	if (deflateReset(z) != Z_OK) {
+		return RDD_ECOMPRESS;
+	}
+	if (job->dictlen > 0
+	&&  deflateSetDictionary(z, job->dict, job->dictlen) != Z_OK) {
+		return RDD_ECOMPRESS;
+	}
+	z->next_in = job->in;
+	z->avail_in = job->inlen;
+	z->next_out = job->out;
+	z->avail_out = s->outsize;
+
+	rc = deflate(z, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (job->last ? rc != Z_STREAM_END : rc != Z_OK) {
+		return RDD_ECOMPRESS;
+	}
+	if (z->avail_in > 0 || z->avail_out == 0) {
+		return RDD_ECOMPRESS;	/* cannot happen: outsize too small */
+	}
+	job->outlen = s->outsize - z->avail_out;
+	if (!s->adaptive) {
+		job->check = adler32(adler32(0L, Z_NULL, 0),
+				job->in, job->inlen);
+	}
+	return RDD_OK;
+}
+
+static int
+compress_chunk(RDD_PARZ_WORKER *wk, RDD_PARZ_JOB *job)
+{
+	RDD_PARZ_WRITER *s = wk->s;
+#if defined(HAVE_LIBLZ4)
+	LZ4F_preferences_t prefs;
+#endif
+	size_t n;
+
+	switch (s->codec) {
+	case RDD_CODEC_ZLIB:
+		return deflate_chunk(wk, job);
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		n = ZSTD_compress2(wk->cctx, job->out, s->outsize,
+				job->in, job->inlen);
+		if (ZSTD_isError(n)) {
+			return RDD_ECOMPRESS;
+		}
+		job->outlen = (unsigned) n;
+		return RDD_OK;
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		memset(&prefs, 0, sizeof prefs);
+		prefs.compressionLevel = s->level;
+		n = LZ4F_compressFrame(job->out, s->outsize,
+				job->in, job->inlen, &prefs);
+		if (LZ4F_isError(n)) {
+			return RDD_ECOMPRESS;
+		}
+		job->outlen = (unsigned) n;
+		return RDD_OK;
+#endif
+	default:
+		(void) n;
+		return RDD_ECOMPRESS;
+	}
+}
+
+/* Returns nonzero if all nbyte bytes in buf are zero (see fdwriter.c).
+ */
+static int
+all_zero(const unsigned char *buf, unsigned nbyte)
+{
+	return nbyte == 0
+		|| (buf[0] == 0 && memcmp(buf, buf + 1, nbyte - 1) == 0);
+}
+
+/* Estimates the entropy of a chunk in bits per byte.  Chunks of up
+ * to ADAPT_SAMPLE bytes are counted entirely.
+ */
+static double
+chunk_entropy(RDD_PARZ_WORKER *wk, RDD_PARZ_JOB *job)
+{
+	unsigned counts[RDD_HIST_NVAL];
+	RDD_HIST_STATS stats;
+	unsigned nslice, stride, i;
+	unsigned n;
+
+	if (job->inlen <= ADAPT_SAMPLE) {
+		rdd_hist_add(&wk->hist, job->in, job->inlen);
+		n = job->inlen;
+	} else {
+		nslice = ADAPT_SAMPLE / ADAPT_SLICE;
+		stride = (job->inlen - ADAPT_SLICE) / (nslice - 1);
+		for (i = 0; i < nslice; i++) {
+			rdd_hist_add(&wk->hist, job->in + i * stride,
+					ADAPT_SLICE);
+		}
+		n = ADAPT_SAMPLE;
+	}
+	rdd_hist_take(&wk->hist, counts);
+
+	/* Only the (read-only) entropy table of the writer's
+	 * histogram is shared by the workers.
+	 */
+	rdd_hist_stats(&wk->s->hist, counts, n, &stats);
+	return stats.entropy;
+}
+
+/* Decides how an adaptive writer stores a chunk, and compresses it
+ * if that pays off.
+ */
+static int
+adapt_chunk(RDD_PARZ_WORKER *wk, RDD_PARZ_JOB *job)
+{
+	double start;
+	int rc;
+
+	job->bypassed = 0;
+	job->seconds = 0.0;
+
+	if (all_zero(job->in, job->inlen)) {
+		job->kind = RDD_ADAPT_ZERO;
+		return RDD_OK;
+	}
+	if (chunk_entropy(wk, job) >= wk->s->maxentropy) {
+		job->kind = RDD_ADAPT_STORED;
+		job->bypassed = 1;
+		return RDD_OK;
+	}
+
+	start = rdd_gettime();
+	rc = compress_chunk(wk, job);
+	job->seconds = rdd_gettime() - start;
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	if (job->outlen < job->inlen) {
+		job->kind = RDD_ADAPT_COMPRESSED;
+	} else {
+		job->kind = RDD_ADAPT_STORED;
+	}
+	return RDD_OK;
+}
+
+/* Body of a worker thread.  Workers take the queued chunks in order,
+ * but may finish them in any order.
+ */
+static void *
+compress_stage(void *arg)
+{
+	RDD_PARZ_WORKER *wk = (RDD_PARZ_WORKER *) arg;
+	RDD_PARZ_WRITER *s = wk->s;
+	RDD_PARZ_JOB *job;
+	int rc;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->quit && s->ntake == s->nsubmit) {
+			pthread_cond_wait(&s->queued, &s->lock);
+		}
+		if (s->ntake == s->nsubmit) {
+			break;		/* quit and nothing left */
+		}
+		job = &s->jobs[s->ntake % s->njob];
+		s->ntake++;
+		pthread_mutex_unlock(&s->lock);
+
+		if (s->adaptive) {
+			rc = adapt_chunk(wk, job);
+		} else {
+			rc = compress_chunk(wk, job);
+		}
+
+		pthread_mutex_lock(&s->lock);
+		job->rc = rc;
+		job->state = JOB_DONE;
+		pthread_cond_broadcast(&s->done);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+/* Returns a bound on the compressed size of a chunk.
+ */
+static unsigned
+chunk_bound(unsigned codec, int level, unsigned chunksize)
+{
+#if defined(HAVE_LIBLZ4)
+	LZ4F_preferences_t prefs;
+#endif
+
+	(void) level;	/* used only by lz4 */
+
+	switch (codec) {
+	case RDD_CODEC_ZLIB:
+		/* compressBound() covers the zlib header and trailer;
+		 * the extra bytes cover the sync flush.
+		 */
+		return (unsigned) compressBound(chunksize) + 16;
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		return (unsigned) ZSTD_compressBound(chunksize);
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		memset(&prefs, 0, sizeof prefs);
+		prefs.compressionLevel = level;
+		return (unsigned) LZ4F_compressFrameBound(chunksize, &prefs);
+#endif
+	default:
+		return 0;
+	}
+}
+
+static int
+init_worker(RDD_PARZ_WRITER *s, RDD_PARZ_WORKER *wk)
+{
+	wk->s = s;
+	(void) rdd_hist_init(&wk->hist, 0);	/* no table: cannot fail */
+
+	switch (s->codec) {
+	case RDD_CODEC_ZLIB:
+		/* Adaptive chunks are complete zlib streams.
+		 */
+		memset(&wk->z, 0, sizeof wk->z);
+		if (deflateInit2(&wk->z, s->level, Z_DEFLATED,
+				s->adaptive ? MAX_WBITS : -MAX_WBITS,
+				8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return RDD_ECOMPRESS;
+		}
+		wk->zinit = 1;
+		return RDD_OK;
+#if defined(HAVE_LIBZSTD)
+	case RDD_CODEC_ZSTD:
+		if ((wk->cctx = ZSTD_createCCtx()) == 0) {
+			return RDD_NOMEM;
+		}
+		if (s->level != 0
+		&&  ZSTD_isError(ZSTD_CCtx_setParameter(wk->cctx,
+				ZSTD_c_compressionLevel, s->level))) {
+			return RDD_BADARG;
+		}
+		return RDD_OK;
+#endif
+#if defined(HAVE_LIBLZ4)
+	case RDD_CODEC_LZ4:
+		return RDD_OK;
+#endif
+	default:
+		return RDD_ECOMPRESS;
+	}
+}
+
+static void
+free_worker(RDD_PARZ_WORKER *wk)
+{
+	if (wk->zinit) {
+		(void) deflateEnd(&wk->z);
+		wk->zinit = 0;
+	}
+#if defined(HAVE_LIBZSTD)
+	if (wk->cctx != 0) {
+		ZSTD_freeCCtx(wk->cctx);
+		wk->cctx = 0;
+	}
+#endif
+	rdd_hist_free(&wk->hist);
+}
+
+/* Stops the workers and releases all resources.
+ */
+static void
+free_parz(RDD_PARZ_WRITER *s)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&s->lock);
+	s->quit = 1;
+	pthread_cond_broadcast(&s->queued);
+	pthread_mutex_unlock(&s->lock);
+
+	for (i = 0; i < s->nthread; i++) {
+		if (s->workers[i].started) {
+			pthread_join(s->workers[i].thread, 0);
+		}
+		free_worker(&s->workers[i]);
+	}
+	for (i = 0; i < s->njob; i++) {
+		free(s->jobs[i].in);
+		free(s->jobs[i].dict);
+		free(s->jobs[i].out);
+	}
+	free(s->jobs);
+	free(s->workers);
+	s->jobs = 0;
+	s->workers = 0;
+	rdd_hist_free(&s->hist);
+
+	pthread_cond_destroy(&s->done);
+	pthread_cond_destroy(&s->queued);
+	pthread_mutex_destroy(&s->lock);
+}
+
+static int
+open_parz(RDD_WRITER **self, RDD_WRITER *parent,
+		unsigned codec, int level, unsigned nthread, unsigned chunksize,
+		int adaptive, double maxentropy, RDD_CODEC_STATS *stats)
+{
+	RDD_WRITER *w = 0;
+	RDD_PARZ_WRITER *s = 0;
+	RDD_PARZ_JOB *job;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (nthread < 1 || chunksize < DICT_SIZE) {
+		return RDD_BADARG;
+	}
+	if (! rdd_codec_supported(codec)) {
+		return RDD_ECOMPRESS;
+	}
+	if (codec == RDD_CODEC_ZLIB) {
+		if (level < 0 || level > Z_BEST_COMPRESSION) {
+			return RDD_BADARG;
+		}
+		if (level == 0) {
+			level = Z_DEFAULT_COMPRESSION;
+		}
+	}
+#if defined(HAVE_LIBLZ4)
+	if (codec == RDD_CODEC_LZ4
+	&&  (level < 0 || level > LZ4F_compressionLevel_max())) {
+		return RDD_BADARG;
+	}
+#endif
+
+	rc = rdd_new_writer(&w, &parz_write_ops, sizeof(RDD_PARZ_WRITER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	s = (RDD_PARZ_WRITER *) w->state;
+	s->parent = parent;
+	s->codec = codec;
+	s->level = level;
+	s->chunksize = chunksize;
+	s->outsize = chunk_bound(codec, level, chunksize);
+	s->nthread = nthread;
+	s->njob = nthread * JOBS_PER_THREAD;
+	s->check = adler32(0L, Z_NULL, 0);
+	s->holdback = (codec == RDD_CODEC_ZLIB && !adaptive);
+	s->adaptive = adaptive;
+	s->maxentropy = maxentropy;
+	s->zerorun = 0;
+	s->stats = (stats != 0 ? stats : &s->own_stats);
+	memset(s->stats, 0, sizeof(RDD_CODEC_STATS));
+	s->rc = RDD_OK;
+
+	pthread_mutex_init(&s->lock, 0);
+	pthread_cond_init(&s->queued, 0);
+	pthread_cond_init(&s->done, 0);
+
+	s->jobs = calloc(s->njob, sizeof(RDD_PARZ_JOB));
+	s->workers = calloc(s->nthread, sizeof(RDD_PARZ_WORKER));
+	if (s->jobs == 0 || s->workers == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if (adaptive && (rc = rdd_hist_init(&s->hist, ADAPT_SAMPLE)) != RDD_OK) {
+		goto error;
+	}
+	for (i = 0; i < s->njob; i++) {
+		job = &s->jobs[i];
+		job->in = malloc(chunksize);
+		job->out = malloc(s->outsize);
+		job->dict = (s->holdback ? malloc(DICT_SIZE) : 0);
+		if (job->in == 0 || job->out == 0
+		||  (s->holdback && job->dict == 0)) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		job->state = JOB_FREE;
+	}
+	for (i = 0; i < s->nthread; i++) {
+		if ((rc = init_worker(s, &s->workers[i])) != RDD_OK) {
+			goto error;
+		}
+		if (pthread_create(&s->workers[i].thread, 0, compress_stage,
+				&s->workers[i]) != 0) {
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		s->workers[i].started = 1;
+	}
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (s->jobs != 0 && s->workers != 0) {
+		free_parz(s);
+	} else {
+		free(s->jobs);
+		free(s->workers);
+		rdd_hist_free(&s->hist);
+		pthread_cond_destroy(&s->done);
+		pthread_cond_destroy(&s->queued);
+		pthread_mutex_destroy(&s->lock);
+	}
+	free(s);
+	free(w);
+	return rc;
+}
+
+int
+rdd_open_parallel_codec_writer(RDD_WRITER **self, RDD_WRITER *parent,
+		unsigned codec, int level, unsigned nthread, unsigned chunksize)
+{
+	return open_parz(self, parent, codec, level, nthread, chunksize,
+			0, 0.0, 0);
+}
+
+int
+rdd_open_adaptive_codec_writer(RDD_WRITER **self, RDD_WRITER *parent,
+		unsigned codec, int level, unsigned nthread, unsigned chunksize,
+		double maxentropy, RDD_CODEC_STATS *stats)
+{
+	if (chunksize > RDD_ADAPT_MAX_CHUNK) {
+		return RDD_BADARG;
+	}
+	return open_parz(self, parent, codec, level, nthread, chunksize,
+			1, maxentropy, stats);
+}
+
+static int
+write_zlib_header(RDD_PARZ_WRITER *s)
+{
+	unsigned char hdr[2];
+	unsigned flevel;
+
+	/* Deflate with a 32 Kbyte window; the level hint is the one
+	 * zlib itself would write.
+	 */
+	if (s->level == 1) {
+		flevel = 0;
+	} else if (s->level >= 2 && s->level <= 5) {
+		flevel = 1;
+	} else if (s->level == Z_DEFAULT_COMPRESSION || s->level == 6) {
+		flevel = 2;
+	} else {
+		flevel = 3;
+	}
+	hdr[0] = 0x78;
+	hdr[1] = (unsigned char) (flevel << 6);
+	hdr[1] += 31 - (hdr[0] * 256 + hdr[1]) % 31;
+
+	s->header_done = 1;
+	return rdd_writer_write(s->parent, hdr, sizeof hdr);
+}
+
+static int
+write_adapt_header(RDD_PARZ_WRITER *s)
+{
+	unsigned char hdr[RDD_ADAPT_HDR_SIZE];
+
+	memset(hdr, 0, sizeof hdr);
+	memcpy(hdr, RDD_ADAPT_MAGIC, 4);
+	hdr[4] = RDD_ADAPT_VERSION;
+	hdr[5] = (unsigned char) s->codec;
+
+	s->header_done = 1;
+	s->stats->nbyte_out += sizeof hdr;
+	return rdd_writer_write(s->parent, hdr, sizeof hdr);
+}
+
+/* Writes a chunk header and the chunk's data to the parent.
+ */
+static int
+put_chunk(RDD_PARZ_WRITER *s, unsigned kind, rdd_count_t rawlen,
+		const unsigned char *data, unsigned datalen)
+{
+	unsigned char hdr[RDD_ADAPT_CHUNK_HDR_SIZE];
+	unsigned i;
+	int rc;
+
+	memset(hdr, 0, sizeof hdr);
+	hdr[0] = (unsigned char) kind;
+	for (i = 0; i < 4; i++) {
+		hdr[4 + i] = (unsigned char) (datalen >> (24 - 8 * i));
+	}
+	for (i = 0; i < 8; i++) {
+		hdr[8 + i] = (unsigned char) (rawlen >> (56 - 8 * i));
+	}
+
+	if ((rc = rdd_writer_write(s->parent, hdr, sizeof hdr)) != RDD_OK) {
+		return rc;
+	}
+	if (datalen > 0
+	&&  (rc = rdd_writer_write(s->parent, data, datalen)) != RDD_OK) {
+		return rc;
+	}
+	s->stats->nbyte_out += sizeof hdr + datalen;
+	return RDD_OK;
+}
+
+static int
+flush_zero_run(RDD_PARZ_WRITER *s)
+{
+	int rc;
+
+	if (s->zerorun == 0) {
+		return RDD_OK;
+	}
+	rc = put_chunk(s, RDD_ADAPT_ZERO, s->zerorun, 0, 0);
+	s->zerorun = 0;
+	return rc;
+}
+
+/* Writes an adaptive chunk.  Zero chunks are merged into a run that
+ * is written when a non-zero chunk follows, or at the end.
+ */
+static int
+put_adaptive(RDD_PARZ_WRITER *s, RDD_PARZ_JOB *job)
+{
+	RDD_CODEC_STATS *st = s->stats;
+	rdd_count_t ntried;
+	int rc;
+
+	st->nbyte_in += job->inlen;
+	st->compress_time += job->seconds;
+
+	switch (job->kind) {
+	case RDD_ADAPT_ZERO:
+		s->zerorun += job->inlen;
+		st->nbyte_zero += job->inlen;
+		return RDD_OK;
+	case RDD_ADAPT_COMPRESSED:
+		st->nbyte_compressed += job->inlen;
+		break;
+	default:
+		if (job->bypassed) {
+			st->nbyte_bypassed += job->inlen;
+		} else {
+			st->nbyte_incompressible += job->inlen;
+		}
+		break;
+	}
+
+	/* The bypassed chunks would have been compressed at the
+	 * average speed of the chunks that were.
+	 */
+	ntried = st->nbyte_compressed + st->nbyte_incompressible;
+	if (ntried > 0) {
+		st->saved_time = st->compress_time
+			* ((double) st->nbyte_bypassed) / ((double) ntried);
+	}
+
+	if ((rc = flush_zero_run(s)) != RDD_OK) {
+		return rc;
+	}
+	if (job->kind == RDD_ADAPT_COMPRESSED) {
+		return put_chunk(s, RDD_ADAPT_COMPRESSED, job->inlen,
+				job->out, job->outlen);
+	}
+	return put_chunk(s, RDD_ADAPT_STORED, job->inlen,
+			job->in, job->inlen);
+}
+
+/* Writes the compressed chunks to the parent, in order.  Waits for
+ * the chunks before chunk number upto; writes later chunks only if
+ * they are done.
+ */
+static int
+emit(RDD_PARZ_WRITER *s, unsigned long upto)
+{
+	RDD_PARZ_JOB *job;
+	int done;
+	int rc;
+
+	if (s->rc != RDD_OK) {
+		return s->rc;
+	}
+	if (s->adaptive && !s->header_done) {
+		if ((rc = write_adapt_header(s)) != RDD_OK) {
+			return s->rc = rc;
+		}
+	}
+	if (s->holdback && !s->header_done) {
+		if ((rc = write_zlib_header(s)) != RDD_OK) {
+			return s->rc = rc;
+		}
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		if (s->nemit >= s->nsubmit) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		job = &s->jobs[s->nemit % s->njob];
+		while (s->nemit < upto && job->state != JOB_DONE) {
+			pthread_cond_wait(&s->done, &s->lock);
+		}
+		done = (job->state == JOB_DONE);
+		pthread_mutex_unlock(&s->lock);
+		if (!done) {
+			break;
+		}
+
+		if ((rc = job->rc) != RDD_OK) {
+			return s->rc = rc;
+		}
+		if (s->adaptive) {
+			rc = put_adaptive(s, job);
+		} else {
+			rc = rdd_writer_write(s->parent, job->out, job->outlen);
+		}
+		if (rc != RDD_OK) {
+			return s->rc = rc;
+		}
+		if (s->holdback) {
+			s->check = adler32_combine(s->check, job->check,
+					(z_off_t) job->inlen);
+		}
+		job->state = JOB_FREE;
+		s->nemit++;
+	}
+
+	return RDD_OK;
+}
+
+/* Makes the slot of the next chunk available to the client.  The
+ * slot is free once the chunk that used it before has been written.
+ */
+static int
+claim_slot(RDD_PARZ_WRITER *s)
+{
+	int rc;
+
+	if (s->owned) {
+		return RDD_OK;
+	}
+	if (s->nsubmit - s->nemit >= s->njob) {
+		if ((rc = emit(s, s->nemit + 1)) != RDD_OK) {
+			return rc;
+		}
+	}
+	s->jobs[s->nsubmit % s->njob].inlen = 0;
+	s->owned = 1;
+	return RDD_OK;
+}
+
+/* Hands the chunk being filled to the workers.
+ */
+static void
+submit(RDD_PARZ_WRITER *s, int last)
+{
+	RDD_PARZ_JOB *job, *prev;
+
+	pthread_mutex_lock(&s->lock);
+	job = &s->jobs[s->nsubmit % s->njob];
+	job->last = last || s->adaptive;	/* adaptive: chunk = stream */
+	job->dictlen = 0;
+	if (s->holdback && s->nsubmit > 0) {
+		/* The previous chunk is full, and its slot is not
+		 * claimed again before this chunk has been submitted.
+		 */
+		prev = &s->jobs[(s->nsubmit - 1) % s->njob];
+		memcpy(job->dict, prev->in + prev->inlen - DICT_SIZE,
+			DICT_SIZE);
+		job->dictlen = DICT_SIZE;
+	}
+	job->state = JOB_QUEUED;
+	s->nsubmit++;
+	s->owned = 0;
+	pthread_cond_signal(&s->queued);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static int
+parz_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_PARZ_WRITER *s = w->state;
+	RDD_PARZ_JOB *job;
+	unsigned n;
+	int rc;
+
+	if (s->rc != RDD_OK) {
+		return s->rc;
+	}
+
+	while (nbyte > 0) {
+		/* A full zlib chunk is held back until more data
+		 * arrives, because the last chunk must end the stream.
+		 */
+		job = &s->jobs[s->nsubmit % s->njob];
+		if (s->owned && job->inlen == s->chunksize) {
+			submit(s, 0);
+			if ((rc = emit(s, 0)) != RDD_OK) {
+				return rc;
+			}
+		}
+		if ((rc = claim_slot(s)) != RDD_OK) {
+			return rc;
+		}
+		job = &s->jobs[s->nsubmit % s->njob];
+
+		n = s->chunksize - job->inlen;
+		if (n > nbyte) {
+			n = nbyte;
+		}
+		memcpy(job->in + job->inlen, buf, n);
+		job->inlen += n;
+		buf += n;
+		nbyte -= n;
+
+		if (job->inlen == s->chunksize && !s->holdback) {
+			submit(s, 0);
+			if ((rc = emit(s, 0)) != RDD_OK) {
+				return rc;
+			}
+		}
+	}
+
+	return RDD_OK;
+}
+
+static int
+parz_close(RDD_WRITER *w)
+{
+	RDD_PARZ_WRITER *s = w->state;
+	unsigned char trailer[4];
+	int rc;
+
+	/* The last zlib chunk ends the stream, even if it is empty.
+	 * A zstd or LZ4 stream needs at least one frame; an adaptive
+	 * stream needs none.
+	 */
+	rc = s->rc;
+	if (rc == RDD_OK
+	&&  (s->owned || s->holdback || (s->nsubmit == 0 && !s->adaptive))) {
+		if ((rc = claim_slot(s)) == RDD_OK) {
+			submit(s, 1);
+		}
+	}
+	if (rc == RDD_OK) {
+		rc = emit(s, s->nsubmit);
+	}
+	if (rc == RDD_OK && s->adaptive) {
+		rc = flush_zero_run(s);
+	}
+	if (rc == RDD_OK && s->holdback) {
+		trailer[0] = (unsigned char) (s->check >> 24);
+		trailer[1] = (unsigned char) (s->check >> 16);
+		trailer[2] = (unsigned char) (s->check >> 8);
+		trailer[3] = (unsigned char) s->check;
+		rc = rdd_writer_write(s->parent, trailer, sizeof trailer);
+	}
+
+	free_parz(s);
+
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_close(s->parent);
+}
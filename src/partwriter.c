@@ -61,6 +61,7 @@ static char copyright[] =
 
 #include "rdd.h"
 #include "writer.h"
+#include "checkpoint.h"
 
 #define GIGABYTE (1024*1024*1024)
 
@@ -68,10 +69,16 @@ static char copyright[] =
  */
 static int part_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
 static int part_close(RDD_WRITER *w);
+static int part_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int part_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name);
+static int part_holes(RDD_WRITER *w, rdd_count_t *nbyte);
 
 static RDD_WRITE_OPS part_write_ops = {
 	part_write,
-	part_close
+	part_close,
+	part_save,
+	part_restore,
+	part_holes
 };
 
 typedef struct _RDD_PART_WRITER {
@@ -83,6 +90,7 @@ typedef struct _RDD_PART_WRITER {
 	rdd_write_mode_t writemode;
 	unsigned     ndigit;		/* #decimal digits in sequence no. */
 	rdd_count_t  written;		/* #bytes in current part */
+	rdd_count_t  nhole;		/* #bytes left as holes in closed parts */
 	RDD_WRITER *parent;
 } RDD_PART_WRITER;
 
@@ -180,6 +188,7 @@ rdd_open_part_writer(RDD_WRITER **self,
 	state->next_partnum = 0;
 	state->splitlen = splitlen;
 	state->written = 0;
+	state->nhole = 0;
 	state->writemode = wrmode;
 
 	if ((pathcopy = malloc(strlen(path) + 1)) == 0) {
@@ -196,7 +205,11 @@ rdd_open_part_writer(RDD_WRITER **self,
 	memset(pathbuf, 0, state->maxpathlen);
 	state->pathbuf = pathbuf;
 
-	if ((rc = open_next_part(state)) != RDD_OK) {
+	/* When resuming, the part to continue with is not known until
+	 * part_restore() is called, so parts are opened lazily.
+	 */
+	if (RDD_WRITE_MODE(wrmode) != RDD_APPEND
+	&&  (rc = open_next_part(state)) != RDD_OK) {
 		goto error;
 	}
 
@@ -216,13 +229,23 @@ static int
 part_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
 {
 	RDD_PART_WRITER *state = w->state;
+	rdd_count_t nhole;
 	unsigned to_write;
 	int rc;
 
+	if (state->parent == 0 && (rc = open_next_part(state)) != RDD_OK) {
+		return rc;
+	}
+
 	while (nbyte > 0) {
 		if (state->written >= state->splitlen) {
 			/* Current part is full; close, then open next part.
 			 */
+			rc = rdd_writer_holes(state->parent, &nhole);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			state->nhole += nhole;
 			if ((rc = rdd_writer_close(state->parent)) != RDD_OK) {
 				return rc;
 			}
@@ -260,9 +283,8 @@ part_close(RDD_WRITER *self)
 	RDD_PART_WRITER *state = self->state;
 	int rc;
 
-	assert(state->parent != 0);
-
-	if ((rc = rdd_writer_close(state->parent)) != RDD_OK) {
+	if (state->parent != 0
+	&&  (rc = rdd_writer_close(state->parent)) != RDD_OK) {
 		return rc;
 	}
 
@@ -273,3 +295,91 @@ part_close(RDD_WRITER *self)
 
 	return RDD_OK;
 }
+
+/* Saves the number of the current part, the number of bytes written
+ * to it, and the position of the part file itself.
+ */
+static int
+part_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_PART_WRITER *state = w->state;
+	unsigned partnum;
+	int rc;
+
+	if (state->parent == 0 && (rc = open_next_part(state)) != RDD_OK) {
+		return rc;
+	}
+	partnum = state->next_partnum - 1;
+
+	rc = rdd_ckpt_put(cp, name, "part", &partnum, sizeof partnum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put_count(cp, name, "written", state->written);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put_count(cp, name, "holes", state->nhole);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	return rdd_writer_save(state->parent, cp, name);
+}
+
+/* Reopens the part that was current when the checkpoint was saved.
+ * Earlier parts are complete and are not touched.
+ */
+static int
+part_restore(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_PART_WRITER *state = w->state;
+	unsigned partnum;
+	rdd_count_t written;
+	int rc;
+
+	if (RDD_WRITE_MODE(state->writemode) != RDD_APPEND
+	||  state->parent != 0) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_ckpt_get(cp, name, "part", &partnum, sizeof partnum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_get_count(cp, name, "written", &written)) != RDD_OK) {
+		return rc;
+	}
+	if (written > state->splitlen) {
+		return RDD_ERANGE;
+	}
+	rc = rdd_ckpt_get_count(cp, name, "holes", &state->nhole);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state->next_partnum = partnum;
+	if ((rc = open_next_part(state)) != RDD_OK) {
+		return rc;
+	}
+	state->written = written;
+
+	return rdd_writer_restore(state->parent, cp, name);
+}
+
+/* Adds the holes in the current part to those in earlier parts.
+ */
+static int
+part_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	RDD_PART_WRITER *state = w->state;
+	rdd_count_t nhole = 0;
+	int rc;
+
+	if (state->parent != 0
+	&&  (rc = rdd_writer_holes(state->parent, &nhole)) != RDD_OK) {
+		return rc;
+	}
+	*nbyte = state->nhole + nhole;
+	return RDD_OK;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * A pipelined copier overlaps reading with filtering.  A reader thread
+ * runs an ordinary robust copier whose only filter deposits each
+ * block in a ring of aligned buffers.  The calling thread takes the
+ * blocks from the ring, in order, and pushes them into the client's
+ * filter set (write, hash, and block filters).  While the filters
+ * process block N the reader thread is already reading block N+1.
+ *
+ * Because all reading is done by an unmodified robust copier,
+ * the read-error handling (READ_OK/READ_ERROR/READ_RECOVERY),
+ * the zero-block substitutions, and all statistics are exactly
+ * those of the robust copier.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "bufqueue.h"
+
+typedef struct _RDD_PIPELINED_COPIER {
+	RDD_COPIER        *robust;	/* copier run by the reader thread */
+	RDD_BUFQUEUE      *queue;	/* ring of read buffers */
+	RDD_FILTERSET      pipefset;	/* contains only the pipe filter */
+
+	rdd_proghandler_t  progressfun;	/* client's progress callback */
+	void              *progressenv;
+
+	RDD_READER        *reader;	/* reader-thread arguments ... */
+	RDD_COPIER_RETURN  read_ret;	/* ... and results */
+	int                read_rc;
+	int                user_abort;	/* progress callback asked to stop */
+} RDD_PIPELINED_COPIER;
+
+static int pipelined_exec(RDD_COPIER *c, RDD_READER *r,
+				      RDD_FILTERSET *fset,
+				      RDD_COPIER_RETURN *ret);
+static int pipelined_free(RDD_COPIER *c);
+static int pipelined_progress(rdd_count_t ncopied, void *env);
+
+static RDD_COPY_OPS pipelined_ops = {
+	pipelined_exec,
+	pipelined_free
+};
+
+int
+rdd_new_pipelined_copier(RDD_COPIER **self,
+		rdd_count_t offset, rdd_count_t count, unsigned nbuf,
+		RDD_ROBUST_PARAMS *p)
+{
+	RDD_COPIER *c = 0;
+	RDD_PIPELINED_COPIER *state = 0;
+	RDD_ROBUST_PARAMS rp;
+	RDD_FILTER *f = 0;
+	int rc = RDD_OK;
+
+	if (nbuf < 2) return RDD_BADARG;
+
+	rc = rdd_new_copier(&c, &pipelined_ops, sizeof(RDD_PIPELINED_COPIER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_PIPELINED_COPIER *) c->state;
+
+	/* Interpose on the progress callback, so that we can tell a
+	 * client abort (the robust copier closes its filter set) from
+	 * a substitution-limit abort (it does not).
+	 */
+	state->progressfun = p->progressfun;
+	state->progressenv = p->progressenv;
+	rp = *p;
+	if (p->progressfun != 0) {
+		rp.progressfun = pipelined_progress;
+		rp.progressenv = state;
+	}
+
+	rc = rdd_new_robust_copier(&state->robust, offset, count, &rp);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+
+	/* The robust copier never pushes more than maxblocklen bytes
+	 * at a time, so each push fits in a single slot.
+	 */
+	rc = rdd_new_bufqueue(&state->queue, nbuf, p->maxblocklen,
+				RDD_SECTOR_SIZE);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+
+	if ((rc = rdd_new_queue_streamfilter(&f, state->queue)) != RDD_OK) {
+		goto error;
+	}
+
+	rdd_fset_init(&state->pipefset);
+	if ((rc = rdd_fset_add(&state->pipefset, "pipe", f)) != RDD_OK) {
+		goto error;
+	}
+
+	*self = c;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (f != 0) rdd_filter_free(f);
+	if (state != 0 && state->queue != 0) rdd_free_bufqueue(state->queue);
+	if (state != 0 && state->robust != 0) rdd_copy_free(state->robust);
+	if (c != 0) {
+		free(c->state);
+		free(c);
+	}
+	return rc;
+}
+
+/* Progress callback of the robust copier; runs in the reader thread.
+ */
+static int
+pipelined_progress(rdd_count_t ncopied, void *env)
+{
+	RDD_PIPELINED_COPIER *s = (RDD_PIPELINED_COPIER *) env;
+	int rc;
+
+	rc = (*s->progressfun)(ncopied, s->progressenv);
+	if (rc == RDD_ABORTED) {
+		s->user_abort = 1;
+	}
+	return rc;
+}
+
+/* Body of the reader thread.
+ */
+static void *
+read_stage(void *arg)
+{
+	RDD_PIPELINED_COPIER *s = (RDD_PIPELINED_COPIER *) arg;
+
+	s->read_rc = rdd_copy_exec(s->robust, s->reader, &s->pipefset,
+					&s->read_ret);
+
+	/* The robust copier closes its filter set, and so ends the
+	 * stream, only when it completes or when the client aborts.
+	 * Any other failure, including too many substitutions, must
+	 * not look like the end of the stream.
+	 */
+	if (s->read_rc == RDD_OK
+	|| (s->read_rc == RDD_ABORTED && s->user_abort)) {
+		rdd_bufq_close(s->queue);
+	} else {
+		rdd_bufq_abort(s->queue, s->read_rc);
+	}
+
+	return 0;
+}
+
+static int
+pipelined_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
+					   RDD_COPIER_RETURN *ret)
+{
+	RDD_PIPELINED_COPIER *s = (RDD_PIPELINED_COPIER *) c->state;
+	RDD_BUFQ_SLOT *slot;
+	pthread_t reader_thread;
+	int rc = RDD_OK;
+
+	memset(ret, 0, sizeof(*ret));
+
+	s->reader = reader;
+	s->read_rc = RDD_OK;
+	s->user_abort = 0;
+	if (pthread_create(&reader_thread, 0, read_stage, s) != 0) {
+		return RDD_NOMEM;
+	}
+
+	while ((rc = rdd_bufq_get_full(s->queue, &slot)) == RDD_OK) {
+		rc = rdd_fset_push(fset, slot->buf, slot->len);
+		if (rc != RDD_OK) {
+			/* Stop the reader thread. */
+			rdd_bufq_abort(s->queue, rc);
+			break;
+		}
+		if ((rc = rdd_bufq_put_free(s->queue, slot)) != RDD_OK) {
+			break;
+		}
+	}
+
+	pthread_join(reader_thread, 0);
+
+	/* Like the robust copier, leave the filter set open when
+	 * reading failed or was given up; the reader's error takes
+	 * precedence if it caused the abort.
+	 */
+	if (s->read_rc != RDD_OK
+	&& !(s->read_rc == RDD_ABORTED && s->user_abort)) {
+		return s->read_rc;
+	}
+	if (rc != RDD_NOTFOUND) {
+		return rc;	/* filter error */
+	}
+
+	if ((rc = rdd_fset_close(fset)) != RDD_OK) {
+		return rc;
+	}
+
+	*ret = s->read_ret;
+
+	return s->read_rc;
+}
+
+static int
+pipelined_free(RDD_COPIER *c)
+{
+	RDD_PIPELINED_COPIER *state = (RDD_PIPELINED_COPIER *) c->state;
+	int rc;
+
+	if ((rc = rdd_fset_clear(&state->pipefset)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_copy_free(state->robust)) != RDD_OK) {
+		return rc;
+	}
+	return rdd_free_bufqueue(state->queue);
+}
@@ -28,12 +28,16 @@
 # OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
 # SUCH DAMAGE.
 
-import getopt, os, re, string, sys
+import getopt, mmap, os, re, string, struct, sys
 
 KBYTE = 1024
 
 DEFAULT_BLOCKSIZE = 256 * KBYTE
 
+# Binary block-hash files (see blockhash.h)
+BLOCKHASH_MAGIC = "RDDBHASH"
+BLOCKHASH_HEADER = "<8sIIIIQQQQII"
+
 infile = None
 outfile = None
 title = None
@@ -70,7 +74,35 @@ def commandLine():
 	else:
 		usage()
 
+def readBinaryHashes(path):
+	hashes = {}
+	fp = file(path, "rb")
+	m = mmap.mmap(fp.fileno(), 0, access=mmap.ACCESS_READ)
+	hdrsize = struct.calcsize(BLOCKHASH_HEADER)
+	(magic, version, algorithm, digestsize, blocksize, offset,
+	 imagesize, nblock, indexpos, flags, reserved) = \
+		struct.unpack(BLOCKHASH_HEADER, m[0:hdrsize])
+	if flags & 0x1 == 0:
+		# Unfinished file: derive the number of digests from its size.
+		nblock = (len(m) - hdrsize) / digestsize
+	for i in xrange(nblock):
+		pos = hdrsize + i * digestsize
+		md5 = m[pos:pos + digestsize]
+		if not (md5 in hashes):
+			hashes[md5] = 1
+		else:
+			hashes[md5] += 1
+	m.close()
+	fp.close()
+	return hashes
+
 def readHashes(path):
+	fp = file(path, "rb")
+	magic = fp.read(len(BLOCKHASH_MAGIC))
+	fp.close()
+	if magic == BLOCKHASH_MAGIC:
+		return readBinaryHashes(path)
+
 	hashes = {}
 	fp = file(path, "r")
 	for line in fp:
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* The queue stream filter copies its input stream into the slots
+ * of a buffer queue (see bufqueue.h), for consumption by another
+ * thread.  Closing the filter closes the queue.
+ */
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "bufqueue.h"
+
+typedef struct _RDD_QUEUE_STREAM_FILTER {
+	RDD_BUFQUEUE *queue;
+} RDD_QUEUE_STREAM_FILTER;
+
+static int queue_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte);
+static int queue_close(RDD_FILTER *f);
+
+static RDD_FILTER_OPS queue_ops = {
+	queue_input,
+	0,
+	queue_close,
+	0,
+	0
+};
+
+int
+rdd_new_queue_streamfilter(RDD_FILTER **self, RDD_BUFQUEUE *queue)
+{
+	RDD_FILTER *f;
+	RDD_QUEUE_STREAM_FILTER *state;
+	int rc;
+
+	rc = rdd_new_filter(&f, &queue_ops, sizeof(RDD_QUEUE_STREAM_FILTER), 0);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_QUEUE_STREAM_FILTER *) f->state;
+
+	state->queue = queue;
+
+	*self = f;
+	return RDD_OK;
+}
+
+/* Copies the input into as many free slots as needed.
+ */
+static int
+queue_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_QUEUE_STREAM_FILTER *state = (RDD_QUEUE_STREAM_FILTER *) f->state;
+	RDD_BUFQ_SLOT *slot;
+	unsigned todo;
+	int rc;
+
+	while (nbyte > 0) {
+		if ((rc = rdd_bufq_get_free(state->queue, &slot)) != RDD_OK) {
+			return rc;
+		}
+		todo = nbyte < slot->size ? nbyte : slot->size;
+		memcpy(slot->buf, buf, todo);
+		slot->len = todo;
+		if ((rc = rdd_bufq_put_full(state->queue, slot)) != RDD_OK) {
+			return rc;
+		}
+		buf += todo;
+		nbyte -= todo;
+	}
+
+	return RDD_OK;
+}
+
+static int
+queue_close(RDD_FILTER *f)
+{
+	RDD_QUEUE_STREAM_FILTER *state = (RDD_QUEUE_STREAM_FILTER *) f->state;
+
+	return rdd_bufq_close(state->queue);
+}
@@ -48,7 +48,8 @@ typedef RDD_UINT32 rdd_checksum_t;	/*  = 32 bits */
 
 typedef enum {
 	RDD_ADLER32 = 0x1,
-	RDD_CRC32 = 0x2
+	RDD_CRC32 = 0x2,
+	RDD_CRC32C = 0x4
 } rdd_checksum_algorithm_t;
 
 typedef struct _RDD_CHECKSUM_FILE_HEADER {
@@ -82,6 +83,7 @@ typedef struct _RDD_CHECKSUM_FILE_HEADER {
 #define RDD_EAGAIN   15		/* try again later */
 #define RDD_NOTFOUND 16		/* not found */
 #define RDD_ABORTED  17		/* operation has been aborted */
+#define RDD_ECHECKSUM 18	/* checksum mismatch */
 
 #define RDD_WHOLE_FILE ((rdd_count_t) ~(0ULL))
 
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "error.h"
+#include "commandline.h"
+#include "blockhash.h"
+
+#define MAX_LOOKUP	64	/* max #block numbers printed by --lookup */
+
+static struct blockhash_opts {
+	char        *file;		/* block-hash file */
+	int          header;		/* print the header only? */
+	char        *lookup;		/* hex digest to look up, or 0 */
+} opts;
+
+static char *usage_message = "rdd-blockhash [local options] file\n";
+
+static RDD_OPTION opttab[] = {
+	{"-?", "--help", 0, 0,
+	 	"Print this message", 0, 0},
+	{"-V", "--version", 0, 0,
+         	"Report version number and exit", 0, 0},
+	{"--header", "--header", 0, 0,
+	 	"print the header of the block-hash file", 0, 0},
+	{"--lookup", "--lookup", "<digest>", 0,
+	 	"print the numbers of the blocks with hash value <digest>",
+		0, 0},
+	{0, 0, 0, 0, 0, 0, 0} /* sentinel */
+};
+
+static void
+process_options(void)
+{
+	char *arg;
+
+	if (rdd_opt_set("help")) {
+		rdd_opt_usage();
+	}
+
+	if (rdd_opt_set("version")) {
+		fprintf(stderr, "%s version %s\n", PACKAGE, VERSION);
+		exit(EXIT_SUCCESS);
+	}
+
+	opts.header = rdd_opt_set("header");
+	if (rdd_opt_set_arg("lookup", &arg)) {
+		opts.lookup = arg;
+	}
+	if (opts.header && opts.lookup != 0) {
+		error("options --header and --lookup are mutually exclusive");
+	}
+}
+
+static void
+command_line(int argc, char **argv)
+{
+	RDD_OPTION *od;
+	unsigned i;
+	char *opt;
+	char *arg;
+
+	for (i = 1; i < (unsigned) argc; i++) {
+		if ((od = rdd_get_opt_with_arg(argv, argc, &i, &opt, &arg)) == 0) {
+			break;
+		}
+	}
+
+	process_options();
+
+	if (argc - i != 1) {
+		rdd_opt_usage();
+	}
+
+	opts.file = argv[i];
+}
+
+static int
+hexval(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+/* Converts a hexadecimal digest to its raw bytes.
+ */
+static void
+parse_digest(const char *hex, unsigned char *md, unsigned mdsize)
+{
+	unsigned i;
+	int hi, lo;
+
+	if (strlen(hex) != 2 * mdsize) {
+		error("digest %s should have %u hexadecimal digits",
+			hex, 2 * mdsize);
+	}
+
+	for (i = 0; i < mdsize; i++) {
+		hi = hexval(hex[2*i]);
+		lo = hexval(hex[2*i + 1]);
+		if (hi < 0 || lo < 0) {
+			error("digest %s is not a hexadecimal number", hex);
+		}
+		md[i] = (unsigned char) ((hi << 4) | lo);
+	}
+}
+
+static void
+print_header(RDD_BLOCKHASH_FILE *bf)
+{
+	RDD_BLOCKHASH_HEADER *hdr = &bf->header;
+
+	printf("version:     %04x\n", (unsigned) hdr->version);
+	printf("algorithm:   %s\n",
+		hdr->algorithm == RDD_BLOCKHASH_MD5 ? "MD5" : "unknown");
+	printf("digest size: %u\n", (unsigned) hdr->digestsize);
+	printf("block size:  %u\n", (unsigned) hdr->blocksize);
+	printf("offset:      %llu\n", (unsigned long long) hdr->offset);
+	printf("image size:  %llu\n", (unsigned long long) hdr->imagesize);
+	printf("blocks:      %llu\n", (unsigned long long) hdr->nblock);
+	printf("finished:    %s\n",
+		(hdr->flags & RDD_BLOCKHASH_FINISHED) != 0 ? "yes" : "no");
+	printf("indexed:     %s\n", bf->index != 0 ? "yes" : "no");
+}
+
+static void
+lookup(RDD_BLOCKHASH_FILE *bf, const char *hexdigest)
+{
+	unsigned char md[RDD_BLOCKHASH_MD5_SIZE];
+	rdd_count_t blocks[MAX_LOOKUP];
+	rdd_count_t nfound;
+	rdd_count_t i;
+	int rc;
+
+	if (bf->header.digestsize > sizeof md) {
+		error("%s: unsupported digest size %u", opts.file,
+			(unsigned) bf->header.digestsize);
+	}
+	parse_digest(hexdigest, md, bf->header.digestsize);
+
+	rc = rdd_blockhash_lookup(bf, md, blocks, MAX_LOOKUP, &nfound);
+	if (rc != RDD_OK) {
+		rdd_error(rc, "%s: lookup failed", opts.file);
+	}
+
+	for (i = 0; i < nfound && i < MAX_LOOKUP; i++) {
+		printf("%llu\n", (unsigned long long) blocks[i]);
+	}
+	if (nfound > MAX_LOOKUP) {
+		warn("%llu more blocks with hash value %s not shown",
+			(unsigned long long) (nfound - MAX_LOOKUP), hexdigest);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	RDD_BLOCKHASH_FILE *bf = 0;
+	int rc;
+
+	rdd_opt_init(opttab, usage_message);
+
+	set_progname(argv[0]);
+	set_logfile(stderr);
+	memset(&opts, '\000', sizeof opts);
+	command_line(argc, argv);
+
+	if ((rc = rdd_blockhash_open(&bf, opts.file)) != RDD_OK) {
+		rdd_error(rc, "cannot open block-hash file %s", opts.file);
+	}
+
+	if (opts.header) {
+		print_header(bf);
+	} else if (opts.lookup != 0) {
+		lookup(bf, opts.lookup);
+	} else if ((rc = rdd_blockhash_print(bf, stdout)) != RDD_OK) {
+		rdd_error(rc, "cannot write standard output");
+	}
+
+	rdd_blockhash_close(bf);
+
+	if (fflush(stdout) == EOF) {
+		unix_error("cannot write standard output");
+	}
+
+	return EXIT_SUCCESS;
+}
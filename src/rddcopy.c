@@ -56,7 +56,13 @@ static char copyright[] =
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "rdd.h"
 #include "rdd_internals.h"
@@ -82,10 +88,19 @@ static char copyright[] =
 #include "writer.h"
 #include "filter.h"
 #include "filterset.h"
+#include "checksum.h"
+#include "checksumfile.h"
 #include "copier.h"
 #include "netio.h"
 #include "progress.h"
 #include "msgprinter.h"
+#include "checkpoint.h"
+#include "serverlimits.h"
+#include "codec.h"
+
+#if !defined(HAVE_SOCKLEN_T)
+typedef int socklen_t;
+#endif
 
 #define DEFAULT_BLOCK_LEN	    262144	/* bytes */
 #define DEFAULT_MIN_BLOCK_SIZE	     32768	/* bytes */
@@ -96,6 +111,8 @@ static char copyright[] =
 #define DEFAULT_NRETRY               1
 #define DEFAULT_RECOVERY_LEN	     4	/* read blocks */
 #define DEFAULT_MAX_READ_ERR	     0	/* 0 = infinity */
+#define FILTER_NBUF		     8	/* #buffers shared by filter threads */
+#define DEFAULT_CHECKPOINT_INTERVAL 10	/* seconds */
 #define DEFAULT_RDD_SERVER_PORT       4832
 
 #define RDD_MAX_DIGEST_LENGTH       20		/* bytes */
@@ -110,23 +127,66 @@ typedef enum _rdd_copy_mode_t {
 
 #define ALL_MODES (RDD_LOCAL|RDD_CLIENT|RDD_SERVER)
 
+/* Block-wise MD5 file formats; these values are stored in checkpoints.
+ */
+#define BLOCKMD5_TEXT		0
+#define BLOCKMD5_BINARY		1
+#define BLOCKMD5_INDEXED	2
+
+static char *blockmd5_formats[] = {"text", "binary", "indexed", 0};
+
+/* Block-wise hash algorithms (--block-digest-type).
+ */
+static struct digest_type {
+	char     *name;
+	unsigned  type;
+} digest_types[] = {
+	{"md5",    RDD_CKSUM2_MD5},
+	{"sha1",   RDD_CKSUM2_SHA1},
+	{"sha256", RDD_CKSUM2_SHA256},
+	{0, 0}
+};
+
 /* rdd's command-line arguments
  */
 typedef struct _rdd_copy_opts {
 	int       compress;		/* compression enabled? */
+	unsigned  codec;		/* compression codec (see codec.h) */
+	unsigned  level;		/* compression level; 0: default */
+	unsigned  compress_threads;	/* #compression threads; 0: none */
+	double    bypass_entropy;	/* store chunks of higher entropy
+					   uncompressed; 0: never */
+	unsigned  streams;		/* #TCP connections in client mode */
+	unsigned  protocol;		/* highest network protocol version */
 	int       quiet;		/* batch mode (no questions)? */
 	char     *infile;		/* input file (source of copy) */
 	char     *logfile;		/* log file */
 	char     *outpath;		/* output file or its prefix */
 	char     *simfile;		/* read-fault simulation config file */
+	char     *rescuemap;		/* rescue map file (rescue mode) */
+	char     *checkpoint;		/* checkpoint file */
+	char     *resume;		/* resume from this checkpoint file */
 	char     *crc32file;		/* output file for CRC32 checksums */
+	char     *crc32cfile;		/* output file for CRC32C checksums */
 	char     *adler32file;		/* output file for Adler32 checksums */
 	char     *histfile;		/* output file for histogram stats */
 	char     *blockmd5file;		/* output file for blockwise MD5 */
+	unsigned  blockmd5fmt;		/* format of the blockwise MD5 file */
+	char     *digestfile;		/* output file for blockwise hashes */
+	unsigned  digesttype;		/* blockwise hash algorithm */
+	unsigned  checksum_version;	/* checksum file format version */
+	int       checksum_index;	/* index version-2 checksum files? */
 	int       verbose;		/* Be verbose? */
 	int       raw;			/* Reading from a raw device? */
+	int       adaptive;		/* adapt block size to throughput? */
+	int       sparse;		/* leave holes for zero blocks? */
+	int       direct;		/* bypass the page cache on output? */
 	unsigned  mode;			/* local, client, or server mode */
 	int       inetd;		/* read from file desc. 0? */
+	unsigned  max_sessions;		/* #concurrent sessions (0 = one) */
+	char     *session_dir;		/* parent of the session directories */
+	rdd_count_t  max_memory;	/* memory budget of all sessions */
+	rdd_count_t  max_bandwidth;	/* output budget of all sessions (B/s) */
 	char     *server_host;		/* host name of rdd server */
 	unsigned  server_port;		/* TCP port of rdd server */
 	int       force_overwrite;	/* output overwrites existing files */
@@ -136,14 +196,24 @@ typedef struct _rdd_copy_opts {
 	rdd_count_t  blocklen;		/* default copy-block size */
 	rdd_count_t  adler32len;	/* block size for Adler32 */
 	rdd_count_t  crc32len;		/* block size for CRC32 */
+	rdd_count_t  crc32clen;		/* block size for CRC32C */
 	rdd_count_t  histblocklen;	/* histogramming block size */
 	rdd_count_t  blockmd5len;	/* block size for block-wise MD5 */
+	rdd_count_t  digestlen;		/* block size for block-wise hashes */
 	rdd_count_t  minblocklen;	/* unit of data loss */
 	rdd_count_t  offset;		/* start copying here */
 	rdd_count_t  count;		/* copy this many bytes */
 	rdd_count_t  splitlen;		/* create new output file every splitlen bytes */
 	rdd_count_t  progresslen;	/* progress reporting interval (s) */
 	rdd_count_t  max_read_err;	/* Max. # read errors allowed */
+	unsigned  pipeline;		/* #read-ahead buffers (0 = no pipeline) */
+	unsigned  write_behind;		/* #write-behind buffers (0 = none) */
+	unsigned  filter_threads;	/* #filter threads (0 = sequential) */
+	rdd_count_t  filter_chunk;	/* filter push granularity (0 = none) */
+	unsigned  block_threads;	/* #threads per block filter (0 = none) */
+	unsigned  queue_depth;		/* #reads in flight (0 = blocking reads) */
+	unsigned  stripes;		/* #concurrent input stripes (0 = none) */
+	unsigned  checkpoint_interval;	/* checkpoint interval (s) */
 } rdd_copy_opts;
 
 static rdd_copy_opts  opts;
@@ -172,30 +242,77 @@ static RDD_OPTION opttab[] = {
 	 	"Read blocks of <count> [KMG]byte at a time", 0, 0},
 	{"-c", "--count", "<count>[kKmMgG]", ALL_MODES,
 	 	"Read at most <count> [KMG]bytes", 0, 0},
+	{"--filter-threads", "--filter-threads", "<count>", RDD_LOCAL|RDD_CLIENT,
+	 	"Run the filters on <count> threads", 0, 0},
+	{"--filter-chunk", "--filter-chunk", "<size>", RDD_LOCAL|RDD_CLIENT,
+	 	"Feed data to the filters in chunks of <size> bytes", 0, 0},
+	{"--block-filter-threads", "--block-filter-threads", "<count>",
+		RDD_LOCAL|RDD_CLIENT,
+	 	"Compute the blocks of each block filter on <count> threads",
+		0, 0},
 	{"-f", "--force", 0, RDD_LOCAL|RDD_SERVER,
 	 	"Ruthlessly overwrite existing files", 0, 0},
 	{"-i", "--inetd", 0, RDD_SERVER, 
 	 	"rdd is started by (x)inetd", 0, 0},
+	{"--max-sessions", "--max-sessions", "<count>", RDD_SERVER,
+	 	"Serve up to <count> clients at a time", 0, 0},
+	{"--session-dir", "--session-dir", "<dir>", RDD_SERVER,
+	 	"Create a directory per session in <dir>", 0, 0},
+	{"--max-memory", "--max-memory", "<size>", RDD_SERVER,
+	 	"Limit buffer memory of all sessions to <size>", 0, 0},
+	{"--max-bandwidth", "--max-bandwidth", "<size>", RDD_SERVER,
+	 	"Limit output of all sessions to <size> bytes/s", 0, 0},
 	{"-l", "--log-file", "<file>", ALL_MODES,
 		"Log messages in <file>", 0, 0},
 	{"-m", "--min-block-size", "<count>[kKmMgK]", RDD_LOCAL|RDD_CLIENT,
 	 	"Minimum read-block size is <count> [KMG]byte", 0, 0},
+	{"--adaptive", "--adaptive", 0, RDD_LOCAL|RDD_CLIENT,
+	 	"Pick the read-block size with the highest throughput", 0, 0},
 	{"-n", "--nretry", "<count>", RDD_LOCAL|RDD_CLIENT,
 	 	"Retry failed reads <count> times", 0, 0},
 	{"-o", "--offset", "<count>[kKmMgG]", ALL_MODES,
 	 	"Skip <count> [KMG] input bytes", 0, 0},
+	{"--pipeline", "--pipeline", "<count>", RDD_LOCAL|RDD_CLIENT,
+	 	"Read ahead, using <count> buffers, while filtering", 0, 0},
+	{"--write-behind", "--write-behind", "<count>", RDD_LOCAL|RDD_SERVER,
+	 	"Write output in the background, using <count> buffers", 0, 0},
 	{"-p", "--port", "<portnum>", RDD_CLIENT|RDD_SERVER,
 	 	"Set server port to <port>", 0, 0},
+	{"--queue-depth", "--queue-depth", "<count>", RDD_LOCAL|RDD_CLIENT,
+	 	"Keep up to <count> input reads in flight (io_uring)", 0, 0},
 	{"-q", "--quiet", 0, ALL_MODES,
 	 	"Do not ask questions", 0, 0},
+	{"--rescue-map", "--rescue-map", "<file>", RDD_LOCAL,
+	 	"Rescue a failing disk in several passes; keep state in <file>", 0, 0},
 	{"-r", "--raw", 0, RDD_LOCAL|RDD_CLIENT,
 	 	"Read from a raw device (/dev/raw/raw[0-9])", 0, 0},
+	{"--direct", "--direct", 0, RDD_LOCAL|RDD_SERVER,
+	 	"Write output files with O_DIRECT, bypassing the page cache", 0, 0},
+	{"--sparse", "--sparse", 0, RDD_LOCAL|RDD_SERVER,
+	 	"Leave holes in the output files where the data is zero", 0, 0},
+	{"--stripes", "--stripes", "<count>", RDD_LOCAL|RDD_CLIENT,
+	 	"Read <count> interleaved stripes concurrently", 0, 0},
 	{"-s", "--split", "<count>[kKmMgG]", RDD_LOCAL|RDD_CLIENT,
 	 	"Split output, all files < <count> [KMG]bytes", 0, 0},
 	{"-v", "--verbose", 0, ALL_MODES,
 	 	"Be verbose", 0, 0},
-	{"-z", "--compress", 0, RDD_CLIENT,
-	 	"Compress data sent across the network", 0, 0},
+	{"-z", "--compress", 0, RDD_LOCAL|RDD_CLIENT,
+	 	"Compress the output image or the network data", 0, 0},
+	{"--codec", "--codec", "<zlib|zstd|lz4>", RDD_LOCAL|RDD_CLIENT,
+	 	"Compress with the given codec (default: zlib)", 0, 0},
+	{"--compress-level", "--compress-level", "<level>",
+		RDD_LOCAL|RDD_CLIENT,
+	 	"Compress at <level> (0: the codec's default)", 0, 0},
+	{"--compress-threads", "--compress-threads", "<count>",
+		RDD_LOCAL|RDD_CLIENT,
+	 	"Compress on <count> threads", 0, 0},
+	{"--entropy-bypass", "--entropy-bypass", "<bits>", RDD_CLIENT,
+	 	"Do not compress chunks with an entropy of <bits> per byte or more",
+		0, 0},
+	{"--streams", "--streams", "<count>", RDD_CLIENT,
+	 	"Stripe network data over <count> TCP connections", 0, 0},
+	{"--protocol", "--protocol", "<version>", RDD_CLIENT|RDD_SERVER,
+	 	"Use network protocol <version> (1 or 2) at most", 0, 0},
 	{"-H", "--histogram", "<file>", ALL_MODES,
 	 	"Store histogram-derived stats in <file>", 0, 0},
 	{"-h", "--histogram-block-size", "<size>", ALL_MODES,
@@ -204,10 +321,24 @@ static RDD_OPTION opttab[] = {
 	 	"Compute and store Adler32 checksums in <file>", 0, 0},
 	{"--checksum-block-size", "--adler32-block-size", "<size>", ALL_MODES,
 	 	"Adler32 uses <size>-byte blocks", 0, 0},
+	{"--checkpoint", "--checkpoint", "<file>", RDD_LOCAL,
+	 	"Save a checkpoint in <file> at regular intervals", 0, 0},
+	{"--checkpoint-interval", "--checkpoint-interval", "<sec>", RDD_LOCAL,
+	 	"Save a checkpoint every <sec> seconds", 0, 0},
+	{"--resume", "--resume", "<file>", RDD_LOCAL,
+	 	"Resume an interrupted copy from checkpoint <file>", 0, 0},
 	{"--crc32", "--crc32", "<file>", ALL_MODES,
 	 	"Compute and store CRC32 checksums in <file>", 0, 0},
 	{"--crc32-block-size", "--crc32-block-size", "<size>", ALL_MODES,
 	 	"CRC32 uses <size>-byte blocks", 0, 0},
+	{"--crc32c", "--crc32c", "<file>", ALL_MODES,
+	 	"Compute and store CRC32C checksums in <file>", 0, 0},
+	{"--crc32c-block-size", "--crc32c-block-size", "<size>", ALL_MODES,
+	 	"CRC32C uses <size>-byte blocks", 0, 0},
+	{"--checksum-format", "--checksum-format", "<version>", ALL_MODES,
+	 	"checksum file format version: 1 or 2", 0, 0},
+	{"--checksum-index", "--checksum-index", 0, ALL_MODES,
+	 	"Append a sorted index to version-2 checksum files", 0, 0},
 	{"--md5", "--md5", 0, ALL_MODES,
 	 	"Compute and print MD5 hash", 0, 0},
 	{"--sha", "--sha1", 0, ALL_MODES,
@@ -216,16 +347,50 @@ static RDD_OPTION opttab[] = {
 	 	"block-wise MD5 block size", 0, 0},
 	{"--block-md5", "--block-md5", "<file>", ALL_MODES,
 	 	"Store block-wise MD5 hash values in <file>", 0, 0},
+	{"--block-md5-format", "--block-md5-format", "<format>", ALL_MODES,
+	 	"block-wise MD5 file format: text, binary, or indexed", 0, 0},
+	{"--block-digest", "--block-digest", "<file>", ALL_MODES,
+	 	"Store block-wise hash values in checksum file <file>", 0, 0},
+	{"--block-digest-type", "--block-digest-type", "<type>", ALL_MODES,
+	 	"block-wise hash: md5, sha1, or sha256", 0, 0},
+	{"--block-digest-size", "--block-digest-size", "<size>", ALL_MODES,
+	 	"block-wise hash block size", 0, 0},
 	{0, 0, 0, 0, 0, 0, 0} /* sentinel */
 };
 
 static RDD_MSGPRINTER *the_printer;
+static char **the_argv;
+static int the_argc;
+
+static void open_logfile(void);
+static void log_header(char **argv, int argc);
+static void log_params(rdd_copy_opts *opts);
+
+/* Sockets of the version-2 client connections (server mode only).
+ * If the server exits before the copy is complete, it reports the
+ * reason on each of them.
+ */
+static int feedback_socks[RDD_NET_MAX_STREAMS];
+static unsigned nfeedback;
+static int feedback_status = RDD_ABORTED;
+
+static void
+report_failure(void)
+{
+	unsigned i;
+
+	for (i = 0; i < nfeedback; i++) {
+		(void) rdd_net_send_msg(feedback_socks[i], RDD_NET_MSG_ERROR,
+				(rdd_count_t) feedback_status);
+	}
+}
 
 static void
 fatal_rdd_error(int rdd_errno, char *fmt, ...)
 {
 	va_list ap;
 
+	feedback_status = rdd_errno;
 	va_start(ap, fmt);
 	rdd_mp_vrddmsg(the_printer, RDD_MSG_ERROR, rdd_errno, fmt, ap);
 	va_end(ap);
@@ -280,6 +445,65 @@ scan_tcp_port(char *str)
 	return port;
 }
 
+static unsigned
+scan_blockmd5_format(char *str)
+{
+	unsigned i;
+
+	for (i = 0; blockmd5_formats[i] != 0; i++) {
+		if (strcmp(str, blockmd5_formats[i]) == 0) {
+			return i;
+		}
+	}
+	error("bad block-MD5 file format %s "
+	      "(use text, binary, or indexed)", str);
+	return 0;
+}
+
+static unsigned
+scan_codec(char *str)
+{
+	unsigned codec = RDD_CODEC_ZLIB;
+
+	if (rdd_codec_lookup(str, &codec) != RDD_OK) {
+		error("bad codec %s (use zlib, zstd, or lz4)", str);
+	}
+	if (! rdd_codec_supported(codec)) {
+		error("rdd not configured with %s support", str);
+	}
+	return codec;
+}
+
+static double
+scan_entropy(char *str)
+{
+	double bits;
+	char *end;
+
+	bits = strtod(str, &end);
+	if (end == str || *end != '\0' || !(bits > 0.0 && bits <= 8.0)) {
+		error("bad entropy %s (use a number of bits per byte "
+		      "between 0 and 8)", str);
+	}
+	return bits;
+}
+
+static unsigned
+scan_digest_type(char *str)
+{
+	unsigned i;
+
+	for (i = 0; digest_types[i].name != 0; i++) {
+		if (strcmp(str, digest_types[i].name) == 0
+		&&  rdd_cksum2_record_size(digest_types[i].type) != 0) {
+			return digest_types[i].type;
+		}
+	}
+	error("bad or unsupported block digest type %s "
+	      "(use md5, sha1, or sha256)", str);
+	return 0;
+}
+
 static void
 init_options(void)
 {
@@ -294,7 +518,13 @@ init_options(void)
 	opts.histblocklen = DEFAULT_HIST_BLOCK_SIZE;
 	opts.adler32len = DEFAULT_CHKSUM_BLOCK_SIZE;
 	opts.crc32len = DEFAULT_CHKSUM_BLOCK_SIZE;
+	opts.crc32clen = DEFAULT_CHKSUM_BLOCK_SIZE;
 	opts.blockmd5len = DEFAULT_BLOCKMD5_SIZE;
+	opts.digesttype = RDD_CKSUM2_SHA256;
+	opts.digestlen = DEFAULT_CHKSUM_BLOCK_SIZE;
+	opts.checksum_version = 1;
+	opts.checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+	opts.filter_chunk = 0;
 }
 
 
@@ -373,6 +603,9 @@ process_options(void)
 	}
 
 	opts.md5 = rdd_opt_set("md5");
+	opts.adaptive = rdd_opt_set("adaptive");
+	opts.sparse = rdd_opt_set("sparse");
+	opts.direct = rdd_opt_set("direct");
 	opts.sha1 = rdd_opt_set("sha1");
 	
 	opts.force_overwrite = rdd_opt_set("force");
@@ -403,6 +636,23 @@ process_options(void)
 			      "(use --crc32)");
 		}
 	}
+	if (rdd_opt_set_arg("crc32c", &arg)) {
+		opts.crc32cfile = arg;
+	}
+	if (rdd_opt_set_arg("crc32c-block-size", &arg)) {
+		opts.crc32clen= scan_size(arg, RDD_POSITIVE);
+		if (opts.crc32cfile == 0) {
+			error("missing CRC-32C output file name "
+			      "(use --crc32c)");
+		}
+	}
+	if (rdd_opt_set_arg("checksum-format", &arg)) {
+		opts.checksum_version = scan_uint(arg);
+		if (opts.checksum_version != 1 && opts.checksum_version != 2) {
+			error("bad checksum file format %s (use 1 or 2)", arg);
+		}
+	}
+	opts.checksum_index = rdd_opt_set("checksum-index");
 	if (rdd_opt_set_arg("histogram", &arg)) {
 		opts.histfile = arg;
 	}
@@ -423,6 +673,35 @@ process_options(void)
 			      "(use --block-md5)");
 		}
 	}
+	if (rdd_opt_set_arg("block-md5-format", &arg)) {
+		opts.blockmd5fmt = scan_blockmd5_format(arg);
+		if (opts.blockmd5file == 0) {
+			error("missing block-MD5 output file name "
+			      "(use --block-md5)");
+		}
+	}
+	if (rdd_opt_set_arg("block-digest", &arg)) {
+		opts.digestfile = arg;
+	}
+	if (rdd_opt_set_arg("block-digest-type", &arg)) {
+		opts.digesttype = scan_digest_type(arg);
+		if (opts.digestfile == 0) {
+			error("missing block-digest output file name "
+			      "(use --block-digest)");
+		}
+	}
+	if (rdd_opt_set_arg("block-digest-size", &arg)) {
+		opts.digestlen = scan_size(arg, RDD_POSITIVE);
+		if (opts.digestfile == 0) {
+			error("missing block-digest output file name "
+			      "(use --block-digest)");
+		}
+	}
+	if (opts.checksum_index && opts.checksum_version != 2
+	&&  opts.digestfile == 0) {
+		error("--checksum-index requires version-2 checksum files "
+		      "(use --checksum-format 2 or --block-digest)");
+	}
 	if (rdd_opt_set_arg("progress", &arg)) {
 		opts.progresslen = scan_uint(arg);
 	}
@@ -447,6 +726,107 @@ process_options(void)
 	if (rdd_opt_set_arg("split", &arg)) {
 		opts.splitlen = scan_size(arg, 0);
 	}
+	if (rdd_opt_set_arg("pipeline", &arg)) {
+		opts.pipeline = scan_uint(arg);
+		if (opts.pipeline < 2) {
+			error("pipeline needs at least 2 buffers");
+		}
+	}
+	if (rdd_opt_set_arg("write-behind", &arg)) {
+		opts.write_behind = scan_uint(arg);
+		if (opts.write_behind < 2) {
+			error("write-behind needs at least 2 buffers");
+		}
+	}
+	if (rdd_opt_set_arg("queue-depth", &arg)) {
+		opts.queue_depth = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("filter-threads", &arg)) {
+		opts.filter_threads = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("filter-chunk", &arg)) {
+		opts.filter_chunk = scan_size(arg, 0);
+	}
+	if (rdd_opt_set_arg("block-filter-threads", &arg)) {
+		opts.block_threads = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("rescue-map", &arg)) {
+		opts.rescuemap = arg;
+	}
+	if (rdd_opt_set_arg("stripes", &arg)) {
+		opts.stripes = scan_uint(arg);
+	}
+	opts.streams = 1;
+	if (rdd_opt_set_arg("streams", &arg)) {
+		opts.streams = scan_uint(arg);
+		if (opts.streams < 1 || opts.streams > RDD_NET_MAX_STREAMS) {
+			error("number of streams must be between 1 and %u",
+				RDD_NET_MAX_STREAMS);
+		}
+	}
+	if (rdd_opt_set_arg("max-sessions", &arg)) {
+		opts.max_sessions = scan_uint(arg);
+		if (opts.max_sessions < 1) {
+			error("--max-sessions must be at least 1");
+		}
+		if (opts.inetd) {
+			error("--max-sessions cannot be used in (x)inetd mode");
+		}
+	}
+	opts.session_dir = ".";
+	if (rdd_opt_set_arg("session-dir", &arg)) {
+		opts.session_dir = arg;
+	}
+	if (rdd_opt_set_arg("max-memory", &arg)) {
+		opts.max_memory = scan_size(arg, RDD_POSITIVE);
+	}
+	if (rdd_opt_set_arg("max-bandwidth", &arg)) {
+		opts.max_bandwidth = scan_size(arg, RDD_POSITIVE);
+	}
+	if (opts.max_sessions == 0
+	&&  (rdd_opt_set("session-dir") || opts.max_memory > 0)) {
+		error("--session-dir and --max-memory require --max-sessions");
+	}
+	opts.codec = RDD_CODEC_ZLIB;
+	if (rdd_opt_set_arg("codec", &arg)) {
+		opts.codec = scan_codec(arg);
+	}
+	if (rdd_opt_set_arg("compress-level", &arg)) {
+		opts.level = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("compress-threads", &arg)) {
+		opts.compress_threads = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("entropy-bypass", &arg)) {
+		opts.bypass_entropy = scan_entropy(arg);
+	}
+	if ((rdd_opt_set("codec") || rdd_opt_set("compress-level")
+	     || rdd_opt_set("compress-threads")
+	     || rdd_opt_set("entropy-bypass"))
+	&&  !opts.compress) {
+		error("--codec, --compress-level, --compress-threads and "
+		      "--entropy-bypass require --compress");
+	}
+	opts.protocol = RDD_NET_VERSION;
+	if (rdd_opt_set_arg("protocol", &arg)) {
+		opts.protocol = scan_uint(arg);
+		if (opts.protocol < 1 || opts.protocol > RDD_NET_VERSION) {
+			error("network protocol version must be between 1 "
+			      "and %u", RDD_NET_VERSION);
+		}
+	}
+	if (rdd_opt_set_arg("checkpoint", &arg)) {
+		opts.checkpoint = arg;
+	}
+	if (rdd_opt_set_arg("checkpoint-interval", &arg)) {
+		opts.checkpoint_interval = scan_uint(arg);
+	}
+	if (rdd_opt_set_arg("resume", &arg)) {
+		opts.resume = arg;
+		if (opts.checkpoint == 0) {
+			opts.checkpoint = arg;	/* keep checkpointing */
+		}
+	}
 	if (rdd_opt_set_arg("port", &arg)) {
 		opts.server_port = scan_tcp_port(arg);
 	}
@@ -540,6 +920,10 @@ command_line(int argc, char **argv)
 		error("block size (%llu) too large (larger than INT_MAX)",
 			opts.blocklen);
 	}
+	if (opts.filter_chunk >= (rdd_count_t) INT_MAX) {
+		error("filter chunk size (%llu) too large "
+		      "(larger than INT_MAX)", opts.filter_chunk);
+	}
 	if (opts.minblocklen > opts.blocklen) {
 		error("minimum block length (%llu) cannot exceed "
 		      "block length (%llu)",
@@ -553,15 +937,62 @@ command_line(int argc, char **argv)
 	if (opts.splitlen > 0 && opts.outpath == 0) {
 		error("--split requires an output file name");
 	}
+	if (opts.sparse && opts.direct) {
+		error("--sparse cannot be combined with --direct");
+	}
+	if (opts.rescuemap != 0) {
+		if (opts.outpath == 0 || strcmp(opts.outpath, "-") == 0) {
+			error("--rescue-map requires an output file name");
+		}
+		if (opts.splitlen > 0 || opts.stripes > 1) {
+			error("--rescue-map cannot be combined with "
+			      "--split or --stripes");
+		}
+		if (access(opts.rescuemap, F_OK) < 0
+		&&  access(opts.outpath, F_OK) == 0
+		&&  !opts.force_overwrite) {
+			error("%s exists, but %s does not; use -f to "
+			      "start a new rescue", opts.outpath,
+			      opts.rescuemap);
+		}
+	}
+	if (opts.compress && opts.mode == RDD_LOCAL) {
+		if (opts.outpath == 0) {
+			error("--compress requires an output file name");
+		}
+		if (opts.rescuemap != 0 || opts.checkpoint != 0) {
+			error("--compress cannot be combined with "
+			      "--rescue-map, --checkpoint or --resume");
+		}
+	}
+	if (opts.checkpoint != 0) {
+		if (opts.outpath != 0 && strcmp(opts.outpath, "-") == 0) {
+			error("cannot checkpoint a copy to standard output");
+		}
+		if (opts.pipeline > 0 || opts.stripes > 1
+		||  opts.rescuemap != 0) {
+			error("--checkpoint and --resume cannot be combined "
+			      "with --pipeline, --stripes or --rescue-map");
+		}
+	}
 }
 
 static RDD_READER *
 open_disk_input(rdd_count_t *inputlen)
 {
 	RDD_READER *reader = 0;
+	int fd;
 	int rc;
 
-	rc = rdd_open_file_reader(&reader, opts.infile, opts.raw);
+	if (opts.queue_depth > 0 && !opts.raw) {
+		if ((fd = open(opts.infile, O_RDONLY)) < 0) {
+			fatal_rdd_error(RDD_EOPEN, "cannot open %s", opts.infile);
+		}
+		rc = rdd_open_uring_reader(&reader, fd, opts.queue_depth,
+					(unsigned) opts.blocklen);
+	} else {
+		rc = rdd_open_file_reader(&reader, opts.infile, opts.raw);
+	}
 	if (rc != RDD_OK) {
 		fatal_rdd_error(rc, "cannot open %s", opts.infile);
 	}
@@ -589,16 +1020,513 @@ open_disk_input(rdd_count_t *inputlen)
 		}
 	}
 
-	return reader;
+	return reader;
+}
+
+/* Opens an extra reader on the input file for a striped copier.
+ */
+static int
+open_stripe_input(RDD_READER **reader, void *env)
+{
+	rdd_count_t inputlen;
+
+	*reader = open_disk_input(&inputlen);
+	return RDD_OK;
+}
+
+/* A transfer from one client over one or more connections.  In
+ * multi-session mode the server collects all connections of a
+ * session before it hands the session to a process of its own.
+ */
+typedef struct _SESSION {
+	RDD_NET_HEADER   request;
+	unsigned         version;	/* network protocol version */
+	unsigned         njoined;	/* connections received so far */
+	RDD_READER      *streams[RDD_NET_MAX_STREAMS];
+	int              socks[RDD_NET_MAX_STREAMS];
+	rdd_checksum_t   crcs[RDD_NET_MAX_STREAMS];
+	char             peer[32];	/* client address */
+	unsigned         seq;		/* session number (multi-session) */
+	unsigned         slot;		/* resource slot (multi-session) */
+	struct _SESSION *next;
+} SESSION;
+
+/* A session process in multi-session mode.
+ */
+typedef struct _SESSION_SLOT {
+	pid_t    pid;			/* 0 if the slot is free */
+	unsigned seq;
+} SESSION_SLOT;
+
+#define SESSION_LOG		"rdd-copy.log"
+#define HEADER_TIMEOUT		10	/* seconds */
+
+static RDD_SERVER_LIMITS *the_limits;
+
+static void
+peer_name(int sock, char *buf, unsigned bufsize)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+
+	memset(&addr, 0, sizeof addr);
+	if (getpeername(sock, (struct sockaddr *) &addr, &len) == 0
+	&&  addr.sin_family == AF_INET) {
+		snprintf(buf, bufsize, "%s", inet_ntoa(addr.sin_addr));
+	} else {
+		snprintf(buf, bufsize, "local");
+	}
+}
+
+/* Reads the request or join header of a new connection.
+ */
+static int
+recv_connection(int sock, RDD_READER **reader, RDD_NET_HEADER *h)
+{
+	int rc;
+
+	if ((rc = rdd_open_fd_reader(reader, sock)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_recv_header(*reader, h)) != RDD_OK) {
+		(void) rdd_reader_close(*reader, 1);
+		*reader = 0;
+	}
+	return rc;
+}
+
+/* Adds a connection to a session.  A client that offers network
+ * protocol version 2 gets its HELLO right away, because it waits
+ * for it before it opens its next connection.  A version-1 client
+ * gets no answer, nor does a version-2 client if we were told to
+ * speak version 1; it falls back after a timeout.
+ */
+static int
+add_connection(SESSION *s, RDD_READER *reader, int sock, RDD_NET_HEADER *h)
+{
+	int v2 = (h->flags & RDD_NET_V2) != 0 && opts.protocol >= 2;
+	unsigned i = 0;
+	int rc;
+
+	if (h->join) {
+		i = h->index;
+		if (h->session != s->request.session) {
+			return RDD_BADARG;
+		}
+		if (i < 1 || i >= s->request.nstream || s->streams[i] != 0) {
+			return RDD_ERANGE;
+		}
+		if (v2 != (s->version >= 2)) {
+			return RDD_ESYNTAX;
+		}
+	} else {
+		s->request = *h;
+		s->version = v2 ? 2 : 1;
+	}
+
+	if (v2) {
+		rc = rdd_net_send_msg(sock, RDD_NET_MSG_HELLO, RDD_NET_WINDOW);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+	}
+	s->streams[i] = reader;
+	s->socks[i] = sock;
+	s->crcs[i] = rdd_net_header_crc(h);
+	s->njoined++;
+	return RDD_OK;
+}
+
+static int
+new_session(SESSION **sp, RDD_READER *reader, int sock, RDD_NET_HEADER *h)
+{
+	SESSION *s;
+	int rc;
+
+	if ((s = calloc(1, sizeof(SESSION))) == 0) {
+		return RDD_NOMEM;
+	}
+	peer_name(sock, s->peer, sizeof s->peer);
+	if ((rc = add_connection(s, reader, sock, h)) != RDD_OK) {
+		free(s);
+		return rc;
+	}
+	*sp = s;
+	return RDD_OK;
+}
+
+/* Closes the connections of a session that will not be served by
+ * this process.
+ */
+static void
+drop_session(SESSION *s)
+{
+	unsigned i;
+
+	for (i = 0; i < RDD_NET_MAX_STREAMS; i++) {
+		if (s->streams[i] != 0) {
+			(void) rdd_reader_close(s->streams[i], 1);
+		}
+	}
+	free(s->request.filename);
+	free(s);
+}
+
+/* Arranges for the clients of a version-2 session to be told
+ * why this process exits if it fails.
+ */
+static void
+watch_session(SESSION *s)
+{
+	unsigned i;
+
+	if (s->version < 2) {
+		return;
+	}
+	atexit(report_failure);
+	for (i = 0; i < s->request.nstream; i++) {
+		feedback_socks[nfeedback++] = s->socks[i];
+	}
+}
+
+/* Stacks the readers of a session: a frame reader on each version-2
+ * connection, a stripe reader on top of several connections, and a
+ * decompressing reader if the client compresses its data.
+ */
+static RDD_READER *
+session_reader(SESSION *s, rdd_count_t *inputlen)
+{
+	RDD_NET_HEADER *h = &s->request;
+	RDD_READER *reader = 0;
+	unsigned codec;
+	unsigned i;
+	int rc;
+
+	opts.outpath = h->filename;
+	*inputlen = h->file_size;
+	opts.blocklen = h->block_size;
+	opts.splitlen = h->split_size;
+
+	if (opts.verbose) {
+		logmsg("Received rdd request:");
+		logmsg("\tfile name:   %s", opts.outpath);
+		logmsg("\tfile size:   %s", rdd_strsize(*inputlen));
+		logmsg("\tblock size:  %llu", opts.blocklen);
+		logmsg("\tsplit size:  %llu", opts.splitlen);
+		logmsg("\tstreams:     %u", h->nstream);
+	}
+	logmsg("network protocol: version %u", s->version);
+
+	if (s->version >= 2) {
+		for (i = 0; i < h->nstream; i++) {
+			rc = rdd_open_frame_reader(&s->streams[i],
+					s->streams[i], s->socks[i], s->crcs[i]);
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc, "cannot open frame reader");
+			}
+		}
+	}
+
+	reader = s->streams[0];
+	if (h->nstream > 1) {
+		rc = rdd_open_stripe_reader(&reader, s->streams, h->nstream);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot open stripe reader");
+		}
+	}
+
+	if ((h->flags & RDD_NET_COMPRESS) != 0) {
+		codec = rdd_net_codec(h->flags);
+		logmsg("compression codec: %s",
+			rdd_codec_name(codec) == 0 ?
+			"unknown" : rdd_codec_name(codec));
+		if ((h->flags & RDD_NET_ADAPTIVE) != 0) {
+			logmsg("adaptive codec stream: yes");
+			rc = rdd_open_adaptive_codec_reader(&reader, reader,
+					codec);
+		} else {
+			rc = rdd_open_codec_reader(&reader, reader, codec);
+		}
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot decompress client data "
+					"(codec %u)", codec);
+		}
+	}
+
+	return reader;
+}
+
+/* Reaps the session processes that have ended and releases their
+ * resources.
+ */
+static void
+reap_sessions(SESSION_SLOT *slots)
+{
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < opts.max_sessions; i++) {
+			if (slots[i].pid != pid) {
+				continue;
+			}
+			slots[i].pid = 0;
+			(void) rdd_server_limits_release(the_limits, i);
+			logmsg("session %u %s", slots[i].seq,
+				WIFEXITED(status) && WEXITSTATUS(status) == 0 ?
+				"completed" : "failed");
+		}
+	}
+}
+
+/* Accepts one connection, if one arrives within a second, and adds
+ * it to the list of pending sessions.  Clients that misbehave are
+ * logged and disconnected; they do not stop the server.
+ */
+static void
+accept_connection(int server_sock, SESSION **pending)
+{
+	struct pollfd pfd;
+	struct timeval tv;
+	RDD_NET_HEADER h;
+	RDD_READER *reader = 0;
+	SESSION *s, **sp;
+	char peer[32];
+	int sock = -1;
+	int rc;
+
+	pfd.fd = server_sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 1000) <= 0) {
+		return;
+	}
+	if (rdd_await_connection(the_printer, server_sock, &sock) != RDD_OK) {
+		return;
+	}
+	peer_name(sock, peer, sizeof peer);
+
+	/* Do not let a silent client block the server.
+	 */
+	tv.tv_sec = HEADER_TIMEOUT;
+	tv.tv_usec = 0;
+	(void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	rc = recv_connection(sock, &reader, &h);
+	tv.tv_sec = 0;
+	(void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	if (rc != RDD_OK) {
+		rdd_mp_rddmsg(the_printer, RDD_MSG_INFO, rc,
+				"bad request from %s", peer);
+		if (reader == 0) {
+			(void) close(sock);
+		}
+		return;
+	}
+
+	if (! h.join) {
+		if ((rc = new_session(&s, reader, sock, &h)) != RDD_OK) {
+			rdd_mp_rddmsg(the_printer, RDD_MSG_INFO, rc,
+					"bad request from %s", peer);
+			free(h.filename);
+			(void) rdd_reader_close(reader, 1);
+			return;
+		}
+		for (sp = pending; *sp != 0; sp = &(*sp)->next)
+			;
+		*sp = s;
+		return;
+	}
+
+	/* A join request must come from the client that started the
+	 * session.  If it is bad, the whole session is dropped.
+	 */
+	for (sp = pending; (s = *sp) != 0; sp = &s->next) {
+		if (s->request.session == h.session
+		&&  s->njoined < s->request.nstream
+		&&  strcmp(s->peer, peer) == 0) {
+			break;
+		}
+	}
+	if (s == 0) {
+		logmsg("join request from %s for unknown session", peer);
+		(void) rdd_reader_close(reader, 1);
+		return;
+	}
+	if ((rc = add_connection(s, reader, sock, &h)) != RDD_OK) {
+		rdd_mp_rddmsg(the_printer, RDD_MSG_INFO, rc,
+				"bad join request from %s", peer);
+		(void) rdd_reader_close(reader, 1);
+		*sp = s->next;
+		drop_session(s);
+	}
+}
+
+/* Multi-session mode: this process accepts all connections, collects
+ * the connections of each session, and forks a process per session
+ * once all of its connections have arrived and a slot is free.  Only
+ * the session processes return from this routine; the server itself
+ * runs until it is killed.
+ */
+static SESSION *
+serve_sessions(int server_sock)
+{
+	SESSION_SLOT *slots;
+	SESSION *pending = 0;
+	SESSION *s, *p, **sp;
+	unsigned nseq = 0;
+	unsigned i;
+	pid_t pid;
+	int rc;
+
+	if ((slots = calloc(opts.max_sessions, sizeof(*slots))) == 0) {
+		fatal_rdd_error(RDD_NOMEM, "cannot allocate session slots");
+	}
+	rc = rdd_new_server_limits(&the_limits, opts.max_sessions,
+			opts.max_memory, opts.max_bandwidth);
+	if (rc != RDD_OK) {
+		fatal_rdd_error(rc, "cannot create session limits");
+	}
+	logmsg("serving up to %u sessions on port %u",
+		opts.max_sessions, opts.server_port);
+
+	for (;;) {
+		reap_sessions(slots);
+
+		for (sp = &pending; (s = *sp) != 0; ) {
+			if (s->njoined < s->request.nstream) {
+				sp = &s->next;
+				continue;
+			}
+			for (i = 0; i < opts.max_sessions; i++) {
+				if (slots[i].pid == 0) break;
+			}
+			if (i == opts.max_sessions) {
+				break;		/* wait for a free slot */
+			}
+
+			*sp = s->next;
+			s->next = 0;
+			s->seq = ++nseq;
+			s->slot = i;
+
+			fflush(0);	/* do not let the child repeat our output */
+			if ((pid = fork()) < 0) {
+				rdd_mp_unixmsg(the_printer, RDD_MSG_INFO, errno,
+					"cannot start session %u", s->seq);
+				drop_session(s);
+				continue;
+			} else if (pid == 0) {
+				(void) close(server_sock);
+				while ((p = pending) != 0) {
+					pending = p->next;
+					drop_session(p);
+				}
+				free(slots);
+				return s;
+			}
+
+			logmsg("session %u from %s (process %d): %s",
+				s->seq, s->peer, (int) pid, s->request.filename);
+			slots[i].pid = pid;
+			slots[i].seq = s->seq;
+			drop_session(s);
+		}
+
+		/* The server does not exit; keep its log up to date.
+		 */
+		fflush(0);
+		accept_connection(server_sock, &pending);
+	}
+}
+
+/* Prepares a session process in multi-session mode.  The session
+ * gets a directory of its own, which becomes the current directory,
+ * and a log file in that directory.  The output file is created in
+ * the session directory under the last component of the client's
+ * path name.
+ */
+static void
+start_session(SESSION *s)
+{
+	RDD_MSGPRINTER *printer = 0;
+	char dir[PATH_MAX];
+	char stamp[32];
+	char *name;
+	time_t now;
+	int rc;
+
+	watch_session(s);
+
+	/* The server's printers belong to the server.
+	 */
+	if ((rc = rdd_mp_open_stdio_printer(&printer, stderr)) != RDD_OK) {
+		exit(EXIT_FAILURE);
+	}
+	the_printer = printer;
+
+	now = time(0);
+	strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", localtime(&now));
+	snprintf(dir, sizeof dir, "%s/%s-%s-%u", opts.session_dir, stamp,
+		s->peer, s->seq);
+	if (mkdir(dir, 0755) < 0) {
+		rdd_mp_unixmsg(the_printer, RDD_MSG_ERROR, errno,
+			"cannot create session directory %s", dir);
+		feedback_status = RDD_EOPEN;
+		exit(EXIT_FAILURE);
+	}
+	if (chdir(dir) < 0) {
+		rdd_mp_unixmsg(the_printer, RDD_MSG_ERROR, errno,
+			"cannot enter session directory %s", dir);
+		feedback_status = RDD_EOPEN;
+		exit(EXIT_FAILURE);
+	}
+
+	opts.logfile = SESSION_LOG;
+	open_logfile();
+	log_header(the_argv, the_argc);
+	logmsg("session %u from %s in directory %s", s->seq, s->peer, dir);
+	log_params(&opts);
+
+	name = strrchr(s->request.filename, '/');
+	name = (name == 0 ? s->request.filename : name + 1);
+	if (*name == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0
+	||  strcmp(name, SESSION_LOG) == 0) {
+		fatal_rdd_error(RDD_BADARG, "bad output file name %s",
+				s->request.filename);
+	}
+	memmove(s->request.filename, name, strlen(name) + 1);
+}
+
+/* Reserves the session's share of the memory budget.  The estimate
+ * counts the copy buffer, the zlib or frame buffer of each
+ * connection, and the write-behind buffers, all of block size.
+ */
+static void
+reserve_memory(SESSION *s)
+{
+	rdd_count_t need;
+	int rc;
+
+	need = opts.blocklen * (2 + s->request.nstream + opts.write_behind);
+	logmsg("session memory: %llu bytes", need);
+	rc = rdd_server_limits_reserve(the_limits, s->slot, need);
+	if (rc == RDD_ERANGE) {
+		fatal_rdd_error(rc, "session needs more than %llu bytes "
+				"of memory", opts.max_memory);
+	} else if (rc != RDD_OK) {
+		fatal_rdd_error(rc, "cannot reserve session memory");
+	}
 }
 
 static RDD_READER *
 open_net_input(rdd_count_t *inputlen)
 {
 	RDD_READER *reader = 0;
+	RDD_NET_HEADER h;
+	SESSION *s = 0;
 	int server_sock = -1;
-	unsigned flags;
-	int fd = -1;
+	int sock = -1;
 	int rc;
 
 	*inputlen = RDD_WHOLE_FILE;
@@ -606,7 +1534,7 @@ open_net_input(rdd_count_t *inputlen)
 	/* In server mode, we read from the network */
 	if (opts.inetd) {
 		/* started by (x)inetd */
-		fd = STDIN_FILENO;
+		sock = STDIN_FILENO;
 	} else {
 		rc = rdd_init_server(the_printer, opts.server_port,
 				&server_sock);
@@ -614,43 +1542,64 @@ open_net_input(rdd_count_t *inputlen)
 			fatal_rdd_error(rc, "cannot start rdd-copy server");
 		}
 
-		rc = rdd_await_connection(the_printer, server_sock, &fd);
+		if (opts.max_sessions > 0) {
+			s = serve_sessions(server_sock);
+			start_session(s);
+			reader = session_reader(s, inputlen);
+			reserve_memory(s);
+			return reader;
+		}
+
+		rc = rdd_await_connection(the_printer, server_sock, &sock);
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "no connection");
 		}
 	}
 
-	rc = rdd_open_fd_reader(&reader, fd);
-	if (rc != RDD_OK) {
-		fatal_rdd_error(rc, "cannot open reader on server socket");
+	if ((rc = recv_connection(sock, &reader, &h)) != RDD_OK) {
+		fatal_rdd_error(rc, "bad client request");
 	}
-
-	rc = rdd_recv_info(reader, &opts.outpath, inputlen,
-			&opts.blocklen, &opts.splitlen, &flags);
-	if (rc != RDD_OK) {
+	if (h.join) {
+		fatal_rdd_error(RDD_ESYNTAX, "bad client request");
+	}
+	if ((rc = new_session(&s, reader, sock, &h)) != RDD_OK) {
 		fatal_rdd_error(rc, "bad client request");
 	}
 
-	if (opts.verbose) {
-		logmsg("Received rdd request:");
-		logmsg("\tfile name:   %s", opts.outpath);
-		logmsg("\tfile size:   %s", rdd_strsize(*inputlen));
-		logmsg("\tblock size:  %llu", opts.blocklen);
-		logmsg("\tsplit size:  %llu", opts.splitlen);
+	/* The other connections of a striped session may arrive in
+	 * any order; each one announces its index.
+	 */
+	while (s->njoined < s->request.nstream) {
+		if (opts.inetd) {
+			error("striped transfers cannot be received "
+			      "in (x)inetd mode");
+		}
+		rc = rdd_await_connection(the_printer, server_sock, &sock);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "no connection for stream %u",
+					s->njoined);
+		}
+		if ((rc = recv_connection(sock, &reader, &h)) != RDD_OK) {
+			fatal_rdd_error(rc, "bad stream join request");
+		}
+		if (! h.join) {
+			fatal_rdd_error(RDD_ESYNTAX, "bad stream join request");
+		}
+		if ((rc = add_connection(s, reader, sock, &h)) != RDD_OK) {
+			fatal_rdd_error(rc, "bad stream join request");
+		}
 	}
 
-#if defined(DEBUG)
-	logmsg("file=%s size=%llu bsize=%llu splitsize=%llu",
-		opts.outpath, rdd_strsize(*filelen),
-		*blocklen, *splitlen);
-#endif
-	if ((flags & RDD_NET_COMPRESS) != 0) {
-		if ((rc = rdd_open_zlib_reader(&reader, reader)) != RDD_OK) {
-			fatal_rdd_error(rc, "cannot open zlib reader");
+	if (opts.max_bandwidth > 0) {
+		rc = rdd_new_server_limits(&the_limits, 1, 0,
+				opts.max_bandwidth);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot create bandwidth limit");
 		}
 	}
 
-	return reader;
+	watch_session(s);
+	return session_reader(s, inputlen);
 }
 
 /* Creates a reader stack that corresponds to the user's options.
@@ -674,7 +1623,19 @@ open_disk_output(rdd_count_t outputsize)
 
 	if (opts.outpath == 0) return 0;
 
-	wrmode = (opts.force_overwrite ? RDD_OVERWRITE_ASK : RDD_NO_OVERWRITE);
+	if (opts.resume != 0) {
+		wrmode = RDD_APPEND;
+	} else if (opts.force_overwrite) {
+		wrmode = RDD_OVERWRITE_ASK;
+	} else {
+		wrmode = RDD_NO_OVERWRITE;
+	}
+	if (opts.sparse) {
+		wrmode |= RDD_SPARSE;
+	}
+	if (opts.direct) {
+		wrmode |= RDD_DIRECT;
+	}
 
 	if (strcmp(opts.outpath, "-") == 0) {
 		if (opts.splitlen > 0) {
@@ -701,33 +1662,225 @@ open_disk_output(rdd_count_t outputsize)
 	return writer;
 }
 
+/* Returns an identifier that lets the server tell the connections
+ * of this striped session from those of other clients.
+ */
+static rdd_count_t
+new_session_id(void)
+{
+	rdd_count_t id = 0;
+	int fd;
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+		if (read(fd, &id, sizeof id) != sizeof id) {
+			id = 0;
+		}
+		close(fd);
+	}
+	id ^= ((rdd_count_t) time(0) << 32) ^ (rdd_count_t) getpid();
+	return id;
+}
+
+/* Waits for the server's answer to a version-2 request.  Returns
+ * the server's credit window, or 0 if the server does not answer
+ * within timeout milliseconds.
+ */
+static rdd_count_t
+await_hello(int sock, int timeout)
+{
+	rdd_count_t window;
+	unsigned type;
+	int rc;
+
+	rc = rdd_net_recv_msg(sock, timeout, &type, &window);
+	if (rc == RDD_EAGAIN) {
+		return 0;
+	} else if (rc != RDD_OK) {
+		fatal_rdd_error(rc, "no answer from %s:%u",
+				opts.server_host, opts.server_port);
+	}
+	if (type == RDD_NET_MSG_ERROR) {
+		fatal_rdd_error((int) window, "request refused by %s:%u",
+				opts.server_host, opts.server_port);
+	}
+	if (type != RDD_NET_MSG_HELLO || window == 0) {
+		fatal_rdd_error(RDD_ESYNTAX, "bad answer from %s:%u",
+				opts.server_host, opts.server_port);
+	}
+	return window;
+}
+
+/* Opens the other connections of a striped session and stacks
+ * a stripe writer on top of all of them.
+ */
+static RDD_WRITER *
+open_streams(RDD_WRITER *first, rdd_count_t session, unsigned flags)
+{
+	RDD_WRITER *streams[RDD_NET_MAX_STREAMS];
+	RDD_WRITER *writer = 0;
+	char *server = opts.server_host;
+	unsigned port = opts.server_port;
+	rdd_count_t window;
+	unsigned i;
+	int sock;
+	int rc;
+
+	streams[0] = first;
+	for (i = 1; i < opts.streams; i++) {
+		if ((rc = rdd_tcp_connect(server, port, &sock)) != RDD_OK) {
+			fatal_rdd_error(rc, "cannot connect to %s:%u", server, port);
+		}
+		if ((rc = rdd_open_fd_writer(&streams[i], sock)) != RDD_OK) {
+			fatal_rdd_error(rc, "cannot open writer on socket");
+		}
+		rc = rdd_send_join(streams[i], session, i, flags & RDD_NET_V2);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot join stream %u to %s:%u",
+					i, server, port);
+		}
+		if ((flags & RDD_NET_V2) == 0) {
+			continue;
+		}
+
+		/* The server has already accepted version 2.
+		 */
+		if ((window = await_hello(sock, -1)) == 0) {
+			fatal_rdd_error(RDD_ECONNECT, "no answer for stream %u",
+					i);
+		}
+		rc = rdd_open_frame_writer(&streams[i], streams[i], sock,
+				RDD_NET_MAX_FRAME, window,
+				rdd_net_join_crc(session, i, RDD_NET_V2));
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot open frame writer");
+		}
+	}
+
+	rc = rdd_open_stripe_writer(&writer, streams, opts.streams,
+				RDD_NET_FRAME_SIZE);
+	if (rc != RDD_OK) {
+		fatal_rdd_error(rc, "cannot open stripe writer");
+	}
+	return writer;
+}
+
+/* Statistics of the adaptive compressor (--entropy-bypass).
+ */
+static RDD_CODEC_STATS the_codec_stats;
+
+/* Stacks a compressing writer on top of parent.
+ */
+static int
+open_compressor(RDD_WRITER **writer, RDD_WRITER *parent)
+{
+	if (opts.bypass_entropy > 0.0) {
+		return rdd_open_adaptive_codec_writer(writer, parent,
+				opts.codec, (int) opts.level,
+				opts.compress_threads > 0 ?
+					opts.compress_threads : 1,
+				RDD_PARALLEL_CHUNK, opts.bypass_entropy,
+				&the_codec_stats);
+	}
+	if (opts.compress_threads > 0) {
+		return rdd_open_parallel_codec_writer(writer, parent,
+				opts.codec, (int) opts.level,
+				opts.compress_threads, RDD_PARALLEL_CHUNK);
+	}
+	return rdd_open_codec_writer(writer, parent, opts.codec,
+			(int) opts.level);
+}
+
+/* Returns true iff a version-1 server can decompress our data.  Such
+ * a server ignores the codec bits and the adaptive flag and inflates
+ * all compressed data as zlib (see netio.h).
+ */
+static int
+v1_compatible(void)
+{
+	return !opts.compress
+	||  (opts.codec == RDD_CODEC_ZLIB && opts.bypass_entropy <= 0.0);
+}
+
 static RDD_WRITER *
 open_net_output(rdd_count_t outputsize)
 {
 	RDD_WRITER *writer = 0;
+	rdd_count_t session = 0;
+	rdd_count_t window = 0;
 	unsigned flags = 0;
+	int sock = -1;
 	int rc;
 	char *server = opts.server_host;
 	unsigned port = opts.server_port;
 
 	assert(opts.outpath != 0);
 
-	rc = rdd_open_tcp_writer(&writer, server, port);
-	if (rc != RDD_OK) {
+	if (opts.protocol < 2 && !v1_compatible()) {
+		error("network protocol version 1 supports only zlib "
+		      "compression without --entropy-bypass");
+	}
+
+	if ((rc = rdd_tcp_connect(server, port, &sock)) != RDD_OK) {
 		fatal_rdd_error(rc, "cannot connect to %s:%u", server, port);
 	}
+	if ((rc = rdd_open_fd_writer(&writer, sock)) != RDD_OK) {
+		fatal_rdd_error(rc, "cannot open writer on socket");
+	}
 
-	flags = (opts.compress ? RDD_NET_COMPRESS : 0);
+	flags = 0;
+	if (opts.compress) {
+		flags |= RDD_NET_COMPRESS | rdd_net_codec_flags(opts.codec);
+		if (opts.bypass_entropy > 0.0) {
+			flags |= RDD_NET_ADAPTIVE;
+		}
+	}
+	if (opts.protocol >= 2) {
+		flags |= RDD_NET_V2;
+	}
+	if (opts.streams > 1) {
+		flags |= RDD_NET_STRIPED;
+		session = new_session_id();
+	}
 	rc = rdd_send_info(writer, opts.outpath, outputsize,
-			opts.blocklen, opts.splitlen, flags);
+			opts.blocklen, opts.splitlen, flags,
+			opts.streams, session);
 	if (rc != RDD_OK) {
 		fatal_rdd_error(rc, "cannot send header to %s:%u", server, port);
 	}
 
+	if ((flags & RDD_NET_V2) != 0) {
+		window = await_hello(sock, RDD_NET_HELLO_TIMEOUT);
+		if (window == 0) {
+			if (!v1_compatible()) {
+				error("%s:%u does not answer; it may speak "
+				      "network protocol version 1 only, which "
+				      "supports only zlib compression without "
+				      "--entropy-bypass", server, port);
+			}
+			logmsg("%s:%u does not answer; falling back to "
+				"network protocol version 1", server, port);
+			flags &= ~RDD_NET_V2;
+		} else {
+			rc = rdd_open_frame_writer(&writer, writer, sock,
+					RDD_NET_MAX_FRAME, window,
+					rdd_net_info_crc(opts.outpath,
+						outputsize, opts.blocklen,
+						opts.splitlen, flags,
+						opts.streams, session));
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc, "cannot open frame writer");
+			}
+		}
+	}
+
+	if (opts.streams > 1) {
+		writer = open_streams(writer, session, flags);
+	}
+
 	if (opts.compress) {
-		/* Stack a zlib writer on top of the TCP writer.
+		/* Stack a compressing writer on top of the TCP writer.
 		 */
-		rc = rdd_open_zlib_writer(&writer, writer);
+		rc = open_compressor(&writer, writer);
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "cannot compress network traffic "
 					    "to %s:%u", server, port);
@@ -736,6 +1889,14 @@ open_net_output(rdd_count_t outputsize)
 
 	return writer;
 }
+/* Shares the server's bandwidth budget among its sessions.
+ */
+static int
+throttle_output(void *env, unsigned nbyte)
+{
+	return rdd_server_limits_throttle((RDD_SERVER_LIMITS *) env, nbyte);
+}
+
 /** Creates a writer stack that corresponds to the user's options.
  *  The outputsize argument contains the size of the output in
  *  bytes if that size is known or RDD_WHOLE_FILE if is not known.
@@ -743,11 +1904,42 @@ open_net_output(rdd_count_t outputsize)
 static RDD_WRITER *
 open_output(rdd_count_t outputsize)
 {
+	RDD_WRITER *writer;
+	RDD_WRITER *async = 0;
+	int rc;
+
 	if (opts.mode == RDD_CLIENT) {
 		return open_net_output(outputsize);
-	} else {
-		return open_disk_output(outputsize);
 	}
+
+	writer = open_disk_output(outputsize);
+	if (writer != 0 && opts.compress) {
+		/* Compress the image.  With write-behind buffers or
+		 * compression threads, the compression does not slow
+		 * down the copier's thread.
+		 */
+		rc = open_compressor(&writer, writer);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot compress output");
+		}
+	}
+	if (writer != 0 && the_limits != 0 && opts.max_bandwidth > 0) {
+		rc = rdd_open_throttle_writer(&writer, writer,
+				throttle_output, the_limits);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot create throttle writer");
+		}
+	}
+	if (writer == 0 || opts.write_behind == 0) {
+		return writer;
+	}
+
+	rc = rdd_open_async_writer(&async, writer, opts.write_behind,
+				(unsigned) opts.blocklen);
+	if (rc != RDD_OK) {
+		fatal_rdd_error(rc, "cannot create write-behind writer");
+	}
+	return async;
 }
 
 static void
@@ -871,27 +2063,63 @@ log_params(rdd_copy_opts *opts)
 	logmsg("log file: %s",                str2str(opts->logfile));
 	logmsg("output file: %s",             str2str(opts->outpath));
 	logmsg("CRC32 file: %s",              str2str(opts->crc32file));
+	logmsg("CRC32C file: %s",             str2str(opts->crc32cfile));
 	logmsg("Adler32 file: %s",            str2str(opts->adler32file));
 	logmsg("Statistics file: %s",         str2str(opts->histfile));
 	logmsg("Block MD5 file: %s",          str2str(opts->blockmd5file));
+	logmsg("Block digest file: %s",       str2str(opts->digestfile));
 	logmsg("raw-device input: %s",        bool2str(opts->raw));
-	logmsg("compress network data: %s",   bool2str(opts->compress));
+	logmsg("compress output: %s",         bool2str(opts->compress));
+	logmsg("compression codec: %s",       rdd_codec_name(opts->codec));
+	logmsg("compression level: %u",       opts->level);
+	logmsg("compression threads: %u",     opts->compress_threads);
+	logmsg("entropy bypass: %.2f",        opts->bypass_entropy);
+	logmsg("network streams: %u",         opts->streams);
+	logmsg("network protocol: %u",        opts->protocol);
 	logmsg("use (x)inetd: %s",            bool2str(opts->inetd));
+	logmsg("max #sessions: %u",           opts->max_sessions);
+	logmsg("session directory: %s",       str2str(opts->session_dir));
+	logmsg("session memory limit: %llu",  opts->max_memory);
+	logmsg("session bandwidth limit: %llu", opts->max_bandwidth);
 	logmsg("force overwrite: %s",         bool2str(opts->force_overwrite));
+	logmsg("sparse output: %s",           bool2str(opts->sparse));
+	logmsg("direct output: %s",           bool2str(opts->direct));
 	logmsg("compute MD5: %s",             bool2str(opts->md5));
 	logmsg("compute SHA1: %s",            bool2str(opts->sha1));
 	logmsg("max #retries: %u",            opts->nretry);
 	logmsg("block size: %llu",            opts->blocklen);
 	logmsg("minimum block size: %llu",    opts->minblocklen);
+	logmsg("adaptive block size: %s",     bool2str(opts->adaptive));
 	logmsg("Adler32 block size: %llu",    opts->adler32len);
 	logmsg("CRC32 block size: %llu",      opts->crc32len);
+	logmsg("CRC32C block size: %llu",     opts->crc32clen);
+	logmsg("checksum code: Adler32 %s, CRC32 %s, CRC32C %s",
+		rdd_checksum_impl(RDD_ADLER32), rdd_checksum_impl(RDD_CRC32),
+		rdd_checksum_impl(RDD_CRC32C));
 	logmsg("statistics block size: %llu", opts->histblocklen);
 	logmsg("MD5 block size: %llu",        opts->blockmd5len);
+	logmsg("MD5 block file format: %s",
+		blockmd5_formats[opts->blockmd5fmt]);
+	logmsg("block digest: %s",            rdd_cksum2_name(opts->digesttype));
+	logmsg("block digest block size: %llu", opts->digestlen);
+	logmsg("checksum file format: %u",    opts->checksum_version);
+	logmsg("checksum file index: %s",     bool2str(opts->checksum_index));
 	logmsg("input offset: %llu",          opts->offset);
 	logmsg("input count: %llu",           opts->count);
 	logmsg("segment size: %llu",          opts->splitlen);
 	logmsg("progress reporting interval: %llu", opts->progresslen);
 	logmsg("max #errors to tolerate: %llu",     opts->max_read_err);
+	logmsg("pipeline buffers: %u",        opts->pipeline);
+	logmsg("write-behind buffers: %u",    opts->write_behind);
+	logmsg("filter threads: %u",          opts->filter_threads);
+	logmsg("filter chunk size: %llu",     opts->filter_chunk);
+	logmsg("block filter threads: %u",    opts->block_threads);
+	logmsg("input queue depth: %u",       opts->queue_depth);
+	logmsg("input stripes: %u",           opts->stripes);
+	logmsg("rescue map: %s",              str2str(opts->rescuemap));
+	logmsg("checkpoint file: %s",         str2str(opts->checkpoint));
+	logmsg("checkpoint interval: %u",     opts->checkpoint_interval);
+	logmsg("resume from: %s",             str2str(opts->resume));
 	logmsg("========================================");
 	logmsg("");
 }
@@ -910,6 +2138,14 @@ handle_substitution(rdd_count_t offset, unsigned nbyte, void *env)
 		offset, nbyte);
 }
 
+static void
+handle_blocklen(rdd_count_t offset, unsigned oldlen, unsigned newlen,
+		double bytes_per_sec, void *env)
+{
+	logmsg("block size %u -> %u bytes: offset %llu bytes, %.2f MB/s",
+		oldlen, newlen, offset, bytes_per_sec / (1024.0 * 1024.0));
+}
+
 static int
 handle_progress(rdd_count_t pos, void *env)
 {
@@ -969,6 +2205,137 @@ handle_progress(rdd_count_t pos, void *env)
 	return RDD_OK;
 }
 
+/* Checkpoint state.  The copier calls handle_checkpoint() after
+ * every block; it saves a checkpoint every checkpoint_interval seconds.
+ */
+typedef struct _rdd_checkpoint_state {
+	RDD_CHECKPOINT *cp;
+	RDD_PROGRESS   *progress;	/* 0 if progress is not reported */
+	RDD_COPIER     *copier;
+	RDD_FILTERSET  *fset;
+	double          saved;		/* time of the last save */
+} rdd_checkpoint_state;
+
+static rdd_checkpoint_state the_checkpoint;
+
+#define NUM_CHECKPOINT_OPTS  16
+
+/* Collects the options that must not change when a copy is resumed.
+ */
+static void
+get_checkpoint_opts(rdd_count_t *vals)
+{
+	vals[0] = opts.offset;
+	vals[1] = opts.count;
+	vals[2] = opts.blocklen;
+	vals[3] = opts.minblocklen;
+	vals[4] = opts.splitlen;
+	vals[5] = opts.adler32len;
+	vals[6] = opts.crc32len;
+	vals[7] = opts.histblocklen;
+	vals[8] = opts.blockmd5len;
+	vals[9] = opts.md5;
+	vals[10] = opts.sha1;
+	vals[11] = opts.crc32clen;
+	vals[12] = opts.blockmd5fmt;
+	vals[13] = opts.checksum_version;
+	vals[14] = opts.digesttype;
+	vals[15] = opts.digestlen;
+}
+
+static int
+save_checkpoint_opts(RDD_CHECKPOINT *cp)
+{
+	rdd_count_t vals[NUM_CHECKPOINT_OPTS];
+	const char *outpath = str2str(opts.outpath);
+	int rc;
+
+	get_checkpoint_opts(vals);
+
+	rc = rdd_ckpt_put(cp, "options", "infile",
+			opts.infile, strlen(opts.infile) + 1);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put(cp, "options", "outfile",
+			outpath, strlen(outpath) + 1);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	return rdd_ckpt_put(cp, "options", "sizes", vals, sizeof vals);
+}
+
+static int
+same_string(RDD_CHECKPOINT *cp, const char *key, const char *str)
+{
+	char buf[4096];
+	unsigned len = strlen(str) + 1;
+
+	if (len > sizeof buf) {
+		return 0;
+	}
+	if (rdd_ckpt_get(cp, "options", key, buf, len) != RDD_OK) {
+		return 0;
+	}
+	return strcmp(buf, str) == 0;
+}
+
+/* Verifies that the checkpoint was made by a copy with the
+ * current options.
+ */
+static void
+check_checkpoint_opts(RDD_CHECKPOINT *cp)
+{
+	rdd_count_t vals[NUM_CHECKPOINT_OPTS];
+	rdd_count_t saved[NUM_CHECKPOINT_OPTS];
+
+	get_checkpoint_opts(vals);
+
+	if (!same_string(cp, "infile", opts.infile)
+	||  !same_string(cp, "outfile", str2str(opts.outpath))
+	||  rdd_ckpt_get(cp, "options", "sizes", saved, sizeof saved) != RDD_OK
+	||  memcmp(vals, saved, sizeof vals) != 0) {
+		error("checkpoint %s was saved by a copy with other files "
+		      "or options", opts.resume);
+	}
+}
+
+static void
+save_checkpoint(rdd_checkpoint_state *ck)
+{
+	int rc;
+
+	if ((rc = rdd_copy_save(ck->copier, ck->cp, "copier")) != RDD_OK
+	||  (rc = rdd_fset_save(ck->fset, ck->cp)) != RDD_OK
+	||  (rc = save_checkpoint_opts(ck->cp)) != RDD_OK
+	||  (rc = rdd_ckpt_save(ck->cp, opts.checkpoint)) != RDD_OK) {
+		/* Not fatal: the copy itself is still fine.
+		 */
+		rdd_mp_rddmsg(the_printer, RDD_MSG_WARN, rc,
+			"cannot save checkpoint %s", opts.checkpoint);
+	}
+	ck->saved = rdd_gettime();
+}
+
+static int
+handle_checkpoint(rdd_count_t pos, void *env)
+{
+	rdd_checkpoint_state *ck = (rdd_checkpoint_state *) env;
+	int rc;
+
+	if (ck->progress != 0) {
+		if ((rc = handle_progress(pos, ck->progress)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	if (rdd_gettime() - ck->saved >= (double) opts.checkpoint_interval) {
+		save_checkpoint(ck);
+	}
+
+	return RDD_OK;
+}
+
 static void
 add_filter(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f)
 {
@@ -979,15 +2346,66 @@ add_filter(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f)
 	}
 }
 
+/* Installs a block filter, which computes its blocks on
+ * opts.block_threads threads if that option was given.
+ */
+static void
+add_block_filter(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f)
+{
+	int rc;
+
+	if (opts.block_threads > 0) {
+		rc = rdd_filter_set_parallel(f, opts.block_threads);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot start %s filter threads",
+					name);
+		}
+	}
+	add_filter(fset, name, f);
+}
+
+/* Creates a checksum filter that writes a checksum file in the
+ * format selected with --checksum-format.
+ */
+static int
+new_checksum_filter(RDD_FILTER **f, rdd_checksum_algorithm_t alg,
+		rdd_count_t blocklen, const char *path, int overwrite)
+{
+	if (opts.checksum_version == 2) {
+		return rdd_new_checksum2_blockfilter(f, alg, blocklen,
+				opts.offset, path, overwrite,
+				opts.checksum_index);
+	}
+
+	switch (alg) {
+	case RDD_ADLER32:
+		return rdd_new_adler32_blockfilter(f, blocklen, path, overwrite);
+	case RDD_CRC32:
+		return rdd_new_crc32_blockfilter(f, blocklen, path, overwrite);
+	default:
+		return rdd_new_crc32c_blockfilter(f, blocklen, path, overwrite);
+	}
+}
+
 static void
 install_filters(RDD_FILTERSET *fset, RDD_WRITER *writer)
 {
 	RDD_FILTER *f = 0;
+	int overwrite;
 	int rc;
 
+	/* When resuming, the output files of the block filters are
+	 * continued; rdd_fset_restore() truncates them.
+	 */
+	overwrite = (opts.resume != 0 ? RDD_APPEND : opts.force_overwrite);
+
 	if ((rc = rdd_fset_init(fset)) != RDD_OK) {
 		fatal_rdd_error(rc, "cannot create filter fset");
 	}
+	if ((rc = rdd_fset_set_chunk(fset, (unsigned) opts.filter_chunk))
+	!= RDD_OK) {
+		fatal_rdd_error(rc, "cannot set filter chunk size");
+	}
 
 	if (writer != 0) {
 		rc = rdd_new_write_streamfilter(&f, writer);
@@ -1014,43 +2432,79 @@ install_filters(RDD_FILTERSET *fset, RDD_WRITER *writer)
 	}
 
 	if (opts.blockmd5file != 0) {
-		rc = rdd_new_md5_blockfilter(&f, opts.blockmd5len,
+		if (opts.blockmd5fmt == BLOCKMD5_TEXT) {
+			rc = rdd_new_md5_blockfilter(&f, opts.blockmd5len,
 						opts.blockmd5file,
-						opts.force_overwrite);
+						overwrite);
+		} else {
+			rc = rdd_new_binary_md5_blockfilter(&f,
+					opts.blockmd5len, opts.offset,
+					opts.blockmd5file, overwrite,
+					opts.blockmd5fmt == BLOCKMD5_INDEXED);
+		}
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "cannot create MD5 block filter");
 		}
-		add_filter(fset, "MD5 block", f);
+		add_block_filter(fset, "MD5 block", f);
 	}
 
 	if (opts.histfile != 0) {
 		rc = rdd_new_stats_blockfilter(&f,
 				opts.histblocklen, opts.histfile,
-				opts.force_overwrite);
+				overwrite);
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "cannot create statistics filter");
 		}
-		add_filter(fset, "statistical block", f);
+		add_block_filter(fset, "statistical block", f);
 	}
 
 	if (opts.adler32file != 0) {
-		rc = rdd_new_adler32_blockfilter(&f,
+		rc = new_checksum_filter(&f, RDD_ADLER32,
 				opts.adler32len, opts.adler32file,
-				opts.force_overwrite);
+				overwrite);
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "cannot create Adler32 filter");
 		}
-		add_filter(fset, "Adler32 block", f);
+		add_block_filter(fset, "Adler32 block", f);
 	}
 
 	if (opts.crc32file != 0) {
-		rc = rdd_new_crc32_blockfilter(&f,
+		rc = new_checksum_filter(&f, RDD_CRC32,
 				opts.crc32len, opts.crc32file,
-				opts.force_overwrite);
+				overwrite);
 		if (rc != RDD_OK) {
 			fatal_rdd_error(rc, "cannot create CRC-32 filter");
 		}
-		add_filter(fset, "CRC-32 block", f);
+		add_block_filter(fset, "CRC-32 block", f);
+	}
+
+	if (opts.crc32cfile != 0) {
+		rc = new_checksum_filter(&f, RDD_CRC32C,
+				opts.crc32clen, opts.crc32cfile,
+				overwrite);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot create CRC-32C filter");
+		}
+		add_block_filter(fset, "CRC-32C block", f);
+	}
+
+	if (opts.digestfile != 0) {
+		rc = rdd_new_checksum2_blockfilter(&f, opts.digesttype,
+				opts.digestlen, opts.offset, opts.digestfile,
+				overwrite, opts.checksum_index);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot create %s block filter",
+				rdd_cksum2_name(opts.digesttype));
+		}
+		add_block_filter(fset, "digest block", f);
+	}
+
+	if (opts.filter_threads > 0) {
+		rc = rdd_fset_set_parallel(fset, opts.filter_threads,
+						FILTER_NBUF);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot start filter threads");
+		}
 	}
 }
 
@@ -1111,21 +2565,84 @@ create_copier(rdd_count_t input_size, RDD_PROGRESS *progress)
 		p.maxsubst = opts.max_read_err;
 		p.readerrfun = handle_read_error;
 		p.substfun = handle_substitution;
-		if (progress != 0) {
+		p.adaptive = opts.adaptive;
+		p.blocklenfun = handle_blocklen;
+		if (opts.checkpoint != 0) {
+			the_checkpoint.progress = progress;
+			p.progressfun = handle_checkpoint;
+			p.progressenv = &the_checkpoint;
+		} else if (progress != 0) {
 			p.progressfun = handle_progress;
 			p.progressenv = progress;
 		}
 
-		rc = rdd_new_robust_copier(&copier,
-				opts.offset, count, &p);
-		if (rc != RDD_OK) {
-			fatal_rdd_error(rc, "cannot create robust copier");
+		if (opts.rescuemap != 0) {
+			if (count == RDD_WHOLE_FILE) {
+				error("--rescue-map requires a known input size");
+			}
+			rc = rdd_new_rescue_copier(&copier,
+					opts.offset, count,
+					opts.outpath, opts.rescuemap, &p);
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc,
+					"cannot create rescue copier");
+			}
+		} else if (opts.stripes > 1) {
+			if (count == RDD_WHOLE_FILE) {
+				error("--stripes requires a known input size");
+			}
+			rc = rdd_new_striped_copier(&copier,
+					opts.offset, count, opts.stripes,
+					(unsigned) opts.blocklen,
+					opts.pipeline > 0 ? opts.pipeline : 4,
+					open_stripe_input, 0, &p);
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc,
+					"cannot create striped copier");
+			}
+		} else if (opts.pipeline > 0) {
+			rc = rdd_new_pipelined_copier(&copier,
+					opts.offset, count, opts.pipeline, &p);
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc,
+					"cannot create pipelined copier");
+			}
+		} else {
+			rc = rdd_new_robust_copier(&copier,
+					opts.offset, count, &p);
+			if (rc != RDD_OK) {
+				fatal_rdd_error(rc,
+					"cannot create robust copier");
+			}
 		}
 	}
 
 	return copier;
 }
 
+/* Reports what the entropy bypass of the adaptive compressor did.
+ */
+static void
+log_codec_stats(RDD_CODEC_STATS *st)
+{
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"compressor input: %llu bytes, output: %llu bytes",
+			st->nbyte_in, st->nbyte_out);
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"bytes compressed: %llu", st->nbyte_compressed);
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"bytes bypassed (entropy >= %.2f): %llu",
+			opts.bypass_entropy, st->nbyte_bypassed);
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"bytes stored as incompressible: %llu",
+			st->nbyte_incompressible);
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"bytes sent as zero runs: %llu", st->nbyte_zero);
+	rdd_mp_message(the_printer, RDD_MSG_INFO,
+			"compression seconds: %.3f, saved by bypass: %.3f "
+			"(estimate)", st->compress_time, st->saved_time);
+}
+
 static void
 log_hash_result(RDD_FILTERSET *fset, const char *hash_name,
 		const char *filter_name, unsigned mdsize)
@@ -1173,6 +2690,8 @@ main(int argc, char **argv)
 	int rc;
 
 	set_progname(argv[0]);
+	the_argv = argv;
+	the_argc = argc;
 	rdd_cons_open();
 	rdd_init();
 
@@ -1209,8 +2728,23 @@ main(int argc, char **argv)
 		rdd_quit_if(RDD_NO, "Continue without logging (yes/no)?");
 	}
 
+	if (opts.resume != 0) {
+		rc = rdd_ckpt_load(&the_checkpoint.cp, opts.resume);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot read checkpoint %s",
+					opts.resume);
+		}
+		check_checkpoint_opts(the_checkpoint.cp);
+	} else if (opts.checkpoint != 0) {
+		if ((rc = rdd_new_checkpoint(&the_checkpoint.cp)) != RDD_OK) {
+			fatal_rdd_error(rc, "cannot create checkpoint");
+		}
+	}
+
 	reader = open_input(&input_size);
-	writer = open_output(RDD_WHOLE_FILE);
+	/* In rescue mode, the copier writes the output file itself.
+	 */
+	writer = opts.rescuemap != 0 ? 0 : open_output(RDD_WHOLE_FILE);
 	install_filters(&filterset, writer);
 
 	if (opts.progresslen > 0) {
@@ -1223,6 +2757,25 @@ main(int argc, char **argv)
 		copier = create_copier(input_size, 0);
 	}
 
+	if (opts.resume != 0) {
+		rc = rdd_copy_restore(copier, the_checkpoint.cp, "copier");
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot restore copier from %s",
+					opts.resume);
+		}
+		rc = rdd_fset_restore(&filterset, the_checkpoint.cp);
+		if (rc != RDD_OK) {
+			fatal_rdd_error(rc, "cannot restore filters from %s",
+					opts.resume);
+		}
+		logmsg("resuming from checkpoint %s", opts.resume);
+	}
+	if (opts.checkpoint != 0) {
+		the_checkpoint.copier = copier;
+		the_checkpoint.fset = &filterset;
+		the_checkpoint.saved = rdd_gettime();
+	}
+
 	start = rdd_gettime();
 	rc = rdd_copy_exec(copier, reader, &filterset, &copier_ret);
 	if (rc != RDD_OK) {
@@ -1236,6 +2789,27 @@ main(int argc, char **argv)
 						  copier_ret.nbyte);
 	rdd_mp_message(the_printer, RDD_MSG_INFO, "bytes lost: %llu", 
 						  copier_ret.nlost);
+	if (opts.sparse && writer != 0) {
+		rdd_count_t nhole;
+
+		if ((rc = rdd_writer_holes(writer, &nhole)) != RDD_OK) {
+			fatal_rdd_error(rc, "cannot count holes in output");
+		}
+		rdd_mp_message(the_printer, RDD_MSG_INFO,
+				"bytes left as holes: %llu", nhole);
+	}
+	if (opts.write_behind > 0 && writer != 0) {
+		RDD_ASYNC_STATS wstats;
+
+		if ((rc = rdd_async_writer_stats(writer, &wstats)) != RDD_OK) {
+			fatal_rdd_error(rc, "cannot get write-behind statistics");
+		}
+		rdd_mp_message(the_printer, RDD_MSG_INFO,
+				"write-behind queue: max depth %u of %u buffers",
+				wstats.maxdepth, wstats.nbuf);
+		rdd_mp_message(the_printer, RDD_MSG_INFO,
+				"write-behind stall: %.3f seconds", wstats.stall);
+	}
 	rdd_mp_message(the_printer, RDD_MSG_INFO, "read errors: %lu", 
 						  copier_ret.nread_err);
 	rdd_mp_message(the_printer, RDD_MSG_INFO, "zero-block substitutions: "
@@ -1264,10 +2838,23 @@ main(int argc, char **argv)
 			fatal_rdd_error(rc, "cannot clean up writer");
 		}
 	}
+	if (opts.bypass_entropy > 0.0 && writer != 0) {
+		log_codec_stats(&the_codec_stats);
+	}
 
 	if ((rc = rdd_reader_close(reader, 1)) != RDD_OK) {
 		fatal_rdd_error(rc, "cannot clean up reader");
 	}
+	nfeedback = 0;	/* the clients have been told that we are done */
+
+	/* The copy is complete, so the checkpoint is obsolete.
+	 */
+	if (opts.checkpoint != 0) {
+		rdd_free_checkpoint(the_checkpoint.cp);
+		if (unlink(opts.checkpoint) < 0 && errno != ENOENT) {
+			logmsg("cannot remove checkpoint %s", opts.checkpoint);
+		}
+	}
 
 	close_printer();
 
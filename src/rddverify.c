@@ -42,6 +42,7 @@ static char copyright[] =
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -50,6 +51,8 @@ static char copyright[] =
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #if defined(HAVE_LIBCRYPTO) && defined(HAVE_OPENSSL_MD5_H) && defined(HAVE_OPENSSL_SHA_H)
 #include <openssl/md5.h>
@@ -82,6 +85,9 @@ static char copyright[] =
 #include "rdd_internals.h"
 #include "error.h"
 #include "commandline.h"
+#include "numparser.h"
+#include "blockhash.h"
+#include "checksumfile.h"
 
 /* Types of verication checks to perform.
  */
@@ -89,15 +95,32 @@ static char copyright[] =
 #define VFY_SHA1     0x2
 #define VFY_ADLER32  0x4
 #define VFY_CRC32    0x8
+#define VFY_CRC32C   0x10
+#define VFY_BLOCKMD5 0x20
+#define VFY_BLOCKDIGEST 0x40
+#define VFY_MANIFEST 0x80
 
 #define READ_SIZE	262144	/* bytes */
+#define DEFAULT_READ_AHEAD 3	/* buffers */
+#define MANIFEST_LINE_SIZE (2*RDD_CKSUM2_MAX_RECORD + PATH_MAX + 16)
+#define SAMPLE_CONFIDENCE 0.95
 #define bool2str(b)   ((b) ? "yes" : "no")
 
 static struct verifier_opts {
 	char       **files;		/* input files */
 	unsigned     nfile;		/* #input files */
 	char        *crc32file;		/* output file for CRC32 checksums */
+	char        *crc32cfile;	/* output file for CRC32C checksums */
 	char        *adler32file;	/* output file for Adler32 checksums */
+	char        *blockmd5file;	/* block-hash file with MD5 values */
+	char        *digestfile;	/* version-2 checksum file */
+	char        *manifest;		/* list of images and hash values */
+	unsigned     nbuf;		/* #read-ahead buffers (0: no threads) */
+	unsigned     njob;		/* #images verified concurrently */
+	int          sample;		/* verify a sample of the blocks? */
+	rdd_count_t  nsample;		/* #blocks to sample (0: use fraction) */
+	double       sample_fraction;	/* fraction of blocks to sample */
+	unsigned long seed;		/* seed for block sampling */
 	int          verbose;		/* Be verbose? */
 	int          md5;		/* MD5-hash all data? */
 	int          sha1;		/* SHA1-hash all data? */
@@ -108,6 +131,39 @@ static struct verifier_opts {
 
 typedef rdd_checksum_t (*checksum_fun)(rdd_checksum_t, const unsigned char *, size_t);
 
+/* A checksum file named on the command line.  Version-1 files are
+ * written in the byte order of the machine that wrote them; version-2
+ * files are always little-endian.
+ */
+typedef struct _CHECKSUM_FILE {
+	char                     *path;
+	FILE                     *fp;
+	int                       version;	/* 1 or 2 */
+	int                       swap;		/* version 1: swap bytes? */
+	RDD_CHECKSUM_FILE_HEADER  hdr;		/* version-1 header */
+	RDD_CHECKSUM2_HEADER      hdr2;		/* version-2 header */
+} CHECKSUM_FILE;
+
+/* An image listed in a manifest file.
+ */
+typedef struct _IMAGE_JOB {
+	char          *path;
+	unsigned       type;	/* RDD_CKSUM2_MD5, _SHA1, or _SHA256 */
+	unsigned char  expected[RDD_CKSUM2_MAX_RECORD];
+	unsigned char  computed[RDD_CKSUM2_MAX_RECORD];
+	int            rc;	/* RDD_OK if computed is valid */
+} IMAGE_JOB;
+
+/* The images of a manifest file.  Worker threads take the next
+ * image from the queue until all images have been taken.
+ */
+typedef struct _JOB_QUEUE {
+	pthread_mutex_t  lock;
+	IMAGE_JOB       *jobs;
+	unsigned         njob;
+	unsigned         next;	/* index of next image to verify */
+} JOB_QUEUE;
+
 static char *usage_message = "rdd-verify [local options] file1 ... \n";
 
 static RDD_OPTION opttab[] = {
@@ -121,15 +177,79 @@ static RDD_OPTION opttab[] = {
 	 "verify Adler32 checksums in <file> against input files", 0, 0},
 	{"--crc", "--crc32", "<file>", 0,
 	 "verify CRC32 checksums in <file> against input files", 0, 0},
+	{"--crc32c", "--crc32c", "<file>", 0,
+	 "verify CRC32C checksums in <file> against input files", 0, 0},
+	{"--block-md5", "--block-md5", "<file>", 0,
+	 "verify block-wise MD5 values in binary <file> against input files",
+	 0, 0},
+	{"--block-digest", "--block-digest", "<file>", 0,
+	 "verify the records in version-2 checksum <file> against input files",
+	 0, 0},
 	{"--md5", "--md5", "<md5 digest>", 0,
 	 	"verify MD5 hash", 0, 0},
 	{"--sha", "--sha1", "<sha-1 digest>", 0,
 	 	"verify SHA1 hash", 0, 0},
+	{"--read-ahead", "--read-ahead", "<count>", 0,
+	 "run each check on its own thread with <count> read buffers "
+	 "(0: single thread)", 0, 0},
+	{"--manifest", "--manifest", "<file>", 0,
+	 "verify the images and hash values listed in <file>", 0, 0},
+	{"--jobs", "--jobs", "<count>", 0,
+	 "verify up to <count> manifest images concurrently", 0, 0},
+	{"--sample", "--sample", "<fraction|count>", 0,
+	 "verify a random sample of the blocks in a checksum file", 0, 0},
+	{"--seed", "--seed", "<n>", 0,
+	 "seed that selects the --sample blocks", 0, 0},
 	{0, 0, 0, 0, 0, 0, 0} /* sentinel */
 };
 
 static RDD_MSGPRINTER *the_printer;
 
+/* Serializes the error reports of filters that run on worker threads.
+ */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned
+scan_uint(char *str)
+{
+	unsigned n;
+	int rc;
+
+	if ((rc = rdd_parse_uint((const char *) str, &n)) != RDD_OK) {
+		rdd_error(rc, "%s", str);
+	}
+	return n;
+}
+
+/* Parses the argument of --sample: a block count, or a fraction
+ * of the blocks if it contains a decimal point or ends in '%'.
+ */
+static void
+scan_sample(char *arg)
+{
+	char *end;
+	int rc;
+
+	if (strchr(arg, '.') == 0 && strchr(arg, '%') == 0) {
+		rc = rdd_parse_bignum((const char *) arg, RDD_POSITIVE,
+					&opts.nsample);
+		if (rc != RDD_OK) {
+			rdd_error(rc, "bad sample size %s", arg);
+		}
+		return;
+	}
+
+	opts.sample_fraction = strtod(arg, &end);
+	if (*end == '%') {
+		opts.sample_fraction /= 100.0;
+		end++;
+	}
+	if (end == arg || *end != '\0'
+	||  !(opts.sample_fraction > 0.0 && opts.sample_fraction <= 1.0)) {
+		error("bad sample fraction %s", arg);
+	}
+}
+
 static void
 process_options(void)
 {
@@ -159,8 +279,64 @@ process_options(void)
 	if (rdd_opt_set_arg("crc32", &arg)) {
 		opts.crc32file = arg;
 	}
+	if (rdd_opt_set_arg("crc32c", &arg)) {
+		opts.crc32cfile = arg;
+	}
+	if (rdd_opt_set_arg("block-md5", &arg)) {
+		opts.blockmd5file = arg;
+	}
+	if (rdd_opt_set_arg("block-digest", &arg)) {
+		opts.digestfile = arg;
+	}
+	opts.nbuf = DEFAULT_READ_AHEAD;
+	if (rdd_opt_set_arg("read-ahead", &arg)) {
+		opts.nbuf = scan_uint(arg);
+		if (opts.nbuf == 1) {
+			error("read-ahead needs 0 or at least 2 buffers");
+		}
+	}
+	opts.njob = 1;
+	if (rdd_opt_set_arg("jobs", &arg)) {
+		opts.njob = scan_uint(arg);
+		if (opts.njob == 0) {
+			error("bad number of jobs %s", arg);
+		}
+	}
+	if (rdd_opt_set_arg("sample", &arg)) {
+		opts.sample = 1;
+		scan_sample(arg);
+		if (opts.md5 || opts.sha1 || opts.blockmd5file != NULL
+		||  (opts.adler32file != NULL) + (opts.crc32file != NULL)
+		  + (opts.crc32cfile != NULL) + (opts.digestfile != NULL) != 1) {
+			error("--sample verifies a single checksum file "
+			      "(use --adler32, --crc32, --crc32c, or "
+			      "--block-digest)");
+		}
+	}
+	opts.seed = (unsigned long) time(0);
+	if (rdd_opt_set_arg("seed", &arg)) {
+		opts.seed = scan_uint(arg);
+		if (!opts.sample) {
+			error("--seed requires --sample");
+		}
+	}
+	if (rdd_opt_set_arg("manifest", &arg)) {
+		opts.manifest = arg;
+		if (opts.md5 || opts.sha1
+		||  opts.adler32file != NULL || opts.crc32file != NULL
+		||  opts.crc32cfile != NULL || opts.blockmd5file != NULL
+		||  opts.digestfile != NULL) {
+			error("--manifest cannot be combined with other checks");
+		}
+		return;
+	}
+	if (opts.njob > 1) {
+		error("--jobs requires a manifest file (use --manifest)");
+	}
 	if ((!opts.md5) && (!opts.sha1)
-	&&  (opts.adler32file == NULL) && (opts.crc32file == NULL)) {
+	&&  (opts.adler32file == NULL) && (opts.crc32file == NULL)
+	&&  (opts.crc32cfile == NULL) && (opts.blockmd5file == NULL)
+	&&  (opts.digestfile == NULL)) {
 		error("Nothing to do. No options given");
 	}
 }
@@ -181,7 +357,11 @@ command_line(int argc, char **argv)
 
 	process_options();
 
-	if (argc - i < 1) {
+	if (opts.manifest != NULL) {
+		if (argc - i > 0) {
+			error("the input files are listed in the manifest file");
+		}
+	} else if (argc - i < 1) {
 		rdd_opt_usage();
 	}
 
@@ -221,16 +401,31 @@ swap64(u_int64_t n)
 	return (lo_swapped << 32) | hi_swapped;
 }
 
+/* Opens an image file.  Regular files are memory-mapped, so that
+ * verify_file() can push the image data into the filters without
+ * copying it.  Other files (devices, pipes) are read in the usual way.
+ */
 static RDD_READER *
-open_image_file(const char *path)
+open_image_file(const char *path, int *mapped)
 {
 	RDD_READER *reader = 0;
+	int fd;
 	int rc;
-       
-	if ((rc = rdd_open_file_reader(&reader, path, 0)) != RDD_OK) {
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		rdd_error(RDD_EOPEN, "cannot open %s", path);
+	}
+
+	if (rdd_open_mmap_reader(&reader, fd) == RDD_OK) {
+		*mapped = 1;
+		return reader;
+	}
+
+	*mapped = 0;
+	if ((rc = rdd_open_fd_reader(&reader, fd)) != RDD_OK) {
 		rdd_error(rc, "cannot open %s", path);
 	}
-	
+
 	return reader;
 }
 
@@ -285,36 +480,75 @@ check_header(char *path, RDD_CHECKSUM_FILE_HEADER *header, int type, int *swap)
 	}
 }
 
-static FILE *
-open_checksum_file(char *path, int type, RDD_CHECKSUM_FILE_HEADER *hdr, int *swap)
+/* Opens a checksum file of either version.  Both versions start
+ * with the magic number and the version number; version 2 stores
+ * them little-endian.  If type is 0, any version-2 file is accepted.
+ */
+static void
+open_checksum_file(char *path, unsigned type, CHECKSUM_FILE *cf)
 {
-	FILE *fp;
+	unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE];
+	unsigned char *h = (unsigned char *) &cf->hdr;
+
+	memset(cf, 0, sizeof(*cf));
+	cf->path = path;
 
-	if ((fp = fopen(path, "rb")) == NULL) {
+	if ((cf->fp = fopen(path, "rb")) == NULL) {
 		unix_error("cannot open checksum file %s", path);
 	}
 
-	if (fread(hdr, sizeof(*hdr), 1, fp) < 1) {
+	if (fread(buf, 4, 1, cf->fp) < 1) {
 		unix_error("cannot read header from %s", path);
 	}
 
-	check_header(path, hdr, type, swap);
+	if (buf[0] == (RDD_CHECKSUM_MAGIC & 0xff)
+	&&  buf[1] == (RDD_CHECKSUM_MAGIC >> 8)
+	&&  buf[2] == (RDD_CHECKSUM_VERSION2 & 0xff)
+	&&  buf[3] == (RDD_CHECKSUM_VERSION2 >> 8)) {
+		cf->version = 2;
+		if (fread(buf + 4, sizeof buf - 4, 1, cf->fp) < 1) {
+			unix_error("cannot read header from %s", path);
+		}
+		if (rdd_cksum2_decode_header(buf, &cf->hdr2) != RDD_OK) {
+			error("%s: unsupported version-2 checksum file", path);
+		}
+		if (type != 0 && cf->hdr2.type != type) {
+			error("%s: the type found in the file is wrong; "
+			      "expected %s got %s", path,
+			      rdd_cksum2_name(type),
+			      rdd_cksum2_name(cf->hdr2.type));
+		}
+		return;
+	}
 
-	return fp;
+	if (type == 0) {
+		error("%s: not a version-2 checksum file", path);
+	}
+	cf->version = 1;
+	memcpy(h, buf, 4);
+	if (fread(h + 4, sizeof(cf->hdr) - 4, 1, cf->fp) < 1) {
+		unix_error("cannot read header from %s", path);
+	}
+	check_header(path, &cf->hdr, type, &cf->swap);
 }
 
+/* A version-2 file may be followed by an index, so only version-1
+ * files are checked for unprocessed data.  A sampled file is not
+ * read to the end.
+ */
 static void
-close_checksum_file(const char *path, FILE *fp)
+close_checksum_file(CHECKSUM_FILE *cf)
 {
-	if (fp == NULL) {
+	if (cf->fp == NULL) {
 		return;
 	}
-	if (fgetc(fp) != EOF) {
-		warn("unprocessed data in %s", path);
+	if (cf->version == 1 && !opts.sample && fgetc(cf->fp) != EOF) {
+		warn("unprocessed data in %s", cf->path);
 	}
-	if (fclose(fp) == EOF) {
-		unix_error("cannot close %s", path);
+	if (fclose(cf->fp) == EOF) {
+		unix_error("cannot close %s", cf->path);
 	}
+	cf->fp = NULL;
 }
 
 static void
@@ -322,25 +556,39 @@ verify_file(RDD_FILTERSET *filters, const char *path)
 {
 	RDD_READER *reader = 0;
 	unsigned char buf[READ_SIZE];
+	unsigned char *rbuf;
+	const unsigned char *data;
 	unsigned nread;
+	int mapped;
 	int rc;
 	
-	reader = open_image_file(path);
+	reader = open_image_file(path, &mapped);
 
 	while (1) {
-		rc = rdd_reader_read(reader, buf, READ_SIZE, &nread);
+		if (mapped) {
+			rc = rdd_mmap_reader_map(reader, &data, READ_SIZE, &nread);
+		} else {
+			/* With read-ahead, read into a buffer that the
+			 * filter threads share.
+			 */
+			rc = rdd_fset_get_buffer(filters, READ_SIZE, &rbuf);
+			if (rc == RDD_NOTFOUND) {
+				rbuf = buf;
+			} else if (rc != RDD_OK) {
+				rdd_error(rc, "cannot push buffer into filter");
+			}
+			rc = rdd_reader_read(reader, rbuf, READ_SIZE, &nread);
+			data = rbuf;
+		}
 		if (rc != RDD_OK) {
 			rdd_error(rc, "%s: read error", path);
 		}
 		if (nread == 0) break;	/* EOF */
 		
-		if ((rc = rdd_fset_push(filters, buf, nread)) != RDD_OK) {
+		if ((rc = rdd_fset_push(filters, data, nread)) != RDD_OK) {
 			rdd_error(rc, "cannot push buffer into filter");
 		}
 	}
-	if ((rc = rdd_fset_close(filters)) != RDD_OK) {
-		rdd_error(rc, "cannot close filters");
-	}
 
 	close_image_file(path, reader);
 }
@@ -361,9 +609,97 @@ handle_checksum_error(rdd_count_t pos,
 {
 	char *algorithm = (char *) env;
 
+	pthread_mutex_lock(&report_lock);
 	errlognl("%s checksum error; block offset %llu; "
 		"expected 0x%08x, got 0x%08x",
 		algorithm, pos, expected, computed);
+	pthread_mutex_unlock(&report_lock);
+}
+
+static void
+handle_digest_error(rdd_count_t pos, const unsigned char *expected,
+	const unsigned char *computed, unsigned size, void *env)
+{
+	char *algorithm = (char *) env;
+	char hexexp[2*RDD_CKSUM2_MAX_RECORD + 1];
+	char hexcomp[2*RDD_CKSUM2_MAX_RECORD + 1];
+
+	if (size == sizeof(rdd_checksum_t)) {
+		/* A checksum record of a version-2 checksum file.
+		 */
+		if (computed == 0) {
+			pthread_mutex_lock(&report_lock);
+			errlognl("%s checksum error; block offset %llu; "
+				"expected 0x%08x, got no data (image too short)",
+				algorithm, pos, rdd_cksum2_get_checksum(expected));
+			pthread_mutex_unlock(&report_lock);
+			return;
+		}
+		handle_checksum_error(pos, rdd_cksum2_get_checksum(expected),
+			rdd_cksum2_get_checksum(computed), env);
+		return;
+	}
+
+	if (rdd_buf2hex(expected, size, hexexp, sizeof hexexp) != RDD_OK) {
+		strcpy(hexexp, "?");
+	}
+
+	if (computed == 0) {
+		pthread_mutex_lock(&report_lock);
+		errlognl("%s block hash error; block offset %llu; "
+			"expected %s, got no data (image too short)",
+			algorithm, pos, hexexp);
+		pthread_mutex_unlock(&report_lock);
+		return;
+	}
+
+	if (rdd_buf2hex(computed, size, hexcomp, sizeof hexcomp) != RDD_OK) {
+		strcpy(hexcomp, "?");
+	}
+	pthread_mutex_lock(&report_lock);
+	errlognl("%s block hash error; block offset %llu; "
+		"expected %s, got %s",
+		algorithm, pos, hexexp, hexcomp);
+	pthread_mutex_unlock(&report_lock);
+}
+
+/* Installs the verification filter for a checksum file of either
+ * version.  The record type of a version-1 file is given by type.
+ */
+static void
+add_checksum_filter(RDD_FILTERSET *fset, const char *name,
+		CHECKSUM_FILE *cf, unsigned type)
+{
+	RDD_FILTER *f = 0;
+	char *algorithm;
+	unsigned blocksize = cf->hdr.blocksize;
+	int rc;
+
+	if (cf->version == 2) {
+		type = cf->hdr2.type;
+	}
+	algorithm = (char *) rdd_cksum2_name(type);
+
+	if (cf->version == 2) {
+		rc = rdd_new_verify_checksum2_blockfilter(&f, cf->fp,
+				&cf->hdr2, handle_digest_error, algorithm);
+	} else if (type == RDD_ADLER32) {
+		rc = rdd_new_verify_adler32_blockfilter(&f, cf->fp,
+				blocksize, cf->swap,
+				handle_checksum_error, algorithm);
+	} else if (type == RDD_CRC32) {
+		rc = rdd_new_verify_crc32_blockfilter(&f, cf->fp,
+				blocksize, cf->swap,
+				handle_checksum_error, algorithm);
+	} else {
+		rc = rdd_new_verify_crc32c_blockfilter(&f, cf->fp,
+				blocksize, cf->swap,
+				handle_checksum_error, algorithm);
+	}
+	if (rc != RDD_OK) {
+		rdd_error(rc, "cannot create %s verification filter", algorithm);
+	}
+	add_filter(fset, name, f);
 }
 
 static void
@@ -418,8 +754,9 @@ equal_digest(char *md1, char *md2, unsigned mdlen)
 
 static int
 verify_files(char **files, unsigned nfile,
-		FILE* adler32file, rdd_count_t a32len, int a32swap,
-		FILE* crc32file, rdd_count_t crc32len, int crc32swap)
+		CHECKSUM_FILE *adler32file, CHECKSUM_FILE *crc32file,
+		CHECKSUM_FILE *crc32cfile, CHECKSUM_FILE *digestfile,
+		RDD_BLOCKHASH_FILE *blockmd5file)
 {
 	RDD_FILTERSET filters;
 	RDD_FILTER *f = 0;
@@ -449,35 +786,55 @@ verify_files(char **files, unsigned nfile,
 	}
 
 	if (adler32file != 0) {
-		rc = rdd_new_verify_adler32_blockfilter(&f, adler32file,
-							a32len, a32swap,
-							handle_checksum_error,
-							"Adler32");
-		if (rc != RDD_OK) {
-			rdd_error(rc, "cannot create Adler32 verification filter");
-		}
-		add_filter(&filters, "Adler32 verification block", f);
+		add_checksum_filter(&filters, "Adler32 verification block",
+					adler32file, RDD_ADLER32);
 	}
 
 	if (crc32file != 0) {
-		rc = rdd_new_verify_crc32_blockfilter(&f, crc32file,
-							crc32len, crc32swap,
-							handle_checksum_error,
-							"CRC-32");
+		add_checksum_filter(&filters, "CRC-32 verification block",
+					crc32file, RDD_CRC32);
+	}
+
+	if (crc32cfile != 0) {
+		add_checksum_filter(&filters, "CRC-32C verification block",
+					crc32cfile, RDD_CRC32C);
+	}
+
+	if (digestfile != 0) {
+		add_checksum_filter(&filters, "digest verification block",
+					digestfile, 0);
+	}
+
+	if (blockmd5file != 0) {
+		rc = rdd_new_verify_md5_blockfilter(&f, blockmd5file,
+							handle_digest_error,
+							"MD5");
 		if (rc != RDD_OK) {
-			rdd_error(rc, "cannot create CRC-32 verification filter");
+			rdd_error(rc, "cannot create MD5 block verification filter");
 		}
-		add_filter(&filters, "CRC-32 verification block", f);
+		add_filter(&filters, "MD5 verification block", f);
 	}
 
-	/* Run verification.
+	/* Run verification.  The input files are the consecutive parts
+	 * of a single image, so the filters are closed only after the
+	 * last file.  With read-ahead buffers, each filter runs on its
+	 * own thread and this thread only reads.
 	 */
+	if (opts.nbuf > 0) {
+		rc = rdd_fset_set_parallel(&filters, 0, opts.nbuf);
+		if (rc != RDD_OK) {
+			rdd_error(rc, "cannot start filter threads");
+		}
+	}
 	for (i = 0; i < nfile; i++) {
 		if (opts.verbose) {
 			errlognl("verifying %s ...", files[i]);
 		}
 		verify_file(&filters, files[i]);
 	}
+	if ((rc = rdd_fset_close(&filters)) != RDD_OK) {
+		rdd_error(rc, "cannot close filters");
+	}
 
 	/* Check results.
 	 */
@@ -497,6 +854,30 @@ verify_files(char **files, unsigned nfile,
 		}
 	}
 
+	if (crc32cfile != 0) {
+		get_checksum_result(&filters, "CRC-32C verification block",
+					&num_error);
+		if (num_error > 0) {
+			broken |= VFY_CRC32C;
+		}
+	}
+
+	if (blockmd5file != 0) {
+		get_checksum_result(&filters, "MD5 verification block",
+					&num_error);
+		if (num_error > 0) {
+			broken |= VFY_BLOCKMD5;
+		}
+	}
+
+	if (digestfile != 0) {
+		get_checksum_result(&filters, "digest verification block",
+					&num_error);
+		if (num_error > 0) {
+			broken |= VFY_BLOCKDIGEST;
+		}
+	}
+
 	if (opts.sha1) {
 		unsigned char md[20];
 		char hexmd[2*20 + 1];
@@ -550,16 +931,559 @@ verify_files(char **files, unsigned nfile,
 	return broken;
 }
 
+/* A part of an image that is split over several input files.
+ */
+typedef struct _IMAGE_PART {
+	char        *path;
+	RDD_READER  *reader;
+	rdd_count_t  start;	/* image position of the first byte */
+	rdd_count_t  size;	/* size in bytes */
+} IMAGE_PART;
+
+static IMAGE_PART *
+open_image_parts(char **files, unsigned nfile, rdd_count_t *imagesize)
+{
+	IMAGE_PART *parts;
+	off_t size;
+	unsigned i;
+	int fd;
+	int rc;
+
+	if ((parts = calloc(nfile, sizeof(*parts))) == 0) {
+		error("out of memory");
+	}
+
+	*imagesize = 0;
+	for (i = 0; i < nfile; i++) {
+		if ((fd = open(files[i], O_RDONLY)) < 0) {
+			rdd_error(RDD_EOPEN, "cannot open %s", files[i]);
+		}
+		if ((size = lseek(fd, (off_t) 0, SEEK_END)) == (off_t) -1) {
+			unix_error("cannot determine the size of %s", files[i]);
+		}
+		if ((rc = rdd_open_fd_reader(&parts[i].reader, fd)) != RDD_OK) {
+			rdd_error(rc, "cannot open %s", files[i]);
+		}
+		parts[i].path = files[i];
+		parts[i].start = *imagesize;
+		parts[i].size = (rdd_count_t) size;
+		*imagesize += parts[i].size;
+	}
+
+	return parts;
+}
+
+static void
+close_image_parts(IMAGE_PART *parts, unsigned nfile)
+{
+	unsigned i;
+
+	for (i = 0; i < nfile; i++) {
+		close_image_file(parts[i].path, parts[i].reader);
+	}
+	free(parts);
+}
+
+/* Reads up to nbyte bytes at image position pos, crossing part
+ * boundaries as needed.  Returns fewer bytes only at the end of
+ * the image.
+ */
+static unsigned
+read_image(IMAGE_PART *parts, unsigned nfile, rdd_count_t pos,
+		unsigned char *buf, unsigned nbyte)
+{
+	unsigned total = 0;
+	unsigned len, nread;
+	unsigned i;
+	int rc;
+
+	for (i = 0; i < nfile && total < nbyte; i++) {
+		if (pos >= parts[i].start + parts[i].size) {
+			continue;
+		}
+		len = nbyte - total;
+		if (len > parts[i].start + parts[i].size - pos) {
+			len = (unsigned) (parts[i].start + parts[i].size - pos);
+		}
+		rc = rdd_reader_seek(parts[i].reader, pos - parts[i].start);
+		if (rc != RDD_OK) {
+			rdd_error(rc, "%s: seek error", parts[i].path);
+		}
+		rc = rdd_reader_read(parts[i].reader, buf + total, len, &nread);
+		if (rc != RDD_OK) {
+			rdd_error(rc, "%s: read error", parts[i].path);
+		}
+		if (nread < len) {
+			error("%s: file is shorter than expected", parts[i].path);
+		}
+		total += len;
+		pos += len;
+	}
+
+	return total;
+}
+
+/* splitmix64: a small generator whose output depends only on the
+ * seed, so that a sample can be repeated on any host.
+ */
+static double
+next_random(u_int64_t *state)
+{
+	u_int64_t z;
+
+	z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z = z ^ (z >> 31);
+
+	return (double) (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Returns the number of records in a checksum file.  The record
+ * count in a finished version-2 header is authoritative; otherwise
+ * the records extend to the end of the file.
+ */
+static rdd_count_t
+count_records(CHECKSUM_FILE *cf)
+{
+	rdd_count_t hdrsize, recsize;
+	off_t size;
+
+	if (cf->version == 2
+	&&  (cf->hdr2.flags & RDD_CHECKSUM2_FINISHED) != 0) {
+		return cf->hdr2.nrecord;
+	}
+
+	if (fseeko(cf->fp, (off_t) 0, SEEK_END) < 0) {
+		unix_error("%s: seek error", cf->path);
+	}
+	if ((size = ftello(cf->fp)) < 0) {
+		unix_error("cannot determine the size of %s", cf->path);
+	}
+	if (cf->version == 2) {
+		hdrsize = RDD_CHECKSUM2_HEADER_SIZE;
+		recsize = cf->hdr2.recordsize;
+	} else {
+		hdrsize = sizeof(cf->hdr);
+		recsize = sizeof(rdd_checksum_t);
+	}
+	if ((rdd_count_t) size < hdrsize) {
+		return 0;
+	}
+	return ((rdd_count_t) size - hdrsize) / recsize;
+}
+
+/* Reads record blocknum of a checksum file.  Checksums are returned
+ * in the little-endian encoding of version-2 files, whatever the
+ * version of the file.
+ */
+static void
+read_record(CHECKSUM_FILE *cf, rdd_count_t blocknum, unsigned char *record)
+{
+	rdd_checksum_t sum;
+	off_t pos;
+
+	if (cf->version == 2) {
+		pos = (off_t) (RDD_CHECKSUM2_HEADER_SIZE
+				+ blocknum * cf->hdr2.recordsize);
+	} else {
+		pos = (off_t) (sizeof(cf->hdr) + blocknum * sizeof sum);
+	}
+	if (fseeko(cf->fp, pos, SEEK_SET) < 0) {
+		unix_error("%s: seek error", cf->path);
+	}
+
+	if (cf->version == 2) {
+		if (fread(record, cf->hdr2.recordsize, 1, cf->fp) != 1) {
+			unix_error("cannot read record from %s", cf->path);
+		}
+		return;
+	}
+
+	if (fread(&sum, sizeof sum, 1, cf->fp) != 1) {
+		unix_error("cannot read checksum from %s", cf->path);
+	}
+	rdd_cksum2_put_checksum(record, cf->swap ? swap32(sum) : sum);
+}
+
+/* Verifies a random sample of the blocks in a checksum file.
+ * The sample is drawn with selection sampling (Knuth, algorithm S),
+ * which yields the blocks in increasing order, so the image is read
+ * front to back with one seek per block.  Block i of the checksum
+ * file is compared with image bytes [i * blocksize, (i+1) * blocksize),
+ * as in a full verification.
+ */
+static int
+verify_sample(char **files, unsigned nfile, CHECKSUM_FILE *cf, int vfy)
+{
+	IMAGE_PART *parts;
+	unsigned char expected[RDD_CKSUM2_MAX_RECORD];
+	unsigned char computed[RDD_CKSUM2_MAX_RECORD];
+	unsigned char *buf;
+	unsigned type, blocksize, recsize, len;
+	rdd_count_t nrecord, nsample, nselected = 0, nerror = 0;
+	rdd_count_t imagesize, i;
+	u_int64_t state = opts.seed;
+	char *algorithm;
+	double bound;
+
+	if (cf->version == 2) {
+		type = cf->hdr2.type;
+		blocksize = cf->hdr2.blocksize;
+	} else {
+		type = cf->hdr.flags;
+		blocksize = cf->hdr.blocksize;
+	}
+	recsize = rdd_cksum2_record_size(type);
+	algorithm = (char *) rdd_cksum2_name(type);
+
+	nrecord = count_records(cf);
+	if (nrecord == 0) {
+		error("%s: no blocks to sample", cf->path);
+	}
+	if (opts.nsample > 0) {
+		nsample = opts.nsample;
+	} else {
+		nsample = (rdd_count_t) ceil(opts.sample_fraction * nrecord);
+	}
+	if (nsample > nrecord) {
+		nsample = nrecord;
+	}
+
+	if ((buf = malloc(blocksize)) == 0) {
+		error("out of memory");
+	}
+	parts = open_image_parts(files, nfile, &imagesize);
+
+	for (i = 0; i < nrecord && nselected < nsample; i++) {
+		if ((nrecord - i) * next_random(&state) >= nsample - nselected) {
+			continue;
+		}
+		nselected++;
+
+		read_record(cf, i, expected);
+		len = 0;
+		if (i * blocksize < imagesize) {
+			len = read_image(parts, nfile, i * blocksize,
+					buf, blocksize);
+		}
+		if (len == 0) {
+			handle_digest_error(i * blocksize, expected, 0,
+					recsize, algorithm);
+			nerror++;
+			continue;
+		}
+		if (rdd_cksum2_compute(type, buf, len, computed) != RDD_OK) {
+			error("cannot compute %s values", algorithm);
+		}
+		if (memcmp(expected, computed, recsize) != 0) {
+			handle_digest_error(i * blocksize, expected, computed,
+					recsize, algorithm);
+			nerror++;
+		}
+	}
+
+	close_image_parts(parts, nfile);
+	free(buf);
+
+	errlognl("sampled %llu of %llu blocks (seed %lu)",
+		(unsigned long long) nselected,
+		(unsigned long long) nrecord, opts.seed);
+	if (nerror > 0) {
+		errlognl("%llu sampled blocks do not match",
+			(unsigned long long) nerror);
+		return vfy;
+	}
+
+	/* With no mismatches in n sampled blocks, a fraction p of corrupt
+	 * blocks is excluded at confidence c if (1 - p)^n <= 1 - c.
+	 */
+	if (nselected == nrecord) {
+		errlognl("all blocks match");
+	} else {
+		bound = 1.0 - exp(log(1.0 - SAMPLE_CONFIDENCE) / nselected);
+		errlognl("no mismatches; with %g%% confidence, fewer than "
+			"%.3g%% of the blocks are corrupt",
+			100.0 * SAMPLE_CONFIDENCE, 100.0 * bound);
+	}
+	return 0;
+}
+
+static int
+hex2buf(const char *hex, unsigned char *buf, unsigned bufsize)
+{
+	unsigned i;
+	int hi, lo;
+
+	for (i = 0; i < bufsize; i++) {
+		if (!isxdigit((unsigned char) hex[2*i])
+		||  !isxdigit((unsigned char) hex[2*i + 1])) {
+			return RDD_ESYNTAX;
+		}
+		hi = tolower((unsigned char) hex[2*i]);
+		lo = tolower((unsigned char) hex[2*i + 1]);
+		hi = isdigit(hi) ? hi - '0' : hi - 'a' + 10;
+		lo = isdigit(lo) ? lo - '0' : lo - 'a' + 10;
+		buf[i] = (unsigned char) ((hi << 4) | lo);
+	}
+	return RDD_OK;
+}
+
+/* Reads a manifest file.  Each line holds a hexadecimal hash value
+ * and a path name, in the format written by md5sum(1), sha1sum(1),
+ * and sha256sum(1).  The length of the hash value determines the
+ * hash algorithm.  Empty lines and lines that start with '#' are
+ * skipped.
+ */
+static IMAGE_JOB *
+read_manifest(const char *path, unsigned *njob)
+{
+	static unsigned types[] = {
+		RDD_CKSUM2_MD5, RDD_CKSUM2_SHA1, RDD_CKSUM2_SHA256
+	};
+	char line[MANIFEST_LINE_SIZE];
+	IMAGE_JOB *jobs = 0;
+	IMAGE_JOB *job;
+	unsigned lineno = 0;
+	unsigned n = 0, size = 0;
+	unsigned hexlen, len, t;
+	char *p, *name;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		unix_error("cannot open manifest file %s", path);
+	}
+
+	while (fgets(line, sizeof line, fp) != NULL) {
+		lineno++;
+		len = strlen(line);
+		if (len > 0 && line[len - 1] != '\n' && !feof(fp)) {
+			error("%s:%u: line too long", path, lineno);
+		}
+		while (len > 0 && isspace((unsigned char) line[len - 1])) {
+			line[--len] = '\0';
+		}
+		if (len == 0 || line[0] == '#') {
+			continue;
+		}
+
+		for (p = line; isxdigit((unsigned char) *p); p++) {
+		}
+		hexlen = p - line;
+		if (!isspace((unsigned char) *p)) {
+			error("%s:%u: syntax error", path, lineno);
+		}
+		for (name = p; isspace((unsigned char) *name); name++) {
+		}
+		if (*name == '*') {
+			name++;		/* binary-mode marker */
+		}
+		if (*name == '\0') {
+			error("%s:%u: missing file name", path, lineno);
+		}
+
+		for (t = 0; t < sizeof types / sizeof types[0]; t++) {
+			if (2*rdd_cksum2_record_size(types[t]) == hexlen) {
+				break;
+			}
+		}
+		if (t >= sizeof types / sizeof types[0]) {
+			error("%s:%u: hash value has an unsupported length",
+				path, lineno);
+		}
+
+		if (n >= size) {
+			size = size == 0 ? 16 : 2 * size;
+			if ((job = realloc(jobs, size * sizeof(*jobs))) == 0) {
+				error("out of memory");
+			}
+			jobs = job;
+		}
+		job = &jobs[n++];
+		memset(job, 0, sizeof(*job));
+		job->type = types[t];
+		hex2buf(line, job->expected, hexlen / 2);
+		if ((job->path = strdup(name)) == 0) {
+			error("out of memory");
+		}
+	}
+	if (ferror(fp)) {
+		unix_error("cannot read manifest file %s", path);
+	}
+	fclose(fp);
+
+	*njob = n;
+	return jobs;
+}
+
+/* Computes the hash value of one manifest image.  Errors are stored
+ * in the job rather than reported, because this routine runs on a
+ * worker thread.
+ */
+static void
+hash_image(IMAGE_JOB *job)
+{
+	struct _RDD_CKSUM2_CTX *ctx = 0;
+	RDD_READER *reader = 0;
+	unsigned char *buf = 0;
+	const unsigned char *data;
+	unsigned nread;
+	int mapped = 1;
+	int fd;
+	int rc;
+
+	if ((rc = rdd_cksum2_ctx_new(&ctx, job->type)) != RDD_OK) {
+		goto error;
+	}
+
+	if ((fd = open(job->path, O_RDONLY)) < 0) {
+		rc = RDD_EOPEN;
+		goto error;
+	}
+	if (rdd_open_mmap_reader(&reader, fd) != RDD_OK) {
+		mapped = 0;
+		if ((buf = malloc(READ_SIZE)) == 0) {
+			close(fd);
+			rc = RDD_NOMEM;
+			goto error;
+		}
+		if ((rc = rdd_open_fd_reader(&reader, fd)) != RDD_OK) {
+			close(fd);
+			goto error;
+		}
+	}
+
+	while (1) {
+		if (mapped) {
+			rc = rdd_mmap_reader_map(reader, &data, READ_SIZE, &nread);
+		} else {
+			rc = rdd_reader_read(reader, buf, READ_SIZE, &nread);
+			data = buf;
+		}
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		if (nread == 0) break;	/* EOF */
+
+		rdd_cksum2_ctx_update(ctx, data, nread);
+	}
+	rdd_cksum2_ctx_final(ctx, job->computed);
+
+	rc = rdd_reader_close(reader, 1);
+	reader = 0;
+
+error:
+	if (reader != 0) rdd_reader_close(reader, 1);
+	if (ctx != 0) rdd_cksum2_ctx_free(ctx);
+	free(buf);
+	job->rc = rc;
+}
+
+static void *
+job_worker(void *arg)
+{
+	JOB_QUEUE *q = (JOB_QUEUE *) arg;
+	unsigned i;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		i = q->next++;
+		pthread_mutex_unlock(&q->lock);
+
+		if (i >= q->njob) {
+			break;
+		}
+		hash_image(&q->jobs[i]);
+	}
+
+	return 0;
+}
+
+/* Verifies the images listed in a manifest file, opts.njob images at
+ * a time.  The calling thread is one of the workers; if a thread
+ * cannot be started, the remaining threads verify its images.
+ * The results are reported in manifest order once all images have
+ * been verified.
+ */
+static int
+verify_manifest(const char *path)
+{
+	JOB_QUEUE q;
+	pthread_t *threads;
+	unsigned nthread = 0;
+	unsigned nfailed = 0;
+	unsigned i, size;
+	IMAGE_JOB *job;
+	char hexexp[2*RDD_CKSUM2_MAX_RECORD + 1];
+	char hexcomp[2*RDD_CKSUM2_MAX_RECORD + 1];
+	char msg[128];
+
+	memset(&q, 0, sizeof q);
+	q.jobs = read_manifest(path, &q.njob);
+	if (q.njob == 0) {
+		error("%s: no images listed", path);
+	}
+	pthread_mutex_init(&q.lock, 0);
+
+	if ((threads = calloc(opts.njob, sizeof(*threads))) == 0) {
+		error("out of memory");
+	}
+	for (i = 1; i < opts.njob && i < q.njob; i++) {
+		if (pthread_create(&threads[nthread], 0, job_worker, &q) != 0) {
+			break;
+		}
+		nthread++;
+	}
+	(void) job_worker(&q);
+	for (i = 0; i < nthread; i++) {
+		pthread_join(threads[i], 0);
+	}
+	free(threads);
+	pthread_mutex_destroy(&q.lock);
+
+	for (i = 0; i < q.njob; i++) {
+		job = &q.jobs[i];
+		size = rdd_cksum2_record_size(job->type);
+
+		if (job->rc != RDD_OK) {
+			if (rdd_strerror(job->rc, msg, sizeof msg) != RDD_OK) {
+				strcpy(msg, "unknown error");
+			}
+			errlognl("%s: cannot verify: %s", job->path, msg);
+			nfailed++;
+		} else if (memcmp(job->expected, job->computed, size) != 0) {
+			rdd_buf2hex(job->expected, size, hexexp, sizeof hexexp);
+			rdd_buf2hex(job->computed, size, hexcomp, sizeof hexcomp);
+			errlognl("%s: %s values do not match:", job->path,
+				rdd_cksum2_name(job->type));
+			errlognl("\texpected: %s", hexexp);
+			errlognl("\tfound:    %s", hexcomp);
+			nfailed++;
+		} else if (opts.verbose) {
+			errlognl("%s: %s OK", job->path,
+				rdd_cksum2_name(job->type));
+		}
+		free(job->path);
+	}
+	free(q.jobs);
+
+	if (nfailed > 0) {
+		errlognl("%u of %u images failed verification", nfailed, q.njob);
+		return VFY_MANIFEST;
+	}
+	return 0;
+}
+
 int
 main(int argc, char** argv)
 {
-	RDD_CHECKSUM_FILE_HEADER adler32hdr;
-	RDD_CHECKSUM_FILE_HEADER crc32hdr;
-	FILE *adler32file = NULL;
-	FILE *crc32file = NULL;
-	int adler32swap = 0;
-	int crc32swap = 0;
+	CHECKSUM_FILE adler32file;
+	CHECKSUM_FILE crc32file;
+	CHECKSUM_FILE crc32cfile;
+	CHECKSUM_FILE digestfile;
+	RDD_BLOCKHASH_FILE *blockmd5file = 0;
 	int res;
+	int rc;
 	int i;
 	
 	rdd_opt_init(opttab, usage_message);
@@ -569,18 +1493,29 @@ main(int argc, char** argv)
 	memset(&opts, '\000', sizeof opts);
 	command_line(argc, argv);
 
-	memset(&adler32hdr, 0, sizeof adler32hdr);
-	memset(&crc32hdr, 0, sizeof crc32hdr);
+	memset(&adler32file, 0, sizeof adler32file);
+	memset(&crc32file, 0, sizeof crc32file);
+	memset(&crc32cfile, 0, sizeof crc32cfile);
+	memset(&digestfile, 0, sizeof digestfile);
 
 	if (opts.adler32file) {
-		adler32file = open_checksum_file(opts.adler32file,
-						 RDD_ADLER32, &adler32hdr,
-						 &adler32swap);
+		open_checksum_file(opts.adler32file, RDD_ADLER32, &adler32file);
 	}
 	if (opts.crc32file) {
-		crc32file = open_checksum_file(opts.crc32file,
-					       RDD_CRC32, &crc32hdr,
-					       &crc32swap);
+		open_checksum_file(opts.crc32file, RDD_CRC32, &crc32file);
+	}
+	if (opts.crc32cfile) {
+		open_checksum_file(opts.crc32cfile, RDD_CRC32C, &crc32cfile);
+	}
+	if (opts.digestfile) {
+		open_checksum_file(opts.digestfile, 0, &digestfile);
+	}
+	if (opts.blockmd5file) {
+		rc = rdd_blockhash_open(&blockmd5file, opts.blockmd5file);
+		if (rc != RDD_OK) {
+			rdd_error(rc, "cannot open block-hash file %s",
+					opts.blockmd5file);
+		}
 	}
 
 	errlognl("");
@@ -604,11 +1539,42 @@ main(int argc, char** argv)
 
 	if (opts.verbose) {
 		errlognl("verbose: %s", bool2str(opts.verbose));
+		errlognl("read-ahead buffers: %u", opts.nbuf);
+		if (opts.manifest != 0) {
+			errlognl("manifest: %s", opts.manifest);
+			errlognl("jobs: %u", opts.njob);
+		}
+		if (opts.sample && opts.nsample > 0) {
+			errlognl("sample: %llu blocks",
+				(unsigned long long) opts.nsample);
+		} else if (opts.sample) {
+			errlognl("sample: %g%% of the blocks",
+				100.0 * opts.sample_fraction);
+		}
 	}
 
-	res = verify_files(opts.files, opts.nfile,
-			adler32file, adler32hdr.blocksize, adler32swap,
-			crc32file, crc32hdr.blocksize, crc32swap);
+	if (opts.manifest != 0) {
+		res = verify_manifest(opts.manifest);
+	} else if (opts.sample && opts.adler32file != 0) {
+		res = verify_sample(opts.files, opts.nfile, &adler32file,
+				VFY_ADLER32);
+	} else if (opts.sample && opts.crc32file != 0) {
+		res = verify_sample(opts.files, opts.nfile, &crc32file,
+				VFY_CRC32);
+	} else if (opts.sample && opts.crc32cfile != 0) {
+		res = verify_sample(opts.files, opts.nfile, &crc32cfile,
+				VFY_CRC32C);
+	} else if (opts.sample) {
+		res = verify_sample(opts.files, opts.nfile, &digestfile,
+				VFY_BLOCKDIGEST);
+	} else {
+		res = verify_files(opts.files, opts.nfile,
+				opts.adler32file != 0 ? &adler32file : 0,
+				opts.crc32file != 0 ? &crc32file : 0,
+				opts.crc32cfile != 0 ? &crc32cfile : 0,
+				opts.digestfile != 0 ? &digestfile : 0,
+				blockmd5file);
+	}
 
 	if (res == 0) {
 		errlognl("Verification complete: NO ERRORS");
@@ -621,16 +1587,34 @@ main(int argc, char** argv)
 		if ((res & VFY_CRC32) != 0) {
 			errlognl("CRC32 verification failed");
 		}
+		if ((res & VFY_CRC32C) != 0) {
+			errlognl("CRC32C verification failed");
+		}
+		if ((res & VFY_BLOCKMD5) != 0) {
+			errlognl("block-wise MD5 verification failed");
+		}
+		if ((res & VFY_BLOCKDIGEST) != 0) {
+			errlognl("block-wise %s verification failed",
+				rdd_cksum2_name(digestfile.hdr2.type));
+		}
 		if ((res & VFY_SHA1) != 0) {
 			errlognl("SHA1 verification failed");
 		}
 		if ((res & VFY_MD5) != 0) {
 			errlognl("MD5 verification failed");
 		}
+		if ((res & VFY_MANIFEST) != 0) {
+			errlognl("manifest verification failed");
+		}
 	}
 
-	close_checksum_file(opts.crc32file, crc32file);
-	close_checksum_file(opts.adler32file, adler32file);
+	close_checksum_file(&digestfile);
+	close_checksum_file(&crc32cfile);
+	close_checksum_file(&crc32file);
+	close_checksum_file(&adler32file);
+	if (blockmd5file != 0) {
+		rdd_blockhash_close(blockmd5file);
+	}
 
 	return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
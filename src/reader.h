@@ -103,6 +103,54 @@ int rdd_new_reader(RDD_READER **r, RDD_READ_OPS *ops, unsigned statesize);
  */
 int rdd_open_fd_reader(RDD_READER **r, int fd);
 
+/** \brief Instantiates a reader that keeps multiple reads in flight.
+ *  \param r output value: a new reader object.
+ *  \param fd the open file descriptor that the reader will read from.
+ *  \param qdepth the maximum number of reads in flight.
+ *  \param blocksize the maximum size in bytes of a single read.
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  A uring reader uses Linux io_uring to read ahead of the current
+ *  file position, \c qdepth reads at a time, into registered buffers.
+ *  Data is returned strictly in file order, and a read fails with
+ *  \c RDD_EREAD if and only if a blocking read of the same range
+ *  would have failed.  The file position is not moved by a failed read.
+ *
+ *  If io_uring is not supported by the system, this routine
+ *  returns a file descriptor reader (see \c rdd_open_fd_reader()).
+ */
+int rdd_open_uring_reader(RDD_READER **r, int fd, unsigned qdepth,
+			unsigned blocksize);
+
+/** \brief Instantiates a reader that maps a regular file into memory.
+ *  \param r output value: a new reader object.
+ *  \param fd the open file descriptor that the reader will read from.
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c fd does not refer to a regular file; \c fd is not closed in
+ *  that case, so the caller can fall back to a file descriptor reader.
+ *
+ *  An mmap reader maps the file one large window at a time and
+ *  unmaps each window as soon as the file position moves past it.
+ *  Use \c rdd_mmap_reader_map() to access the data without copying it.
+ *  The file must not shrink while the reader is open.
+ */
+int rdd_open_mmap_reader(RDD_READER **r, int fd);
+
+/** \brief Returns a pointer to the next \c nbyte bytes of an mmap reader.
+ *  \param r pointer to an mmap reader object.
+ *  \param buf output value: a pointer into the mapped file.
+ *  \param nbyte the number of bytes to read
+ *  \param nread output value: the number of bytes actually read.
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c r is not an mmap reader.
+ *
+ *  This routine behaves like \c rdd_reader_read(), except that it does
+ *  not copy any data.  The pointer in \c *buf remains valid until the
+ *  next operation on the reader.
+ */
+int rdd_mmap_reader_map(RDD_READER *r, const unsigned char **buf,
+			unsigned nbyte, unsigned *nread);
+
 /** \brief Instantiates a reader that reads from an open file descriptor
  *  that refers to a raw block device.
  *  \param r output value: a new reader object.
@@ -163,6 +211,64 @@ int rdd_open_atomic_reader(RDD_READER **r, RDD_READER *p);
  */
 int rdd_open_zlib_reader(RDD_READER **r, RDD_READER *p);
 
+/** \brief Instantiates a reader that decompresses Zstandard data.
+ *  \param r output value: a new reader object.
+ *  \param p an existing parent reader.
+ *
+ *  The compressed data may consist of several concatenated frames.
+ *  Only available if rdd was built with libzstd.
+ *
+ *  \b Note: a zstd reader does not implement the \c seek() routine.
+ */
+int rdd_open_zstd_reader(RDD_READER **r, RDD_READER *p);
+
+/** \brief Instantiates a reader that decompresses LZ4 frame data.
+ *  \param r output value: a new reader object.
+ *  \param p an existing parent reader.
+ *
+ *  The compressed data may consist of several concatenated frames.
+ *  Only available if rdd was built with liblz4.
+ *
+ *  \b Note: an lz4 reader does not implement the \c seek() routine.
+ */
+int rdd_open_lz4_reader(RDD_READER **r, RDD_READER *p);
+
+/** \brief Instantiates a reader that reassembles a striped stream.
+ *  \param r output value: a new reader object.
+ *  \param streams the parent readers, in the order of the
+ *         parent writers of the stripe writer.
+ *  \param nstream the number of parent readers.
+ *
+ *  A stripe reader reads the frames written by a stripe writer
+ *  (see \c rdd_open_stripe_writer()) from its parents, in order.
+ *  A read fails with \c RDD_ESYNTAX if a frame is out of place or
+ *  if a parent ends before its end frame.
+ *
+ *  \b Note: a stripe reader does not implement the \c seek() routine.
+ */
+int rdd_open_stripe_reader(RDD_READER **r, RDD_READER **streams,
+			unsigned nstream);
+
+/** \brief Instantiates a reader for the frames of a network protocol
+ *  version 2 client.
+ *  \param r output value: a new reader object.
+ *  \param p the reader for the connection.
+ *  \param sock the connection's socket, on which credits and the
+ *         final DONE message are sent.
+ *  \param hdrcrc the checksum of the request or join header that
+ *         was received (see \c rdd_net_info_crc()).
+ *
+ *  A frame reader reads the frames written by a frame writer (see
+ *  \c rdd_open_frame_writer()).  A read fails with \c RDD_ECHECKSUM
+ *  if a checksum does not match and with \c RDD_ESYNTAX if a frame
+ *  is out of place.  Closing the reader after the end of the stream
+ *  tells the client that all data has been received.
+ *
+ *  \b Note: a frame reader does not implement the \c seek() routine.
+ */
+int rdd_open_frame_reader(RDD_READER **r, RDD_READER *p, int sock,
+			rdd_checksum_t hdrcrc);
+
 int rdd_open_cdrom_reader(RDD_READER **r, const char *path);
 
 /** \brief Instantiates a reader that simulates read errors.
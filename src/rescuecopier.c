@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * The rescue copier saves the readable data of a failing drive
+ * before it spends any time on the unreadable data.  It makes
+ * several passes over the input, each driven by a rescue map (see
+ * rescuemap.h) that records the state of every input byte:
+ *
+ * 1. Fast pass: read all untried data in maximum-size blocks.  After
+ *    a read error, skip ahead; the skip size doubles with every
+ *    consecutive error and resets after a good read.
+ * 2. Forward trim: read each skipped area from its start in
+ *    minimum-size blocks until the first read error.  The failed
+ *    block is marked trimmed.
+ * 3. Backward trim: read each skipped area from its end in
+ *    minimum-size blocks until the first read error.  The rest of
+ *    the area is marked trimmed.
+ * 4. Scrape: read every trimmed minimum-size block, retrying it
+ *    nretry times.  Blocks that still fail are bad and are zeroed.
+ *
+ * Every read changes the state of the block that was read, so a
+ * resumed rescue never repeats work of an earlier run.
+ *
+ * Data is written to the image file at its input position.  The map
+ * is saved to disk every few seconds, so an interrupted rescue can be
+ * resumed.  When all passes are done, the image is read back in order
+ * and pushed through the filter set, so the hash values describe the
+ * complete image.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "error.h"
+#include "alignedbuf.h"
+#include "rescuemap.h"
+
+#define MAP_SYNC_INTERVAL  5.0	/* seconds between map saves */
+#define MAX_SKIP_FRACTION  1000	/* skip at most count/1000 bytes */
+
+typedef struct _RDD_RESCUE_COPIER {
+	rdd_count_t offset;		/* start reading at this position */
+	rdd_count_t count;		/* number of bytes to read */
+	unsigned    minblocklen;
+	unsigned    maxblocklen;
+	rdd_count_t maxskip;
+	unsigned    nretry;
+	unsigned    maxsubst;
+	char       *imagepath;
+	char       *mappath;
+
+	rdd_readerrhandler_t  readerrfun;
+	void                 *readerrenv;
+	rdd_substhandler_t    substfun;
+	void                 *substenv;
+	rdd_proghandler_t     progressfun;
+	void                 *progressenv;
+
+	/* Valid during rdd_copy_exec() only.
+	 */
+	RDD_READER     *reader;
+	RDD_RESCUE_MAP *map;
+	int             imagefd;
+	rdd_count_t     ngood;		/* bytes rescued so far */
+	unsigned        nread_err;
+	unsigned        nsubst;
+
+	RDD_ALIGNEDBUF readbuf;
+} RDD_RESCUE_COPIER;
+
+static int rescue_exec(RDD_COPIER *c, RDD_READER *r,
+				      RDD_FILTERSET *fset,
+				      RDD_COPIER_RETURN *ret);
+static int rescue_free(RDD_COPIER *c);
+
+static RDD_COPY_OPS rescue_ops = {
+	rescue_exec,
+	rescue_free
+};
+
+static char *
+copy_string(const char *s)
+{
+	char *copy;
+
+	if ((copy = malloc(strlen(s) + 1)) != 0) {
+		strcpy(copy, s);
+	}
+	return copy;
+}
+
+int
+rdd_new_rescue_copier(RDD_COPIER **self,
+		rdd_count_t offset, rdd_count_t count,
+		const char *imagepath, const char *mappath,
+		RDD_ROBUST_PARAMS *p)
+{
+	RDD_COPIER *c = 0;
+	RDD_RESCUE_COPIER *state = 0;
+	int rc = RDD_OK;
+
+	if (p->maxblocklen <= 0) return RDD_BADARG;
+	if (p->minblocklen <= 0) return RDD_BADARG;
+	if (p->minblocklen > p->maxblocklen) return RDD_BADARG;
+	if (count == RDD_WHOLE_FILE) return RDD_BADARG;
+	if (imagepath == 0 || mappath == 0) return RDD_BADARG;
+
+	rc = rdd_new_copier(&c, &rescue_ops, sizeof(RDD_RESCUE_COPIER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_RESCUE_COPIER *) c->state;
+
+	state->offset = offset;
+	state->count = count;
+	state->minblocklen = p->minblocklen;
+	state->maxblocklen = p->maxblocklen;
+	state->maxskip = (count / MAX_SKIP_FRACTION / p->maxblocklen)
+				* p->maxblocklen;
+	if (state->maxskip < p->maxblocklen) {
+		state->maxskip = p->maxblocklen;
+	}
+	state->nretry = p->nretry;
+	state->maxsubst = p->maxsubst;
+
+	state->readerrfun = p->readerrfun;
+	state->readerrenv = p->readerrenv;
+	state->substfun = p->substfun;
+	state->substenv = p->substenv;
+	state->progressfun = p->progressfun;
+	state->progressenv = p->progressenv;
+	state->imagefd = -1;
+
+	state->imagepath = copy_string(imagepath);
+	state->mappath = copy_string(mappath);
+	if (state->imagepath == 0 || state->mappath == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	rc = rdd_new_alignedbuf(&state->readbuf, p->maxblocklen,
+				RDD_SECTOR_SIZE);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+
+	*self = c;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	free(state->imagepath);
+	free(state->mappath);
+	free(state);
+	free(c);
+	return rc;
+}
+
+static int
+write_image(RDD_RESCUE_COPIER *s, rdd_count_t pos,
+		const unsigned char *buf, unsigned nbyte)
+{
+	ssize_t n;
+
+	pos -= s->offset;
+	while (nbyte > 0) {
+		n = pwrite(s->imagefd, buf, nbyte, (off_t) pos);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return RDD_EWRITE;
+		}
+		buf += n;
+		pos += n;
+		nbyte -= n;
+	}
+	return RDD_OK;
+}
+
+/* Flushes the image data before the map is saved; otherwise a crash
+ * could leave the map marking extents good whose data never reached
+ * the disk.
+ */
+static int
+sync_image(void *env)
+{
+	RDD_RESCUE_COPIER *s = (RDD_RESCUE_COPIER *) env;
+
+	if (s->imagefd >= 0 && fdatasync(s->imagefd) < 0) {
+		return RDD_EWRITE;
+	}
+	return RDD_OK;
+}
+
+/* Reads [pos, pos + nbyte) and writes it to the image.  Sets *ok
+ * to 1 if the read succeeded and to 0 if it failed with a read error.
+ */
+static int
+read_block(RDD_RESCUE_COPIER *s, rdd_count_t pos, unsigned nbyte, int *ok)
+{
+	unsigned char *buf = s->readbuf.aligned;
+	unsigned nread = 0;
+	int rc;
+
+	*ok = 0;
+
+	if ((rc = rdd_reader_seek(s->reader, pos)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_reader_read(s->reader, buf, nbyte, &nread);
+	if (rc == RDD_EREAD) {
+		s->nread_err++;
+		if (s->readerrfun != 0) {
+			(*s->readerrfun)(pos, nbyte, s->readerrenv);
+		}
+		return RDD_OK;
+	} else if (rc != RDD_OK) {
+		return rc;
+	}
+
+	if (nread != nbyte) {
+		errlognl("unexpected end-of-file at offset %llu bytes "
+			"(expected %s bytes)", pos + nread,
+			rdd_strsize(s->count));
+		return RDD_EREAD;
+	}
+
+	if ((rc = write_image(s, pos, buf, nbyte)) != RDD_OK) {
+		return rc;
+	}
+	s->ngood += nbyte;
+	*ok = 1;
+	return RDD_OK;
+}
+
+/* Reports progress and saves the map now and then.
+ */
+static int
+checkpoint(RDD_RESCUE_COPIER *s)
+{
+	int rc;
+
+	if ((rc = rdd_map_sync(s->map, MAP_SYNC_INTERVAL)) != RDD_OK) {
+		return rc;
+	}
+	if (s->progressfun != 0) {
+		return (*s->progressfun)(s->ngood, s->progressenv);
+	}
+	return RDD_OK;
+}
+
+static int
+fast_pass(RDD_RESCUE_COPIER *s)
+{
+	rdd_count_t pos = s->offset;
+	rdd_count_t skip = s->maxblocklen;
+	rdd_count_t off, len, n;
+	int ok;
+	int rc;
+
+	while (rdd_map_find(s->map, RDD_MAP_UNTRIED, pos, &off, &len) == RDD_OK) {
+		n = len < s->maxblocklen ? len : s->maxblocklen;
+		if ((rc = read_block(s, off, (unsigned) n, &ok)) != RDD_OK) {
+			return rc;
+		}
+		if (ok) {
+			rc = rdd_map_set(s->map, off, n, RDD_MAP_GOOD);
+			skip = s->maxblocklen;
+			pos = off + n;
+		} else {
+			/* Skip the failed block and the next skip bytes
+			 * of the untried area.
+			 */
+			if (n + skip < len) {
+				len = n + skip;
+			}
+			rc = rdd_map_set(s->map, off, len, RDD_MAP_SKIPPED);
+			pos = off + len;
+			skip = 2 * skip < s->maxskip ? 2 * skip : s->maxskip;
+		}
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if ((rc = checkpoint(s)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+/* Reads each skipped area from its start until the first error.
+ */
+static int
+trim_forward(RDD_RESCUE_COPIER *s)
+{
+	rdd_count_t pos = s->offset;
+	rdd_count_t off, len, n;
+	int ok;
+	int rc;
+
+	while (rdd_map_find(s->map, RDD_MAP_SKIPPED, pos, &off, &len) == RDD_OK) {
+		n = len < s->minblocklen ? len : s->minblocklen;
+		if ((rc = read_block(s, off, (unsigned) n, &ok)) != RDD_OK) {
+			return rc;
+		}
+		if (ok) {
+			rc = rdd_map_set(s->map, off, n, RDD_MAP_GOOD);
+			pos = off + n;
+		} else {
+			rc = rdd_map_set(s->map, off, n, RDD_MAP_TRIMMED);
+			pos = off + len;	/* leave the rest for later */
+		}
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if ((rc = checkpoint(s)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+/* Reads each skipped area from its end until the first error.
+ * Blocks stay aligned on multiples of minblocklen from the start of
+ * the input range.
+ */
+static int
+trim_backward(RDD_RESCUE_COPIER *s)
+{
+	rdd_count_t pos = s->offset + s->count;
+	rdd_count_t off, len, start, end;
+	int ok;
+	int rc;
+
+	while (rdd_map_find_last(s->map, RDD_MAP_SKIPPED, pos, &off, &len)
+			== RDD_OK) {
+		end = off + len;
+		start = s->offset
+			+ ((end - 1 - s->offset) / s->minblocklen)
+				* s->minblocklen;
+		if (start < off) {
+			start = off;
+		}
+
+		rc = read_block(s, start, (unsigned) (end - start), &ok);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if (ok) {
+			rc = rdd_map_set(s->map, start, end - start,
+					RDD_MAP_GOOD);
+			pos = start;
+		} else {
+			rc = rdd_map_set(s->map, off, len, RDD_MAP_TRIMMED);
+			pos = off;
+		}
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		if ((rc = checkpoint(s)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+/* Reads every trimmed block, with retries, and zeroes
+ * the blocks that cannot be read.
+ */
+static int
+scrape(RDD_RESCUE_COPIER *s)
+{
+	rdd_count_t pos = s->offset;
+	rdd_count_t off, len, n;
+	unsigned ntry;
+	int ok = 0;
+	int rc;
+
+	while (rdd_map_find(s->map, RDD_MAP_TRIMMED, pos, &off, &len) == RDD_OK) {
+		n = s->minblocklen - (off - s->offset) % s->minblocklen;
+		if (n > len) {
+			n = len;
+		}
+
+		for (ntry = 0; ntry < s->nretry || ntry == 0; ntry++) {
+			rc = read_block(s, off, (unsigned) n, &ok);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			if (ok) break;
+		}
+
+		if (ok) {
+			rc = rdd_map_set(s->map, off, n, RDD_MAP_GOOD);
+		} else {
+			if (s->maxsubst > 0 && s->nsubst + 1 >= s->maxsubst) {
+				return RDD_ABORTED;
+			}
+
+			errlognl("read error: offset %llu bytes, count %u bytes",
+				off, (unsigned) n);
+			memset(s->readbuf.aligned, 0, (size_t) n);
+			rc = write_image(s, off, s->readbuf.aligned,
+					(unsigned) n);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			rc = rdd_map_set(s->map, off, n, RDD_MAP_BAD);
+			if (s->substfun != 0) {
+				(*s->substfun)(off, (unsigned) n, s->substenv);
+			}
+			s->nsubst++;
+		}
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		pos = off + n;
+		if ((rc = checkpoint(s)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	return RDD_OK;
+}
+
+/* Pushes the finished image through the filter set.
+ */
+static int
+replay(RDD_RESCUE_COPIER *s, RDD_FILTERSET *fset)
+{
+	unsigned char *buf = s->readbuf.aligned;
+	rdd_count_t pos = 0;
+	unsigned n;
+	ssize_t nread;
+	int rc;
+
+	while (pos < s->count) {
+		n = s->count - pos < s->maxblocklen ?
+			(unsigned) (s->count - pos) : s->maxblocklen;
+		nread = pread(s->imagefd, buf, n, (off_t) pos);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		} else if (nread <= 0) {
+			return RDD_EREAD;
+		}
+		if ((rc = rdd_fset_push(fset, buf, (unsigned) nread)) != RDD_OK) {
+			return rc;
+		}
+		pos += nread;
+	}
+
+	return rdd_fset_close(fset);
+}
+
+static int
+rescue_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
+					       RDD_COPIER_RETURN *ret)
+{
+	RDD_RESCUE_COPIER *s = (RDD_RESCUE_COPIER *) c->state;
+	struct stat st;
+	int close_rc;
+	int rc = RDD_OK;
+
+	memset(ret, 0, sizeof(*ret));
+
+	s->reader = reader;
+	s->nread_err = 0;
+	s->nsubst = 0;
+
+	rc = rdd_open_rescue_map(&s->map, s->mappath, s->offset, s->count);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	s->ngood = rdd_map_count(s->map, RDD_MAP_GOOD);
+	rdd_map_set_presave(s->map, sync_image, s);
+
+	/* Keep the image of an interrupted rescue; make sure
+	 * that unread areas read back as zeroes.
+	 */
+	if ((s->imagefd = open(s->imagepath, O_RDWR|O_CREAT, 0666)) < 0) {
+		rc = RDD_EOPEN;
+		goto out;
+	}
+	if (fstat(s->imagefd, &st) < 0) {
+		rc = RDD_EOPEN;
+		goto out;
+	}
+	if ((rdd_count_t) st.st_size < s->count
+	&&  ftruncate(s->imagefd, (off_t) s->count) < 0) {
+		rc = RDD_EWRITE;
+		goto out;
+	}
+
+	if ((rc = fast_pass(s)) != RDD_OK) goto out;
+	if ((rc = trim_forward(s)) != RDD_OK) goto out;
+	if ((rc = trim_backward(s)) != RDD_OK) goto out;
+	if ((rc = scrape(s)) != RDD_OK) goto out;
+	if ((rc = rdd_map_save(s->map)) != RDD_OK) goto out;
+
+	if ((rc = replay(s, fset)) != RDD_OK) goto out;
+
+	ret->nbyte = s->count;
+	ret->nlost = rdd_map_count(s->map, RDD_MAP_BAD);
+	ret->nread_err = s->nread_err;
+	ret->nsubst = s->nsubst;
+
+out:
+	/* Always save the map, so that the rescue can be resumed.
+	 */
+	close_rc = rdd_close_rescue_map(s->map);
+	s->map = 0;
+	if (rc == RDD_OK) {
+		rc = close_rc;
+	}
+	if (s->imagefd >= 0) {
+		if (close(s->imagefd) < 0 && rc == RDD_OK) {
+			rc = RDD_ECLOSE;
+		}
+		s->imagefd = -1;
+	}
+	s->reader = 0;
+	return rc;
+}
+
+static int
+rescue_free(RDD_COPIER *c)
+{
+	RDD_RESCUE_COPIER *state = (RDD_RESCUE_COPIER *) c->state;
+	int rc;
+
+	if ((rc = rdd_free_alignedbuf(&state->readbuf)) != RDD_OK) {
+		return rc;
+	}
+	free(state->imagepath);
+	free(state->mappath);
+	return RDD_OK;
+}
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * The rescue map keeps a sorted array of extents.  Updates replace
+ * the extents that overlap the updated range by at most three new
+ * extents and then merge neighbours with equal states, so the array
+ * stays as short as possible.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "rescuemap.h"
+
+#define MAX_LINE   128
+#define MIN_EXT    64
+
+static int
+valid_state(int state)
+{
+	return state == RDD_MAP_UNTRIED || state == RDD_MAP_GOOD
+	    || state == RDD_MAP_BAD     || state == RDD_MAP_SKIPPED
+	    || state == RDD_MAP_TRIMMED;
+}
+
+/* Makes room for at least n extents.
+ */
+static int
+reserve(RDD_RESCUE_MAP *m, unsigned n)
+{
+	RDD_MAP_EXTENT *ext;
+	unsigned maxext;
+
+	if (n <= m->maxext) {
+		return RDD_OK;
+	}
+
+	maxext = m->maxext < MIN_EXT ? MIN_EXT : m->maxext;
+	while (maxext < n) {
+		maxext *= 2;
+	}
+	ext = realloc(m->ext, maxext * sizeof(RDD_MAP_EXTENT));
+	if (ext == 0) {
+		return RDD_NOMEM;
+	}
+	m->ext = ext;
+	m->maxext = maxext;
+	return RDD_OK;
+}
+
+/* Returns the index of the extent that contains pos.
+ */
+static unsigned
+find_extent(RDD_RESCUE_MAP *m, rdd_count_t pos)
+{
+	unsigned lo = 0;
+	unsigned hi = m->next;
+	unsigned mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (m->ext[mid].offset <= pos) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static int
+read_map(RDD_RESCUE_MAP *m, FILE *fp)
+{
+	char line[MAX_LINE];
+	unsigned long long offset;
+	unsigned long long length;
+	rdd_count_t pos = m->offset;
+	char state;
+	int rc;
+
+	while (fgets(line, MAX_LINE, fp) != NULL) {
+		if (strlen(line) >= MAX_LINE - 1) {
+			return RDD_ESYNTAX;
+		}
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		if (sscanf(line, "%llu %llu %c", &offset, &length, &state) != 3) {
+			return RDD_ESYNTAX;
+		}
+		if (!valid_state(state) || length == 0) {
+			return RDD_ESYNTAX;
+		}
+		if ((rdd_count_t) offset != pos) {
+			return RDD_ERANGE;
+		}
+		if ((rc = reserve(m, m->next + 1)) != RDD_OK) {
+			return rc;
+		}
+		if (m->next > 0 && m->ext[m->next - 1].state == state) {
+			m->ext[m->next - 1].length += (rdd_count_t) length;
+		} else {
+			m->ext[m->next].offset = (rdd_count_t) offset;
+			m->ext[m->next].length = (rdd_count_t) length;
+			m->ext[m->next].state = state;
+			m->next++;
+		}
+		pos += (rdd_count_t) length;
+	}
+	if (! feof(fp)) {
+		return RDD_ESYNTAX;
+	}
+	if (pos != m->offset + m->count) {
+		return RDD_ERANGE;
+	}
+
+	return RDD_OK;
+}
+
+int
+rdd_open_rescue_map(RDD_RESCUE_MAP **self, const char *path,
+		rdd_count_t offset, rdd_count_t count)
+{
+	RDD_RESCUE_MAP *m = 0;
+	FILE *fp = NULL;
+	int rc = RDD_OK;
+
+	if (count == RDD_WHOLE_FILE) return RDD_BADARG;
+
+	if ((m = calloc(1, sizeof(RDD_RESCUE_MAP))) == 0) {
+		return RDD_NOMEM;
+	}
+	if ((m->path = malloc(strlen(path) + 1)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	strcpy(m->path, path);
+	m->offset = offset;
+	m->count = count;
+	m->saved = rdd_gettime();
+
+	if ((fp = fopen(path, "r")) != NULL) {
+		rc = read_map(m, fp);
+		fclose(fp);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+	} else if (errno != ENOENT) {
+		rc = RDD_EOPEN;
+		goto error;
+	} else if (count > 0) {
+		if ((rc = reserve(m, 1)) != RDD_OK) {
+			goto error;
+		}
+		m->ext[0].offset = offset;
+		m->ext[0].length = count;
+		m->ext[0].state = RDD_MAP_UNTRIED;
+		m->next = 1;
+		m->ndirty = 1;
+	}
+
+	*self = m;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	free(m->ext);
+	free(m->path);
+	free(m);
+	return rc;
+}
+
+int
+rdd_close_rescue_map(RDD_RESCUE_MAP *m)
+{
+	int rc = RDD_OK;
+
+	if (m->ndirty > 0) {
+		rc = rdd_map_save(m);
+	}
+	free(m->ext);
+	free(m->path);
+	free(m);
+	return rc;
+}
+
+int
+rdd_map_set(RDD_RESCUE_MAP *m, rdd_count_t offset, rdd_count_t length,
+		int state)
+{
+	RDD_MAP_EXTENT repl[3];
+	rdd_count_t end = offset + length;
+	rdd_count_t xend;
+	unsigned first, last;
+	unsigned nrepl = 0;
+	unsigned nold;
+	unsigned i, k;
+	int rc;
+
+	if (length == 0) return RDD_OK;
+	if (!valid_state(state)) return RDD_BADARG;
+	if (offset < m->offset || end < offset) return RDD_BADARG;
+	if (end > m->offset + m->count) return RDD_BADARG;
+
+	first = find_extent(m, offset);
+	last = find_extent(m, end - 1);
+
+	/* Replace extents first..last by at most three extents: the
+	 * part of the first extent before offset, the new extent, and
+	 * the part of the last extent after end.
+	 */
+	if (m->ext[first].offset < offset) {
+		repl[nrepl].offset = m->ext[first].offset;
+		repl[nrepl].length = offset - m->ext[first].offset;
+		repl[nrepl].state = m->ext[first].state;
+		nrepl++;
+	}
+	repl[nrepl].offset = offset;
+	repl[nrepl].length = length;
+	repl[nrepl].state = state;
+	nrepl++;
+	xend = m->ext[last].offset + m->ext[last].length;
+	if (xend > end) {
+		repl[nrepl].offset = end;
+		repl[nrepl].length = xend - end;
+		repl[nrepl].state = m->ext[last].state;
+		nrepl++;
+	}
+
+	/* Absorb neighbours with the same state.
+	 */
+	if (first > 0 && m->ext[first - 1].state == repl[0].state) {
+		first--;
+		repl[0].offset = m->ext[first].offset;
+		repl[0].length += m->ext[first].length;
+	}
+	if (last + 1 < m->next && m->ext[last + 1].state == repl[nrepl-1].state) {
+		last++;
+		repl[nrepl-1].length += m->ext[last].length;
+	}
+	for (i = 1, k = 0; i < nrepl; i++) {
+		if (repl[i].state == repl[k].state) {
+			repl[k].length += repl[i].length;
+		} else {
+			repl[++k] = repl[i];
+		}
+	}
+	nrepl = k + 1;
+
+	nold = last - first + 1;
+	if (nrepl > nold) {
+		if ((rc = reserve(m, m->next + nrepl - nold)) != RDD_OK) {
+			return rc;
+		}
+	}
+	memmove(&m->ext[first + nrepl], &m->ext[last + 1],
+		(m->next - last - 1) * sizeof(RDD_MAP_EXTENT));
+	memcpy(&m->ext[first], repl, nrepl * sizeof(RDD_MAP_EXTENT));
+	m->next = m->next - nold + nrepl;
+	m->ndirty++;
+
+	return RDD_OK;
+}
+
+int
+rdd_map_find(RDD_RESCUE_MAP *m, int state, rdd_count_t pos,
+		rdd_count_t *offset, rdd_count_t *length)
+{
+	RDD_MAP_EXTENT *x;
+	unsigned i;
+
+	if (m->next == 0 || pos >= m->offset + m->count) {
+		return RDD_NOTFOUND;
+	}
+	if (pos < m->offset) {
+		pos = m->offset;
+	}
+
+	for (i = find_extent(m, pos); i < m->next; i++) {
+		x = &m->ext[i];
+		if (x->state == state) {
+			*offset = x->offset > pos ? x->offset : pos;
+			*length = x->offset + x->length - *offset;
+			return RDD_OK;
+		}
+	}
+	return RDD_NOTFOUND;
+}
+
+int
+rdd_map_find_last(RDD_RESCUE_MAP *m, int state, rdd_count_t pos,
+		rdd_count_t *offset, rdd_count_t *length)
+{
+	RDD_MAP_EXTENT *x;
+	rdd_count_t end;
+	unsigned i;
+
+	if (m->next == 0 || pos <= m->offset) {
+		return RDD_NOTFOUND;
+	}
+	if (pos > m->offset + m->count) {
+		pos = m->offset + m->count;
+	}
+
+	i = find_extent(m, pos - 1) + 1;
+	while (i-- > 0) {
+		x = &m->ext[i];
+		if (x->state == state) {
+			end = x->offset + x->length;
+			*offset = x->offset;
+			*length = (end < pos ? end : pos) - x->offset;
+			return RDD_OK;
+		}
+	}
+	return RDD_NOTFOUND;
+}
+
+rdd_count_t
+rdd_map_count(RDD_RESCUE_MAP *m, int state)
+{
+	rdd_count_t n = 0;
+	unsigned i;
+
+	for (i = 0; i < m->next; i++) {
+		if (m->ext[i].state == state) {
+			n += m->ext[i].length;
+		}
+	}
+	return n;
+}
+
+int
+rdd_map_save(RDD_RESCUE_MAP *m)
+{
+	char *tmppath = 0;
+	FILE *fp = NULL;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (m->presave != 0 && (rc = (*m->presave)(m->presave_env)) != RDD_OK) {
+		return rc;
+	}
+	if ((tmppath = malloc(strlen(m->path) + 5)) == 0) {
+		return RDD_NOMEM;
+	}
+	sprintf(tmppath, "%s.tmp", m->path);
+
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		rc = RDD_EOPEN;
+		goto out;
+	}
+	fprintf(fp, "# rdd rescue map\n");
+	fprintf(fp, "# offset length state\n");
+	for (i = 0; i < m->next; i++) {
+		fprintf(fp, "%llu %llu %c\n",
+			(unsigned long long) m->ext[i].offset,
+			(unsigned long long) m->ext[i].length,
+			m->ext[i].state);
+	}
+	if (fflush(fp) == EOF || ferror(fp) || fsync(fileno(fp)) < 0) {
+		fclose(fp);
+		rc = RDD_EWRITE;
+		goto out;
+	}
+	if (fclose(fp) == EOF) {
+		rc = RDD_ECLOSE;
+		goto out;
+	}
+	if (rename(tmppath, m->path) < 0) {
+		rc = RDD_EWRITE;
+		goto out;
+	}
+
+	m->ndirty = 0;
+	m->saved = rdd_gettime();
+
+out:
+	free(tmppath);
+	return rc;
+}
+
+void
+rdd_map_set_presave(RDD_RESCUE_MAP *m, rdd_map_presave_fun fun, void *env)
+{
+	m->presave = fun;
+	m->presave_env = env;
+}
+
+int
+rdd_map_sync(RDD_RESCUE_MAP *m, double interval)
+{
+	if (m->ndirty == 0 || rdd_gettime() - m->saved < interval) {
+		return RDD_OK;
+	}
+	return rdd_map_save(m);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __rescuemap_h__
+#define __rescuemap_h__
+
+/** @file
+ *  \brief Persistent map of the rescue state of an input range.
+ *
+ *  A rescue map divides an input range into extents.  Every byte of
+ *  the range is in exactly one extent, and every extent has one
+ *  state: untried, good, bad, skipped, or trimmed.  Adjacent extents always
+ *  have different states.  Skipped areas become trimmed when their
+ *  readable edges have been copied; only the scrape pass (see
+ *  rescuecopier.c) reads them again.
+ *
+ *  The map can be saved to a text file, one extent per line:
+ *  \verbatim
+ *  # rdd rescue map
+ *  # offset length state
+ *  0 1048576 +
+ *  1048576 65536 *
+ *  ...
+ *  \endverbatim
+ *  The file is replaced atomically (write, then rename), so an
+ *  interrupted copy leaves either the old or the new map behind.
+ */
+
+#define RDD_MAP_UNTRIED  '?'	/**< not read yet */
+#define RDD_MAP_GOOD     '+'	/**< read without errors */
+#define RDD_MAP_BAD      '-'	/**< unreadable; zeros in the image */
+#define RDD_MAP_SKIPPED  '*'	/**< skipped after a read error */
+#define RDD_MAP_TRIMMED  '/'	/**< skipped, edges already read */
+
+/** \brief Map extent.
+ */
+typedef struct _RDD_MAP_EXTENT {
+	rdd_count_t offset;	/**< input offset of the extent */
+	rdd_count_t length;	/**< extent length in bytes */
+	int         state;	/**< one of the RDD_MAP_ states */
+} RDD_MAP_EXTENT;
+
+/** \brief Rescue map.
+ */
+/** \brief Called before the map is saved; a save fails if this
+ *  routine does not return \c RDD_OK.
+ */
+typedef int (*rdd_map_presave_fun)(void *env);
+
+typedef struct _RDD_RESCUE_MAP {
+	char           *path;	/**< map file */
+	rdd_count_t     offset;	/**< start of the mapped range */
+	rdd_count_t     count;	/**< length of the mapped range */
+	RDD_MAP_EXTENT *ext;	/**< extents, sorted by offset */
+	unsigned        next;	/**< number of extents */
+	unsigned        maxext;	/**< capacity of \c ext */
+	unsigned        ndirty;	/**< updates since the last save */
+	double          saved;	/**< time of the last save */
+	rdd_map_presave_fun presave;	/**< called before each save, or 0 */
+	void           *presave_env;	/**< argument of \c presave */
+} RDD_RESCUE_MAP;
+
+/** \brief Opens a rescue map.
+ *  \param m output value: the new map.
+ *  \param path the map file.
+ *  \param offset start of the input range.
+ *  \param count length of the input range.
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_ESYNTAX if
+ *  the map file is malformed and \c RDD_ERANGE if it describes another
+ *  input range.
+ *
+ *  If \c path exists, the map is read from it; this is how an
+ *  interrupted rescue resumes.  Otherwise the whole range is untried.
+ */
+int rdd_open_rescue_map(RDD_RESCUE_MAP **m, const char *path,
+			rdd_count_t offset, rdd_count_t count);
+
+/** \brief Saves the map (if necessary) and releases it.
+ */
+int rdd_close_rescue_map(RDD_RESCUE_MAP *m);
+
+/** \brief Sets the state of [\c offset, \c offset + \c length).
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if the
+ *  range is not inside the mapped range.
+ *
+ *  The change is saved by the next \c rdd_map_save() or
+ *  \c rdd_map_sync().
+ */
+int rdd_map_set(RDD_RESCUE_MAP *m, rdd_count_t offset, rdd_count_t length,
+		int state);
+
+/** \brief Finds the first extent with state \c state that ends after
+ *  \c pos.
+ *  \param m the map
+ *  \param state the requested state
+ *  \param pos search position
+ *  \param offset output value: start of the extent part after \c pos.
+ *  \param length output value: length of that part.
+ *  \return Returns \c RDD_OK on success and \c RDD_NOTFOUND if there is
+ *  no such extent.
+ */
+int rdd_map_find(RDD_RESCUE_MAP *m, int state, rdd_count_t pos,
+		rdd_count_t *offset, rdd_count_t *length);
+
+/** \brief Like \c rdd_map_find(), but searches backwards for the
+ *  last extent with state \c state that starts before \c pos.
+ */
+int rdd_map_find_last(RDD_RESCUE_MAP *m, int state, rdd_count_t pos,
+		rdd_count_t *offset, rdd_count_t *length);
+
+/** \brief Returns the number of bytes with state \c state.
+ */
+rdd_count_t rdd_map_count(RDD_RESCUE_MAP *m, int state);
+
+/** \brief Installs a routine that runs before every save of the map.
+ *  \param m the map
+ *  \param fun the routine, or 0
+ *  \param env the argument of \c fun
+ *
+ *  The rescue copier uses it to flush the image to disk, so that
+ *  the map never records data as good before that data is stable.
+ */
+void rdd_map_set_presave(RDD_RESCUE_MAP *m, rdd_map_presave_fun fun,
+		void *env);
+
+/** \brief Writes the map to its file.
+ */
+int rdd_map_save(RDD_RESCUE_MAP *m);
+
+/** \brief Writes the map to its file if it has changed and the
+ *  last save is more than \c interval seconds ago.
+ */
+int rdd_map_sync(RDD_RESCUE_MAP *m, double interval);
+
+#endif /* __rescuemap_h__ */
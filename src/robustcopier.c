@@ -62,11 +62,29 @@ static char copyright[] =
 #include "error.h"
 #include "netio.h"
 #include "alignedbuf.h"
+#include "checkpoint.h"
 
 #define KNOWN_INPUT_SIZE(s)   ((s)->count != RDD_WHOLE_FILE)
 
 typedef enum _read_mode_t { READ_OK, READ_ERROR, READ_RECOVERY } read_mode_t;
 
+/* Adaptive block sizing.  Block lengths form a ladder
+ * minblocklen, 2 * minblocklen, ..., maxblocklen.  For each length
+ * we keep a moving average of the throughput and of the read latency.
+ */
+#define ADAPT_MAX_LEVEL   32
+#define ADAPT_WEIGHT      0.25	/* weight of a new sample in the averages */
+#define ADAPT_MIN_SAMPLE  4	/* reads before we judge a block length */
+#define ADAPT_HYSTERESIS  0.05	/* required relative throughput gain */
+#define ADAPT_SPIKE       4.0	/* latency spike: this times the average */
+#define ADAPT_REPROBE     256	/* reads before neighbours are re-measured */
+
+typedef struct _RDD_ADAPT_LEVEL {
+	double   tput;		/* average throughput (bytes/s) */
+	double   latency;	/* average read time (s) */
+	unsigned nsample;	/* 0 means: not measured (yet) */
+} RDD_ADAPT_LEVEL;
+
 typedef struct _RDD_ROBUST_COPIER {
 	read_mode_t mode;
 	rdd_count_t offset;		/* start reading at this position */
@@ -89,12 +107,21 @@ typedef struct _RDD_ROBUST_COPIER {
 	unsigned    nok;		/* only valid in READ_RECOVERY mode */
 	unsigned    ntry;		/* only valid in READ_ERROR mode */
 
+	int         adaptive;
+	unsigned    nlevel;		/* number of block lengths in the ladder */
+	unsigned    level;		/* current ladder position */
+	unsigned    nlevelread;		/* full reads at the current position */
+	unsigned    nsettled;		/* reads since the last change */
+	RDD_ADAPT_LEVEL levels[ADAPT_MAX_LEVEL];
+
 	rdd_readerrhandler_t  readerrfun;
 	void                 *readerrenv;
 	rdd_substhandler_t    substfun;
 	void                 *substenv;
 	rdd_proghandler_t     progressfun;
 	void                 *progressenv;
+	rdd_blocklenhandler_t blocklenfun;
+	void                 *blocklenenv;
 
 	RDD_ALIGNEDBUF readbuf;
 } RDD_ROBUST_COPIER;
@@ -103,10 +130,16 @@ static int robust_exec(RDD_COPIER *c, RDD_READER *r,
 				      RDD_FILTERSET *fset,
 				      RDD_COPIER_RETURN *ret);
 static int robust_free(RDD_COPIER *c);
+static unsigned adapt_blocklen(RDD_ROBUST_COPIER *s, unsigned level);
+static int robust_save(RDD_COPIER *c, RDD_CHECKPOINT *cp, const char *name);
+static int robust_restore(RDD_COPIER *c, RDD_CHECKPOINT *cp,
+			const char *name);
 
 static RDD_COPY_OPS robust_ops = {
 	robust_exec,
-	robust_free
+	robust_free,
+	robust_save,
+	robust_restore
 };
 
 int
@@ -143,6 +176,8 @@ rdd_new_robust_copier(RDD_COPIER **self,
 	state->substenv = p->substenv;
 	state->progressfun = p->progressfun;
 	state->progressenv = p->progressenv;
+	state->blocklenfun = p->blocklenfun;
+	state->blocklenenv = p->blocklenenv;
 	state->verbose = 1;
 
 	state->nretry = p->nretry;
@@ -156,6 +191,16 @@ rdd_new_robust_copier(RDD_COPIER **self,
 	state->nok = 0;
 	state->ntry = 0;
 
+	state->adaptive = p->adaptive;
+	state->nlevel = 1;
+	while (adapt_blocklen(state, state->nlevel - 1) < state->maxblocklen) {
+		state->nlevel++;
+	}
+	state->level = state->nlevel - 1;
+	state->nlevelread = 0;
+	state->nsettled = 0;
+	memset(state->levels, 0, sizeof state->levels);
+
 	/* Allocate a sector-aligned buffer.  Alignment is required
 	 * when rdd access a raw device (Linux: /dev/raw/raw1, ...).
 	 * It never hurts, so we always do this.
@@ -181,6 +226,129 @@ error:
 	return rc;
 }
 
+/* Returns the block length at position level of the ladder.
+ */
+static unsigned
+adapt_blocklen(RDD_ROBUST_COPIER *s, unsigned level)
+{
+	unsigned len = s->minblocklen;
+
+	while (level-- > 0 && len < s->maxblocklen) {
+		len = len > s->maxblocklen / 2 ? s->maxblocklen : 2 * len;
+	}
+	return len;
+}
+
+/* Returns the highest ladder position whose block length does
+ * not exceed len.
+ */
+static unsigned
+adapt_level(RDD_ROBUST_COPIER *s, unsigned len)
+{
+	unsigned level = 0;
+
+	while (level + 1 < s->nlevel && adapt_blocklen(s, level + 1) <= len) {
+		level++;
+	}
+	return level;
+}
+
+static void
+adapt_move(RDD_ROBUST_COPIER *s, unsigned level)
+{
+	unsigned oldlen = s->curblocklen;
+	double tput = s->levels[s->level].tput;
+
+	s->level = level;
+	s->curblocklen = adapt_blocklen(s, level);
+	s->nlevelread = 0;
+	s->nsettled = 0;
+
+	if (s->blocklenfun != 0) {
+		(*s->blocklenfun)(s->offset + s->nbyte, oldlen,
+				s->curblocklen, tput, s->blocklenenv);
+	}
+}
+
+/* Records the time a successful full-length read took and decides
+ * whether to move along the block-length ladder.  The copier first
+ * measures every length it reaches, moving up while the next length is
+ * unmeasured and then down.  Once all neighbours are known it moves to
+ * the neighbour with the highest throughput if that beats the current
+ * length by more than ADAPT_HYSTERESIS.  Neighbour measurements age, so
+ * they are discarded every ADAPT_REPROBE reads.
+ */
+static void
+adapt_block_size(RDD_ROBUST_COPIER *s, unsigned nread, double elapsed)
+{
+	RDD_ADAPT_LEVEL *cur;
+	RDD_ADAPT_LEVEL *up;
+	RDD_ADAPT_LEVEL *down;
+	unsigned level;
+	double tput;
+
+	if (nread != s->curblocklen || elapsed <= 0.0) {
+		return;	/* short last block: no useful sample */
+	}
+
+	/* The block length may have changed behind our back (recovery
+	 * mode, restore from a checkpoint).
+	 */
+	level = adapt_level(s, s->curblocklen);
+	if (level != s->level || adapt_blocklen(s, level) != s->curblocklen) {
+		s->level = level;
+		s->curblocklen = adapt_blocklen(s, level);
+		s->nlevelread = 0;
+		return;
+	}
+
+	cur = &s->levels[level];
+	up = level + 1 < s->nlevel ? &s->levels[level + 1] : 0;
+	down = level > 0 ? &s->levels[level - 1] : 0;
+	tput = nread / elapsed;
+
+	if (cur->nsample >= ADAPT_MIN_SAMPLE
+	&&  elapsed > ADAPT_SPIKE * cur->latency) {
+		/* Latency spike: back off.  The spike does not enter
+		 * the averages, so the length is not penalized for long.
+		 */
+		if (down != 0) {
+			adapt_move(s, level - 1);
+		}
+		return;
+	}
+
+	if (cur->nsample == 0) {
+		cur->tput = tput;
+		cur->latency = elapsed;
+	} else {
+		cur->tput += ADAPT_WEIGHT * (tput - cur->tput);
+		cur->latency += ADAPT_WEIGHT * (elapsed - cur->latency);
+	}
+	cur->nsample++;
+
+	if (++s->nlevelread < ADAPT_MIN_SAMPLE) {
+		return;
+	}
+
+	if (up != 0 && up->nsample == 0) {
+		adapt_move(s, level + 1);
+	} else if (down != 0 && down->nsample == 0) {
+		adapt_move(s, level - 1);
+	} else if (up != 0
+	&&  up->tput > (1.0 + ADAPT_HYSTERESIS) * cur->tput
+	&&  (down == 0 || up->tput >= down->tput)) {
+		adapt_move(s, level + 1);
+	} else if (down != 0
+	&&  down->tput > (1.0 + ADAPT_HYSTERESIS) * cur->tput) {
+		adapt_move(s, level - 1);
+	} else if (++s->nsettled >= ADAPT_REPROBE) {
+		if (up != 0) up->nsample = 0;
+		if (down != 0) down->nsample = 0;
+		s->nsettled = 0;
+	}
+}
+
 static void
 handle_eof(RDD_ROBUST_COPIER *state)
 {
@@ -194,7 +362,8 @@ handle_eof(RDD_ROBUST_COPIER *state)
 }
 
 static void
-handle_read_ok(RDD_ROBUST_COPIER *state, unsigned rsize, unsigned nread)
+handle_read_ok(RDD_ROBUST_COPIER *state, unsigned rsize, unsigned nread,
+		double elapsed)
 {
 	/* Read appears to have succeeded.  Make sure it really did.
 	 */
@@ -207,7 +376,9 @@ handle_read_ok(RDD_ROBUST_COPIER *state, unsigned rsize, unsigned nread)
 	 */
 	switch (state->mode) {
 	case READ_OK:
-		if (nread >= state->curblocklen
+		if (state->adaptive) {
+			adapt_block_size(state, nread, elapsed);
+		} else if (nread >= state->curblocklen
 		&& state->curblocklen < state->maxblocklen) {
 			unsigned oldsize = state->curblocklen;
 			state->curblocklen *= 2;
@@ -334,6 +505,7 @@ robust_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
 	RDD_UINT32 rsize;
 	unsigned nread;
 	unsigned char *buf = 0;
+	double start;
 	int aborted = 0;
 	int rc = RDD_OK;
 
@@ -346,8 +518,11 @@ robust_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
 		return rc;
 	}
 
-	if (s->offset > 0) {
-		if ((rc = rdd_reader_skip(areader, s->offset)) != RDD_OK) {
+	/* After a restore, nbyte bytes have already been copied.
+	 */
+	if (s->offset + s->nbyte > 0) {
+		rc = rdd_reader_skip(areader, s->offset + s->nbyte);
+		if (rc != RDD_OK) {
 			return rc;
 		}
 	}
@@ -361,14 +536,24 @@ robust_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
 			rsize = (RDD_UINT32) (s->count - s->nbyte);
 		}
 
-		buf = s->readbuf.aligned;
+		/* With filter threads, read straight into a buffer
+		 * that the filters share.
+		 */
+		rc = rdd_fset_get_buffer(fset, rsize, &buf);
+		if (rc == RDD_NOTFOUND) {
+			buf = s->readbuf.aligned;
+		} else if (rc != RDD_OK) {
+			return rc;
+		}
 		nread = 0;
+		start = s->adaptive ? rdd_gettime() : 0.0;
 		rc = rdd_reader_read(areader, buf, rsize, &nread);
 		if (rc == RDD_OK && nread == 0) {
 			handle_eof(s);
 			break;
 		} else if (rc == RDD_OK && nread > 0) {
-			handle_read_ok(s, rsize, nread);
+			handle_read_ok(s, rsize, nread,
+				s->adaptive ? rdd_gettime() - start : 0.0);
 			rc = rdd_fset_push(fset, buf, nread);
 			if (rc != RDD_OK) {
 				return rc;
@@ -467,3 +652,83 @@ robust_free(RDD_COPIER *c)
 
 	return rdd_free_alignedbuf(&state->readbuf);
 }
+
+/* The copier position, its statistics, and its read mode are saved.
+ * The input range is saved as well, so that a checkpoint cannot be
+ * resumed with a different offset or count.
+ */
+static int
+robust_save(RDD_COPIER *c, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_ROBUST_COPIER *s = (RDD_ROBUST_COPIER *) c->state;
+	int mode = (int) s->mode;
+	int rc;
+
+	if ((rc = rdd_ckpt_put_count(cp, name, "offset", s->offset)) != RDD_OK
+	||  (rc = rdd_ckpt_put_count(cp, name, "count", s->count)) != RDD_OK
+	||  (rc = rdd_ckpt_put_count(cp, name, "nbyte", s->nbyte)) != RDD_OK
+	||  (rc = rdd_ckpt_put_count(cp, name, "nlost", s->nlost)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_put(cp, name, "nread_err",
+			&s->nread_err, sizeof s->nread_err)) != RDD_OK
+	||  (rc = rdd_ckpt_put(cp, name, "nsubst",
+			&s->nsubst, sizeof s->nsubst)) != RDD_OK
+	||  (rc = rdd_ckpt_put(cp, name, "mode",
+			&mode, sizeof mode)) != RDD_OK
+	||  (rc = rdd_ckpt_put(cp, name, "curblocklen",
+			&s->curblocklen, sizeof s->curblocklen)) != RDD_OK
+	||  (rc = rdd_ckpt_put(cp, name, "nok",
+			&s->nok, sizeof s->nok)) != RDD_OK
+	||  (rc = rdd_ckpt_put(cp, name, "ntry",
+			&s->ntry, sizeof s->ntry)) != RDD_OK) {
+		return rc;
+	}
+
+	return RDD_OK;
+}
+
+static int
+robust_restore(RDD_COPIER *c, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_ROBUST_COPIER *s = (RDD_ROBUST_COPIER *) c->state;
+	rdd_count_t offset, count;
+	int mode;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "offset", &offset)) != RDD_OK
+	||  (rc = rdd_ckpt_get_count(cp, name, "count", &count)) != RDD_OK) {
+		return rc;
+	}
+	if (offset != s->offset || count != s->count) {
+		return RDD_ERANGE;
+	}
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "nbyte", &s->nbyte)) != RDD_OK
+	||  (rc = rdd_ckpt_get_count(cp, name, "nlost", &s->nlost)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_get(cp, name, "nread_err",
+			&s->nread_err, sizeof s->nread_err)) != RDD_OK
+	||  (rc = rdd_ckpt_get(cp, name, "nsubst",
+			&s->nsubst, sizeof s->nsubst)) != RDD_OK
+	||  (rc = rdd_ckpt_get(cp, name, "mode",
+			&mode, sizeof mode)) != RDD_OK
+	||  (rc = rdd_ckpt_get(cp, name, "curblocklen",
+			&s->curblocklen, sizeof s->curblocklen)) != RDD_OK
+	||  (rc = rdd_ckpt_get(cp, name, "nok",
+			&s->nok, sizeof s->nok)) != RDD_OK
+	||  (rc = rdd_ckpt_get(cp, name, "ntry",
+			&s->ntry, sizeof s->ntry)) != RDD_OK) {
+		return rc;
+	}
+	if (s->curblocklen < s->minblocklen || s->curblocklen > s->maxblocklen) {
+		return RDD_ERANGE;
+	}
+	if (mode != READ_OK && mode != READ_ERROR && mode != READ_RECOVERY) {
+		return RDD_ESYNTAX;
+	}
+	s->mode = (read_mode_t) mode;
+
+	return RDD_OK;
+}
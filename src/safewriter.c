@@ -55,10 +55,18 @@ static char copyright[] =
  */
 static int safe_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
 static int safe_close(RDD_WRITER *w);
+static int safe_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+			const char *name);
+static int safe_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+			const char *name);
+static int safe_holes(RDD_WRITER *w, rdd_count_t *nbyte);
 
 static RDD_WRITE_OPS safe_write_ops = {
 	safe_write,
-	safe_close
+	safe_close,
+	safe_save,
+	safe_restore,
+	safe_holes
 };
 
 typedef struct _RDD_SAFE_WRITER {
@@ -75,6 +83,29 @@ path_exists(const char *path, struct stat *info)
 	return stat(path, info) != -1 || errno != ENOENT;
 }
 
+/* Opens path without truncating it.
+ */
+static int
+open_append(RDD_WRITER **w, const char *path, rdd_write_mode_t flags)
+{
+	int fd;
+
+	if ((fd = open(path, O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR)) < 0) {
+		return RDD_EOPEN;
+	}
+	if (lseek(fd, (off_t) 0, SEEK_END) == (off_t) -1) {
+		close(fd);
+		return RDD_ESEEK;
+	}
+
+	if (flags & RDD_DIRECT) {
+		return rdd_open_direct_fd_writer(w, fd);
+	} else if (flags & RDD_SPARSE) {
+		return rdd_open_sparse_fd_writer(w, fd);
+	}
+	return rdd_open_fd_writer(w, fd);
+}
+
 int
 rdd_open_safe_writer(RDD_WRITER **self, const char *path,
 			rdd_write_mode_t wmode)
@@ -84,7 +115,12 @@ rdd_open_safe_writer(RDD_WRITER **self, const char *path,
 	struct stat statinfo;
 	int rc = RDD_OK;
 	char *pathcopy = 0;
+	rdd_write_mode_t flags = wmode & (RDD_SPARSE|RDD_DIRECT);
 
+	if (flags == (RDD_SPARSE|RDD_DIRECT)) {
+		return RDD_BADARG;
+	}
+	wmode = RDD_WRITE_MODE(wmode);
 	if (wmode == RDD_NO_OVERWRITE && path_exists(path, &statinfo)) {
 		rc = RDD_EEXISTS;
 		goto error;
@@ -103,7 +139,15 @@ rdd_open_safe_writer(RDD_WRITER **self, const char *path,
 	strcpy(pathcopy, path);
 	state->path = pathcopy;
 
-	rc = rdd_open_file_writer(&state->parent, path);
+	if (wmode == RDD_APPEND) {
+		rc = open_append(&state->parent, path, flags);
+	} else if (flags & RDD_DIRECT) {
+		rc = rdd_open_direct_writer(&state->parent, path);
+	} else if (flags & RDD_SPARSE) {
+		rc = rdd_open_sparse_file_writer(&state->parent, path);
+	} else {
+		rc = rdd_open_file_writer(&state->parent, path);
+	}
 	if (rc != RDD_OK) {
 		goto error;
 	}
@@ -154,3 +198,27 @@ safe_close(RDD_WRITER *self)
 
 	return RDD_OK;
 }
+
+static int
+safe_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_SAFE_WRITER *state = w->state;
+
+	return rdd_writer_save(state->parent, cp, name);
+}
+
+static int
+safe_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_SAFE_WRITER *state = w->state;
+
+	return rdd_writer_restore(state->parent, cp, name);
+}
+
+static int
+safe_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	RDD_SAFE_WRITER *state = w->state;
+
+	return rdd_writer_holes(state->parent, nbyte);
+}
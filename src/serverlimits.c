@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the resource limits of a multi-session server (see
+ * serverlimits.h).
+ *
+ * The limits object is a single anonymous shared mapping, so the
+ * session processes that the server forks all see the same object.
+ * It is protected by a process-shared mutex.  The mutex is robust:
+ * if a session process dies while it holds the mutex, the next
+ * process that locks it takes over.
+ *
+ * Bandwidth is limited with a token bucket.  A session that wants
+ * to transfer more than the bucket holds takes the tokens anyway
+ * and sleeps for the time it takes to earn the deficit; sessions
+ * that follow queue up behind it, so the total rate stays within
+ * the budget.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "serverlimits.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* The bucket holds at most BURST_SECS seconds' worth of tokens.
+ */
+#define BURST_SECS	0.1
+
+struct _RDD_SERVER_LIMITS {
+	pthread_mutex_t lock;
+	pthread_cond_t  freed;		/* memory has been released */
+	size_t          size;		/* size of the mapping */
+	unsigned        nslot;
+	rdd_count_t     max_memory;
+	rdd_count_t     used;		/* memory reserved by all slots */
+	double          rate;		/* bytes per second */
+	double          tokens;
+	double          last;		/* time of the last refill */
+	rdd_count_t     reserved[1];	/* memory reserved per slot */
+};
+
+static int
+lock_limits(RDD_SERVER_LIMITS *sl)
+{
+	int rc = pthread_mutex_lock(&sl->lock);
+
+	if (rc == EOWNERDEAD) {
+		rc = pthread_mutex_consistent(&sl->lock);
+	}
+	return rc == 0 ? RDD_OK : RDD_ABORTED;
+}
+
+static void
+unlock_limits(RDD_SERVER_LIMITS *sl)
+{
+	(void) pthread_mutex_unlock(&sl->lock);
+}
+
+int
+rdd_new_server_limits(RDD_SERVER_LIMITS **self, unsigned nslot,
+		rdd_count_t max_memory, rdd_count_t max_rate)
+{
+	RDD_SERVER_LIMITS *sl = 0;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	size_t size;
+	void *p;
+
+	if (nslot < 1) {
+		return RDD_BADARG;
+	}
+
+	size = sizeof(RDD_SERVER_LIMITS) + (nslot - 1) * sizeof(rdd_count_t);
+	p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+			-1, 0);
+	if (p == MAP_FAILED) {
+		return RDD_NOMEM;
+	}
+	sl = (RDD_SERVER_LIMITS *) p;
+	memset(sl, 0, size);
+	sl->size = size;
+	sl->nslot = nslot;
+	sl->max_memory = max_memory;
+	sl->rate = (double) max_rate;
+	sl->tokens = sl->rate * BURST_SECS;
+	sl->last = rdd_gettime();
+
+	if (pthread_mutexattr_init(&mattr) != 0) {
+		goto error;
+	}
+	if (pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED) != 0
+	||  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST) != 0
+	||  pthread_mutex_init(&sl->lock, &mattr) != 0) {
+		pthread_mutexattr_destroy(&mattr);
+		goto error;
+	}
+	pthread_mutexattr_destroy(&mattr);
+
+	if (pthread_condattr_init(&cattr) != 0) {
+		goto error;
+	}
+	if (pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED) != 0
+	||  pthread_cond_init(&sl->freed, &cattr) != 0) {
+		pthread_condattr_destroy(&cattr);
+		goto error;
+	}
+	pthread_condattr_destroy(&cattr);
+
+	*self = sl;
+	return RDD_OK;
+
+error:
+	munmap(p, size);
+	return RDD_ABORTED;
+}
+
+int
+rdd_free_server_limits(RDD_SERVER_LIMITS *sl)
+{
+	pthread_cond_destroy(&sl->freed);
+	pthread_mutex_destroy(&sl->lock);
+	if (munmap((void *) sl, sl->size) < 0) {
+		return RDD_ECLOSE;
+	}
+	return RDD_OK;
+}
+
+int
+rdd_server_limits_reserve(RDD_SERVER_LIMITS *sl, unsigned slot,
+		rdd_count_t nbyte)
+{
+	int rc;
+
+	if (slot >= sl->nslot) {
+		return RDD_BADARG;
+	}
+	if (sl->max_memory == 0) {
+		return RDD_OK;
+	}
+	if (nbyte > sl->max_memory) {
+		return RDD_ERANGE;
+	}
+
+	if ((rc = lock_limits(sl)) != RDD_OK) {
+		return rc;
+	}
+	while (sl->used + nbyte > sl->max_memory) {
+		rc = pthread_cond_wait(&sl->freed, &sl->lock);
+		if (rc == EOWNERDEAD) {
+			rc = pthread_mutex_consistent(&sl->lock);
+		}
+		if (rc != 0) {
+			unlock_limits(sl);
+			return RDD_ABORTED;
+		}
+	}
+	sl->used += nbyte;
+	sl->reserved[slot] += nbyte;
+	unlock_limits(sl);
+	return RDD_OK;
+}
+
+int
+rdd_server_limits_release(RDD_SERVER_LIMITS *sl, unsigned slot)
+{
+	int rc;
+
+	if (slot >= sl->nslot) {
+		return RDD_BADARG;
+	}
+	if ((rc = lock_limits(sl)) != RDD_OK) {
+		return rc;
+	}
+	sl->used -= sl->reserved[slot];
+	sl->reserved[slot] = 0;
+	pthread_cond_broadcast(&sl->freed);
+	unlock_limits(sl);
+	return RDD_OK;
+}
+
+int
+rdd_server_limits_throttle(RDD_SERVER_LIMITS *sl, unsigned nbyte)
+{
+	struct timespec ts;
+	double now, wait;
+	int rc;
+
+	if (sl->rate <= 0.0) {
+		return RDD_OK;
+	}
+
+	if ((rc = lock_limits(sl)) != RDD_OK) {
+		return rc;
+	}
+	now = rdd_gettime();
+	sl->tokens += (now - sl->last) * sl->rate;
+	if (sl->tokens > sl->rate * BURST_SECS) {
+		sl->tokens = sl->rate * BURST_SECS;
+	}
+	sl->last = now;
+	sl->tokens -= (double) nbyte;
+	wait = sl->tokens < 0.0 ? -sl->tokens / sl->rate : 0.0;
+	unlock_limits(sl);
+
+	if (wait > 0.0) {
+		ts.tv_sec = (time_t) wait;
+		ts.tv_nsec = (long) ((wait - (double) ts.tv_sec) * 1e9);
+		while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+			;
+	}
+	return RDD_OK;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef __serverlimits_h__
+#define __serverlimits_h__
+
+/** @file
+ *  \brief Resource limits shared by the sessions of an rdd server.
+ *
+ *  A server that serves several clients at once runs each session
+ *  in its own process.  The limits object lives in shared memory
+ *  that is inherited across \c fork(), so that all sessions draw
+ *  from the same memory budget and the same bandwidth budget.
+ *
+ *  Each session runs in a slot.  Memory is reserved per slot; the
+ *  server process releases a slot's reservation when the session
+ *  ends, also if the session process died.
+ */
+
+struct _RDD_SERVER_LIMITS;
+typedef struct _RDD_SERVER_LIMITS RDD_SERVER_LIMITS;
+
+/** \brief Creates a limits object in shared memory.
+ *  \param sl output value: the new limits object.
+ *  \param nslot the number of session slots.
+ *  \param max_memory the memory budget in bytes, or 0 for no limit.
+ *  \param max_rate the bandwidth budget in bytes per second, or 0
+ *         for no limit.
+ *  \return Returns \c RDD_OK on success.
+ */
+int rdd_new_server_limits(RDD_SERVER_LIMITS **sl, unsigned nslot,
+		rdd_count_t max_memory, rdd_count_t max_rate);
+
+/** \brief Releases a limits object.  No session may use it any more.
+ */
+int rdd_free_server_limits(RDD_SERVER_LIMITS *sl);
+
+/** \brief Reserves memory for the session in slot \c slot.
+ *  \return Returns \c RDD_OK on success.  Blocks until enough memory
+ *  is available.  Returns \c RDD_ERANGE if \c nbyte exceeds the
+ *  memory budget.
+ */
+int rdd_server_limits_reserve(RDD_SERVER_LIMITS *sl, unsigned slot,
+		rdd_count_t nbyte);
+
+/** \brief Releases all memory reserved for slot \c slot and wakes up
+ *  sessions that wait for memory.
+ */
+int rdd_server_limits_release(RDD_SERVER_LIMITS *sl, unsigned slot);
+
+/** \brief Waits until \c nbyte more bytes may be transferred without
+ *  exceeding the bandwidth budget of all sessions together.
+ */
+int rdd_server_limits_throttle(RDD_SERVER_LIMITS *sl, unsigned nbyte);
+
+#endif /* __serverlimits_h__ */
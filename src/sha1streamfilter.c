@@ -55,6 +55,7 @@ static char copyright[] =
 
 #include "writer.h"
 #include "filter.h"
+#include "checkpoint.h"
 
 typedef struct _RDD_SHA1_STREAM_FILTER {
 	SHA_CTX   sha1_state;
@@ -64,13 +65,17 @@ typedef struct _RDD_SHA1_STREAM_FILTER {
 static int sha1_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte);
 static int sha1_close(RDD_FILTER *f);
 static int sha1_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte);
+static int sha1_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int sha1_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
 
 static RDD_FILTER_OPS sha1_ops = {
 	sha1_input,
 	0,
 	sha1_close,
 	sha1_get_result,
-	0
+	0,
+	sha1_save,
+	sha1_restore
 };
 
 int
@@ -123,3 +128,21 @@ sha1_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
 
 	return RDD_OK;
 }
+
+static int
+sha1_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_SHA1_STREAM_FILTER *state = (RDD_SHA1_STREAM_FILTER *) f->state;
+
+	return rdd_ckpt_put(cp, name, "ctx",
+			&state->sha1_state, sizeof(SHA_CTX));
+}
+
+static int
+sha1_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_SHA1_STREAM_FILTER *state = (RDD_SHA1_STREAM_FILTER *) f->state;
+
+	return rdd_ckpt_get(cp, name, "ctx",
+			&state->sha1_state, sizeof(SHA_CTX));
+}
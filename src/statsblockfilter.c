@@ -39,9 +39,10 @@ static char copyright[] =
 #include <config.h>
 #endif
 
-#include <math.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "rdd.h"
@@ -49,19 +50,16 @@ static char copyright[] =
 #include "error.h"
 #include "writer.h"
 #include "filter.h"
-#include "msgprinter.h"
-
-#define NUM_BYTE_VAL   256
-
-#define RDD_LN2        0.69314718055994530942
+#include "outfile.h"
+#include "checkpoint.h"
+#include "histogram.h"
 
 typedef struct _RDD_STATS_BLOCKFILTER {
 	rdd_count_t     blocknum;
-	unsigned        histogram[NUM_BYTE_VAL];
-	unsigned        minbyte;
-	unsigned        maxbyte;
+	RDD_HISTOGRAM   hist;
+	pthread_key_t   worker_hist;	/* histogram of each digest() thread */
 	char           *path;
-	RDD_MSGPRINTER *printer;
+	FILE           *fp;
 } RDD_STATS_BLOCKFILTER;
 
 static int stats_input(RDD_FILTER *f,
@@ -69,16 +67,35 @@ static int stats_input(RDD_FILTER *f,
 static int stats_block(RDD_FILTER *f, unsigned nbyte);
 static int stats_close(RDD_FILTER *f);
 static int stats_free(RDD_FILTER *f);
+static int stats_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int stats_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int stats_digest(RDD_FILTER *f,
+			const unsigned char *buf, unsigned nbyte, void *result);
+static int stats_emit(RDD_FILTER *f, const void *result, unsigned nbyte);
 
 static RDD_FILTER_OPS stats_ops = {
 	stats_input,
 	stats_block,
 	stats_close,
 	0,
-	stats_free
+	stats_free,
+	stats_save,
+	stats_restore,
+	stats_digest,
+	stats_emit,
+	sizeof(RDD_HIST_STATS)
 };
 
 
+/* Frees the histogram of a digest() thread when the thread exits.
+ */
+static void
+free_worker_hist(void *p)
+{
+	rdd_hist_free((RDD_HISTOGRAM *) p);
+	free(p);
+}
+
 int
 rdd_new_stats_blockfilter(RDD_FILTER **self, unsigned blocksize,
 		const char *outpath, int force_overwrite)
@@ -86,7 +103,9 @@ rdd_new_stats_blockfilter(RDD_FILTER **self, unsigned blocksize,
 	RDD_FILTER *f = 0;
 	RDD_STATS_BLOCKFILTER *state = 0;
 	char *path = 0;
-	RDD_MSGPRINTER *prn = 0;
+	FILE *fp = NULL;
+	int have_hist = 0;
+	int have_key = 0;
 	int rc;
 
 	rc = rdd_new_filter(&f, &stats_ops, sizeof(RDD_STATS_BLOCKFILTER),
@@ -96,22 +115,30 @@ rdd_new_stats_blockfilter(RDD_FILTER **self, unsigned blocksize,
 	}
 	state = (RDD_STATS_BLOCKFILTER *) f->state;
 
+	if ((rc = rdd_hist_init(&state->hist, blocksize)) != RDD_OK) {
+		goto error;
+	}
+	have_hist = 1;
+
+	if (pthread_key_create(&state->worker_hist, free_worker_hist) != 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	have_key = 1;
+
 	if ((path = malloc(strlen(outpath) + 1)) == 0) {
 		rc = RDD_NOMEM;
 		goto error;
 	}
 	strcpy(path, outpath);
 
-	if ((rc = rdd_mp_open_file_printer(&prn, outpath)) != RDD_OK) {
+	if ((rc = outfile_fopen(&fp, outpath, force_overwrite)) != RDD_OK) {
 		goto error;
 	}
 
 	state->blocknum = 0;
-	memset(state->histogram, 0, sizeof(state->histogram));
-	state->minbyte = NUM_BYTE_VAL - 1;
-	state->maxbyte = 0;
 	state->path = path;
-	state->printer = prn;
+	state->fp = fp;
 
 	*self = f;
 	return RDD_OK;
@@ -119,48 +146,13 @@ rdd_new_stats_blockfilter(RDD_FILTER **self, unsigned blocksize,
 error:
 	*self = 0;
 	if (path != 0) free(path);
+	if (have_key) pthread_key_delete(state->worker_hist);
+	if (have_hist) rdd_hist_free(&state->hist);
 	if (state != 0) free(state);
 	if (f != 0) free(f);
 	return rc;
 }
 
-/** Computes block statistics based on the byte-value histogram.
- *  The modus is the byte value that occurs most in the block.
- *  Entropy measures randomness in a block.  It is computed as
- *  sum(-Pi * (log2(Pi))), where Pi is the occurrence frequency of
- *  byte value i and where i ranges over all byte values with positive Pi.
- */
-static void
-compute_histogram_stats(RDD_STATS_BLOCKFILTER *state,
-		unsigned block_size,
-		double *entropy,
-		unsigned *modus_byteval, unsigned *modus_count)
-{
-	unsigned byte, count;
-	unsigned mval, mcount;
-	double p, ent;
-
-	ent = 0.0;
-	mval = 0;
-	mcount = state->histogram[mval];
-
-	for (byte = 0; byte < NUM_BYTE_VAL; byte++) {
-		count = state->histogram[byte];
-		if (count > 0) {
-			p = ((double) count) / ((double) block_size);
-			ent += -p * (log(p) / RDD_LN2);
-		}
-		if (count > mcount) {
-			mval = byte;
-			mcount = count;
-		}
-	}
-
-	*entropy = ent;
-	*modus_byteval = mval;
-	*modus_count = mcount;
-}
-
 /** Uses the byte values in buf to update the histogramming
  *  statistics for the current block.
  */
@@ -168,43 +160,82 @@ static int
 stats_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 {
 	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
-	unsigned byte;
-	unsigned i;
 
-	for (i = 0; i < nbyte; i++) {
-		byte = buf[i];
-		state->histogram[byte]++;
-
-		if (byte < state->minbyte) state->minbyte = byte;
-		if (byte > state->maxbyte) state->maxbyte = byte;
-	}
+	rdd_hist_add(&state->hist, buf, nbyte);
 
 	return RDD_OK;
 }
 
 /** Computes and outputs the per-block histogramming statistics:
  *  entropy, mininum byte value, maximum byte value, and modus.
+ *  The modus is the byte value that occurs most in the block.
+ *  Entropy measures randomness in a block (see rdd_hist_stats()).
  */
 static int
 stats_block(RDD_FILTER *f, unsigned nbyte)
 {
 	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
-	unsigned modus, fmodus;
-	double entropy;
+	unsigned counts[RDD_HIST_NVAL];
+	RDD_HIST_STATS stats;
 
-	compute_histogram_stats(state, nbyte, &entropy, &modus, &fmodus);
+	rdd_hist_take(&state->hist, counts);
+	rdd_hist_stats(&state->hist, counts, nbyte, &stats);
 
-	rdd_mp_message(state->printer, RDD_MSG_INFO,
-		"%llu\t%u\t%u\t%u\t%u\t%lf",
-		state->blocknum,
-		state->minbyte, state->maxbyte,
-		modus, fmodus,
-		entropy);
+	return stats_emit(f, &stats, nbyte);
+}
+
+/** Computes the statistics of a whole block.  The block is counted
+ *  in a histogram that belongs to the calling worker thread and is
+ *  reused for all its blocks; only the (read-only) entropy table of
+ *  the filter's histogram is used.
+ */
+static int
+stats_digest(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte,
+		void *result)
+{
+	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
+	RDD_HISTOGRAM *hist;
+	unsigned counts[RDD_HIST_NVAL];
+	int rc;
+
+	hist = (RDD_HISTOGRAM *) pthread_getspecific(state->worker_hist);
+	if (hist == 0) {
+		if ((hist = malloc(sizeof(*hist))) == 0) {
+			return RDD_NOMEM;
+		}
+		if ((rc = rdd_hist_init(hist, 0)) != RDD_OK) {
+			free(hist);
+			return rc;
+		}
+		if (pthread_setspecific(state->worker_hist, hist) != 0) {
+			free_worker_hist(hist);
+			return RDD_NOMEM;
+		}
+	}
+	rdd_hist_add(hist, buf, nbyte);
+	rdd_hist_take(hist, counts);	/* also clears it for the next block */
+
+	rdd_hist_stats(&state->hist, counts, nbyte, (RDD_HIST_STATS *) result);
+
+	return RDD_OK;
+}
+
+static int
+stats_emit(RDD_FILTER *f, const void *result, unsigned nbyte)
+{
+	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
+	const RDD_HIST_STATS *stats = (const RDD_HIST_STATS *) result;
+
+	if (fprintf(state->fp,
+		"%llu\t%u\t%u\t%u\t%u\t%lf\n",
+		(unsigned long long) state->blocknum,
+		stats->minbyte, stats->maxbyte,
+		stats->modus, stats->modus_count,
+		stats->entropy) < 0) {
+		return RDD_EWRITE;
+	}
 
 	state->blocknum++;
-	memset(state->histogram, 0, sizeof(state->histogram));
-	state->minbyte = NUM_BYTE_VAL - 1;
-	state->maxbyte = 0;
 
 	return RDD_OK;
 }
@@ -213,12 +244,9 @@ static int
 stats_close(RDD_FILTER *f)
 {
 	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
-	int rc;
 
-	rc = rdd_mp_close(state->printer, RDD_MP_RECURSE|RDD_MP_READONLY);
-	if (rc != RDD_OK) {
-		return rc;
-	}
+	outfile_fclose(state->fp, state->path);
+	state->fp = NULL;
 
 	return RDD_OK;
 }
@@ -228,7 +256,61 @@ stats_free(RDD_FILTER *f)
 {
 	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
 
+	/* The workers are gone, so their histograms have been freed.
+	 */
 	free(state->path);
+	pthread_key_delete(state->worker_hist);
+	rdd_hist_free(&state->hist);
 
 	return RDD_OK;
 }
+
+static int
+stats_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
+	unsigned counts[RDD_HIST_NVAL];
+	rdd_count_t len;
+	int rc;
+
+	if ((rc = outfile_fsave(state->fp, &len)) != RDD_OK) {
+		return rc;
+	}
+	if ((rc = rdd_ckpt_put_count(cp, name, "filelen", len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_put_count(cp, name, "blocknum", state->blocknum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	/* The minimum and maximum byte values, which older versions
+	 * saved separately, follow from the histogram.
+	 */
+	rdd_hist_get(&state->hist, counts);
+	return rdd_ckpt_put(cp, name, "histogram", counts, sizeof counts);
+}
+
+static int
+stats_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_STATS_BLOCKFILTER *state = (RDD_STATS_BLOCKFILTER *) f->state;
+	unsigned counts[RDD_HIST_NVAL];
+	rdd_count_t len;
+	int rc;
+
+	if ((rc = rdd_ckpt_get_count(cp, name, "filelen", &len)) != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_get_count(cp, name, "blocknum", &state->blocknum);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rc = rdd_ckpt_get(cp, name, "histogram", counts, sizeof counts);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rdd_hist_put(&state->hist, counts);
+
+	return outfile_frestore(state->fp, len);
+}
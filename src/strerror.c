@@ -90,6 +90,8 @@ get_message(int rc)
 		return "not found";
 	case RDD_ABORTED:
 		return "operation has been aborted";
+	case RDD_ECHECKSUM:
+		return "checksum mismatch";
 	default:
 		return 0;
 	}
@@ -0,0 +1,663 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * A striped copier splits the input range into chunks and deals the
+ * chunks round-robin to N stripes: stripe k reads chunks k, k+N, k+2N,
+ * and so on.  Each stripe has its own input reader and its own thread,
+ * which runs an ordinary robust copier, so every stripe has independent
+ * retry state.  The robust copier reads from a stripe reader, a view
+ * that presents the stripe's chunks as one contiguous stream.
+ *
+ * Each stripe deposits its data in its own buffer queue.  The calling
+ * thread reorders the data: it takes one chunk from stripe 0, one
+ * from stripe 1, and so on, and pushes it into the client's filter
+ * set.  All filters (output, stream hashes, block filters) therefore
+ * see exactly the data stream that a sequential copy would produce.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "bufqueue.h"
+
+#define ABORT_NONE   0
+#define ABORT_USER   1	/* progress callback asked to stop */
+#define ABORT_SUBST  2	/* too many substitutions */
+
+struct _RDD_STRIPED_COPIER;
+
+typedef struct _RDD_STRIPE {
+	struct _RDD_STRIPED_COPIER *copier;
+	unsigned           index;
+	rdd_count_t        length;	/* number of bytes in this stripe */
+	RDD_COPIER        *robust;
+	RDD_BUFQUEUE      *queue;
+	RDD_FILTERSET      fset;	/* contains only the queue filter */
+	RDD_READER        *input;	/* input reader for this stripe */
+	RDD_READER        *reader;	/* stripe view on top of input */
+	pthread_t          thread;
+	RDD_COPIER_RETURN  ret;
+	int                rc;
+
+	RDD_BUFQ_SLOT     *slot;	/* slot being reordered */
+	unsigned           consumed;	/* bytes of slot already pushed */
+} RDD_STRIPE;
+
+typedef struct _RDD_STRIPED_COPIER {
+	rdd_count_t   offset;
+	rdd_count_t   count;
+	unsigned      chunklen;
+	unsigned      nstripe;
+	RDD_STRIPE   *stripes;
+
+	rdd_reader_opener_t  openfun;
+	void                *openenv;
+	rdd_readerrhandler_t readerrfun;
+	void                *readerrenv;
+	rdd_substhandler_t   substfun;
+	void                *substenv;
+	rdd_proghandler_t    progressfun;
+	void                *progressenv;
+	unsigned             maxsubst;
+
+	pthread_mutex_t lock;		/* protects the fields below and
+					 * serializes client callbacks */
+	unsigned      nsubst;
+	int           abort;
+} RDD_STRIPED_COPIER;
+
+typedef struct _RDD_STRIPE_READER {
+	RDD_STRIPED_COPIER *copier;
+	unsigned            index;
+	RDD_READER         *parent;
+	rdd_count_t         pos;	/* position within the stripe */
+} RDD_STRIPE_READER;
+
+static int striped_exec(RDD_COPIER *c, RDD_READER *r,
+				      RDD_FILTERSET *fset,
+				      RDD_COPIER_RETURN *ret);
+static int striped_free(RDD_COPIER *c);
+
+static RDD_COPY_OPS striped_ops = {
+	striped_exec,
+	striped_free
+};
+
+static int stripe_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int stripe_tell(RDD_READER *r, rdd_count_t *pos);
+static int stripe_seek(RDD_READER *r, rdd_count_t pos);
+static int stripe_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS stripe_read_ops = {
+	stripe_read,
+	stripe_tell,
+	stripe_seek,
+	stripe_close
+};
+
+/* Maps position pos within stripe index to an input position.
+ */
+static rdd_count_t
+input_pos(RDD_STRIPED_COPIER *s, unsigned index, rdd_count_t pos)
+{
+	rdd_count_t chunk = pos / s->chunklen;
+
+	return s->offset + (chunk * s->nstripe + index) * s->chunklen
+		+ pos % s->chunklen;
+}
+
+/* Stripe reader
+ */
+
+static int
+open_stripe_reader(RDD_READER **self, RDD_STRIPED_COPIER *s,
+		unsigned index, RDD_READER *parent)
+{
+	RDD_READER *r = 0;
+	RDD_STRIPE_READER *state = 0;
+	int rc;
+
+	rc = rdd_new_reader(&r, &stripe_read_ops, sizeof(RDD_STRIPE_READER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state = (RDD_STRIPE_READER *) r->state;
+	state->copier = s;
+	state->index = index;
+	state->parent = parent;
+	state->pos = 0;
+
+	*self = r;
+	return RDD_OK;
+}
+
+/* Reads never cross a chunk boundary in a single parent read.
+ * If a parent read fails, the stripe position is left unchanged.
+ */
+static int
+stripe_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+		unsigned *nread)
+{
+	RDD_STRIPE_READER *state = self->state;
+	RDD_STRIPED_COPIER *s = state->copier;
+	rdd_count_t pos = state->pos;
+	unsigned done = 0;
+	unsigned inchunk;
+	unsigned n;
+	unsigned got;
+	int rc;
+
+	while (done < nbyte) {
+		inchunk = s->chunklen - (unsigned) (pos % s->chunklen);
+		n = nbyte - done < inchunk ? nbyte - done : inchunk;
+
+		rc = rdd_reader_seek(state->parent,
+				input_pos(s, state->index, pos));
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		rc = rdd_reader_read(state->parent, buf + done, n, &got);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		done += got;
+		pos += got;
+		if (got < n) {
+			break;	/* reached EOF */
+		}
+	}
+
+	state->pos = pos;
+	*nread = done;
+	return RDD_OK;
+}
+
+static int
+stripe_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_STRIPE_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+stripe_seek(RDD_READER *self, rdd_count_t pos)
+{
+	RDD_STRIPE_READER *state = self->state;
+
+	state->pos = pos;
+	return RDD_OK;
+}
+
+static int
+stripe_close(RDD_READER *self, int recurse)
+{
+	RDD_STRIPE_READER *state = self->state;
+
+	if (recurse) {
+		return rdd_reader_close(state->parent, 1);
+	} else {
+		return RDD_OK;
+	}
+}
+
+/* Callbacks of the per-stripe robust copiers.  These run on the
+ * stripe threads; they translate stripe positions to input positions
+ * and call the client's callbacks one at a time.
+ */
+
+static void
+report_range(RDD_STRIPE *st, rdd_readerrhandler_t fun, void *env,
+		rdd_count_t pos, unsigned nbyte)
+{
+	RDD_STRIPED_COPIER *s = st->copier;
+	unsigned inchunk;
+	unsigned n;
+
+	while (nbyte > 0) {
+		inchunk = s->chunklen - (unsigned) (pos % s->chunklen);
+		n = nbyte < inchunk ? nbyte : inchunk;
+		(*fun)(input_pos(s, st->index, pos), n, env);
+		pos += n;
+		nbyte -= n;
+	}
+}
+
+static void
+stripe_readerr(rdd_count_t pos, unsigned nbyte, void *env)
+{
+	RDD_STRIPE *st = (RDD_STRIPE *) env;
+	RDD_STRIPED_COPIER *s = st->copier;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->readerrfun != 0) {
+		report_range(st, s->readerrfun, s->readerrenv, pos, nbyte);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void
+stripe_subst(rdd_count_t pos, unsigned nbyte, void *env)
+{
+	RDD_STRIPE *st = (RDD_STRIPE *) env;
+	RDD_STRIPED_COPIER *s = st->copier;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->maxsubst > 0 && (s->nsubst+1) >= s->maxsubst) {
+		/* A robust copier gives up instead of making this
+		 * substitution, so neither count nor report it.
+		 */
+		if (s->abort == ABORT_NONE) {
+			s->abort = ABORT_SUBST;
+		}
+	} else {
+		if (s->substfun != 0) {
+			report_range(st, s->substfun, s->substenv, pos, nbyte);
+		}
+		s->nsubst++;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+static int
+stripe_progress(rdd_count_t ncopied, void *env)
+{
+	RDD_STRIPE *st = (RDD_STRIPE *) env;
+	RDD_STRIPED_COPIER *s = st->copier;
+	int abort;
+
+	(void) ncopied;
+
+	pthread_mutex_lock(&s->lock);
+	abort = s->abort;
+	pthread_mutex_unlock(&s->lock);
+
+	return abort != ABORT_NONE ? RDD_ABORTED : RDD_OK;
+}
+
+int
+rdd_new_striped_copier(RDD_COPIER **self,
+		rdd_count_t offset, rdd_count_t count,
+		unsigned nstripe, unsigned chunklen, unsigned nbuf,
+		rdd_reader_opener_t openfun, void *openenv,
+		RDD_ROBUST_PARAMS *p)
+{
+	RDD_COPIER *c = 0;
+	RDD_STRIPED_COPIER *state = 0;
+	RDD_ROBUST_PARAMS sp;
+	RDD_STRIPE *st;
+	RDD_FILTER *f = 0;
+	rdd_count_t nchunk;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (nstripe < 1 || chunklen < 1 || nbuf < 2) return RDD_BADARG;
+	if (count == RDD_WHOLE_FILE) return RDD_BADARG;
+	if (nstripe > 1 && openfun == 0) return RDD_BADARG;
+
+	rc = rdd_new_copier(&c, &striped_ops, sizeof(RDD_STRIPED_COPIER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_STRIPED_COPIER *) c->state;
+
+	state->offset = offset;
+	state->count = count;
+	state->chunklen = chunklen;
+	state->nstripe = nstripe;
+	state->openfun = openfun;
+	state->openenv = openenv;
+	state->readerrfun = p->readerrfun;
+	state->readerrenv = p->readerrenv;
+	state->substfun = p->substfun;
+	state->substenv = p->substenv;
+	state->progressfun = p->progressfun;
+	state->progressenv = p->progressenv;
+	state->maxsubst = p->maxsubst;
+	state->nsubst = 0;
+	state->abort = ABORT_NONE;
+	pthread_mutex_init(&state->lock, 0);
+
+	if ((state->stripes = calloc(nstripe, sizeof(RDD_STRIPE))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	nchunk = (count + chunklen - 1) / chunklen;
+	for (i = 0; i < nstripe; i++) {
+		st = &state->stripes[i];
+		st->copier = state;
+		st->index = i;
+		rdd_fset_init(&st->fset);
+
+		/* Stripe i owns chunks i, i + nstripe, ...; the last
+		 * chunk of the range may be short.
+		 */
+		st->length = (nchunk / nstripe + (i < nchunk % nstripe))
+				* chunklen;
+		if (nchunk > 0 && (nchunk - 1) % nstripe == i) {
+			st->length -= nchunk * chunklen - count;
+		}
+
+		/* Substitutions are limited for all stripes together.
+		 */
+		sp = *p;
+		sp.readerrfun = stripe_readerr;
+		sp.readerrenv = st;
+		sp.substfun = stripe_subst;
+		sp.substenv = st;
+		sp.progressfun = stripe_progress;
+		sp.progressenv = st;
+		sp.maxsubst = 0;
+
+		/* Each stripe adapts its block length on its own; the
+		 * changes are not reported, as stripes run concurrently.
+		 */
+		sp.blocklenfun = 0;
+		sp.blocklenenv = 0;
+		rc = rdd_new_robust_copier(&st->robust, 0, st->length, &sp);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+
+		rc = rdd_new_bufqueue(&st->queue, nbuf, p->maxblocklen,
+					RDD_SECTOR_SIZE);
+		if (rc != RDD_OK) {
+			goto error;
+		}
+		if ((rc = rdd_new_queue_streamfilter(&f, st->queue)) != RDD_OK) {
+			goto error;
+		}
+		if ((rc = rdd_fset_add(&st->fset, "queue", f)) != RDD_OK) {
+			rdd_filter_free(f);
+			goto error;
+		}
+	}
+
+	*self = c;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	(void) striped_free(c);
+	free(c->state);
+	free(c);
+	return rc;
+}
+
+/* Body of a stripe thread.
+ */
+static void *
+stripe_stage(void *arg)
+{
+	RDD_STRIPE *st = (RDD_STRIPE *) arg;
+
+	st->rc = rdd_copy_exec(st->robust, st->reader, &st->fset, &st->ret);
+
+	if (st->rc == RDD_OK || st->rc == RDD_ABORTED) {
+		rdd_bufq_close(st->queue);
+	} else {
+		rdd_bufq_abort(st->queue, st->rc);
+	}
+
+	return 0;
+}
+
+/* Pushes the stripes' data into fset, one chunk per stripe in turn.
+ */
+static int
+reorder(RDD_STRIPED_COPIER *s, RDD_FILTERSET *fset, rdd_count_t *nbyte)
+{
+	RDD_STRIPE *st;
+	rdd_count_t chunk;
+	unsigned need;
+	unsigned n;
+	int rc;
+
+	for (chunk = 0; *nbyte < s->count; chunk++) {
+		st = &s->stripes[chunk % s->nstripe];
+		need = s->count - *nbyte < s->chunklen ?
+			(unsigned) (s->count - *nbyte) : s->chunklen;
+
+		while (need > 0) {
+			if (st->slot == 0) {
+				rc = rdd_bufq_get_full(st->queue, &st->slot);
+				if (rc != RDD_OK) {
+					st->slot = 0;
+					/* Closed early: the stripe gave up. */
+					return rc == RDD_NOTFOUND ?
+						RDD_ABORTED : rc;
+				}
+				st->consumed = 0;
+			}
+
+			n = st->slot->len - st->consumed;
+			if (n > need) {
+				n = need;
+			}
+			rc = rdd_fset_push(fset,
+					st->slot->buf + st->consumed, n);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			st->consumed += n;
+			need -= n;
+			*nbyte += n;
+
+			if (st->consumed == st->slot->len) {
+				rc = rdd_bufq_put_free(st->queue, st->slot);
+				st->slot = 0;
+				if (rc != RDD_OK) {
+					return rc;
+				}
+			}
+		}
+
+		if (s->progressfun != 0) {
+			rc = (*s->progressfun)(*nbyte, s->progressenv);
+			if (rc == RDD_ABORTED) {
+				pthread_mutex_lock(&s->lock);
+				if (s->abort == ABORT_NONE) {
+					s->abort = ABORT_USER;
+				}
+				pthread_mutex_unlock(&s->lock);
+				return RDD_ABORTED;
+			} else if (rc != RDD_OK) {
+				return rc;
+			}
+		}
+	}
+
+	return RDD_OK;
+}
+
+static int
+striped_exec(RDD_COPIER *c, RDD_READER *reader, RDD_FILTERSET *fset,
+					 RDD_COPIER_RETURN *ret)
+{
+	RDD_STRIPED_COPIER *s = (RDD_STRIPED_COPIER *) c->state;
+	RDD_STRIPE *st;
+	rdd_count_t nbyte = 0;
+	unsigned nstarted = 0;
+	unsigned i;
+	int abort;
+	int rc = RDD_OK;
+
+	memset(ret, 0, sizeof(*ret));
+
+	/* Stripe 0 reads from the client's reader; the other stripes
+	 * get their own readers.
+	 */
+	for (i = 0; i < s->nstripe; i++) {
+		st = &s->stripes[i];
+		if (i == 0) {
+			st->input = reader;
+		} else if ((rc = (*s->openfun)(&st->input, s->openenv))
+				!= RDD_OK) {
+			goto out;
+		}
+		rc = open_stripe_reader(&st->reader, s, i, st->input);
+		if (rc != RDD_OK) {
+			goto out;
+		}
+	}
+
+	for (i = 0; i < s->nstripe; i++) {
+		st = &s->stripes[i];
+		if (pthread_create(&st->thread, 0, stripe_stage, st) != 0) {
+			rc = RDD_NOMEM;
+			break;
+		}
+		nstarted++;
+	}
+
+	if (rc == RDD_OK) {
+		rc = reorder(s, fset, &nbyte);
+	}
+	if (rc != RDD_OK) {
+		/* Stop all stripes, including those that wait for
+		 * a free slot.
+		 */
+		for (i = 0; i < s->nstripe; i++) {
+			rdd_bufq_abort(s->stripes[i].queue,
+				rc == RDD_ABORTED ? RDD_ABORTED : rc);
+		}
+	}
+
+	for (i = 0; i < nstarted; i++) {
+		pthread_join(s->stripes[i].thread, 0);
+	}
+	if (nstarted < s->nstripe) {
+		goto out;
+	}
+
+	/* A stripe's own error takes precedence.
+	 */
+	for (i = 0; i < s->nstripe; i++) {
+		st = &s->stripes[i];
+		if (st->rc != RDD_OK && st->rc != RDD_ABORTED) {
+			rc = st->rc;
+			goto out;
+		}
+	}
+
+	pthread_mutex_lock(&s->lock);
+	abort = s->abort;
+	pthread_mutex_unlock(&s->lock);
+
+	if (abort == ABORT_SUBST) {
+		/* Like the robust copier, give up without closing the
+		 * filters, even if the stripes finished regardless.
+		 */
+		rc = RDD_ABORTED;
+	} else if (rc == RDD_OK || (rc == RDD_ABORTED && abort == ABORT_USER)) {
+		int close_rc;
+
+		if ((close_rc = rdd_fset_close(fset)) != RDD_OK) {
+			rc = close_rc;
+			goto out;
+		}
+
+		ret->nbyte = nbyte;
+		for (i = 0; i < s->nstripe; i++) {
+			st = &s->stripes[i];
+			ret->nlost += st->ret.nlost;
+			ret->nread_err += st->ret.nread_err;
+			ret->nsubst += st->ret.nsubst;
+		}
+	}
+
+out:
+	for (i = 0; i < s->nstripe; i++) {
+		st = &s->stripes[i];
+		if (st->reader != 0) {
+			(void) rdd_reader_close(st->reader, 0);
+			st->reader = 0;
+		}
+		if (i > 0 && st->input != 0) {
+			(void) rdd_reader_close(st->input, 1);
+		}
+		st->input = 0;
+	}
+	return rc;
+}
+
+static int
+striped_free(RDD_COPIER *c)
+{
+	RDD_STRIPED_COPIER *state = (RDD_STRIPED_COPIER *) c->state;
+	RDD_STRIPE *st;
+	unsigned i;
+	int rc;
+
+	for (i = 0; state->stripes != 0 && i < state->nstripe; i++) {
+		st = &state->stripes[i];
+		if ((rc = rdd_fset_clear(&st->fset)) != RDD_OK) {
+			return rc;
+		}
+		if (st->robust != 0
+		&&  (rc = rdd_copy_free(st->robust)) != RDD_OK) {
+			return rc;
+		}
+		if (st->queue != 0
+		&&  (rc = rdd_free_bufqueue(st->queue)) != RDD_OK) {
+			return rc;
+		}
+	}
+	free(state->stripes);
+	pthread_mutex_destroy(&state->lock);
+
+	return RDD_OK;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic reader interface (see reader.h)
+ *
+ * A stripe reader reassembles the stream written by a stripe writer
+ * (see stripewriter.c).  Frame k is read from parent k % nstream.
+ * Because the writer sends the frames round-robin, reading them in
+ * order never waits for data that is stuck behind another frame.
+ * Each frame offset is checked against the current stream position,
+ * and the stream ends only after every parent has delivered its
+ * end frame.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "msgprinter.h"
+#include "netio.h"
+
+typedef struct _RDD_STRIPE_READER {
+	RDD_READER  **streams;
+	unsigned      nstream;
+	unsigned      cur;	/* parent that holds the current frame */
+	unsigned      next;	/* parent that holds the next frame */
+	rdd_count_t   left;	/* unread data bytes in the current frame */
+	rdd_count_t   pos;	/* stream position */
+	int           eof;
+	int           err;	/* error held back until the next read */
+} RDD_STRIPE_READER;
+
+static int rdd_stripe_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_stripe_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_stripe_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_stripe_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS stripe_read_ops = {
+	rdd_stripe_read,
+	rdd_stripe_tell,
+	rdd_stripe_seek,
+	rdd_stripe_close
+};
+
+int
+rdd_open_stripe_reader(RDD_READER **self, RDD_READER **streams,
+			unsigned nstream)
+{
+	RDD_READER *r = 0;
+	RDD_STRIPE_READER *state = 0;
+	int rc = RDD_OK;
+
+	if (nstream < 1) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_reader(&r, &stripe_read_ops, sizeof(RDD_STRIPE_READER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_STRIPE_READER *) r->state;
+
+	if ((state->streams = malloc(nstream * sizeof(*streams))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	memcpy(state->streams, streams, nstream * sizeof(*streams));
+	state->nstream = nstream;
+
+	*self = r;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (state != 0) free(state);
+	if (r != 0) free(r);
+	return rc;
+}
+
+/* Reads exactly nbyte bytes from a parent.
+ */
+static int
+read_fully(RDD_READER *r, unsigned char *buf, unsigned nbyte)
+{
+	unsigned nread;
+	int rc;
+
+	while (nbyte > 0) {
+		if ((rc = rdd_reader_read(r, buf, nbyte, &nread)) != RDD_OK) {
+			return rc;
+		}
+		if (nread == 0) {
+			return RDD_ESYNTAX;	/* connection cut off */
+		}
+		buf += nread;
+		nbyte -= nread;
+	}
+
+	return RDD_OK;
+}
+
+/* Reads the header of the next frame.  An end frame from one parent
+ * must be followed by end frames from all other parents.
+ */
+static int
+next_frame(RDD_STRIPE_READER *state)
+{
+	unsigned char hdr[RDD_NET_FRAME_HDR_SIZE];
+	rdd_count_t offset, length;
+	unsigned i;
+	int rc;
+
+	rc = read_fully(state->streams[state->next], hdr, sizeof hdr);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	rdd_net_unpack_frame(hdr, &offset, &length);
+	state->cur = state->next;
+	state->next = (state->next + 1) % state->nstream;
+
+	if (offset != state->pos || length > RDD_NET_MAX_FRAME) {
+		return RDD_ESYNTAX;
+	}
+	if (length > 0) {
+		state->left = length;
+		return RDD_OK;
+	}
+
+	for (i = 1; i < state->nstream; i++) {
+		rc = read_fully(state->streams[state->next], hdr, sizeof hdr);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		rdd_net_unpack_frame(hdr, &offset, &length);
+		state->next = (state->next + 1) % state->nstream;
+		if (offset != state->pos || length != 0) {
+			return RDD_ESYNTAX;
+		}
+	}
+	state->eof = 1;
+	return RDD_OK;
+}
+
+static int
+rdd_stripe_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+		unsigned *nread)
+{
+	RDD_STRIPE_READER *state = self->state;
+	unsigned total = 0;
+	unsigned len;
+	int rc;
+
+	*nread = 0;
+	if (state->err != RDD_OK) {
+		return state->err;
+	}
+
+	while (total < nbyte && !state->eof) {
+		if (state->left == 0) {
+			if ((rc = next_frame(state)) == RDD_OK) {
+				continue;
+			}
+			if (total == 0) {
+				return rc;
+			}
+			/* Return the data that precedes the damage
+			 * first; the next read reports the error.
+			 */
+			state->err = rc;
+			break;
+		}
+
+		len = nbyte - total;
+		if (len > state->left) {
+			len = (unsigned) state->left;
+		}
+		rc = read_fully(state->streams[state->cur], buf + total, len);
+		if (rc != RDD_OK) {
+			return rc;
+		}
+		total += len;
+		state->left -= len;
+		state->pos += len;
+	}
+
+	*nread = total;
+	return RDD_OK;
+}
+
+static int
+rdd_stripe_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_STRIPE_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_stripe_seek(RDD_READER *self, rdd_count_t pos)
+{
+	RDD_STRIPE_READER *state = self->state;
+
+	if (pos == state->pos) {
+		return RDD_OK;
+	}
+	return RDD_ESEEK;
+}
+
+static int
+rdd_stripe_close(RDD_READER *self, int recurse)
+{
+	RDD_STRIPE_READER *state = self->state;
+	unsigned i;
+	int rc;
+
+	if (recurse) {
+		for (i = 0; i < state->nstream; i++) {
+			rc = rdd_reader_close(state->streams[i], 1);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+		}
+	}
+
+	free(state->streams);
+	return RDD_OK;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * A stripe writer spreads a byte stream over several parent writers,
+ * usually TCP connections to the same server.  A single connection
+ * cannot fill a link with a large bandwidth-delay product; several
+ * connections, each with its own window, can.
+ *
+ * The data is cut into frames of a fixed size.  Frame k is sent to
+ * parent k % nstream, preceded by a frame header that holds the
+ * stream offset of the frame and its length (see netio.h).  When the
+ * writer is closed, every parent receives an end frame with length
+ * zero, so that the reader can tell a complete stream from a
+ * connection that was cut off.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "reader.h"
+#include "msgprinter.h"
+#include "netio.h"
+
+typedef struct _RDD_STRIPE_WRITER {
+	RDD_WRITER   **streams;
+	unsigned       nstream;
+	unsigned       next;		/* parent that gets the next frame */
+	unsigned char *frame;		/* frame header and data */
+	unsigned       framesize;	/* maximum data bytes per frame */
+	unsigned       len;		/* data bytes in the current frame */
+	rdd_count_t    pos;		/* stream offset of the current frame */
+} RDD_STRIPE_WRITER;
+
+static int stripe_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int stripe_close(RDD_WRITER *w);
+
+static RDD_WRITE_OPS stripe_write_ops = {
+	stripe_write,
+	stripe_close,
+	0,
+	0,
+	0
+};
+
+int
+rdd_open_stripe_writer(RDD_WRITER **self, RDD_WRITER **streams,
+			unsigned nstream, unsigned framesize)
+{
+	RDD_WRITER *w = 0;
+	RDD_STRIPE_WRITER *state = 0;
+	int rc = RDD_OK;
+
+	if (nstream < 1 || framesize < 1 || framesize > RDD_NET_MAX_FRAME) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_writer(&w, &stripe_write_ops, sizeof(RDD_STRIPE_WRITER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_STRIPE_WRITER *) w->state;
+
+	state->streams = malloc(nstream * sizeof(*state->streams));
+	state->frame = malloc(RDD_NET_FRAME_HDR_SIZE + framesize);
+	if (state->streams == 0 || state->frame == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	memcpy(state->streams, streams, nstream * sizeof(*streams));
+	state->nstream = nstream;
+	state->framesize = framesize;
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (state != 0) {
+		free(state->frame);
+		free(state->streams);
+		free(state);
+	}
+	if (w != 0) free(w);
+	return rc;
+}
+
+/* Sends the current frame, which may be empty, to the next parent.
+ */
+static int
+send_frame(RDD_STRIPE_WRITER *state)
+{
+	int rc;
+
+	rdd_net_pack_frame(state->frame, state->pos, state->len);
+	rc = rdd_writer_write(state->streams[state->next], state->frame,
+			RDD_NET_FRAME_HDR_SIZE + state->len);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state->next = (state->next + 1) % state->nstream;
+	state->pos += state->len;
+	state->len = 0;
+	return RDD_OK;
+}
+
+static int
+stripe_write(RDD_WRITER *self, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_STRIPE_WRITER *state = self->state;
+	unsigned len;
+	int rc;
+
+	while (nbyte > 0) {
+		len = state->framesize - state->len;
+		if (len > nbyte) {
+			len = nbyte;
+		}
+		memcpy(state->frame + RDD_NET_FRAME_HDR_SIZE + state->len,
+			buf, len);
+		state->len += len;
+		buf += len;
+		nbyte -= len;
+
+		if (state->len == state->framesize) {
+			if ((rc = send_frame(state)) != RDD_OK) {
+				return rc;
+			}
+		}
+	}
+
+	return RDD_OK;
+}
+
+static int
+stripe_close(RDD_WRITER *self)
+{
+	RDD_STRIPE_WRITER *state = self->state;
+	unsigned i;
+	int rc;
+
+	if (state->len > 0 && (rc = send_frame(state)) != RDD_OK) {
+		return rc;
+	}
+
+	/* Every parent gets an end frame, in frame order.
+	 */
+	for (i = 0; i < state->nstream; i++) {
+		if ((rc = send_frame(state)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	for (i = 0; i < state->nstream; i++) {
+		if ((rc = rdd_writer_close(state->streams[i])) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	free(state->frame);
+	free(state->streams);
+	return RDD_OK;
+}
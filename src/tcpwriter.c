@@ -49,21 +49,29 @@ static char copyright[] =
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "rdd.h"
 #include "writer.h"
+#include "reader.h"
+#include "msgprinter.h"
+#include "netio.h"
 
+/* Connects to TCP port port on host and returns the socket in sock.
+ */
 int
-rdd_open_tcp_writer(RDD_WRITER **w, const char *host, unsigned port)
+rdd_tcp_connect(const char *host, unsigned port, int *sock)
 {
 	struct sockaddr_in addr;
 	struct hostent *he = 0;
-	int sock = -1;
+	int fd = -1;
 
-	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+	*sock = -1;
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
 		return RDD_ECONNECT;
 	}
 	if ((he = gethostbyname(host)) == NULL) {
+		(void) close(fd);
 		return RDD_ECONNECT;
 	}
 	memset(&addr, 0, sizeof(addr));
@@ -71,9 +79,24 @@ rdd_open_tcp_writer(RDD_WRITER **w, const char *host, unsigned port)
 	memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
 	addr.sin_port = htons(port);
 
-	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		(void) close(fd);
 		return RDD_ECONNECT;
 	}
 
+	*sock = fd;
+	return RDD_OK;
+}
+
+int
+rdd_open_tcp_writer(RDD_WRITER **w, const char *host, unsigned port)
+{
+	int sock = -1;
+	int rc;
+
+	if ((rc = rdd_tcp_connect(host, port, &sock)) != RDD_OK) {
+		return rc;
+	}
+
 	return rdd_open_fd_writer(w, sock);
 }
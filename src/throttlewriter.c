@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * Implements the generic writer interface (see writer.h)
+ *
+ * A throttle writer asks a callback for permission before it passes
+ * data on to its parent.  The callback may block; it is used to keep
+ * the output of several server sessions within a shared bandwidth
+ * budget (see serverlimits.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "rdd.h"
+#include "writer.h"
+
+typedef struct _RDD_THROTTLE_WRITER {
+	RDD_WRITER      *parent;
+	rdd_throttle_fun throttle;
+	void            *env;
+} RDD_THROTTLE_WRITER;
+
+static int throttle_write(RDD_WRITER *w, const unsigned char *buf,
+			unsigned nbyte);
+static int throttle_close(RDD_WRITER *w);
+static int throttle_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+			const char *name);
+static int throttle_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+			const char *name);
+static int throttle_holes(RDD_WRITER *w, rdd_count_t *nbyte);
+
+static RDD_WRITE_OPS throttle_write_ops = {
+	throttle_write,
+	throttle_close,
+	throttle_save,
+	throttle_restore,
+	throttle_holes
+};
+
+int
+rdd_open_throttle_writer(RDD_WRITER **self, RDD_WRITER *parent,
+			rdd_throttle_fun throttle, void *env)
+{
+	RDD_WRITER *w = 0;
+	RDD_THROTTLE_WRITER *state = 0;
+	int rc;
+
+	if (throttle == 0) {
+		return RDD_BADARG;
+	}
+
+	rc = rdd_new_writer(&w, &throttle_write_ops,
+			sizeof(RDD_THROTTLE_WRITER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state = (RDD_THROTTLE_WRITER *) w->state;
+	state->parent = parent;
+	state->throttle = throttle;
+	state->env = env;
+
+	*self = w;
+	return RDD_OK;
+}
+
+static int
+throttle_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_THROTTLE_WRITER *state = w->state;
+	int rc;
+
+	if ((rc = (*state->throttle)(state->env, nbyte)) != RDD_OK) {
+		return rc;
+	}
+	return rdd_writer_write(state->parent, buf, nbyte);
+}
+
+static int
+throttle_close(RDD_WRITER *w)
+{
+	RDD_THROTTLE_WRITER *state = w->state;
+
+	return rdd_writer_close(state->parent);
+}
+
+static int
+throttle_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_THROTTLE_WRITER *state = w->state;
+
+	return rdd_writer_save(state->parent, cp, name);
+}
+
+static int
+throttle_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_THROTTLE_WRITER *state = w->state;
+
+	return rdd_writer_restore(state->parent, cp, name);
+}
+
+static int
+throttle_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	RDD_THROTTLE_WRITER *state = w->state;
+
+	return rdd_writer_holes(state->parent, nbyte);
+}
@@ -0,0 +1,701 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/*
+ * A reader that keeps several reads in flight using Linux io_uring.
+ *
+ * The reader maintains a read-ahead window of up to qdepth pieces
+ * that cover consecutive file ranges, starting at the current file
+ * position.  Each piece is read into its own (registered) buffer.
+ * Read requests are served from the pieces at the head of the window,
+ * strictly in file order, and consumed pieces are resubmitted at the
+ * end of the window.
+ *
+ * The piece size follows the size of the read requests (up to the
+ * maximum block size).  While the robust copier recovers from a read
+ * error it reads minimum-sized blocks, so the window then consists of
+ * a batch of small pieces that are all submitted at once.
+ *
+ * A failed piece fails the caller's request only if the piece covers
+ * exactly that request.  Otherwise the reader reissues the request
+ * with a plain pread().  A read therefore fails with RDD_EREAD exactly
+ * when the same blocking read would have failed, and the file position
+ * is not moved, which is what the atomic reader and the robust copier
+ * expect.  After a failure the reader does not read ahead for a while
+ * (qdepth successful reads), because speculative reads into a damaged
+ * area can be very slow.
+ *
+ * A device ends a read short just before an unreadable sector.  A
+ * short piece therefore only marks the end of the file if the read
+ * at its end returns nothing; otherwise the reader lets a blocking
+ * read find out whether the rest of the request fails.
+ *
+ * If io_uring is not available, at compile time or at run time,
+ * rdd_open_uring_reader() returns a file-descriptor reader instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "rdd.h"
+#include "rdd_internals.h"
+#include "alignedbuf.h"
+#include "reader.h"
+#include "uringreader_test.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) \
+ && defined(__GNUC__)
+#define RDD_URING 1
+#endif
+
+#if defined(RDD_URING)
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+typedef struct _RDD_URING_PIECE {
+	rdd_count_t    offset;		/* file offset */
+	unsigned       len;		/* number of bytes requested */
+	int            res;		/* bytes read or -errno */
+	int            busy;		/* submitted, not yet completed */
+	unsigned char *buf;
+	struct iovec   iov;
+} RDD_URING_PIECE;
+
+typedef struct _RDD_URING_READER {
+	int              fd;
+	int              ring_fd;
+	int              fixed;		/* buffers are registered */
+	int              broken;	/* ring failed; use pread() only */
+
+	/* Submission and completion rings (shared with the kernel).
+	 */
+	void            *sq_ptr;
+	size_t           sq_size;
+	void            *cq_ptr;
+	size_t           cq_size;
+	struct io_uring_sqe *sqes;
+	size_t           sqes_size;
+	unsigned        *sq_head;
+	unsigned        *sq_tail;
+	unsigned        *sq_mask;
+	unsigned        *sq_array;
+	unsigned        *cq_head;
+	unsigned        *cq_tail;
+	unsigned        *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Read-ahead window: pieces head, head+1, ... (mod qdepth).
+	 */
+	RDD_URING_PIECE *pieces;
+	unsigned         qdepth;
+	unsigned         maxlen;	/* maximum piece length */
+	unsigned         piecelen;	/* length of new pieces */
+	unsigned         head;
+	unsigned         nwin;		/* #pieces in window */
+	unsigned         ninflight;
+	rdd_count_t      next_offset;	/* offset of next piece */
+	int              eof;		/* a piece read nothing */
+	unsigned         careful;	/* #reads left without read-ahead */
+	int              simfault;	/* simulate a bad sector? */
+	rdd_count_t      faultpos;	/* offset of the simulated bad sector */
+
+	rdd_count_t      pos;		/* current file position */
+	RDD_ALIGNEDBUF   databuf;
+} RDD_URING_READER;
+
+/* Forward declarations
+ */
+static int rdd_uring_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_uring_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_uring_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_uring_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS uring_read_ops = {
+	rdd_uring_read,
+	rdd_uring_tell,
+	rdd_uring_seek,
+	rdd_uring_close
+};
+
+/* Applies a simulated bad sector to a read of nread > 0 bytes at
+ * offset.  Returns the number of bytes that the read yields, or -1
+ * if it fails.
+ */
+static ssize_t
+simulate_fault(RDD_URING_READER *state, rdd_count_t offset, ssize_t nread)
+{
+	if (!state->simfault
+	||  offset + nread <= state->faultpos
+	||  offset >= state->faultpos + RDD_SECTOR_SIZE) {
+		return nread;
+	}
+	if (offset < state->faultpos) {
+		return (ssize_t) (state->faultpos - offset);
+	}
+	return -1;
+}
+
+static int
+uring_enter(RDD_URING_READER *state, unsigned nsubmit, unsigned nwait)
+{
+	int n;
+
+	for (;;) {
+		n = (int) syscall(__NR_io_uring_enter, state->ring_fd,
+				nsubmit, nwait,
+				nwait > 0 ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+		if (n >= 0) {
+			return RDD_OK;
+		} else if (errno != EINTR && errno != EAGAIN
+		&&         errno != EBUSY) {
+			state->broken = 1;
+			return RDD_EREAD;
+		}
+	}
+}
+
+static void
+uring_reap(RDD_URING_READER *state)
+{
+	struct io_uring_cqe *cqe;
+	RDD_URING_PIECE *p;
+	unsigned head;
+	ssize_t n;
+
+	head = *state->cq_head;
+	while (head != load_acquire(state->cq_tail)) {
+		cqe = &state->cqes[head & *state->cq_mask];
+		p = &state->pieces[cqe->user_data];
+		p->res = cqe->res;
+		if (p->res > 0) {
+			n = simulate_fault(state, p->offset, p->res);
+			p->res = n < 0 ? -EIO : (int) n;
+		}
+		p->busy = 0;
+		state->ninflight--;
+		head++;
+	}
+	store_release(state->cq_head, head);
+}
+
+/* Waits until piece p has completed.
+ */
+static int
+uring_wait(RDD_URING_READER *state, RDD_URING_PIECE *p)
+{
+	int rc;
+
+	uring_reap(state);
+	while (p->busy) {
+		if ((rc = uring_enter(state, 0, 1)) != RDD_OK) {
+			return rc;
+		}
+		uring_reap(state);
+	}
+	return RDD_OK;
+}
+
+/* Waits for all pieces in flight and empties the window.
+ */
+static int
+uring_drain(RDD_URING_READER *state)
+{
+	int rc;
+
+	uring_reap(state);
+	while (state->ninflight > 0) {
+		if ((rc = uring_enter(state, 0, 1)) != RDD_OK) {
+			return rc;
+		}
+		uring_reap(state);
+	}
+	state->nwin = 0;
+	return RDD_OK;
+}
+
+/* Fills the window with new pieces and submits them in a single batch.
+ */
+static int
+uring_refill(RDD_URING_READER *state)
+{
+	struct io_uring_sqe *sqe;
+	RDD_URING_PIECE *p;
+	unsigned tail;
+	unsigned i;
+	unsigned n = 0;
+
+	tail = *state->sq_tail;
+	while (state->nwin < state->qdepth && !state->eof) {
+		i = (state->head + state->nwin) % state->qdepth;
+		p = &state->pieces[i];
+		p->offset = state->next_offset;
+		p->len = state->piecelen;
+		p->res = 0;
+		p->busy = 1;
+
+		sqe = &state->sqes[tail & *state->sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = state->fd;
+		sqe->off = p->offset;
+		sqe->user_data = i;
+		if (state->fixed) {
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->addr = (unsigned long) p->buf;
+			sqe->len = p->len;
+			sqe->buf_index = i;
+		} else {
+			p->iov.iov_base = p->buf;
+			p->iov.iov_len = p->len;
+			sqe->opcode = IORING_OP_READV;
+			sqe->addr = (unsigned long) &p->iov;
+			sqe->len = 1;
+		}
+		state->sq_array[tail & *state->sq_mask] = tail & *state->sq_mask;
+		tail++;
+
+		state->next_offset += p->len;
+		state->nwin++;
+		state->ninflight++;
+		n++;
+	}
+	if (n == 0) {
+		return RDD_OK;
+	}
+
+	store_release(state->sq_tail, tail);
+	return uring_enter(state, n, 0);
+}
+
+/* Restarts the window at the current file position.
+ */
+static int
+uring_restart(RDD_URING_READER *state)
+{
+	int rc;
+
+	if ((rc = uring_drain(state)) != RDD_OK) {
+		return rc;
+	}
+	state->head = 0;
+	state->next_offset = state->pos;
+	state->eof = 0;
+	return RDD_OK;
+}
+
+/* Reads nbyte bytes at the current position with plain pread() calls.
+ */
+static int
+uring_pread(RDD_URING_READER *state, unsigned char *buf, unsigned nbyte,
+		unsigned *nread)
+{
+	unsigned char *next = buf;
+	ssize_t n;
+
+	while (nbyte > 0) {
+		n = pread(state->fd, next, nbyte,
+			(off_t) (state->pos + (next - buf)));
+		if (n > 0) {
+			n = simulate_fault(state, state->pos + (next - buf), n);
+			if (n < 0) {
+				errno = EIO;
+			}
+		}
+		if (n < 0) {
+#if defined(RDD_SIGNALS)
+			if (errno == EINTR) continue;
+#endif
+			return RDD_EREAD;
+		} else if (n == 0) {
+			break;	/* reached EOF */
+		}
+		nbyte -= n;
+		next += n;
+	}
+
+	*nread = next - buf;
+	state->pos += *nread;
+	return RDD_OK;
+}
+
+static int
+setup_ring(RDD_URING_READER *state)
+{
+	struct io_uring_params params;
+	struct iovec *iovs = 0;
+	unsigned char *sq;
+	unsigned char *cq;
+	unsigned i;
+
+	memset(&params, 0, sizeof params);
+	state->ring_fd = (int) syscall(__NR_io_uring_setup,
+					state->qdepth, &params);
+	if (state->ring_fd < 0) {
+		return RDD_EOPEN;
+	}
+
+	state->sq_size = params.sq_off.array
+			+ params.sq_entries * sizeof(unsigned);
+	state->cq_size = params.cq_off.cqes
+			+ params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (state->cq_size > state->sq_size) {
+			state->sq_size = state->cq_size;
+		}
+		state->cq_size = 0;
+	}
+
+	state->sq_ptr = mmap(0, state->sq_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, state->ring_fd,
+			IORING_OFF_SQ_RING);
+	if (state->sq_ptr == MAP_FAILED) {
+		state->sq_ptr = 0;
+		return RDD_EOPEN;
+	}
+	if (state->cq_size > 0) {
+		state->cq_ptr = mmap(0, state->cq_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, state->ring_fd,
+				IORING_OFF_CQ_RING);
+		if (state->cq_ptr == MAP_FAILED) {
+			state->cq_ptr = 0;
+			return RDD_EOPEN;
+		}
+	}
+	state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	state->sqes = mmap(0, state->sqes_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, state->ring_fd,
+			IORING_OFF_SQES);
+	if (state->sqes == MAP_FAILED) {
+		state->sqes = 0;
+		return RDD_EOPEN;
+	}
+
+	sq = state->sq_ptr;
+	cq = state->cq_ptr != 0 ? state->cq_ptr : state->sq_ptr;
+	state->sq_head = (unsigned *) (sq + params.sq_off.head);
+	state->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	state->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	state->sq_array = (unsigned *) (sq + params.sq_off.array);
+	state->cq_head = (unsigned *) (cq + params.cq_off.head);
+	state->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	state->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	state->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	/* Register the piece buffers, so that the kernel need not map
+	 * them for every read.  This may fail because of resource limits
+	 * (RLIMIT_MEMLOCK); plain vectored reads are used in that case.
+	 */
+	if ((iovs = calloc(state->qdepth, sizeof(struct iovec))) == 0) {
+		return RDD_NOMEM;
+	}
+	for (i = 0; i < state->qdepth; i++) {
+		iovs[i].iov_base = state->pieces[i].buf;
+		iovs[i].iov_len = state->maxlen;
+	}
+	state->fixed = syscall(__NR_io_uring_register, state->ring_fd,
+			IORING_REGISTER_BUFFERS, iovs, state->qdepth) == 0;
+	free(iovs);
+
+	return RDD_OK;
+}
+
+static void
+teardown_ring(RDD_URING_READER *state)
+{
+	if (state->sqes != 0) munmap(state->sqes, state->sqes_size);
+	if (state->cq_ptr != 0) munmap(state->cq_ptr, state->cq_size);
+	if (state->sq_ptr != 0) munmap(state->sq_ptr, state->sq_size);
+	if (state->ring_fd >= 0) close(state->ring_fd);
+	state->sqes = 0;
+	state->cq_ptr = 0;
+	state->sq_ptr = 0;
+	state->ring_fd = -1;
+}
+
+int
+rdd_open_uring_reader(RDD_READER **self, int fd, unsigned qdepth,
+		unsigned blocksize)
+{
+	RDD_READER *r = 0;
+	RDD_URING_READER *state = 0;
+	unsigned i;
+	int rc = RDD_OK;
+
+	if (qdepth < 1 || blocksize < 1) return RDD_BADARG;
+
+	rc = rdd_new_reader(&r, &uring_read_ops, sizeof(RDD_URING_READER));
+	if (rc != RDD_OK) {
+		return rc;
+	}
+
+	state = (RDD_URING_READER *) r->state;
+	state->fd = fd;
+	state->ring_fd = -1;
+	state->qdepth = qdepth;
+	state->maxlen = blocksize;
+	state->piecelen = blocksize;
+
+	if ((state->pieces = calloc(qdepth, sizeof(RDD_URING_PIECE))) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	rc = rdd_new_alignedbuf(&state->databuf, qdepth * blocksize,
+				RDD_SECTOR_SIZE);
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	for (i = 0; i < qdepth; i++) {
+		state->pieces[i].buf = state->databuf.aligned + i * blocksize;
+	}
+
+	if ((rc = setup_ring(state)) != RDD_OK) {
+		goto error;
+	}
+
+	*self = r;
+	return RDD_OK;
+
+error:
+	teardown_ring(state);
+	if (state->databuf.unaligned != 0) {
+		rdd_free_alignedbuf(&state->databuf);
+	}
+	if (state->pieces != 0) free(state->pieces);
+	free(state);
+	free(r);
+
+	/* No usable io_uring: fall back to ordinary blocking reads.
+	 */
+	if (rc == RDD_EOPEN) {
+		return rdd_open_fd_reader(self, fd);
+	}
+	*self = 0;
+	return rc;
+}
+
+static int
+rdd_uring_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+			unsigned *nread)
+{
+	RDD_URING_READER *state = self->state;
+	rdd_count_t start = state->pos;
+	RDD_URING_PIECE *p;
+	unsigned copied = 0;
+	unsigned avail;
+	unsigned n;
+	int rc;
+
+	if (state->broken) {
+		return uring_pread(state, buf, nbyte, nread);
+	}
+	if (state->careful > 0) {
+		rc = uring_pread(state, buf, nbyte, nread);
+		if (rc == RDD_OK) {
+			state->careful--;
+		} else {
+			state->careful = state->qdepth;
+		}
+		return rc;
+	}
+
+	/* New pieces follow the caller's block size.
+	 */
+	state->piecelen = nbyte < state->maxlen ? nbyte : state->maxlen;
+	if (state->piecelen < 1) {
+		state->piecelen = 1;
+	}
+
+	while (copied < nbyte) {
+		/* Discard pieces that lie before the current position.
+		 */
+		while (state->nwin > 0) {
+			p = &state->pieces[state->head];
+			if (state->pos < p->offset + p->len) break;
+			if ((rc = uring_wait(state, p)) != RDD_OK) {
+				goto sync;
+			}
+			state->head = (state->head + 1) % state->qdepth;
+			state->nwin--;
+		}
+		if (state->nwin == 0
+		||  state->pos < state->pieces[state->head].offset) {
+			if ((rc = uring_restart(state)) != RDD_OK) {
+				goto sync;
+			}
+		}
+		if ((rc = uring_refill(state)) != RDD_OK) {
+			goto sync;
+		}
+
+		p = &state->pieces[state->head];
+		if ((rc = uring_wait(state, p)) != RDD_OK) {
+			goto sync;
+		}
+		if (p->res < 0) {
+			state->careful = state->qdepth;
+			if (p->offset == start && p->len == nbyte) {
+				/* The failed piece is the caller's request.
+				 */
+				state->pos = start;
+				(void) uring_drain(state);
+				return RDD_EREAD;
+			}
+			goto sync;
+		}
+		if (state->pos >= p->offset + (unsigned) p->res) {
+			if (p->res == 0) {
+				state->eof = 1;
+				break;	/* reached EOF */
+			}
+			/* The piece ended short, at the end of the file
+			 * or before a bad sector.
+			 */
+			goto sync;
+		}
+
+		avail = (unsigned) (p->offset + p->res - state->pos);
+		n = nbyte - copied < avail ? nbyte - copied : avail;
+		memcpy(buf + copied, p->buf + (state->pos - p->offset), n);
+		copied += n;
+		state->pos += n;
+	}
+
+	*nread = copied;
+	return RDD_OK;
+
+sync:
+	/* A piece failed (or the ring did).  Let a blocking read decide
+	 * whether the caller's request really fails.
+	 */
+	state->pos = start;
+	if (!state->broken) {
+		(void) uring_drain(state);
+	}
+	if ((rc = uring_pread(state, buf, nbyte, nread)) != RDD_OK) {
+		state->careful = state->qdepth;
+	}
+	return rc;
+}
+
+int
+rdd_uring_reader_simulate_error(RDD_READER *self, rdd_count_t offset)
+{
+	RDD_URING_READER *state;
+
+	if (self->ops != &uring_read_ops) {
+		return RDD_BADARG;
+	}
+	state = self->state;
+	state->simfault = 1;
+	state->faultpos = offset;
+	return RDD_OK;
+}
+
+static int
+rdd_uring_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_URING_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_uring_seek(RDD_READER *self, rdd_count_t pos)
+{
+	RDD_URING_READER *state = self->state;
+
+	/* The window is kept; rdd_uring_read() restarts it if
+	 * the new position lies outside it.
+	 */
+	state->pos = pos;
+	return RDD_OK;
+}
+
+static int
+rdd_uring_close(RDD_READER *self, int recurse /* ignored */)
+{
+	RDD_URING_READER *state = self->state;
+	int rc = RDD_OK;
+
+	if (!state->broken) {
+		(void) uring_drain(state);
+	}
+	teardown_ring(state);
+	rdd_free_alignedbuf(&state->databuf);
+	free(state->pieces);
+
+	if (close(state->fd) < 0) {
+		rc = RDD_ECLOSE;
+	}
+	return rc;
+}
+
+#else /* !RDD_URING */
+
+int
+rdd_open_uring_reader(RDD_READER **self, int fd, unsigned qdepth,
+		unsigned blocksize)
+{
+	if (qdepth < 1 || blocksize < 1) return RDD_BADARG;
+
+	return rdd_open_fd_reader(self, fd);
+}
+
+int
+rdd_uring_reader_simulate_error(RDD_READER *self, rdd_count_t offset)
+{
+	return RDD_BADARG;
+}
+
+#endif /* RDD_URING */
@@ -48,7 +48,6 @@ static char copyright[] =
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <zlib.h>
 
 #include "rdd.h"
 #include "rdd_internals.h"
@@ -56,20 +55,29 @@ static char copyright[] =
 #include "writer.h"
 #include "filter.h"
 #include "filterset.h"
+#include "checksumfile.h"
 
+#define RECORD_BUF_SIZE	65536	/* bytes of records read at once */
 
 /* State maintained by a checksum filter.
  */
 typedef struct _RDD_VERIFY_BLOCKFILTER {
 	FILE                    *fp;		/* stream with checksums */
-	rdd_checksum_t           checksum;	/* running checksum */
-	rdd_checksum_algorithm_t algorithm;	/* checksum algorithm */
-	int                      swap;
+	struct _RDD_CKSUM2_CTX  *ctx;		/* running checksum or hash */
+	unsigned                 recordsize;	/* record size in bytes */
+	int                      version;	/* file format version: 1 or 2 */
+	int                      swap;		/* version 1: swap bytes? */
+	rdd_count_t              nrecord;	/* #records in the file */
+	rdd_count_t              nread;		/* #records read from fp */
 	rdd_count_t              blocknum;
 	unsigned                 blocksize;
-	rdd_count_t              num_error;	/* error count */
-	rdd_fltr_error_fun       error_fun;	/* callback function */
+	unsigned                 num_error;	/* error count */
+	rdd_fltr_error_fun       error_fun;	/* callback function (v1) */
+	rdd_fltr_digest_error_fun digest_error_fun; /* callback function (v2) */
 	void                    *error_env;	/* callback environment */
+	unsigned char           *recbuf;	/* records read ahead */
+	unsigned                 recpos;	/* next record in recbuf */
+	unsigned                 reclen;	/* #bytes in recbuf */
 } RDD_VERIFY_BLOCKFILTER;
 
 /* Forward declarations.
@@ -77,42 +85,24 @@ typedef struct _RDD_VERIFY_BLOCKFILTER {
 static int verify_input(RDD_FILTER *f,
 			const unsigned char *buf, unsigned nbyte);
 static int verify_block(RDD_FILTER *f, unsigned nbyte);
+static int verify_close(RDD_FILTER *f);
 static int verify_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte);
+static int verify_free(RDD_FILTER *f);
 
 static RDD_FILTER_OPS verify_ops = {
 	verify_input,
 	verify_block,
-	0,	/* close */
+	verify_close,
 	verify_get_result,
-	0	/* free */
+	verify_free
 };
 
-static void
-reset_checksum(RDD_VERIFY_BLOCKFILTER *state)
-{
-	switch (state->algorithm) {
-	case RDD_ADLER32:
-		state->checksum = adler32(0, NULL, 0);
-		break;
-	case RDD_CRC32:
-		state->checksum = crc32(0, NULL, 0);
-		break;
-	}
-}
-
 static int
 verify_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte)
 {
 	RDD_VERIFY_BLOCKFILTER *state = (RDD_VERIFY_BLOCKFILTER *) f->state;
 
-	switch (state->algorithm) {
-	case RDD_ADLER32:
-		state->checksum = adler32(state->checksum, buf, nbyte);
-		break;
-	case RDD_CRC32:
-		state->checksum = crc32(state->checksum, buf, nbyte);
-		break;
-	}
+	rdd_cksum2_ctx_update(state->ctx, buf, nbyte);
 
 	return RDD_OK;
 }
@@ -128,36 +118,73 @@ swap32(u_int32_t n)
 	;
 }
 
+/* Returns the next record in the checksum file.  Records are read
+ * RECORD_BUF_SIZE bytes at a time.  A version-2 file may be followed
+ * by an index, so no more than nrecord records are read from it.
+ */
 static int
-read_chksum(RDD_VERIFY_BLOCKFILTER *state, rdd_checksum_t *result)
+read_record(RDD_VERIFY_BLOCKFILTER *state, const unsigned char **record)
 {
-	rdd_checksum_t chksum;
-
-	if (fread(&chksum, sizeof chksum, 1, state->fp) != 1) {
-		return RDD_EREAD;
-	}
-	if (state->swap) {
-		chksum = swap32(chksum);
+	rdd_count_t nwant;
+	size_t n;
+
+	if (state->recpos >= state->reclen) {
+		nwant = RECORD_BUF_SIZE / state->recordsize;
+		if (nwant > state->nrecord - state->nread) {
+			nwant = state->nrecord - state->nread;
+		}
+		if (nwant == 0) {
+			return RDD_EREAD;
+		}
+		n = fread(state->recbuf, state->recordsize, (size_t) nwant,
+			state->fp);
+		if (n == 0) {
+			return RDD_EREAD;
+		}
+		state->nread += n;
+		state->recpos = 0;
+		state->reclen = (unsigned) n * state->recordsize;
 	}
-	*result = chksum;
+
+	*record = state->recbuf + state->recpos;
+	state->recpos += state->recordsize;
 	return RDD_OK;
 }
 
 static void
-verify_checksum(RDD_VERIFY_BLOCKFILTER *state, u_int32_t stored_checksum)
+verify_checksum(RDD_VERIFY_BLOCKFILTER *state, const unsigned char *stored,
+		const unsigned char *computed)
 {
-	rdd_count_t offset;
+	rdd_checksum_t stored_checksum, checksum;
+	rdd_count_t offset = state->blocknum * state->blocksize;
+
+	if (state->version == 2) {
+		if (memcmp(stored, computed, state->recordsize) == 0) {
+			return;	/* record ok */
+		}
+		state->num_error++;
+		if (state->digest_error_fun != 0) {
+			(*state->digest_error_fun)(offset, stored, computed,
+					state->recordsize, state->error_env);
+		}
+		return;
+	}
 
-	if (state->checksum == stored_checksum) {
+	memcpy(&stored_checksum, stored, sizeof stored_checksum);
+	if (state->swap) {
+		stored_checksum = swap32(stored_checksum);
+	}
+	checksum = rdd_cksum2_get_checksum(computed);
+
+	if (checksum == stored_checksum) {
 		return;	/* checksum ok */
 	}
 
 	state->num_error++;
 
 	if (state->error_fun != 0) {
-		offset = state->blocknum * state->blocksize;
 		(*state->error_fun)(offset,
-				    stored_checksum, state->checksum,
+				    stored_checksum, checksum,
 				    state->error_env);
 	}
 }
@@ -166,28 +193,55 @@ static int
 verify_block(RDD_FILTER *f, unsigned pos)
 {
 	RDD_VERIFY_BLOCKFILTER *state = (RDD_VERIFY_BLOCKFILTER *) f->state;
-	rdd_checksum_t stored_checksum;
+	unsigned char computed[RDD_CKSUM2_MAX_RECORD];
+	const unsigned char *stored;
 	int rc;
 
-	if ((rc = read_chksum(state, &stored_checksum)) != RDD_OK) {
+	if ((rc = read_record(state, &stored)) != RDD_OK) {
 		return rc;
 	}
 
-	verify_checksum(state, stored_checksum);
+	rdd_cksum2_ctx_final(state->ctx, computed);
 
-	reset_checksum(state);
+	verify_checksum(state, stored, computed);
 
 	state->blocknum++;
 
 	return RDD_OK;
 }
 
+/* Counts the blocks that are in a finished version-2 file but not
+ * in the image as errors.  The first missing block is reported with
+ * a null computed record.
+ */
+static int
+verify_close(RDD_FILTER *f)
+{
+	RDD_VERIFY_BLOCKFILTER *state = (RDD_VERIFY_BLOCKFILTER *) f->state;
+	const unsigned char *stored;
+
+	if (state->version != 2 || state->blocknum >= state->nrecord
+	||  state->nrecord == RDD_COUNT_MAX) {
+		return RDD_OK;
+	}
+
+	state->num_error += (unsigned) (state->nrecord - state->blocknum);
+	if (state->digest_error_fun != 0
+	&&  read_record(state, &stored) == RDD_OK) {
+		(*state->digest_error_fun)(state->blocknum * state->blocksize,
+				stored, 0, state->recordsize,
+				state->error_env);
+	}
+
+	return RDD_OK;
+}
+
 static int
 verify_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
 {
 	RDD_VERIFY_BLOCKFILTER *state = (RDD_VERIFY_BLOCKFILTER *) f->state;
 
-	if (nbyte < sizeof(unsigned)) {
+	if (nbyte < sizeof(state->num_error)) {
 		return RDD_NOMEM;
 	}
 
@@ -197,16 +251,38 @@ verify_get_result(RDD_FILTER *f, unsigned char *buf, unsigned nbyte)
 }
 
 static int
-new_verify_checksum_blockfilter(RDD_FILTER **self,
-	rdd_checksum_algorithm_t alg, FILE *fp, unsigned blocksize, int swap,
-	rdd_fltr_error_fun error_fun, void *error_env)
+verify_free(RDD_FILTER *f)
+{
+	RDD_VERIFY_BLOCKFILTER *state = (RDD_VERIFY_BLOCKFILTER *) f->state;
+
+	free(state->recbuf);
+	state->recbuf = 0;
+	rdd_cksum2_ctx_free(state->ctx);
+	state->ctx = 0;
+
+	return RDD_OK;
+}
+
+static int
+new_verify_blockfilter(RDD_FILTER **self, unsigned type, int version,
+	FILE *fp, unsigned blocksize, int swap, rdd_count_t nrecord,
+	rdd_fltr_error_fun error_fun,
+	rdd_fltr_digest_error_fun digest_error_fun, void *error_env)
 {
 	RDD_FILTER *f = 0;
 	RDD_VERIFY_BLOCKFILTER *state = 0;
+	unsigned char *recbuf = 0;
+	struct _RDD_CKSUM2_CTX *ctx = 0;
 	int rc = RDD_OK;
 
 	if (blocksize <= 0) return RDD_BADARG;
-	if (alg != RDD_ADLER32 && alg != RDD_CRC32) return RDD_BADARG;
+	if (version == 1
+	&&  type != RDD_ADLER32 && type != RDD_CRC32 && type != RDD_CRC32C) {
+		return RDD_BADARG;
+	}
+	if ((rc = rdd_cksum2_ctx_new(&ctx, type)) != RDD_OK) {
+		return rc;
+	}
 
 	rc = rdd_new_filter(&f, &verify_ops,
 			sizeof(RDD_VERIFY_BLOCKFILTER), blocksize);
@@ -215,15 +291,27 @@ new_verify_checksum_blockfilter(RDD_FILTER **self,
 	}
 	state = (RDD_VERIFY_BLOCKFILTER *)f->state;
 
+	if ((recbuf = malloc(RECORD_BUF_SIZE)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
 	state->fp = fp;
-	state->algorithm = alg;
+	state->ctx = ctx;
+	state->recordsize = rdd_cksum2_record_size(type);
+	state->version = version;
 	state->swap = swap;
+	state->nrecord = nrecord;
+	state->nread = 0;
 	state->blocknum = 0;
 	state->blocksize = blocksize;
 	state->num_error = 0;
 	state->error_fun = error_fun;
+	state->digest_error_fun = digest_error_fun;
 	state->error_env = error_env;
-	reset_checksum(state);
+	state->recbuf = recbuf;
+	state->recpos = 0;
+	state->reclen = 0;
 
 	*self = f;
 	return RDD_OK;
@@ -231,6 +319,8 @@ new_verify_checksum_blockfilter(RDD_FILTER **self,
 error:
 	*self = 0;
 	if (fp != NULL) fclose(fp);
+	if (recbuf != 0) free(recbuf);
+	if (ctx != 0) rdd_cksum2_ctx_free(ctx);
 	if (state != 0) free(state);
 	if (f != 0) free(f);
 	return rc;
@@ -240,16 +330,44 @@ int
 rdd_new_verify_adler32_blockfilter(RDD_FILTER **f, FILE *fp,
 	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env)
 {
-	return new_verify_checksum_blockfilter(f, RDD_ADLER32,
-						fp, blocksize, swap,
-						err, env);
+	return new_verify_blockfilter(f, RDD_ADLER32, 1,
+					fp, blocksize, swap, RDD_COUNT_MAX,
+					err, 0, env);
 }
 
 int
 rdd_new_verify_crc32_blockfilter(RDD_FILTER **f, FILE *fp,
 	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env)
 {
-	return new_verify_checksum_blockfilter(f, RDD_CRC32,
-						fp, blocksize, swap,
-						err, env);
+	return new_verify_blockfilter(f, RDD_CRC32, 1,
+					fp, blocksize, swap, RDD_COUNT_MAX,
+					err, 0, env);
+}
+
+int
+rdd_new_verify_crc32c_blockfilter(RDD_FILTER **f, FILE *fp,
+	unsigned blocksize, int swap, rdd_fltr_error_fun err, void *env)
+{
+	return new_verify_blockfilter(f, RDD_CRC32C, 1,
+					fp, blocksize, swap, RDD_COUNT_MAX,
+					err, 0, env);
+}
+
+/* The number of records in an unfinished file is unknown; all
+ * records up to the end of the file are used.
+ */
+int
+rdd_new_verify_checksum2_blockfilter(RDD_FILTER **f, FILE *fp,
+	const RDD_CHECKSUM2_HEADER *hdr,
+	rdd_fltr_digest_error_fun err, void *env)
+{
+	rdd_count_t nrecord = RDD_COUNT_MAX;
+
+	if ((hdr->flags & RDD_CHECKSUM2_FINISHED) != 0) {
+		nrecord = hdr->nrecord;
+	}
+
+	return new_verify_blockfilter(f, hdr->type, 2,
+					fp, hdr->blocksize, 0, nrecord,
+					0, err, env);
 }
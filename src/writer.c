@@ -100,3 +100,31 @@ rdd_writer_close(RDD_WRITER *w)
 
 	return RDD_OK;
 }
+
+int
+rdd_writer_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp, const char *name)
+{
+	if (w->ops->save == 0) return RDD_NOTFOUND;
+
+	return (*(w->ops->save))(w, cp, name);
+}
+
+int
+rdd_writer_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+		const char *name)
+{
+	if (w->ops->restore == 0) return RDD_NOTFOUND;
+
+	return (*(w->ops->restore))(w, cp, name);
+}
+
+int
+rdd_writer_holes(RDD_WRITER *w, rdd_count_t *nbyte)
+{
+	if (w->ops->holes == 0) {
+		*nbyte = 0;
+		return RDD_OK;
+	}
+
+	return (*(w->ops->holes))(w, nbyte);
+}
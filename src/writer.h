@@ -66,21 +66,39 @@
 
 struct _RDD_WRITER;
 struct _RDD_WRITE_OPS;
+struct _RDD_CHECKPOINT;
 
 /** Values of type \c rdd_write_mode_t determine the behavior
- *  of writers that try to write to an existing file.
+ *  of writers that try to write to an existing file.  \c RDD_SPARSE
+ *  or \c RDD_DIRECT can be or-ed with any of the other values.
  */
 typedef enum _rdd_write_mode_t {
 	RDD_NO_OVERWRITE = 0,	/**< do not overwrite existing files */
 	RDD_OVERWRITE = 1,	/**< truncate and overwrite existing files */
-	RDD_OVERWRITE_ASK = 2	/**< ask before overwriting existing files */
+	RDD_OVERWRITE_ASK = 2,	/**< ask before overwriting existing files */
+	RDD_APPEND = 3,		/**< keep existing files (resume from a checkpoint) */
+	RDD_SPARSE = 0x10,	/**< flag: store all-zero blocks as holes */
+	RDD_DIRECT = 0x20	/**< flag: bypass the page cache (O_DIRECT) */
 } rdd_write_mode_t;
 
+/** Strips the \c RDD_SPARSE and \c RDD_DIRECT flags from a write mode.
+ */
+#define RDD_WRITE_MODE(m) \
+	((rdd_write_mode_t) ((m) & ~(RDD_SPARSE|RDD_DIRECT)))
+
 typedef int (*rdd_wr_write_fun)(struct _RDD_WRITER *w,
 				const unsigned char *buf, unsigned nbyte);
 
 typedef int (*rdd_wr_close_fun)(struct _RDD_WRITER *w);
 
+typedef int (*rdd_wr_save_fun)(struct _RDD_WRITER *w,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
+typedef int (*rdd_wr_restore_fun)(struct _RDD_WRITER *w,
+				struct _RDD_CHECKPOINT *cp, const char *name);
+
+typedef int (*rdd_wr_holes_fun)(struct _RDD_WRITER *w, rdd_count_t *nbyte);
+
 /** All writer implementations provide a structure of type \c RDD_WRITE_OPS.
  *  This structure contains pointers to the routines that implement
  *  the interface.
@@ -88,8 +106,21 @@ typedef int (*rdd_wr_close_fun)(struct _RDD_WRITER *w);
 typedef struct _RDD_WRITE_OPS {
 	rdd_wr_write_fun write;	/**< writes data to the output channel */
 	rdd_wr_close_fun close;	/**< closes the writer */
+	rdd_wr_save_fun save;	/**< saves the output position (optional) */
+	rdd_wr_restore_fun restore; /**< restores the output position (optional) */
+	rdd_wr_holes_fun holes;	/**< counts bytes left as holes (optional) */
 } RDD_WRITE_OPS;
 
+/** Statistics of an asynchronous writer (see \c rdd_open_async_writer()).
+ */
+typedef struct _RDD_ASYNC_STATS {
+	unsigned nbuf;		/**< number of queue buffers */
+	unsigned depth;		/**< buffers waiting to be written now */
+	unsigned maxdepth;	/**< most buffers ever waiting to be written */
+	double   stall;		/**< seconds writes waited for a free buffer */
+	double   idle;		/**< seconds the writer thread waited for data */
+} RDD_ASYNC_STATS;
+
 /** Writer object. A writer object consists of a pointer to a state
  *  buffer and a pointer to an operation table.
  */
@@ -127,6 +158,36 @@ int rdd_new_writer(RDD_WRITER **w, RDD_WRITE_OPS *ops, unsigned statesize);
  */
 int rdd_open_zlib_writer(RDD_WRITER **w, RDD_WRITER *parent);
 
+/** \brief Creates a zlib writer that compresses at level \c level
+ *  (-1 for zlib's default, or 1 through 9).
+ */
+int rdd_open_zlib_level_writer(RDD_WRITER **w, RDD_WRITER *parent,
+			int level);
+
+/** \brief Creates a writer that compresses its input in Zstandard
+ *  format.
+ *  \param w output value: the new writer object
+ *  \param parent: all compressed output is written to \c parent
+ *  \param level the compression level; 0 selects the library's
+ *         default level
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Only available if rdd was built with libzstd.
+ */
+int rdd_open_zstd_writer(RDD_WRITER **w, RDD_WRITER *parent, int level);
+
+/** \brief Creates a writer that compresses its input in LZ4 frame
+ *  format.
+ *  \param w output value: the new writer object
+ *  \param parent: all compressed output is written to \c parent
+ *  \param level the compression level; 0 selects fast LZ4, levels
+ *         3 and up select LZ4 HC
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Only available if rdd was built with liblz4.
+ */
+int rdd_open_lz4_writer(RDD_WRITER **w, RDD_WRITER *parent, int level);
+
 /** \brief Creates a writer that writes to an open file descriptor.
  *  \param w output value: the new writer object
  *  \param fd the open file descriptor that the new writer will write to
@@ -134,6 +195,21 @@ int rdd_open_zlib_writer(RDD_WRITER **w, RDD_WRITER *parent);
  */
 int rdd_open_fd_writer(RDD_WRITER **w, int fd);
 
+/** \brief Creates a writer that writes to an open file descriptor and
+ *  leaves holes where the data is zero.
+ *  \param w output value: the new writer object
+ *  \param fd the open file descriptor that the new writer will write to
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  A sparse fd writer does not write blocks that contain only zero
+ *  bytes; it moves the file offset past them instead.  When the writer
+ *  is closed, the file is extended to its full length, so its size and
+ *  contents are the same as those written by an ordinary fd writer.
+ *  Holes are only made in regular files that end at the current offset;
+ *  for other files a sparse fd writer behaves like an ordinary one.
+ */
+int rdd_open_sparse_fd_writer(RDD_WRITER **w, int fd);
+
 /** \brief Creates a writer that writes to a file.
  *  \param w output value: the new writer object
  *  \param path the name of the file that the new writer will write to
@@ -147,6 +223,41 @@ int rdd_open_fd_writer(RDD_WRITER **w, int fd);
  */
 int rdd_open_file_writer(RDD_WRITER **w, const char *path);
 
+/** \brief Creates a file writer that leaves holes where the data is zero.
+ *  \param w output value: the new writer object
+ *  \param path the name of the file that the new writer will write to
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  See \c rdd_open_file_writer() and \c rdd_open_sparse_fd_writer().
+ */
+int rdd_open_sparse_file_writer(RDD_WRITER **w, const char *path);
+
+/** \brief Creates a writer that writes to a file without going through
+ *  the page cache.
+ *  \param w output value: the new writer object
+ *  \param path the name of the file that the new writer will write to
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Routine \c rdd_open_direct_writer() creates or truncates \c path
+ *  like \c rdd_open_file_writer(), but opens it with \c O_DIRECT.
+ *  The writer collects its input in a buffer aligned to the target's
+ *  logical block size and writes it in large aligned blocks.  Data that
+ *  does not fill a whole block, such as the end of the file, is written
+ *  through the page cache.  If the file system does not support
+ *  \c O_DIRECT, all data is written through the page cache.
+ */
+int rdd_open_direct_writer(RDD_WRITER **w, const char *path);
+
+/** \brief Creates a direct writer for an open file descriptor.
+ *  \param w output value: the new writer object
+ *  \param fd the open file descriptor that the new writer will write to
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  See \c rdd_open_direct_writer().  The writer sets \c O_DIRECT on
+ *  \c fd and starts writing at the current offset of \c fd.
+ */
+int rdd_open_direct_fd_writer(RDD_WRITER **w, int fd);
+
 /** \brief Creates a writer that writes to a TCP server.
  *  \param w output value: the new writer object
  *  \param host the name of the server host
@@ -160,6 +271,62 @@ int rdd_open_file_writer(RDD_WRITER **w, const char *path);
  */
 int rdd_open_tcp_writer(RDD_WRITER **w, const char *host, unsigned port);
 
+/** \brief Creates a writer that stripes its output over several writers.
+ *  \param w output value: the new writer object
+ *  \param streams the parent writers, usually TCP writers
+ *  \param nstream the number of parent writers
+ *  \param framesize the number of data bytes per frame
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c nstream is 0 or \c framesize is 0 or too large.
+ *
+ *  A stripe writer cuts its input into frames of \c framesize bytes
+ *  and sends them round-robin to the parent writers.  Each frame is
+ *  tagged with its offset in the stream (see netio.h).  Closing the
+ *  stripe writer closes all parents.  Use \c rdd_open_stripe_reader()
+ *  to reassemble the stream.
+ */
+int rdd_open_stripe_writer(RDD_WRITER **w, RDD_WRITER **streams,
+			unsigned nstream, unsigned framesize);
+
+/** \brief Creates a writer that sends checksummed frames to a
+ *  server that speaks network protocol version 2.
+ *  \param w output value: the new writer object
+ *  \param parent the writer for the connection, usually a TCP writer
+ *  \param sock the connection's socket, on which the server answers
+ *  \param framesize the maximum number of data bytes per frame
+ *  \param window the credit window announced by the server's HELLO
+ *  \param hdrcrc the checksum of the request or join header
+ *         (see \c rdd_net_info_crc() and \c rdd_net_join_crc())
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  A frame writer never has more than \c window unacknowledged bytes
+ *  in flight.  If the server reports an error, the next write fails
+ *  with the server's error code.  Closing the writer waits until the
+ *  server has closed its output, and then closes the parent.
+ */
+int rdd_open_frame_writer(RDD_WRITER **w, RDD_WRITER *parent, int sock,
+			unsigned framesize, rdd_count_t window,
+			rdd_checksum_t hdrcrc);
+
+/** \brief Callback that decides when a throttle writer may proceed.
+ *  It blocks until \c nbyte bytes may be written and returns
+ *  \c RDD_OK, or returns an error code to fail the write.
+ */
+typedef int (*rdd_throttle_fun)(void *env, unsigned nbyte);
+
+/** \brief Creates a writer that limits the rate of its output.
+ *  \param w output value: the new writer object
+ *  \param parent the writer that receives the output
+ *  \param throttle the callback that is called before each write
+ *  \param env the first argument of \c throttle
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The throttle writer forwards checkpoint and hole-count requests
+ *  to its parent.  Closing it closes the parent.
+ */
+int rdd_open_throttle_writer(RDD_WRITER **w, RDD_WRITER *parent,
+			rdd_throttle_fun throttle, void *env);
+
 /** \brief Creates a writer that does not blindly overwrite existing files.
  *  \param w output value: the new writer object
  *  \param path the name of the file that the new writer will write to
@@ -169,7 +336,13 @@ int rdd_open_tcp_writer(RDD_WRITER **w, const char *host, unsigned port);
  *  A safe writer behaves almost exactly like a file writer. The key
  *  difference is that a safe writer will only overwrite an existing
  *  file if \c overwrite equals \c RDD_OVERWRITE. Otherwise
- *  \c rdd_open_safe_writer() will fail.
+ *  \c rdd_open_safe_writer() will fail.  In \c RDD_APPEND mode an
+ *  existing file is opened without truncating it; the output position
+ *  is set by \c rdd_writer_restore().  If \c RDD_SPARSE is set in
+ *  \c overwrite, all-zero blocks become holes in the output file
+ *  (see \c rdd_open_sparse_fd_writer()).  If \c RDD_DIRECT is set,
+ *  the file is written with a direct writer (see
+ *  \c rdd_open_direct_writer()).  The two flags cannot be combined.
  */
 int rdd_open_safe_writer(RDD_WRITER **w, const char *path,
 			rdd_write_mode_t overwrite);
@@ -191,11 +364,41 @@ int rdd_open_safe_writer(RDD_WRITER **w, const char *path,
  *  - the output file's sequence number;
  *  - a dash;
  *  - the base name of \c basepath.
+ *
+ *  Each output file is opened with a safe writer in mode \c overwrite.
  */
 int rdd_open_part_writer(RDD_WRITER **w,
 	const char *basepath, rdd_count_t maxlen, rdd_count_t splitlen,
 	rdd_write_mode_t overwrite);
 
+/** \brief Creates a writer that writes to its parent in the background.
+ *  \param w output value: the new writer object
+ *  \param parent all data is written through to \c parent
+ *  \param nbuf the number of queue buffers (at least 2)
+ *  \param bufsize the size in bytes of each queue buffer
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG for
+ *  bad arguments and \c RDD_NOMEM if the buffers or the writer thread
+ *  cannot be created.
+ *
+ *  An async writer copies the data written to it into a queue of
+ *  \c nbuf buffers.  A separate thread writes the buffers to
+ *  \c parent, in order.  Writes to the async writer return as soon as
+ *  the data has been copied, and block only while the queue is full.
+ *  If the thread fails to write to \c parent, the next write, save,
+ *  or close of the async writer returns the error.  Closing the async
+ *  writer writes all queued data and closes \c parent.
+ */
+int rdd_open_async_writer(RDD_WRITER **w, RDD_WRITER *parent,
+			unsigned nbuf, unsigned bufsize);
+
+/** \brief Returns the queue statistics of an async writer.
+ *  \param w the async writer
+ *  \param stats output value: the statistics
+ *  \return Returns \c RDD_OK on success.  Returns \c RDD_BADARG if
+ *  \c w is not an async writer.
+ */
+int rdd_async_writer_stats(RDD_WRITER *w, RDD_ASYNC_STATS *stats);
+
 
 /* Generic writer routines
  */
@@ -228,6 +431,41 @@ int rdd_writer_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
  */
 int rdd_writer_close(RDD_WRITER *w);
 
+/** \brief Saves a writer's output position in a checkpoint.
+ *  \param w a pointer to the writer object.
+ *  \param cp the checkpoint
+ *  \param name the writer's name in the checkpoint
+ *  \return Returns \c RDD_OK on success. Returns \c RDD_NOTFOUND if
+ *  the writer cannot be checkpointed.
+ *
+ *  All data written so far is flushed to stable storage before the
+ *  position is recorded.
+ */
+int rdd_writer_save(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
+/** \brief Restores a writer's output position from a checkpoint.
+ *  \param w a pointer to the writer object.
+ *  \param cp the checkpoint
+ *  \param name the writer's name in the checkpoint
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  The writer must have been opened in \c RDD_APPEND mode. Output
+ *  beyond the saved position is discarded.
+ */
+int rdd_writer_restore(RDD_WRITER *w, struct _RDD_CHECKPOINT *cp,
+		const char *name);
+
+/** \brief Counts the bytes that a writer did not write, but left as
+ *  holes in its output.
+ *  \param w a pointer to the writer object.
+ *  \param nbyte output value: the number of bytes left as holes.
+ *  \return Returns \c RDD_OK on success.
+ *
+ *  Writers that never make holes report zero bytes.
+ */
+int rdd_writer_holes(RDD_WRITER *w, rdd_count_t *nbyte);
+
 RDD_WRITER *rdd_test_get_writer(int argc, char **argv);
 
 #endif /* __writer_h__ */
@@ -56,7 +56,7 @@ static char copyright[] =
 #include "error.h"
 #include "writer.h"
 #include "filter.h"
-#include "writer.h"
+#include "checkpoint.h"
 
 typedef struct _RDD_WRITE_STREAM_FILTER {
 	RDD_WRITER *writer;
@@ -64,13 +64,17 @@ typedef struct _RDD_WRITE_STREAM_FILTER {
 
 static int write_input(RDD_FILTER *f, const unsigned char *buf, unsigned nbyte);
 static int write_close(RDD_FILTER *f);
+static int write_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
+static int write_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name);
 
 static RDD_FILTER_OPS write_ops = {
 	write_input,
 	0,
 	write_close,
 	0,
-	0
+	0,
+	write_save,
+	write_restore
 };
 
 int
@@ -105,3 +109,19 @@ write_close(RDD_FILTER *f)
 {
 	return RDD_OK;
 }
+
+static int
+write_save(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_WRITE_STREAM_FILTER *state = (RDD_WRITE_STREAM_FILTER *) f->state;
+
+	return rdd_writer_save(state->writer, cp, name);
+}
+
+static int
+write_restore(RDD_FILTER *f, RDD_CHECKPOINT *cp, const char *name)
+{
+	RDD_WRITE_STREAM_FILTER *state = (RDD_WRITE_STREAM_FILTER *) f->state;
+
+	return rdd_writer_restore(state->writer, cp, name);
+}
@@ -79,6 +79,12 @@ typedef struct _RDD_ZLIB_WRITER {
 
 int
 rdd_open_zlib_writer(RDD_WRITER **self, RDD_WRITER *parent)
+{
+	return rdd_open_zlib_level_writer(self, parent, Z_DEFAULT_COMPRESSION);
+}
+
+int
+rdd_open_zlib_level_writer(RDD_WRITER **self, RDD_WRITER *parent, int level)
 {
 	RDD_WRITER *w = 0;
 	RDD_ZLIB_WRITER *state = 0;
@@ -105,7 +111,7 @@ rdd_open_zlib_writer(RDD_WRITER **self, RDD_WRITER *parent)
 	state->zstate.next_out = zbuf;
 	state->zstate.avail_out = ZBUF_SIZE;
 
-	rc = deflateInit(&state->zstate, Z_DEFAULT_COMPRESSION);
+	rc = deflateInit(&state->zstate, level);
 	switch (rc) {
 	case Z_OK:
 		break;
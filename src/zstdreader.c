@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Implements a reader that decompresses Zstandard data that it
+ * reads from its parent reader.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(HAVE_LIBZSTD)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#include "rdd.h"
+#include "reader.h"
+
+typedef struct _RDD_ZSTD_READER {
+	RDD_READER    *parent;
+	ZSTD_DCtx     *dctx;
+	ZSTD_inBuffer  in;
+	unsigned char *zbuf;
+	unsigned       zbufsize;
+	size_t         hint;	/* 0 between frames */
+	rdd_count_t    pos;
+} RDD_ZSTD_READER;
+
+
+/* Forward declarations
+ */
+static int rdd_zstd_read(RDD_READER *r, unsigned char *buf, unsigned nbyte,
+			unsigned *nread);
+static int rdd_zstd_tell(RDD_READER *r, rdd_count_t *pos);
+static int rdd_zstd_seek(RDD_READER *r, rdd_count_t pos);
+static int rdd_zstd_close(RDD_READER *r, int recurse);
+
+static RDD_READ_OPS zstd_read_ops = {
+	rdd_zstd_read,
+	rdd_zstd_tell,
+	rdd_zstd_seek,
+	rdd_zstd_close
+};
+
+int
+rdd_open_zstd_reader(RDD_READER **self, RDD_READER *parent)
+{
+	RDD_READER *r = 0;
+	RDD_ZSTD_READER *state = 0;
+	ZSTD_DCtx *dctx = 0;
+	unsigned char *zbuf = 0;
+	unsigned zbufsize = (unsigned) ZSTD_DStreamInSize();
+	int rc = RDD_OK;
+
+	rc = rdd_new_reader(&r, &zstd_read_ops, sizeof(RDD_ZSTD_READER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_ZSTD_READER *) r->state;
+
+	if ((zbuf = malloc(zbufsize)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if ((dctx = ZSTD_createDCtx()) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+
+	state->parent = parent;
+	state->dctx = dctx;
+	state->zbuf = zbuf;
+	state->zbufsize = zbufsize;
+	state->in.src = zbuf;
+	state->in.size = 0;
+	state->in.pos = 0;
+	state->hint = 0;
+	state->pos = 0;
+
+	*self = r;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (dctx != 0) ZSTD_freeDCtx(dctx);
+	if (zbuf != 0) free(zbuf);
+	if (state != 0) free(state);
+	if (r != 0) free(r);
+	return rc;
+}
+
+static int
+rdd_zstd_read(RDD_READER *self, unsigned char *buf, unsigned nbyte,
+			unsigned *nread)
+{
+	RDD_ZSTD_READER *state = self->state;
+	ZSTD_outBuffer out;
+	unsigned n;
+	int rc;
+
+	*nread = 0;
+
+	out.dst = buf;
+	out.size = nbyte;
+	out.pos = 0;
+
+	while (out.pos < out.size) {
+		if (state->in.pos >= state->in.size) {
+			/* Input buffer (zbuf) is empty: refill it with
+			 * compressed data that is obtained from the parent
+			 * reader.
+			 */
+			rc = rdd_reader_read(state->parent,
+					state->zbuf, state->zbufsize, &n);
+			if (rc != RDD_OK) {
+				return rc;
+			}
+			if (n == 0) {
+				/* End of input; it must not end inside
+				 * a frame.
+				 */
+				if (state->hint != 0) {
+					return RDD_ECOMPRESS;
+				}
+				break;
+			}
+			state->in.size = n;
+			state->in.pos = 0;
+		}
+
+		state->hint = ZSTD_decompressStream(state->dctx, &out,
+				&state->in);
+		if (ZSTD_isError(state->hint)) {
+			return RDD_ECOMPRESS;
+		}
+	}
+
+	*nread = (unsigned) out.pos;
+	state->pos += *nread;
+	return RDD_OK;
+}
+
+static int
+rdd_zstd_tell(RDD_READER *self, rdd_count_t *pos)
+{
+	RDD_ZSTD_READER *state = self->state;
+
+	*pos = state->pos;
+	return RDD_OK;
+}
+
+static int
+rdd_zstd_seek(RDD_READER *self, rdd_count_t pos)
+{
+	return RDD_ESEEK;	/* not implemented */
+}
+
+static int
+rdd_zstd_close(RDD_READER *self, int recurse)
+{
+	RDD_ZSTD_READER *state = self->state;
+	int rc;
+
+	ZSTD_freeDCtx(state->dctx);
+	state->dctx = 0;
+
+	if (recurse) {
+		if ((rc = rdd_reader_close(state->parent, 1)) != RDD_OK) {
+			return rc;
+		}
+	}
+
+	free(state->zbuf);
+	state->zbuf = 0;
+
+	return RDD_OK;
+}
+
+#endif /* HAVE_LIBZSTD */
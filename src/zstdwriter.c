@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+#ifndef lint
+static char copyright[] =
+"@(#) Copyright (c) 2002-2004\n\
+	Netherlands Forensic Institute.  All rights reserved.\n";
+#endif /* not lint */
+
+/* Implements a writer that compresses its input in Zstandard format
+ * and writes the compressed data to its parent writer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(HAVE_LIBZSTD)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#include "rdd.h"
+#include "writer.h"
+
+/* Forward declarations
+ */
+static int zstd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte);
+static int zstd_close(RDD_WRITER *w);
+
+static RDD_WRITE_OPS zstd_write_ops = {
+	zstd_write,
+	zstd_close
+};
+
+typedef struct _RDD_ZSTD_WRITER {
+	RDD_WRITER    *parent;
+	ZSTD_CCtx     *cctx;
+	ZSTD_outBuffer out;
+	unsigned char *zbuf;
+} RDD_ZSTD_WRITER;
+
+int
+rdd_open_zstd_writer(RDD_WRITER **self, RDD_WRITER *parent, int level)
+{
+	RDD_WRITER *w = 0;
+	RDD_ZSTD_WRITER *state = 0;
+	ZSTD_CCtx *cctx = 0;
+	unsigned char *zbuf = 0;
+	size_t zbufsize = ZSTD_CStreamOutSize();
+	int rc = RDD_OK;
+
+	rc = rdd_new_writer(&w, &zstd_write_ops, sizeof(RDD_ZSTD_WRITER));
+	if (rc != RDD_OK) {
+		goto error;
+	}
+	state = (RDD_ZSTD_WRITER *) w->state;
+
+	if ((zbuf = malloc(zbufsize)) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if ((cctx = ZSTD_createCCtx()) == 0) {
+		rc = RDD_NOMEM;
+		goto error;
+	}
+	if (level != 0) {
+		if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) {
+			rc = RDD_BADARG;
+			goto error;
+		}
+		if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx,
+				ZSTD_c_compressionLevel, level))) {
+			rc = RDD_ECOMPRESS;
+			goto error;
+		}
+	}
+
+	state->parent = parent;
+	state->cctx = cctx;
+	state->zbuf = zbuf;
+	state->out.dst = zbuf;
+	state->out.size = zbufsize;
+	state->out.pos = 0;
+
+	*self = w;
+	return RDD_OK;
+
+error:
+	*self = 0;
+	if (cctx != 0) ZSTD_freeCCtx(cctx);
+	if (zbuf != 0) free(zbuf);
+	if (state != 0) free(state);
+	if (w != 0) free(w);
+	return rc;
+}
+
+/* Flushes the output that the compressor has generated so far
+ * to the parent writer.
+ */
+static int
+flush(RDD_ZSTD_WRITER *state)
+{
+	int rc;
+
+	if (state->out.pos == 0) {
+		return RDD_OK;
+	}
+	rc = rdd_writer_write(state->parent, state->zbuf,
+			(unsigned) state->out.pos);
+	if (rc != RDD_OK) {
+		return rc;
+	}
+	state->out.pos = 0;
+	return RDD_OK;
+}
+
+/* Pushes the entire input buffer into the compressor.
+ */
+static int
+zstd_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	RDD_ZSTD_WRITER *state = w->state;
+	ZSTD_inBuffer in;
+	size_t ret;
+	int rc;
+
+	in.src = buf;
+	in.size = nbyte;
+	in.pos = 0;
+
+	while (in.pos < in.size) {
+		if (state->out.pos >= state->out.size) {
+			if ((rc = flush(state)) != RDD_OK) {
+				return rc;
+			}
+		}
+		ret = ZSTD_compressStream2(state->cctx, &state->out, &in,
+				ZSTD_e_continue);
+		if (ZSTD_isError(ret)) {
+			return RDD_ECOMPRESS;
+		}
+	}
+
+	return RDD_OK;
+}
+
+static int
+zstd_close(RDD_WRITER *self)
+{
+	RDD_ZSTD_WRITER *state = self->state;
+	ZSTD_inBuffer in;
+	size_t remaining;
+	int rc;
+
+	in.src = 0;
+	in.size = 0;
+	in.pos = 0;
+
+	/* End the frame and flush any pending output to the parent.
+	 */
+	do {
+		remaining = ZSTD_compressStream2(state->cctx, &state->out,
+				&in, ZSTD_e_end);
+		if (ZSTD_isError(remaining)) {
+			return RDD_ECOMPRESS;
+		}
+		if ((rc = flush(state)) != RDD_OK) {
+			return rc;
+		}
+	} while (remaining > 0);
+
+	/* Close parent.
+	 */
+	if ((rc = rdd_writer_close(state->parent)) != RDD_OK) {
+		return rc;
+	}
+
+	/* Clean up.
+	 */
+	ZSTD_freeCCtx(state->cctx);
+	state->cctx = 0;
+	free(state->zbuf);
+	state->zbuf = 0;
+
+	return RDD_OK;
+}
+
+#endif /* HAVE_LIBZSTD */
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test for adaptive block sizing in the robust copier.  It
+ * copies from a reader whose reads have a fixed overhead, so large
+ * blocks are faster, and one of whose reads is very slow.  The copier
+ * must copy the data correctly, settle on the largest block size, back
+ * off at the slow read, and return to the largest block size.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "rdd_internals.h"
+#include "md5.h"
+
+#define FILE_SIZE    (6 * 1024 * 1024)
+#define BLOCK_SIZE   (128 * 1024)
+#define MIN_BLOCK    4096
+#define OVERHEAD_US  2000	/* fixed cost of every read */
+#define SPIKE_OFF    (4 * 1024 * 1024)
+#define SPIKE_US     200000	/* cost of the read that covers SPIKE_OFF */
+#define MAX_EVENT    1024
+
+typedef struct _SLOW_READER {
+	rdd_count_t pos;
+} SLOW_READER;
+
+typedef struct _EVENT {
+	rdd_count_t offset;
+	unsigned    oldlen;
+	unsigned    newlen;
+} EVENT;
+
+static unsigned char *contents;
+static EVENT events[MAX_EVENT];
+static unsigned nevent;
+
+static void
+adaptive_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tadaptive] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+static int
+slow_read(RDD_READER *r, unsigned char *buf, unsigned nbyte, unsigned *nread)
+{
+	SLOW_READER *state = (SLOW_READER *) r->state;
+	unsigned n = nbyte;
+
+	if (state->pos + n > FILE_SIZE) {
+		n = (unsigned) (FILE_SIZE - state->pos);
+	}
+	if (state->pos <= SPIKE_OFF && SPIKE_OFF < state->pos + n) {
+		usleep(SPIKE_US);
+	}
+	usleep(OVERHEAD_US);
+	memcpy(buf, contents + state->pos, n);
+	state->pos += n;
+	*nread = n;
+	return RDD_OK;
+}
+
+static int
+slow_tell(RDD_READER *r, rdd_count_t *pos)
+{
+	*pos = ((SLOW_READER *) r->state)->pos;
+	return RDD_OK;
+}
+
+static int
+slow_seek(RDD_READER *r, rdd_count_t pos)
+{
+	if (pos > FILE_SIZE) {
+		return RDD_ESEEK;
+	}
+	((SLOW_READER *) r->state)->pos = pos;
+	return RDD_OK;
+}
+
+static int
+slow_close(RDD_READER *r, int recurse)
+{
+	/* The data live in memory, so there is nothing to release.
+	 */
+	((SLOW_READER *) r->state)->pos = 0;
+	if (!recurse) {
+		adaptive_error("unexpected non-recursive close");
+	}
+	return RDD_OK;
+}
+
+static RDD_READ_OPS slow_ops = {
+	slow_read,
+	slow_tell,
+	slow_seek,
+	slow_close
+};
+
+static void
+record_blocklen(rdd_count_t offset, unsigned oldlen, unsigned newlen,
+		double bytes_per_sec, void *env)
+{
+	if (env != &nevent || bytes_per_sec <= 0.0) {
+		adaptive_error("bad block-size callback arguments");
+	}
+	if (nevent >= MAX_EVENT) {
+		adaptive_error("too many block-size changes");
+	}
+	events[nevent].offset = offset;
+	events[nevent].oldlen = oldlen;
+	events[nevent].newlen = newlen;
+	nevent++;
+}
+
+static void
+check_events(void)
+{
+	unsigned backoff = 0;
+	unsigned i;
+
+	if (nevent == 0) {
+		adaptive_error("block size never changed");
+	}
+	for (i = 0; i < nevent; i++) {
+		EVENT *e = &events[i];
+
+		if (e->newlen < MIN_BLOCK || e->newlen > BLOCK_SIZE
+		||  (e->newlen != 2 * e->oldlen && e->oldlen != 2 * e->newlen)) {
+			adaptive_error("bad block-size change %u -> %u",
+				e->oldlen, e->newlen);
+		}
+		if (i > 0 && e->oldlen != events[i - 1].newlen) {
+			adaptive_error("block-size changes do not connect");
+		}
+		if (e->newlen < e->oldlen
+		&&  e->offset <= SPIKE_OFF
+		&&  e->offset + BLOCK_SIZE > SPIKE_OFF) {
+			backoff = 1;
+		}
+	}
+	if (events[0].oldlen != BLOCK_SIZE) {
+		adaptive_error("copier did not start at the largest block size");
+	}
+	if (!backoff) {
+		adaptive_error("copier did not back off at the slow read");
+	}
+	if (events[nevent - 1].newlen != BLOCK_SIZE) {
+		adaptive_error("copier did not settle on the largest block size");
+	}
+}
+
+int
+main(void)
+{
+	unsigned char md[16], expected[16];
+	RDD_ROBUST_PARAMS p;
+	RDD_COPIER_RETURN ret;
+	RDD_FILTERSET fset;
+	RDD_FILTER *md5f = 0;
+	RDD_COPIER *c = 0;
+	RDD_READER *r = 0;
+	MD5_CTX ctx;
+	unsigned i;
+	int rc;
+
+	printf("testing adaptive block size......");
+	fflush(stdout);
+
+	if ((contents = malloc(FILE_SIZE)) == 0) {
+		adaptive_error("out of memory");
+	}
+	srand(7);
+	for (i = 0; i < FILE_SIZE; i++) {
+		contents[i] = rand() & 0xff;
+	}
+
+	if ((rc = rdd_fset_init(&fset)) != RDD_OK) {
+		adaptive_error("rdd_fset_init() returned %d", rc);
+	}
+	if ((rc = rdd_new_md5_streamfilter(&md5f)) != RDD_OK) {
+		adaptive_error("rdd_new_md5_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_fset_add(&fset, "md5", md5f)) != RDD_OK) {
+		adaptive_error("rdd_fset_add() returned %d", rc);
+	}
+	if ((rc = rdd_new_reader(&r, &slow_ops, sizeof(SLOW_READER))) != RDD_OK) {
+		adaptive_error("rdd_new_reader() returned %d", rc);
+	}
+
+	memset(&p, 0, sizeof p);
+	p.minblocklen = MIN_BLOCK;
+	p.maxblocklen = BLOCK_SIZE;
+	p.nretry = 1;
+	p.adaptive = 1;
+	p.blocklenfun = record_blocklen;
+	p.blocklenenv = &nevent;
+	rc = rdd_new_robust_copier(&c, 0, FILE_SIZE, &p);
+	if (rc != RDD_OK) {
+		adaptive_error("rdd_new_robust_copier() returned %d", rc);
+	}
+	if ((rc = rdd_copy_exec(c, r, &fset, &ret)) != RDD_OK) {
+		adaptive_error("rdd_copy_exec() returned %d", rc);
+	}
+	if (ret.nbyte != FILE_SIZE || ret.nlost != 0) {
+		adaptive_error("bad statistics");
+	}
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, contents, FILE_SIZE);
+	MD5_Final(expected, &ctx);
+	if ((rc = rdd_filter_get_result(md5f, md, sizeof md)) != RDD_OK) {
+		adaptive_error("rdd_filter_get_result() returned %d", rc);
+	}
+	if (memcmp(md, expected, sizeof md) != 0) {
+		adaptive_error("bad MD5 hash value");
+	}
+
+	check_events();
+
+	rdd_copy_free(c);
+	rdd_reader_close(r, 1);
+	rdd_fset_clear(&fset);
+	free(contents);
+
+	printf("ok\n");
+	return 0;
+}
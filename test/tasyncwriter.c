@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test for the async writer.  It stacks async writers on a
+ * slow memory writer and checks the data that arrives, the draining
+ * of the queue before a checkpoint, and the reporting of write errors.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "checkpoint.h"
+
+#define DATA_SIZE   (1024 * 1024 + 333)
+#define ODD_WRITE   5000
+#define NBUF        4
+#define BUFSIZE     65536
+#define SAVE_POS    300001
+#define FAIL_AFTER  3		/* parent fails after this many writes */
+
+typedef struct _MEM_WRITER {
+	unsigned char *data;
+	unsigned       len;
+	unsigned       nwrite;
+	unsigned       fail_after;	/* 0: never fail */
+	unsigned       saved_len;	/* len when save was called */
+	int            closed;
+} MEM_WRITER;
+
+static unsigned char contents[DATA_SIZE];
+
+static void
+async_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tasyncwriter] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+static int
+mem_write(RDD_WRITER *w, const unsigned char *buf, unsigned nbyte)
+{
+	MEM_WRITER *m = *(MEM_WRITER **) w->state;
+
+	if (m->fail_after > 0 && m->nwrite >= m->fail_after) {
+		return RDD_EWRITE;
+	}
+	if (m->len + nbyte > DATA_SIZE) {
+		async_error("too much data");
+	}
+	usleep(1000);	/* a slow output device */
+	memcpy(m->data + m->len, buf, nbyte);
+	m->len += nbyte;
+	m->nwrite++;
+	return RDD_OK;
+}
+
+static int
+mem_close(RDD_WRITER *w)
+{
+	MEM_WRITER *m = *(MEM_WRITER **) w->state;
+
+	m->closed = 1;
+	return RDD_OK;
+}
+
+static int
+mem_save(RDD_WRITER *w, RDD_CHECKPOINT *cp, const char *name)
+{
+	MEM_WRITER *m = *(MEM_WRITER **) w->state;
+
+	m->saved_len = m->len;
+	return rdd_ckpt_put_count(cp, name, "pos", m->len);
+}
+
+static RDD_WRITE_OPS mem_ops = {
+	mem_write,
+	mem_close,
+	mem_save,
+	0,
+	0
+};
+
+static RDD_WRITER *
+open_async(MEM_WRITER *m, unsigned fail_after)
+{
+	RDD_WRITER *parent = 0;
+	RDD_WRITER *w = 0;
+	int rc;
+
+	memset(m, 0, sizeof *m);
+	if ((m->data = malloc(DATA_SIZE)) == 0) {
+		async_error("out of memory");
+	}
+	m->fail_after = fail_after;
+
+	if ((rc = rdd_new_writer(&parent, &mem_ops, sizeof m)) != RDD_OK) {
+		async_error("rdd_new_writer() returned %d", rc);
+	}
+	*(MEM_WRITER **) parent->state = m;
+
+	if ((rc = rdd_open_async_writer(&w, parent, NBUF, BUFSIZE)) != RDD_OK) {
+		async_error("rdd_open_async_writer() returned %d", rc);
+	}
+	return w;
+}
+
+/* Writes contents[start..end) in odd-sized pieces; returns the first
+ * error.
+ */
+static int
+write_range(RDD_WRITER *w, unsigned start, unsigned end)
+{
+	unsigned pos, n;
+	int rc;
+
+	for (pos = start; pos < end; pos += n) {
+		n = end - pos < ODD_WRITE ? end - pos : ODD_WRITE;
+		if ((rc = rdd_writer_write(w, contents + pos, n)) != RDD_OK) {
+			return rc;
+		}
+	}
+	return RDD_OK;
+}
+
+static void
+test_copy(void)
+{
+	RDD_CHECKPOINT *cp = 0;
+	RDD_ASYNC_STATS stats;
+	MEM_WRITER m;
+	RDD_WRITER *w;
+	int rc;
+
+	w = open_async(&m, 0);
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		async_error("rdd_new_checkpoint() returned %d", rc);
+	}
+
+	if ((rc = write_range(w, 0, SAVE_POS)) != RDD_OK) {
+		async_error("write returned %d", rc);
+	}
+	if ((rc = rdd_writer_save(w, cp, "out")) != RDD_OK) {
+		async_error("rdd_writer_save() returned %d", rc);
+	}
+	if (m.saved_len != SAVE_POS) {
+		async_error("queue not drained before save (%u bytes)",
+			m.saved_len);
+	}
+	if ((rc = write_range(w, SAVE_POS, DATA_SIZE)) != RDD_OK) {
+		async_error("write returned %d", rc);
+	}
+
+	if ((rc = rdd_async_writer_stats(w, &stats)) != RDD_OK) {
+		async_error("rdd_async_writer_stats() returned %d", rc);
+	}
+	if (stats.nbuf != NBUF || stats.maxdepth > NBUF || stats.stall < 0.0) {
+		async_error("bad statistics");
+	}
+
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		async_error("rdd_writer_close() returned %d", rc);
+	}
+	if (!m.closed) {
+		async_error("parent not closed");
+	}
+	if (m.len != DATA_SIZE || memcmp(m.data, contents, DATA_SIZE) != 0) {
+		async_error("parent received the wrong data");
+	}
+
+	rdd_free_checkpoint(cp);
+	free(m.data);
+}
+
+static void
+test_error(void)
+{
+	MEM_WRITER m;
+	RDD_WRITER *w;
+	int rc;
+
+	w = open_async(&m, FAIL_AFTER);
+
+	/* The error shows up on a later write or else on close.
+	 */
+	rc = write_range(w, 0, DATA_SIZE);
+	if (rc == RDD_OK) {
+		rc = rdd_writer_close(w);
+	} else {
+		(void) rdd_writer_close(w);
+	}
+	if (rc != RDD_EWRITE) {
+		async_error("write error not reported (%d)", rc);
+	}
+	if (m.len != FAIL_AFTER * BUFSIZE) {
+		async_error("parent received %u bytes", m.len);
+	}
+
+	free(m.data);
+}
+
+int
+main(void)
+{
+	RDD_WRITER *w = 0;
+	unsigned i;
+
+	srand(17);
+	for (i = 0; i < DATA_SIZE; i++) {
+		contents[i] = rand() & 0xff;
+	}
+
+	printf("testing async writer......");
+	fflush(stdout);
+
+	if (rdd_open_async_writer(&w, 0, 1, BUFSIZE) != RDD_BADARG) {
+		async_error("one buffer accepted");
+	}
+
+	test_copy();
+	test_error();
+
+	printf("ok\n");
+	return 0;
+}
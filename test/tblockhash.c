@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* A unit-test for binary block-hash files.  The block MD5 filter is
+ * run in text mode and in binary mode, sequentially and in parallel;
+ * the binary files, converted to text, must equal the text file.
+ * The test then looks up digests with and without an index, resumes
+ * a binary filter from a checkpoint, and verifies an image with one
+ * corrupted block and a truncated image.  Finally, it indexes a file
+ * that is too large to be sorted in a single run.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "checkpoint.h"
+#include "blockhash.h"
+#include "rdd_internals.h"
+
+#define BLOCK_SIZE  4096
+#define NBLOCK      700
+#define DATA_SIZE   (NBLOCK * BLOCK_SIZE + 1234)
+#define TEXT_FILE   "tblockhash.txt"
+#define BIN_FILE    "tblockhash.bin"
+#define CONV_FILE   "tblockhash.conv"
+#define MAX_FOUND   16
+#define NBLOCK_LARGE (3 * 65536 + 1234)	/* needs four sorted runs */
+
+static unsigned char *data;
+
+static void
+blockhash_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tblockhash] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEXT_FILE);
+	unlink(BIN_FILE);
+	unlink(CONV_FILE);
+	exit(EXIT_FAILURE);
+}
+
+/* Pushes data[start..end) into f in pieces of varying size.
+ */
+static void
+push_range(RDD_FILTER *f, const unsigned char *buf,
+		unsigned start, unsigned end)
+{
+	unsigned pos, len;
+	int rc;
+
+	for (pos = start; pos < end; pos += len) {
+		len = 1 + (pos * 7) % 50000;
+		if (len > end - pos) {
+			len = end - pos;
+		}
+		if ((rc = rdd_filter_push(f, buf + pos, len)) != RDD_OK) {
+			blockhash_error("rdd_filter_push() returned %d", rc);
+		}
+	}
+}
+
+static void
+close_filter(RDD_FILTER *f)
+{
+	int rc;
+
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		blockhash_error("rdd_filter_close() returned %d", rc);
+	}
+	if ((rc = rdd_filter_free(f)) != RDD_OK) {
+		blockhash_error("rdd_filter_free() returned %d", rc);
+	}
+}
+
+static RDD_FILTER *
+new_binary_filter(int mode, int indexed, unsigned nworker)
+{
+	RDD_FILTER *f;
+	int rc;
+
+	rc = rdd_new_binary_md5_blockfilter(&f, BLOCK_SIZE, 0,
+					BIN_FILE, mode, indexed);
+	if (rc != RDD_OK) {
+		blockhash_error("cannot create binary MD5 filter (%d)", rc);
+	}
+	if (nworker > 0 && (rc = rdd_filter_set_parallel(f, nworker)) != RDD_OK) {
+		blockhash_error("rdd_filter_set_parallel() returned %d", rc);
+	}
+	return f;
+}
+
+static RDD_BLOCKHASH_FILE *
+open_blockhash(void)
+{
+	RDD_BLOCKHASH_FILE *bf;
+	int rc;
+
+	if ((rc = rdd_blockhash_open(&bf, BIN_FILE)) != RDD_OK) {
+		blockhash_error("rdd_blockhash_open() returned %d", rc);
+	}
+	return bf;
+}
+
+static void
+compare_files(const char *path1, const char *path2, const char *what)
+{
+	FILE *fp1, *fp2;
+	int c1, c2;
+
+	if ((fp1 = fopen(path1, "rb")) == NULL
+	||  (fp2 = fopen(path2, "rb")) == NULL) {
+		blockhash_error("cannot open output files");
+	}
+	do {
+		c1 = getc(fp1);
+		c2 = getc(fp2);
+		if (c1 != c2) {
+			blockhash_error("%s: output files differ", what);
+		}
+	} while (c1 != EOF);
+	fclose(fp1);
+	fclose(fp2);
+}
+
+/* Checks that the header is stored little-endian, whatever the
+ * byte order of this machine.
+ */
+static void
+check_layout(const char *what)
+{
+	unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE];
+	FILE *fp;
+
+	if ((fp = fopen(BIN_FILE, "rb")) == NULL) {
+		blockhash_error("cannot open %s", BIN_FILE);
+	}
+	if (fread(buf, sizeof buf, 1, fp) != 1) {
+		blockhash_error("%s: cannot read header", what);
+	}
+	fclose(fp);
+
+	if (buf[8] != (RDD_BLOCKHASH_VERSION & 0xff)
+	||  buf[9] != (RDD_BLOCKHASH_VERSION >> 8)
+	||  buf[20] != (BLOCK_SIZE & 0xff)
+	||  buf[21] != (BLOCK_SIZE >> 8)
+	||  buf[40] != ((NBLOCK + 1) & 0xff)
+	||  buf[41] != ((NBLOCK + 1) >> 8)
+	||  buf[42] != 0) {
+		blockhash_error("%s: header is not little-endian", what);
+	}
+}
+
+/* Converts the binary file to text and compares the result with
+ * the output of the text filter.
+ */
+static void
+check_binary(const char *what, int indexed)
+{
+	RDD_BLOCKHASH_FILE *bf;
+	FILE *fp;
+	int rc;
+
+	bf = open_blockhash();
+	if ((bf->header.flags & RDD_BLOCKHASH_FINISHED) == 0) {
+		blockhash_error("%s: file is not finished", what);
+	}
+	if (bf->header.nblock != NBLOCK + 1
+	||  bf->header.imagesize != DATA_SIZE
+	||  bf->header.blocksize != BLOCK_SIZE) {
+		blockhash_error("%s: bad header", what);
+	}
+	if ((bf->index != 0) != (indexed != 0)) {
+		blockhash_error("%s: bad index", what);
+	}
+
+	if ((fp = fopen(CONV_FILE, "w")) == NULL) {
+		blockhash_error("cannot open %s", CONV_FILE);
+	}
+	if ((rc = rdd_blockhash_print(bf, fp)) != RDD_OK) {
+		blockhash_error("rdd_blockhash_print() returned %d", rc);
+	}
+	fclose(fp);
+	rdd_blockhash_close(bf);
+
+	check_layout(what);
+	compare_files(TEXT_FILE, CONV_FILE, what);
+}
+
+/* Every block in [0, NBLOCK) that is all zeroes is a duplicate of
+ * block 0; no other block is.
+ */
+static void
+check_lookup(const char *what)
+{
+	RDD_BLOCKHASH_FILE *bf;
+	rdd_count_t blocks[MAX_FOUND];
+	rdd_count_t nfound;
+	unsigned char md[RDD_BLOCKHASH_MD5_SIZE];
+	unsigned i, n;
+	int rc;
+
+	bf = open_blockhash();
+
+	memcpy(md, rdd_blockhash_digest(bf, 0), sizeof md);
+	rc = rdd_blockhash_lookup(bf, md, blocks, MAX_FOUND, &nfound);
+	if (rc != RDD_OK) {
+		blockhash_error("rdd_blockhash_lookup() returned %d", rc);
+	}
+	for (i = n = 0; i < NBLOCK; i++) {
+		if (i % 100 == 0) {
+			if (n < MAX_FOUND && blocks[n] != i) {
+				blockhash_error("%s: block %u not found", what, i);
+			}
+			n++;
+		}
+	}
+	if (nfound != n) {
+		blockhash_error("%s: found %u blocks, expected %u",
+			what, (unsigned) nfound, n);
+	}
+
+	memcpy(md, rdd_blockhash_digest(bf, 123), sizeof md);
+	rc = rdd_blockhash_lookup(bf, md, blocks, MAX_FOUND, &nfound);
+	if (rc != RDD_OK || nfound != 1 || blocks[0] != 123) {
+		blockhash_error("%s: lookup of block 123 failed", what);
+	}
+
+	memset(md, 0xee, sizeof md);
+	rc = rdd_blockhash_lookup(bf, md, blocks, MAX_FOUND, &nfound);
+	if (rc != RDD_OK || nfound != 0) {
+		blockhash_error("%s: found a nonexistent digest", what);
+	}
+
+	if (rdd_blockhash_digest(bf, NBLOCK + 1) != 0) {
+		blockhash_error("%s: found a nonexistent block", what);
+	}
+
+	rdd_blockhash_close(bf);
+}
+
+/* Saves a checkpoint in the middle of a block, pushes some more
+ * data, and resumes from the checkpoint.
+ */
+static void
+run_resumed(unsigned nworker)
+{
+	RDD_CHECKPOINT *cp;
+	RDD_FILTER *f;
+	unsigned half = DATA_SIZE / 2 + 17;
+	int rc;
+
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		blockhash_error("rdd_new_checkpoint() returned %d", rc);
+	}
+
+	f = new_binary_filter(RDD_OVERWRITE, 1, nworker);
+	push_range(f, data, 0, half);
+	if ((rc = rdd_filter_save(f, cp, "filter")) != RDD_OK) {
+		blockhash_error("rdd_filter_save() returned %d", rc);
+	}
+	push_range(f, data, half, half + 5 * BLOCK_SIZE + 3);
+	close_filter(f);
+
+	f = new_binary_filter(RDD_APPEND, 1, nworker);
+	if ((rc = rdd_filter_restore(f, cp, "filter")) != RDD_OK) {
+		blockhash_error("rdd_filter_restore() returned %d", rc);
+	}
+	push_range(f, data, half, DATA_SIZE);
+	close_filter(f);
+
+	rdd_free_checkpoint(cp);
+}
+
+static unsigned num_reported;
+static rdd_count_t first_error;
+static int missing_reported;
+
+static void
+handle_error(rdd_count_t pos, const unsigned char *expected,
+	const unsigned char *computed, unsigned size, void *env)
+{
+	unsigned *count = (unsigned *) env;
+
+	if (expected == 0 || size != RDD_BLOCKHASH_MD5_SIZE) {
+		blockhash_error("bad error report");
+	}
+	if (computed == 0) {
+		missing_reported = 1;
+		return;
+	}
+	if ((*count)++ == 0) {
+		first_error = pos;
+	}
+}
+
+static unsigned
+verify(const unsigned char *buf, unsigned size, unsigned nworker)
+{
+	RDD_BLOCKHASH_FILE *bf;
+	RDD_FILTER *f;
+	unsigned num_error;
+	int rc;
+
+	num_reported = 0;
+	first_error = 0;
+	missing_reported = 0;
+
+	bf = open_blockhash();
+	rc = rdd_new_verify_md5_blockfilter(&f, bf, handle_error,
+					&num_reported);
+	if (rc != RDD_OK) {
+		blockhash_error("cannot create verification filter (%d)", rc);
+	}
+	if (nworker > 0 && (rc = rdd_filter_set_parallel(f, nworker)) != RDD_OK) {
+		blockhash_error("rdd_filter_set_parallel() returned %d", rc);
+	}
+	push_range(f, buf, 0, size);
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		blockhash_error("rdd_filter_close() returned %d", rc);
+	}
+	rc = rdd_filter_get_result(f, (unsigned char *) &num_error,
+				sizeof num_error);
+	if (rc != RDD_OK) {
+		blockhash_error("rdd_filter_get_result() returned %d", rc);
+	}
+	if ((rc = rdd_filter_free(f)) != RDD_OK) {
+		blockhash_error("rdd_filter_free() returned %d", rc);
+	}
+	rdd_blockhash_close(bf);
+
+	return num_error;
+}
+
+static void
+check_verify(unsigned nworker)
+{
+	unsigned char *copy;
+
+	if ((copy = malloc(DATA_SIZE)) == 0) {
+		blockhash_error("out of memory");
+	}
+	memcpy(copy, data, DATA_SIZE);
+
+	if (verify(copy, DATA_SIZE, nworker) != 0 || num_reported != 0) {
+		blockhash_error("verification of a good image failed");
+	}
+
+	copy[321 * BLOCK_SIZE + 99] ^= 0x1;
+	if (verify(copy, DATA_SIZE, nworker) != 1
+	||  num_reported != 1 || first_error != 321 * BLOCK_SIZE) {
+		blockhash_error("corrupted block not detected");
+	}
+	copy[321 * BLOCK_SIZE + 99] ^= 0x1;
+
+	if (verify(copy, 10 * BLOCK_SIZE, nworker) != NBLOCK + 1 - 10
+	||  num_reported != 0 || !missing_reported) {
+		blockhash_error("truncated image not detected");
+	}
+
+	free(copy);
+}
+
+/* Writes NBLOCK_LARGE digests with many duplicates, finishes the
+ * file with an index, and checks that the index lists every block
+ * once, sorted by digest and block number.
+ */
+static void
+check_large_index(void)
+{
+	RDD_BLOCKHASH_HEADER hdr;
+	RDD_BLOCKHASH_FILE *bf;
+	unsigned char buf[RDD_BLOCKHASH_HEADER_SIZE];
+	unsigned char md[RDD_BLOCKHASH_MD5_SIZE];
+	unsigned char *seen;
+	const unsigned char *entry, *prev;
+	rdd_count_t blocknum, prevnum;
+	unsigned long v;
+	unsigned i;
+	FILE *fp;
+	int rc;
+
+	rdd_blockhash_init_header(&hdr, RDD_BLOCKHASH_MD5, BLOCK_SIZE, 0);
+	hdr.nblock = NBLOCK_LARGE;
+	hdr.imagesize = (rdd_count_t) NBLOCK_LARGE * BLOCK_SIZE;
+	if ((fp = fopen(BIN_FILE, "wb")) == NULL) {
+		blockhash_error("cannot open %s", BIN_FILE);
+	}
+	rdd_blockhash_encode_header(&hdr, buf);
+	fwrite(buf, sizeof buf, 1, fp);
+	memset(md, 0x5a, sizeof md);
+	for (i = 0; i < NBLOCK_LARGE; i++) {
+		v = (i * 2654435761UL) % 40009;
+		md[0] = (unsigned char) (v >> 8);
+		md[1] = (unsigned char) v;
+		if (fwrite(md, sizeof md, 1, fp) != 1) {
+			blockhash_error("cannot write %s", BIN_FILE);
+		}
+	}
+	if ((rc = rdd_blockhash_finish(fp, BIN_FILE, &hdr, 1)) != RDD_OK) {
+		blockhash_error("rdd_blockhash_finish() returned %d", rc);
+	}
+	fclose(fp);
+
+	bf = open_blockhash();
+	if (bf->index == 0 || bf->header.nblock != NBLOCK_LARGE
+	||  bf->size != bf->header.indexpos
+			+ NBLOCK_LARGE * (RDD_BLOCKHASH_MD5_SIZE + 8)) {
+		blockhash_error("large index: bad layout");
+	}
+	if ((seen = calloc(NBLOCK_LARGE, 1)) == 0) {
+		blockhash_error("out of memory");
+	}
+	prev = 0;
+	prevnum = 0;
+	for (i = 0; i < NBLOCK_LARGE; i++) {
+		entry = bf->index + i * (RDD_BLOCKHASH_MD5_SIZE + 8);
+		for (blocknum = 0, rc = 8; rc > 0; rc--) {
+			blocknum = (blocknum << 8)
+				| entry[RDD_BLOCKHASH_MD5_SIZE + rc - 1];
+		}
+		if (blocknum >= NBLOCK_LARGE || seen[blocknum]
+		||  memcmp(entry, rdd_blockhash_digest(bf, blocknum),
+				RDD_BLOCKHASH_MD5_SIZE) != 0) {
+			blockhash_error("large index: bad entry %u", i);
+		}
+		seen[blocknum] = 1;
+		if (prev != 0) {
+			rc = memcmp(prev, entry, RDD_BLOCKHASH_MD5_SIZE);
+			if (rc > 0 || (rc == 0 && prevnum > blocknum)) {
+				blockhash_error("large index: entry %u "
+					"out of order", i);
+			}
+		}
+		prev = entry;
+		prevnum = blocknum;
+	}
+	free(seen);
+	rdd_blockhash_close(bf);
+}
+
+int
+main(void)
+{
+	static unsigned nworkers[] = {0, 3};
+	RDD_FILTER *f;
+	unsigned i, k;
+	int rc;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		blockhash_error("out of memory");
+	}
+	srand(1616);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = (i / BLOCK_SIZE) % 100 == 0 ? 0 : rand() & 0xff;
+	}
+
+	rc = rdd_new_md5_blockfilter(&f, BLOCK_SIZE, TEXT_FILE, RDD_OVERWRITE);
+	if (rc != RDD_OK) {
+		blockhash_error("cannot create text MD5 filter (%d)", rc);
+	}
+	push_range(f, data, 0, DATA_SIZE);
+	close_filter(f);
+
+	for (k = 0; k < sizeof nworkers / sizeof nworkers[0]; k++) {
+		printf("testing binary block-hash files, %u threads......",
+			nworkers[k]);
+		fflush(stdout);
+
+		f = new_binary_filter(RDD_OVERWRITE, 0, nworkers[k]);
+		push_range(f, data, 0, DATA_SIZE);
+		close_filter(f);
+		check_binary("binary", 0);
+		check_lookup("binary");
+
+		f = new_binary_filter(RDD_OVERWRITE, 1, nworkers[k]);
+		push_range(f, data, 0, DATA_SIZE);
+		close_filter(f);
+		check_binary("indexed", 1);
+		check_lookup("indexed");
+
+		run_resumed(nworkers[k]);
+		check_binary("resumed", 1);
+
+		check_verify(nworkers[k]);
+		printf("OK\n");
+	}
+
+	printf("testing a large index......");
+	fflush(stdout);
+	check_large_index();
+	printf("OK\n");
+
+	unlink(TEXT_FILE);
+	unlink(BIN_FILE);
+	unlink(CONV_FILE);
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for checkpoints.  It copies a test file with a robust
+ * copier, a split output file, a hash filter, and several block
+ * filters; it saves a checkpoint halfway, interrupts the copy a few
+ * blocks later, and resumes it from the checkpoint.  The hash value
+ * and all output files must be the same as those of a copy that was
+ * not interrupted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "checkpoint.h"
+#include "rdd_internals.h"
+
+#define TEST_FILE   "tcheckpoint.dat"
+#define FAULT_FILE  "tcheckpoint.flt"
+#define CKPT_FILE   "tcheckpoint.ckp"
+#define FILE_SIZE   (200 * 1024 + 333)
+#define BLOCK_SIZE  8192
+#define MIN_BLOCK   512
+#define SPLIT_SIZE  (64 * 1024)
+#define NPART       ((FILE_SIZE + SPLIT_SIZE - 1) / SPLIT_SIZE)
+
+static const char *suffixes[] = {"md5", "stats", "crc", "adler"};
+#define NSUFFIX (sizeof suffixes / sizeof suffixes[0])
+
+typedef struct _RUN {
+	rdd_count_t     ncopied;
+	RDD_COPIER     *copier;
+	RDD_FILTERSET  *fset;
+	RDD_CHECKPOINT *cp;
+	unsigned        ncall;
+	unsigned        save_at;	/* save a checkpoint at this call */
+	unsigned        abort_at;	/* 0: never abort */
+} RUN;
+
+static void
+cleanup(void)
+{
+	char path[64];
+	unsigned i;
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	unlink(CKPT_FILE);
+	for (i = 0; i < NPART; i++) {
+		sprintf(path, "%u-tcheckpoint-ref.img", i);
+		unlink(path);
+		sprintf(path, "%u-tcheckpoint-run.img", i);
+		unlink(path);
+	}
+	for (i = 0; i < NSUFFIX; i++) {
+		sprintf(path, "tcheckpoint-ref.%s", suffixes[i]);
+		unlink(path);
+		sprintf(path, "tcheckpoint-run.%s", suffixes[i]);
+		unlink(path);
+	}
+}
+
+static void
+ckpt_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tcheckpoint] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	cleanup();
+	exit(EXIT_FAILURE);
+}
+
+static void
+create_files(void)
+{
+	FILE *fp;
+	unsigned i;
+
+	if ((fp = fopen(TEST_FILE, "wb")) == NULL) {
+		ckpt_error("cannot create %s", TEST_FILE);
+	}
+	srand(7);
+	for (i = 0; i < FILE_SIZE; i++) {
+		putc(rand() & 0x3f, fp);	/* low entropy */
+	}
+	fclose(fp);
+
+	if ((fp = fopen(FAULT_FILE, "w")) == NULL) {
+		ckpt_error("cannot create %s", FAULT_FILE);
+	}
+	fprintf(fp, "70000 1.0\n");
+	fclose(fp);
+}
+
+static int
+handle_progress(rdd_count_t ncopied, void *env)
+{
+	RUN *run = (RUN *) env;
+	int rc;
+
+	if (ncopied < run->ncopied || ncopied > FILE_SIZE) {
+		ckpt_error("bad progress count");
+	}
+	run->ncopied = ncopied;
+	run->ncall++;
+	if (run->ncall == run->save_at) {
+		rc = rdd_copy_save(run->copier, run->cp, "copier");
+		if (rc != RDD_OK) {
+			ckpt_error("rdd_copy_save() returned %d", rc);
+		}
+		if ((rc = rdd_fset_save(run->fset, run->cp)) != RDD_OK) {
+			ckpt_error("rdd_fset_save() returned %d", rc);
+		}
+		if ((rc = rdd_ckpt_save(run->cp, CKPT_FILE)) != RDD_OK) {
+			ckpt_error("rdd_ckpt_save() returned %d", rc);
+		}
+	}
+	if (run->abort_at > 0 && run->ncall >= run->abort_at) {
+		return RDD_ABORTED;
+	}
+	return RDD_OK;
+}
+
+static void
+add_filter(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f, int rc)
+{
+	if (rc != RDD_OK) {
+		ckpt_error("cannot create %s filter (%d)", name, rc);
+	}
+	if ((rc = rdd_fset_add(fset, name, f)) != RDD_OK) {
+		ckpt_error("rdd_fset_add() returned %d", rc);
+	}
+}
+
+/* Copies the test file.  Returns the result of rdd_copy_exec().
+ */
+static int
+run_copy(const char *name, rdd_write_mode_t wmode, RUN *run,
+	int parallel, unsigned char *md5)
+{
+	RDD_ROBUST_PARAMS p;
+	RDD_COPIER_RETURN ret;
+	RDD_FILTERSET fset;
+	RDD_FILTER *f = 0;
+	RDD_FILTER *md5f = 0;
+	RDD_WRITER *w = 0;
+	RDD_READER *r = 0;
+	char path[64];
+	int rc, exec_rc;
+
+	if ((rc = rdd_fset_init(&fset)) != RDD_OK) {
+		ckpt_error("rdd_fset_init() returned %d", rc);
+	}
+
+	sprintf(path, "tcheckpoint-%s.img", name);
+	rc = rdd_open_part_writer(&w, path, FILE_SIZE, SPLIT_SIZE, wmode);
+	if (rc != RDD_OK) {
+		ckpt_error("rdd_open_part_writer() returned %d", rc);
+	}
+	rc = rdd_new_write_streamfilter(&f, w);
+	add_filter(&fset, "write", f, rc);
+	rc = rdd_new_md5_streamfilter(&md5f);
+	add_filter(&fset, "MD5 stream", md5f, rc);
+	sprintf(path, "tcheckpoint-%s.md5", name);
+	rc = rdd_new_md5_blockfilter(&f, 4096, path, wmode);
+	add_filter(&fset, "MD5 block", f, rc);
+	sprintf(path, "tcheckpoint-%s.stats", name);
+	rc = rdd_new_stats_blockfilter(&f, 10000, path, wmode);
+	add_filter(&fset, "statistical block", f, rc);
+	sprintf(path, "tcheckpoint-%s.crc", name);
+	rc = rdd_new_crc32_blockfilter(&f, 3000, path, wmode);
+	add_filter(&fset, "CRC-32 block", f, rc);
+	sprintf(path, "tcheckpoint-%s.adler", name);
+	rc = rdd_new_adler32_blockfilter(&f, 32768, path, wmode);
+	add_filter(&fset, "Adler32 block", f, rc);
+	if (parallel && (rc = rdd_fset_set_parallel(&fset, 2, 4)) != RDD_OK) {
+		ckpt_error("rdd_fset_set_parallel() returned %d", rc);
+	}
+
+	if ((rc = rdd_open_file_reader(&r, TEST_FILE, 0)) != RDD_OK) {
+		ckpt_error("cannot open %s", TEST_FILE);
+	}
+	if ((rc = rdd_open_faulty_reader(&r, r, FAULT_FILE)) != RDD_OK) {
+		ckpt_error("rdd_open_faulty_reader() returned %d", rc);
+	}
+
+	memset(&p, 0, sizeof p);
+	p.minblocklen = MIN_BLOCK;
+	p.maxblocklen = BLOCK_SIZE;
+	p.nretry = 1;
+	p.progressfun = handle_progress;
+	p.progressenv = run;
+	rc = rdd_new_robust_copier(&run->copier, 0, FILE_SIZE, &p);
+	if (rc != RDD_OK) {
+		ckpt_error("rdd_new_robust_copier() returned %d", rc);
+	}
+	run->fset = &fset;
+
+	if (wmode == RDD_APPEND) {
+		rc = rdd_copy_restore(run->copier, run->cp, "copier");
+		if (rc != RDD_OK) {
+			ckpt_error("rdd_copy_restore() returned %d", rc);
+		}
+		if ((rc = rdd_fset_restore(&fset, run->cp)) != RDD_OK) {
+			ckpt_error("rdd_fset_restore() returned %d", rc);
+		}
+	}
+
+	exec_rc = rdd_copy_exec(run->copier, r, &fset, &ret);
+	if (exec_rc == RDD_OK) {
+		if (ret.nbyte != FILE_SIZE || ret.nlost != MIN_BLOCK) {
+			ckpt_error("bad copy statistics");
+		}
+		if ((rc = rdd_filter_get_result(md5f, md5, 16)) != RDD_OK) {
+			ckpt_error("rdd_filter_get_result() returned %d", rc);
+		}
+	}
+
+	rdd_copy_free(run->copier);
+	rdd_fset_clear(&fset);
+	rdd_writer_close(w);
+	rdd_reader_close(r, 1);
+	return exec_rc;
+}
+
+static unsigned char *
+read_file(const char *path, unsigned *len)
+{
+	unsigned char *buf;
+	struct stat info;
+	FILE *fp;
+
+	if (stat(path, &info) < 0 || (fp = fopen(path, "rb")) == NULL) {
+		ckpt_error("cannot open %s", path);
+	}
+	if ((buf = malloc(info.st_size + 1)) == 0) {
+		ckpt_error("out of memory");
+	}
+	*len = fread(buf, 1, info.st_size, fp);
+	fclose(fp);
+	return buf;
+}
+
+static void
+compare_files(const char *refpath, const char *path)
+{
+	unsigned char *ref, *buf;
+	unsigned reflen, len;
+
+	ref = read_file(refpath, &reflen);
+	buf = read_file(path, &len);
+	if (reflen != len || memcmp(ref, buf, len) != 0) {
+		ckpt_error("%s differs from %s", path, refpath);
+	}
+	free(ref);
+	free(buf);
+}
+
+/* A copy that is aborted through its progress handler closes (and
+ * write-protects) its output files.  A copy that is killed does not;
+ * make the files writable again to get the same situation.
+ */
+static void
+unprotect_files(void)
+{
+	char path[64];
+	unsigned i;
+
+	for (i = 0; i < NPART; i++) {
+		sprintf(path, "%u-tcheckpoint-run.img", i);
+		chmod(path, S_IRUSR|S_IWUSR);
+	}
+	for (i = 0; i < NSUFFIX; i++) {
+		sprintf(path, "tcheckpoint-run.%s", suffixes[i]);
+		chmod(path, S_IRUSR|S_IWUSR);
+	}
+}
+
+static void
+test_records(void)
+{
+	RDD_CHECKPOINT *cp = 0;
+	unsigned char data[300];
+	unsigned char buf[300];
+	rdd_count_t count;
+	unsigned i;
+	int rc;
+
+	printf("testing checkpoint records......");
+
+	for (i = 0; i < sizeof data; i++) {
+		data[i] = (unsigned char) (i * 7);
+	}
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		ckpt_error("rdd_new_checkpoint() returned %d", rc);
+	}
+	if (rdd_ckpt_put(cp, "a b", "data", data, sizeof data) != RDD_OK
+	||  rdd_ckpt_put(cp, "a b", "empty", data, 0) != RDD_OK
+	||  rdd_ckpt_put_count(cp, "c", "n", 5) != RDD_OK
+	||  rdd_ckpt_put_count(cp, "c", "n", 123456789) != RDD_OK) {
+		ckpt_error("rdd_ckpt_put() failed");
+	}
+	if (cp->nrec != 3) {
+		ckpt_error("checkpoint has %u records instead of 3", cp->nrec);
+	}
+	if ((rc = rdd_ckpt_save(cp, CKPT_FILE)) != RDD_OK) {
+		ckpt_error("rdd_ckpt_save() returned %d", rc);
+	}
+	rdd_free_checkpoint(cp);
+
+	if ((rc = rdd_ckpt_load(&cp, CKPT_FILE)) != RDD_OK) {
+		ckpt_error("rdd_ckpt_load() returned %d", rc);
+	}
+	if (rdd_ckpt_get(cp, "a b", "data", buf, sizeof buf) != RDD_OK
+	||  memcmp(buf, data, sizeof data) != 0
+	||  rdd_ckpt_get(cp, "a b", "empty", buf, 0) != RDD_OK
+	||  rdd_ckpt_get_count(cp, "c", "n", &count) != RDD_OK
+	||  count != 123456789) {
+		ckpt_error("checkpoint changed after save");
+	}
+	if (rdd_ckpt_get(cp, "a b", "data", buf, 10) != RDD_ESYNTAX) {
+		ckpt_error("record with the wrong size accepted");
+	}
+	if (rdd_ckpt_get(cp, "a", "data", buf, sizeof buf) != RDD_NOTFOUND) {
+		ckpt_error("missing record found");
+	}
+	rdd_free_checkpoint(cp);
+	unlink(CKPT_FILE);
+
+	printf("OK\n");
+}
+
+static void
+test_resume(void)
+{
+	unsigned char refmd5[16], md5[16];
+	char refpath[64], path[64];
+	RUN run;
+	unsigned i;
+	int rc;
+
+	printf("testing interrupted copies......");
+
+	/* Reference copy.
+	 */
+	memset(&run, 0, sizeof run);
+	if ((rc = rdd_new_checkpoint(&run.cp)) != RDD_OK) {
+		ckpt_error("rdd_new_checkpoint() returned %d", rc);
+	}
+	if ((rc = run_copy("ref", RDD_OVERWRITE, &run, 0, refmd5)) != RDD_OK) {
+		ckpt_error("reference copy returned %d", rc);
+	}
+
+	/* Save a checkpoint in the second part, during the recovery
+	 * from the read error, and abort a few blocks later.
+	 */
+	run.ncall = 0;
+	run.ncopied = 0;
+	run.save_at = 13;
+	run.abort_at = 17;
+	if ((rc = run_copy("run", RDD_OVERWRITE, &run, 1, md5)) != RDD_ABORTED) {
+		ckpt_error("interrupted copy returned %d", rc);
+	}
+	rdd_free_checkpoint(run.cp);
+	unprotect_files();
+
+	/* Resume.
+	 */
+	if ((rc = rdd_ckpt_load(&run.cp, CKPT_FILE)) != RDD_OK) {
+		ckpt_error("rdd_ckpt_load() returned %d", rc);
+	}
+	run.ncall = 0;
+	run.ncopied = 0;
+	run.save_at = 0;
+	run.abort_at = 0;
+	if ((rc = run_copy("run", RDD_APPEND, &run, 0, md5)) != RDD_OK) {
+		ckpt_error("resumed copy returned %d", rc);
+	}
+	rdd_free_checkpoint(run.cp);
+
+	if (memcmp(md5, refmd5, sizeof md5) != 0) {
+		ckpt_error("resumed copy has a different MD5 hash value");
+	}
+	for (i = 0; i < NPART; i++) {
+		sprintf(refpath, "%u-tcheckpoint-ref.img", i);
+		sprintf(path, "%u-tcheckpoint-run.img", i);
+		compare_files(refpath, path);
+	}
+	for (i = 0; i < NSUFFIX; i++) {
+		sprintf(refpath, "tcheckpoint-ref.%s", suffixes[i]);
+		sprintf(path, "tcheckpoint-run.%s", suffixes[i]);
+		compare_files(refpath, path);
+	}
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_files();
+
+	test_records();
+	test_resume();
+
+	cleanup();
+	return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test and benchmark for the block-checksum kernels.  Adler32
+ * and CRC32 are compared with zlib, and CRC32C with a bitwise reference
+ * implementation, for many buffer sizes, alignments, and split points.
+ * A CRC32C checksum file is then written and verified.  Finally, the
+ * throughput of each kernel is printed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "checksum.h"
+#include "rdd_internals.h"
+
+#define DATA_SIZE   (1024 * 1024 + 77)
+#define BLOCK_SIZE  4096
+#define TEST_FILE   "tchecksum.crc32c"
+#define BENCH_SIZE  (64 * 1024 * 1024)
+
+static unsigned char *data;
+
+static void
+checksum_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tchecksum] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static rdd_checksum_t
+crc32c_reference(const unsigned char *buf, unsigned nbyte)
+{
+	rdd_checksum_t c = 0xffffffff;
+	unsigned k;
+
+	while (nbyte-- > 0) {
+		c ^= *buf++;
+		for (k = 0; k < 8; k++) {
+			c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+		}
+	}
+	return ~c;
+}
+
+static rdd_checksum_t
+reference(rdd_checksum_algorithm_t alg, const unsigned char *buf,
+	unsigned nbyte)
+{
+	switch (alg) {
+	case RDD_ADLER32:
+		return adler32(adler32(0, NULL, 0), buf, nbyte);
+	case RDD_CRC32:
+		return crc32(crc32(0, NULL, 0), buf, nbyte);
+	case RDD_CRC32C:
+		return crc32c_reference(buf, nbyte);
+	}
+	return 0;
+}
+
+/* Checks the checksum of data[off .. off+len), computed in one
+ * call and in two calls (split at split).
+ */
+static void
+check_range(rdd_checksum_algorithm_t alg, unsigned off, unsigned len,
+	unsigned split)
+{
+	rdd_checksum_t expected, sum;
+
+	expected = reference(alg, data + off, len);
+
+	sum = rdd_checksum_update(alg, rdd_checksum_init(alg), data + off, len);
+	if (sum != expected) {
+		checksum_error("%s: checksum of %u bytes at %u is %08x "
+			"instead of %08x", rdd_checksum_impl(alg),
+			len, off, sum, expected);
+	}
+
+	if (split > len) split = len;
+	sum = rdd_checksum_init(alg);
+	sum = rdd_checksum_update(alg, sum, data + off, split);
+	sum = rdd_checksum_update(alg, sum, data + off + split, len - split);
+	if (sum != expected) {
+		checksum_error("%s: checksum of %u bytes at %u, split at %u, "
+			"is %08x instead of %08x", rdd_checksum_impl(alg),
+			len, off, split, sum, expected);
+	}
+}
+
+static void
+test_kernel(rdd_checksum_algorithm_t alg, const char *name)
+{
+	unsigned len, i;
+
+	printf("testing %s (%s)......", name, rdd_checksum_impl(alg));
+
+	for (len = 0; len < 1100; len++) {
+		check_range(alg, len % 61, len, len / 3);
+	}
+	for (i = 0; i < 200; i++) {
+		len = rand() % (DATA_SIZE - 64);
+		check_range(alg, rand() % 64, len, rand() % (len + 1));
+	}
+	check_range(alg, 0, DATA_SIZE, 0);
+	check_range(alg, 1, DATA_SIZE - 1, 12345);
+
+	/* Maximal sums for Adler32.
+	 */
+	memset(data, 0xff, DATA_SIZE);
+	check_range(alg, 3, DATA_SIZE - 3, 5552);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	printf("OK\n");
+}
+
+static void
+handle_error(rdd_count_t offset, rdd_checksum_t expected,
+	rdd_checksum_t computed, void *env)
+{
+	unsigned *nerror = (unsigned *) env;
+
+	if (offset != 5 * BLOCK_SIZE || expected == computed) {
+		checksum_error("bad error report at offset %llu", offset);
+	}
+	(*nerror)++;
+}
+
+/* Writes a CRC32C checksum file for data and verifies it; returns
+ * the number of bad blocks.
+ */
+static unsigned
+verify_file(void)
+{
+	RDD_CHECKSUM_FILE_HEADER header;
+	RDD_FILTERSET fset;
+	RDD_FILTER *f;
+	FILE *fp;
+	unsigned nerror = 0;
+	int rc;
+
+	if ((fp = fopen(TEST_FILE, "rb")) == NULL) {
+		checksum_error("cannot open %s", TEST_FILE);
+	}
+	if (fread(&header, sizeof header, 1, fp) != 1) {
+		checksum_error("cannot read header");
+	}
+	if (header.magic != RDD_CHECKSUM_MAGIC
+	||  (header.flags & RDD_CRC32C) == 0
+	||  header.blocksize != BLOCK_SIZE) {
+		checksum_error("bad checksum file header");
+	}
+
+	rdd_fset_init(&fset);
+	rc = rdd_new_verify_crc32c_blockfilter(&f, fp, BLOCK_SIZE, 0,
+						handle_error, &nerror);
+	if (rc != RDD_OK) {
+		checksum_error("rdd_new_verify_crc32c_blockfilter() "
+			"returned %d", rc);
+	}
+	rdd_fset_add(&fset, "CRC-32C verification block", f);
+	if ((rc = rdd_fset_push(&fset, data, DATA_SIZE)) != RDD_OK) {
+		checksum_error("rdd_fset_push() returned %d", rc);
+	}
+	if ((rc = rdd_fset_close(&fset)) != RDD_OK) {
+		checksum_error("rdd_fset_close() returned %d", rc);
+	}
+	rdd_fset_clear(&fset);
+	fclose(fp);
+
+	return nerror;
+}
+
+static void
+test_filters(void)
+{
+	RDD_FILTERSET fset;
+	RDD_FILTER *f;
+	int rc;
+
+	printf("testing CRC32C checksum file......");
+
+	rdd_fset_init(&fset);
+	rc = rdd_new_crc32c_blockfilter(&f, BLOCK_SIZE, TEST_FILE,
+					RDD_OVERWRITE);
+	if (rc != RDD_OK) {
+		checksum_error("rdd_new_crc32c_blockfilter() returned %d", rc);
+	}
+	rdd_fset_add(&fset, "CRC-32C block", f);
+	if ((rc = rdd_fset_push(&fset, data, DATA_SIZE)) != RDD_OK) {
+		checksum_error("rdd_fset_push() returned %d", rc);
+	}
+	if ((rc = rdd_fset_close(&fset)) != RDD_OK) {
+		checksum_error("rdd_fset_close() returned %d", rc);
+	}
+	rdd_fset_clear(&fset);
+
+	if (verify_file() != 0) {
+		checksum_error("verification of intact data failed");
+	}
+	data[5 * BLOCK_SIZE + 17] ^= 0x01;
+	if (verify_file() != 1) {
+		checksum_error("corrupted block not detected");
+	}
+	data[5 * BLOCK_SIZE + 17] ^= 0x01;
+
+	unlink(TEST_FILE);
+	printf("OK\n");
+}
+
+static void
+benchmark(rdd_checksum_algorithm_t alg, const char *name)
+{
+	unsigned char *buf;
+	rdd_checksum_t sum;
+	double start, secs;
+	unsigned i;
+
+	if ((buf = malloc(BENCH_SIZE)) == 0) {
+		checksum_error("out of memory");
+	}
+	memset(buf, 0x5a, BENCH_SIZE);
+
+	sum = rdd_checksum_init(alg);
+	start = rdd_gettime();
+	for (i = 0; i < BENCH_SIZE; i += 32768) {
+		sum = rdd_checksum_update(alg, sum, buf + i, 32768);
+	}
+	secs = rdd_gettime() - start;
+	printf("%-8s %-9s %8.0f MB/s (%08x)\n", name,
+		rdd_checksum_impl(alg),
+		(BENCH_SIZE / (1024.0 * 1024.0)) / secs, sum);
+
+	free(buf);
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		checksum_error("out of memory");
+	}
+	srand(3255);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	memcpy(data, "123456789", 9);
+	if (rdd_checksum_update(RDD_CRC32C, 0, data, 9) != 0xe3069283) {
+		checksum_error("CRC32C check value is wrong");
+	}
+
+	test_kernel(RDD_ADLER32, "Adler32");
+	test_kernel(RDD_CRC32, "CRC32");
+	test_kernel(RDD_CRC32C, "CRC32C");
+	test_filters();
+
+	benchmark(RDD_ADLER32, "Adler32");
+	benchmark(RDD_CRC32, "CRC32");
+	benchmark(RDD_CRC32C, "CRC32C");
+
+	free(data);
+	return 0;
+}
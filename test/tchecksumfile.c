@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* A unit-test for version-2 checksum files.  For every record type,
+ * a checksum file is written sequentially and with three worker
+ * threads, and its header and records are checked.  The test then
+ * looks up records in the index, resumes a filter from a checkpoint,
+ * and verifies good, corrupted, and truncated images.  Version-1
+ * files, which use the same buffered record output, are checked too.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "checkpoint.h"
+#include "checksum.h"
+#include "checksumfile.h"
+#include "rdd_internals.h"
+
+#define BLOCK_SIZE  4096
+#define NBLOCK      900
+#define DATA_SIZE   (NBLOCK * BLOCK_SIZE + 1000)
+#define TEST_FILE   "tchecksumfile.out"
+#define REF_FILE    "tchecksumfile.ref"
+
+static unsigned types[] = {
+	RDD_ADLER32, RDD_CRC32, RDD_CRC32C,
+	RDD_CKSUM2_MD5, RDD_CKSUM2_SHA1, RDD_CKSUM2_SHA256
+};
+#define NTYPE (sizeof types / sizeof types[0])
+
+/* Hash values of "abc".
+ */
+static struct {
+	unsigned  type;
+	char     *hex;
+} known[] = {
+	{RDD_CKSUM2_MD5, "900150983cd24fb0d6963f7d28e17f72"},
+	{RDD_CKSUM2_SHA1, "a9993e364706816aba3e25717850c26c9cd0d89d"},
+	{RDD_CKSUM2_SHA256,
+	 "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"}
+};
+
+static unsigned char *data;
+
+static void
+cksumfile_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tchecksumfile] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	unlink(REF_FILE);
+	exit(EXIT_FAILURE);
+}
+
+/* Pushes buf[start..end) into f in pieces of varying size.
+ */
+static void
+push_range(RDD_FILTER *f, const unsigned char *buf,
+		unsigned start, unsigned end)
+{
+	unsigned pos, len;
+	int rc;
+
+	for (pos = start; pos < end; pos += len) {
+		len = 1 + (pos * 7) % 70000;
+		if (len > end - pos) {
+			len = end - pos;
+		}
+		if ((rc = rdd_filter_push(f, buf + pos, len)) != RDD_OK) {
+			cksumfile_error("rdd_filter_push() returned %d", rc);
+		}
+	}
+}
+
+static void
+close_filter(RDD_FILTER *f)
+{
+	int rc;
+
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		cksumfile_error("rdd_filter_close() returned %d", rc);
+	}
+	if ((rc = rdd_filter_free(f)) != RDD_OK) {
+		cksumfile_error("rdd_filter_free() returned %d", rc);
+	}
+}
+
+static RDD_FILTER *
+new_filter(const char *path, unsigned type, int mode, int indexed,
+		unsigned nworker)
+{
+	RDD_FILTER *f;
+	int rc;
+
+	rc = rdd_new_checksum2_blockfilter(&f, type, BLOCK_SIZE, 512,
+					path, mode, indexed);
+	if (rc != RDD_OK) {
+		cksumfile_error("cannot create %s filter (%d)",
+			rdd_cksum2_name(type), rc);
+	}
+	if (nworker > 0 && (rc = rdd_filter_set_parallel(f, nworker)) != RDD_OK) {
+		cksumfile_error("rdd_filter_set_parallel() returned %d", rc);
+	}
+	return f;
+}
+
+static FILE *
+open_file(const char *path, RDD_CHECKSUM2_HEADER *hdr)
+{
+	unsigned char buf[RDD_CHECKSUM2_HEADER_SIZE];
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		cksumfile_error("cannot open %s", path);
+	}
+	if (fread(buf, sizeof buf, 1, fp) != 1) {
+		cksumfile_error("cannot read header");
+	}
+	if (rdd_cksum2_decode_header(buf, hdr) != RDD_OK) {
+		cksumfile_error("bad header");
+	}
+	return fp;
+}
+
+static void
+compare_files(const char *what)
+{
+	FILE *ref, *run;
+	int c1, c2;
+
+	if ((ref = fopen(REF_FILE, "rb")) == NULL
+	||  (run = fopen(TEST_FILE, "rb")) == NULL) {
+		cksumfile_error("cannot open output files");
+	}
+	do {
+		c1 = getc(ref);
+		c2 = getc(run);
+		if (c1 != c2) {
+			cksumfile_error("%s: output files differ", what);
+		}
+	} while (c1 != EOF);
+	fclose(ref);
+	fclose(run);
+}
+
+static void
+test_known_values(void)
+{
+	unsigned char record[RDD_CKSUM2_MAX_RECORD];
+	char hex[2*RDD_CKSUM2_MAX_RECORD + 1];
+	unsigned i, size;
+
+	printf("testing record computation......");
+
+	for (i = 0; i < sizeof known / sizeof known[0]; i++) {
+		size = rdd_cksum2_record_size(known[i].type);
+		if (rdd_cksum2_compute(known[i].type,
+				(const unsigned char *) "abc", 3, record) != RDD_OK
+		||  rdd_buf2hex(record, size, hex, sizeof hex) != RDD_OK
+		||  strcmp(hex, known[i].hex) != 0) {
+			cksumfile_error("bad %s value", rdd_cksum2_name(known[i].type));
+		}
+	}
+
+	rdd_cksum2_compute(RDD_CRC32C, (const unsigned char *) "abc", 3, record);
+	if (record[0] != 0xb7 || record[1] != 0x3f
+	||  record[2] != 0x4b || record[3] != 0x36) {
+		cksumfile_error("CRC-32C record is not little-endian");
+	}
+
+	printf("OK\n");
+}
+
+/* Checks the header and all records of a finished file.
+ */
+static void
+check_file(unsigned type, int indexed)
+{
+	RDD_CHECKSUM2_HEADER hdr;
+	unsigned char expected[RDD_CKSUM2_MAX_RECORD];
+	unsigned char record[RDD_CKSUM2_MAX_RECORD];
+	const char *name = rdd_cksum2_name(type);
+	unsigned i, len;
+	FILE *fp;
+
+	fp = open_file(TEST_FILE, &hdr);
+	if (hdr.type != type
+	||  hdr.blocksize != BLOCK_SIZE
+	||  hdr.offset != 512
+	||  hdr.imagesize != DATA_SIZE
+	||  hdr.nrecord != NBLOCK + 1
+	||  (hdr.flags & RDD_CHECKSUM2_FINISHED) == 0
+	||  ((hdr.flags & RDD_CHECKSUM2_INDEXED) != 0) != (indexed != 0)) {
+		cksumfile_error("%s: bad header", name);
+	}
+
+	for (i = 0; i <= NBLOCK; i++) {
+		len = i < NBLOCK ? BLOCK_SIZE : DATA_SIZE - NBLOCK * BLOCK_SIZE;
+		rdd_cksum2_compute(type, data + i * BLOCK_SIZE, len, expected);
+		if (fread(record, hdr.recordsize, 1, fp) != 1
+		||  memcmp(record, expected, hdr.recordsize) != 0) {
+			cksumfile_error("%s: bad record %u", name, i);
+		}
+	}
+	if (!indexed && getc(fp) != EOF) {
+		cksumfile_error("%s: trailing data", name);
+	}
+	fclose(fp);
+}
+
+/* Blocks i and i + 100 have the same contents for i % 100 == 7,
+ * so the lowest of them must be found.
+ */
+static void
+check_lookup(unsigned type)
+{
+	RDD_CHECKSUM2_HEADER hdr;
+	unsigned char record[RDD_CKSUM2_MAX_RECORD];
+	rdd_count_t blocknum;
+	FILE *fp;
+	unsigned i;
+	int rc;
+
+	fp = open_file(TEST_FILE, &hdr);
+	for (i = 0; i < NBLOCK; i += 37) {
+		rdd_cksum2_compute(type, data + i * BLOCK_SIZE, BLOCK_SIZE,
+				record);
+		rc = rdd_cksum2_lookup(fp, &hdr, record, &blocknum);
+		if (rc != RDD_OK
+		||  blocknum != (i % 100 == 7 ? 7 : i)) {
+			cksumfile_error("%s: lookup of block %u failed",
+				rdd_cksum2_name(type), i);
+		}
+	}
+	memset(record, 0xee, sizeof record);
+	if (rdd_cksum2_lookup(fp, &hdr, record, &blocknum) != RDD_NOTFOUND) {
+		cksumfile_error("%s: found a nonexistent record",
+			rdd_cksum2_name(type));
+	}
+	fclose(fp);
+}
+
+/* Saves a checkpoint in the middle of a block, pushes some more
+ * data, and resumes from the checkpoint.
+ */
+static void
+run_resumed(unsigned type, unsigned nworker)
+{
+	RDD_CHECKPOINT *cp;
+	RDD_FILTER *f;
+	unsigned half = DATA_SIZE / 2 + 17;
+	int rc;
+
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		cksumfile_error("rdd_new_checkpoint() returned %d", rc);
+	}
+
+	f = new_filter(TEST_FILE, type, RDD_OVERWRITE, 1, nworker);
+	push_range(f, data, 0, half);
+	if ((rc = rdd_filter_save(f, cp, "filter")) != RDD_OK) {
+		cksumfile_error("rdd_filter_save() returned %d", rc);
+	}
+	push_range(f, data, half, half + 5 * BLOCK_SIZE + 3);
+	close_filter(f);
+
+	f = new_filter(TEST_FILE, type, RDD_APPEND, 1, nworker);
+	if ((rc = rdd_filter_restore(f, cp, "filter")) != RDD_OK) {
+		cksumfile_error("rdd_filter_restore() returned %d", rc);
+	}
+	push_range(f, data, half, DATA_SIZE);
+	close_filter(f);
+
+	rdd_free_checkpoint(cp);
+}
+
+static unsigned num_reported;
+static rdd_count_t first_error;
+static int missing_reported;
+
+static void
+handle_error(rdd_count_t pos, const unsigned char *expected,
+	const unsigned char *computed, unsigned size, void *env)
+{
+	unsigned *count = (unsigned *) env;
+
+	if (expected == 0 || size == 0) {
+		cksumfile_error("bad error report");
+	}
+	if (computed == 0) {
+		missing_reported = 1;
+		return;
+	}
+	if ((*count)++ == 0) {
+		first_error = pos;
+	}
+}
+
+static unsigned
+verify(const unsigned char *buf, unsigned size)
+{
+	RDD_CHECKSUM2_HEADER hdr;
+	RDD_FILTER *f;
+	unsigned num_error;
+	FILE *fp;
+	int rc;
+
+	num_reported = 0;
+	first_error = 0;
+	missing_reported = 0;
+
+	fp = open_file(TEST_FILE, &hdr);
+	rc = rdd_new_verify_checksum2_blockfilter(&f, fp, &hdr,
+					handle_error, &num_reported);
+	if (rc != RDD_OK) {
+		cksumfile_error("cannot create verification filter (%d)", rc);
+	}
+	push_range(f, buf, 0, size);
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		cksumfile_error("rdd_filter_close() returned %d", rc);
+	}
+	rc = rdd_filter_get_result(f, (unsigned char *) &num_error,
+				sizeof num_error);
+	if (rc != RDD_OK) {
+		cksumfile_error("rdd_filter_get_result() returned %d", rc);
+	}
+	if ((rc = rdd_filter_free(f)) != RDD_OK) {
+		cksumfile_error("rdd_filter_free() returned %d", rc);
+	}
+	fclose(fp);
+
+	return num_error;
+}
+
+static void
+check_verify(unsigned type)
+{
+	const char *name = rdd_cksum2_name(type);
+	unsigned char *copy;
+
+	if ((copy = malloc(DATA_SIZE)) == 0) {
+		cksumfile_error("out of memory");
+	}
+	memcpy(copy, data, DATA_SIZE);
+
+	if (verify(copy, DATA_SIZE) != 0 || num_reported != 0) {
+		cksumfile_error("%s: verification of a good image failed", name);
+	}
+
+	copy[321 * BLOCK_SIZE + 99] ^= 0x1;
+	if (verify(copy, DATA_SIZE) != 1
+	||  num_reported != 1 || first_error != 321 * BLOCK_SIZE) {
+		cksumfile_error("%s: corrupted block not detected", name);
+	}
+	copy[321 * BLOCK_SIZE + 99] ^= 0x1;
+
+	if (verify(copy, 10 * BLOCK_SIZE) != NBLOCK + 1 - 10
+	||  num_reported != 0 || !missing_reported) {
+		cksumfile_error("%s: truncated image not detected", name);
+	}
+
+	free(copy);
+}
+
+/* A version-1 file holds the header and native-order checksums.
+ */
+static void
+test_version1(void)
+{
+	RDD_CHECKSUM_FILE_HEADER hdr;
+	RDD_FILTER *f;
+	rdd_checksum_t sum, expected;
+	FILE *fp;
+	unsigned i, len;
+	int rc;
+
+	printf("testing version-1 Adler32 file......");
+
+	rc = rdd_new_adler32_blockfilter(&f, BLOCK_SIZE, TEST_FILE,
+					RDD_OVERWRITE);
+	if (rc != RDD_OK) {
+		cksumfile_error("rdd_new_adler32_blockfilter() returned %d", rc);
+	}
+	push_range(f, data, 0, DATA_SIZE);
+	close_filter(f);
+
+	if ((fp = fopen(TEST_FILE, "rb")) == NULL) {
+		cksumfile_error("cannot open %s", TEST_FILE);
+	}
+	if (fread(&hdr, sizeof hdr, 1, fp) != 1
+	||  hdr.magic != RDD_CHECKSUM_MAGIC
+	||  hdr.version != RDD_CHECKSUM_VERSION
+	||  hdr.flags != RDD_ADLER32
+	||  hdr.blocksize != BLOCK_SIZE) {
+		cksumfile_error("bad version-1 header");
+	}
+	for (i = 0; i <= NBLOCK; i++) {
+		len = i < NBLOCK ? BLOCK_SIZE : DATA_SIZE - NBLOCK * BLOCK_SIZE;
+		expected = rdd_checksum_update(RDD_ADLER32,
+				rdd_checksum_init(RDD_ADLER32),
+				data + i * BLOCK_SIZE, len);
+		if (fread(&sum, sizeof sum, 1, fp) != 1 || sum != expected) {
+			cksumfile_error("bad version-1 record %u", i);
+		}
+	}
+	if (getc(fp) != EOF) {
+		cksumfile_error("trailing data in version-1 file");
+	}
+	fclose(fp);
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	static unsigned nworkers[] = {0, 3};
+	RDD_FILTER *f;
+	unsigned i, k, t;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		cksumfile_error("out of memory");
+	}
+	srand(1717);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+	for (i = 107; i < NBLOCK; i += 100) {
+		memcpy(data + i * BLOCK_SIZE, data + 7 * BLOCK_SIZE, BLOCK_SIZE);
+	}
+
+	test_known_values();
+	test_version1();
+
+	for (t = 0; t < NTYPE; t++) {
+		printf("testing version-2 %s file......",
+			rdd_cksum2_name(types[t]));
+		fflush(stdout);
+
+		f = new_filter(REF_FILE, types[t], RDD_OVERWRITE, 1, 0);
+		push_range(f, data, 0, DATA_SIZE);
+		close_filter(f);
+
+		for (k = 0; k < sizeof nworkers / sizeof nworkers[0]; k++) {
+			f = new_filter(TEST_FILE, types[t], RDD_OVERWRITE, 0,
+					nworkers[k]);
+			push_range(f, data, 0, DATA_SIZE);
+			close_filter(f);
+			check_file(types[t], 0);
+
+			f = new_filter(TEST_FILE, types[t], RDD_OVERWRITE, 1,
+					nworkers[k]);
+			push_range(f, data, 0, DATA_SIZE);
+			close_filter(f);
+			check_file(types[t], 1);
+			check_lookup(types[t]);
+			compare_files(rdd_cksum2_name(types[t]));
+
+			run_resumed(types[t], nworkers[k]);
+			compare_files(rdd_cksum2_name(types[t]));
+		}
+
+		check_verify(types[t]);
+		printf("OK\n");
+	}
+
+	unlink(TEST_FILE);
+	unlink(REF_FILE);
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* A unit-test for the compression codecs.  For each codec that this
+ * build supports, data is compressed into a file at several levels
+ * and read back.  The zstd and LZ4 readers must also accept several
+ * concatenated frames and must reject a truncated file.  The output
+ * of the parallel codec writer must decode with the ordinary
+ * readers, whatever the number of threads and the input size.
+ * Adaptive streams must decode with the adaptive reader, and the
+ * adaptive writer must sort the chunks into compressed, bypassed
+ * and zero chunks.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "codec.h"
+
+#define DATA_SIZE   (3 * 1024 * 1024 + 777)
+#define ODD_WRITE   100003
+#define READ_SIZE   65536
+#define TMPFILE     "tcodec.tmp"
+#define PAR_CHUNK   65536
+
+static unsigned char contents[DATA_SIZE];
+static unsigned char result[DATA_SIZE + READ_SIZE];
+
+static void
+codec_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tcodec] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	unlink(TMPFILE);
+	exit(EXIT_FAILURE);
+}
+
+/* The data comes in blocks of 64 Kbyte.  Of every eight blocks, the
+ * last two are zero; of the others, half hold a few distinct byte
+ * values and compress well, and half are random.
+ */
+static void
+init_contents(void)
+{
+	unsigned i;
+
+	srand(4711);
+	for (i = 0; i < DATA_SIZE; i++) {
+		if ((i / 65536) % 8 >= 6) {
+			contents[i] = 0;
+		} else if ((i / 65536) % 2 == 0) {
+			contents[i] = (unsigned char) ('a' + (i % 251) % 13);
+		} else {
+			contents[i] = (unsigned char) rand();
+		}
+	}
+}
+
+/* Compresses contents[start..end) as one stream and appends it to
+ * the output of writer w.
+ */
+static void
+compress_par(RDD_WRITER *w, unsigned codec, int level, unsigned start,
+		unsigned end, unsigned nthread)
+{
+	RDD_WRITER *cw = 0;
+	unsigned pos, n;
+	int rc;
+
+	if (nthread > 0) {
+		rc = rdd_open_parallel_codec_writer(&cw, w, codec, level,
+				nthread, PAR_CHUNK);
+	} else {
+		rc = rdd_open_codec_writer(&cw, w, codec, level);
+	}
+	if (rc != RDD_OK) {
+		codec_error("%s: rdd_open_codec_writer() returned %d",
+			rdd_codec_name(codec), rc);
+	}
+	for (pos = start; pos < end; pos += n) {
+		n = end - pos < ODD_WRITE ? end - pos : ODD_WRITE;
+		if ((rc = rdd_writer_write(cw, contents + pos, n)) != RDD_OK) {
+			codec_error("%s: write returned %d",
+				rdd_codec_name(codec), rc);
+		}
+	}
+	if ((rc = rdd_writer_close(cw)) != RDD_OK) {
+		codec_error("%s: close returned %d", rdd_codec_name(codec), rc);
+	}
+}
+
+static void
+compress(RDD_WRITER *w, unsigned codec, int level, unsigned start,
+		unsigned end)
+{
+	compress_par(w, codec, level, start, end, 0);
+}
+
+static RDD_WRITER *
+open_tmpfile(void)
+{
+	RDD_WRITER *w = 0;
+	int rc;
+
+	if ((rc = rdd_open_file_writer(&w, TMPFILE)) != RDD_OK) {
+		codec_error("cannot create %s", TMPFILE);
+	}
+	return w;
+}
+
+/* Compresses contents[0..end) into an adaptive stream.
+ */
+static void
+compress_adaptive(unsigned codec, unsigned end, unsigned nthread,
+		double maxentropy, RDD_CODEC_STATS *stats)
+{
+	RDD_WRITER *cw = 0;
+	unsigned pos, n;
+	int rc;
+
+	rc = rdd_open_adaptive_codec_writer(&cw, open_tmpfile(), codec, 0,
+			nthread, PAR_CHUNK, maxentropy, stats);
+	if (rc != RDD_OK) {
+		codec_error("%s: rdd_open_adaptive_codec_writer() returned %d",
+			rdd_codec_name(codec), rc);
+	}
+	for (pos = 0; pos < end; pos += n) {
+		n = end - pos < ODD_WRITE ? end - pos : ODD_WRITE;
+		if ((rc = rdd_writer_write(cw, contents + pos, n)) != RDD_OK) {
+			codec_error("%s: adaptive write returned %d",
+				rdd_codec_name(codec), rc);
+		}
+	}
+	if ((rc = rdd_writer_close(cw)) != RDD_OK) {
+		codec_error("%s: adaptive close returned %d",
+			rdd_codec_name(codec), rc);
+	}
+}
+
+/* Reads the file back; returns the first error.
+ */
+static int
+decode(unsigned codec, int adaptive, unsigned *len)
+{
+	RDD_READER *fr = 0;
+	RDD_READER *r = 0;
+	unsigned n;
+	int rc;
+
+	*len = 0;
+	if ((rc = rdd_open_file_reader(&fr, TMPFILE, 0)) != RDD_OK) {
+		codec_error("cannot open %s", TMPFILE);
+	}
+	if (adaptive) {
+		rc = rdd_open_adaptive_codec_reader(&r, fr, codec);
+	} else {
+		rc = rdd_open_codec_reader(&r, fr, codec);
+	}
+	if (rc != RDD_OK) {
+		codec_error("%s: cannot open reader (%d)",
+			rdd_codec_name(codec), rc);
+	}
+	do {
+		rc = rdd_reader_read(r, result + *len, READ_SIZE, &n);
+		if (rc != RDD_OK) {
+			break;
+		}
+		*len += n;
+	} while (n > 0 && *len <= DATA_SIZE);
+
+	(void) rdd_reader_close(r, 1);
+	return rc;
+}
+
+static int
+decompress(unsigned codec, unsigned *len)
+{
+	return decode(codec, 0, len);
+}
+
+static void
+check_size(unsigned codec, unsigned len, unsigned size, const char *what)
+{
+	if (len != size) {
+		codec_error("%s, %s: read %u bytes, expected %u",
+			rdd_codec_name(codec), what, len, size);
+	}
+	if (memcmp(result, contents, size) != 0) {
+		codec_error("%s, %s: data differs", rdd_codec_name(codec), what);
+	}
+}
+
+static void
+check_result(unsigned codec, unsigned len, const char *what)
+{
+	check_size(codec, len, DATA_SIZE, what);
+}
+
+static void
+test_codec(unsigned codec)
+{
+	static int levels[] = {0, 1, 5};
+	RDD_WRITER *w;
+	unsigned len, i;
+	int rc;
+
+	for (i = 0; i < sizeof levels / sizeof levels[0]; i++) {
+		compress(open_tmpfile(), codec, levels[i], 0, DATA_SIZE);
+		if ((rc = decompress(codec, &len)) != RDD_OK) {
+			codec_error("%s, level %d: read returned %d",
+				rdd_codec_name(codec), levels[i], rc);
+		}
+		check_result(codec, len, "one stream");
+	}
+
+	if (codec == RDD_CODEC_ZLIB) {
+		return;
+	}
+
+	/* Several streams (frames) in a row.  The writers close their
+	 * parent, so each frame goes through a writer of its own that
+	 * appends to the file.
+	 */
+	compress(open_tmpfile(), codec, 0, 0, 1000);
+	if ((rc = rdd_open_safe_writer(&w, TMPFILE, RDD_APPEND)) != RDD_OK) {
+		codec_error("cannot append to %s", TMPFILE);
+	}
+	compress(w, codec, 0, 1000, DATA_SIZE / 2);
+	if ((rc = rdd_open_safe_writer(&w, TMPFILE, RDD_APPEND)) != RDD_OK) {
+		codec_error("cannot append to %s", TMPFILE);
+	}
+	compress(w, codec, 1, DATA_SIZE / 2, DATA_SIZE);
+	if ((rc = decompress(codec, &len)) != RDD_OK) {
+		codec_error("%s, frames: read returned %d",
+			rdd_codec_name(codec), rc);
+	}
+	check_result(codec, len, "three frames");
+
+	/* A truncated stream is an error.
+	 */
+	compress(open_tmpfile(), codec, 0, 0, DATA_SIZE);
+	if (truncate(TMPFILE, 100000) < 0) {
+		codec_error("cannot truncate %s", TMPFILE);
+	}
+	if ((rc = decompress(codec, &len)) != RDD_ECOMPRESS) {
+		codec_error("%s: truncated stream returned %d",
+			rdd_codec_name(codec), rc);
+	}
+}
+
+static void
+test_parallel(unsigned codec)
+{
+	static unsigned sizes[] = {
+		DATA_SIZE, 8 * PAR_CHUNK, PAR_CHUNK + 1, 1000, 0
+	};
+	static unsigned nthreads[] = {1, 4};
+	unsigned len, i, j;
+	int rc;
+
+	for (i = 0; i < sizeof nthreads / sizeof nthreads[0]; i++) {
+		for (j = 0; j < sizeof sizes / sizeof sizes[0]; j++) {
+			compress_par(open_tmpfile(), codec, 0, 0, sizes[j],
+					nthreads[i]);
+			if ((rc = decompress(codec, &len)) != RDD_OK) {
+				codec_error("%s, %u threads, %u bytes: read "
+					"returned %d", rdd_codec_name(codec),
+					nthreads[i], sizes[j], rc);
+			}
+			check_size(codec, len, sizes[j], "parallel");
+		}
+	}
+}
+
+static void
+check_stat(unsigned codec, const char *what, rdd_count_t n,
+		rdd_count_t expected)
+{
+	if (n != expected) {
+		codec_error("%s, adaptive: %s is %llu, expected %llu",
+			rdd_codec_name(codec), what,
+			(unsigned long long) n, (unsigned long long) expected);
+	}
+}
+
+static void
+test_adaptive(unsigned codec)
+{
+	static unsigned sizes[] = {DATA_SIZE, PAR_CHUNK + 1, 1000, 0};
+	static unsigned nthreads[] = {1, 3};
+	/* DATA_SIZE holds 48 full chunks: 12 zero chunks, 18 random
+	 * chunks, and 18 chunks that compress well.
+	 */
+	const rdd_count_t nzero = 12 * PAR_CHUNK;
+	const rdd_count_t nrandom = 18 * PAR_CHUNK;
+	RDD_CODEC_STATS st;
+	struct stat info;
+	unsigned len, i, j;
+	int rc;
+
+	for (i = 0; i < sizeof nthreads / sizeof nthreads[0]; i++) {
+		for (j = 0; j < sizeof sizes / sizeof sizes[0]; j++) {
+			compress_adaptive(codec, sizes[j], nthreads[i],
+					7.5, &st);
+			if ((rc = decode(codec, 1, &len)) != RDD_OK) {
+				codec_error("%s, adaptive, %u threads, %u "
+					"bytes: read returned %d",
+					rdd_codec_name(codec), nthreads[i],
+					sizes[j], rc);
+			}
+			check_size(codec, len, sizes[j], "adaptive");
+			check_stat(codec, "input", st.nbyte_in, sizes[j]);
+		}
+	}
+
+	/* Random chunks bypass compression below 8 bits per byte and
+	 * turn out incompressible above it.
+	 */
+	compress_adaptive(codec, DATA_SIZE, 2, 7.5, &st);
+	if (stat(TMPFILE, &info) < 0) {
+		codec_error("cannot stat %s", TMPFILE);
+	}
+	check_stat(codec, "output", st.nbyte_out, (rdd_count_t) info.st_size);
+	check_stat(codec, "zero", st.nbyte_zero, nzero);
+	check_stat(codec, "bypassed", st.nbyte_bypassed, nrandom);
+	check_stat(codec, "incompressible", st.nbyte_incompressible, 0);
+	check_stat(codec, "compressed", st.nbyte_compressed,
+			DATA_SIZE - nzero - nrandom);
+
+	compress_adaptive(codec, DATA_SIZE, 2, 9.0, &st);
+	if ((rc = decode(codec, 1, &len)) != RDD_OK) {
+		codec_error("%s, adaptive without bypass: read returned %d",
+			rdd_codec_name(codec), rc);
+	}
+	check_result(codec, len, "adaptive without bypass");
+	check_stat(codec, "bypassed", st.nbyte_bypassed, 0);
+	check_stat(codec, "incompressible", st.nbyte_incompressible,
+			nrandom);
+
+	/* A truncated stream is an error, and so is a stream that was
+	 * written with another codec.
+	 */
+	if (truncate(TMPFILE, 100000) < 0) {
+		codec_error("cannot truncate %s", TMPFILE);
+	}
+	if ((rc = decode(codec, 1, &len)) != RDD_ECOMPRESS) {
+		codec_error("%s: truncated adaptive stream returned %d",
+			rdd_codec_name(codec), rc);
+	}
+	if (codec != RDD_CODEC_ZLIB) {
+		compress_adaptive(codec, 1000, 1, 7.5, &st);
+		if ((rc = decode(RDD_CODEC_ZLIB, 1, &len)) != RDD_ECOMPRESS) {
+			codec_error("%s: codec mismatch returned %d",
+				rdd_codec_name(codec), rc);
+		}
+	}
+}
+
+int
+main(void)
+{
+	unsigned codec;
+
+	init_contents();
+	for (codec = 0; codec < RDD_CODEC_COUNT; codec++) {
+		if (rdd_codec_supported(codec)) {
+			test_codec(codec);
+			test_parallel(codec);
+			test_adaptive(codec);
+		} else {
+			printf("codec %s not supported; skipped\n",
+				rdd_codec_name(codec));
+		}
+	}
+	unlink(TMPFILE);
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test for the direct (O_DIRECT) writer.  It writes test data
+ * in odd-sized pieces through direct safe and part writers, and
+ * resumes a direct writer from a checkpoint at an unaligned offset.
+ * It checks the contents of all output files.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "checkpoint.h"
+
+#define OUT_FILE    "tdirect.img"
+#define DATA_SIZE   (3 * 1024 * 1024 + 1234)
+#define ODD_WRITE   7001
+#define SPLIT_SIZE  1000000
+#define NPART       ((DATA_SIZE + SPLIT_SIZE - 1) / SPLIT_SIZE)
+#define CKPT_POS    1000003
+#define JUNK_SIZE   50000
+
+static unsigned char contents[DATA_SIZE];
+
+static void
+direct_error(char *fmt, ...)
+{
+	va_list ap;
+	char path[64];
+	unsigned i;
+
+	fprintf(stderr, "[tdirect] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(OUT_FILE);
+	for (i = 0; i < NPART; i++) {
+		snprintf(path, sizeof path, "%u-%s", i, OUT_FILE);
+		unlink(path);
+	}
+	exit(EXIT_FAILURE);
+}
+
+static void
+write_range(RDD_WRITER *w, const unsigned char *data,
+		unsigned start, unsigned end)
+{
+	unsigned pos, n;
+	int rc;
+
+	for (pos = start; pos < end; pos += n) {
+		n = end - pos < ODD_WRITE ? end - pos : ODD_WRITE;
+		if ((rc = rdd_writer_write(w, data + pos, n)) != RDD_OK) {
+			direct_error("rdd_writer_write() returned %d", rc);
+		}
+	}
+}
+
+static RDD_WRITER *
+open_safe(rdd_write_mode_t wmode)
+{
+	RDD_WRITER *w = 0;
+	int rc;
+
+	if ((rc = rdd_open_safe_writer(&w, OUT_FILE, wmode)) != RDD_OK) {
+		direct_error("rdd_open_safe_writer() returned %d", rc);
+	}
+	return w;
+}
+
+static void
+close_writer(RDD_WRITER *w)
+{
+	int rc;
+
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		direct_error("rdd_writer_close() returned %d", rc);
+	}
+}
+
+/* Checks that file path holds len bytes that equal data.
+ */
+static void
+check_file(const char *path, const unsigned char *data, unsigned len)
+{
+	unsigned char *buf;
+	struct stat info;
+	FILE *fp;
+
+	if (stat(path, &info) < 0 || info.st_size != (off_t) len) {
+		direct_error("%s has the wrong size", path);
+	}
+	if ((buf = malloc(len + 1)) == 0) {
+		direct_error("out of memory");
+	}
+	if ((fp = fopen(path, "rb")) == NULL) {
+		direct_error("cannot open %s", path);
+	}
+	if (fread(buf, 1, len + 1, fp) != len || memcmp(buf, data, len) != 0) {
+		direct_error("%s has the wrong contents", path);
+	}
+	fclose(fp);
+	free(buf);
+	unlink(path);
+}
+
+static void
+test_safe(void)
+{
+	RDD_WRITER *w;
+
+	unlink(OUT_FILE);
+	w = open_safe(RDD_OVERWRITE|RDD_DIRECT);
+	write_range(w, contents, 0, DATA_SIZE);
+	close_writer(w);
+	check_file(OUT_FILE, contents, DATA_SIZE);
+
+	if (rdd_open_safe_writer(&w, OUT_FILE,
+			RDD_OVERWRITE|RDD_DIRECT|RDD_SPARSE) != RDD_BADARG) {
+		direct_error("direct and sparse writing can be combined");
+	}
+}
+
+static void
+test_part(void)
+{
+	RDD_WRITER *w = 0;
+	char path[64];
+	unsigned i, len;
+	int rc;
+
+	rc = rdd_open_part_writer(&w, OUT_FILE, DATA_SIZE, SPLIT_SIZE,
+				RDD_OVERWRITE|RDD_DIRECT);
+	if (rc != RDD_OK) {
+		direct_error("rdd_open_part_writer() returned %d", rc);
+	}
+	write_range(w, contents, 0, DATA_SIZE);
+	close_writer(w);
+
+	for (i = 0; i < NPART; i++) {
+		len = DATA_SIZE - i * SPLIT_SIZE;
+		if (len > SPLIT_SIZE) {
+			len = SPLIT_SIZE;
+		}
+		snprintf(path, sizeof path, "%u-%s", i, OUT_FILE);
+		check_file(path, contents + i * SPLIT_SIZE, len);
+	}
+}
+
+/* Saves a checkpoint at an unaligned offset, writes junk beyond it,
+ * then resumes from the checkpoint and writes the rest.
+ */
+static void
+test_resume(void)
+{
+	unsigned char junk[JUNK_SIZE];
+	RDD_CHECKPOINT *cp = 0;
+	RDD_WRITER *w;
+	int rc;
+
+	memset(junk, 0xaa, sizeof junk);
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		direct_error("rdd_new_checkpoint() returned %d", rc);
+	}
+
+	unlink(OUT_FILE);
+	w = open_safe(RDD_OVERWRITE|RDD_DIRECT);
+	write_range(w, contents, 0, CKPT_POS);
+	if ((rc = rdd_writer_save(w, cp, "out")) != RDD_OK) {
+		direct_error("rdd_writer_save() returned %d", rc);
+	}
+	write_range(w, junk, 0, JUNK_SIZE);
+	close_writer(w);
+	chmod(OUT_FILE, S_IRUSR|S_IWUSR);
+
+	w = open_safe(RDD_APPEND|RDD_DIRECT);
+	if ((rc = rdd_writer_restore(w, cp, "out")) != RDD_OK) {
+		direct_error("rdd_writer_restore() returned %d", rc);
+	}
+	write_range(w, contents, CKPT_POS, DATA_SIZE);
+	close_writer(w);
+	check_file(OUT_FILE, contents, DATA_SIZE);
+
+	rdd_free_checkpoint(cp);
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	srand(13);
+	for (i = 0; i < DATA_SIZE; i++) {
+		contents[i] = rand() & 0xff;
+	}
+
+	printf("testing direct writer......");
+	fflush(stdout);
+
+	test_safe();
+	test_part();
+	test_resume();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for network protocol version 2.  A stream is sent
+ * through a frame writer over a socket pair to a frame reader that
+ * runs in another thread; the reader's credits keep the writer from
+ * running ahead.  The test also checks that damaged frames and a
+ * wrong request-header checksum are detected, and that an error
+ * reported by the server makes the client's next write fail.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "msgprinter.h"
+#include "netio.h"
+
+#define DATA_SIZE   (3 * 1024 * 1024 + 333)
+#define FRAME_SIZE  65536
+#define WINDOW      (4 * FRAME_SIZE)
+#define HDR_CRC     0x12345678
+
+static unsigned char *data;
+static unsigned char *result;
+static char path[] = "tframe.dat";
+
+static void
+frame_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tframe] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(path);
+	exit(EXIT_FAILURE);
+}
+
+static void
+open_socketpair(int *sock)
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0) {
+		frame_error("cannot create socket pair");
+	}
+}
+
+/* The server side: reads the whole stream in pieces of 10000 bytes
+ * and closes the reader, which sends DONE.
+ */
+static void *
+serve(void *arg)
+{
+	RDD_READER *r;
+	int sock = *(int *) arg;
+	unsigned nread, pos = 0;
+	int rc;
+
+	if ((rc = rdd_open_fd_reader(&r, sock)) != RDD_OK) {
+		frame_error("rdd_open_fd_reader() returned %d", rc);
+	}
+	if ((rc = rdd_open_frame_reader(&r, r, sock, HDR_CRC)) != RDD_OK) {
+		frame_error("rdd_open_frame_reader() returned %d", rc);
+	}
+	do {
+		rc = rdd_reader_read(r, result + pos, 10000, &nread);
+		if (rc != RDD_OK) {
+			frame_error("frame reader returned %d at %u", rc, pos);
+		}
+		pos += nread;
+	} while (nread > 0 && pos <= DATA_SIZE);
+
+	if (pos != DATA_SIZE) {
+		frame_error("received %u bytes instead of %u", pos, DATA_SIZE);
+	}
+	if ((rc = rdd_reader_close(r, 1)) != RDD_OK) {
+		frame_error("rdd_reader_close() returned %d", rc);
+	}
+	return 0;
+}
+
+static void
+test_roundtrip(void)
+{
+	RDD_WRITER *w;
+	pthread_t server;
+	unsigned pos, len;
+	int sock[2];
+	int rc;
+
+	printf("testing frame writer and reader......");
+
+	open_socketpair(sock);
+	memset(result, 0, DATA_SIZE);
+	if (pthread_create(&server, 0, serve, &sock[1]) != 0) {
+		frame_error("cannot start server thread");
+	}
+
+	if ((rc = rdd_open_fd_writer(&w, sock[0])) != RDD_OK) {
+		frame_error("rdd_open_fd_writer() returned %d", rc);
+	}
+	rc = rdd_open_frame_writer(&w, w, sock[0], FRAME_SIZE, WINDOW,
+			HDR_CRC);
+	if (rc != RDD_OK) {
+		frame_error("rdd_open_frame_writer() returned %d", rc);
+	}
+	for (pos = 0, len = 1; pos < DATA_SIZE; pos += len, len = len*7 + 13) {
+		len %= 3 * FRAME_SIZE;
+		if (len > DATA_SIZE - pos) {
+			len = DATA_SIZE - pos;
+		}
+		if ((rc = rdd_writer_write(w, data + pos, len)) != RDD_OK) {
+			frame_error("frame writer returned %d at %u", rc, pos);
+		}
+	}
+
+	/* Close returns after the server has sent DONE.
+	 */
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		frame_error("rdd_writer_close() returned %d", rc);
+	}
+	pthread_join(server, 0);
+
+	if (memcmp(data, result, DATA_SIZE) != 0) {
+		frame_error("data differs");
+	}
+
+	printf("OK\n");
+}
+
+/* Writes a short stream through a frame writer into a file.  The
+ * peer socket stands in for the server; DONE is queued in advance.
+ */
+static void
+write_frames(int *sock, unsigned size)
+{
+	RDD_WRITER *w;
+	int fd;
+	int rc;
+
+	open_socketpair(sock);
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		frame_error("cannot create %s", path);
+	}
+	if ((rc = rdd_open_fd_writer(&w, fd)) != RDD_OK) {
+		frame_error("rdd_open_fd_writer() returned %d", rc);
+	}
+	rc = rdd_open_frame_writer(&w, w, sock[0], FRAME_SIZE, WINDOW,
+			HDR_CRC);
+	if (rc != RDD_OK) {
+		frame_error("rdd_open_frame_writer() returned %d", rc);
+	}
+	if ((rc = rdd_writer_write(w, data, size)) != RDD_OK) {
+		frame_error("frame writer returned %d", rc);
+	}
+	rc = rdd_net_send_msg(sock[1], RDD_NET_MSG_DONE, (rdd_count_t) size);
+	if (rc != RDD_OK) {
+		frame_error("rdd_net_send_msg() returned %d", rc);
+	}
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		frame_error("rdd_writer_close() returned %d", rc);
+	}
+}
+
+/* Flips a bit at file offset pos.
+ */
+static void
+damage(unsigned pos)
+{
+	unsigned char c;
+	int fd;
+
+	if ((fd = open(path, O_RDWR)) < 0) {
+		frame_error("cannot open %s", path);
+	}
+	if (pread(fd, &c, 1, pos) != 1) {
+		frame_error("cannot read %s", path);
+	}
+	c ^= 0x10;
+	if (pwrite(fd, &c, 1, pos) != 1) {
+		frame_error("cannot write %s", path);
+	}
+	close(fd);
+}
+
+/* Reads the frames in the file and returns the first error.
+ */
+static int
+read_frames(int sock, rdd_checksum_t hdrcrc)
+{
+	RDD_READER *r;
+	unsigned nread;
+	int rc;
+
+	if ((rc = rdd_open_file_reader(&r, path, 0)) != RDD_OK) {
+		frame_error("cannot open %s (%d)", path, rc);
+	}
+	if ((rc = rdd_open_frame_reader(&r, r, sock, hdrcrc)) != RDD_OK) {
+		frame_error("rdd_open_frame_reader() returned %d", rc);
+	}
+	do {
+		rc = rdd_reader_read(r, result, 4096, &nread);
+	} while (rc == RDD_OK && nread > 0);
+	rdd_reader_close(r, 1);
+	return rc;
+}
+
+static void
+test_damage(void)
+{
+	unsigned hdr = RDD_NET_FRAME2_HDR_SIZE;
+	int sock[2];
+	int rc;
+
+	printf("testing damaged frames......");
+
+	write_frames(sock, 5000);
+	if ((rc = read_frames(sock[1], HDR_CRC)) != RDD_OK) {
+		frame_error("intact frames rejected (%d)", rc);
+	}
+	if ((rc = read_frames(sock[1], HDR_CRC + 1)) != RDD_ECHECKSUM) {
+		frame_error("wrong header checksum accepted (%d)", rc);
+	}
+
+	/* The data frame follows the header frame and its 4 bytes.
+	 */
+	damage(hdr + 4 + hdr + 1234);
+	if ((rc = read_frames(sock[1], HDR_CRC)) != RDD_ECHECKSUM) {
+		frame_error("damaged data accepted (%d)", rc);
+	}
+	damage(hdr + 4 + hdr + 1234);
+	damage(hdr + 4 + 10);	/* frame offset */
+	if ((rc = read_frames(sock[1], HDR_CRC)) != RDD_ECHECKSUM) {
+		frame_error("damaged frame header accepted (%d)", rc);
+	}
+	damage(hdr + 4 + 10);
+	damage(hdr + 4 + 6);	/* magic number */
+	if ((rc = read_frames(sock[1], HDR_CRC)) != RDD_ESYNTAX) {
+		frame_error("frame without magic number accepted (%d)", rc);
+	}
+
+	close(sock[0]);
+	close(sock[1]);
+	printf("OK\n");
+}
+
+static void
+test_server_error(void)
+{
+	RDD_WRITER *w;
+	int sock[2];
+	int rc;
+
+	printf("testing server errors......");
+
+	open_socketpair(sock);
+	if ((rc = rdd_open_fd_writer(&w, sock[0])) != RDD_OK) {
+		frame_error("rdd_open_fd_writer() returned %d", rc);
+	}
+	rc = rdd_open_frame_writer(&w, w, sock[0], FRAME_SIZE, WINDOW,
+			HDR_CRC);
+	if (rc != RDD_OK) {
+		frame_error("rdd_open_frame_writer() returned %d", rc);
+	}
+	if ((rc = rdd_writer_write(w, data, 1000)) != RDD_OK) {
+		frame_error("frame writer returned %d", rc);
+	}
+	rc = rdd_net_send_msg(sock[1], RDD_NET_MSG_ERROR, RDD_ESPACE);
+	if (rc != RDD_OK) {
+		frame_error("rdd_net_send_msg() returned %d", rc);
+	}
+	if ((rc = rdd_writer_write(w, data, 1000)) != RDD_ESPACE) {
+		frame_error("server error not reported (%d)", rc);
+	}
+
+	close(sock[0]);
+	close(sock[1]);
+	printf("OK\n");
+}
+
+static void
+test_header_crc(void)
+{
+	rdd_checksum_t crc;
+
+	printf("testing header checksums......");
+
+	crc = rdd_net_info_crc("image.dd", 1000000, 65536, 0, RDD_NET_V2, 1, 0);
+	if (crc != rdd_net_info_crc("image.dd", 1000000, 65536, 0,
+				RDD_NET_V2, 1, 0)) {
+		frame_error("request header checksum is not stable");
+	}
+	if (crc == rdd_net_info_crc("image.dd", 1000001, 65536, 0,
+				RDD_NET_V2, 1, 0)
+	||  crc == rdd_net_info_crc("image.de", 1000000, 65536, 0,
+				RDD_NET_V2, 1, 0)) {
+		frame_error("request header checksum misses a change");
+	}
+	if (rdd_net_join_crc(7, 1, RDD_NET_V2)
+	    == rdd_net_join_crc(7, 2, RDD_NET_V2)) {
+		frame_error("join header checksum misses a change");
+	}
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	data = malloc(DATA_SIZE);
+	result = malloc(DATA_SIZE + 10000);
+	if (data == 0 || result == 0) {
+		frame_error("out of memory");
+	}
+	srand(17);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	test_header_crc();
+	test_roundtrip();
+	test_damage();
+	test_server_error();
+
+	unlink(path);
+	free(data);
+	free(result);
+	return 0;
+}
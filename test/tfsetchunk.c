@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test and benchmark for chunked filter-set pushes.  The same
+ * data is hashed and checksummed by six filters, with and without
+ * chunking; all filter results and block-filter output files must be
+ * identical.  The throughput of each configuration is printed.
+ *
+ * Chunking pays off only when a pushed buffer does not fit in the
+ * processor's L2 cache.  To benchmark larger buffers, pass the push
+ * size in bytes as the first argument.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "rdd_internals.h"
+#include "md5.h"
+#include "sha1.h"
+
+#define DATA_SIZE  (32 * 1024 * 1024 + 17)
+#define PUSH_SIZE  (1024 * 1024)	/* default */
+#define NPASS      2
+
+static const char *suffixes[] = {"md5", "stats", "crc", "adler"};
+
+#define NFILE (sizeof suffixes / sizeof suffixes[0])
+
+static unsigned push_size = PUSH_SIZE;
+
+typedef struct _RESULT {
+	unsigned char md5[MD5_DIGEST_LENGTH];
+	unsigned char sha1[SHA_DIGEST_LENGTH];
+} RESULT;
+
+static void
+fset_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tfsetchunk] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void
+check(int rc, const char *what)
+{
+	if (rc != RDD_OK) {
+		fset_error("%s returned %d instead of RDD_OK", what, rc);
+	}
+}
+
+static void
+add_filter(RDD_FILTERSET *fset, const char *name, RDD_FILTER *f, int rc)
+{
+	check(rc, "filter constructor");
+	check(rdd_fset_add(fset, name, f), "rdd_fset_add()");
+}
+
+/* Pushes the data through an MD5 and a SHA-1 stream filter and through
+ * four block filters, with the given chunk size.  The block sizes
+ * are chosen so that block boundaries fall inside chunks.  Returns
+ * the number of seconds spent pushing.
+ */
+static double
+run(unsigned char *data, unsigned chunk, unsigned nworker, const char *name,
+	RESULT *res)
+{
+	RDD_FILTERSET fset;
+	RDD_FILTER *f;
+	char path[64];
+	unsigned pos, len;
+	unsigned pass;
+	double start, elapsed;
+
+	check(rdd_fset_init(&fset), "rdd_fset_init()");
+	check(rdd_fset_set_chunk(&fset, chunk), "rdd_fset_set_chunk()");
+
+	add_filter(&fset, "MD5 stream", f, rdd_new_md5_streamfilter(&f));
+	add_filter(&fset, "SHA-1 stream", f, rdd_new_sha1_streamfilter(&f));
+	sprintf(path, "tfsetchunk-%s.md5", name);
+	add_filter(&fset, "MD5 block", f,
+		rdd_new_md5_blockfilter(&f, 4099, path, RDD_OVERWRITE));
+	sprintf(path, "tfsetchunk-%s.stats", name);
+	add_filter(&fset, "statistical block", f,
+		rdd_new_stats_blockfilter(&f, 100003, path, RDD_OVERWRITE));
+	sprintf(path, "tfsetchunk-%s.crc", name);
+	add_filter(&fset, "CRC-32 block", f,
+		rdd_new_crc32_blockfilter(&f, 3000, path, RDD_OVERWRITE));
+	sprintf(path, "tfsetchunk-%s.adler", name);
+	add_filter(&fset, "Adler32 block", f,
+		rdd_new_adler32_blockfilter(&f, 32768, path, RDD_OVERWRITE));
+
+	if (nworker > 0) {
+		check(rdd_fset_set_parallel(&fset, nworker, 4),
+			"rdd_fset_set_parallel()");
+		if (rdd_fset_set_chunk(&fset, chunk) != RDD_BADARG) {
+			fset_error("rdd_fset_set_chunk() accepted a "
+				"parallel filter set");
+		}
+	}
+
+	start = rdd_gettime();
+	for (pass = 0; pass < NPASS; pass++) {
+		for (pos = 0; pos < DATA_SIZE; pos += len) {
+			len = DATA_SIZE - pos < push_size ?
+					DATA_SIZE - pos : push_size;
+			check(rdd_fset_push(&fset, data + pos, len),
+				"rdd_fset_push()");
+		}
+	}
+	check(rdd_fset_close(&fset), "rdd_fset_close()");
+	elapsed = rdd_gettime() - start;
+
+	check(rdd_fset_get(&fset, "MD5 stream", &f), "rdd_fset_get()");
+	check(rdd_filter_get_result(f, res->md5, MD5_DIGEST_LENGTH),
+		"rdd_filter_get_result()");
+	check(rdd_fset_get(&fset, "SHA-1 stream", &f), "rdd_fset_get()");
+	check(rdd_filter_get_result(f, res->sha1, SHA_DIGEST_LENGTH),
+		"rdd_filter_get_result()");
+	check(rdd_fset_clear(&fset), "rdd_fset_clear()");
+
+	return elapsed;
+}
+
+static unsigned char *
+read_file(const char *path, unsigned *len)
+{
+	unsigned char *buf;
+	struct stat info;
+	FILE *fp;
+
+	if (stat(path, &info) < 0 || (fp = fopen(path, "rb")) == NULL) {
+		fset_error("cannot open %s", path);
+	}
+	if ((buf = malloc(info.st_size + 1)) == 0) {
+		fset_error("out of memory");
+	}
+	*len = fread(buf, 1, info.st_size, fp);
+	fclose(fp);
+	return buf;
+}
+
+/* Compares the block-filter output files of run name with those of
+ * the reference run and removes them.
+ */
+static void
+compare_files(const char *name)
+{
+	unsigned char *ref, *buf;
+	unsigned reflen, len;
+	char refpath[64], path[64];
+	unsigned i;
+
+	for (i = 0; i < NFILE; i++) {
+		sprintf(refpath, "tfsetchunk-ref.%s", suffixes[i]);
+		sprintf(path, "tfsetchunk-%s.%s", name, suffixes[i]);
+		ref = read_file(refpath, &reflen);
+		buf = read_file(path, &len);
+		if (reflen != len || memcmp(ref, buf, len) != 0) {
+			fset_error("%s differs from %s", path, refpath);
+		}
+		free(ref);
+		free(buf);
+		unlink(path);
+	}
+}
+
+static void
+remove_files(const char *name)
+{
+	char path[64];
+	unsigned i;
+
+	for (i = 0; i < NFILE; i++) {
+		sprintf(path, "tfsetchunk-%s.%s", name, suffixes[i]);
+		unlink(path);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		unsigned    chunk;
+		unsigned    nworker;
+	} runs[] = {
+		{"4k",         4 * 1024,  0},
+		{"16k",       16 * 1024,  0},
+		{"64k",       64 * 1024,  0},
+		{"odd",             1009, 0},
+		{"par64k",    64 * 1024,  2},
+		{"par0",               0, 2},
+	};
+	unsigned char *data;
+	RESULT expected;
+	RESULT result;
+	double secs;
+	double mb = (double) NPASS * DATA_SIZE / (1024.0 * 1024.0);
+	unsigned i;
+
+	if (argc > 1 && (push_size = strtoul(argv[1], 0, 10)) == 0) {
+		fset_error("bad push size %s", argv[1]);
+	}
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		fset_error("out of memory");
+	}
+	srand(1212);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	memset(&expected, 0, sizeof expected);
+	secs = run(data, 0, 0, "ref", &expected);
+	printf("%-8s chunk %6u: %8.1f MB/s\n", "whole", 0, mb / secs);
+
+	for (i = 0; i < sizeof runs / sizeof runs[0]; i++) {
+		memset(&result, 0, sizeof result);
+		secs = run(data, runs[i].chunk, runs[i].nworker, runs[i].name,
+				&result);
+		if (memcmp(&result, &expected, sizeof result) != 0) {
+			fset_error("chunked results differ (%s)",
+				runs[i].name);
+		}
+		compare_files(runs[i].name);
+		printf("%-8s chunk %6u: %8.1f MB/s\n", runs[i].name,
+			runs[i].chunk, mb / secs);
+	}
+
+	remove_files("ref");
+	free(data);
+	return 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test and benchmark for the byte-histogram kernel.  Block
+ * statistics are compared with a straightforward reference
+ * implementation for random data, runs of equal bytes, and blocks
+ * that are fed in odd-sized, unaligned pieces; entropies must match
+ * to the last bit.  The output of the statistics block filter is
+ * then compared with the reference.  Finally, the throughput of the
+ * kernel is printed for a few block sizes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "histogram.h"
+#include "rdd_internals.h"
+
+#define DATA_SIZE   (1024 * 1024 + 77)
+#define TEST_FILE   "thistogram.stats"
+#define BENCH_SIZE  (64 * 1024 * 1024)
+
+#define RDD_LN2     0.69314718055994530942
+
+static unsigned char *data;
+
+static void
+histogram_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[thistogram] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	exit(EXIT_FAILURE);
+}
+
+/* The statistics of a block, computed as the statistics block
+ * filter used to compute them.
+ */
+static void
+reference_stats(const unsigned char *buf, unsigned nbyte, RDD_HIST_STATS *s)
+{
+	unsigned hist[RDD_HIST_NVAL];
+	unsigned i, count;
+	double p;
+
+	memset(hist, 0, sizeof hist);
+	s->minbyte = RDD_HIST_NVAL - 1;
+	s->maxbyte = 0;
+	for (i = 0; i < nbyte; i++) {
+		hist[buf[i]]++;
+		if (buf[i] < s->minbyte) s->minbyte = buf[i];
+		if (buf[i] > s->maxbyte) s->maxbyte = buf[i];
+	}
+
+	s->entropy = 0.0;
+	s->modus = 0;
+	s->modus_count = hist[0];
+	for (i = 0; i < RDD_HIST_NVAL; i++) {
+		count = hist[i];
+		if (count > 0) {
+			p = ((double) count) / ((double) nbyte);
+			s->entropy += -p * (log(p) / RDD_LN2);
+		}
+		if (count > s->modus_count) {
+			s->modus = i;
+			s->modus_count = count;
+		}
+	}
+}
+
+static void
+compare_stats(const char *what, unsigned blocksize, unsigned block,
+		RDD_HIST_STATS *s, RDD_HIST_STATS *ref)
+{
+	if (s->minbyte != ref->minbyte || s->maxbyte != ref->maxbyte
+	||  s->modus != ref->modus || s->modus_count != ref->modus_count
+	||  memcmp(&s->entropy, &ref->entropy, sizeof s->entropy) != 0) {
+		histogram_error("%s: block %u of size %u: got %u %u %u %u %.17g, "
+			"expected %u %u %u %u %.17g", what, block, blocksize,
+			s->minbyte, s->maxbyte, s->modus, s->modus_count,
+			s->entropy,
+			ref->minbyte, ref->maxbyte, ref->modus, ref->modus_count,
+			ref->entropy);
+	}
+}
+
+/* Splits the data into blocks of blocksize bytes, feeds each block to
+ * a histogram in pieces of varying size, and checks the statistics of
+ * each block, including the short last block.
+ */
+static void
+test_blocks(const char *what, unsigned blocksize)
+{
+	RDD_HISTOGRAM h;
+	RDD_HIST_STATS s, ref;
+	unsigned counts[RDD_HIST_NVAL];
+	unsigned pos, len, piece, done, block;
+
+	if (rdd_hist_init(&h, blocksize) != RDD_OK) {
+		histogram_error("cannot initialize histogram");
+	}
+
+	for (pos = 0, block = 0; pos < DATA_SIZE; pos += len, block++) {
+		len = DATA_SIZE - pos < blocksize ? DATA_SIZE - pos : blocksize;
+
+		for (done = 0; done < len; done += piece) {
+			piece = 1 + (block * 7 + done) % 37;
+			if (piece > len - done) {
+				piece = len - done;
+			}
+			rdd_hist_add(&h, data + pos + done, piece);
+		}
+		rdd_hist_take(&h, counts);
+		rdd_hist_stats(&h, counts, len, &s);
+
+		reference_stats(data + pos, len, &ref);
+		compare_stats(what, blocksize, block, &s, &ref);
+	}
+
+	rdd_hist_free(&h);
+}
+
+static void
+test_histogram(const char *what)
+{
+	static unsigned sizes[] = {1, 15, 16, 512, 4096, 65536, 65537, 262144};
+	unsigned i;
+
+	printf("testing %s......", what);
+	fflush(stdout);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		test_blocks(what, sizes[i]);
+	}
+	printf("OK\n");
+}
+
+/* Checks that rdd_hist_put() followed by more input yields the same
+ * statistics as uninterrupted input, as a checkpoint restore requires.
+ */
+static void
+test_put(void)
+{
+	RDD_HISTOGRAM h;
+	RDD_HIST_STATS s, ref;
+	unsigned counts[RDD_HIST_NVAL];
+
+	printf("testing histogram restore......");
+	if (rdd_hist_init(&h, 4096) != RDD_OK) {
+		histogram_error("cannot initialize histogram");
+	}
+	rdd_hist_add(&h, data, 1001);
+	rdd_hist_get(&h, counts);
+	rdd_hist_free(&h);
+
+	if (rdd_hist_init(&h, 4096) != RDD_OK) {
+		histogram_error("cannot initialize histogram");
+	}
+	rdd_hist_put(&h, counts);
+	rdd_hist_add(&h, data + 1001, 4096 - 1001);
+	rdd_hist_take(&h, counts);
+	rdd_hist_stats(&h, counts, 4096, &s);
+	rdd_hist_free(&h);
+
+	reference_stats(data, 4096, &ref);
+	compare_stats("restore", 4096, 0, &s, &ref);
+	printf("OK\n");
+}
+
+/* Runs the statistics block filter over the data and compares its
+ * output, line by line, with the reference statistics.
+ */
+static void
+test_filter(unsigned blocksize)
+{
+	RDD_FILTER *f;
+	RDD_HIST_STATS ref;
+	FILE *fp;
+	char line[256], expected[256];
+	unsigned pos, len, block;
+
+	printf("testing statistics filter (block size %u)......", blocksize);
+	fflush(stdout);
+
+	unlink(TEST_FILE);
+	if (rdd_new_stats_blockfilter(&f, blocksize, TEST_FILE, 1) != RDD_OK) {
+		histogram_error("cannot create statistics filter");
+	}
+	for (pos = 0; pos < DATA_SIZE; pos += len) {
+		len = DATA_SIZE - pos < 1000 ? DATA_SIZE - pos : 1000;
+		if (rdd_filter_push(f, data + pos, len) != RDD_OK) {
+			histogram_error("cannot push data");
+		}
+	}
+	if (rdd_filter_close(f) != RDD_OK) {
+		histogram_error("cannot close statistics filter");
+	}
+	rdd_filter_free(f);
+
+	if ((fp = fopen(TEST_FILE, "r")) == NULL) {
+		histogram_error("cannot open %s", TEST_FILE);
+	}
+	for (pos = 0, block = 0; pos < DATA_SIZE; pos += len, block++) {
+		len = DATA_SIZE - pos < blocksize ? DATA_SIZE - pos : blocksize;
+		reference_stats(data + pos, len, &ref);
+		snprintf(expected, sizeof expected, "%u\t%u\t%u\t%u\t%u\t%lf\n",
+			block, ref.minbyte, ref.maxbyte,
+			ref.modus, ref.modus_count, ref.entropy);
+
+		if (fgets(line, sizeof line, fp) == NULL) {
+			histogram_error("block %u: missing output", block);
+		}
+		if (strcmp(line, expected) != 0) {
+			histogram_error("block %u: got '%s', expected '%s'",
+				block, line, expected);
+		}
+	}
+	if (fgets(line, sizeof line, fp) != NULL) {
+		histogram_error("unexpected output: '%s'", line);
+	}
+	fclose(fp);
+	unlink(TEST_FILE);
+	printf("OK\n");
+}
+
+static void
+benchmark(unsigned blocksize)
+{
+	RDD_HISTOGRAM h;
+	RDD_HIST_STATS s;
+	unsigned counts[RDD_HIST_NVAL];
+	unsigned char *buf;
+	double start, secs, entropy;
+	unsigned i;
+
+	if ((buf = malloc(BENCH_SIZE)) == 0) {
+		histogram_error("out of memory");
+	}
+	/* Long runs of equal bytes, as in a mostly empty disk. */
+	for (i = 0; i < BENCH_SIZE; i++) {
+		buf[i] = (i >> 20) & 0x3;
+	}
+	if (rdd_hist_init(&h, blocksize) != RDD_OK) {
+		histogram_error("cannot initialize histogram");
+	}
+
+	entropy = 0.0;
+	start = rdd_gettime();
+	for (i = 0; i < BENCH_SIZE; i += blocksize) {
+		rdd_hist_add(&h, buf + i, blocksize);
+		rdd_hist_take(&h, counts);
+		rdd_hist_stats(&h, counts, blocksize, &s);
+		entropy += s.entropy;
+	}
+	secs = rdd_gettime() - start;
+	printf("block size %6u %8.0f MB/s (%g)\n", blocksize,
+		(BENCH_SIZE / (1024.0 * 1024.0)) / secs, entropy);
+
+	rdd_hist_free(&h);
+	free(buf);
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		histogram_error("out of memory");
+	}
+
+	srand(3255);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+	test_histogram("random data");
+	test_put();
+	test_filter(4096);
+	test_filter(262144);
+
+	/* Runs of equal bytes with skewed lengths, and a few outliers. */
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = (i / (1 + i % 1500)) & 0xff;
+		if (rand() % 1000 == 0) {
+			data[i] = rand() & 0xff;
+		}
+	}
+	test_histogram("runs of equal bytes");
+
+	memset(data, 0, DATA_SIZE);
+	test_histogram("zero data");
+
+	benchmark(512);
+	benchmark(4096);
+	benchmark(65536);
+	benchmark(262144);
+
+	free(data);
+	return 0;
+}
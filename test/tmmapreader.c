@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for the mmap reader.  It reads a sparse test file that
+ * is larger than the reader's mapping window, both through the zero-copy
+ * interface and through the regular read routine, and checks that
+ * a pipe is rejected.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+
+#define TEST_FILE  "tmmapreader.dat"
+#define MB         (1024 * 1024)
+#define FILE_SIZE  ((rdd_count_t) 150 * MB + 123)
+#define MARK_SIZE  4096
+
+/* Offsets of the non-zero regions in the test file.  The second
+ * region straddles the end of the first mapping window.
+ */
+static const rdd_count_t marks[] = {
+	0,
+	(rdd_count_t) 64 * MB - 100,
+	(rdd_count_t) 100 * MB + 17,
+	FILE_SIZE - MARK_SIZE
+};
+
+#define NMARK (sizeof marks / sizeof marks[0])
+
+static void
+reader_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tmmapreader] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned char
+expected_byte(rdd_count_t pos)
+{
+	unsigned i;
+
+	for (i = 0; i < NMARK; i++) {
+		if (pos >= marks[i] && pos < marks[i] + MARK_SIZE) {
+			return (unsigned char) ((pos * 31 + i) | 1);
+		}
+	}
+	return 0;
+}
+
+static void
+create_file(void)
+{
+	unsigned char buf[MARK_SIZE];
+	unsigned i, k;
+	int fd;
+
+	if ((fd = open(TEST_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		reader_error("cannot create %s", TEST_FILE);
+	}
+	if (ftruncate(fd, (off_t) FILE_SIZE) < 0) {
+		reader_error("cannot extend %s", TEST_FILE);
+	}
+	for (i = 0; i < NMARK; i++) {
+		for (k = 0; k < MARK_SIZE; k++) {
+			buf[k] = expected_byte(marks[i] + k);
+		}
+		if (pwrite(fd, buf, MARK_SIZE, (off_t) marks[i]) != MARK_SIZE) {
+			reader_error("cannot write %s", TEST_FILE);
+		}
+	}
+	close(fd);
+}
+
+static void
+check_data(const unsigned char *data, rdd_count_t pos, unsigned nbyte)
+{
+	unsigned k;
+
+	for (k = 0; k < nbyte; k++) {
+		if (data[k] != expected_byte(pos + k)) {
+			reader_error("bad data at offset %llu", pos + k);
+		}
+	}
+}
+
+static RDD_READER *
+open_reader(void)
+{
+	RDD_READER *r = 0;
+	int fd;
+	int rc;
+
+	if ((fd = open(TEST_FILE, O_RDONLY)) < 0) {
+		reader_error("cannot open %s", TEST_FILE);
+	}
+	if ((rc = rdd_open_mmap_reader(&r, fd)) != RDD_OK) {
+		reader_error("rdd_open_mmap_reader() returned %d", rc);
+	}
+	return r;
+}
+
+static void
+close_reader(RDD_READER *r)
+{
+	int rc;
+
+	if ((rc = rdd_reader_close(r, 1)) != RDD_OK) {
+		reader_error("rdd_reader_close() returned %d", rc);
+	}
+}
+
+/* Maps the whole file in blocks of blocksize bytes.
+ */
+static void
+test_map(unsigned blocksize)
+{
+	RDD_READER *r;
+	const unsigned char *data;
+	rdd_count_t pos = 0;
+	rdd_count_t tellpos;
+	unsigned expected;
+	unsigned nread;
+	int rc;
+
+	printf("mapping with block size %u......", blocksize);
+
+	r = open_reader();
+	while (1) {
+		rc = rdd_mmap_reader_map(r, &data, blocksize, &nread);
+		if (rc != RDD_OK) {
+			reader_error("rdd_mmap_reader_map() returned %d", rc);
+		}
+		expected = FILE_SIZE - pos < blocksize ?
+				(unsigned) (FILE_SIZE - pos) : blocksize;
+		if (nread != expected) {
+			reader_error("mapped %u bytes at %llu instead of %u",
+				nread, pos, expected);
+		}
+		if (nread == 0) break;
+
+		check_data(data, pos, nread);
+		pos += nread;
+	}
+	if ((rc = rdd_reader_tell(r, &tellpos)) != RDD_OK) {
+		reader_error("rdd_reader_tell() returned %d", rc);
+	}
+	if (tellpos != FILE_SIZE) {
+		reader_error("file position is %llu at EOF", tellpos);
+	}
+	close_reader(r);
+
+	printf("OK\n");
+}
+
+/* Reads around each mark, both forwards and backwards.
+ */
+static void
+test_read(void)
+{
+	static unsigned char buf[3 * MARK_SIZE];
+	RDD_READER *r;
+	rdd_count_t pos;
+	unsigned nread;
+	int i;
+	int rc;
+
+	printf("reading around marks......");
+
+	r = open_reader();
+	for (i = (int) NMARK - 1; i >= 0; i--) {
+		pos = marks[i] >= MARK_SIZE ? marks[i] - MARK_SIZE : 0;
+		if ((rc = rdd_reader_seek(r, pos)) != RDD_OK) {
+			reader_error("rdd_reader_seek() returned %d", rc);
+		}
+		rc = rdd_reader_read(r, buf, sizeof buf, &nread);
+		if (rc != RDD_OK) {
+			reader_error("rdd_reader_read() returned %d", rc);
+		}
+		if (nread != (FILE_SIZE - pos < sizeof buf ?
+				(unsigned) (FILE_SIZE - pos) : sizeof buf)) {
+			reader_error("read %u bytes at %llu", nread, pos);
+		}
+		check_data(buf, pos, nread);
+	}
+	close_reader(r);
+
+	printf("OK\n");
+}
+
+static void
+test_pipe(void)
+{
+	RDD_READER *r = 0;
+	int fds[2];
+	int rc;
+
+	printf("rejecting a pipe......");
+
+	if (pipe(fds) < 0) {
+		reader_error("cannot create pipe");
+	}
+	if ((rc = rdd_open_mmap_reader(&r, fds[0])) != RDD_BADARG) {
+		reader_error("rdd_open_mmap_reader() returned %d for a pipe",
+			rc);
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_file();
+
+	test_map(65536);
+	test_map(1000000);
+	test_read();
+	test_pipe();
+
+	unlink(TEST_FILE);
+	return 0;
+}
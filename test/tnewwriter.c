@@ -47,7 +47,10 @@ static int test_close(RDD_WRITER *w);
 
 static RDD_WRITE_OPS test_writer = {
 	test_write,
-	test_close
+	test_close,
+	0,
+	0,
+	0
 };
 
 static struct _RDD_WRITER_TEST {
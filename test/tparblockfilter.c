@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test and benchmark for parallel block filters.  Every
+ * block filter type is run sequentially and with one and with three
+ * worker threads, on data that is pushed in pieces of varying size;
+ * the output files must be identical.  A parallel filter is then
+ * checkpointed in the middle of a block, abandoned, and resumed from
+ * the checkpoint.  Finally, the throughput of the block MD5 filter is
+ * printed for a sequential and a parallel run.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "checkpoint.h"
+#include "rdd_internals.h"
+
+#define DATA_SIZE   (3 * 1024 * 1024 + 1234)
+#define REF_FILE    "tparblockfilter.ref"
+#define RUN_FILE    "tparblockfilter.run"
+#define BENCH_SIZE  (64 * 1024 * 1024)
+#define BENCH_BLOCK 4096
+
+typedef int (*new_filter_fun)(RDD_FILTER **f, unsigned blocksize,
+				const char *outpath, int overwrite);
+
+typedef struct _FILTER_TYPE {
+	const char     *name;
+	new_filter_fun  create;
+	unsigned        blocksize;
+} FILTER_TYPE;
+
+static FILTER_TYPE filter_types[] = {
+	{"block MD5", rdd_new_md5_blockfilter, 4096},
+	{"statistics", rdd_new_stats_blockfilter, 10000},
+	{"Adler32", rdd_new_adler32_blockfilter, 32768},
+	{"CRC32", rdd_new_crc32_blockfilter, 3000},
+	{"CRC32C", rdd_new_crc32c_blockfilter, 512}
+};
+#define NTYPE (sizeof filter_types / sizeof filter_types[0])
+
+static unsigned char *data;
+
+static void
+parblock_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tparblockfilter] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(REF_FILE);
+	unlink(RUN_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static RDD_FILTER *
+new_filter(FILTER_TYPE *t, const char *path, int mode, unsigned nworker)
+{
+	RDD_FILTER *f;
+	int rc;
+
+	if ((rc = (*t->create)(&f, t->blocksize, path, mode)) != RDD_OK) {
+		parblock_error("cannot create %s filter (%d)", t->name, rc);
+	}
+	if (nworker > 0 && (rc = rdd_filter_set_parallel(f, nworker)) != RDD_OK) {
+		parblock_error("rdd_filter_set_parallel() returned %d", rc);
+	}
+	return f;
+}
+
+/* Pushes data[start..end) into f in pieces of varying size.
+ */
+static void
+push_range(RDD_FILTER *f, unsigned start, unsigned end)
+{
+	unsigned pos, len;
+	int rc;
+
+	for (pos = start; pos < end; pos += len) {
+		len = 1 + (pos * 7) % 100000;
+		if (len > end - pos) {
+			len = end - pos;
+		}
+		if ((rc = rdd_filter_push(f, data + pos, len)) != RDD_OK) {
+			parblock_error("rdd_filter_push() returned %d", rc);
+		}
+	}
+}
+
+static void
+close_filter(RDD_FILTER *f)
+{
+	int rc;
+
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		parblock_error("rdd_filter_close() returned %d", rc);
+	}
+	if ((rc = rdd_filter_free(f)) != RDD_OK) {
+		parblock_error("rdd_filter_free() returned %d", rc);
+	}
+}
+
+static void
+run_filter(FILTER_TYPE *t, const char *path, unsigned nworker)
+{
+	RDD_FILTER *f;
+
+	f = new_filter(t, path, RDD_OVERWRITE, nworker);
+	push_range(f, 0, DATA_SIZE);
+	close_filter(f);
+}
+
+static void
+compare_files(const char *what)
+{
+	FILE *ref, *run;
+	int c1, c2;
+
+	if ((ref = fopen(REF_FILE, "rb")) == NULL
+	||  (run = fopen(RUN_FILE, "rb")) == NULL) {
+		parblock_error("cannot open output files");
+	}
+	do {
+		c1 = getc(ref);
+		c2 = getc(run);
+		if (c1 != c2) {
+			parblock_error("%s: output files differ", what);
+		}
+	} while (c1 != EOF);
+	fclose(ref);
+	fclose(run);
+}
+
+/* Saves a checkpoint of a parallel filter in the middle of a block,
+ * pushes some more data, and resumes from the checkpoint; the output
+ * written after the checkpoint must be discarded.
+ */
+static void
+run_resumed(FILTER_TYPE *t, unsigned nworker)
+{
+	RDD_CHECKPOINT *cp;
+	RDD_FILTER *f;
+	unsigned half = DATA_SIZE / 2 + 17;
+	int rc;
+
+	if ((rc = rdd_new_checkpoint(&cp)) != RDD_OK) {
+		parblock_error("rdd_new_checkpoint() returned %d", rc);
+	}
+
+	f = new_filter(t, RUN_FILE, RDD_OVERWRITE, nworker);
+	push_range(f, 0, half);
+	if ((rc = rdd_filter_save(f, cp, "filter")) != RDD_OK) {
+		parblock_error("rdd_filter_save() returned %d", rc);
+	}
+	push_range(f, half, half + 5 * t->blocksize + 3);
+	close_filter(f);
+
+	f = new_filter(t, RUN_FILE, RDD_APPEND, nworker);
+	if ((rc = rdd_filter_restore(f, cp, "filter")) != RDD_OK) {
+		parblock_error("rdd_filter_restore() returned %d", rc);
+	}
+	push_range(f, half, DATA_SIZE);
+	close_filter(f);
+
+	rdd_free_checkpoint(cp);
+}
+
+static double
+benchmark(unsigned nworker)
+{
+	RDD_FILTER *f;
+	unsigned char *buf;
+	double start;
+	unsigned i;
+	int rc;
+
+	if ((buf = malloc(BENCH_SIZE)) == 0) {
+		parblock_error("out of memory");
+	}
+	memset(buf, 0x5a, BENCH_SIZE);
+
+	rc = rdd_new_md5_blockfilter(&f, BENCH_BLOCK, RUN_FILE, RDD_OVERWRITE);
+	if (rc != RDD_OK) {
+		parblock_error("cannot create block MD5 filter (%d)", rc);
+	}
+	if (nworker > 0 && (rc = rdd_filter_set_parallel(f, nworker)) != RDD_OK) {
+		parblock_error("rdd_filter_set_parallel() returned %d", rc);
+	}
+
+	start = rdd_gettime();
+	for (i = 0; i < BENCH_SIZE; i += 1024 * 1024) {
+		if ((rc = rdd_filter_push(f, buf + i, 1024 * 1024)) != RDD_OK) {
+			parblock_error("rdd_filter_push() returned %d", rc);
+		}
+	}
+	close_filter(f);
+
+	free(buf);
+	return (BENCH_SIZE / (1024.0 * 1024.0)) / (rdd_gettime() - start);
+}
+
+int
+main(void)
+{
+	static unsigned nworkers[] = {1, 3};
+	FILTER_TYPE *t;
+	unsigned i, k;
+	long ncpu;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		parblock_error("out of memory");
+	}
+	srand(1717);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = (i / 5000) % 3 == 0 ? 0 : rand() & 0xff;
+	}
+
+	for (i = 0; i < NTYPE; i++) {
+		t = &filter_types[i];
+		printf("testing parallel %s filter......", t->name);
+		fflush(stdout);
+
+		run_filter(t, REF_FILE, 0);
+		for (k = 0; k < sizeof nworkers / sizeof nworkers[0]; k++) {
+			run_filter(t, RUN_FILE, nworkers[k]);
+			compare_files(t->name);
+			run_resumed(t, nworkers[k]);
+			compare_files(t->name);
+		}
+		printf("OK\n");
+	}
+	unlink(REF_FILE);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 2) {
+		ncpu = 2;
+	}
+	printf("block MD5 (%u-byte blocks), sequential: %8.0f MB/s\n",
+		BENCH_BLOCK, benchmark(0));
+	printf("block MD5 (%u-byte blocks), %ld threads: %8.0f MB/s\n",
+		BENCH_BLOCK, ncpu, benchmark((unsigned) ncpu));
+	unlink(RUN_FILE);
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* A unit-test for parallel filter sets.  The same data is pushed
+ * into a sequential and into parallel filter sets, using buffers
+ * of varying sizes; all filter results must be identical.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "rdd_internals.h"
+#include "md5.h"
+#include "sha1.h"
+
+#define DATA_SIZE  (1024 * 1024 + 17)
+#define NFILTER    4
+
+typedef struct _RESULT {
+	unsigned char md5[NFILTER / 2][MD5_DIGEST_LENGTH];
+	unsigned char sha1[NFILTER / 2][SHA_DIGEST_LENGTH];
+} RESULT;
+
+static void
+fset_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tparfset] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void
+check(int rc, const char *what)
+{
+	if (rc != RDD_OK) {
+		fset_error("%s returned %d instead of RDD_OK", what, rc);
+	}
+}
+
+/* Hashes data with two MD5 and two SHA-1 filters.  If nbuf is
+ * nonzero, the filter set runs on nworker threads that share nbuf
+ * buffers.
+ */
+static void
+run(unsigned char *data, unsigned nworker, unsigned nbuf, RESULT *res)
+{
+	static const char *names[NFILTER] = {
+		"MD5 #0", "SHA-1 #0", "MD5 #1", "SHA-1 #1"
+	};
+	RDD_FILTERSET fset;
+	RDD_FILTER *f;
+	unsigned char *buf;
+	unsigned pos, len;
+	unsigned i;
+	int rc;
+
+	check(rdd_fset_init(&fset), "rdd_fset_init()");
+	for (i = 0; i < NFILTER; i++) {
+		if (i % 2 == 0) {
+			check(rdd_new_md5_streamfilter(&f),
+				"rdd_new_md5_streamfilter()");
+		} else {
+			check(rdd_new_sha1_streamfilter(&f),
+				"rdd_new_sha1_streamfilter()");
+		}
+		check(rdd_fset_add(&fset, names[i], f), "rdd_fset_add()");
+	}
+
+	if (nbuf > 0) {
+		check(rdd_fset_set_parallel(&fset, nworker, nbuf),
+			"rdd_fset_set_parallel()");
+		if (rdd_fset_add(&fset, "late", f) != RDD_BADARG) {
+			fset_error("rdd_fset_add() accepted a filter "
+				"in a parallel filter set");
+		}
+	}
+
+	/* Push buffers of 0, 1, ... bytes, then larger ones, so that
+	 * the shared buffers must grow.  Every other buffer is filled
+	 * in place, in a buffer lent by the filter set.
+	 */
+	for (i = 0, pos = 0, len = 0; pos < DATA_SIZE; i++, pos += len) {
+		len = len < 64 ? len + 1 : 2 * len;
+		if (len > DATA_SIZE - pos) {
+			len = DATA_SIZE - pos;
+		}
+		buf = data + pos;
+		if (i % 2 == 1) {
+			rc = rdd_fset_get_buffer(&fset, len, &buf);
+			if (nbuf == 0 && rc != RDD_NOTFOUND) {
+				fset_error("rdd_fset_get_buffer() returned %d "
+					"instead of RDD_NOTFOUND", rc);
+			} else if (nbuf > 0) {
+				check(rc, "rdd_fset_get_buffer()");
+				memcpy(buf, data + pos, len);
+			}
+		}
+		check(rdd_fset_push(&fset, buf, len), "rdd_fset_push()");
+	}
+	check(rdd_fset_close(&fset), "rdd_fset_close()");
+
+	for (i = 0; i < NFILTER; i++) {
+		check(rdd_fset_get(&fset, names[i], &f), "rdd_fset_get()");
+		if (i % 2 == 0) {
+			check(rdd_filter_get_result(f, res->md5[i / 2],
+						MD5_DIGEST_LENGTH),
+				"rdd_filter_get_result()");
+		} else {
+			check(rdd_filter_get_result(f, res->sha1[i / 2],
+						SHA_DIGEST_LENGTH),
+				"rdd_filter_get_result()");
+		}
+	}
+	check(rdd_fset_clear(&fset), "rdd_fset_clear()");
+}
+
+int
+main(void)
+{
+	static const unsigned nworkers[] = {0, 1, 2, 3};
+	unsigned char *data;
+	RESULT expected;
+	RESULT result;
+	unsigned i;
+
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		fset_error("out of memory");
+	}
+	srand(4832);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	memset(&expected, 0, sizeof expected);
+	run(data, 0, 0, &expected);
+	if (memcmp(expected.md5[0], expected.md5[1], MD5_DIGEST_LENGTH) != 0
+	||  memcmp(expected.sha1[0], expected.sha1[1], SHA_DIGEST_LENGTH) != 0) {
+		fset_error("sequential filters disagree");
+	}
+
+	for (i = 0; i < sizeof nworkers / sizeof nworkers[0]; i++) {
+		printf("testing %u worker(s)......", nworkers[i]);
+		memset(&result, 0, sizeof result);
+		run(data, nworkers[i], 2 + i, &result);
+		if (memcmp(&result, &expected, sizeof result) != 0) {
+			fset_error("parallel results differ (%u workers)",
+				nworkers[i]);
+		}
+		printf("OK\n");
+	}
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for the pipelined copier.  It copies a test file with
+ * a robust copier and with a pipelined copier, with and without
+ * simulated read errors, and checks that the image files, the MD5
+ * hash values, and the copier statistics are the same.  When a copy
+ * is given up because of too many substitutions, neither copier may
+ * close (and so finalize) its filters.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+
+#define TEST_FILE   "tpipelinedcopier.dat"
+#define FAULT_FILE  "tpipelinedcopier.flt"
+#define ROBUST_IMG  "tpipelinedcopier.img0"
+#define PIPE_IMG    "tpipelinedcopier.img1"
+#define FILE_SIZE   (200 * 1024 + 777)
+#define BLOCK_SIZE  4096
+#define MIN_BLOCK   512
+
+static void
+pipelined_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tpipelinedcopier] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	unlink(ROBUST_IMG);
+	unlink(PIPE_IMG);
+	exit(EXIT_FAILURE);
+}
+
+static void
+create_files(void)
+{
+	FILE *fp;
+	unsigned i;
+
+	if ((fp = fopen(TEST_FILE, "wb")) == NULL) {
+		pipelined_error("cannot create %s", TEST_FILE);
+	}
+	srand(17);
+	for (i = 0; i < FILE_SIZE; i++) {
+		putc(rand() & 0xff, fp);
+	}
+	fclose(fp);
+
+	if ((fp = fopen(FAULT_FILE, "w")) == NULL) {
+		pipelined_error("cannot create %s", FAULT_FILE);
+	}
+	fprintf(fp, "1000 1.0\n");
+	fprintf(fp, "9000 1.0\n");
+	fprintf(fp, "70000 1.0\n");
+	fprintf(fp, "%u 1.0\n", FILE_SIZE - 100);
+	fclose(fp);
+}
+
+/* Progress callback that aborts the copy once *env bytes
+ * have been copied.
+ */
+static int
+abort_progress(rdd_count_t ncopied, void *env)
+{
+	rdd_count_t limit = *((rdd_count_t *) env);
+
+	return ncopied >= limit ? RDD_ABORTED : RDD_OK;
+}
+
+/* Copies the test file with copier c to the image file imgpath and
+ * returns the MD5 hash.  After a failed copy the hash is that of an
+ * MD5 filter that was never closed: all zeroes.
+ */
+static int
+run_copier(RDD_COPIER *c, int faulty, const char *imgpath,
+		unsigned char *md5, RDD_COPIER_RETURN *ret)
+{
+	RDD_FILTERSET fset;
+	RDD_FILTER *f = 0;
+	RDD_FILTER *wf = 0;
+	RDD_WRITER *w = 0;
+	RDD_READER *r = 0;
+	int rc;
+	int exec_rc;
+
+	if ((rc = rdd_fset_init(&fset)) != RDD_OK) {
+		pipelined_error("rdd_fset_init() returned %d", rc);
+	}
+	if ((rc = rdd_new_md5_streamfilter(&f)) != RDD_OK) {
+		pipelined_error("rdd_new_md5_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_fset_add(&fset, "md5", f)) != RDD_OK) {
+		pipelined_error("rdd_fset_add() returned %d", rc);
+	}
+	if ((rc = rdd_open_file_writer(&w, imgpath)) != RDD_OK) {
+		pipelined_error("cannot open %s", imgpath);
+	}
+	if ((rc = rdd_new_write_streamfilter(&wf, w)) != RDD_OK) {
+		pipelined_error("rdd_new_write_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_fset_add(&fset, "write", wf)) != RDD_OK) {
+		pipelined_error("rdd_fset_add() returned %d", rc);
+	}
+	if ((rc = rdd_open_file_reader(&r, TEST_FILE, 0)) != RDD_OK) {
+		pipelined_error("cannot open %s", TEST_FILE);
+	}
+	if (faulty) {
+		if ((rc = rdd_open_faulty_reader(&r, r, FAULT_FILE)) != RDD_OK) {
+			pipelined_error("cannot open faulty reader");
+		}
+	}
+
+	memset(ret, 0, sizeof(*ret));
+	exec_rc = rdd_copy_exec(c, r, &fset, ret);
+	if ((rc = rdd_filter_get_result(f, md5, 16)) != RDD_OK) {
+		pipelined_error("rdd_filter_get_result() returned %d", rc);
+	}
+
+	(void) rdd_reader_close(r, 1);
+	(void) rdd_fset_clear(&fset);
+	return exec_rc;
+}
+
+/* Returns 0 if the two files have the same contents.
+ */
+static int
+compare_files(const char *path0, const char *path1)
+{
+	FILE *fp0, *fp1;
+	int c0, c1;
+
+	if ((fp0 = fopen(path0, "rb")) == NULL) {
+		pipelined_error("cannot open %s", path0);
+	}
+	if ((fp1 = fopen(path1, "rb")) == NULL) {
+		pipelined_error("cannot open %s", path1);
+	}
+	do {
+		c0 = getc(fp0);
+		c1 = getc(fp1);
+	} while (c0 == c1 && c0 != EOF);
+	fclose(fp0);
+	fclose(fp1);
+
+	return c0 != c1;
+}
+
+static void
+test_pipelined(unsigned nbuf, int faulty, unsigned maxsubst,
+		rdd_count_t abortpos)
+{
+	static unsigned char zero[16];
+	RDD_ROBUST_PARAMS p;
+	RDD_COPIER_RETURN ret0, ret;
+	RDD_COPIER *c = 0;
+	unsigned char md0[16], md[16];
+	int rc0, rc;
+
+	printf("testing %u buffers%s", nbuf, faulty ? ", read errors" : "");
+	if (maxsubst > 0) printf(", at most %u substitutions", maxsubst);
+	if (abortpos > 0) printf(", client abort");
+	printf("......");
+
+	memset(&p, 0, sizeof p);
+	p.minblocklen = MIN_BLOCK;
+	p.maxblocklen = BLOCK_SIZE;
+	p.nretry = 1;
+	p.maxsubst = maxsubst;
+	if (abortpos > 0) {
+		p.progressfun = abort_progress;
+		p.progressenv = &abortpos;
+	}
+
+	if ((rc = rdd_new_robust_copier(&c, 0, FILE_SIZE, &p)) != RDD_OK) {
+		pipelined_error("rdd_new_robust_copier() returned %d", rc);
+	}
+	rc0 = run_copier(c, faulty, ROBUST_IMG, md0, &ret0);
+	rdd_copy_free(c);
+
+	rc = rdd_new_pipelined_copier(&c, 0, FILE_SIZE, nbuf, &p);
+	if (rc != RDD_OK) {
+		pipelined_error("rdd_new_pipelined_copier() returned %d", rc);
+	}
+	rc = run_copier(c, faulty, PIPE_IMG, md, &ret);
+	rdd_copy_free(c);
+
+	if (rc != rc0) {
+		pipelined_error("pipelined copier returned %d instead of %d",
+			rc, rc0);
+	}
+	if (memcmp(md, md0, sizeof md) != 0) {
+		pipelined_error("MD5 hash values differ");
+	}
+	if (ret.nbyte != ret0.nbyte || ret.nlost != ret0.nlost
+	||  ret.nread_err != ret0.nread_err || ret.nsubst != ret0.nsubst) {
+		pipelined_error("statistics differ");
+	}
+	if (rc == RDD_OK || (rc == RDD_ABORTED && abortpos > 0)) {
+		if (memcmp(md, zero, sizeof md) == 0) {
+			pipelined_error("filters were not closed");
+		}
+		if (compare_files(ROBUST_IMG, PIPE_IMG) != 0) {
+			pipelined_error("image files differ");
+		}
+	} else if (memcmp(md, zero, sizeof md) != 0) {
+		pipelined_error("filters were closed after error %d", rc);
+	}
+	if (faulty && rc == RDD_OK && ret.nsubst == 0) {
+		pipelined_error("no substitutions");
+	}
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_files();
+
+	test_pipelined(2, 0, 0, 0);
+	test_pipelined(8, 0, 0, 0);
+	test_pipelined(2, 1, 0, 0);
+	test_pipelined(8, 1, 0, 0);
+	test_pipelined(4, 1, 2, 0);
+	test_pipelined(4, 1, 0, 100 * 1024);
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	unlink(ROBUST_IMG);
+	unlink(PIPE_IMG);
+	return 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for the rescue copier and the rescue map.  It rescues
+ * a test file with simulated read errors, checks the image, the
+ * hash value, and the map, and checks that an interrupted rescue
+ * can be resumed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+#include "rescuemap.h"
+#include "rdd_internals.h"
+#include "md5.h"
+
+#define TEST_FILE   "trescuecopier.dat"
+#define FAULT_FILE  "trescuecopier.flt"
+#define IMAGE_FILE  "trescuecopier.img"
+#define MAP_FILE    "trescuecopier.map"
+#define FILE_SIZE   (300 * 1024 + 100)
+#define BLOCK_SIZE  16384
+#define MIN_BLOCK   512
+
+static const unsigned faults[] = {5000, 5600, 70000, FILE_SIZE - 10};
+#define NFAULT (sizeof faults / sizeof faults[0])
+
+typedef struct _PROGRESS {
+	unsigned    ncall;
+	unsigned    abort_after;	/* 0: never abort */
+	rdd_count_t ncopied;
+} PROGRESS;
+
+static unsigned char *contents;
+static PROGRESS progress;
+
+static void
+rescue_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[trescuecopier] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	unlink(IMAGE_FILE);
+	unlink(MAP_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static void
+create_files(void)
+{
+	FILE *fp;
+	unsigned i;
+
+	if ((contents = malloc(FILE_SIZE)) == 0) {
+		rescue_error("out of memory");
+	}
+	srand(5);
+	for (i = 0; i < FILE_SIZE; i++) {
+		contents[i] = rand() & 0xff;
+	}
+	if ((fp = fopen(TEST_FILE, "wb")) == NULL) {
+		rescue_error("cannot create %s", TEST_FILE);
+	}
+	fwrite(contents, 1, FILE_SIZE, fp);
+	fclose(fp);
+
+	if ((fp = fopen(FAULT_FILE, "w")) == NULL) {
+		rescue_error("cannot create %s", FAULT_FILE);
+	}
+	for (i = 0; i < NFAULT; i++) {
+		fprintf(fp, "%u 1.0\n", faults[i]);
+	}
+	fclose(fp);
+
+	/* The expected image: all blocks that contain a fault are zero.
+	 */
+	for (i = 0; i < NFAULT; i++) {
+		unsigned start = (faults[i] / MIN_BLOCK) * MIN_BLOCK;
+		unsigned end = start + MIN_BLOCK;
+
+		memset(contents + start, 0,
+			(end < FILE_SIZE ? end : FILE_SIZE) - start);
+	}
+}
+
+static int
+count_progress(rdd_count_t ncopied, void *env)
+{
+	PROGRESS *p = (PROGRESS *) env;
+
+	if (ncopied < p->ncopied || ncopied > FILE_SIZE) {
+		rescue_error("bad progress count");
+	}
+	p->ncopied = ncopied;
+	p->ncall++;
+	if (p->abort_after > 0 && p->ncall >= p->abort_after) {
+		return RDD_ABORTED;
+	}
+	return RDD_OK;
+}
+
+static int
+run_rescue(RDD_FILTER **md5f, RDD_FILTERSET *fset, RDD_COPIER_RETURN *ret)
+{
+	RDD_ROBUST_PARAMS p;
+	RDD_COPIER *c = 0;
+	RDD_READER *r = 0;
+	int exec_rc;
+	int rc;
+
+	if ((rc = rdd_fset_init(fset)) != RDD_OK) {
+		rescue_error("rdd_fset_init() returned %d", rc);
+	}
+	if ((rc = rdd_new_md5_streamfilter(md5f)) != RDD_OK) {
+		rescue_error("rdd_new_md5_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_fset_add(fset, "md5", *md5f)) != RDD_OK) {
+		rescue_error("rdd_fset_add() returned %d", rc);
+	}
+
+	if ((rc = rdd_open_file_reader(&r, TEST_FILE, 0)) != RDD_OK) {
+		rescue_error("cannot open %s", TEST_FILE);
+	}
+	if ((rc = rdd_open_faulty_reader(&r, r, FAULT_FILE)) != RDD_OK) {
+		rescue_error("rdd_open_faulty_reader() returned %d", rc);
+	}
+
+	memset(&p, 0, sizeof p);
+	p.minblocklen = MIN_BLOCK;
+	p.maxblocklen = BLOCK_SIZE;
+	p.nretry = 2;
+	p.progressfun = count_progress;
+	p.progressenv = &progress;
+
+	rc = rdd_new_rescue_copier(&c, 0, FILE_SIZE, IMAGE_FILE, MAP_FILE, &p);
+	if (rc != RDD_OK) {
+		rescue_error("rdd_new_rescue_copier() returned %d", rc);
+	}
+	exec_rc = rdd_copy_exec(c, r, fset, ret);
+
+	rdd_copy_free(c);
+	rdd_reader_close(r, 1);
+	return exec_rc;
+}
+
+static void
+check_result(RDD_FILTER *md5f, RDD_COPIER_RETURN *ret)
+{
+	unsigned char md[16], expected[16];
+	unsigned char *image;
+	RDD_RESCUE_MAP *m = 0;
+	MD5_CTX ctx;
+	FILE *fp;
+	int rc;
+
+	if ((image = malloc(FILE_SIZE + 1)) == 0) {
+		rescue_error("out of memory");
+	}
+	if ((fp = fopen(IMAGE_FILE, "rb")) == NULL) {
+		rescue_error("cannot open %s", IMAGE_FILE);
+	}
+	if (fread(image, 1, FILE_SIZE + 1, fp) != FILE_SIZE) {
+		rescue_error("image has the wrong size");
+	}
+	fclose(fp);
+	if (memcmp(image, contents, FILE_SIZE) != 0) {
+		rescue_error("image differs from expected image");
+	}
+	free(image);
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, contents, FILE_SIZE);
+	MD5_Final(expected, &ctx);
+	if ((rc = rdd_filter_get_result(md5f, md, sizeof md)) != RDD_OK) {
+		rescue_error("rdd_filter_get_result() returned %d", rc);
+	}
+	if (memcmp(md, expected, sizeof md) != 0) {
+		rescue_error("bad MD5 hash value");
+	}
+
+	if (ret->nbyte != FILE_SIZE || ret->nlost != 3 * MIN_BLOCK + 100) {
+		rescue_error("bad statistics");
+	}
+
+	if ((rc = rdd_open_rescue_map(&m, MAP_FILE, 0, FILE_SIZE)) != RDD_OK) {
+		rescue_error("rdd_open_rescue_map() returned %d", rc);
+	}
+	if (rdd_map_count(m, RDD_MAP_BAD) != ret->nlost
+	||  rdd_map_count(m, RDD_MAP_GOOD) != FILE_SIZE - ret->nlost) {
+		rescue_error("bad rescue map");
+	}
+	rdd_close_rescue_map(m);
+}
+
+static int
+fail_presave(void *env)
+{
+	(*(unsigned *) env)++;
+	return RDD_EWRITE;
+}
+
+static void
+test_map(void)
+{
+	RDD_RESCUE_MAP *m = 0;
+	rdd_count_t off, len;
+	unsigned npresave = 0;
+	int rc;
+
+	printf("testing rescue map......");
+
+	unlink(MAP_FILE);
+	if ((rc = rdd_open_rescue_map(&m, MAP_FILE, 1000, 10000)) != RDD_OK) {
+		rescue_error("rdd_open_rescue_map() returned %d", rc);
+	}
+	rdd_map_set(m, 1000, 2000, RDD_MAP_GOOD);
+	rdd_map_set(m, 5000, 1000, RDD_MAP_SKIPPED);
+	rdd_map_set(m, 3000, 2000, RDD_MAP_GOOD);
+	rdd_map_set(m, 8000, 500, RDD_MAP_SKIPPED);
+	rdd_map_set(m, 5500, 100, RDD_MAP_BAD);
+	if (m->next != 7) {
+		rescue_error("map has %u extents instead of 7", m->next);
+	}
+	if (rdd_map_find(m, RDD_MAP_SKIPPED, 5200, &off, &len) != RDD_OK
+	||  off != 5200 || len != 300) {
+		rescue_error("rdd_map_find() failed");
+	}
+	if (rdd_map_find_last(m, RDD_MAP_SKIPPED, 8200, &off, &len) != RDD_OK
+	||  off != 8000 || len != 200) {
+		rescue_error("rdd_map_find_last() failed");
+	}
+	if (rdd_map_find(m, RDD_MAP_UNTRIED, 9000, &off, &len) != RDD_OK
+	||  off != 9000 || len != 2000) {
+		rescue_error("rdd_map_find() failed at the end of the map");
+	}
+	if ((rc = rdd_close_rescue_map(m)) != RDD_OK) {
+		rescue_error("rdd_close_rescue_map() returned %d", rc);
+	}
+
+	/* Read it back.
+	 */
+	if ((rc = rdd_open_rescue_map(&m, MAP_FILE, 1000, 10000)) != RDD_OK) {
+		rescue_error("cannot reopen map (%d)", rc);
+	}
+	if (m->next != 7 || rdd_map_count(m, RDD_MAP_BAD) != 100
+	||  rdd_map_count(m, RDD_MAP_SKIPPED) != 1400) {
+		rescue_error("map changed after save");
+	}
+
+	/* A failing presave routine (image sync) fails the save and
+	 * leaves the old map file in place.
+	 */
+	rdd_map_set_presave(m, fail_presave, &npresave);
+	rdd_map_set(m, 9000, 1000, RDD_MAP_GOOD);
+	if (rdd_map_save(m) != RDD_EWRITE || npresave != 1) {
+		rescue_error("presave failure not reported");
+	}
+	rdd_map_set_presave(m, 0, 0);
+	rdd_close_rescue_map(m);
+
+	if (rdd_open_rescue_map(&m, MAP_FILE, 0, 10000) != RDD_ERANGE) {
+		rescue_error("map accepted for the wrong range");
+	}
+	unlink(MAP_FILE);
+
+	printf("OK\n");
+}
+
+static void
+test_rescue(void)
+{
+	RDD_COPIER_RETURN ret;
+	RDD_FILTERSET fset;
+	RDD_FILTER *md5f = 0;
+	int rc;
+
+	printf("testing rescue......");
+
+	unlink(IMAGE_FILE);
+	unlink(MAP_FILE);
+	memset(&progress, 0, sizeof progress);
+	if ((rc = run_rescue(&md5f, &fset, &ret)) != RDD_OK) {
+		rescue_error("rescue returned %d", rc);
+	}
+	check_result(md5f, &ret);
+	rdd_fset_clear(&fset);
+
+	printf("OK\n");
+}
+
+static void
+test_resume(void)
+{
+	RDD_COPIER_RETURN ret;
+	RDD_FILTERSET fset;
+	RDD_FILTER *md5f = 0;
+	unsigned nrun;
+	int rc;
+
+	printf("testing interrupted rescues......");
+
+	unlink(IMAGE_FILE);
+	unlink(MAP_FILE);
+	memset(&progress, 0, sizeof progress);
+	for (nrun = 0; ; nrun++) {
+		progress.ncall = 0;
+		progress.abort_after = 5;
+		rc = run_rescue(&md5f, &fset, &ret);
+		if (rc == RDD_OK) {
+			break;
+		} else if (rc != RDD_ABORTED) {
+			rescue_error("rescue returned %d", rc);
+		} else if (nrun > 1000) {
+			rescue_error("rescue does not make progress");
+		}
+		rdd_fset_clear(&fset);
+	}
+	if (nrun < 2) {
+		rescue_error("rescue was not interrupted");
+	}
+	check_result(md5f, &ret);
+	rdd_fset_clear(&fset);
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_files();
+
+	test_map();
+	test_rescue();
+	test_resume();
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	unlink(IMAGE_FILE);
+	unlink(MAP_FILE);
+	free(contents);
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* A unit-test for the server limits.  A child process waits for
+ * memory that its parent holds, and a run of throttled transfers
+ * must not exceed the bandwidth budget.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "rdd.h"
+#include "serverlimits.h"
+
+#define MAX_MEMORY   1000
+#define MAX_RATE     (4 * 1024 * 1024)	/* bytes/s */
+#define CHUNK        65536
+#define NCHUNK       32			/* 2 Mbyte: at least 0.4 s */
+
+static void
+limits_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tserverlimits] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+test_memory(void)
+{
+	RDD_SERVER_LIMITS *sl = 0;
+	double start;
+	pid_t pid;
+	int status;
+	int rc;
+
+	if ((rc = rdd_new_server_limits(&sl, 2, MAX_MEMORY, 0)) != RDD_OK) {
+		limits_error("rdd_new_server_limits() returned %d", rc);
+	}
+	if ((rc = rdd_server_limits_reserve(sl, 0, MAX_MEMORY + 1))
+			!= RDD_ERANGE) {
+		limits_error("oversized reservation returned %d", rc);
+	}
+	if ((rc = rdd_server_limits_reserve(sl, 0, 600)) != RDD_OK) {
+		limits_error("rdd_server_limits_reserve() returned %d", rc);
+	}
+
+	if ((pid = fork()) < 0) {
+		limits_error("cannot fork");
+	} else if (pid == 0) {
+		/* Must wait until the parent releases slot 0.
+		 */
+		start = now();
+		rc = rdd_server_limits_reserve(sl, 1, 600);
+		if (rc != RDD_OK) {
+			exit(2);
+		}
+		exit(now() - start < 0.2 ? 3 : 0);
+	}
+
+	usleep(300000);
+	if ((rc = rdd_server_limits_release(sl, 0)) != RDD_OK) {
+		limits_error("rdd_server_limits_release() returned %d", rc);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		limits_error("cannot wait for child");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		limits_error("child failed (status %d)", status);
+	}
+
+	/* The child has exited without releasing its slot.
+	 */
+	if ((rc = rdd_server_limits_release(sl, 1)) != RDD_OK) {
+		limits_error("rdd_server_limits_release() returned %d", rc);
+	}
+	if ((rc = rdd_server_limits_reserve(sl, 0, MAX_MEMORY)) != RDD_OK) {
+		limits_error("full reservation returned %d", rc);
+	}
+
+	if ((rc = rdd_free_server_limits(sl)) != RDD_OK) {
+		limits_error("rdd_free_server_limits() returned %d", rc);
+	}
+}
+
+static void
+test_throttle(void)
+{
+	RDD_SERVER_LIMITS *sl = 0;
+	double start, elapsed;
+	unsigned i;
+	int rc;
+
+	if ((rc = rdd_new_server_limits(&sl, 1, 0, MAX_RATE)) != RDD_OK) {
+		limits_error("rdd_new_server_limits() returned %d", rc);
+	}
+	start = now();
+	for (i = 0; i < NCHUNK; i++) {
+		if ((rc = rdd_server_limits_throttle(sl, CHUNK)) != RDD_OK) {
+			limits_error("rdd_server_limits_throttle() returned %d",
+					rc);
+		}
+	}
+	elapsed = now() - start;
+
+	/* The bucket starts full with 0.1 s worth of bytes.
+	 */
+	if (elapsed < (double) NCHUNK * CHUNK / MAX_RATE - 0.15) {
+		limits_error("throttle too fast (%.3f s)", elapsed);
+	}
+	if (elapsed > 5.0) {
+		limits_error("throttle too slow (%.3f s)", elapsed);
+	}
+
+	if ((rc = rdd_free_server_limits(sl)) != RDD_OK) {
+		limits_error("rdd_free_server_limits() returned %d", rc);
+	}
+}
+
+int
+main(void)
+{
+	test_memory();
+	test_throttle();
+	return 0;
+}
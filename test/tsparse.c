@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+
+/* A unit-test for sparse output.  It writes data with long runs of
+ * zero bytes through sparse safe and part writers and checks the
+ * contents and sizes of the output files and the number of bytes
+ * that were left as holes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rdd.h"
+#include "writer.h"
+
+#define OUT_FILE    "tsparse.img"
+#define PAGE        4096
+#define NPAGE       16
+#define DATA_SIZE   (NPAGE * PAGE)
+#define WRITE_SIZE  (4 * PAGE)
+#define ODD_WRITE   7000
+#define SPLIT_SIZE  20000
+#define NPART       ((DATA_SIZE + SPLIT_SIZE - 1) / SPLIT_SIZE)
+
+/* Page layout of the test data: 'd' is random data, '0' is zeros.
+ * The data ends with a run of zeros, so the output ends in a hole.
+ */
+static const char layout[NPAGE + 1] = "dd0000d000000000";
+
+static unsigned char contents[DATA_SIZE];
+
+static void
+sparse_error(char *fmt, ...)
+{
+	va_list ap;
+	char path[64];
+	unsigned i;
+
+	fprintf(stderr, "[tsparse] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(OUT_FILE);
+	for (i = 0; i < NPART; i++) {
+		snprintf(path, sizeof path, "%u-%s", i, OUT_FILE);
+		unlink(path);
+	}
+	exit(EXIT_FAILURE);
+}
+
+static void
+init_contents(void)
+{
+	unsigned i;
+
+	srand(11);
+	for (i = 0; i < DATA_SIZE; i++) {
+		contents[i] = layout[i / PAGE] == 'd' ? (rand() & 0xff) | 1 : 0;
+	}
+}
+
+static void
+write_all(RDD_WRITER *w, unsigned chunk)
+{
+	unsigned pos, n;
+	int rc;
+
+	for (pos = 0; pos < DATA_SIZE; pos += n) {
+		n = DATA_SIZE - pos < chunk ? DATA_SIZE - pos : chunk;
+		if ((rc = rdd_writer_write(w, contents + pos, n)) != RDD_OK) {
+			sparse_error("rdd_writer_write() returned %d", rc);
+		}
+	}
+}
+
+/* Checks that file path holds len bytes that equal data.
+ */
+static void
+check_file(const char *path, const unsigned char *data, unsigned len)
+{
+	unsigned char *buf;
+	struct stat info;
+	FILE *fp;
+
+	if (stat(path, &info) < 0 || info.st_size != (off_t) len) {
+		sparse_error("%s has the wrong size", path);
+	}
+	if ((buf = malloc(len + 1)) == 0) {
+		sparse_error("out of memory");
+	}
+	if ((fp = fopen(path, "rb")) == NULL) {
+		sparse_error("cannot open %s", path);
+	}
+	if (fread(buf, 1, len + 1, fp) != len || memcmp(buf, data, len) != 0) {
+		sparse_error("%s has the wrong contents", path);
+	}
+	fclose(fp);
+	free(buf);
+	unlink(path);
+}
+
+static void
+test_safe(rdd_write_mode_t wmode, rdd_count_t expected)
+{
+	RDD_WRITER *w = 0;
+	rdd_count_t nhole;
+	int rc;
+
+	unlink(OUT_FILE);
+	if ((rc = rdd_open_safe_writer(&w, OUT_FILE, wmode)) != RDD_OK) {
+		sparse_error("rdd_open_safe_writer() returned %d", rc);
+	}
+	write_all(w, WRITE_SIZE);
+	if ((rc = rdd_writer_holes(w, &nhole)) != RDD_OK) {
+		sparse_error("rdd_writer_holes() returned %d", rc);
+	}
+	if (nhole != expected) {
+		sparse_error("%lu bytes left as holes instead of %lu",
+			(unsigned long) nhole, (unsigned long) expected);
+	}
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		sparse_error("rdd_writer_close() returned %d", rc);
+	}
+	check_file(OUT_FILE, contents, DATA_SIZE);
+}
+
+static void
+test_part(void)
+{
+	RDD_WRITER *w = 0;
+	rdd_count_t nhole;
+	char path[64];
+	unsigned i, len;
+	int rc;
+
+	rc = rdd_open_part_writer(&w, OUT_FILE, DATA_SIZE, SPLIT_SIZE,
+				RDD_OVERWRITE|RDD_SPARSE);
+	if (rc != RDD_OK) {
+		sparse_error("rdd_open_part_writer() returned %d", rc);
+	}
+	write_all(w, ODD_WRITE);
+	if ((rc = rdd_writer_holes(w, &nhole)) != RDD_OK) {
+		sparse_error("rdd_writer_holes() returned %d", rc);
+	}
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		sparse_error("rdd_writer_close() returned %d", rc);
+	}
+
+	/* Writes do not line up with pages or parts, so fewer bytes
+	 * become holes; there must be some, though.
+	 */
+	if (nhole == 0 || nhole > (NPAGE - 3) * PAGE) {
+		sparse_error("%lu bytes left as holes in parts",
+			(unsigned long) nhole);
+	}
+	for (i = 0; i < NPART; i++) {
+		len = DATA_SIZE - i * SPLIT_SIZE;
+		if (len > SPLIT_SIZE) {
+			len = SPLIT_SIZE;
+		}
+		snprintf(path, sizeof path, "%u-%s", i, OUT_FILE);
+		check_file(path, contents + i * SPLIT_SIZE, len);
+	}
+}
+
+int
+main(void)
+{
+	init_contents();
+
+	printf("testing sparse writers......");
+	fflush(stdout);
+
+	test_safe(RDD_OVERWRITE, 0);
+	test_safe(RDD_OVERWRITE|RDD_SPARSE, (NPAGE - 3) * PAGE);
+	test_part();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* A unit-test for striped network transfers.  A stream is written
+ * through a stripe writer into several files, which stand in for
+ * TCP connections, and read back with a stripe reader.  The test
+ * also checks the request and join headers of a striped session,
+ * and that a cut-off or misordered stream is detected.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "msgprinter.h"
+#include "netio.h"
+
+#define MAX_STREAM  4
+#define DATA_SIZE   (3 * 1024 * 1024 + 333)
+#define FRAME_SIZE  65536
+
+static unsigned char *data;
+static unsigned char *result;
+static char paths[MAX_STREAM][32];
+
+static void
+cleanup(void)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_STREAM; i++) {
+		unlink(paths[i]);
+	}
+}
+
+static void
+stripe_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tstripe] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	cleanup();
+	exit(EXIT_FAILURE);
+}
+
+static RDD_WRITER *
+open_output(const char *path)
+{
+	RDD_WRITER *w;
+	int fd;
+	int rc;
+
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		stripe_error("cannot create %s", path);
+	}
+	if ((rc = rdd_open_fd_writer(&w, fd)) != RDD_OK) {
+		stripe_error("rdd_open_fd_writer() returned %d", rc);
+	}
+	return w;
+}
+
+static RDD_READER *
+open_input(const char *path)
+{
+	RDD_READER *r;
+	int rc;
+
+	if ((rc = rdd_open_file_reader(&r, path, 0)) != RDD_OK) {
+		stripe_error("cannot open %s (%d)", path, rc);
+	}
+	return r;
+}
+
+/* Writes data[0..size) through a stripe writer with nstream streams,
+ * in pieces of varying size.
+ */
+static void
+write_striped(unsigned nstream, unsigned size)
+{
+	RDD_WRITER *streams[MAX_STREAM];
+	RDD_WRITER *w;
+	unsigned pos, len, i;
+	int rc;
+
+	for (i = 0; i < nstream; i++) {
+		streams[i] = open_output(paths[i]);
+	}
+	rc = rdd_open_stripe_writer(&w, streams, nstream, FRAME_SIZE);
+	if (rc != RDD_OK) {
+		stripe_error("rdd_open_stripe_writer() returned %d", rc);
+	}
+	for (pos = 0; pos < size; pos += len) {
+		len = 1 + (pos * 13) % 200000;
+		if (len > size - pos) {
+			len = size - pos;
+		}
+		if ((rc = rdd_writer_write(w, data + pos, len)) != RDD_OK) {
+			stripe_error("rdd_writer_write() returned %d", rc);
+		}
+	}
+	if ((rc = rdd_writer_close(w)) != RDD_OK) {
+		stripe_error("rdd_writer_close() returned %d", rc);
+	}
+}
+
+/* Reads the striped stream back; the streams are opened in the
+ * order given by perm.  Returns the status of the first failing
+ * read, or RDD_OK.
+ */
+static int
+read_striped(unsigned nstream, const unsigned *perm, unsigned *total)
+{
+	RDD_READER *streams[MAX_STREAM];
+	RDD_READER *r;
+	unsigned nread, len;
+	int rc;
+	unsigned i;
+
+	for (i = 0; i < nstream; i++) {
+		streams[i] = open_input(paths[perm[i]]);
+	}
+	if ((rc = rdd_open_stripe_reader(&r, streams, nstream)) != RDD_OK) {
+		stripe_error("rdd_open_stripe_reader() returned %d", rc);
+	}
+
+	*total = 0;
+	do {
+		len = 1 + (*total * 7) % 150000;
+		if (*total + len > DATA_SIZE) {
+			len = DATA_SIZE + 1 - *total;
+		}
+		rc = rdd_reader_read(r, result + *total, len, &nread);
+		if (rc != RDD_OK) {
+			break;
+		}
+		*total += nread;
+	} while (nread > 0);
+
+	rdd_reader_close(r, 1);
+	return rc;
+}
+
+static void
+test_roundtrip(unsigned nstream, unsigned size)
+{
+	static unsigned identity[] = {0, 1, 2, 3};
+	unsigned total;
+	int rc;
+
+	printf("testing %u stream(s), %u bytes......", nstream, size);
+
+	write_striped(nstream, size);
+	if ((rc = read_striped(nstream, identity, &total)) != RDD_OK) {
+		stripe_error("read failed (%d)", rc);
+	}
+	if (total != size || memcmp(data, result, size) != 0) {
+		stripe_error("data differs (read %u of %u bytes)", total, size);
+	}
+
+	printf("OK\n");
+}
+
+static void
+test_damage(void)
+{
+	static unsigned identity[] = {0, 1, 2};
+	static unsigned swapped[] = {1, 0, 2};
+	unsigned total;
+	int fd;
+
+	printf("testing damaged streams......");
+
+	write_striped(3, DATA_SIZE);
+	if (read_striped(3, swapped, &total) != RDD_ESYNTAX || total != 0) {
+		stripe_error("misordered streams not detected");
+	}
+
+	/* Drop the end frame of stream 2.
+	 */
+	if ((fd = open(paths[2], O_WRONLY)) < 0
+	||  ftruncate(fd, lseek(fd, 0, SEEK_END) - RDD_NET_FRAME_HDR_SIZE) < 0) {
+		stripe_error("cannot truncate %s", paths[2]);
+	}
+	close(fd);
+	if (read_striped(3, identity, &total) != RDD_ESYNTAX
+	||  total != DATA_SIZE) {
+		stripe_error("missing end frame not detected");
+	}
+
+	printf("OK\n");
+}
+
+static void
+test_headers(void)
+{
+	RDD_WRITER *w;
+	RDD_READER *r;
+	char *name = 0;
+	rdd_count_t filesize, blocksize, splitsize, session;
+	unsigned flags, nstream, index;
+	int rc;
+
+	printf("testing striped session headers......");
+
+	w = open_output(paths[0]);
+	rc = rdd_send_info(w, "image.dd", 1000000, 65536, 0,
+			RDD_NET_COMPRESS|RDD_NET_STRIPED, 3, 0x123456789abcULL);
+	if (rc != RDD_OK) {
+		stripe_error("rdd_send_info() returned %d", rc);
+	}
+	if ((rc = rdd_send_join(w, 0x123456789abcULL, 2, 0)) != RDD_OK) {
+		stripe_error("rdd_send_join() returned %d", rc);
+	}
+	if ((rc = rdd_send_join(w, 0x123456789abdULL, 1, 0)) != RDD_OK) {
+		stripe_error("rdd_send_join() returned %d", rc);
+	}
+	rdd_writer_close(w);
+
+	r = open_input(paths[0]);
+	rc = rdd_recv_info(r, &name, &filesize, &blocksize, &splitsize,
+			&flags, &nstream, &session);
+	if (rc != RDD_OK || strcmp(name, "image.dd") != 0
+	||  filesize != 1000000 || blocksize != 65536 || splitsize != 0
+	||  flags != (RDD_NET_COMPRESS|RDD_NET_STRIPED)
+	||  nstream != 3 || session != 0x123456789abcULL) {
+		stripe_error("bad request header (%d)", rc);
+	}
+	rc = rdd_recv_join(r, session, nstream, &index, &flags);
+	if (rc != RDD_OK || index != 2 || flags != RDD_NET_JOIN) {
+		stripe_error("bad join header (%d)", rc);
+	}
+	if (rdd_recv_join(r, session, nstream, &index, &flags) != RDD_BADARG) {
+		stripe_error("join header of another session accepted");
+	}
+	rdd_reader_close(r, 1);
+	free(name);
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_STREAM; i++) {
+		sprintf(paths[i], "tstripe.%u", i);
+	}
+	if ((data = malloc(DATA_SIZE)) == 0
+	||  (result = malloc(DATA_SIZE + 1)) == 0) {
+		stripe_error("out of memory");
+	}
+	srand(2020);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+
+	test_roundtrip(1, DATA_SIZE);
+	test_roundtrip(3, DATA_SIZE);
+	test_roundtrip(4, 5 * FRAME_SIZE);
+	test_roundtrip(2, 0);
+	test_damage();
+	test_headers();
+
+	cleanup();
+	free(data);
+	free(result);
+	return 0;
+}
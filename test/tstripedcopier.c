@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A unit-test for the striped copier.  It copies a test file with
+ * a robust copier and with striped copiers, with and without
+ * simulated read errors, and checks that the MD5 hash values and
+ * the copier statistics are the same.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "writer.h"
+#include "filter.h"
+#include "filterset.h"
+#include "copier.h"
+
+#define TEST_FILE   "tstripedcopier.dat"
+#define FAULT_FILE  "tstripedcopier.flt"
+#define FILE_SIZE   (200 * 1024 + 777)
+#define BLOCK_SIZE  4096
+#define MIN_BLOCK   512
+
+static void
+striped_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tstripedcopier] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static void
+create_files(void)
+{
+	FILE *fp;
+	unsigned i;
+
+	if ((fp = fopen(TEST_FILE, "wb")) == NULL) {
+		striped_error("cannot create %s", TEST_FILE);
+	}
+	srand(11);
+	for (i = 0; i < FILE_SIZE; i++) {
+		putc(rand() & 0xff, fp);
+	}
+	fclose(fp);
+
+	/* Faults in different chunks, so in different stripes.
+	 */
+	if ((fp = fopen(FAULT_FILE, "w")) == NULL) {
+		striped_error("cannot create %s", FAULT_FILE);
+	}
+	fprintf(fp, "1000 1.0\n");
+	fprintf(fp, "9000 1.0\n");
+	fprintf(fp, "13000 1.0\n");
+	fprintf(fp, "%u 1.0\n", FILE_SIZE - 100);
+	fclose(fp);
+}
+
+static int
+open_input(RDD_READER **r, void *env)
+{
+	int faulty = *((int *) env);
+	int rc;
+
+	if ((rc = rdd_open_file_reader(r, TEST_FILE, 0)) != RDD_OK) {
+		return rc;
+	}
+	if (faulty) {
+		rc = rdd_open_faulty_reader(r, *r, FAULT_FILE);
+	}
+	return rc;
+}
+
+/* Copies the test file with copier c and returns the MD5 hash.
+ */
+static int
+run_copier(RDD_COPIER *c, int faulty, unsigned char *md5,
+		RDD_COPIER_RETURN *ret)
+{
+	RDD_FILTERSET fset;
+	RDD_FILTER *f = 0;
+	RDD_READER *r = 0;
+	int rc;
+	int exec_rc;
+
+	if ((rc = rdd_fset_init(&fset)) != RDD_OK) {
+		striped_error("rdd_fset_init() returned %d", rc);
+	}
+	if ((rc = rdd_new_md5_streamfilter(&f)) != RDD_OK) {
+		striped_error("rdd_new_md5_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_fset_add(&fset, "md5", f)) != RDD_OK) {
+		striped_error("rdd_fset_add() returned %d", rc);
+	}
+	if ((rc = open_input(&r, &faulty)) != RDD_OK) {
+		striped_error("cannot open %s", TEST_FILE);
+	}
+
+	exec_rc = rdd_copy_exec(c, r, &fset, ret);
+	if (exec_rc == RDD_OK) {
+		if ((rc = rdd_filter_get_result(f, md5, 16)) != RDD_OK) {
+			striped_error("rdd_filter_get_result() returned %d", rc);
+		}
+	}
+
+	(void) rdd_reader_close(r, 1);
+	(void) rdd_fset_clear(&fset);
+	return exec_rc;
+}
+
+static void
+test_striped(unsigned nstripe, unsigned chunklen, int faulty,
+		unsigned maxsubst)
+{
+	RDD_ROBUST_PARAMS p;
+	RDD_COPIER_RETURN ret0, ret;
+	RDD_COPIER *c = 0;
+	unsigned char md0[16], md[16];
+	int rc0, rc;
+
+	printf("testing %u stripes, chunk size %u%s......", nstripe,
+		chunklen, faulty ? ", read errors" : "");
+
+	memset(&p, 0, sizeof p);
+	p.minblocklen = MIN_BLOCK;
+	p.maxblocklen = BLOCK_SIZE;
+	p.nretry = 1;
+	p.maxsubst = maxsubst;
+
+	if ((rc = rdd_new_robust_copier(&c, 0, FILE_SIZE, &p)) != RDD_OK) {
+		striped_error("rdd_new_robust_copier() returned %d", rc);
+	}
+	rc0 = run_copier(c, faulty, md0, &ret0);
+	rdd_copy_free(c);
+
+	rc = rdd_new_striped_copier(&c, 0, FILE_SIZE, nstripe, chunklen, 3,
+				open_input, &faulty, &p);
+	if (rc != RDD_OK) {
+		striped_error("rdd_new_striped_copier() returned %d", rc);
+	}
+	rc = run_copier(c, faulty, md, &ret);
+	rdd_copy_free(c);
+
+	if (rc != rc0) {
+		striped_error("striped copier returned %d instead of %d",
+			rc, rc0);
+	}
+	if (rc == RDD_OK) {
+		if (memcmp(md, md0, sizeof md) != 0) {
+			striped_error("MD5 hash values differ");
+		}
+		if (ret.nbyte != ret0.nbyte || ret.nlost != ret0.nlost
+		||  ret.nsubst != ret0.nsubst) {
+			striped_error("statistics differ");
+		}
+	}
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_files();
+
+	test_striped(1, BLOCK_SIZE, 0, 0);
+	test_striped(2, BLOCK_SIZE, 0, 0);
+	test_striped(3, 2 * BLOCK_SIZE, 0, 0);
+	test_striped(7, BLOCK_SIZE, 0, 0);
+	test_striped(2, BLOCK_SIZE, 1, 0);
+	test_striped(4, 2 * BLOCK_SIZE, 1, 0);
+	test_striped(4, BLOCK_SIZE, 1, 2);
+	test_striped(4, BLOCK_SIZE, 1, 1);
+	test_striped(4, BLOCK_SIZE, 1, 4);
+	test_striped(4, BLOCK_SIZE, 1, 5);
+
+	unlink(TEST_FILE);
+	unlink(FAULT_FILE);
+	return 0;
+}
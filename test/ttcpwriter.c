@@ -76,7 +76,7 @@ build_filterset(RDD_FILTERSET *fset)
 	}
 
 	rc = rdd_send_info(w, OUTPUT_FILE, size,
-			262144, 12345678901, flags);
+			262144, 12345678901, flags, 1, 0);
 	if (rc != RDD_OK) {
 		fprintf(stderr, "cannot send header to %s:%u", SERVER, PORT);
 		exit(-1);
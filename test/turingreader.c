@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* A unit-test for the io_uring reader.  It reads a test file with
+ * different request sizes and queue depths, seeks around, and
+ * compares everything it reads with the file contents.  It also
+ * simulates a bad sector, before which the device ends reads short;
+ * the read that covers the sector must fail rather than end the file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rdd.h"
+#include "reader.h"
+#include "uringreader_test.h"
+
+#define TEST_FILE  "turingreader.dat"
+#define FILE_SIZE  (300 * 1024 + 123)
+
+static unsigned char *contents;
+
+static void
+reader_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[turingreader] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	unlink(TEST_FILE);
+	exit(EXIT_FAILURE);
+}
+
+static void
+create_file(void)
+{
+	FILE *fp;
+	unsigned i;
+
+	if ((contents = malloc(FILE_SIZE)) == 0) {
+		reader_error("out of memory");
+	}
+	srand(7);
+	for (i = 0; i < FILE_SIZE; i++) {
+		contents[i] = rand() & 0xff;
+	}
+
+	if ((fp = fopen(TEST_FILE, "wb")) == NULL) {
+		reader_error("cannot create %s", TEST_FILE);
+	}
+	if (fwrite(contents, 1, FILE_SIZE, fp) != FILE_SIZE) {
+		reader_error("cannot write %s", TEST_FILE);
+	}
+	fclose(fp);
+}
+
+/* Reads nbyte bytes at the current position and checks them.
+ */
+static void
+check_read(RDD_READER *r, unsigned char *buf, unsigned nbyte)
+{
+	rdd_count_t pos;
+	unsigned expected;
+	unsigned nread;
+	int rc;
+
+	if ((rc = rdd_reader_tell(r, &pos)) != RDD_OK) {
+		reader_error("rdd_reader_tell() returned %d", rc);
+	}
+	if ((rc = rdd_reader_read(r, buf, nbyte, &nread)) != RDD_OK) {
+		reader_error("rdd_reader_read() returned %d", rc);
+	}
+
+	expected = pos >= FILE_SIZE ? 0 : FILE_SIZE - (unsigned) pos;
+	if (expected > nbyte) {
+		expected = nbyte;
+	}
+	if (nread != expected) {
+		reader_error("read %u bytes at %llu instead of %u",
+			nread, pos, expected);
+	}
+	if (memcmp(buf, contents + pos, nread) != 0) {
+		reader_error("bad data at offset %llu", pos);
+	}
+}
+
+static void
+test_reader(unsigned qdepth, unsigned blocksize)
+{
+	static const unsigned sizes[] = {512, 4096, 1000, 65536, 1, 8192};
+	RDD_READER *r = 0;
+	unsigned char *buf;
+	rdd_count_t pos;
+	unsigned i;
+	int fd;
+	int rc;
+
+	printf("testing queue depth %u, block size %u......",
+		qdepth, blocksize);
+
+	if ((buf = malloc(2 * blocksize)) == 0) {
+		reader_error("out of memory");
+	}
+	if ((fd = open(TEST_FILE, O_RDONLY)) < 0) {
+		reader_error("cannot open %s", TEST_FILE);
+	}
+	if ((rc = rdd_open_uring_reader(&r, fd, qdepth, blocksize)) != RDD_OK) {
+		reader_error("rdd_open_uring_reader() returned %d", rc);
+	}
+
+	/* Sequential reads of full blocks, until EOF.
+	 */
+	for (pos = 0; pos <= FILE_SIZE; pos += blocksize) {
+		check_read(r, buf, blocksize);
+	}
+
+	/* Back to the start; mix request sizes, including requests
+	 * that are larger than the maximum block size.
+	 */
+	if ((rc = rdd_reader_seek(r, 0)) != RDD_OK) {
+		reader_error("rdd_reader_seek() returned %d", rc);
+	}
+	for (i = 0; i < 200; i++) {
+		unsigned n = sizes[i % (sizeof sizes / sizeof sizes[0])];
+		check_read(r, buf, n <= 2 * blocksize ? n : 2 * blocksize);
+	}
+
+	/* Seek backwards (as the atomic reader does after an error)
+	 * and forwards.
+	 */
+	for (i = 0; i < 10; i++) {
+		pos = ((rdd_count_t) i * 104729) % FILE_SIZE;
+		if ((rc = rdd_reader_seek(r, pos)) != RDD_OK) {
+			reader_error("rdd_reader_seek() returned %d", rc);
+		}
+		check_read(r, buf, blocksize);
+		check_read(r, buf, blocksize / 2);
+	}
+
+	if ((rc = rdd_reader_close(r, 1)) != RDD_OK) {
+		reader_error("rdd_reader_close() returned %d", rc);
+	}
+	free(buf);
+
+	printf("OK\n");
+}
+
+static void
+test_bad_sector(unsigned qdepth, unsigned blocksize)
+{
+	RDD_READER *r = 0;
+	unsigned char *buf;
+	rdd_count_t bad = 10 * blocksize + 1024;
+	rdd_count_t pos;
+	unsigned nread;
+	int fd;
+	int rc;
+
+	printf("testing bad sector, queue depth %u......", qdepth);
+
+	if ((buf = malloc(blocksize)) == 0) {
+		reader_error("out of memory");
+	}
+	if ((fd = open(TEST_FILE, O_RDONLY)) < 0) {
+		reader_error("cannot open %s", TEST_FILE);
+	}
+	if ((rc = rdd_open_uring_reader(&r, fd, qdepth, blocksize)) != RDD_OK) {
+		reader_error("rdd_open_uring_reader() returned %d", rc);
+	}
+	if (rdd_uring_reader_simulate_error(r, bad) != RDD_OK) {
+		printf("no io_uring; skipped\n");
+		rdd_reader_close(r, 1);
+		free(buf);
+		return;
+	}
+
+	for (pos = 0; pos + blocksize <= bad; pos += blocksize) {
+		check_read(r, buf, blocksize);
+	}
+	rc = rdd_reader_read(r, buf, blocksize, &nread);
+	if (rc != RDD_EREAD) {
+		reader_error("read before bad sector returned %d (%u bytes)",
+			rc, rc == RDD_OK ? nread : 0);
+	}
+	if (rdd_reader_tell(r, &pos) != RDD_OK || pos != 10 * blocksize) {
+		reader_error("failed read moved the file position");
+	}
+
+	/* The data up to the bad sector, and after it, can be read.
+	 */
+	check_read(r, buf, 1024);
+	if (rdd_reader_read(r, buf, 512, &nread) != RDD_EREAD) {
+		reader_error("bad sector was read");
+	}
+	if ((rc = rdd_reader_seek(r, bad + 512)) != RDD_OK) {
+		reader_error("rdd_reader_seek() returned %d", rc);
+	}
+	for (pos = bad + 512; pos <= FILE_SIZE; pos += blocksize) {
+		check_read(r, buf, blocksize);
+	}
+
+	if ((rc = rdd_reader_close(r, 1)) != RDD_OK) {
+		reader_error("rdd_reader_close() returned %d", rc);
+	}
+	free(buf);
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	create_file();
+
+	test_reader(1, 4096);
+	test_reader(4, 4096);
+	test_reader(8, 32768);
+	test_reader(32, 65536);
+	test_bad_sector(1, 4096);
+	test_bad_sector(8, 4096);
+
+	unlink(TEST_FILE);
+	free(contents);
+	return 0;
+}
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2002 - 2006, Netherlands Forensic Institute
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/* A test of rdd-verify.  It writes an image and checksum files with
+ * the library's block filters, runs rdd-verify on them, and checks
+ * the blocks that it reports.  An image that is split over several
+ * files must verify like a single file, with and without read-ahead
+ * threads.  The sampling mode must select the same blocks for the
+ * same seed, report a corrupt block if and only if it is sampled,
+ * and report the missing blocks of a truncated image, for version-1
+ * and version-2 checksum files alike.  Finally, a manifest of images
+ * is verified with two jobs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include"config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "rdd.h"
+#include "writer.h"
+#include "filter.h"
+#include "checksumfile.h"
+#include "rdd_internals.h"
+
+#define VERIFY      "../src/rdd-verify"
+#define BLOCK_SIZE  4096
+#define NBLOCK      200
+#define NRECORD     (NBLOCK + 1)
+#define DATA_SIZE   (NBLOCK * BLOCK_SIZE + 1000)
+#define IMAGE_FILE  "tverify.img"
+#define V1_FILE     "tverify.crc1"
+#define V2_FILE     "tverify.crc2"
+#define LOG_FILE    "tverify.log"
+#define MANIFEST    "tverify.lst"
+#define NSAMPLE     20
+#define NPART       3
+#define NMANIFEST   4
+
+static unsigned char *data;
+
+static void
+cleanup(void)
+{
+	char path[64];
+	unsigned i;
+
+	unlink(IMAGE_FILE);
+	unlink(V1_FILE);
+	unlink(V2_FILE);
+	unlink(LOG_FILE);
+	unlink(MANIFEST);
+	for (i = 0; i < NPART || i < NMANIFEST; i++) {
+		sprintf(path, "%s.%u", IMAGE_FILE, i);
+		unlink(path);
+	}
+}
+
+static void
+verify_error(char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[tverify] ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+
+	cleanup();
+	exit(EXIT_FAILURE);
+}
+
+static void
+write_file(const char *path, const unsigned char *buf, unsigned size)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "wb")) == NULL) {
+		verify_error("cannot create %s", path);
+	}
+	if (size > 0 && fwrite(buf, size, 1, fp) != 1) {
+		verify_error("cannot write %s", path);
+	}
+	fclose(fp);
+}
+
+static void
+write_image(const unsigned char *buf, unsigned size)
+{
+	write_file(IMAGE_FILE, buf, size);
+}
+
+/* Computes the MD5 hash value of buf in hexadecimal.
+ */
+static void
+md5_hex(const unsigned char *buf, unsigned size, char *hex)
+{
+	unsigned char md[16];
+	RDD_FILTER *f;
+	int rc;
+
+	if ((rc = rdd_new_md5_streamfilter(&f)) != RDD_OK) {
+		verify_error("rdd_new_md5_streamfilter() returned %d", rc);
+	}
+	if ((rc = rdd_filter_push(f, buf, size)) != RDD_OK) {
+		verify_error("rdd_filter_push() returned %d", rc);
+	}
+	if ((rc = rdd_filter_close(f)) != RDD_OK) {
+		verify_error("rdd_filter_close() returned %d", rc);
+	}
+	if ((rc = rdd_filter_get_result(f, md, sizeof md)) != RDD_OK) {
+		verify_error("rdd_filter_get_result() returned %d", rc);
+	}
+	(void) rdd_filter_free(f);
+
+	if ((rc = rdd_buf2hex(md, sizeof md, hex, 2 * sizeof md + 1))
+	!= RDD_OK) {
+		verify_error("rdd_buf2hex() returned %d", rc);
+	}
+}
+
+/* Writes CRC32 checksum files of both versions for data.
+ */
+static void
+write_checksums(void)
+{
+	RDD_FILTER *f;
+	int version;
+	int rc;
+
+	for (version = 1; version <= 2; version++) {
+		if (version == 1) {
+			rc = rdd_new_crc32_blockfilter(&f, BLOCK_SIZE,
+					V1_FILE, RDD_OVERWRITE);
+		} else {
+			rc = rdd_new_checksum2_blockfilter(&f, RDD_CRC32,
+					BLOCK_SIZE, 0, V2_FILE, RDD_OVERWRITE, 0);
+		}
+		if (rc != RDD_OK) {
+			verify_error("cannot create checksum filter (%d)", rc);
+		}
+		if ((rc = rdd_filter_push(f, data, DATA_SIZE)) != RDD_OK) {
+			verify_error("rdd_filter_push() returned %d", rc);
+		}
+		if ((rc = rdd_filter_close(f)) != RDD_OK) {
+			verify_error("rdd_filter_close() returned %d", rc);
+		}
+		if ((rc = rdd_filter_free(f)) != RDD_OK) {
+			verify_error("rdd_filter_free() returned %d", rc);
+		}
+	}
+}
+
+/* Runs rdd-verify with the given arguments and returns its exit
+ * status.  Its messages go to LOG_FILE.
+ */
+static int
+run_verify(const char *args)
+{
+	char cmd[512];
+	int status;
+
+	sprintf(cmd, "%s %s >%s 2>&1", VERIFY, args, LOG_FILE);
+	status = system(cmd);
+	if (status == -1 || !WIFEXITED(status)) {
+		verify_error("cannot run %s", cmd);
+	}
+	return WEXITSTATUS(status);
+}
+
+/* Collects the offsets of the blocks reported by the last run.
+ * Only reports that contain pattern are counted.  Returns the number
+ * of reports.
+ */
+static unsigned
+reported_blocks(const char *pattern, rdd_count_t *offsets, unsigned max)
+{
+	char line[512];
+	unsigned long long pos;
+	unsigned n = 0;
+	char *p;
+	FILE *fp;
+
+	if ((fp = fopen(LOG_FILE, "r")) == NULL) {
+		verify_error("cannot open %s", LOG_FILE);
+	}
+	while (fgets(line, sizeof line, fp) != NULL) {
+		if ((p = strstr(line, "block offset ")) == 0
+		||  strstr(line, pattern) == 0) {
+			continue;
+		}
+		if (sscanf(p, "block offset %llu", &pos) != 1) {
+			verify_error("bad report: %s", line);
+		}
+		if (n < max) {
+			offsets[n] = (rdd_count_t) pos;
+		}
+		n++;
+	}
+	fclose(fp);
+
+	return n;
+}
+
+static int
+log_contains(const char *text)
+{
+	char line[512];
+	int found = 0;
+	FILE *fp;
+
+	if ((fp = fopen(LOG_FILE, "r")) == NULL) {
+		verify_error("cannot open %s", LOG_FILE);
+	}
+	while (!found && fgets(line, sizeof line, fp) != NULL) {
+		found = strstr(line, text) != 0;
+	}
+	fclose(fp);
+
+	return found;
+}
+
+/* Splits buf into NPART files whose boundaries do not coincide with
+ * block boundaries, and returns their names.
+ */
+static void
+write_parts(const unsigned char *buf, char *names)
+{
+	static unsigned ends[NPART] = {
+		5 * BLOCK_SIZE + 123, 77 * BLOCK_SIZE - 1, DATA_SIZE
+	};
+	char path[64];
+	unsigned i, start = 0;
+
+	names[0] = '\0';
+	for (i = 0; i < NPART; i++) {
+		sprintf(path, "%s.%u", IMAGE_FILE, i);
+		write_file(path, buf + start, ends[i] - start);
+		start = ends[i];
+		strcat(names, " ");
+		strcat(names, path);
+	}
+}
+
+static void
+test_split(const char *readahead)
+{
+	rdd_count_t found[NRECORD];
+	char names[256];
+	char args[512];
+	char hex[33];
+	unsigned pos = 77 * BLOCK_SIZE + 5;	/* in the last part */
+
+	printf("testing a split image, %s......", readahead);
+
+	md5_hex(data, DATA_SIZE, hex);
+	write_parts(data, names);
+	sprintf(args, "%s --crc32 %s --block-digest %s --md5 %s%s",
+		readahead, V1_FILE, V2_FILE, hex, names);
+	if (run_verify(args) != 0) {
+		verify_error("%s: good split image failed", readahead);
+	}
+
+	data[pos] ^= 0x1;
+	write_parts(data, names);
+	data[pos] ^= 0x1;
+	if (run_verify(args) == 0) {
+		verify_error("%s: corrupt split image passed", readahead);
+	}
+	if (reported_blocks("checksum error", found, NRECORD) != 2
+	||  found[0] != 77 * BLOCK_SIZE || found[1] != 77 * BLOCK_SIZE) {
+		verify_error("%s: corrupt block not reported", readahead);
+	}
+	if (!log_contains("MD5 verification failed")) {
+		verify_error("%s: MD5 mismatch not reported", readahead);
+	}
+
+	printf("OK\n");
+}
+
+static void
+test_sample(const char *option, const char *path)
+{
+	rdd_count_t sel[NRECORD], again[NRECORD], other[NRECORD];
+	rdd_count_t found[NRECORD];
+	unsigned char *bad;
+	char args[256];
+	char msg[64];
+	unsigned nsel, n, i;
+	unsigned victim;
+
+	printf("testing sampled verification, %s %s......", option, path);
+
+	/* In an image where every block is corrupt, every sampled
+	 * block is reported.
+	 */
+	if ((bad = malloc(DATA_SIZE)) == 0) {
+		verify_error("out of memory");
+	}
+	for (i = 0; i < DATA_SIZE; i++) {
+		bad[i] = data[i] ^ 0xff;
+	}
+	write_image(bad, DATA_SIZE);
+	free(bad);
+
+	sprintf(args, "%s %s --sample %u --seed 42 %s",
+		option, path, NSAMPLE, IMAGE_FILE);
+	if (run_verify(args) == 0) {
+		verify_error("%s: corrupt image passed", path);
+	}
+	nsel = reported_blocks("got 0x", sel, NRECORD);
+	sprintf(msg, "sampled %u of %u blocks (seed 42)", NSAMPLE, NRECORD);
+	if (!log_contains(msg)) {
+		verify_error("%s: bad sample size", path);
+	}
+	if (nsel != NSAMPLE) {
+		verify_error("%s: %u blocks reported, expected %u",
+			path, nsel, NSAMPLE);
+	}
+	for (i = 1; i < nsel; i++) {
+		if (sel[i] <= sel[i-1] || sel[i] % BLOCK_SIZE != 0) {
+			verify_error("%s: bad block offsets", path);
+		}
+	}
+
+	if (run_verify(args) == 0
+	||  reported_blocks("got 0x", again, NRECORD) != nsel
+	||  memcmp(sel, again, nsel * sizeof sel[0]) != 0) {
+		verify_error("%s: the same seed selected other blocks", path);
+	}
+
+	sprintf(args, "%s %s --sample %u --seed 43 %s",
+		option, path, NSAMPLE, IMAGE_FILE);
+	if (run_verify(args) == 0
+	||  reported_blocks("got 0x", other, NRECORD) != nsel) {
+		verify_error("%s: bad run with another seed", path);
+	}
+	if (memcmp(sel, other, nsel * sizeof sel[0]) == 0) {
+		verify_error("%s: another seed selected the same blocks",
+			path);
+	}
+
+	/* A good image passes.
+	 */
+	write_image(data, DATA_SIZE);
+	sprintf(args, "%s %s --sample %u --seed 42 %s",
+		option, path, NSAMPLE, IMAGE_FILE);
+	if (run_verify(args) != 0 || !log_contains("no mismatches")) {
+		verify_error("%s: good image failed", path);
+	}
+
+	/* A corrupt block is reported when it is sampled, and only
+	 * then.
+	 */
+	victim = (unsigned) (sel[NSAMPLE / 2] / BLOCK_SIZE);
+	data[victim * BLOCK_SIZE + 17] ^= 0x1;
+	write_image(data, DATA_SIZE);
+	data[victim * BLOCK_SIZE + 17] ^= 0x1;
+	if (run_verify(args) == 0
+	||  reported_blocks("got 0x", found, NRECORD) != 1
+	||  found[0] != (rdd_count_t) victim * BLOCK_SIZE) {
+		verify_error("%s: sampled corrupt block not reported", path);
+	}
+
+	for (victim = 0; victim < NRECORD; victim++) {
+		for (i = 0; i < nsel; i++) {
+			if (sel[i] == (rdd_count_t) victim * BLOCK_SIZE) break;
+		}
+		if (i >= nsel) break;
+	}
+	data[victim * BLOCK_SIZE + 17] ^= 0x1;
+	write_image(data, DATA_SIZE);
+	data[victim * BLOCK_SIZE + 17] ^= 0x1;
+	if (run_verify(args) != 0) {
+		verify_error("%s: unsampled corrupt block reported", path);
+	}
+
+	/* Sampling all blocks of a truncated image reports the
+	 * missing blocks.
+	 */
+	write_image(data, 100 * BLOCK_SIZE);
+	sprintf(args, "%s %s --sample 1.0 --seed 42 %s",
+		option, path, IMAGE_FILE);
+	if (run_verify(args) == 0) {
+		verify_error("%s: truncated image passed", path);
+	}
+	n = reported_blocks("no data", found, NRECORD);
+	if (n != NRECORD - 100 || found[0] != 100 * BLOCK_SIZE) {
+		verify_error("%s: %u missing blocks reported, expected %u",
+			path, n, NRECORD - 100);
+	}
+	if (reported_blocks("got 0x", found, NRECORD) != 0) {
+		verify_error("%s: good blocks of a truncated image reported",
+			path);
+	}
+
+	printf("OK\n");
+}
+
+/* Writes NMANIFEST different images and a manifest that lists their
+ * MD5 hash values; the value of image bad, if any, is wrong.
+ */
+static void
+write_manifest(int bad)
+{
+	char path[64];
+	char hex[33];
+	unsigned size;
+	unsigned i;
+	FILE *fp;
+
+	if ((fp = fopen(MANIFEST, "w")) == NULL) {
+		verify_error("cannot create %s", MANIFEST);
+	}
+	fprintf(fp, "# images\n");
+	for (i = 0; i < NMANIFEST; i++) {
+		sprintf(path, "%s.%u", IMAGE_FILE, i);
+		size = DATA_SIZE - i * 3 * BLOCK_SIZE - i;
+		write_file(path, data + i, size);
+		md5_hex(data + i, size, hex);
+		if ((int) i == bad) {
+			hex[0] = hex[0] == '0' ? '1' : '0';
+		}
+		fprintf(fp, "%s  %s\n", hex, path);
+	}
+	fclose(fp);
+}
+
+static void
+test_manifest(void)
+{
+	char args[256];
+	char msg[128];
+
+	printf("testing a manifest, 2 jobs......");
+
+	sprintf(args, "--manifest %s --jobs 2 -v", MANIFEST);
+
+	write_manifest(-1);
+	if (run_verify(args) != 0
+	||  !log_contains(IMAGE_FILE ".3: MD5 OK")) {
+		verify_error("good manifest failed");
+	}
+
+	write_manifest(2);
+	if (run_verify(args) == 0) {
+		verify_error("bad manifest passed");
+	}
+	sprintf(msg, "%s.2: MD5 values do not match", IMAGE_FILE);
+	if (!log_contains(msg)
+	||  !log_contains("1 of 4 images failed verification")) {
+		verify_error("bad image not reported");
+	}
+
+	printf("OK\n");
+}
+
+int
+main(void)
+{
+	unsigned i;
+
+	if (access(VERIFY, X_OK) != 0) {
+		verify_error("cannot find %s", VERIFY);
+	}
+	if ((data = malloc(DATA_SIZE)) == 0) {
+		verify_error("out of memory");
+	}
+	srand(1919);
+	for (i = 0; i < DATA_SIZE; i++) {
+		data[i] = rand() & 0xff;
+	}
+	write_checksums();
+
+	test_split("--read-ahead 0");
+	test_split("--read-ahead 3");
+	test_sample("--crc32", V1_FILE);
+	test_sample("--crc32", V2_FILE);
+	test_sample("--block-digest", V2_FILE);
+	test_manifest();
+
+	free(data);
+	cleanup();
+	return 0;
+}